@@ -0,0 +1,704 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <moxygen/MoQCapture.h>
+
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <folly/io/Cursor.h>
+#include <folly/logging/xlog.h>
+
+#include <fcntl.h>
+
+namespace {
+using namespace moxygen;
+
+constexpr folly::StringPiece kCaptureMagic{"MOQCAP1\0", 8};
+// Buffered before writing to the file
+constexpr size_t kFlushBytes = 64 * 1024;
+
+uint64_t payloadLength(const Payload& payload) {
+  return payload ? payload->computeChainDataLength() : 0;
+}
+
+// Throws std::out_of_range when the capture ends first
+uint64_t readVarint(folly::io::Cursor& cursor) {
+  auto value = decodeVarint(cursor);
+  if (!value) {
+    throw std::out_of_range("capture truncated");
+  }
+  return value->first;
+}
+
+std::string readString(folly::io::Cursor& cursor) {
+  auto length = readVarint(cursor);
+  if (!cursor.canAdvance(length)) {
+    throw std::out_of_range("capture truncated");
+  }
+  return cursor.readFixedString(length);
+}
+
+AbsoluteLocation readLocation(folly::io::Cursor& cursor) {
+  auto group = readVarint(cursor);
+  return {group, readVarint(cursor)};
+}
+
+// Throws std::out_of_range when the capture ends first, and
+// std::runtime_error on an unknown record
+MoQCaptureRecord readRecord(folly::io::Cursor& cursor) {
+  using Type = MoQCaptureRecord::Type;
+  MoQCaptureRecord record;
+  auto type = readVarint(cursor);
+  if (type > uint64_t(Type::SUBGROUP_END)) {
+    throw std::runtime_error(
+        folly::to<std::string>("unknown capture record type ", type));
+  }
+  record.type = Type(type);
+  record.time = std::chrono::microseconds(readVarint(cursor));
+  switch (record.type) {
+    case Type::TRACK: {
+      record.trackID = readVarint(cursor);
+      auto numElements = readVarint(cursor);
+      // Each takes at least its length
+      if (numElements > cursor.totalLength()) {
+        throw std::out_of_range("capture truncated");
+      }
+      std::vector<std::string> elements(numElements);
+      for (auto& element : elements) {
+        element = readString(cursor);
+      }
+      record.fullTrackName.trackNamespace =
+          TrackNamespace(std::move(elements));
+      record.fullTrackName.trackName = readString(cursor);
+      break;
+    }
+    case Type::SUBSCRIBE:
+      record.sessionID = readVarint(cursor);
+      record.requestID = readVarint(cursor);
+      record.trackID = readVarint(cursor);
+      record.locType = LocationType(readVarint(cursor));
+      record.start = readLocation(cursor);
+      record.end.group = readVarint(cursor);
+      record.priority = uint8_t(readVarint(cursor));
+      record.forward = readVarint(cursor) != 0;
+      break;
+    case Type::SUBSCRIBE_END:
+      record.sessionID = readVarint(cursor);
+      record.requestID = readVarint(cursor);
+      break;
+    case Type::FETCH:
+      record.sessionID = readVarint(cursor);
+      record.requestID = readVarint(cursor);
+      record.trackID = readVarint(cursor);
+      record.start = readLocation(cursor);
+      record.end = readLocation(cursor);
+      break;
+    case Type::SESSION_END:
+      record.sessionID = readVarint(cursor);
+      break;
+    case Type::OBJECT:
+      record.trackID = readVarint(cursor);
+      record.datagram = readVarint(cursor) != 0;
+      record.group = readVarint(cursor);
+      record.subgroup = readVarint(cursor);
+      record.objectID = readVarint(cursor);
+      record.priority = uint8_t(readVarint(cursor));
+      record.status = ObjectStatus(readVarint(cursor));
+      record.length = readVarint(cursor);
+      break;
+    case Type::SUBGROUP_END:
+      record.trackID = readVarint(cursor);
+      record.group = readVarint(cursor);
+      record.subgroup = readVarint(cursor);
+      break;
+  }
+  return record;
+}
+} // namespace
+
+namespace moxygen {
+
+class MoQCaptureWriter::RecordingSubgroup : public SubgroupConsumer {
+ public:
+  RecordingSubgroup(
+      std::shared_ptr<MoQCaptureWriter> writer,
+      uint64_t trackID,
+      uint64_t group,
+      uint64_t subgroup,
+      uint8_t priority,
+      std::shared_ptr<SubgroupConsumer> downstream)
+      : writer_(std::move(writer)),
+        trackID_(trackID),
+        group_(group),
+        subgroup_(subgroup),
+        priority_(priority),
+        downstream_(std::move(downstream)) {}
+
+  folly::Expected<folly::Unit, MoQPublishError> object(
+      uint64_t objectID,
+      Payload payload,
+      Extensions extensions,
+      bool finSubgroup) override {
+    record(objectID, ObjectStatus::NORMAL, payloadLength(payload));
+    if (finSubgroup) {
+      end();
+    }
+    return downstream_->object(
+        objectID, std::move(payload), std::move(extensions), finSubgroup);
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objects(
+      std::span<SubgroupObject> batch,
+      bool finSubgroup) override {
+    for (const auto& obj : batch) {
+      record(obj.objectID, ObjectStatus::NORMAL, payloadLength(obj.payload));
+    }
+    if (finSubgroup) {
+      end();
+    }
+    return downstream_->objects(batch, finSubgroup);
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objectNotExists(
+      uint64_t objectID,
+      Extensions extensions,
+      bool finSubgroup) override {
+    record(objectID, ObjectStatus::OBJECT_NOT_EXIST, 0);
+    if (finSubgroup) {
+      end();
+    }
+    return downstream_->objectNotExists(
+        objectID, std::move(extensions), finSubgroup);
+  }
+
+  void checkpoint() override {
+    downstream_->checkpoint();
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> beginObject(
+      uint64_t objectID,
+      uint64_t length,
+      Payload initialPayload,
+      Extensions extensions) override {
+    record(objectID, ObjectStatus::NORMAL, length);
+    return downstream_->beginObject(
+        objectID, length, std::move(initialPayload), std::move(extensions));
+  }
+
+  folly::Expected<ObjectPublishStatus, MoQPublishError> objectPayload(
+      Payload payload,
+      bool finSubgroup) override {
+    if (finSubgroup) {
+      end();
+    }
+    return downstream_->objectPayload(std::move(payload), finSubgroup);
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> endOfGroup(
+      uint64_t endOfGroupObjectID,
+      Extensions extensions) override {
+    record(endOfGroupObjectID, ObjectStatus::END_OF_GROUP, 0);
+    end();
+    return downstream_->endOfGroup(endOfGroupObjectID, std::move(extensions));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> endOfTrackAndGroup(
+      uint64_t endOfTrackObjectID,
+      Extensions extensions) override {
+    record(endOfTrackObjectID, ObjectStatus::END_OF_TRACK, 0);
+    end();
+    return downstream_->endOfTrackAndGroup(
+        endOfTrackObjectID, std::move(extensions));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> endOfSubgroup() override {
+    end();
+    return downstream_->endOfSubgroup();
+  }
+
+  void reset(ResetStreamErrorCode error) override {
+    end();
+    downstream_->reset(error);
+  }
+
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitReadyToConsume() override {
+    return downstream_->awaitReadyToConsume();
+  }
+
+ private:
+  void record(uint64_t objectID, ObjectStatus status, uint64_t length) {
+    writer_->object(
+        trackID_,
+        /*datagram=*/false,
+        group_,
+        subgroup_,
+        objectID,
+        priority_,
+        status,
+        length);
+  }
+
+  void end() {
+    if (!ended_) {
+      ended_ = true;
+      writer_->subgroupEnd(trackID_, group_, subgroup_);
+    }
+  }
+
+  std::shared_ptr<MoQCaptureWriter> writer_;
+  uint64_t trackID_;
+  uint64_t group_;
+  uint64_t subgroup_;
+  uint8_t priority_;
+  bool ended_{false};
+  std::shared_ptr<SubgroupConsumer> downstream_;
+};
+
+class MoQCaptureWriter::RecordingTrack : public TrackConsumer {
+ public:
+  RecordingTrack(
+      std::shared_ptr<MoQCaptureWriter> writer,
+      uint64_t trackID,
+      std::shared_ptr<TrackConsumer> downstream)
+      : writer_(std::move(writer)),
+        trackID_(trackID),
+        downstream_(std::move(downstream)) {}
+
+  folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
+  beginSubgroup(uint64_t groupID, uint64_t subgroupID, Priority priority)
+      override {
+    auto subgroup = downstream_->beginSubgroup(groupID, subgroupID, priority);
+    if (!subgroup) {
+      return subgroup;
+    }
+    return std::make_shared<RecordingSubgroup>(
+        writer_,
+        trackID_,
+        groupID,
+        subgroupID,
+        priority,
+        std::move(*subgroup));
+  }
+
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitStreamCredit() override {
+    return downstream_->awaitStreamCredit();
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objectStream(
+      const ObjectHeader& header,
+      Payload payload) override {
+    record(header, /*datagram=*/false, payloadLength(payload));
+    writer_->subgroupEnd(trackID_, header.group, header.subgroup);
+    return downstream_->objectStream(header, std::move(payload));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> datagram(
+      const ObjectHeader& header,
+      Payload payload) override {
+    record(header, /*datagram=*/true, payloadLength(payload));
+    return downstream_->datagram(header, std::move(payload));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> groupNotExists(
+      uint64_t groupID,
+      uint64_t subgroup,
+      Priority pri,
+      Extensions extensions) override {
+    writer_->object(
+        trackID_,
+        /*datagram=*/false,
+        groupID,
+        subgroup,
+        0,
+        pri,
+        ObjectStatus::GROUP_NOT_EXIST,
+        0);
+    return downstream_->groupNotExists(
+        groupID, subgroup, pri, std::move(extensions));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> subscribeDone(
+      SubscribeDone subDone) override {
+    return downstream_->subscribeDone(std::move(subDone));
+  }
+
+ private:
+  void record(const ObjectHeader& header, bool datagram, uint64_t length) {
+    writer_->object(
+        trackID_,
+        datagram,
+        header.group,
+        header.subgroup,
+        header.id,
+        header.priority,
+        header.status,
+        length);
+  }
+
+  std::shared_ptr<MoQCaptureWriter> writer_;
+  uint64_t trackID_;
+  std::shared_ptr<TrackConsumer> downstream_;
+};
+
+class MoQCaptureWriter::SubscriberConsumer : public TrackConsumer {
+ public:
+  SubscriberConsumer(
+      std::shared_ptr<MoQCaptureWriter> writer,
+      uint64_t sessionID,
+      RequestID requestID,
+      std::shared_ptr<TrackConsumer> downstream)
+      : writer_(std::move(writer)),
+        sessionID_(sessionID),
+        requestID_(requestID),
+        downstream_(std::move(downstream)) {}
+
+  ~SubscriberConsumer() override {
+    writer_->subscribeEnd(sessionID_, requestID_);
+  }
+
+  folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
+  beginSubgroup(uint64_t groupID, uint64_t subgroupID, Priority priority)
+      override {
+    return downstream_->beginSubgroup(groupID, subgroupID, priority);
+  }
+
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitStreamCredit() override {
+    return downstream_->awaitStreamCredit();
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objectStream(
+      const ObjectHeader& header,
+      Payload payload) override {
+    return downstream_->objectStream(header, std::move(payload));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> datagram(
+      const ObjectHeader& header,
+      Payload payload) override {
+    return downstream_->datagram(header, std::move(payload));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> groupNotExists(
+      uint64_t groupID,
+      uint64_t subgroup,
+      Priority pri,
+      Extensions extensions) override {
+    return downstream_->groupNotExists(
+        groupID, subgroup, pri, std::move(extensions));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> subscribeDone(
+      SubscribeDone subDone) override {
+    return downstream_->subscribeDone(std::move(subDone));
+  }
+
+ private:
+  std::shared_ptr<MoQCaptureWriter> writer_;
+  uint64_t sessionID_;
+  RequestID requestID_;
+  std::shared_ptr<TrackConsumer> downstream_;
+};
+
+std::shared_ptr<MoQCaptureWriter> MoQCaptureWriter::open(
+    const std::string& path) {
+  folly::File file;
+  try {
+    file = folly::File(path, O_WRONLY | O_CREAT | O_TRUNC);
+  } catch (const std::exception& ex) {
+    XLOG(ERR) << "Can't create capture " << path << " err=" << ex.what();
+    return nullptr;
+  }
+  return std::make_shared<MoQCaptureWriter>(std::move(file));
+}
+
+MoQCaptureWriter::MoQCaptureWriter(folly::File file) : file_(std::move(file)) {
+  buf_.append(kCaptureMagic.data(), kCaptureMagic.size());
+}
+
+MoQCaptureWriter::~MoQCaptureWriter() {
+  flush();
+}
+
+std::shared_ptr<TrackConsumer> MoQCaptureWriter::subscribe(
+    const void* session,
+    const SubscribeRequest& subReq,
+    std::shared_ptr<TrackConsumer> consumer) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!openLocked()) {
+    return consumer;
+  }
+  auto sessionID = sessionIDLocked(session);
+  auto trackID = trackIDLocked(subReq.fullTrackName);
+  beginRecord(MoQCaptureRecord::Type::SUBSCRIBE);
+  appendVarint(sessionID);
+  appendVarint(subReq.requestID.value);
+  appendVarint(trackID);
+  appendVarint(folly::to_underlying(subReq.locType));
+  auto start = subReq.start.value_or(AbsoluteLocation{0, 0});
+  appendVarint(start.group);
+  appendVarint(start.object);
+  appendVarint(
+      subReq.locType == LocationType::AbsoluteRange ? subReq.endGroup : 0);
+  appendVarint(subReq.priority);
+  appendVarint(subReq.forward ? 1 : 0);
+  maybeFlushLocked();
+  lock.unlock();
+  return std::make_shared<SubscriberConsumer>(
+      shared_from_this(), sessionID, subReq.requestID, std::move(consumer));
+}
+
+void MoQCaptureWriter::subscribeEnd(uint64_t sessionID, RequestID requestID) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!openLocked()) {
+    return;
+  }
+  beginRecord(MoQCaptureRecord::Type::SUBSCRIBE_END);
+  appendVarint(sessionID);
+  appendVarint(requestID.value);
+  maybeFlushLocked();
+}
+
+void MoQCaptureWriter::fetch(
+    const void* session,
+    RequestID requestID,
+    const FullTrackName& ftn,
+    AbsoluteLocation start,
+    AbsoluteLocation end) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!openLocked()) {
+    return;
+  }
+  auto sessionID = sessionIDLocked(session);
+  auto trackID = trackIDLocked(ftn);
+  beginRecord(MoQCaptureRecord::Type::FETCH);
+  appendVarint(sessionID);
+  appendVarint(requestID.value);
+  appendVarint(trackID);
+  appendVarint(start.group);
+  appendVarint(start.object);
+  appendVarint(end.group);
+  appendVarint(end.object);
+  maybeFlushLocked();
+}
+
+void MoQCaptureWriter::sessionEnd(const void* session) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!openLocked()) {
+    return;
+  }
+  auto it = sessionIDs_.find(session);
+  if (it == sessionIDs_.end()) {
+    // Never made a request
+    return;
+  }
+  beginRecord(MoQCaptureRecord::Type::SESSION_END);
+  appendVarint(it->second);
+  sessionIDs_.erase(it);
+  maybeFlushLocked();
+}
+
+std::shared_ptr<TrackConsumer> MoQCaptureWriter::recordObjects(
+    const FullTrackName& ftn,
+    std::shared_ptr<TrackConsumer> consumer) {
+  uint64_t trackID = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!openLocked()) {
+      return consumer;
+    }
+    trackID = trackIDLocked(ftn);
+  }
+  return std::make_shared<RecordingTrack>(
+      shared_from_this(), trackID, std::move(consumer));
+}
+
+void MoQCaptureWriter::object(
+    uint64_t trackID,
+    bool datagram,
+    uint64_t group,
+    uint64_t subgroup,
+    uint64_t objectID,
+    uint8_t priority,
+    ObjectStatus status,
+    uint64_t length) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!openLocked()) {
+    return;
+  }
+  beginRecord(MoQCaptureRecord::Type::OBJECT);
+  appendVarint(trackID);
+  appendVarint(datagram ? 1 : 0);
+  appendVarint(group);
+  appendVarint(subgroup);
+  appendVarint(objectID);
+  appendVarint(priority);
+  appendVarint(folly::to_underlying(status));
+  appendVarint(length);
+  maybeFlushLocked();
+}
+
+void MoQCaptureWriter::subgroupEnd(
+    uint64_t trackID,
+    uint64_t group,
+    uint64_t subgroup) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!openLocked()) {
+    return;
+  }
+  beginRecord(MoQCaptureRecord::Type::SUBGROUP_END);
+  appendVarint(trackID);
+  appendVarint(group);
+  appendVarint(subgroup);
+  maybeFlushLocked();
+}
+
+bool MoQCaptureWriter::flush() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    flushLocked();
+  }
+  // Written in order, after what was handed to the writer before
+  writer_.getEventBase()->runInEventBaseThreadAndWait([] {});
+  return !writeFailed_.load(std::memory_order_acquire);
+}
+
+bool MoQCaptureWriter::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!openLocked()) {
+      return false;
+    }
+    open_ = false;
+    flushLocked();
+  }
+  bool res = false;
+  writer_.getEventBase()->runInEventBaseThreadAndWait([this, &res] {
+    res = !writeFailed_.load(std::memory_order_acquire);
+    if (file_) {
+      file_.close();
+    }
+  });
+  return res;
+}
+
+void MoQCaptureWriter::beginRecord(MoQCaptureRecord::Type type) {
+  auto now = std::chrono::steady_clock::now();
+  if (!started_) {
+    started_ = true;
+    lastRecord_ = now;
+  }
+  appendVarint(folly::to_underlying(type));
+  appendVarint(
+      std::chrono::duration_cast<std::chrono::microseconds>(now - lastRecord_)
+          .count());
+  lastRecord_ = now;
+}
+
+uint64_t MoQCaptureWriter::trackIDLocked(const FullTrackName& ftn) {
+  auto [it, inserted] = trackIDs_.emplace(ftn, trackIDs_.size());
+  if (inserted) {
+    beginRecord(MoQCaptureRecord::Type::TRACK);
+    appendVarint(it->second);
+    appendVarint(ftn.trackNamespace.size());
+    for (const auto& element : ftn.trackNamespace.elements()) {
+      appendString(element);
+    }
+    appendString(ftn.trackName);
+  }
+  return it->second;
+}
+
+uint64_t MoQCaptureWriter::sessionIDLocked(const void* session) {
+  auto it = sessionIDs_.find(session);
+  if (it == sessionIDs_.end()) {
+    it = sessionIDs_.emplace(session, nextSessionID_++).first;
+  }
+  return it->second;
+}
+
+void MoQCaptureWriter::appendVarint(uint64_t value) {
+  size_t size = 0;
+  bool error = false;
+  ::moxygen::writeVarint(buf_, value, size, error);
+}
+
+void MoQCaptureWriter::appendString(const std::string& str) {
+  appendVarint(str.size());
+  buf_.append(str.data(), str.size());
+}
+
+void MoQCaptureWriter::maybeFlushLocked() {
+  if (buf_.chainLength() >= kFlushBytes) {
+    flushLocked();
+  }
+}
+
+void MoQCaptureWriter::flushLocked() {
+  if (buf_.empty()) {
+    return;
+  }
+  writer_.getEventBase()->runInEventBaseThread(
+      [this, chain = buf_.move()]() mutable { write(std::move(chain)); });
+}
+
+void MoQCaptureWriter::write(std::unique_ptr<folly::IOBuf> chain) {
+  if (!file_) {
+    return;
+  }
+  for (auto range : *chain) {
+    if (folly::writeFull(file_.fd(), range.data(), range.size()) !=
+        ssize_t(range.size())) {
+      XLOG(ERR) << "Capture write failed err=" << folly::errnoStr(errno);
+      // Later records would be misaligned with what was written
+      file_.close();
+      writeFailed_.store(true, std::memory_order_release);
+      return;
+    }
+  }
+}
+
+folly::Expected<std::vector<MoQCaptureRecord>, std::runtime_error>
+parseCapture(const folly::IOBuf& capture) {
+  folly::io::Cursor cursor(&capture);
+  if (!cursor.canAdvance(kCaptureMagic.size()) ||
+      folly::StringPiece(cursor.readFixedString(kCaptureMagic.size())) !=
+          kCaptureMagic) {
+    return folly::makeUnexpected(std::runtime_error("bad capture magic"));
+  }
+  std::vector<MoQCaptureRecord> records;
+  std::chrono::microseconds time{0};
+  while (!cursor.isAtEnd()) {
+    try {
+      auto record = readRecord(cursor);
+      time += record.time;
+      record.time = time;
+      records.push_back(std::move(record));
+    } catch (const std::out_of_range&) {
+      XLOG(WARN) << "Capture truncated after " << records.size()
+                 << " records";
+      break;
+    } catch (const std::runtime_error& ex) {
+      return folly::makeUnexpected(std::runtime_error(ex.what()));
+    }
+  }
+  return records;
+}
+
+folly::Expected<std::vector<MoQCaptureRecord>, std::runtime_error>
+readCapture(const std::string& path) {
+  std::string contents;
+  if (!folly::readFile(path.c_str(), contents)) {
+    return folly::makeUnexpected(std::runtime_error(
+        folly::to<std::string>("Can't read capture ", path)));
+  }
+  auto buf = folly::IOBuf::wrapBufferAsValue(contents.data(), contents.size());
+  return parseCapture(buf);
+}
+
+} // namespace moxygen
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/File.h>
+#include <folly/container/F14Map.h>
+#include <folly/io/async/ScopedEventBaseThread.h>
+#include <moxygen/MoQConsumers.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace moxygen {
+
+/*
+ * A capture of the load on a relay: the requests of downstream sessions and
+ * the metadata of every object received upstream, without payloads, so the
+ * load can be replayed against another build, see moqtest/MoQCaptureReplay.h.
+ *
+ * The file is a magic followed by records, each its type, the microseconds
+ * since the previous record and its fields, all QUIC varints.  A TRACK
+ * record names a track before other records refer to it by ID.
+ */
+struct MoQCaptureRecord {
+  enum class Type : uint8_t {
+    TRACK = 0,
+    SUBSCRIBE = 1,
+    SUBSCRIBE_END = 2,
+    FETCH = 3,
+    SESSION_END = 4,
+    OBJECT = 5,
+    SUBGROUP_END = 6,
+  };
+
+  Type type{Type::TRACK};
+  // Since the first record
+  std::chrono::microseconds time{0};
+  // SUBSCRIBE, SUBSCRIBE_END, FETCH and SESSION_END
+  uint64_t sessionID{0};
+  uint64_t requestID{0};
+  // All but SUBSCRIBE_END and SESSION_END
+  uint64_t trackID{0};
+  // TRACK
+  FullTrackName fullTrackName;
+  // SUBSCRIBE and FETCH.  end is exclusive for a FETCH, end.group is the
+  // SUBSCRIBE end group.
+  LocationType locType{LocationType::LatestObject};
+  AbsoluteLocation start;
+  AbsoluteLocation end;
+  bool forward{true};
+  // SUBSCRIBE and OBJECT
+  uint8_t priority{kDefaultPriority};
+  // OBJECT and SUBGROUP_END
+  bool datagram{false};
+  uint64_t group{0};
+  uint64_t subgroup{0};
+  uint64_t objectID{0};
+  ObjectStatus status{ObjectStatus::NORMAL};
+  // Payload bytes
+  uint64_t length{0};
+};
+
+// Safe to use from several threads, records are ordered by a lock.  Records
+// are buffered and handed in blocks to a thread of the writer's own, so
+// recording never blocks on the file, and written on destruction.
+class MoQCaptureWriter
+    : public std::enable_shared_from_this<MoQCaptureWriter> {
+ public:
+  // nullptr if path can't be created
+  static std::shared_ptr<MoQCaptureWriter> open(const std::string& path);
+
+  explicit MoQCaptureWriter(folly::File file);
+  ~MoQCaptureWriter();
+  MoQCaptureWriter(const MoQCaptureWriter&) = delete;
+  MoQCaptureWriter& operator=(const MoQCaptureWriter&) = delete;
+
+  // Sessions are identified by address until sessionEnd.  Returns consumer
+  // wrapped to record SUBSCRIBE_END when the subscription lets go of it.
+  std::shared_ptr<TrackConsumer> subscribe(
+      const void* session,
+      const SubscribeRequest& subReq,
+      std::shared_ptr<TrackConsumer> consumer);
+  void fetch(
+      const void* session,
+      RequestID requestID,
+      const FullTrackName& ftn,
+      AbsoluteLocation start,
+      AbsoluteLocation end);
+  void sessionEnd(const void* session);
+
+  // Wraps consumer to record the objects passed to it
+  std::shared_ptr<TrackConsumer> recordObjects(
+      const FullTrackName& ftn,
+      std::shared_ptr<TrackConsumer> consumer);
+
+  // For the recording consumers
+  void object(
+      uint64_t trackID,
+      bool datagram,
+      uint64_t group,
+      uint64_t subgroup,
+      uint64_t objectID,
+      uint8_t priority,
+      ObjectStatus status,
+      uint64_t length);
+  void subgroupEnd(uint64_t trackID, uint64_t group, uint64_t subgroup);
+
+  // Writes buffered records to the file and waits for them, false on I/O
+  // errors
+  bool flush();
+
+  // Flushes and closes the file, later records are dropped.  False on I/O
+  // errors or if already closed.
+  bool close();
+
+ private:
+  class RecordingTrack;
+  class RecordingSubgroup;
+  class SubscriberConsumer;
+
+  void subscribeEnd(uint64_t sessionID, RequestID requestID);
+
+  // Requires mutex_
+  bool openLocked() const {
+    return open_ && !writeFailed_.load(std::memory_order_acquire);
+  }
+  void beginRecord(MoQCaptureRecord::Type type);
+  uint64_t trackIDLocked(const FullTrackName& ftn);
+  uint64_t sessionIDLocked(const void* session);
+  void appendVarint(uint64_t value);
+  void appendString(const std::string& str);
+  void maybeFlushLocked();
+  // Hands the buffered records to writer_
+  void flushLocked();
+  // On writer_
+  void write(std::unique_ptr<folly::IOBuf> chain);
+
+  std::mutex mutex_;
+  bool open_{true};
+  folly::IOBufQueue buf_{folly::IOBufQueue::cacheChainLength()};
+  std::chrono::steady_clock::time_point lastRecord_;
+  bool started_{false};
+  folly::F14FastMap<FullTrackName, uint64_t, FullTrackName::hash> trackIDs_;
+  folly::F14FastMap<const void*, uint64_t> sessionIDs_;
+  uint64_t nextSessionID_{0};
+  // Only used on writer_
+  folly::File file_;
+  // Set on writer_, later records are dropped
+  std::atomic<bool> writeFailed_{false};
+  // Last, so it stops before what it writes goes
+  folly::ScopedEventBaseThread writer_{"MoQCapture"};
+};
+
+// Records of a capture in order, or the error that stopped parsing.  A
+// record cut short at the end, by a writer that didn't flush, is dropped.
+folly::Expected<std::vector<MoQCaptureRecord>, std::runtime_error>
+parseCapture(const folly::IOBuf& capture);
+folly::Expected<std::vector<MoQCaptureRecord>, std::runtime_error>
+readCapture(const std::string& path);
+
+} // namespace moxygen
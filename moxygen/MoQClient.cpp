@@ -7,6 +7,7 @@
 #include <moxygen/MoQClient.h>
 
 #include <moxygen/util/QuicConnector.h>
+#include <moxygen/util/QuicTransportMetrics.h>
 
 #include <quic/api/QuicSocket.h>
 #include <quic/client/QuicClientTransport.h>
@@ -52,30 +53,77 @@ folly::coro::Task<void> MoQClient::setupMoQSession(
       connect_timeout,
       std::make_shared<
           proxygen::InsecureVerifierDangerousDoNotUseInProduction>(),
-      "moq-00");
+      "moq-00",
+      resumptionCache_ ? resumptionCache_->pskCache() : nullptr,
+      url_.getHost());
 
+  transportMetricsProvider_ = quicTransportMetricsProvider(quicClient);
   // Make WebTransport object
   quicWebTransport_ =
       std::make_shared<proxygen::QuicWebTransport>(std::move(quicClient));
   quicWebTransport_->setHandler(this);
   wt = quicWebTransport_.get();
-  co_await completeSetupMoQSession(
+  auto expected = resumptionCache_
+      ? resumptionCache_->getServerSetup(serverKey())
+      : folly::none;
+  if (expected) {
+    // Don't wait a round trip for SERVER_SETUP, the caller's first requests
+    // go out right behind CLIENT_SETUP
+    createMoQSession(
+        wt, std::move(publishHandler), std::move(subscribeHandler));
+    auto setupFuture = moqSession_->setupOptimistic(
+        getClientSetup(url_.getPath()), std::move(*expected));
+    folly::coro::co_invoke(
+        [setupFuture = std::move(setupFuture),
+         cache = resumptionCache_,
+         key = serverKey()]() mutable -> folly::coro::Task<void> {
+          auto serverSetup =
+              co_await folly::coro::co_awaitTry(std::move(setupFuture));
+          if (serverSetup.hasException()) {
+            cache->removeServerSetup(key);
+          } else {
+            cache->putServerSetup(key, std::move(*serverSetup));
+          }
+        })
+        .scheduleOn(evb_)
+        .start();
+    co_return;
+  }
+  auto serverSetup = co_await completeSetupMoQSession(
       wt,
       url_.getPath(),
       std::move(publishHandler),
       std::move(subscribeHandler));
+  if (resumptionCache_) {
+    resumptionCache_->putServerSetup(serverKey(), std::move(serverSetup));
+  }
 }
 
-folly::coro::Task<ServerSetup> MoQClient::completeSetupMoQSession(
+void MoQClient::createMoQSession(
     proxygen::WebTransport* wt,
-    folly::Optional<std::string> pathParam,
     std::shared_ptr<Publisher> publishHandler,
     std::shared_ptr<Subscriber> subscribeHandler) {
   //  Create MoQSession and Setup MoQSession parameters
   moqSession_ = std::make_shared<MoQSession>(wt, evb_);
   moqSession_->setPublishHandler(std::move(publishHandler));
   moqSession_->setSubscribeHandler(std::move(subscribeHandler));
+  if (transportMetricsProvider_) {
+    moqSession_->setTransportMetricsProvider(transportMetricsProvider_);
+  }
   moqSession_->start();
+}
+
+std::string MoQClient::serverKey() const {
+  return folly::to<std::string>(url_.getHost(), ":", url_.getPort());
+}
+
+folly::coro::Task<ServerSetup> MoQClient::completeSetupMoQSession(
+    proxygen::WebTransport* wt,
+    folly::Optional<std::string> pathParam,
+    std::shared_ptr<Publisher> publishHandler,
+    std::shared_ptr<Subscriber> subscribeHandler) {
+  createMoQSession(
+      wt, std::move(publishHandler), std::move(subscribeHandler));
   return moqSession_->setup(getClientSetup(pathParam));
 }
 
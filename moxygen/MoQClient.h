@@ -9,14 +9,48 @@
 #include <moxygen/MoQSession.h>
 
 #include <folly/coro/Promise.h>
+#include <folly/container/F14Map.h>
 #include <proxygen/lib/http/webtransport/QuicWebTransport.h>
 #include <proxygen/lib/http/webtransport/WebTransport.h>
 #include <proxygen/lib/utils/URL.h>
+#include <quic/fizz/client/handshake/QuicPskCache.h>
 
 namespace moxygen {
 
 class Subscriber;
 
+// Remembers what a reconnecting client needs to skip round trips: the TLS
+// tickets for 0-RTT and the last SERVER_SETUP of each server.  Shared by
+// clients on one EventBase, not thread safe.
+class MoQResumptionCache {
+ public:
+  std::shared_ptr<quic::QuicPskCache> pskCache() const {
+    return pskCache_;
+  }
+
+  folly::Optional<ServerSetup> getServerSetup(
+      const std::string& server) const {
+    auto it = serverSetups_.find(server);
+    if (it == serverSetups_.end()) {
+      return folly::none;
+    }
+    return it->second;
+  }
+
+  void putServerSetup(const std::string& server, ServerSetup setup) {
+    serverSetups_.insert_or_assign(server, std::move(setup));
+  }
+
+  void removeServerSetup(const std::string& server) {
+    serverSetups_.erase(server);
+  }
+
+ private:
+  std::shared_ptr<quic::QuicPskCache> pskCache_{
+      std::make_shared<quic::BasicQuicPskCache>()};
+  folly::F14FastMap<std::string, ServerSetup> serverSetups_;
+};
+
 class MoQClient : public proxygen::WebTransportHandler {
  public:
   MoQClient(folly::EventBase* evb, proxygen::URL url)
@@ -26,6 +60,12 @@ class MoQClient : public proxygen::WebTransportHandler {
     return evb_;
   }
 
+  // Resume with 0-RTT when a ticket is cached, and send requests before
+  // SERVER_SETUP when this server's setup is known.
+  void setResumptionCache(std::shared_ptr<MoQResumptionCache> cache) {
+    resumptionCache_ = std::move(cache);
+  }
+
   std::shared_ptr<MoQSession> moqSession_;
   virtual folly::coro::Task<void> setupMoQSession(
       std::chrono::milliseconds connect_timeout,
@@ -40,6 +80,11 @@ class MoQClient : public proxygen::WebTransportHandler {
       std::shared_ptr<Publisher> publishHandler,
       std::shared_ptr<Subscriber> subscribeHandler);
   ClientSetup getClientSetup(const folly::Optional<std::string>& path);
+  void createMoQSession(
+      proxygen::WebTransport* wt,
+      std::shared_ptr<Publisher> publishHandler,
+      std::shared_ptr<Subscriber> subscribeHandler);
+  std::string serverKey() const;
 
   void onSessionEnd(folly::Optional<uint32_t>) override;
   void onNewBidiStream(
@@ -51,6 +96,9 @@ class MoQClient : public proxygen::WebTransportHandler {
   folly::EventBase* evb_{nullptr};
   proxygen::URL url_;
   std::shared_ptr<proxygen::QuicWebTransport> quicWebTransport_;
+  std::shared_ptr<MoQResumptionCache> resumptionCache_;
+  // Installed on each session, when the transport can report congestion state
+  MoQSession::TransportMetricsProvider transportMetricsProvider_;
 };
 
 } // namespace moxygen
@@ -5,11 +5,17 @@
  */
 
 #include "moxygen/MoQCodec.h"
+#include "moxygen/util/Trace.h"
 
 #include <folly/logging/xlog.h>
 
 #include <iomanip>
 
+namespace {
+// Cursor target when all ingress has been consumed
+const folly::IOBuf kEmptyIngress;
+} // namespace
+
 namespace moxygen {
 
 void MoQCodec::onIngressStart(std::unique_ptr<folly::IOBuf> data) {
@@ -126,6 +132,7 @@ void MoQCodec::onIngressEnd(
     if (connError_.value() == ErrorCode::PARSE_UNDERFLOW && !eom) {
       ingress_.trimStart(ingress_.chainLength() - remainingLength);
       connError_.reset();
+      accountIngress();
       return;
     } else if (callback) {
       XLOG(ERR) << "Conn error=" << uint32_t(*connError_);
@@ -134,6 +141,35 @@ void MoQCodec::onIngressEnd(
   }
   // we parsed everything, or connection error
   ingress_.move();
+  accountIngress();
+}
+
+void MoQCodec::setIngressAccounting(std::shared_ptr<uint64_t> total) {
+  if (ingressTotal_) {
+    *ingressTotal_ -= accountedIngress_;
+  }
+  ingressTotal_ = std::move(total);
+  accountedIngress_ = 0;
+  accountIngress();
+}
+
+void MoQCodec::accountIngress() {
+  if (!ingressTotal_) {
+    return;
+  }
+  auto buffered = ingress_.chainLength();
+  *ingressTotal_ = *ingressTotal_ - accountedIngress_ + buffered;
+  accountedIngress_ = buffered;
+}
+
+std::unique_ptr<folly::IOBuf> MoQObjectStreamCodec::splitPayload(
+    folly::io::Cursor& cursor,
+    uint64_t maxLength) {
+  ingress_.trimStart(ingress_.chainLength() - cursor.totalLength());
+  auto payload = ingress_.splitAtMost(maxLength);
+  cursor = folly::io::Cursor(
+      ingress_.empty() ? &kEmptyIngress : ingress_.front());
+  return payload;
 }
 
 void MoQObjectStreamCodec::onIngress(
@@ -247,12 +283,17 @@ void MoQObjectStreamCodec::onIngress(
         }
         curObjectHeader_ = res.value();
         cursor = newCursor;
+        MOXYGEN_TRACE_SPAN(
+            "MoQObjectStreamCodec::object",
+            value(curObjectHeader_.trackIdentifier),
+            curObjectHeader_.group,
+            curObjectHeader_.id);
         if (curObjectHeader_.status == ObjectStatus::NORMAL) {
           XLOG(DBG2) << "Parsing object with length, need="
                      << *curObjectHeader_.length
                      << " have=" << cursor.totalLength();
-          std::unique_ptr<folly::IOBuf> payload;
-          auto chunkLen = cursor.cloneAtMost(payload, *curObjectHeader_.length);
+          auto payload = splitPayload(cursor, *curObjectHeader_.length);
+          uint64_t chunkLen = payload ? payload->computeChainDataLength() : 0;
           auto endOfObject = chunkLen == *curObjectHeader_.length;
           if (endOfStream && !endOfObject) {
             XLOG(ERR) << "End of stream before end of object";
@@ -306,13 +347,13 @@ void MoQObjectStreamCodec::onIngress(
       case ParseState::OBJECT_PAYLOAD: {
         // need to check for bufLen == 0?
         std::unique_ptr<folly::IOBuf> payload;
-        // TODO: skip clone and do split
         uint64_t chunkLen = 0;
         XCHECK(curObjectHeader_.length);
         XLOG(DBG2) << "Parsing object with length, need="
                    << *curObjectHeader_.length;
         if (ingress_.chainLength() > 0 && cursor.canAdvance(1)) {
-          chunkLen = cursor.cloneAtMost(payload, *curObjectHeader_.length);
+          payload = splitPayload(cursor, *curObjectHeader_.length);
+          chunkLen = payload ? payload->computeChainDataLength() : 0;
         }
         *curObjectHeader_.length -= chunkLen;
         if (endOfStream && *curObjectHeader_.length != 0) {
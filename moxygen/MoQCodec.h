@@ -12,7 +12,11 @@ namespace moxygen {
 
 class MoQCodec {
  public:
-  virtual ~MoQCodec() = default;
+  virtual ~MoQCodec() {
+    if (ingressTotal_) {
+      *ingressTotal_ -= accountedIngress_;
+    }
+  }
 
   class Callback {
    public:
@@ -35,12 +39,24 @@ class MoQCodec {
 
   virtual void onIngress(std::unique_ptr<folly::IOBuf> data, bool eom) = 0;
 
+  // Bytes received and not parsed yet
+  size_t bufferedBytes() const {
+    return ingress_.chainLength();
+  }
+
+  // Keeps bufferedBytes() added into *total, for sharing one total among the
+  // codecs of a session
+  void setIngressAccounting(std::shared_ptr<uint64_t> total);
+
  protected:
   void onIngressStart(std::unique_ptr<folly::IOBuf> data);
   void onIngressEnd(size_t remainingLength, bool eom, Callback* callback);
+  void accountIngress();
 
   uint64_t streamId_{std::numeric_limits<uint64_t>::max()};
   folly::IOBufQueue ingress_{folly::IOBufQueue::cacheChainLength()};
+  std::shared_ptr<uint64_t> ingressTotal_;
+  size_t accountedIngress_{0};
 
   folly::Optional<ErrorCode> connError_;
   ObjectHeader curObjectHeader_;
@@ -198,6 +214,12 @@ class MoQObjectStreamCodec : public MoQCodec {
     STREAM_FIN_DELIVERED,
     // OBJECT_PAYLOAD_NO_LENGTH
   };
+  // Moves up to maxLength bytes at cursor out of ingress_ without copying and
+  // repositions cursor at the start of what remains.
+  std::unique_ptr<folly::IOBuf> splitPayload(
+      folly::io::Cursor& cursor,
+      uint64_t maxLength);
+
   ParseState parseState_{ParseState::STREAM_HEADER_TYPE};
   StreamType streamType_{StreamType::SUBGROUP_HEADER};
   SubgroupIDFormat subgroupFormat_{SubgroupIDFormat::Present};
@@ -3,6 +3,8 @@
 #include <proxygen/lib/http/webtransport/WebTransport.h>
 #include <moxygen/MoQFramer.h>
 
+#include <span>
+
 namespace moxygen {
 
 // MoQ Consumers
@@ -49,6 +51,13 @@ struct MoQPublishError {
 
 enum class ObjectPublishStatus { IN_PROGRESS, DONE };
 
+// A complete object, for SubgroupConsumer::objects
+struct SubgroupObject {
+  uint64_t objectID{0};
+  Payload payload;
+  Extensions extensions;
+};
+
 // Interface for Publishing and Receiving objects on a subgroup
 class SubgroupConsumer {
  public:
@@ -73,6 +82,30 @@ class SubgroupConsumer {
       Extensions extensions = noExtensions(),
       bool finSubgroup = false) = 0;
 
+  // Deliver several objects in ID order, as if by object() for each, with
+  // finSubgroup applying to the last.  Payloads and extensions are moved out
+  // of the span.  Writers encode every header in the batch into one buffer
+  // and write it at once.  Stops at the first error; objects earlier in the
+  // batch may or may not have been delivered.
+  virtual folly::Expected<folly::Unit, MoQPublishError> objects(
+      std::span<SubgroupObject> batch,
+      bool finSubgroup = false) {
+    if (batch.empty() && finSubgroup) {
+      return endOfSubgroup();
+    }
+    for (size_t i = 0; i < batch.size(); i++) {
+      auto res = object(
+          batch[i].objectID,
+          std::move(batch[i].payload),
+          std::move(batch[i].extensions),
+          finSubgroup && i + 1 == batch.size());
+      if (!res) {
+        return res;
+      }
+    }
+    return folly::unit;
+  }
+
   // Deliver Object Status=ObjectNotExists as the given object.
   virtual folly::Expected<folly::Unit, MoQPublishError> objectNotExists(
       uint64_t objectID,
@@ -119,17 +152,56 @@ class SubgroupConsumer {
   // code.  The stream will be reliably delivered up to the last checkpoint().
   virtual void reset(ResetStreamErrorCode error) = 0;
 
-  // This function will never be called by the library. It is meant to only be
-  // used by the application. The publisher can use this signal if it wants to
-  // pace data according to the rate at which the consumer is consuming it. If
-  // the publisher ignores this signal (which is perfectly valid), it may get
-  // a TOO_FAR_BEHIND if the client is unable to keep up.
+  // The publisher can use this signal if it wants to pace data according to
+  // the rate at which the consumer is consuming it. If the publisher ignores
+  // this signal (which is perfectly valid), it may get a TOO_FAR_BEHIND if the
+  // client is unable to keep up.
+  //
+  // When used as a read interface, the consumer can return BLOCKED from an
+  // object method, and the library stops reading the stream until this
+  // completes.  Data already read may still be delivered.
   virtual folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
   awaitReadyToConsume() {
     return folly::makeSemiFuture();
   }
 };
 
+// Drops everything it is passed, for subgroups nobody needs
+class DiscardSubgroupConsumer : public SubgroupConsumer {
+ public:
+  folly::Expected<folly::Unit, MoQPublishError>
+  object(uint64_t, Payload, Extensions, bool) override {
+    return folly::unit;
+  }
+  folly::Expected<folly::Unit, MoQPublishError>
+  objectNotExists(uint64_t, Extensions, bool) override {
+    return folly::unit;
+  }
+  folly::Expected<folly::Unit, MoQPublishError>
+  beginObject(uint64_t, uint64_t, Payload, Extensions) override {
+    return folly::unit;
+  }
+  folly::Expected<ObjectPublishStatus, MoQPublishError> objectPayload(
+      Payload,
+      bool) override {
+    return ObjectPublishStatus::DONE;
+  }
+  folly::Expected<folly::Unit, MoQPublishError> endOfGroup(
+      uint64_t,
+      Extensions) override {
+    return folly::unit;
+  }
+  folly::Expected<folly::Unit, MoQPublishError> endOfTrackAndGroup(
+      uint64_t,
+      Extensions) override {
+    return folly::unit;
+  }
+  folly::Expected<folly::Unit, MoQPublishError> endOfSubgroup() override {
+    return folly::unit;
+  }
+  void reset(ResetStreamErrorCode) override {}
+};
+
 // Interface for Publishing and Receiving Subscriptions
 //
 // Note that for now, both the stream interface and datagram interface coexist
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/MoQEgressScheduler.h"
+
+#include <algorithm>
+
+namespace moxygen {
+
+namespace {
+// Order bits below the subscriber and publisher priorities
+constexpr uint64_t kClassShift = 42;
+} // namespace
+
+void MoQEgressScheduler::schedule(
+    uint64_t order,
+    uint64_t flow,
+    uint32_t weight,
+    Send send) {
+  auto& cls = classes_[order >> kClassShift];
+  auto [it, inserted] = cls.flows.try_emplace(flow);
+  if (inserted) {
+    cls.active.push_back(flow);
+  }
+  it->second.weight = std::max<uint32_t>(weight, 1);
+  it->second.writes.emplace(order, std::move(send));
+  size_++;
+}
+
+void MoQEgressScheduler::sendOne(uint64_t classKey) {
+  Send send;
+  uint64_t flowID = 0;
+  {
+    auto& cls = classes_[classKey];
+    flowID = cls.active.front();
+    auto& flow = cls.flows.find(flowID)->second;
+    if (flow.deficit <= 0) {
+      flow.deficit += int64_t(kQuantum * flow.weight);
+    }
+    auto writeIt = flow.writes.begin();
+    send = std::move(writeIt->second);
+    flow.writes.erase(writeIt);
+    size_--;
+  }
+  auto sent = send();
+
+  // send() can schedule more writes or clear the scheduler, look it all up
+  // again
+  auto classIt = classes_.find(classKey);
+  if (classIt == classes_.end()) {
+    return;
+  }
+  auto& cls = classIt->second;
+  auto flowIt = cls.flows.find(flowID);
+  if (flowIt == cls.flows.end()) {
+    return;
+  }
+  // A flow that overdraws pays it back in later rounds
+  auto& flow = flowIt->second;
+  flow.deficit -= int64_t(sent);
+  if (flow.writes.empty()) {
+    cls.flows.erase(flowIt);
+    cls.active.erase(std::find(cls.active.begin(), cls.active.end(), flowID));
+  } else if (flow.deficit <= 0 && cls.active.front() == flowID) {
+    cls.active.pop_front();
+    cls.active.push_back(flowID);
+  }
+  if (cls.flows.empty()) {
+    classes_.erase(classIt);
+  }
+}
+
+} // namespace moxygen
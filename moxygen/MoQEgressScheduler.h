@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Function.h>
+#include <folly/container/F14Map.h>
+
+#include <deque>
+#include <map>
+
+namespace moxygen {
+
+/*
+ * Orders the writes a session has pending, stream data and datagrams alike.
+ * Each write has a 58 bit order as built by getStreamPriority, and belongs
+ * to a flow, one per track.  Writes go out by the top 16 bits of the order
+ * (subscriber then publisher priority).  Flows tied on those share the
+ * bytes by deficit round robin in proportion to their weights, and within a
+ * flow writes go out by their full order (group order, then subgroup).
+ *
+ * Not thread safe.
+ */
+class MoQEgressScheduler {
+ public:
+  // Sends the write and returns the bytes it put on the wire
+  using Send = folly::Function<uint64_t()>;
+
+  // Bytes a weight 1 flow is entitled to per round
+  static constexpr uint64_t kQuantum = 1200;
+
+  void schedule(uint64_t order, uint64_t flow, uint32_t weight, Send send);
+
+  // Sends writes, until none are left or canSend returns false
+  template <typename CanSend>
+  void run(CanSend&& canSend) {
+    while (!classes_.empty() && canSend()) {
+      sendOne(classes_.begin()->first);
+    }
+  }
+
+  bool empty() const {
+    return classes_.empty();
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  void clear() {
+    classes_.clear();
+    size_ = 0;
+  }
+
+ private:
+  struct Flow {
+    uint32_t weight{1};
+    int64_t deficit{0};
+    std::multimap<uint64_t, Send> writes;
+  };
+  // Flows tied on subscriber and publisher priority
+  struct Class {
+    folly::F14FastMap<uint64_t, Flow> flows;
+    // Round robin order of the flow IDs
+    std::deque<uint64_t> active;
+  };
+  using Classes = std::map<uint64_t, Class>;
+
+  void sendOne(uint64_t classKey);
+
+  Classes classes_;
+  size_t size_{0};
+};
+
+} // namespace moxygen
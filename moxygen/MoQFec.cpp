@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <moxygen/MoQFec.h>
+
+#include <folly/io/Cursor.h>
+#include <folly/lang/Bits.h>
+#include <folly/logging/xlog.h>
+
+namespace {
+using namespace moxygen;
+
+// An object as the parity protects it: the length of the rest as 8 bytes,
+// so the XOR of the lengths is the length of the lost object, then its
+// extensions and payload.
+std::unique_ptr<folly::IOBuf> encodeObject(
+    const Extensions& extensions,
+    const Payload& payload) {
+  folly::IOBufQueue body{folly::IOBufQueue::cacheChainLength()};
+  size_t size = 0;
+  bool error = false;
+  writeVarint(body, extensions.size(), size, error);
+  for (const auto& ext : extensions) {
+    writeVarint(body, ext.type, size, error);
+    if (ext.type & 0x1) {
+      auto length =
+          ext.arrayValue ? ext.arrayValue->computeChainDataLength() : 0;
+      writeVarint(body, length, size, error);
+      if (ext.arrayValue) {
+        body.append(ext.arrayValue->clone());
+      }
+    } else {
+      writeVarint(body, ext.intValue, size, error);
+    }
+  }
+  if (payload) {
+    body.append(payload->clone());
+  }
+  auto length = folly::Endian::big(uint64_t(body.chainLength()));
+  auto encoded = folly::IOBuf::copyBuffer(&length, sizeof(length));
+  if (!body.empty()) {
+    encoded->appendToChain(body.move());
+  }
+  return encoded;
+}
+
+// Bounds the encoded datagram: type, track alias, group, object and
+// priority, then the extensions and the payload
+uint64_t datagramSizeBound(
+    const ObjectHeader& header,
+    const Payload& payload,
+    uint64_t parityLength) {
+  constexpr uint64_t kMaxVarint = 8;
+  uint64_t size = 1 + 3 * kMaxVarint + 1 + kMaxVarint;
+  for (const auto& ext : header.extensions) {
+    size += 2 * kMaxVarint +
+        (ext.arrayValue ? ext.arrayValue->computeChainDataLength() : 0);
+  }
+  if (parityLength > 0) {
+    size += 2 * kMaxVarint + parityLength;
+  }
+  return size + (payload ? payload->computeChainDataLength() : 0);
+}
+
+void xorInto(std::vector<uint8_t>& parity, const folly::IOBuf& encoded) {
+  size_t offset = 0;
+  for (auto range : encoded) {
+    if (parity.size() < offset + range.size()) {
+      parity.resize(offset + range.size());
+    }
+    for (auto byte : range) {
+      parity[offset++] ^= byte;
+    }
+  }
+}
+
+struct DecodedObject {
+  Extensions extensions;
+  Payload payload;
+};
+
+// The inverse of encodeObject, on what the XOR left of the parity
+folly::Optional<DecodedObject> decodeObject(
+    const std::vector<uint8_t>& bytes) {
+  uint64_t length = 0;
+  if (bytes.size() < sizeof(length)) {
+    return folly::none;
+  }
+  auto buf = folly::IOBuf::wrapBufferAsValue(bytes.data(), bytes.size());
+  folly::io::Cursor cursor(&buf);
+  length = cursor.readBE<uint64_t>();
+  if (length > cursor.totalLength()) {
+    return folly::none;
+  }
+  auto end = bytes.size() - cursor.totalLength() + length;
+  auto numExtensions = decodeVarint(cursor);
+  if (!numExtensions || numExtensions->first > length) {
+    return folly::none;
+  }
+  std::vector<Extension> extensions;
+  for (uint64_t i = 0; i < numExtensions->first; i++) {
+    auto type = decodeVarint(cursor);
+    auto value = type ? decodeVarint(cursor) : folly::none;
+    if (!value) {
+      return folly::none;
+    }
+    if (type->first & 0x1) {
+      if (!cursor.canAdvance(value->first)) {
+        return folly::none;
+      }
+      // Copied, bytes don't outlive the call
+      auto array = folly::IOBuf::create(value->first);
+      cursor.pull(array->writableData(), value->first);
+      array->append(value->first);
+      extensions.emplace_back(type->first, std::move(array));
+    } else {
+      extensions.emplace_back(type->first, value->first);
+    }
+  }
+  auto consumed = bytes.size() - cursor.totalLength();
+  if (consumed > end) {
+    return folly::none;
+  }
+  return DecodedObject{
+      std::move(extensions),
+      folly::IOBuf::copyBuffer(bytes.data() + consumed, end - consumed)};
+}
+
+} // namespace
+
+namespace moxygen {
+
+folly::Expected<folly::Unit, MoQPublishError> MoQFecEncoder::datagram(
+    const ObjectHeader& header,
+    Payload payload) {
+  if (header.status != ObjectStatus::NORMAL) {
+    return downstream_->datagram(header, std::move(payload));
+  }
+  for (const auto& ext : header.extensions) {
+    if (ext.type == kFecParityExtension) {
+      return downstream_->datagram(header, std::move(payload));
+    }
+  }
+  if (!objectIDs_.empty() && header.group != group_) {
+    finishWindow();
+  }
+  auto encoded = encodeObject(header.extensions, payload);
+  // Its parity would not fit on a datagram with another object
+  if (encoded->computeChainDataLength() <= maxDatagramSize_ / 2) {
+    group_ = header.group;
+    objectIDs_.push_back(header.id);
+    xorInto(parity_, *encoded);
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> res{folly::unit};
+  if (pendingParity_ &&
+      datagramSizeBound(
+          header, payload, pendingParity_->computeChainDataLength()) <=
+          maxDatagramSize_) {
+    auto withParity = header;
+    withParity.extensions.push_back(
+        Extension(kFecParityExtension, std::move(pendingParity_)));
+    res = downstream_->datagram(withParity, std::move(payload));
+  } else {
+    res = downstream_->datagram(header, std::move(payload));
+  }
+  if (!objectIDs_.empty() && objectIDs_.size() >= window_) {
+    finishWindow();
+  }
+  return res;
+}
+
+void MoQFecEncoder::finishWindow() {
+  folly::IOBufQueue value{folly::IOBufQueue::cacheChainLength()};
+  size_t size = 0;
+  bool error = false;
+  writeVarint(value, group_, size, error);
+  writeVarint(value, objectIDs_.size(), size, error);
+  for (auto id : objectIDs_) {
+    writeVarint(value, id, size, error);
+  }
+  value.append(parity_.data(), parity_.size());
+  // A window not yet carried is replaced, its parity is too late to help
+  pendingParity_ = value.move();
+  objectIDs_.clear();
+  parity_.clear();
+}
+
+ObjectReceiverCallback::FlowControlState MoQFecReceiver::onObject(
+    const ObjectHeader& objHeader,
+    Payload payload) {
+  if (objHeader.status != ObjectStatus::NORMAL) {
+    return callback_->onObject(objHeader, std::move(payload));
+  }
+  std::unique_ptr<folly::IOBuf> parity;
+  for (const auto& ext : objHeader.extensions) {
+    if (ext.type == kFecParityExtension && ext.arrayValue) {
+      parity = ext.arrayValue->clone();
+      break;
+    }
+  }
+  const ObjectHeader* header = &objHeader;
+  ObjectHeader stripped;
+  if (parity) {
+    std::vector<Extension> extensions;
+    for (const auto& ext : objHeader.extensions) {
+      if (ext.type != kFecParityExtension) {
+        extensions.push_back(ext);
+      }
+    }
+    stripped = objHeader;
+    stripped.extensions = Extensions(std::move(extensions));
+    header = &stripped;
+  }
+
+  auto state = FlowControlState::UNBLOCKED;
+  AbsoluteLocation location{header->group, header->id};
+  auto prior = findReceived(location);
+  if (!prior || !prior->recovered) {
+    if (!prior) {
+      remember(
+          location,
+          {header->extensions, payload ? payload->clone() : nullptr, false});
+    }
+    state = callback_->onObject(*header, std::move(payload));
+  } else {
+    XLOG(DBG4) << "Dropping object rebuilt earlier grp=" << location.group
+               << " id=" << location.object;
+  }
+  if (parity && recover(*header, *parity) == FlowControlState::BLOCKED) {
+    state = FlowControlState::BLOCKED;
+  }
+  return state;
+}
+
+const MoQFecReceiver::Received* MoQFecReceiver::findReceived(
+    AbsoluteLocation location) const {
+  auto it = history_.find(location);
+  return it == history_.end() ? nullptr : &it->second;
+}
+
+void MoQFecReceiver::remember(AbsoluteLocation location, Received received) {
+  history_.emplace(location, std::move(received));
+  if (history_.size() > kMaxHistory) {
+    history_.erase(history_.begin());
+  }
+}
+
+ObjectReceiverCallback::FlowControlState MoQFecReceiver::recover(
+    const ObjectHeader& carrier,
+    folly::IOBuf& parity) {
+  folly::io::Cursor cursor(&parity);
+  auto group = decodeVarint(cursor);
+  auto count = group ? decodeVarint(cursor) : folly::none;
+  if (!count || count->first > kMaxHistory) {
+    XLOG(DBG2) << "Invalid FEC parity";
+    return FlowControlState::UNBLOCKED;
+  }
+  folly::Optional<uint64_t> missing;
+  std::vector<const Received*> present;
+  for (uint64_t i = 0; i < count->first; i++) {
+    auto id = decodeVarint(cursor);
+    if (!id) {
+      XLOG(DBG2) << "Invalid FEC parity";
+      return FlowControlState::UNBLOCKED;
+    }
+    if (auto received = findReceived({group->first, id->first})) {
+      present.push_back(received);
+    } else if (missing) {
+      // More than one object of the window was lost
+      return FlowControlState::UNBLOCKED;
+    } else {
+      missing = id->first;
+    }
+  }
+  if (!missing) {
+    return FlowControlState::UNBLOCKED;
+  }
+  std::vector<uint8_t> bytes(cursor.totalLength());
+  cursor.pull(bytes.data(), bytes.size());
+  for (auto received : present) {
+    xorInto(bytes, *encodeObject(received->extensions, received->payload));
+  }
+  auto decoded = decodeObject(bytes);
+  if (!decoded) {
+    XLOG(DBG2) << "Failed to rebuild object from FEC parity";
+    return FlowControlState::UNBLOCKED;
+  }
+  AbsoluteLocation location{group->first, *missing};
+  XLOG(DBG4) << "Rebuilt object from FEC parity grp=" << location.group
+             << " id=" << location.object;
+  recovered_++;
+  ObjectHeader header(
+      carrier.trackIdentifier,
+      location.group,
+      location.object,
+      location.object,
+      carrier.priority,
+      decoded->payload->length(),
+      decoded->extensions);
+  remember(location, {decoded->extensions, decoded->payload->clone(), true});
+  return callback_->onObject(header, std::move(decoded->payload));
+}
+
+} // namespace moxygen
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <moxygen/MoQConsumers.h>
+#include <moxygen/ObjectReceiver.h>
+
+#include <map>
+
+namespace moxygen {
+
+// Forward error correction for datagram tracks.  Each window of up to N
+// NORMAL datagrams of a group is protected by the XOR of the objects, their
+// extensions included.  The parity rides in a kFecParityExtension on the
+// next datagram of the track, so object IDs are untouched and receivers that
+// don't know the extension just ignore it.  A receiver that lost one object
+// of a window rebuilds it from the others and the parity, without waiting a
+// round trip for a retransmission.  The last window before the track ends
+// has no datagram to carry its parity and is unprotected.
+//
+// The parity is as large as the largest object of the window, so carrier
+// and parity are kept within a maximum datagram size: objects over half of
+// it are sent unprotected, and parity that doesn't fit on a datagram waits
+// for a smaller one.
+//
+// Extension value: group, number of objects, their IDs, then the parity.
+constexpr uint64_t kFecParityExtension = 0xFEC1;
+
+// Adds parity to the datagrams passed to downstream.  Datagrams already
+// carrying parity pass through unchanged, as does everything else.
+class MoQFecEncoder : public TrackConsumer {
+ public:
+  // The smallest maximum datagram size of any QUIC path
+  static constexpr uint64_t kDefaultMaxDatagramSize = 1200;
+
+  MoQFecEncoder(
+      std::shared_ptr<TrackConsumer> downstream,
+      size_t window,
+      uint64_t maxDatagramSize = kDefaultMaxDatagramSize)
+      : downstream_(std::move(downstream)),
+        window_(std::max<size_t>(window, 1)),
+        maxDatagramSize_(maxDatagramSize) {}
+
+  folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
+  beginSubgroup(uint64_t groupID, uint64_t subgroupID, Priority priority)
+      override {
+    return downstream_->beginSubgroup(groupID, subgroupID, priority);
+  }
+
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitStreamCredit() override {
+    return downstream_->awaitStreamCredit();
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objectStream(
+      const ObjectHeader& header,
+      Payload payload) override {
+    return downstream_->objectStream(header, std::move(payload));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> datagram(
+      const ObjectHeader& header,
+      Payload payload) override;
+
+  folly::Expected<folly::Unit, MoQPublishError> groupNotExists(
+      uint64_t groupID,
+      uint64_t subgroup,
+      Priority pri,
+      Extensions extensions) override {
+    return downstream_->groupNotExists(
+        groupID, subgroup, pri, std::move(extensions));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> subscribeDone(
+      SubscribeDone subDone) override {
+    return downstream_->subscribeDone(std::move(subDone));
+  }
+
+ private:
+  void finishWindow();
+
+  std::shared_ptr<TrackConsumer> downstream_;
+  size_t window_;
+  uint64_t maxDatagramSize_;
+  // The window being accumulated
+  uint64_t group_{0};
+  std::vector<uint64_t> objectIDs_;
+  std::vector<uint8_t> parity_;
+  // Parity of the last window, for the next datagram
+  std::unique_ptr<folly::IOBuf> pendingParity_;
+};
+
+// Rebuilds objects lost from windows protected by MoQFecEncoder before
+// passing them on, and strips the parity extension.  A rebuilt object is
+// passed on when the parity arrives, after the objects that followed it, so
+// callback should reorder, as DeJitter does.
+class MoQFecReceiver : public ObjectReceiverCallback {
+ public:
+  // Objects kept to rebuild from, enough for several windows
+  static constexpr size_t kMaxHistory = 256;
+
+  explicit MoQFecReceiver(std::shared_ptr<ObjectReceiverCallback> callback)
+      : callback_(std::move(callback)) {}
+
+  FlowControlState onObject(const ObjectHeader& objHeader, Payload payload)
+      override;
+
+  void onObjectStatus(const ObjectHeader& objHeader) override {
+    callback_->onObjectStatus(objHeader);
+  }
+
+  void onEndOfStream() override {
+    callback_->onEndOfStream();
+  }
+
+  void onError(ResetStreamErrorCode error) override {
+    callback_->onError(error);
+  }
+
+  void onSubscribeDone(SubscribeDone done) override {
+    callback_->onSubscribeDone(std::move(done));
+  }
+
+  folly::SemiFuture<folly::Unit> awaitReadyToConsume() override {
+    return callback_->awaitReadyToConsume();
+  }
+
+  // Objects rebuilt from parity
+  uint64_t recovered() const {
+    return recovered_;
+  }
+
+ private:
+  struct Received {
+    Extensions extensions;
+    Payload payload;
+    // Rebuilt, so a late copy isn't passed on again
+    bool recovered{false};
+  };
+
+  const Received* findReceived(AbsoluteLocation location) const;
+  void remember(AbsoluteLocation location, Received received);
+  // Passes on the one object of the window described by parity that is
+  // missing, if it can be rebuilt
+  FlowControlState recover(const ObjectHeader& carrier, folly::IOBuf& parity);
+
+  std::shared_ptr<ObjectReceiverCallback> callback_;
+  // The oldest is evicted first
+  std::map<AbsoluteLocation, Received> history_;
+  uint64_t recovered_{0};
+};
+
+} // namespace moxygen
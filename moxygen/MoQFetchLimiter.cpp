@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/MoQFetchLimiter.h"
+
+#include <algorithm>
+
+namespace moxygen {
+
+MoQFetchLimiter::MoQFetchLimiter(Config config)
+    : config_(config),
+      tokens_(double(config.burstBytes)),
+      lastRefill_(std::chrono::steady_clock::now()) {}
+
+void MoQFetchLimiter::acquire(
+    folly::EventBase* evb,
+    folly::Function<void()> onAcquired) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (config_.maxConcurrent > 0 && active_ >= config_.maxConcurrent) {
+      waiters_.push_back({evb, std::move(onAcquired)});
+      return;
+    }
+    active_++;
+  }
+  onAcquired();
+}
+
+void MoQFetchLimiter::release() {
+  Waiter next;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (waiters_.empty()) {
+      if (active_ > 0) {
+        active_--;
+      }
+      return;
+    }
+    // The slot passes to the next waiter, active_ is unchanged
+    next = std::move(waiters_.front());
+    waiters_.pop_front();
+  }
+  next.evb->runInEventBaseThread(std::move(next.onAcquired));
+}
+
+std::chrono::microseconds MoQFetchLimiter::onBytesWritten(uint64_t bytes) {
+  if (config_.maxBytesPerSecond == 0) {
+    return std::chrono::microseconds(0);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto now = std::chrono::steady_clock::now();
+  auto elapsed = std::chrono::duration<double>(now - lastRefill_).count();
+  lastRefill_ = now;
+  tokens_ = std::min(
+      double(config_.burstBytes),
+      tokens_ + elapsed * double(config_.maxBytesPerSecond));
+  tokens_ -= double(bytes);
+  if (tokens_ >= 0) {
+    return std::chrono::microseconds(0);
+  }
+  return std::chrono::microseconds(
+      int64_t(-tokens_ * 1e6 / double(config_.maxBytesPerSecond)) + 1);
+}
+
+uint32_t MoQFetchLimiter::active() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return active_;
+}
+
+size_t MoQFetchLimiter::waiting() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return waiters_.size();
+}
+
+} // namespace moxygen
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Function.h>
+#include <folly/io/async/EventBase.h>
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+
+namespace moxygen {
+
+/*
+ * Bounds the FETCHes served at once and the rate of the bytes they write.
+ * A FETCH acquires a slot before its handler runs and releases it when its
+ * stream completes, later FETCHes wait in arrival order.  Written bytes are
+ * drawn from a token bucket that can go into debt, and the writer is told
+ * how long to wait before its next write.
+ *
+ * Thread safe, one limiter can be shared by a relay's sessions.
+ */
+class MoQFetchLimiter {
+ public:
+  struct Config {
+    // 0 means no limit
+    uint32_t maxConcurrent{0};
+    // 0 means no limit
+    uint64_t maxBytesPerSecond{0};
+    // Bytes that can be written at once after an idle period
+    uint64_t burstBytes{64 * 1024};
+
+    bool enabled() const {
+      return maxConcurrent > 0 || maxBytesPerSecond > 0;
+    }
+  };
+
+  explicit MoQFetchLimiter(Config config);
+
+  // Runs onAcquired inline if a slot is free, else on evb once one is
+  // released.  Every acquired slot must be released.
+  void acquire(folly::EventBase* evb, folly::Function<void()> onAcquired);
+  void release();
+
+  // Accounts for bytes written by a FETCH, returns how long it should wait
+  // before writing more
+  std::chrono::microseconds onBytesWritten(uint64_t bytes);
+
+  uint32_t active() const;
+  size_t waiting() const;
+
+ private:
+  struct Waiter {
+    folly::EventBase* evb;
+    folly::Function<void()> onAcquired;
+  };
+
+  const Config config_;
+  mutable std::mutex mutex_;
+  uint32_t active_{0};
+  std::deque<Waiter> waiters_;
+  double tokens_{0};
+  std::chrono::steady_clock::time_point lastRefill_;
+};
+
+} // namespace moxygen
@@ -8,6 +8,9 @@
 #include <folly/lang/Bits.h>
 #include <folly/logging/xlog.h>
 
+#include <array>
+#include <cstring>
+
 namespace {
 constexpr uint64_t kMaxExtensions = 16;
 constexpr uint64_t kMaxExtensionLength = 1024;
@@ -55,7 +58,9 @@ folly::Expected<folly::Unit, ErrorCode> parseSetupParams(
     uint64_t version,
     size_t numParams,
     std::vector<SetupParameter>& params);
-bool datagramTypeHasExtensions(uint64_t version, StreamType streamType);
+bool datagramTypeHasExtensions(
+    const DraftTraits& traits,
+    StreamType streamType);
 bool datagramTypeIsStatus(StreamType streamType);
 
 void writeFixedString(
@@ -116,6 +121,17 @@ uint64_t getMaxCacheDurationParamKey(uint64_t version) {
   }
 }
 
+DraftTraits getDraftTraits(uint64_t version) {
+  DraftTraits traits;
+  traits.majorVersion = getDraftMajorVersion(version);
+  traits.legacy = traits.majorVersion < 11;
+  traits.requestIDMultiplier = traits.legacy ? 1 : 2;
+  traits.authorizationParamKey = getAuthorizationParamKey(version);
+  traits.deliveryTimeoutParamKey = getDeliveryTimeoutParamKey(version);
+  traits.maxCacheDurationParamKey = getMaxCacheDurationParamKey(version);
+  return traits;
+}
+
 std::string toString(LocationType loctype) {
   switch (loctype) {
     case LocationType::NextGroupStart: {
@@ -276,15 +292,17 @@ folly::Expected<ServerSetup, ErrorCode> parseServerSetup(
 
 folly::Expected<RequestID, ErrorCode> MoQFrameParser::parseFetchHeader(
     folly::io::Cursor& cursor) const noexcept {
-  auto requestID = quic::decodeQuicInteger(cursor);
+  auto requestID = decodeVarint(cursor);
   if (!requestID) {
     return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
   }
   return RequestID(requestID->first);
 }
 
-bool datagramTypeHasExtensions(uint64_t version, StreamType streamType) {
-  return getDraftMajorVersion(version) < 11 ||
+bool datagramTypeHasExtensions(
+    const DraftTraits& traits,
+    StreamType streamType) {
+  return traits.legacy ||
       streamType == StreamType::OBJECT_DATAGRAM_EXT ||
       streamType == StreamType::OBJECT_DATAGRAM_STATUS_EXT;
 }
@@ -300,19 +318,19 @@ MoQFrameParser::parseDatagramObjectHeader(
     StreamType streamType,
     size_t& length) const noexcept {
   ObjectHeader objectHeader;
-  auto trackAlias = quic::decodeQuicInteger(cursor, length);
+  auto trackAlias = decodeVarint(cursor, length);
   if (!trackAlias) {
     return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
   }
   length -= trackAlias->second;
   objectHeader.trackIdentifier = TrackAlias(trackAlias->first);
-  auto group = quic::decodeQuicInteger(cursor, length);
+  auto group = decodeVarint(cursor, length);
   if (!group) {
     return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
   }
   length -= group->second;
   objectHeader.group = group->first;
-  auto id = quic::decodeQuicInteger(cursor, length);
+  auto id = decodeVarint(cursor, length);
   if (!id) {
     return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
   }
@@ -323,7 +341,7 @@ MoQFrameParser::parseDatagramObjectHeader(
   }
   objectHeader.priority = cursor.readBE<uint8_t>();
   length -= 1;
-  if (datagramTypeHasExtensions(*version_, streamType)) {
+  if (datagramTypeHasExtensions(traits_, streamType)) {
     auto ext = parseExtensions(cursor, length, objectHeader);
     if (!ext) {
       return folly::makeUnexpected(ext.error());
@@ -331,7 +349,7 @@ MoQFrameParser::parseDatagramObjectHeader(
   }
 
   if (datagramTypeIsStatus(streamType)) {
-    auto status = quic::decodeQuicInteger(cursor, length);
+    auto status = decodeVarint(cursor, length);
     if (!status) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
     }
@@ -362,22 +380,22 @@ folly::Expected<ObjectHeader, ErrorCode> MoQFrameParser::parseSubgroupHeader(
   ObjectHeader objectHeader;
   objectHeader.group = std::numeric_limits<uint64_t>::max(); // unset
   objectHeader.id = std::numeric_limits<uint64_t>::max();    // unset
-  auto trackAlias = quic::decodeQuicInteger(cursor, length);
+  auto trackAlias = decodeVarint(cursor, length);
   if (!trackAlias) {
     return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
   }
   length -= trackAlias->second;
   objectHeader.trackIdentifier = TrackAlias(trackAlias->first);
-  auto group = quic::decodeQuicInteger(cursor, length);
+  auto group = decodeVarint(cursor, length);
   if (!group) {
     return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
   }
   length -= group->second;
   objectHeader.group = group->first;
   bool parseObjectID = false;
-  if (getDraftMajorVersion(*version_) < 11 ||
+  if (traits_.legacy ||
       format == SubgroupIDFormat::Present) {
-    auto subgroup = quic::decodeQuicInteger(cursor, length);
+    auto subgroup = decodeVarint(cursor, length);
     if (!subgroup) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
     }
@@ -396,7 +414,7 @@ folly::Expected<ObjectHeader, ErrorCode> MoQFrameParser::parseSubgroupHeader(
   }
   if (parseObjectID) {
     auto tmpCursor = cursor; // we reparse the object ID later
-    auto id = quic::decodeQuicInteger(tmpCursor, length);
+    auto id = decodeVarint(tmpCursor, length);
     if (!id) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
     }
@@ -410,7 +428,7 @@ MoQFrameParser::parseObjectStatusAndLength(
     folly::io::Cursor& cursor,
     size_t length,
     ObjectHeader& objectHeader) const noexcept {
-  auto payloadLength = quic::decodeQuicInteger(cursor, length);
+  auto payloadLength = decodeVarint(cursor, length);
   if (!payloadLength) {
     return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
   }
@@ -418,7 +436,7 @@ MoQFrameParser::parseObjectStatusAndLength(
   objectHeader.length = payloadLength->first;
 
   if (objectHeader.length == 0) {
-    auto objectStatus = quic::decodeQuicInteger(cursor, length);
+    auto objectStatus = decodeVarint(cursor, length);
     if (!objectStatus) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
     }
@@ -443,21 +461,21 @@ folly::Expected<ObjectHeader, ErrorCode> MoQFrameParser::parseFetchObjectHeader(
   auto length = cursor.totalLength();
   ObjectHeader objectHeader = headerTemplate;
 
-  auto group = quic::decodeQuicInteger(cursor, length);
+  auto group = decodeVarint(cursor, length);
   if (!group) {
     return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
   }
   length -= group->second;
   objectHeader.group = group->first;
 
-  auto subgroup = quic::decodeQuicInteger(cursor, length);
+  auto subgroup = decodeVarint(cursor, length);
   if (!subgroup) {
     return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
   }
   length -= subgroup->second;
   objectHeader.subgroup = subgroup->first;
 
-  auto id = quic::decodeQuicInteger(cursor, length);
+  auto id = decodeVarint(cursor, length);
   if (!id) {
     return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
   }
@@ -491,14 +509,14 @@ MoQFrameParser::parseSubgroupObjectHeader(
   // TODO get rid of this
   auto length = cursor.totalLength();
   ObjectHeader objectHeader = headerTemplate;
-  auto id = quic::decodeQuicInteger(cursor, length);
+  auto id = decodeVarint(cursor, length);
   if (!id) {
     return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
   }
   length -= id->second;
   objectHeader.id = id->first;
 
-  if (getDraftMajorVersion(*version_) < 11 || includeExtensions) {
+  if (traits_.legacy || includeExtensions) {
     auto ext = parseExtensions(cursor, length, objectHeader);
     if (!ext) {
       return folly::makeUnexpected(ext.error());
@@ -629,7 +647,7 @@ folly::Expected<folly::Unit, ErrorCode> MoQFrameParser::parseTrackRequestParams(
 
     if (p.key ==
             folly::to_underlying(LegacyTrackRequestParamKey::AUTHORIZATION) &&
-        getDraftMajorVersion(*version_) < 11) {
+        traits_.legacy) {
       auto res = parseFixedString(cursor, length);
       if (!res) {
         return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
@@ -638,7 +656,7 @@ folly::Expected<folly::Unit, ErrorCode> MoQFrameParser::parseTrackRequestParams(
     } else if (
         p.key ==
             folly::to_underlying(TrackRequestParamKey::AUTHORIZATION_TOKEN) &&
-        getDraftMajorVersion(*version_) >= 11) {
+        !traits_.legacy) {
       auto res = quic::decodeQuicInteger(cursor, length);
       if (!res) {
         return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
@@ -659,7 +677,7 @@ folly::Expected<folly::Unit, ErrorCode> MoQFrameParser::parseTrackRequestParams(
       p.asAuthToken = std::move(*tokenRes.value());
     } else {
       auto res = quic::decodeQuicInteger(cursor, length);
-      if (getDraftMajorVersion(*version_) < 11) {
+      if (traits_.legacy) {
         if (!res) {
           return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
         }
@@ -717,7 +735,7 @@ MoQFrameParser::parseSubscribeRequest(folly::io::Cursor& cursor, size_t length)
   }
   subscribeRequest.groupOrder = static_cast<GroupOrder>(order);
   length -= 2;
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     if (length < 1) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
     }
@@ -736,7 +754,7 @@ MoQFrameParser::parseSubscribeRequest(folly::io::Cursor& cursor, size_t length)
   // and above have LocationType::NextGroupStart. Draft 9 and 10 don't have
   // LocationType == 1, but we treat it as LatestGroup.
   if (locType->first == folly::to_underlying(LocationType::NextGroupStart) &&
-      getDraftMajorVersion(*version_) < 11) {
+      traits_.legacy) {
     locType->first = folly::to_underlying(LocationType::LatestGroup);
   }
   switch (locType->first) {
@@ -816,7 +834,7 @@ MoQFrameParser::parseSubscribeUpdate(folly::io::Cursor& cursor, size_t length)
   subscribeUpdate.priority = cursor.readBE<uint8_t>();
   length--;
 
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     if (length < 2) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
     }
@@ -984,7 +1002,7 @@ folly::Expected<SubscribeDone, ErrorCode> MoQFrameParser::parseSubscribeDone(
 
   CHECK(version_.hasValue())
       << "The version must be set before parsing SUBSCRIBE_DONE";
-  if (getDraftMajorVersion(*version_) <= 9) {
+  if (traits_.majorVersion <= 9) {
     if (length == 0) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
     }
@@ -1007,7 +1025,7 @@ folly::Expected<Announce, ErrorCode> MoQFrameParser::parseAnnounce(
     folly::io::Cursor& cursor,
     size_t length) const noexcept {
   Announce announce;
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     auto requestID = quic::decodeQuicInteger(cursor, length);
     if (!requestID) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
@@ -1043,7 +1061,7 @@ folly::Expected<AnnounceOk, ErrorCode> MoQFrameParser::parseAnnounceOk(
     folly::io::Cursor& cursor,
     size_t length) const noexcept {
   AnnounceOk announceOk;
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     auto requestID = quic::decodeQuicInteger(cursor, length);
     if (!requestID) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
@@ -1068,7 +1086,7 @@ folly::Expected<AnnounceError, ErrorCode> MoQFrameParser::parseAnnounceError(
     folly::io::Cursor& cursor,
     size_t length) const noexcept {
   AnnounceError announceError;
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     auto requestID = quic::decodeQuicInteger(cursor, length);
     if (!requestID) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
@@ -1151,7 +1169,7 @@ MoQFrameParser::parseTrackStatusRequest(
       << "version_ needs to be set to parse TrackStatusRequest";
 
   TrackStatusRequest trackStatusRequest;
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     auto requestID = quic::decodeQuicInteger(cursor, length);
     if (!requestID) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
@@ -1167,7 +1185,7 @@ MoQFrameParser::parseTrackStatusRequest(
   }
   trackStatusRequest.fullTrackName = std::move(res.value());
 
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     auto numParams = quic::decodeQuicInteger(cursor, length);
     if (!numParams) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
@@ -1191,7 +1209,7 @@ folly::Expected<TrackStatus, ErrorCode> MoQFrameParser::parseTrackStatus(
   CHECK(version_.hasValue()) << "version_ needs to be set to parse TrackStatus";
 
   TrackStatus trackStatus;
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     auto requestID = quic::decodeQuicInteger(cursor, length);
     if (!requestID) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
@@ -1222,7 +1240,7 @@ folly::Expected<TrackStatus, ErrorCode> MoQFrameParser::parseTrackStatus(
   }
   trackStatus.latestGroupAndObject = *location;
 
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     auto numParams = quic::decodeQuicInteger(cursor, length);
     if (!numParams) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
@@ -1322,7 +1340,7 @@ folly::Expected<Fetch, ErrorCode> MoQFrameParser::parseFetch(
     return folly::makeUnexpected(ErrorCode::PROTOCOL_VIOLATION);
   } else if (
       fetchType->first == folly::to_underlying(FetchType::ABSOLUTE_JOINING) &&
-      getDraftMajorVersion(*version_) < 11) {
+      traits_.legacy) {
     // Absolute joining is only supported in draft-11 and later
     return folly::makeUnexpected(ErrorCode::PROTOCOL_VIOLATION);
   }
@@ -1573,10 +1591,13 @@ folly::Expected<folly::Unit, ErrorCode> MoQFrameParser::parseExtensions(
   CHECK(version_.hasValue())
       << "The version must be set before parsing extensions";
 
-  if (getDraftMajorVersion(*version_) <= 8) {
+  // The extensions are validated here, but only decoded when accessed
+  size_t numExtensions = 0;
+  std::unique_ptr<folly::IOBuf> serialized;
+  if (traits_.majorVersion <= 8) {
     // We're not using draft 9 or any of its sub-versions
     // Parse the number of extensions
-    auto numExt = quic::decodeQuicInteger(cursor, length);
+    auto numExt = decodeVarint(cursor, length);
     if (!numExt) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
     }
@@ -1585,17 +1606,22 @@ folly::Expected<folly::Unit, ErrorCode> MoQFrameParser::parseExtensions(
       XLOG(ERR) << "numExt > kMaxExtensions =" << numExt->first;
       return folly::makeUnexpected(ErrorCode::PROTOCOL_VIOLATION);
     }
-    // Parse the extensions
+    // Validate the extensions
+    folly::io::Cursor blockStart(cursor);
+    auto lengthBefore = length;
     for (auto i = 0u; i < numExt->first; i++) {
-      auto maybeExtension = parseExtension(cursor, length);
-      if (maybeExtension.hasError()) {
-        return folly::makeUnexpected(maybeExtension.error());
+      auto res = skipExtension(cursor, length);
+      if (res.hasError()) {
+        return folly::makeUnexpected(res.error());
       }
-      objectHeader.extensions.emplace_back(std::move(*maybeExtension));
+    }
+    numExtensions = numExt->first;
+    if (numExtensions > 0) {
+      blockStart.clone(serialized, lengthBefore - length);
     }
   } else {
     // Parse the length of the extension block
-    auto extLen = quic::decodeQuicInteger(cursor, length);
+    auto extLen = decodeVarint(cursor, length);
     if (!extLen) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
     }
@@ -1604,34 +1630,41 @@ folly::Expected<folly::Unit, ErrorCode> MoQFrameParser::parseExtensions(
       XLOG(ERR) << "Extension block length provided exceeds remaining length";
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
     }
-    // Parse the extensions
-    size_t extensionBlockLength = extLen->first;
-    while (extensionBlockLength > 0) {
+    // Validate the extensions
+    folly::io::Cursor blockStart(cursor);
+    size_t remaining = extLen->first;
+    while (remaining > 0) {
       // This won't infinite loop because we're parsing out at least a
       // QuicInteger each time.
-      auto maybeExtension = parseExtension(cursor, extensionBlockLength);
-      if (maybeExtension.hasError()) {
-        return folly::makeUnexpected(maybeExtension.error());
+      auto res = skipExtension(cursor, remaining);
+      if (res.hasError()) {
+        return folly::makeUnexpected(res.error());
       }
-      objectHeader.extensions.emplace_back(std::move(*maybeExtension));
+      numExtensions++;
+    }
+    if (numExtensions > 0) {
+      blockStart.clone(serialized, extLen->first);
     }
     length -= extLen->first;
   }
+  if (numExtensions == 0) {
+    objectHeader.extensions.clear();
+    return folly::unit;
+  }
+  objectHeader.extensions = Extensions(std::move(serialized), numExtensions);
   return folly::unit;
 }
 
-folly::Expected<Extension, ErrorCode> MoQFrameParser::parseExtension(
+folly::Expected<folly::Unit, ErrorCode> MoQFrameParser::skipExtension(
     folly::io::Cursor& cursor,
     size_t& length) const noexcept {
-  auto type = quic::decodeQuicInteger(cursor, length);
+  auto type = decodeVarint(cursor, length);
   if (!type) {
     return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
   }
   length -= type->second;
-  Extension ext;
-  ext.type = type->first;
-  if (ext.type & 0x1) {
-    auto extLen = quic::decodeQuicInteger(cursor, length);
+  if (type->first & 0x1) {
+    auto extLen = decodeVarint(cursor, length);
     if (!extLen) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
     }
@@ -1643,17 +1676,16 @@ folly::Expected<Extension, ErrorCode> MoQFrameParser::parseExtension(
       XLOG(ERR) << "extLen > kMaxExtensionLength =" << extLen->first;
       return folly::makeUnexpected(ErrorCode::PROTOCOL_VIOLATION);
     }
-    cursor.clone(ext.arrayValue, extLen->first);
+    cursor.skip(extLen->first);
     length -= extLen->first;
   } else {
-    auto iVal = quic::decodeQuicInteger(cursor, length);
+    auto iVal = decodeVarint(cursor, length);
     if (!iVal) {
       return folly::makeUnexpected(ErrorCode::PARSE_UNDERFLOW);
     }
     length -= iVal->second;
-    ext.intValue = iVal->first;
   }
-  return ext;
+  return folly::unit;
 }
 
 folly::Expected<std::vector<std::string>, ErrorCode>
@@ -1680,6 +1712,89 @@ MoQFrameParser::parseFixedTuple(folly::io::Cursor& cursor, size_t& length)
   return items;
 }
 
+folly::Optional<std::pair<uint64_t, size_t>> decodeVarint(
+    folly::io::Cursor& cursor,
+    uint64_t atMost) noexcept {
+  // Fast path: the whole varint is in the current buffer, decode it with a
+  // single load instead of a per-byte peek.
+  if (cursor.length() > 0) {
+    const uint8_t* data = cursor.data();
+    size_t encodedLength = size_t(1) << (data[0] >> 6);
+    if (encodedLength <= cursor.length() && encodedLength <= atMost) {
+      uint64_t value = 0;
+      switch (encodedLength) {
+        case 1:
+          value = data[0] & 0x3f;
+          break;
+        case 2:
+          value = folly::Endian::big(folly::loadUnaligned<uint16_t>(data)) &
+              0x3fff;
+          break;
+        case 4:
+          value = folly::Endian::big(folly::loadUnaligned<uint32_t>(data)) &
+              0x3fffffff;
+          break;
+        default:
+          value = folly::Endian::big(folly::loadUnaligned<uint64_t>(data)) &
+              0x3fffffffffffffff;
+          break;
+      }
+      cursor.skip(encodedLength);
+      return std::make_pair(value, encodedLength);
+    }
+  }
+  auto res = quic::decodeQuicInteger(cursor, atMost);
+  if (!res) {
+    return folly::none;
+  }
+  return *res;
+}
+
+namespace {
+// Decodes an extension from a block that was validated when it was parsed
+Extension decodeExtension(folly::io::Cursor& cursor) {
+  Extension ext;
+  ext.type = decodeVarint(cursor).value().first;
+  if (ext.isOddType()) {
+    auto len = decodeVarint(cursor).value().first;
+    cursor.clone(ext.arrayValue, len);
+  } else {
+    ext.intValue = decodeVarint(cursor).value().first;
+  }
+  return ext;
+}
+} // namespace
+
+const std::vector<Extension>& Extensions::values() const {
+  if (serialized_ && !values_) {
+    auto values = std::make_shared<std::vector<Extension>>();
+    values->reserve(numSerialized_);
+    folly::io::Cursor cursor(serialized_.get());
+    while (!cursor.isAtEnd()) {
+      values->emplace_back(decodeExtension(cursor));
+    }
+    values_ = std::move(values);
+  }
+  if (!values_) {
+    static const std::vector<Extension> kNoExtensions;
+    return kNoExtensions;
+  }
+  return *values_;
+}
+
+std::vector<Extension>& Extensions::mutableValues() {
+  values();
+  if (!values_) {
+    values_ = std::make_shared<std::vector<Extension>>();
+  } else if (values_.use_count() > 1) {
+    values_ = std::make_shared<std::vector<Extension>>(*values_);
+  }
+  // Modified extensions are serialized from the values
+  serialized_.reset();
+  numSerialized_ = 0;
+  return *values_;
+}
+
 //// Egress ////
 
 void writeVarint(
@@ -1702,6 +1817,68 @@ void writeVarint(
   }
 }
 
+namespace {
+// Builds a run of varints and bytes in a stack buffer and appends it to the
+// queue in one shot, rather than appending each field separately.
+// flush() must be called before anything else is appended to writeBuf.
+class HeaderWriter {
+ public:
+  HeaderWriter(folly::IOBufQueue& writeBuf, size_t& size, bool& error)
+      : writeBuf_(writeBuf), size_(size), error_(error) {}
+
+  ~HeaderWriter() {
+    flush();
+  }
+
+  HeaderWriter(const HeaderWriter&) = delete;
+  HeaderWriter& operator=(const HeaderWriter&) = delete;
+
+  void writeVarint(uint64_t value) {
+    if (error_) {
+      return;
+    }
+    if (len_ + sizeof(uint64_t) > kCapacity) {
+      flush();
+    }
+    auto res = quic::encodeQuicInteger(value, [this](auto val) {
+      val = folly::Endian::big(val);
+      memcpy(buf_.data() + len_, &val, sizeof(val));
+      len_ += sizeof(val);
+    });
+    if (res.hasError()) {
+      error_ = true;
+    } else {
+      size_ += *res;
+    }
+  }
+
+  void writeByte(uint8_t byte) {
+    if (len_ == kCapacity) {
+      flush();
+    }
+    buf_[len_++] = byte;
+    size_ += 1;
+  }
+
+  void flush() {
+    if (len_ > 0) {
+      writeBuf_.append(buf_.data(), len_);
+      len_ = 0;
+    }
+  }
+
+ private:
+  // Fits the largest object header without extensions
+  static constexpr size_t kCapacity = 64;
+
+  folly::IOBufQueue& writeBuf_;
+  size_t& size_;
+  bool& error_;
+  std::array<uint8_t, kCapacity> buf_;
+  size_t len_{0};
+};
+} // namespace
+
 void writeFixedString(
     folly::IOBufQueue& writeBuf,
     const std::string& str,
@@ -1732,7 +1909,7 @@ void writeTrackNamespace(
     const TrackNamespace& tn,
     size_t& size,
     bool& error) {
-  writeFixedTuple(writeBuf, tn.trackNamespace, size, error);
+  writeFixedTuple(writeBuf, tn.elements(), size, error);
 }
 
 uint16_t* writeFrameHeader(
@@ -1820,7 +1997,7 @@ std::string MoQFrameWriter::encodeTokenValue(
   folly::IOBufQueue writeBuf{folly::IOBufQueue::cacheChainLength()};
   size_t size = 0;
   bool error = false;
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     writeVarint(
         writeBuf, folly::to_underlying(AliasType::USE_VALUE), size, error);
     writeVarint(writeBuf, tokenType, size, error);
@@ -1955,19 +2132,21 @@ WriteResult MoQFrameWriter::writeSubgroupHeader(
   size_t size = 0;
   bool error = false;
   auto streamType = getSubgroupStreamType(
-      *version_,
+      traits_,
       objectHeader.subgroup == 0 ? SubgroupIDFormat::Zero : format,
       includeExtensions);
   auto streamTypeInt = folly::to_underlying(streamType);
-  writeVarint(writeBuf, streamTypeInt, size, error);
-  writeVarint(writeBuf, value(objectHeader.trackIdentifier), size, error);
-  writeVarint(writeBuf, objectHeader.group, size, error);
-  if (streamType == StreamType::SUBGROUP_HEADER ||
-      streamTypeInt & SG_HAS_SUBGROUP_ID) {
-    writeVarint(writeBuf, objectHeader.subgroup, size, error);
-  }
-  writeBuf.append(&objectHeader.priority, 1);
-  size += 1;
+  {
+    HeaderWriter header(writeBuf, size, error);
+    header.writeVarint(streamTypeInt);
+    header.writeVarint(value(objectHeader.trackIdentifier));
+    header.writeVarint(objectHeader.group);
+    if (streamType == StreamType::SUBGROUP_HEADER ||
+        streamTypeInt & SG_HAS_SUBGROUP_ID) {
+      header.writeVarint(objectHeader.subgroup);
+    }
+    header.writeByte(objectHeader.priority);
+  }
   if (error) {
     return folly::makeUnexpected(quic::TransportErrorCode::INTERNAL_ERROR);
   }
@@ -1979,9 +2158,11 @@ WriteResult MoQFrameWriter::writeFetchHeader(
     RequestID requestID) const noexcept {
   size_t size = 0;
   bool error = false;
-  writeVarint(
-      writeBuf, folly::to_underlying(StreamType::FETCH_HEADER), size, error);
-  writeVarint(writeBuf, requestID.value, size, error);
+  {
+    HeaderWriter header(writeBuf, size, error);
+    header.writeVarint(folly::to_underlying(StreamType::FETCH_HEADER));
+    header.writeVarint(requestID.value);
+  }
   if (error) {
     return folly::makeUnexpected(quic::TransportErrorCode::INTERNAL_ERROR);
   }
@@ -1992,7 +2173,7 @@ WriteResult MoQFrameWriter::writeSingleObjectStream(
     folly::IOBufQueue& writeBuf,
     const ObjectHeader& objectHeader,
     std::unique_ptr<folly::IOBuf> objectPayload) const noexcept {
-  bool v11Plus = getDraftMajorVersion(*version_) >= 11;
+  bool v11Plus = !traits_.legacy;
   bool hasExtensions = !v11Plus || objectHeader.extensions.size() > 0;
   auto res = writeSubgroupHeader(
       writeBuf,
@@ -2015,10 +2196,10 @@ WriteResult MoQFrameWriter::writeSingleObjectStream(
 
 void MoQFrameWriter::writeExtensions(
     folly::IOBufQueue& writeBuf,
-    const std::vector<Extension>& extensions,
+    const Extensions& extensions,
     size_t& size,
     bool& error) const noexcept {
-  if (getDraftMajorVersion(*version_) <= 8) {
+  if (traits_.majorVersion <= 8) {
     // Not draft 9 or any of its sub-versions. Write out the number of
     // extensions
     writeVarint(writeBuf, extensions.size(), size, error);
@@ -2031,14 +2212,23 @@ void MoQFrameWriter::writeExtensions(
     }
     writeVarint(writeBuf, extLen, size, error);
   }
+  if (auto serialized = extensions.serialized()) {
+    // Unmodified since they were parsed, forward the bytes as is
+    for (auto range : *serialized) {
+      writeBuf.append(range.data(), range.size());
+      size += range.size();
+    }
+    return;
+  }
   for (const auto& ext : extensions) {
     writeVarint(writeBuf, ext.type, size, error);
     if (ext.isOddType()) {
       // odd = length prefix
       if (ext.arrayValue) {
-        writeVarint(
-            writeBuf, ext.arrayValue->computeChainDataLength(), size, error);
+        auto arrayLength = ext.arrayValue->computeChainDataLength();
+        writeVarint(writeBuf, arrayLength, size, error);
         writeBuf.append(ext.arrayValue->clone());
+        size += arrayLength;
       } else {
         writeVarint(writeBuf, 0, size, error);
       }
@@ -2051,12 +2241,15 @@ void MoQFrameWriter::writeExtensions(
 }
 
 size_t MoQFrameWriter::getExtensionSize(
-    const std::vector<Extension>& extensions,
+    const Extensions& extensions,
     bool& error) const noexcept {
   size_t size = 0;
   if (error) {
     return 0;
   }
+  if (auto serialized = extensions.serialized()) {
+    return serialized->computeChainDataLength();
+  }
   for (const auto& ext : extensions) {
     auto maybeTypeSize = quic::getQuicIntegerSize(ext.type);
     if (maybeTypeSize.hasError()) {
@@ -2108,12 +2301,12 @@ void MoQFrameWriter::writeTrackRequestParams(
   for (auto& param : params) {
     writeVarint(writeBuf, param.key, size, error);
 
-    if (param.key == getAuthorizationParamKey(*version_)) {
+    if (param.key == traits_.authorizationParamKey) {
       writeFixedString(writeBuf, param.asString, size, error);
     } else if (
-        param.key == getDeliveryTimeoutParamKey(*version_) ||
-        param.key == getMaxCacheDurationParamKey(*version_)) {
-      if (getDraftMajorVersion(*version_) < 11) {
+        param.key == traits_.deliveryTimeoutParamKey ||
+        param.key == traits_.maxCacheDurationParamKey) {
+      if (traits_.legacy) {
         auto res = quic::getQuicIntegerSize(param.asUint64);
         if (!res) {
           error = true;
@@ -2136,38 +2329,28 @@ WriteResult MoQFrameWriter::writeDatagramObject(
   bool hasExtensions = objectHeader.extensions.size() > 0;
   CHECK(!hasLength || objectHeader.status == ObjectStatus::NORMAL)
       << "non-zero length objects require NORMAL status";
-  if (objectHeader.status != ObjectStatus::NORMAL || !hasLength) {
+  bool statusOnly = objectHeader.status != ObjectStatus::NORMAL || !hasLength;
+  if (statusOnly) {
     CHECK(!objectPayload || objectPayload->computeChainDataLength() == 0)
         << "non-empty objectPayload with no header length";
-    writeVarint(
-        writeBuf,
-        folly::to_underlying(getDatagramType(*version_, true, hasExtensions)),
-        size,
-        error);
-    writeVarint(writeBuf, value(objectHeader.trackIdentifier), size, error);
-    writeVarint(writeBuf, objectHeader.group, size, error);
-    writeVarint(writeBuf, objectHeader.id, size, error);
-    writeBuf.append(&objectHeader.priority, 1);
-    size += 1;
-    if (getDraftMajorVersion(*version_) < 11 || hasExtensions) {
+  }
+  {
+    HeaderWriter header(writeBuf, size, error);
+    header.writeVarint(folly::to_underlying(
+        getDatagramType(traits_, statusOnly, hasExtensions)));
+    header.writeVarint(value(objectHeader.trackIdentifier));
+    header.writeVarint(objectHeader.group);
+    header.writeVarint(objectHeader.id);
+    header.writeByte(objectHeader.priority);
+    if (traits_.legacy || hasExtensions) {
+      header.flush();
       writeExtensions(writeBuf, objectHeader.extensions, size, error);
     }
-    writeVarint(
-        writeBuf, folly::to_underlying(objectHeader.status), size, error);
-  } else {
-    writeVarint(
-        writeBuf,
-        folly::to_underlying(getDatagramType(*version_, false, hasExtensions)),
-        size,
-        error);
-    writeVarint(writeBuf, value(objectHeader.trackIdentifier), size, error);
-    writeVarint(writeBuf, objectHeader.group, size, error);
-    writeVarint(writeBuf, objectHeader.id, size, error);
-    writeBuf.append(&objectHeader.priority, 1);
-    size += 1;
-    if (getDraftMajorVersion(*version_) < 11 || hasExtensions) {
-      writeExtensions(writeBuf, objectHeader.extensions, size, error);
+    if (statusOnly) {
+      header.writeVarint(folly::to_underlying(objectHeader.status));
     }
+  }
+  if (!statusOnly) {
     writeBuf.append(std::move(objectPayload));
   }
   if (error) {
@@ -2176,6 +2359,25 @@ WriteResult MoQFrameWriter::writeDatagramObject(
   return size;
 }
 
+thread_local ObjectHeaderFanoutScope* ObjectHeaderFanoutScope::current_{
+    nullptr};
+
+const ObjectHeaderFanoutScope::Entry* ObjectHeaderFanoutScope::find(
+    uint64_t version,
+    StreamType streamType,
+    const ObjectHeader& objectHeader) const {
+  for (const auto& entry : entries_) {
+    if (entry.version == version && entry.streamType == streamType &&
+        entry.group == objectHeader.group &&
+        entry.subgroup == objectHeader.subgroup &&
+        entry.id == objectHeader.id && entry.length == objectHeader.length &&
+        entry.status == objectHeader.status) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
 WriteResult MoQFrameWriter::writeStreamObject(
     folly::IOBufQueue& writeBuf,
     StreamType streamType,
@@ -2183,33 +2385,47 @@ WriteResult MoQFrameWriter::writeStreamObject(
     std::unique_ptr<folly::IOBuf> objectPayload) const noexcept {
   size_t size = 0;
   bool error = false;
-  if (streamType == StreamType::FETCH_HEADER) {
-    writeVarint(writeBuf, objectHeader.group, size, error);
-    writeVarint(writeBuf, objectHeader.subgroup, size, error);
-    writeVarint(writeBuf, objectHeader.id, size, error);
-    writeBuf.append(&objectHeader.priority, 1);
-    size += 1;
-  } else {
-    writeVarint(writeBuf, objectHeader.id, size, error);
-  }
-  if (folly::to_underlying(streamType) & 0x1 ||
-      streamType == StreamType::SUBGROUP_HEADER) {
-    // includes FETCH, watch out if we add more types!
-    writeExtensions(writeBuf, objectHeader.extensions, size, error);
-  }
   bool hasLength = objectHeader.length && *objectHeader.length > 0;
   CHECK(!hasLength || objectHeader.status == ObjectStatus::NORMAL)
       << "non-zero length objects require NORMAL status";
+  CHECK(hasLength || !objectPayload ||
+        objectPayload->computeChainDataLength() == 0)
+      << "non-empty objectPayload with no header length";
+  auto scope = ObjectHeaderFanoutScope::current();
+  if (scope && version_) {
+    auto entry = scope->find(*version_, streamType, objectHeader);
+    if (entry) {
+      writeBuf.append(entry->bytes.data(), entry->bytes.size());
+      size += entry->bytes.size();
+    } else {
+      folly::IOBufQueue headerBuf{folly::IOBufQueue::cacheChainLength()};
+      writeStreamObjectHeader(headerBuf, streamType, objectHeader, size, error);
+      if (!error) {
+        auto header = headerBuf.move();
+        std::string bytes;
+        if (header) {
+          header->coalesce();
+          bytes.assign(
+              reinterpret_cast<const char*>(header->data()), header->length());
+        }
+        writeBuf.append(bytes.data(), bytes.size());
+        scope->entries_.push_back(
+            {*version_,
+             streamType,
+             objectHeader.group,
+             objectHeader.subgroup,
+             objectHeader.id,
+             objectHeader.length,
+             objectHeader.status,
+             std::move(bytes)});
+      }
+    }
+  } else {
+    writeStreamObjectHeader(writeBuf, streamType, objectHeader, size, error);
+  }
   if (hasLength) {
-    writeVarint(writeBuf, *objectHeader.length, size, error);
     writeBuf.append(std::move(objectPayload));
     // TODO: adjust size?
-  } else {
-    CHECK(!objectPayload || objectPayload->computeChainDataLength() == 0)
-        << "non-empty objectPayload with no header length";
-    writeVarint(writeBuf, 0, size, error);
-    writeVarint(
-        writeBuf, folly::to_underlying(objectHeader.status), size, error);
   }
   if (error) {
     return folly::makeUnexpected(quic::TransportErrorCode::INTERNAL_ERROR);
@@ -2217,6 +2433,40 @@ WriteResult MoQFrameWriter::writeStreamObject(
   return size;
 }
 
+void MoQFrameWriter::writeStreamObjectHeader(
+    folly::IOBufQueue& writeBuf,
+    StreamType streamType,
+    const ObjectHeader& objectHeader,
+    size_t& size,
+    bool& error) const noexcept {
+  HeaderWriter header(writeBuf, size, error);
+  if (streamType == StreamType::FETCH_HEADER) {
+    header.writeVarint(objectHeader.group);
+    header.writeVarint(objectHeader.subgroup);
+    header.writeVarint(objectHeader.id);
+    header.writeByte(objectHeader.priority);
+  } else {
+    header.writeVarint(objectHeader.id);
+  }
+  if (folly::to_underlying(streamType) & 0x1 ||
+      streamType == StreamType::SUBGROUP_HEADER) {
+    // includes FETCH, watch out if we add more types!
+    if (objectHeader.extensions.empty()) {
+      // Zero extension count or zero length extension block
+      header.writeVarint(0);
+    } else {
+      header.flush();
+      writeExtensions(writeBuf, objectHeader.extensions, size, error);
+    }
+  }
+  if (objectHeader.length && *objectHeader.length > 0) {
+    header.writeVarint(*objectHeader.length);
+  } else {
+    header.writeVarint(0);
+    header.writeVarint(folly::to_underlying(objectHeader.status));
+  }
+}
+
 WriteResult MoQFrameWriter::writeSubscribeRequest(
     folly::IOBufQueue& writeBuf,
     const SubscribeRequest& subscribeRequest) const noexcept {
@@ -2233,7 +2483,7 @@ WriteResult MoQFrameWriter::writeSubscribeRequest(
   uint8_t order = folly::to_underlying(subscribeRequest.groupOrder);
   writeBuf.append(&order, 1);
   size += 1;
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     uint8_t forwardFlag = (subscribeRequest.forward) ? 1 : 0;
     writeBuf.append(&forwardFlag, 1);
     size += 1;
@@ -2286,7 +2536,7 @@ WriteResult MoQFrameWriter::writeSubscribeUpdate(
   writeVarint(writeBuf, update.endGroup, size, error);
   writeBuf.append(&update.priority, 1);
   size += 1;
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     uint8_t forwardFlag = (update.forward) ? 1 : 0;
     writeBuf.append(&forwardFlag, 1);
     size += 1;
@@ -2406,7 +2656,7 @@ WriteResult MoQFrameWriter::writeSubscribeDone(
       writeBuf, folly::to_underlying(subscribeDone.statusCode), size, error);
   writeVarint(writeBuf, subscribeDone.streamCount, size, error);
   writeFixedString(writeBuf, subscribeDone.reasonPhrase, size, error);
-  if (getDraftMajorVersion(*version_) <= 9) {
+  if (traits_.majorVersion <= 9) {
     writeVarint(writeBuf, 0, size, error);
   }
   writeSize(sizePtr, size, error, *version_);
@@ -2423,7 +2673,7 @@ WriteResult MoQFrameWriter::writeAnnounce(
   size_t size = 0;
   bool error = false;
   auto sizePtr = writeFrameHeader(writeBuf, FrameType::ANNOUNCE, error);
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     writeVarint(writeBuf, announce.requestID.value, size, error);
   }
   writeTrackNamespace(writeBuf, announce.trackNamespace, size, error);
@@ -2442,7 +2692,7 @@ WriteResult MoQFrameWriter::writeAnnounceOk(
   size_t size = 0;
   bool error = false;
   auto sizePtr = writeFrameHeader(writeBuf, FrameType::ANNOUNCE_OK, error);
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     writeVarint(writeBuf, announceOk.requestID.value, size, error);
   } else {
     writeTrackNamespace(writeBuf, announceOk.trackNamespace, size, error);
@@ -2462,7 +2712,7 @@ WriteResult MoQFrameWriter::writeAnnounceError(
   size_t size = 0;
   bool error = false;
   auto sizePtr = writeFrameHeader(writeBuf, FrameType::ANNOUNCE_ERROR, error);
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     writeVarint(writeBuf, announceError.requestID.value, size, error);
   } else {
     writeTrackNamespace(writeBuf, announceError.trackNamespace, size, error);
@@ -2521,11 +2771,11 @@ WriteResult MoQFrameWriter::writeTrackStatusRequest(
   bool error = false;
   auto sizePtr =
       writeFrameHeader(writeBuf, FrameType::TRACK_STATUS_REQUEST, error);
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     writeVarint(writeBuf, trackStatusRequest.requestID.value, size, error);
   }
   writeFullTrackName(writeBuf, trackStatusRequest.fullTrackName, size, error);
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     writeTrackRequestParams(writeBuf, trackStatusRequest.params, size, error);
   }
   writeSize(sizePtr, size, error, *version_);
@@ -2543,7 +2793,7 @@ WriteResult MoQFrameWriter::writeTrackStatus(
   size_t size = 0;
   bool error = false;
   auto sizePtr = writeFrameHeader(writeBuf, FrameType::TRACK_STATUS, error);
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     writeVarint(writeBuf, trackStatus.requestID.value, size, error);
   } else {
     writeFullTrackName(writeBuf, trackStatus.fullTrackName, size, error);
@@ -2558,7 +2808,7 @@ WriteResult MoQFrameWriter::writeTrackStatus(
     writeVarint(writeBuf, 0, size, error);
     writeVarint(writeBuf, 0, size, error);
   }
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     writeTrackRequestParams(writeBuf, trackStatus.params, size, error);
   }
   writeSize(sizePtr, size, error, *version_);
@@ -2592,7 +2842,7 @@ WriteResult MoQFrameWriter::writeSubscribeAnnounces(
   bool error = false;
   auto sizePtr =
       writeFrameHeader(writeBuf, FrameType::SUBSCRIBE_ANNOUNCES, error);
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     writeVarint(writeBuf, subscribeAnnounces.requestID.value, size, error);
   }
   writeTrackNamespace(
@@ -2614,7 +2864,7 @@ WriteResult MoQFrameWriter::writeSubscribeAnnouncesOk(
   bool error = false;
   auto sizePtr =
       writeFrameHeader(writeBuf, FrameType::SUBSCRIBE_ANNOUNCES_OK, error);
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     writeVarint(writeBuf, subscribeAnnouncesOk.requestID.value, size, error);
   } else {
     writeTrackNamespace(
@@ -2636,7 +2886,7 @@ WriteResult MoQFrameWriter::writeSubscribeAnnouncesError(
   bool error = false;
   auto sizePtr =
       writeFrameHeader(writeBuf, FrameType::SUBSCRIBE_ANNOUNCES_ERROR, error);
-  if (getDraftMajorVersion(*version_) >= 11) {
+  if (!traits_.legacy) {
     writeVarint(writeBuf, subscribeAnnouncesError.requestID.value, size, error);
   } else {
     writeTrackNamespace(
@@ -2701,7 +2951,7 @@ WriteResult MoQFrameWriter::writeFetch(
     CHECK(joining);
 
     if (joining->fetchType == FetchType::ABSOLUTE_JOINING &&
-        getDraftMajorVersion(*version_) < 11) {
+        traits_.legacy) {
       // Absolute joining is only supported in draft-11 and above
       return folly::makeUnexpected(quic::TransportErrorCode::INTERNAL_ERROR);
     }
@@ -252,6 +252,12 @@ void writeVarint(
     size_t& size,
     bool& error) noexcept;
 
+// Decodes a QUIC varint like quic::decodeQuicInteger.  When the whole varint
+// is in the cursor's current buffer it is decoded with a single load.
+folly::Optional<std::pair<uint64_t, size_t>> decodeVarint(
+    folly::io::Cursor& cursor,
+    uint64_t atMost = sizeof(uint64_t)) noexcept;
+
 struct ClientSetup {
   std::vector<uint64_t> supportedVersions;
   std::vector<SetupParameter> params;
@@ -408,7 +414,99 @@ struct Extension {
   }
 };
 
-using Extensions = std::vector<Extension>;
+class MoQFrameParser;
+
+// The extension headers of an object.
+//
+// Extensions parsed off the wire keep the serialized extension block and are
+// only decoded into Extension values when they are accessed.  Copying shares
+// the serialized block (or the values, for extensions built by the
+// application), so a relay that caches and forwards objects without looking
+// at their extensions never allocates or clones per extension.  The block is
+// written back out verbatim until the extensions are modified.
+//
+// Decoding on access modifies the object, so a const Extensions must not be
+// read from multiple threads at once.
+class Extensions {
+ public:
+  using value_type = Extension;
+  using const_iterator = std::vector<Extension>::const_iterator;
+  using iterator = const_iterator;
+
+  Extensions() = default;
+  /* implicit */ Extensions(std::vector<Extension> extensions)
+      : values_(
+            extensions.empty() ? nullptr
+                               : std::make_shared<std::vector<Extension>>(
+                                     std::move(extensions))) {}
+  Extensions(std::initializer_list<Extension> extensions)
+      : Extensions(std::vector<Extension>(extensions)) {}
+
+  size_t size() const {
+    return serialized_ ? numSerialized_ : (values_ ? values_->size() : 0);
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  // Decodes the extensions if they have not been already
+  const std::vector<Extension>& values() const;
+
+  const_iterator begin() const {
+    return values().begin();
+  }
+
+  const_iterator end() const {
+    return values().end();
+  }
+
+  const Extension& operator[](size_t i) const {
+    return values()[i];
+  }
+
+  // Decoded and not shared with any copy, so values can be modified or moved
+  // out.  Clears serialized().
+  std::vector<Extension>& mutableValues();
+
+  void push_back(Extension ext) {
+    mutableValues().push_back(std::move(ext));
+  }
+
+  template <typename... Args>
+  Extension& emplace_back(Args&&... args) {
+    return mutableValues().emplace_back(std::forward<Args>(args)...);
+  }
+
+  void clear() {
+    serialized_.reset();
+    numSerialized_ = 0;
+    values_.reset();
+  }
+
+  // The type/value pairs exactly as parsed, without the count or length
+  // prefix.  nullptr if the extensions were built locally or modified.
+  const folly::IOBuf* serialized() const {
+    return serialized_.get();
+  }
+
+  friend bool operator==(const Extensions& a, const Extensions& b) {
+    return a.size() == b.size() && (a.empty() || a.values() == b.values());
+  }
+
+ private:
+  friend class MoQFrameParser;
+
+  // serialized has been validated by the parser
+  Extensions(std::unique_ptr<folly::IOBuf> serialized, size_t numExtensions)
+      : serialized_(std::move(serialized)), numSerialized_(numExtensions) {}
+
+  std::shared_ptr<const folly::IOBuf> serialized_;
+  size_t numSerialized_{0};
+  // Shared between copies, copied before modification
+  mutable std::shared_ptr<std::vector<Extension>> values_;
+};
+
 inline Extensions noExtensions() {
   return Extensions();
 }
@@ -421,7 +519,7 @@ struct ObjectHeader {
       uint64_t idIn,
       uint8_t priorityIn = 128,
       ObjectStatus statusIn = ObjectStatus::NORMAL,
-      std::vector<Extension> extensionsIn = noExtensions(),
+      Extensions extensionsIn = noExtensions(),
       folly::Optional<uint64_t> lengthIn = folly::none)
       : trackIdentifier(trackIdentifierIn),
         group(groupIn),
@@ -438,7 +536,7 @@ struct ObjectHeader {
       uint64_t idIn,
       uint8_t priorityIn,
       uint64_t lengthIn,
-      std::vector<Extension> extensionsIn = noExtensions())
+      Extensions extensionsIn = noExtensions())
       : trackIdentifier(trackIdentifierIn),
         group(groupIn),
         subgroup(subgroupIn),
@@ -453,7 +551,7 @@ struct ObjectHeader {
   uint64_t id;
   uint8_t priority{kDefaultPriority};
   ObjectStatus status{ObjectStatus::NORMAL};
-  std::vector<Extension> extensions;
+  Extensions extensions;
   folly::Optional<uint64_t> length{folly::none};
 
   // == Operator For Datagram Testing
@@ -473,6 +571,20 @@ uint64_t getDeliveryTimeoutParamKey(uint64_t version);
 
 uint64_t getMaxCacheDurationParamKey(uint64_t version);
 
+// Wire format choices fixed by the negotiated draft.  The framer derives
+// them once when its version is set, not per field.
+struct DraftTraits {
+  uint64_t majorVersion{0};
+  // Below draft 11
+  bool legacy{false};
+  uint8_t requestIDMultiplier{1};
+  uint64_t authorizationParamKey{0};
+  uint64_t deliveryTimeoutParamKey{0};
+  uint64_t maxCacheDurationParamKey{0};
+};
+
+DraftTraits getDraftTraits(uint64_t version);
+
 enum class LocationType : uint8_t {
   NextGroupStart = 1,
   LatestObject = 2,
@@ -527,30 +639,37 @@ constexpr AbsoluteLocation kLocationMax{
     quic::kEightByteLimit,
     quic::kEightByteLimit};
 
-struct TrackNamespace {
-  std::vector<std::string> trackNamespace;
-
+// A namespace tuple.  The hash is computed when the tuple changes rather than
+// on each lookup, and unequal namespaces usually compare unequal on the hash
+// alone.  Elements are only modified through the member functions, which
+// keep the hash up to date.
+class TrackNamespace {
+ public:
   TrackNamespace() = default;
-  explicit TrackNamespace(std::vector<std::string> tns) {
-    trackNamespace = std::move(tns);
+  explicit TrackNamespace(std::vector<std::string> tns)
+      : trackNamespace_(std::move(tns)) {
+    rehash();
   }
   explicit TrackNamespace(std::string tns, std::string delimiter) {
-    folly::split(delimiter, tns, trackNamespace);
+    folly::split(delimiter, tns, trackNamespace_);
+    rehash();
   }
 
   bool operator==(const TrackNamespace& other) const {
-    return trackNamespace == other.trackNamespace;
+    return hash_ == other.hash_ && trackNamespace_ == other.trackNamespace_;
   }
   bool operator<(const TrackNamespace& other) const {
-    return trackNamespace < other.trackNamespace;
+    return trackNamespace_ < other.trackNamespace_;
   }
   const std::string& operator[](size_t i) const {
-    return trackNamespace[i];
+    return trackNamespace_[i];
+  }
+  const std::vector<std::string>& elements() const {
+    return trackNamespace_;
   }
   struct hash {
     size_t operator()(const TrackNamespace& tn) const {
-      return folly::hash::hash_range(
-          tn.trackNamespace.begin(), tn.trackNamespace.end());
+      return tn.hash_;
     }
   };
   friend std::ostream& operator<<(
@@ -562,36 +681,41 @@ struct TrackNamespace {
 
   std::string describe() const {
     std::string result;
-    if (trackNamespace.empty()) {
+    if (trackNamespace_.empty()) {
       return result;
     }
 
     // Iterate through all elements except the last one
-    for (size_t i = 0; i < trackNamespace.size() - 1; ++i) {
-      result += trackNamespace[i];
+    for (size_t i = 0; i < trackNamespace_.size() - 1; ++i) {
+      result += trackNamespace_[i];
       result += '/';
     }
 
     // Add the last element without a trailing slash
-    result += trackNamespace.back();
+    result += trackNamespace_.back();
     return result;
   }
   bool empty() const {
-    return trackNamespace.empty() ||
-        (trackNamespace.size() == 1 && trackNamespace[0].empty());
+    return trackNamespace_.empty() ||
+        (trackNamespace_.size() == 1 && trackNamespace_[0].empty());
   }
   size_t size() const {
-    return trackNamespace.size();
+    return trackNamespace_.size();
   }
   void append(std::string token) {
-    trackNamespace.emplace_back(std::move(token));
+    hash_ = combineHash(hash_, token);
+    trackNamespace_.emplace_back(std::move(token));
+  }
+  void set(size_t i, std::string token) {
+    trackNamespace_[i] = std::move(token);
+    rehash();
   }
   bool startsWith(const TrackNamespace& other) const {
-    if (other.trackNamespace.size() > trackNamespace.size()) {
+    if (other.trackNamespace_.size() > trackNamespace_.size()) {
       return false;
     }
-    for (size_t i = 0; i < other.trackNamespace.size(); ++i) {
-      if (other.trackNamespace[i] != trackNamespace[i]) {
+    for (size_t i = 0; i < other.trackNamespace_.size(); ++i) {
+      if (other.trackNamespace_[i] != trackNamespace_[i]) {
         return false;
       }
     }
@@ -599,8 +723,24 @@ struct TrackNamespace {
   }
   void trimEnd() {
     CHECK_GT(size(), 0);
-    trackNamespace.pop_back();
+    trackNamespace_.pop_back();
+    rehash();
+  }
+
+ private:
+  static size_t combineHash(size_t seed, const std::string& token) {
+    return folly::hash::hash_128_to_64(
+        seed, folly::hasher<std::string>()(token));
+  }
+  void rehash() {
+    hash_ = 0;
+    for (const auto& token : trackNamespace_) {
+      hash_ = combineHash(hash_, token);
+    }
   }
+
+  std::vector<std::string> trackNamespace_;
+  size_t hash_{0};
 };
 
 struct FullTrackName {
@@ -871,10 +1011,10 @@ struct UnsubscribeAnnounces {
 
 enum class SubgroupIDFormat : uint8_t { Present, Zero, FirstObject };
 inline StreamType getSubgroupStreamType(
-    uint64_t version,
+    const DraftTraits& traits,
     SubgroupIDFormat format,
     bool includeExtensions) {
-  if (getDraftMajorVersion(version) < 11) {
+  if (traits.legacy) {
     return StreamType::SUBGROUP_HEADER;
   }
   return StreamType(
@@ -884,14 +1024,29 @@ inline StreamType getSubgroupStreamType(
       (includeExtensions ? SG_HAS_EXTENSIONS : 0));
 }
 
-inline StreamType
-getDatagramType(uint64_t version, bool status, bool includeExtensions) {
-  return getDraftMajorVersion(version) < 11
+inline StreamType getSubgroupStreamType(
+    uint64_t version,
+    SubgroupIDFormat format,
+    bool includeExtensions) {
+  return getSubgroupStreamType(
+      getDraftTraits(version), format, includeExtensions);
+}
+
+inline StreamType getDatagramType(
+    const DraftTraits& traits,
+    bool status,
+    bool includeExtensions) {
+  return traits.legacy
       ? (status ? StreamType::OBJECT_DATAGRAM_STATUS
                 : StreamType::OBJECT_DATAGRAM_EXT)
       : (StreamType((status ? 0x2 : 0) | (includeExtensions ? 0x1 : 0)));
 }
 
+inline StreamType
+getDatagramType(uint64_t version, bool status, bool includeExtensions) {
+  return getDatagramType(getDraftTraits(version), status, includeExtensions);
+}
+
 folly::Expected<std::string, ErrorCode> parseFixedString(
     folly::io::Cursor& cursor,
     size_t& length);
@@ -1023,12 +1178,18 @@ class MoQFrameParser {
   void initializeVersion(uint64_t versionIn) {
     CHECK(!version_) << "Version already initialized";
     version_ = versionIn;
+    traits_ = getDraftTraits(versionIn);
   }
 
   folly::Optional<uint64_t> getVersion() const {
     return version_;
   }
 
+  // Valid once the version is initialized
+  const DraftTraits& draftTraits() const {
+    return traits_;
+  }
+
   void setTokenCacheMaxSize(size_t size) {
     tokenCache_.setMaxSize(size);
   }
@@ -1066,11 +1227,13 @@ class MoQFrameParser {
       size_t& length,
       ObjectHeader& objectHeader) const noexcept;
 
-  folly::Expected<Extension, ErrorCode> parseExtension(
+  // Validates and skips one extension
+  folly::Expected<folly::Unit, ErrorCode> skipExtension(
       folly::io::Cursor& cursor,
       size_t& length) const noexcept;
 
   folly::Optional<uint64_t> version_;
+  DraftTraits traits_;
   mutable MoQTokenCache tokenCache_;
 };
 
@@ -1091,6 +1254,52 @@ WriteResult writeServerSetup(
     const ServerSetup& serverSetup,
     uint64_t version) noexcept;
 
+// While an ObjectHeaderFanoutScope is alive on the current thread,
+// MoQFrameWriter::writeStreamObject encodes each distinct object header once
+// per version and stream type and copies the cached bytes for every other
+// stream it is written to.  A fan-out (eg: MoQForwarder) opens one around
+// delivering a single object to all of its subscribers.
+class ObjectHeaderFanoutScope {
+ public:
+  ObjectHeaderFanoutScope() : prev_(current_) {
+    current_ = this;
+  }
+  ObjectHeaderFanoutScope(const ObjectHeaderFanoutScope&) = delete;
+  ObjectHeaderFanoutScope& operator=(const ObjectHeaderFanoutScope&) = delete;
+  ObjectHeaderFanoutScope(ObjectHeaderFanoutScope&&) = delete;
+  ObjectHeaderFanoutScope& operator=(ObjectHeaderFanoutScope&&) = delete;
+  ~ObjectHeaderFanoutScope() {
+    current_ = prev_;
+  }
+
+  static ObjectHeaderFanoutScope* current() {
+    return current_;
+  }
+
+ private:
+  friend class MoQFrameWriter;
+
+  struct Entry {
+    uint64_t version;
+    StreamType streamType;
+    uint64_t group;
+    uint64_t subgroup;
+    uint64_t id;
+    folly::Optional<uint64_t> length;
+    ObjectStatus status;
+    std::string bytes;
+  };
+
+  const Entry* find(
+      uint64_t version,
+      StreamType streamType,
+      const ObjectHeader& objectHeader) const;
+
+  static thread_local ObjectHeaderFanoutScope* current_;
+  ObjectHeaderFanoutScope* prev_;
+  std::vector<Entry> entries_;
+};
+
 // writeClientSetup and writeServerSetup are the only two functions that
 // are version-agnostic, so we are leaving them out of the MoQFrameWriter.
 class MoQFrameWriter {
@@ -1234,20 +1443,34 @@ class MoQFrameWriter {
   void initializeVersion(uint64_t versionIn) {
     CHECK(!version_) << "Version already initialized";
     version_ = versionIn;
+    traits_ = getDraftTraits(versionIn);
   }
 
   folly::Optional<uint64_t> getVersion() const {
     return version_;
   }
 
+  // Valid once the version is initialized
+  const DraftTraits& draftTraits() const {
+    return traits_;
+  }
+
  private:
   void writeExtensions(
       folly::IOBufQueue& writeBuf,
-      const std::vector<Extension>& extensions,
+      const Extensions& extensions,
+      size_t& size,
+      bool& error) const noexcept;
+
+  // Everything in a stream object except the payload
+  void writeStreamObjectHeader(
+      folly::IOBufQueue& writeBuf,
+      StreamType streamType,
+      const ObjectHeader& objectHeader,
       size_t& size,
       bool& error) const noexcept;
 
-  size_t getExtensionSize(const std::vector<Extension>& extensions, bool& error)
+  size_t getExtensionSize(const Extensions& extensions, bool& error)
       const noexcept;
 
   void writeTrackRequestParams(
@@ -1257,6 +1480,7 @@ class MoQFrameWriter {
       bool& error) const noexcept;
 
   folly::Optional<uint64_t> version_;
+  DraftTraits traits_;
 };
 
 } // namespace moxygen
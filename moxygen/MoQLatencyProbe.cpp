@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <moxygen/MoQLatencyProbe.h>
+
+#include <folly/io/Cursor.h>
+#include <folly/logging/xlog.h>
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+using namespace moxygen;
+
+uint64_t elapsedUs(uint64_t fromUs, uint64_t toUs) {
+  // Clocks of different hosts can be behind each other
+  return toUs > fromUs ? toUs - fromUs : 0;
+}
+
+class ProbeSubgroupStamper : public SubgroupConsumer {
+ public:
+  explicit ProbeSubgroupStamper(std::shared_ptr<SubgroupConsumer> downstream)
+      : downstream_(std::move(downstream)) {}
+
+  folly::Expected<folly::Unit, MoQPublishError> object(
+      uint64_t objectID,
+      Payload payload,
+      Extensions extensions,
+      bool finSubgroup) override {
+    appendProbeHop(extensions);
+    return downstream_->object(
+        objectID, std::move(payload), std::move(extensions), finSubgroup);
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objects(
+      std::span<SubgroupObject> batch,
+      bool finSubgroup) override {
+    auto nowUs = probeTimestampUs();
+    for (auto& obj : batch) {
+      appendProbeHop(obj.extensions, nowUs);
+    }
+    return downstream_->objects(batch, finSubgroup);
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objectNotExists(
+      uint64_t objectID,
+      Extensions extensions,
+      bool finSubgroup) override {
+    return downstream_->objectNotExists(
+        objectID, std::move(extensions), finSubgroup);
+  }
+
+  void checkpoint() override {
+    downstream_->checkpoint();
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> beginObject(
+      uint64_t objectID,
+      uint64_t length,
+      Payload initialPayload,
+      Extensions extensions) override {
+    appendProbeHop(extensions);
+    return downstream_->beginObject(
+        objectID, length, std::move(initialPayload), std::move(extensions));
+  }
+
+  folly::Expected<ObjectPublishStatus, MoQPublishError> objectPayload(
+      Payload payload,
+      bool finSubgroup) override {
+    return downstream_->objectPayload(std::move(payload), finSubgroup);
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> endOfGroup(
+      uint64_t endOfGroupObjectID,
+      Extensions extensions) override {
+    return downstream_->endOfGroup(endOfGroupObjectID, std::move(extensions));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> endOfTrackAndGroup(
+      uint64_t endOfTrackObjectID,
+      Extensions extensions) override {
+    return downstream_->endOfTrackAndGroup(
+        endOfTrackObjectID, std::move(extensions));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> endOfSubgroup() override {
+    return downstream_->endOfSubgroup();
+  }
+
+  void reset(ResetStreamErrorCode error) override {
+    downstream_->reset(error);
+  }
+
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitReadyToConsume() override {
+    return downstream_->awaitReadyToConsume();
+  }
+
+ private:
+  std::shared_ptr<SubgroupConsumer> downstream_;
+};
+
+} // namespace
+
+namespace moxygen {
+
+uint64_t probeTimestampUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+Extensions makeProbeExtensions(uint64_t timestampUs) {
+  folly::IOBufQueue value{folly::IOBufQueue::cacheChainLength()};
+  size_t size = 0;
+  bool error = false;
+  writeVarint(value, timestampUs, size, error);
+  return Extensions{Extension(kLatencyProbeExtension, value.move())};
+}
+
+bool appendProbeHop(Extensions& extensions, uint64_t timestampUs) {
+  if (extensions.empty()) {
+    return false;
+  }
+  auto it = std::find_if(
+      extensions.begin(), extensions.end(), [](const Extension& ext) {
+        return ext.type == kLatencyProbeExtension;
+      });
+  if (it == extensions.end()) {
+    return false;
+  }
+  auto values = extensions.values();
+  auto& ext = values[it - extensions.begin()];
+  folly::IOBufQueue value{folly::IOBufQueue::cacheChainLength()};
+  if (ext.arrayValue) {
+    value.append(std::move(ext.arrayValue));
+  }
+  size_t size = 0;
+  bool error = false;
+  writeVarint(value, timestampUs, size, error);
+  ext.arrayValue = value.move();
+  extensions = Extensions(std::move(values));
+  return true;
+}
+
+std::vector<uint64_t> parseProbeHops(const Extensions& extensions) {
+  std::vector<uint64_t> hops;
+  for (const auto& ext : extensions) {
+    if (ext.type != kLatencyProbeExtension || !ext.arrayValue) {
+      continue;
+    }
+    folly::io::Cursor cursor(ext.arrayValue.get());
+    while (!cursor.isAtEnd()) {
+      auto timestamp = decodeVarint(cursor);
+      if (!timestamp) {
+        XLOG(DBG2) << "Invalid latency probe extension";
+        return {};
+      }
+      hops.push_back(timestamp->first);
+    }
+    break;
+  }
+  return hops;
+}
+
+folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
+MoQLatencyProbeStamper::beginSubgroup(
+    uint64_t groupID,
+    uint64_t subgroupID,
+    Priority priority) {
+  auto subgroup = downstream_->beginSubgroup(groupID, subgroupID, priority);
+  if (!subgroup) {
+    return subgroup;
+  }
+  return std::make_shared<ProbeSubgroupStamper>(std::move(*subgroup));
+}
+
+folly::Expected<folly::Unit, MoQPublishError>
+MoQLatencyProbeStamper::objectStream(
+    const ObjectHeader& header,
+    Payload payload) {
+  auto stamped = header;
+  if (!appendProbeHop(stamped.extensions)) {
+    return downstream_->objectStream(header, std::move(payload));
+  }
+  return downstream_->objectStream(stamped, std::move(payload));
+}
+
+folly::Expected<folly::Unit, MoQPublishError> MoQLatencyProbeStamper::datagram(
+    const ObjectHeader& header,
+    Payload payload) {
+  auto stamped = header;
+  if (!appendProbeHop(stamped.extensions)) {
+    return downstream_->datagram(header, std::move(payload));
+  }
+  return downstream_->datagram(stamped, std::move(payload));
+}
+
+void LatencyProbeStats::add(
+    const std::vector<uint64_t>& hops,
+    uint64_t nowUs) {
+  if (hops.empty()) {
+    return;
+  }
+  numProbes_++;
+  total_.push_back(elapsedUs(hops.front(), nowUs));
+  if (hops_.size() < hops.size()) {
+    hops_.resize(hops.size());
+  }
+  for (size_t i = 0; i < hops.size(); i++) {
+    auto toUs = i + 1 < hops.size() ? hops[i + 1] : nowUs;
+    hops_[i].push_back(elapsedUs(hops[i], toUs));
+  }
+}
+
+LatencyProbeStats::Percentiles LatencyProbeStats::percentiles(
+    std::vector<uint64_t> samples) {
+  Percentiles result;
+  if (samples.empty()) {
+    return result;
+  }
+  std::sort(samples.begin(), samples.end());
+  auto at = [&samples](size_t percent) {
+    auto i = std::min(samples.size() - 1, samples.size() * percent / 100);
+    return samples[i];
+  };
+  result.p50Us = at(50);
+  result.p90Us = at(90);
+  result.p99Us = at(99);
+  result.maxUs = samples.back();
+  return result;
+}
+
+std::vector<LatencyProbeStats::Percentiles> LatencyProbeStats::hopPercentiles()
+    const {
+  std::vector<Percentiles> result;
+  result.reserve(hops_.size());
+  for (const auto& samples : hops_) {
+    result.push_back(percentiles(samples));
+  }
+  return result;
+}
+
+LatencyProbeStats::Percentiles LatencyProbeStats::totalPercentiles() const {
+  return percentiles(total_);
+}
+
+std::string LatencyProbeStats::report() const {
+  auto line = [](const std::string& name, size_t n, const Percentiles& p) {
+    return fmt::format(
+        "{:<24} n={:<6} p50={}us p90={}us p99={}us max={}us\n",
+        name,
+        n,
+        p.p50Us,
+        p.p90Us,
+        p.p99Us,
+        p.maxUs);
+  };
+  std::string result;
+  auto hops = hopPercentiles();
+  for (size_t i = 0; i < hops.size(); i++) {
+    auto from = i == 0 ? std::string("publisher") : fmt::format("relay {}", i);
+    auto to = i + 1 < hops.size() ? fmt::format("relay {}", i + 1)
+                                  : std::string("subscriber");
+    result += line(from + " -> " + to, hops_[i].size(), hops[i]);
+  }
+  result += line("total", total_.size(), totalPercentiles());
+  return result;
+}
+
+} // namespace moxygen
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <moxygen/MoQConsumers.h>
+
+#include <string>
+#include <vector>
+
+namespace moxygen {
+
+// Latency probes are objects carrying a kLatencyProbeExtension, whose value
+// is a list of varint timestamps, microseconds of the system clock.  The
+// publisher writes the first and each relay on the way appends the time the
+// object reached it, so a subscriber can tell how long each hop took.  Hops
+// on different hosts are only as accurate as their clocks are synchronized.
+constexpr uint64_t kLatencyProbeExtension = 0x1A75;
+
+uint64_t probeTimestampUs();
+
+// The extensions of a probe published at timestampUs
+Extensions makeProbeExtensions(uint64_t timestampUs = probeTimestampUs());
+
+// Appends timestampUs to the probe extension.  Returns false, leaving
+// extensions as they were, if it has none.
+bool appendProbeHop(
+    Extensions& extensions,
+    uint64_t timestampUs = probeTimestampUs());
+
+// The publisher's then each relay's timestamp, empty if not a probe
+std::vector<uint64_t> parseProbeHops(const Extensions& extensions);
+
+// Appends the time of arrival to the probes passed to downstream
+class MoQLatencyProbeStamper : public TrackConsumer {
+ public:
+  explicit MoQLatencyProbeStamper(std::shared_ptr<TrackConsumer> downstream)
+      : downstream_(std::move(downstream)) {}
+
+  folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
+  beginSubgroup(uint64_t groupID, uint64_t subgroupID, Priority priority)
+      override;
+
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitStreamCredit() override {
+    return downstream_->awaitStreamCredit();
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objectStream(
+      const ObjectHeader& header,
+      Payload payload) override;
+
+  folly::Expected<folly::Unit, MoQPublishError> datagram(
+      const ObjectHeader& header,
+      Payload payload) override;
+
+  folly::Expected<folly::Unit, MoQPublishError> groupNotExists(
+      uint64_t groupID,
+      uint64_t subgroup,
+      Priority pri,
+      Extensions extensions) override {
+    return downstream_->groupNotExists(
+        groupID, subgroup, pri, std::move(extensions));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> subscribeDone(
+      SubscribeDone subDone) override {
+    return downstream_->subscribeDone(std::move(subDone));
+  }
+
+ private:
+  std::shared_ptr<TrackConsumer> downstream_;
+};
+
+// Gathers the per hop and total latencies of received probes and reports
+// their percentiles
+class LatencyProbeStats {
+ public:
+  // Adds a probe received at nowUs
+  void add(
+      const std::vector<uint64_t>& hops,
+      uint64_t nowUs = probeTimestampUs());
+
+  size_t numProbes() const {
+    return numProbes_;
+  }
+
+  struct Percentiles {
+    uint64_t p50Us{0};
+    uint64_t p90Us{0};
+    uint64_t p99Us{0};
+    uint64_t maxUs{0};
+  };
+  // Hop i is from timestamp i to the next one, or to the subscriber for the
+  // last.  Probes with fewer hops are left out of the hops they don't have.
+  std::vector<Percentiles> hopPercentiles() const;
+  Percentiles totalPercentiles() const;
+
+  // A line per hop and one for the total
+  std::string report() const;
+
+  void clear() {
+    hops_.clear();
+    total_.clear();
+    numProbes_ = 0;
+  }
+
+ private:
+  static Percentiles percentiles(std::vector<uint64_t> samples);
+
+  std::vector<std::vector<uint64_t>> hops_;
+  std::vector<uint64_t> total_;
+  size_t numProbes_{0};
+};
+
+} // namespace moxygen
@@ -0,0 +1,483 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/MoQMigratingClient.h"
+
+#include <folly/coro/Timeout.h>
+#include <folly/futures/ThreadWheelTimekeeper.h>
+
+namespace moxygen {
+
+// One subscription, on the current session and during a migration also on
+// the next one.  Each upstream subscription is a source, numbered so late
+// callbacks from a replaced one are dropped.
+class MoQMigratingClient::Track
+    : public Publisher::SubscriptionHandle,
+      public std::enable_shared_from_this<Track> {
+ public:
+  Track(
+      std::weak_ptr<MoQMigratingClient> client,
+      SubscribeRequest request,
+      std::shared_ptr<TrackConsumer> downstream)
+      : client_(std::move(client)),
+        request_(std::move(request)),
+        downstream_(std::move(downstream)) {}
+
+  void unsubscribe() override {
+    curSource_ = nextSource_ = 0;
+    if (auto handle = std::exchange(current_, nullptr)) {
+      handle->unsubscribe();
+    }
+    if (auto handle = std::exchange(next_, nullptr)) {
+      handle->unsubscribe();
+    }
+    if (auto client = client_.lock()) {
+      client->removeTrack(shared_from_this());
+    }
+  }
+
+  void subscribeUpdate(SubscribeUpdate subUpdate) override {
+    // A migrated subscription starts out the same way
+    request_.priority = subUpdate.priority;
+    request_.forward = subUpdate.forward;
+    if (current_) {
+      current_->subscribeUpdate(subUpdate);
+    }
+    if (next_) {
+      next_->subscribeUpdate(std::move(subUpdate));
+    }
+  }
+
+  const FullTrackName& fullTrackName() const {
+    return request_.fullTrackName;
+  }
+
+  // The consumer for one more upstream subscription.  Unless it's the first,
+  // it takes over from the current one at a group boundary.
+  std::pair<uint64_t, std::shared_ptr<TrackConsumer>> addSource();
+
+  // The upstream subscription for source is established
+  void setHandle(
+      uint64_t source,
+      std::shared_ptr<Publisher::SubscriptionHandle> handle) {
+    if (!subscribeOk_) {
+      setSubscribeOk(handle->subscribeOk());
+    }
+    if (source == curSource_) {
+      current_ = std::move(handle);
+    } else if (source == nextSource_) {
+      next_ = std::move(handle);
+    } else {
+      // Replaced or unsubscribed while subscribing
+      handle->unsubscribe();
+    }
+  }
+
+  // The request for the next session, picking up after the newest group
+  SubscribeRequest nextRequest() const {
+    auto subReq = request_;
+    if (largestGroup_) {
+      subReq.locType = LocationType::AbsoluteStart;
+      subReq.start = AbsoluteLocation{*largestGroup_ + 1, 0};
+    }
+    return subReq;
+  }
+
+  bool switching() const {
+    return nextSource_ != 0;
+  }
+
+  // Drops the current subscription, the next one carries on
+  void retire();
+
+  // The next session couldn't take the track, it stays where it is
+  void abandonNext(uint64_t source);
+
+  // Whether objects of group from source go downstream
+  bool accept(uint64_t source, uint64_t group);
+
+  folly::Expected<folly::Unit, MoQPublishError> sourceDone(
+      uint64_t source,
+      SubscribeDone subDone);
+
+  TrackConsumer& downstream() {
+    return *downstream_;
+  }
+
+ private:
+  std::weak_ptr<MoQMigratingClient> client_;
+  SubscribeRequest request_;
+  std::shared_ptr<TrackConsumer> downstream_;
+  std::shared_ptr<Publisher::SubscriptionHandle> current_;
+  std::shared_ptr<Publisher::SubscriptionHandle> next_;
+  uint64_t lastSource_{0};
+  uint64_t curSource_{0};
+  uint64_t nextSource_{0};
+  folly::Optional<uint64_t> largestGroup_;
+  // First group taken from the next source, set when it delivers one
+  folly::Optional<uint64_t> switchGroup_;
+  // Groups the current source delivers before this came from the last one
+  uint64_t floor_{0};
+};
+
+class MoQMigratingClient::TrackSource : public TrackConsumer {
+ public:
+  TrackSource(std::shared_ptr<Track> track, uint64_t source)
+      : track_(std::move(track)), source_(source) {}
+
+  folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
+  beginSubgroup(uint64_t groupID, uint64_t subgroupID, Priority priority)
+      override {
+    if (!track_->accept(source_, groupID)) {
+      // The other session is delivering the group
+      return std::make_shared<DiscardSubgroupConsumer>();
+    }
+    return track_->downstream().beginSubgroup(groupID, subgroupID, priority);
+  }
+
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitStreamCredit() override {
+    return track_->downstream().awaitStreamCredit();
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objectStream(
+      const ObjectHeader& header,
+      Payload payload) override {
+    if (!track_->accept(source_, header.group)) {
+      return folly::unit;
+    }
+    return track_->downstream().objectStream(header, std::move(payload));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> datagram(
+      const ObjectHeader& header,
+      Payload payload) override {
+    if (!track_->accept(source_, header.group)) {
+      return folly::unit;
+    }
+    return track_->downstream().datagram(header, std::move(payload));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> groupNotExists(
+      uint64_t groupID,
+      uint64_t subgroup,
+      Priority pri,
+      Extensions extensions) override {
+    if (!track_->accept(source_, groupID)) {
+      return folly::unit;
+    }
+    return track_->downstream().groupNotExists(
+        groupID, subgroup, pri, std::move(extensions));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> subscribeDone(
+      SubscribeDone subDone) override {
+    return track_->sourceDone(source_, std::move(subDone));
+  }
+
+ private:
+  std::shared_ptr<Track> track_;
+  uint64_t source_;
+};
+
+std::pair<uint64_t, std::shared_ptr<TrackConsumer>>
+MoQMigratingClient::Track::addSource() {
+  auto source = ++lastSource_;
+  if (curSource_ == 0) {
+    curSource_ = source;
+  } else {
+    nextSource_ = source;
+    switchGroup_.reset();
+  }
+  return {source, std::make_shared<TrackSource>(shared_from_this(), source)};
+}
+
+bool MoQMigratingClient::Track::accept(uint64_t source, uint64_t group) {
+  if (source == curSource_) {
+    if (group < floor_) {
+      return false;
+    }
+    if (nextSource_ && switchGroup_ && group >= *switchGroup_) {
+      // The old session has moved past the switch
+      retire();
+      return false;
+    }
+  } else if (source == nextSource_) {
+    if (!switchGroup_) {
+      switchGroup_ = std::max(group, largestGroup_ ? *largestGroup_ + 1 : 0);
+      XLOG(DBG1) << "Switching " << request_.fullTrackName << " at group "
+                 << *switchGroup_;
+    }
+    if (group < *switchGroup_) {
+      return false;
+    }
+    if (group > *switchGroup_) {
+      // Whatever the old session had left is too late now
+      retire();
+    }
+  } else {
+    return false;
+  }
+  if (!largestGroup_ || group > *largestGroup_) {
+    largestGroup_ = group;
+  }
+  return true;
+}
+
+void MoQMigratingClient::Track::retire() {
+  if (!nextSource_) {
+    return;
+  }
+  if (switchGroup_) {
+    floor_ = *switchGroup_;
+  } else if (largestGroup_) {
+    floor_ = *largestGroup_ + 1;
+  }
+  curSource_ = std::exchange(nextSource_, 0);
+  switchGroup_.reset();
+  auto old = std::exchange(current_, std::move(next_));
+  if (old) {
+    old->unsubscribe();
+  }
+  if (auto client = client_.lock()) {
+    client->onTrackSwitched();
+  }
+}
+
+void MoQMigratingClient::Track::abandonNext(uint64_t source) {
+  if (source != nextSource_) {
+    return;
+  }
+  nextSource_ = 0;
+  switchGroup_.reset();
+  if (auto handle = std::exchange(next_, nullptr)) {
+    handle->unsubscribe();
+  }
+  if (auto client = client_.lock()) {
+    client->onTrackSwitched();
+  }
+}
+
+folly::Expected<folly::Unit, MoQPublishError>
+MoQMigratingClient::Track::sourceDone(uint64_t source, SubscribeDone subDone) {
+  if (source == nextSource_) {
+    XLOG(WARN) << "New session ended " << request_.fullTrackName
+               << " during migration, staying on the old one";
+    abandonNext(source);
+    return folly::unit;
+  }
+  if (source != curSource_) {
+    return folly::unit;
+  }
+  if (nextSource_) {
+    // The old session finished first, the new one takes over at once
+    retire();
+    return folly::unit;
+  }
+  curSource_ = 0;
+  current_.reset();
+  if (auto client = client_.lock()) {
+    client->removeTrack(shared_from_this());
+  }
+  return downstream_->subscribeDone(std::move(subDone));
+}
+
+MoQMigratingClient::MoQMigratingClient(
+    folly::EventBase* evb,
+    proxygen::URL url,
+    Config config,
+    ClientFactory clientFactory)
+    : evb_(evb),
+      url_(std::move(url)),
+      config_(config),
+      clientFactory_(std::move(clientFactory)) {
+  if (!clientFactory_) {
+    clientFactory_ = [](folly::EventBase* evb, proxygen::URL url) {
+      return std::make_unique<MoQClient>(evb, std::move(url));
+    };
+  }
+}
+
+folly::coro::Task<void> MoQMigratingClient::connect(
+    std::shared_ptr<Subscriber> subscribeHandler) {
+  subscribeHandler_ = std::move(subscribeHandler);
+  client_ = clientFactory_(evb_, url_);
+  co_await client_->setupMoQSession(
+      config_.connectTimeout,
+      config_.transactionTimeout,
+      nullptr,
+      shared_from_this());
+}
+
+folly::coro::Task<Publisher::SubscribeResult> MoQMigratingClient::subscribe(
+    SubscribeRequest subReq,
+    std::shared_ptr<TrackConsumer> consumer) {
+  auto session = getSession();
+  if (!session) {
+    co_return folly::makeUnexpected(SubscribeError{
+        subReq.requestID,
+        SubscribeErrorCode::INTERNAL_ERROR,
+        "not connected",
+        folly::none});
+  }
+  auto track =
+      std::make_shared<Track>(weak_from_this(), subReq, std::move(consumer));
+  auto [source, trackConsumer] = track->addSource();
+  tracks_.insert(track);
+  auto res = co_await session->subscribe(std::move(subReq), trackConsumer);
+  if (res.hasError()) {
+    tracks_.erase(track);
+    co_return folly::makeUnexpected(res.error());
+  }
+  track->setHandle(source, std::move(res.value()));
+  co_return std::shared_ptr<Publisher::SubscriptionHandle>(std::move(track));
+}
+
+folly::coro::Task<Subscriber::AnnounceResult> MoQMigratingClient::announce(
+    Announce ann,
+    std::shared_ptr<AnnounceCallback> announceCallback) {
+  if (!subscribeHandler_) {
+    co_return co_await Subscriber::announce(
+        std::move(ann), std::move(announceCallback));
+  }
+  co_return co_await subscribeHandler_->announce(
+      std::move(ann), std::move(announceCallback));
+}
+
+void MoQMigratingClient::goaway(Goaway goaway) {
+  XLOG(INFO) << "Processing goaway uri=" << goaway.newSessionUri;
+  if (MoQSession::getRequestSession() != getSession()) {
+    // From an old session still draining
+    if (subscribeHandler_) {
+      subscribeHandler_->goaway(std::move(goaway));
+    }
+    return;
+  }
+  if (migrating_) {
+    return;
+  }
+  auto url = url_;
+  if (!goaway.newSessionUri.empty()) {
+    url = proxygen::URL(goaway.newSessionUri);
+    if (!url.isValid() || !url.hasHost()) {
+      XLOG(ERR) << "Invalid GOAWAY uri=" << goaway.newSessionUri
+                << ", reconnecting to " << url_.getUrl();
+      url = url_;
+    }
+  }
+  migrating_ = true;
+  folly::coro::co_invoke(
+      [self = shared_from_this(),
+       url = std::move(url)]() mutable -> folly::coro::Task<void> {
+        co_await self->migrate(std::move(url));
+      })
+      .scheduleOn(evb_)
+      .start();
+}
+
+folly::coro::Task<void> MoQMigratingClient::migrate(proxygen::URL url) {
+  auto client = clientFactory_(evb_, url);
+  XLOG(INFO) << "Migrating " << tracks_.size() << " subscriptions to "
+             << url.getUrl();
+  try {
+    co_await client->setupMoQSession(
+        config_.connectTimeout,
+        config_.transactionTimeout,
+        nullptr,
+        shared_from_this());
+  } catch (const std::exception& ex) {
+    XLOG(ERR) << "Migration to " << url.getUrl()
+              << " failed err=" << folly::exceptionStr(ex);
+  }
+  if (!client->moqSession_) {
+    // The old session serves until the server closes it
+    evb_->runInEventBaseThread([client = std::move(client)] {});
+    migrating_ = false;
+    co_return;
+  }
+  auto session = client->moqSession_;
+  auto oldClient = std::exchange(client_, std::move(client));
+  url_ = std::move(url);
+  migrations_++;
+  auto [switchedPromise, switchedFuture] =
+      folly::coro::makePromiseContract<folly::Unit>();
+  switched_ = std::move(switchedPromise);
+
+  // Every track starts switching before any SUBSCRIBE goes out, so one that
+  // the old session ends meanwhile moves over rather than ending
+  std::vector<std::pair<std::shared_ptr<Track>, uint64_t>> moving;
+  std::vector<std::shared_ptr<TrackConsumer>> consumers;
+  for (const auto& track : tracks_) {
+    auto [source, consumer] = track->addSource();
+    moving.emplace_back(track, source);
+    consumers.emplace_back(std::move(consumer));
+  }
+  // could parallelize
+  for (size_t i = 0; i < moving.size(); i++) {
+    auto& [track, source] = moving[i];
+    auto res = co_await session->subscribe(
+        track->nextRequest(), std::move(consumers[i]));
+    if (res.hasError()) {
+      XLOG(ERR) << "Resubscribe failed for " << track->fullTrackName()
+                << " err=" << res.error().reasonPhrase;
+      track->abandonNext(source);
+    } else {
+      track->setHandle(source, std::move(res.value()));
+    }
+  }
+  onTrackSwitched();
+
+  folly::EventBaseThreadTimekeeper tk(*evb_);
+  co_await folly::coro::co_awaitTry(
+      folly::coro::timeout(
+          std::move(switchedFuture), config_.drainTimeout, &tk));
+  switched_.reset();
+  for (const auto& track : std::vector<std::shared_ptr<Track>>(
+           tracks_.begin(), tracks_.end())) {
+    if (track->switching()) {
+      XLOG(DBG1) << "Switching " << track->fullTrackName()
+                 << " after drain timeout";
+      track->retire();
+    }
+  }
+  XLOG(INFO) << "Migration to " << url_.getUrl() << " complete";
+  if (oldClient->moqSession_) {
+    oldClient->moqSession_->close(SessionCloseErrorCode::NO_ERROR);
+  }
+  // The transport may still call into the client from this loop
+  evb_->runInEventBaseThread([oldClient = std::move(oldClient)] {});
+  migrating_ = false;
+}
+
+void MoQMigratingClient::onTrackSwitched() {
+  if (!switched_) {
+    return;
+  }
+  for (const auto& track : tracks_) {
+    if (track->switching()) {
+      return;
+    }
+  }
+  std::exchange(switched_, folly::none)->setValue(folly::unit);
+}
+
+void MoQMigratingClient::removeTrack(const std::shared_ptr<Track>& track) {
+  tracks_.erase(track);
+  onTrackSwitched();
+}
+
+void MoQMigratingClient::close() {
+  auto tracks = std::move(tracks_);
+  tracks_.clear();
+  for (const auto& track : tracks) {
+    track->unsubscribe();
+  }
+  if (auto session = getSession()) {
+    session->close(SessionCloseErrorCode::NO_ERROR);
+  }
+}
+
+} // namespace moxygen
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/container/F14Set.h>
+#include <moxygen/MoQClient.h>
+
+namespace moxygen {
+
+// A subscribing client whose subscriptions survive the server going away.
+// On GOAWAY a session to the new URI, or the same URL if there is none, is
+// opened in the background and every subscription is made again there,
+// starting at the group after the newest one received.  Each track switches
+// over at a group boundary: groups before the switch come from the old
+// session and the rest from the new one, so the consumer sees each group
+// once.  The old session is closed when every track has switched, or after
+// drainTimeout.
+//
+// All calls must be made on evb.
+class MoQMigratingClient
+    : public Subscriber,
+      public std::enable_shared_from_this<MoQMigratingClient> {
+ public:
+  struct Config {
+    std::chrono::milliseconds connectTimeout{std::chrono::seconds(5)};
+    std::chrono::milliseconds transactionTimeout{std::chrono::seconds(60)};
+    // Longest the old session is kept once the new one is up, for tracks
+    // that don't reach their switch group
+    std::chrono::milliseconds drainTimeout{std::chrono::seconds(10)};
+  };
+
+  using ClientFactory = std::function<std::unique_ptr<MoQClient>(
+      folly::EventBase*,
+      proxygen::URL)>;
+
+  MoQMigratingClient(
+      folly::EventBase* evb,
+      proxygen::URL url,
+      Config config,
+      ClientFactory clientFactory = nullptr);
+
+  // subscribeHandler receives the server's ANNOUNCEs, on every session
+  folly::coro::Task<void> connect(
+      std::shared_ptr<Subscriber> subscribeHandler = nullptr);
+
+  std::shared_ptr<MoQSession> getSession() const {
+    return client_ ? client_->moqSession_ : nullptr;
+  }
+
+  // Like MoQSession::subscribe.  The handle and consumer stay the same
+  // across migrations.
+  folly::coro::Task<Publisher::SubscribeResult> subscribe(
+      SubscribeRequest subReq,
+      std::shared_ptr<TrackConsumer> consumer);
+
+  folly::coro::Task<AnnounceResult> announce(
+      Announce ann,
+      std::shared_ptr<AnnounceCallback> announceCallback) override;
+
+  void goaway(Goaway goaway) override;
+
+  void close();
+
+  // Sessions the subscriptions were moved to
+  uint64_t migrations() const {
+    return migrations_;
+  }
+
+ private:
+  class Track;
+  class TrackSource;
+
+  folly::coro::Task<void> migrate(proxygen::URL url);
+  // Called when a track has no subscription left on the old session
+  void onTrackSwitched();
+  void removeTrack(const std::shared_ptr<Track>& track);
+
+  folly::EventBase* evb_;
+  proxygen::URL url_;
+  Config config_;
+  ClientFactory clientFactory_;
+  std::shared_ptr<Subscriber> subscribeHandler_;
+  std::unique_ptr<MoQClient> client_;
+  folly::F14FastSet<std::shared_ptr<Track>> tracks_;
+  bool migrating_{false};
+  // Fulfilled when the last track leaves the old session
+  folly::Optional<folly::coro::Promise<folly::Unit>> switched_;
+  uint64_t migrations_{0};
+};
+
+} // namespace moxygen
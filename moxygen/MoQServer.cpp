@@ -5,6 +5,7 @@
  */
 
 #include "moxygen/MoQServer.h"
+#include "moxygen/util/QuicTransportMetrics.h"
 #include <proxygen/lib/http/webtransport/QuicWebTransport.h>
 
 using namespace quic::samples;
@@ -16,11 +17,12 @@ MoQServer::MoQServer(
     uint16_t port,
     std::string cert,
     std::string key,
-    std::string endpoint)
+    std::string endpoint,
+    size_t serverThreads)
     : endpoint_(endpoint) {
   params_.localAddress.emplace();
   params_.localAddress->setFromLocalPort(port);
-  params_.serverThreads = 1;
+  params_.serverThreads = serverThreads;
   params_.certificateFilePath = cert;
   params_.keyFilePath = key;
   params_.txnTimeout = std::chrono::seconds(60);
@@ -47,6 +49,7 @@ void MoQServer::createMoQQuicSession(
   ts.copaDeltaParam = 0.05;
   ts.pacingEnabled = true;
   ts.experimentalPacer = true;
+  auto metricsProvider = quicTransportMetricsProvider(quicSocket);
   auto quicWebTransport =
       std::make_shared<proxygen::QuicWebTransport>(std::move(quicSocket));
   auto qWtPtr = quicWebTransport.get();
@@ -58,6 +61,7 @@ void MoQServer::createMoQQuicSession(
   }
   auto moqSession = std::make_shared<MoQSession>(wt, *this, evb);
   qWtPtr->setHandler(moqSession.get());
+  moqSession->setTransportMetricsProvider(std::move(metricsProvider));
   // the handleClientSession coro this session moqSession
   handleClientSession(std::move(moqSession)).scheduleOn(evb).start();
 }
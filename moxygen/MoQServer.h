@@ -21,7 +21,8 @@ class MoQServer : public MoQSession::ServerSetupCallback {
       uint16_t port,
       std::string cert,
       std::string key,
-      std::string endpoint);
+      std::string endpoint,
+      size_t serverThreads = 1);
   MoQServer(const MoQServer&) = delete;
   MoQServer(MoQServer&&) = delete;
   MoQServer& operator=(const MoQServer&) = delete;
@@ -5,13 +5,19 @@
  */
 
 #include "moxygen/MoQSession.h"
+#include "moxygen/util/Trace.h"
 #include <folly/coro/Collect.h>
 #include <folly/coro/FutureUtil.h>
+#include <folly/futures/Future.h>
 #include <folly/futures/ThreadWheelTimekeeper.h>
+#include <folly/small_vector.h>
 #include <folly/io/async/EventBase.h>
 
 #include <folly/logging/xlog.h>
 
+#include <algorithm>
+#include <deque>
+
 namespace {
 using namespace moxygen;
 constexpr std::chrono::seconds kSetupTimeout(5);
@@ -68,7 +74,8 @@ class StreamPublisherImpl
     : public SubgroupConsumer,
       public FetchConsumer,
       public std::enable_shared_from_this<StreamPublisherImpl>,
-      public proxygen::WebTransport::ByteEventCallback {
+      public proxygen::WebTransport::ByteEventCallback,
+      public folly::EventBase::LoopCallback {
  public:
   StreamPublisherImpl() = delete;
 
@@ -95,6 +102,9 @@ class StreamPublisherImpl
       Payload payload,
       Extensions extensions,
       bool finStream) override;
+  folly::Expected<folly::Unit, MoQPublishError> objects(
+      std::span<SubgroupObject> batch,
+      bool finStream) override;
   folly::Expected<folly::Unit, MoQPublishError> objectNotExists(
       uint64_t objectID,
       Extensions extensions,
@@ -225,10 +235,63 @@ class StreamPublisherImpl
     onByteEventCommon(id, offset);
   }
 
+  // Writes the objects held for coalescing
+  void runLoopCallback() noexcept override {
+    auto keepalive = std::move(coalesceKeepalive_);
+    (void)flushToStream(/*finStream=*/false);
+  }
+
   void setForward(bool forwardIn) {
     forward_ = forwardIn;
   }
 
+  uint64_t streamPriority() const {
+    return streamPriority_;
+  }
+
+  uint8_t publisherPriority() const {
+    return publisherPriority_;
+  }
+
+  void setStreamPriority(uint64_t streamPriority, uint8_t publisherPriority) {
+    streamPriority_ = streamPriority;
+    publisherPriority_ = publisherPriority;
+  }
+
+  // Reprioritizes the open stream, eg: after SUBSCRIBE_UPDATE
+  void updateStreamPriority(uint64_t streamPriority) {
+    streamPriority_ = streamPriority;
+    if (writeHandle_) {
+      writeHandle_->setPriority(1, streamPriority, false);
+    }
+  }
+
+  // Bytes written to the transport that are not yet delivered or cancelled
+  uint64_t bufferedBytes() const {
+    return bytesWritten_ - bytesDeliveredOrCanceled_;
+  }
+
+  // Resets the stream and releases its buffered bytes from the subscription
+  // and session budgets.  Further writes fail with TOO_FAR_BEHIND.  Returns
+  // the number of bytes released.
+  uint64_t dropBufferedBytes();
+
+  // True if the oldest undelivered object was written more than the
+  // subscription's delivery timeout before now
+  bool pastDeliveryTimeout(std::chrono::steady_clock::time_point now) const {
+    return !undelivered_.empty() && publisher_ &&
+        now - undelivered_.front().second > publisher_->deliveryTimeout();
+  }
+
+  // Write time of the oldest undelivered object
+  folly::Optional<std::chrono::steady_clock::time_point> oldestUndelivered()
+      const {
+    if (undelivered_.empty()) {
+      return folly::none;
+    }
+    return undelivered_.front().second;
+  }
+
  private:
   void onByteEventCommon(quic::StreamId id, uint64_t offset) {
     uint64_t bytesDeliveredOrCanceled = offset + 1;
@@ -237,6 +300,10 @@ class StreamPublisherImpl
           bytesDeliveredOrCanceled - bytesDeliveredOrCanceled_);
       bytesDeliveredOrCanceled_ = bytesDeliveredOrCanceled;
     }
+    while (!undelivered_.empty() &&
+           undelivered_.front().first <= bytesDeliveredOrCanceled_) {
+      undelivered_.pop_front();
+    }
 
     refCountForCallbacks_--;
     if (refCountForCallbacks_ == 0) {
@@ -245,13 +312,16 @@ class StreamPublisherImpl
   }
 
   bool setGroupAndSubgroup(uint64_t groupID, uint64_t subgroupID) {
-    if (groupID < header_.group) {
-      return false;
-    } else if (groupID > header_.group) {
-      // TODO(T211026595): reverse this check with group order
+    if (groupID != header_.group || !groupStarted_) {
+      // Fetch groups advance in the FETCH's group order
+      if (groupStarted_ &&
+          (newestFirst_ ? groupID > header_.group : groupID < header_.group)) {
+        return false;
+      }
       // Fetch group advanced, reset expected object
       header_.id = std::numeric_limits<uint64_t>::max();
     }
+    groupStarted_ = true;
     header_.group = groupID;
     header_.subgroup = subgroupID;
     return true;
@@ -265,6 +335,12 @@ class StreamPublisherImpl
       uint64_t objectID);
   folly::Expected<ObjectPublishStatus, MoQPublishError>
   validateObjectPublishAndUpdateState(folly::IOBuf* payload, bool finStream);
+  // Appends the object to writeBuf_
+  void encodeObject(
+      uint64_t objectID,
+      uint64_t length,
+      Payload payload,
+      const Extensions& extensions);
   folly::Expected<folly::Unit, MoQPublishError> writeCurrentObject(
       uint64_t objectID,
       uint64_t length,
@@ -272,15 +348,33 @@ class StreamPublisherImpl
       const Extensions& extensions,
       bool finStream);
   folly::Expected<folly::Unit, MoQPublishError> writeToStream(bool finStream);
+  folly::Expected<folly::Unit, MoQPublishError> flushToStream(bool finStream);
+  // True if writeBuf_ is held for the session's egress scheduler
+  bool holdForScheduler(bool finStream);
+  // True if writeBuf_ is held to be written with later objects
+  bool holdForCoalescing();
+  // Returns the reference held while a coalesced write is scheduled
+  std::shared_ptr<StreamPublisherImpl> cancelCoalescing();
 
   void onStreamComplete();
 
+  MoQPublishError closedError() const {
+    return dropped_ ? MoQPublishError(
+                          MoQPublishError::TOO_FAR_BEHIND,
+                          "Subgroup dropped, peer is too far behind")
+                    : MoQPublishError(MoQPublishError::CANCELLED, "Cancelled");
+  }
+
   std::shared_ptr<MoQSession::PublisherImpl> publisher_{nullptr};
   bool streamComplete_{false};
   folly::Optional<folly::CancellationCallback> cancelCallback_;
   proxygen::WebTransport::StreamWriteHandle* writeHandle_{nullptr};
   StreamType streamType_;
   ObjectHeader header_;
+  // Set once an object's group is known, FETCH groups can start anywhere
+  bool groupStarted_{false};
+  // A FETCH asking for descending group order
+  bool newestFirst_{false};
   folly::Optional<uint64_t> currentLengthRemaining_;
   folly::IOBufQueue writeBuf_{folly::IOBufQueue::cacheChainLength()};
   MoQFrameWriter moqFrameWriter_;
@@ -290,8 +384,25 @@ class StreamPublisherImpl
 
   uint32_t bytesWritten_{0};
   uint32_t bytesDeliveredOrCanceled_{0};
+  // End offset and write time of each undelivered write, kept only when the
+  // subscription has a delivery timeout
+  std::deque<std::pair<uint32_t, std::chrono::steady_clock::time_point>>
+      undelivered_;
+  uint64_t streamPriority_{0};
+  uint8_t publisherPriority_{0};
+  // When the oldest object in writeBuf_ was held for coalescing
+  folly::Optional<std::chrono::steady_clock::time_point> heldSince_;
+  // Set while a coalesced write is scheduled
+  std::shared_ptr<StreamPublisherImpl> coalesceKeepalive_;
+  // Set while writeBuf_ waits in the egress scheduler, finPending_ if the
+  // write ends the stream
+  bool egressScheduled_{false};
+  bool finPending_{false};
+  // Set when a FETCH write exceeded the fetch limiters' rate
+  folly::Optional<std::chrono::steady_clock::time_point> fetchResumeTime_;
 
   bool forward_{true};
+  bool dropped_{false};
 };
 
 // StreamPublisherImpl
@@ -306,7 +417,8 @@ StreamPublisherImpl::StreamPublisherImpl(
           0,
           std::numeric_limits<uint64_t>::max(),
           0,
-          ObjectStatus::NORMAL) {
+          ObjectStatus::NORMAL),
+      newestFirst_(publisher->groupOrder() == GroupOrder::NewestFirst) {
   moqFrameWriter_.initializeVersion(publisher->getVersion());
   (void)moqFrameWriter_.writeFetchHeader(writeBuf_, publisher->requestID());
 }
@@ -320,8 +432,8 @@ StreamPublisherImpl::StreamPublisherImpl(
     SubgroupIDFormat format,
     bool includeExtensions)
     : StreamPublisherImpl(publisher) {
-  streamType_ =
-      getSubgroupStreamType(publisher->getVersion(), format, includeExtensions);
+  streamType_ = getSubgroupStreamType(
+      moqFrameWriter_.draftTraits(), format, includeExtensions);
   header_.trackIdentifier = alias;
   setWriteHandle(writeHandle);
   setGroupAndSubgroup(groupID, subgroupID);
@@ -362,6 +474,10 @@ void StreamPublisherImpl::onStreamComplete() {
 
 folly::Expected<folly::Unit, MoQPublishError>
 StreamPublisherImpl::validatePublish(uint64_t objectID) {
+  if (finPending_) {
+    return folly::makeUnexpected(MoQPublishError(
+        MoQPublishError::API_ERROR, "Write after stream complete"));
+  }
   if (currentLengthRemaining_) {
     XLOG(ERR) << "Still publishing previous object sgp=" << this;
     reset(ResetStreamErrorCode::INTERNAL_ERROR);
@@ -379,41 +495,175 @@ StreamPublisherImpl::validatePublish(uint64_t objectID) {
   return ensureWriteHandle();
 }
 
-folly::Expected<folly::Unit, MoQPublishError>
-StreamPublisherImpl::writeCurrentObject(
+void StreamPublisherImpl::encodeObject(
     uint64_t objectID,
     uint64_t length,
     Payload payload,
-    const Extensions& extensions,
-    bool finStream) {
+    const Extensions& extensions) {
   header_.id = objectID;
   header_.length = length;
+  MOXYGEN_TRACE_SPAN(
+      "StreamPublisherImpl::writeObject",
+      value(header_.trackIdentifier),
+      header_.group,
+      objectID);
   // copy is gratuitous
   header_.extensions = extensions;
-  XLOG(DBG6) << "writeCurrentObject sgp=" << this << " objectID=" << objectID;
+  XLOG(DBG6) << "encodeObject sgp=" << this << " objectID=" << objectID;
   (void)moqFrameWriter_.writeStreamObject(
       writeBuf_, streamType_, header_, std::move(payload));
-  return writeToStream(finStream);
+}
+
+folly::Expected<folly::Unit, MoQPublishError>
+StreamPublisherImpl::writeCurrentObject(
+    uint64_t objectID,
+    uint64_t length,
+    Payload payload,
+    const Extensions& extensions,
+    bool finStream) {
+  encodeObject(objectID, length, std::move(payload), extensions);
+  auto res = writeToStream(finStream);
+  // BLOCKED means the objects were written
+  if ((res || res.error().code == MoQPublishError::BLOCKED) && publisher_) {
+    MOQ_TRACK_STATS(
+        publisher_->trackStatsCallback(),
+        onObjectSent,
+        publisher_->fullTrackName(),
+        length);
+  }
+  return res;
 }
 
 folly::Expected<folly::Unit, MoQPublishError>
 StreamPublisherImpl::writeToStream(bool finStream) {
-  if (streamType_ != StreamType::FETCH_HEADER &&
-      !publisher_->canBufferBytes(writeBuf_.chainLength())) {
-    publisher_->onTooManyBytesBuffered();
-    return folly::makeUnexpected(
-        MoQPublishError(MoQPublishError::TOO_FAR_BEHIND));
+  if (finPending_) {
+    return folly::makeUnexpected(MoQPublishError(
+        MoQPublishError::API_ERROR, "Write after stream complete"));
+  }
+  if (holdForScheduler(finStream)) {
+    // Bytes waiting for the egress window count as buffered, so a window
+    // that stays closed can't grow writeBuf_ without bound
+    auto maxHeldBytes = publisher_->egressScheduling()->maxHeldBytes;
+    auto heldBytes = writeBuf_.chainLength();
+    if ((maxHeldBytes > 0 && heldBytes > maxHeldBytes) ||
+        !publisher_->canBufferBytes(heldBytes)) {
+      XLOG(DBG1) << "Too many bytes held for the egress window sgp=" << this;
+      publisher_->onTooManyBytesBuffered();
+      return folly::makeUnexpected(
+          MoQPublishError(MoQPublishError::TOO_FAR_BEHIND));
+    }
+    return folly::unit;
+  }
+  if (!finStream && holdForCoalescing()) {
+    return folly::unit;
+  }
+  return flushToStream(finStream);
+}
+
+bool StreamPublisherImpl::holdForCoalescing() {
+  if (streamType_ == StreamType::FETCH_HEADER || !writeHandle_ ||
+      !publisher_) {
+    return false;
+  }
+  auto coalescing = publisher_->writeCoalescing();
+  auto evb = publisher_->getEventBase();
+  if (!coalescing || !evb) {
+    return false;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (!heldSince_) {
+    heldSince_ = now;
+  }
+  if (writeBuf_.chainLength() >= coalescing->maxBytes ||
+      now - *heldSince_ >= coalescing->maxDelay) {
+    return false;
+  }
+  if (!coalesceKeepalive_) {
+    coalesceKeepalive_ = shared_from_this();
+    evb->runInLoop(this);
+  }
+  return true;
+}
+
+bool StreamPublisherImpl::holdForScheduler(bool finStream) {
+  if (streamType_ == StreamType::FETCH_HEADER || !writeHandle_ ||
+      !publisher_ || !publisher_->egressScheduling()) {
+    return false;
+  }
+  finPending_ = finStream;
+  if (!egressScheduled_) {
+    egressScheduled_ = true;
+    publisher_->scheduleEgress(
+        streamPriority_, [self = shared_from_this()]() -> uint64_t {
+          self->egressScheduled_ = false;
+          auto numBytes = self->writeBuf_.chainLength();
+          auto finStream = std::exchange(self->finPending_, false);
+          return self->flushToStream(finStream) ? numBytes : 0;
+        });
+  }
+  return true;
+}
+
+std::shared_ptr<StreamPublisherImpl> StreamPublisherImpl::cancelCoalescing() {
+  heldSince_.reset();
+  if (coalesceKeepalive_) {
+    cancelLoopCallback();
+  }
+  return std::move(coalesceKeepalive_);
+}
+
+folly::Expected<folly::Unit, MoQPublishError>
+StreamPublisherImpl::flushToStream(bool finStream) {
+  auto heldKeepalive = cancelCoalescing();
+  if (!writeHandle_) {
+    return folly::makeUnexpected(closedError());
+  }
+  folly::Optional<std::chrono::steady_clock::time_point> now;
+  if (streamType_ != StreamType::FETCH_HEADER) {
+    auto numBytes = writeBuf_.chainLength();
+    auto keepalive = shared_from_this();
+    if (publisher_->deliveryTimeout().count() > 0) {
+      now = publisher_->now();
+      if (pastDeliveryTimeout(*now)) {
+        // Later objects in the subgroup can't be delivered in time either
+        XLOG(DBG1) << "Delivery timeout on subgroup=" << header_
+                   << " sgp=" << this;
+        dropBufferedBytes();
+        return folly::makeUnexpected(closedError());
+      }
+    }
+    if (!publisher_->canBufferBytes(numBytes)) {
+      publisher_->onTooManyBytesBuffered();
+      return folly::makeUnexpected(
+          MoQPublishError(MoQPublishError::TOO_FAR_BEHIND));
+    }
+    if (!publisher_->canBufferBytesInSession(numBytes)) {
+      // Make room by dropping subgroups that would be sent after this one.
+      // If that's not enough, this subgroup is dropped instead.
+      publisher_->shedSessionBytes(numBytes, streamPriority_);
+      if (!publisher_->canBufferBytesInSession(numBytes)) {
+        dropBufferedBytes();
+      }
+      if (!writeHandle_) {
+        return folly::makeUnexpected(closedError());
+      }
+    }
   }
 
   auto writeHandle = writeHandle_;
   if (finStream) {
     writeHandle_ = nullptr;
   }
+  auto writeBytes = writeBuf_.chainLength();
   proxygen::WebTransport::ByteEventCallback* deliveryCallback = nullptr;
   if (!writeBuf_.empty() || finStream) {
     deliveryCallback = this;
     bytesWritten_ += writeBuf_.chainLength();
     publisher_->onBytesBuffered(writeBuf_.chainLength());
+    if (now) {
+      undelivered_.emplace_back(bytesWritten_, *now);
+      publisher_->onDeliveryDeadline(*now + publisher_->deliveryTimeout());
+    }
     if (refCountForCallbacks_ == 0) {
       keepaliveForDeliveryCallbacks_ = shared_from_this();
     }
@@ -422,8 +672,17 @@ StreamPublisherImpl::writeToStream(bool finStream) {
   auto writeRes = writeHandle->writeStreamData(
       writeBuf_.move(), finStream, deliveryCallback);
   if (writeRes.hasValue()) {
+    std::chrono::microseconds rateWait{0};
+    if (streamType_ == StreamType::FETCH_HEADER && writeBytes > 0) {
+      rateWait = publisher_->onFetchBytesWritten(writeBytes);
+    }
     if (finStream) {
       onStreamComplete();
+    } else if (rateWait.count() > 0 && !currentLengthRemaining_) {
+      // The object is written, the publisher waits in awaitReadyToConsume
+      fetchResumeTime_ = std::chrono::steady_clock::now() + rateWait;
+      return folly::makeUnexpected(
+          MoQPublishError(MoQPublishError::BLOCKED, "FETCH rate limited"));
     }
     return folly::unit;
   }
@@ -487,6 +746,42 @@ folly::Expected<folly::Unit, MoQPublishError> StreamPublisherImpl::object(
       objectID, length, std::move(payload), extensions, finStream);
 }
 
+folly::Expected<folly::Unit, MoQPublishError> StreamPublisherImpl::objects(
+    std::span<SubgroupObject> batch,
+    bool finStream) {
+  if (!forward_) {
+    reset(ResetStreamErrorCode::INTERNAL_ERROR);
+    return folly::makeUnexpected(
+        MoQPublishError(MoQPublishError::API_ERROR, "shouldForward is false"));
+  }
+  if (batch.empty() && finStream) {
+    return endOfSubgroup();
+  }
+  folly::small_vector<uint64_t, 16> lengths;
+  for (auto& obj : batch) {
+    auto validateRes = validatePublish(obj.objectID);
+    if (!validateRes) {
+      return validateRes;
+    }
+    auto length = obj.payload ? obj.payload->computeChainDataLength() : 0;
+    lengths.push_back(length);
+    header_.status = ObjectStatus::NORMAL;
+    encodeObject(obj.objectID, length, std::move(obj.payload), obj.extensions);
+  }
+  auto res = writeToStream(finStream);
+  // BLOCKED means the objects were written
+  if ((res || res.error().code == MoQPublishError::BLOCKED) && publisher_) {
+    for (auto length : lengths) {
+      MOQ_TRACK_STATS(
+          publisher_->trackStatsCallback(),
+          onObjectSent,
+          publisher_->fullTrackName(),
+          length);
+    }
+  }
+  return res;
+}
+
 folly::Expected<folly::Unit, MoQPublishError>
 StreamPublisherImpl::objectNotExists(
     uint64_t objectID,
@@ -539,8 +834,7 @@ StreamPublisherImpl::objectPayload(Payload payload, bool finStream) {
         MoQPublishError(MoQPublishError::API_ERROR, "shouldForward is false"));
   }
   if (!writeHandle_) {
-    return folly::makeUnexpected(
-        MoQPublishError(MoQPublishError::CANCELLED, "Cancelled"));
+    return folly::makeUnexpected(closedError());
   }
   auto validateObjectPublishRes =
       validateObjectPublishAndUpdateState(payload.get(), finStream);
@@ -625,16 +919,44 @@ StreamPublisherImpl::endOfSubgroup() {
     return folly::makeUnexpected(MoQPublishError(
         MoQPublishError::API_ERROR, "Previous object incomplete"));
   }
-  if (!writeBuf_.empty()) {
+  if (!writeBuf_.empty() && !heldSince_ && !egressScheduled_) {
     XLOG(WARN) << "No objects published on subgroup=" << header_;
   }
   return writeToStream(/*finStream=*/true);
 }
 
+uint64_t StreamPublisherImpl::dropBufferedBytes() {
+  auto released = bufferedBytes();
+  XLOG(DBG1) << "Dropping subgroup=" << header_ << " released=" << released
+             << " sgp=" << this;
+  // Nothing to report when no bytes were waiting
+  if (released > 0 && publisher_) {
+    publisher_->onBytesUnbuffered(released);
+    MOQ_TRACK_STATS(
+        publisher_->trackStatsCallback(),
+        onSubgroupDropped,
+        publisher_->fullTrackName(),
+        released);
+  }
+  // Late delivery callbacks for these bytes are ignored
+  bytesDeliveredOrCanceled_ = bytesWritten_;
+  undelivered_.clear();
+  dropped_ = true;
+  writeBuf_.move();
+  reset(ResetStreamErrorCode::DELIVERY_TIMEOUT);
+  return released;
+}
+
 void StreamPublisherImpl::reset(ResetStreamErrorCode error) {
+  auto heldKeepalive = cancelCoalescing();
+  if (streamComplete_) {
+    // Already reset by the session, eg: dropped for buffering
+    XLOG(DBG4) << "reset after stream complete: sgp=" << this;
+    return;
+  }
   if (!writeBuf_.empty()) {
-    // TODO: stream header is pending, reliable reset?
-    XLOG(WARN) << "Stream header pending on subgroup=" << header_;
+    // TODO: stream header or coalesced objects pending, reliable reset?
+    XLOG(WARN) << "Writes pending on subgroup=" << header_;
   }
   if (writeHandle_) {
     auto writeHandle = writeHandle_;
@@ -653,6 +975,16 @@ StreamPublisherImpl::awaitReadyToConsume() {
     return folly::makeUnexpected(
         MoQPublishError(MoQPublishError::CANCELLED, "Fetch cancelled"));
   }
+  if (fetchResumeTime_) {
+    auto resumeTime = *fetchResumeTime_;
+    fetchResumeTime_.reset();
+    auto now = std::chrono::steady_clock::now();
+    if (resumeTime > now) {
+      return folly::futures::sleep(
+          std::chrono::duration_cast<folly::HighResDuration>(
+              resumeTime - now));
+    }
+  }
   auto writableFuture = writeHandle_->awaitWritable();
   if (!writableFuture) {
     return folly::makeUnexpected(
@@ -667,6 +999,9 @@ StreamPublisherImpl::ensureWriteHandle() {
     return folly::unit;
   }
   if (streamComplete_) {
+    if (dropped_) {
+      return folly::makeUnexpected(closedError());
+    }
     return folly::makeUnexpected(MoQPublishError(
         MoQPublishError::API_ERROR, "Write after stream complete"));
   }
@@ -692,7 +1027,7 @@ StreamPublisherImpl::ensureWriteHandle() {
   // publisher group order is not known here, but it shouldn't matter
   // Currently sets group=0 for FETCH priority bits
   stream.value()->setPriority(
-      1,
+      publisher_->fetchStreamUrgency(),
       getStreamPriority(
           0, 0, publisher_->subPriority(), 0, GroupOrder::OldestFirst),
       false);
@@ -782,6 +1117,72 @@ class MoQSession::TrackPublisherImpl : public MoQSession::PublisherImpl,
     subscribeDone(std::move(subDone));
   }
 
+  // Recomputes the priority of every open subgroup from the current
+  // subscriber priority
+  void updateSubgroupPriorities() {
+    for (const auto& [id, subgroupPublisher] : subgroups_) {
+      subgroupPublisher->updateStreamPriority(getStreamPriority(
+          id.first,
+          id.second,
+          subPriority_,
+          subgroupPublisher->publisherPriority(),
+          groupOrder_));
+    }
+  }
+
+  // Drops every open subgroup, releasing their buffered bytes
+  void dropAllSubgroups() {
+    std::vector<std::shared_ptr<StreamPublisherImpl>> subgroups;
+    subgroups.reserve(subgroups_.size());
+    for (const auto& [_, subgroupPublisher] : subgroups_) {
+      subgroups.push_back(subgroupPublisher);
+    }
+    // dropBufferedBytes will invoke onStreamComplete, which erases from
+    // subgroups_
+    for (auto& subgroupPublisher : subgroups) {
+      subgroupPublisher->dropBufferedBytes();
+    }
+  }
+
+  // Appends open subgroups with a lower precedence than streamPriority that
+  // have bytes buffered
+  void appendSheddableSubgroups(
+      std::vector<std::shared_ptr<StreamPublisherImpl>>& subgroups,
+      uint64_t streamPriority) const {
+    for (const auto& [_, subgroupPublisher] : subgroups_) {
+      if (subgroupPublisher->streamPriority() > streamPriority &&
+          subgroupPublisher->bufferedBytes() > 0) {
+        subgroups.push_back(subgroupPublisher);
+      }
+    }
+  }
+
+  // Drops open subgroups holding objects older than the delivery timeout
+  void dropLateSubgroups() {
+    if (deliveryTimeout_.count() == 0) {
+      return;
+    }
+    auto now = this->now();
+    std::vector<std::shared_ptr<StreamPublisherImpl>> lateSubgroups;
+    for (const auto& [_, subgroupPublisher] : subgroups_) {
+      if (subgroupPublisher->pastDeliveryTimeout(now)) {
+        lateSubgroups.push_back(subgroupPublisher);
+      }
+    }
+    for (auto& subgroupPublisher : lateSubgroups) {
+      XLOG(DBG1) << "Delivery timeout, dropping subgroup trackPub=" << this;
+      subgroupPublisher->dropBufferedBytes();
+    }
+  }
+
+  void onDeliveryDeadline(
+      std::chrono::steady_clock::time_point deadline) override {
+    // Deadlines only grow, so a scheduled check is never too late
+    if (!deliveryTimer_.isScheduled()) {
+      scheduleDeliveryTimer(deadline);
+    }
+  }
+
   void resetAllSubgroups(ResetStreamErrorCode code) {
     while (!subgroups_.empty()) {
       auto it = subgroups_.begin();
@@ -824,6 +1225,45 @@ class MoQSession::TrackPublisherImpl : public MoQSession::PublisherImpl,
       SubscribeDone subDone) override;
 
  private:
+  // Drops late subgroups that get no further writes
+  class DeliveryTimer : public folly::HHWheelTimer::Callback {
+   public:
+    explicit DeliveryTimer(TrackPublisherImpl& trackPublisher)
+        : trackPublisher_(trackPublisher) {}
+    void timeoutExpired() noexcept override {
+      trackPublisher_.onDeliveryTimer();
+    }
+
+   private:
+    TrackPublisherImpl& trackPublisher_;
+  };
+
+  void scheduleDeliveryTimer(std::chrono::steady_clock::time_point deadline) {
+    auto evb = getEventBase();
+    if (!evb) {
+      return;
+    }
+    auto wait =
+        std::chrono::ceil<std::chrono::milliseconds>(deadline - now());
+    evb->timer().scheduleTimeout(
+        &deliveryTimer_, std::max(wait, std::chrono::milliseconds(1)));
+  }
+
+  void onDeliveryTimer() {
+    auto keepalive = shared_from_this();
+    dropLateSubgroups();
+    folly::Optional<std::chrono::steady_clock::time_point> oldest;
+    for (const auto& [_, subgroupPublisher] : subgroups_) {
+      auto written = subgroupPublisher->oldestUndelivered();
+      if (written && (!oldest || *written < *oldest)) {
+        oldest = written;
+      }
+    }
+    if (oldest) {
+      scheduleDeliveryTimer(*oldest + deliveryTimeout_);
+    }
+  }
+
   std::shared_ptr<Publisher::SubscriptionHandle> handle_;
   TrackAlias trackAlias_;
   folly::Optional<SubscribeDone> pendingSubscribeDone_;
@@ -835,6 +1275,7 @@ class MoQSession::TrackPublisherImpl : public MoQSession::PublisherImpl,
   enum class State { OPEN, DONE };
   State state_{State::OPEN};
   bool forward_;
+  DeliveryTimer deliveryTimer_{*this};
 };
 
 class MoQSession::FetchPublisherImpl : public MoQSession::PublisherImpl {
@@ -896,9 +1337,22 @@ class MoQSession::FetchPublisherImpl : public MoQSession::PublisherImpl {
 
   void onStreamComplete(const ObjectHeader&) override {
     streamPublisher_.reset();
+    releaseLimiterSlots();
     PublisherImpl::fetchComplete();
   }
 
+  // Holds a slot in limiter until the stream completes
+  void addLimiterSlot(std::shared_ptr<MoQFetchLimiter> limiter) {
+    limiterSlots_.push_back(std::move(limiter));
+  }
+
+  void releaseLimiterSlots() {
+    auto slots = std::move(limiterSlots_);
+    for (auto& limiter : slots) {
+      limiter->release();
+    }
+  }
+
   void onTooManyBytesBuffered() override {
     // Right now, we don't do anything when we buffer too many bytes for a
     // FETCH.
@@ -907,6 +1361,7 @@ class MoQSession::FetchPublisherImpl : public MoQSession::PublisherImpl {
  private:
   std::shared_ptr<Publisher::FetchHandle> handle_;
   std::shared_ptr<StreamPublisherImpl> streamPublisher_;
+  std::vector<std::shared_ptr<MoQFetchLimiter>> limiterSlots_;
   bool cancelled_{false};
 };
 
@@ -940,6 +1395,8 @@ MoQSession::TrackPublisherImpl::beginSubgroup(
     return folly::makeUnexpected(MoQPublishError(
         MoQPublishError::API_ERROR, "Publish after subscribeDone"));
   }
+  // Stop spending bandwidth on subgroups the subscriber will discard
+  dropLateSubgroups();
   auto stream = wt->createUniStream();
   if (!stream) {
     // failed to create a stream
@@ -951,11 +1408,9 @@ MoQSession::TrackPublisherImpl::beginSubgroup(
   }
   XLOG(DBG4) << "New stream created, id: " << stream.value()->getID()
              << " tp=" << this;
-  stream.value()->setPriority(
-      1,
-      getStreamPriority(
-          groupID, subgroupID, subPriority_, pubPriority, groupOrder_),
-      false);
+  auto streamPriority = getStreamPriority(
+      groupID, subgroupID, subPriority_, pubPriority, groupOrder_);
+  stream.value()->setPriority(1, streamPriority, false);
   auto subgroupPublisher = std::make_shared<StreamPublisherImpl>(
       shared_from_this(),
       *stream,
@@ -964,6 +1419,7 @@ MoQSession::TrackPublisherImpl::beginSubgroup(
       subgroupID,
       format,
       includeExtensions);
+  subgroupPublisher->setStreamPriority(streamPriority, pubPriority);
   // TODO: these are currently unused, but the intent might be to reset
   // open subgroups automatically from some path?
   subgroups_[{groupID, subgroupID}] = subgroupPublisher;
@@ -977,7 +1433,18 @@ MoQSession::TrackPublisherImpl::awaitStreamCredit() {
     return folly::makeUnexpected(MoQPublishError(
         MoQPublishError::API_ERROR, "awaitStreamCredit after subscribeDone"));
   }
-  return wt->awaitUniStreamCredit();
+  auto credit = wt->awaitUniStreamCredit();
+  if (!trackStatsCallback_ || credit.isReady()) {
+    return credit;
+  }
+  return std::move(credit).deferValue(
+      [trackStatsCallback = trackStatsCallback_,
+       ftn = fullTrackName_,
+       start = std::chrono::steady_clock::now()](folly::Unit) {
+        auto stall = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+        trackStatsCallback->recordStreamCreditStall(ftn, stall.count());
+      });
 }
 
 void MoQSession::TrackPublisherImpl::onStreamComplete(
@@ -991,6 +1458,15 @@ void MoQSession::TrackPublisherImpl::onStreamComplete(
 }
 
 void MoQSession::TrackPublisherImpl::onTooManyBytesBuffered() {
+  MOQ_TRACK_STATS(trackStatsCallback_, onTooFarBehind, fullTrackName_);
+  if (session_ &&
+      session_->moqSettings_.bufferingThresholds
+          .resetSubgroupsWhenTooFarBehind) {
+    XLOG(DBG1) << "Too far behind, dropping open subgroups id=" << requestID_
+               << " trackPub=" << this;
+    dropAllSubgroups();
+    return;
+  }
   // Note: There is one case in which this reset can be problematic. If some
   // streams have been created, but have been reset before the subgroup header
   // is sent out, then there can be a stream count discrepancy. We could, some
@@ -1108,12 +1584,19 @@ MoQSession::TrackPublisherImpl::datagram(
           header.extensions,
           headerLength),
       std::move(payload));
-  // TODO: set priority when WT has an API for that
-  auto res = wt->sendDatagram(writeBuf.move());
-  if (res.hasError()) {
-    return folly::makeUnexpected(
-        MoQPublishError(MoQPublishError::WRITE_ERROR, "sendDatagram failed"));
+  if (egressScheduling()) {
+    session_->scheduleDatagram(
+        getStreamPriority(
+            header.group, 0, subPriority_, header.priority, groupOrder_),
+        requestID_.value,
+        egressWeight(),
+        writeBuf.move());
+  } else {
+    // WT has no datagram priority, the session orders each batch instead
+    session_->queueDatagram(header.priority, writeBuf.move());
   }
+  MOQ_TRACK_STATS(
+      trackStatsCallback_, onObjectSent, fullTrackName_, headerLength);
   return folly::unit;
 }
 
@@ -1360,7 +1843,113 @@ MoQSession::~MoQSession() {
   XLOG(DBG1) << __func__ << " sess=" << this;
 }
 
+void MoQSession::queueDatagram(
+    uint8_t priority,
+    std::unique_ptr<folly::IOBuf> datagram) {
+  pendingDatagrams_.push_back({priority, std::move(datagram)});
+  if (!evb_) {
+    flushDatagrams();
+  } else if (!datagramFlusher_.isLoopCallbackScheduled()) {
+    evb_->runInLoop(&datagramFlusher_);
+  }
+}
+
+void MoQSession::flushDatagrams() {
+  datagramFlusher_.cancelLoopCallback();
+  if (pendingDatagrams_.empty()) {
+    return;
+  }
+  auto datagrams = std::move(pendingDatagrams_);
+  pendingDatagrams_.clear();
+  if (!wt_) {
+    return;
+  }
+  // Publish order within a priority
+  std::stable_sort(
+      datagrams.begin(), datagrams.end(), [](const auto& a, const auto& b) {
+        return a.priority < b.priority;
+      });
+  size_t failed = 0;
+  for (auto& pending : datagrams) {
+    if (wt_->sendDatagram(std::move(pending.datagram)).hasError()) {
+      failed++;
+    }
+  }
+  if (failed > 0) {
+    XLOG(DBG1) << "sendDatagram failed for " << failed << " of "
+               << datagrams.size() << " datagrams sess=" << this;
+  }
+}
+
+void MoQSession::scheduleEgress(
+    uint64_t order,
+    uint64_t flow,
+    uint32_t weight,
+    MoQEgressScheduler::Send send) {
+  egressScheduler_.schedule(order, flow, weight, std::move(send));
+  if (!evb_) {
+    flushEgress(/*ignoreWindow=*/false);
+  } else if (!egressFlusher_.isLoopCallbackScheduled()) {
+    evb_->runInLoop(&egressFlusher_);
+  }
+}
+
+void MoQSession::scheduleDatagram(
+    uint64_t order,
+    uint64_t flow,
+    uint32_t weight,
+    std::unique_ptr<folly::IOBuf> datagram) {
+  scheduleEgress(
+      order,
+      flow,
+      weight,
+      [this, datagram = std::move(datagram)]() mutable -> uint64_t {
+        auto numBytes = datagram->computeChainDataLength();
+        if (!wt_ || wt_->sendDatagram(std::move(datagram)).hasError()) {
+          XLOG(DBG1) << "sendDatagram failed sess=" << this;
+          return 0;
+        }
+        egressDatagramBytes_ += numBytes;
+        return numBytes;
+      });
+}
+
+void MoQSession::flushEgress(bool ignoreWindow) {
+  egressFlusher_.cancelLoopCallback();
+  auto window = moqSettings_.egressScheduling.windowBytes;
+  egressDatagramBytes_ = 0;
+  egressScheduler_.run([&] {
+    return ignoreWindow || window == 0 ||
+        *bytesBuffered_ + egressDatagramBytes_ < window;
+  });
+  if (!egressScheduler_.empty()) {
+    XLOG(DBG4) << "Egress window full, " << egressScheduler_.size()
+               << " writes waiting sess=" << this;
+    // Datagrams closed the window, they are sent now so it reopens next loop.
+    // Stream bytes reopen it from onBytesUnbuffered instead.
+    if (evb_ && window > 0 && *bytesBuffered_ < window) {
+      evb_->runInLoop(&egressFlusher_);
+    }
+  }
+}
+
+void MoQSession::onEgressWindowOpened() {
+  if (egressScheduler_.empty() || egressFlusher_.isLoopCallbackScheduled()) {
+    return;
+  }
+  if (evb_) {
+    evb_->runInLoop(&egressFlusher_);
+  }
+}
+
 void MoQSession::cleanup() {
+  // Unsent datagrams are dropped with the session
+  datagramFlusher_.cancelLoopCallback();
+  pendingDatagrams_.clear();
+  egressFlusher_.cancelLoopCallback();
+  egressScheduler_.clear();
+  transportMetricsSampler_.cancelTimeout();
+  transportMetricsCallbacks_.clear();
   // TODO: Are these loops safe since they may (should?) delete elements
   for (auto& subAnn : subscribeAnnounces_) {
     subAnn.second->unsubscribeAnnounces();
@@ -1473,8 +2062,75 @@ void MoQSession::goaway(Goaway goaway) {
   }
 }
 
+void MoQSession::setTransportMetricsInterval(
+    std::chrono::milliseconds interval) {
+  transportMetricsInterval_ = interval;
+  transportMetricsSampler_.cancelTimeout();
+  if (evb_ && interval.count() > 0) {
+    evb_->timer().scheduleTimeout(&transportMetricsSampler_, interval);
+  }
+}
+
+void MoQSession::addTransportMetricsCallback(
+    std::shared_ptr<TransportMetricsCallback> callback) {
+  transportMetricsCallbacks_.emplace_back(std::move(callback));
+}
+
+void MoQSession::removeTransportMetricsCallback(
+    const TransportMetricsCallback* callback) {
+  auto it = std::find_if(
+      transportMetricsCallbacks_.begin(),
+      transportMetricsCallbacks_.end(),
+      [callback](const auto& cb) { return cb.get() == callback; });
+  if (it != transportMetricsCallbacks_.end()) {
+    transportMetricsCallbacks_.erase(it);
+  }
+}
+
+namespace {
+// More than an eighth apart
+bool movedNoticeably(uint64_t last, uint64_t now) {
+  auto diff = last > now ? last - now : now - last;
+  return diff * 8 > std::max(last, now);
+}
+} // namespace
+
+void MoQSession::sampleTransportMetrics() {
+  if (!wt_) {
+    return;
+  }
+  MOQ_PUBLISHER_STATS(
+      publisherStatsCallback_, recordMemoryUsage, memoryUsage());
+  if (auto metrics = getTransportMetrics()) {
+    MOQ_PUBLISHER_STATS(
+        publisherStatsCallback_, recordTransportMetrics, *metrics);
+    maxDatagramSize_ = metrics->maxDatagramSize;
+    auto& last = notifiedTransportMetrics_;
+    if (!last ||
+        movedNoticeably(
+            last->estimatedSendRateBps(), metrics->estimatedSendRateBps()) ||
+        movedNoticeably(last->srtt.count(), metrics->srtt.count()) ||
+        metrics->packetsLost > last->packetsLost) {
+      last = *metrics;
+      // Callbacks may remove themselves
+      auto callbacks = transportMetricsCallbacks_;
+      for (const auto& callback : callbacks) {
+        callback->onTransportMetrics(*metrics);
+      }
+    }
+  }
+  if (wt_ && transportMetricsInterval_.count() > 0) {
+    evb_->timer().scheduleTimeout(
+        &transportMetricsSampler_, transportMetricsInterval_);
+  }
+}
+
 void MoQSession::checkForCloseOnDrain() {
-  if (draining_ && fetches_.empty() && subTracks_.empty()) {
+  // A server keeps publishing after GOAWAY until the client has moved its
+  // subscriptions elsewhere
+  bool publishing =
+      dir_ == MoQControlCodec::Direction::SERVER && !pubTracks_.empty();
+  if (draining_ && fetches_.empty() && subTracks_.empty() && !publishing) {
     close(SessionCloseErrorCode::NO_ERROR);
   }
 }
@@ -1516,6 +2172,9 @@ folly::coro::Task<void> MoQSession::controlWriteLoop(
         co_return;
       }
     }
+    // Let the rest of this loop iteration queue its frames, so a burst of
+    // requests goes out in one write
+    co_await folly::coro::co_reschedule_on_current_executor;
     co_await folly::coro::co_safe_point;
     auto writeRes =
         controlStream->writeStreamData(controlWriteBuf_.move(), false, nullptr);
@@ -1532,13 +2191,7 @@ folly::coro::Task<void> MoQSession::controlWriteLoop(
   }
 }
 
-folly::coro::Task<ServerSetup> MoQSession::setup(ClientSetup setup) {
-  XCHECK(dir_ == MoQControlCodec::Direction::CLIENT);
-  XLOG(DBG1) << __func__ << " sess=" << this;
-  folly::coro::Future<ServerSetup> setupFuture;
-  std::tie(setupPromise_, setupFuture) =
-      folly::coro::makePromiseContract<ServerSetup>();
-
+bool MoQSession::writeSetup(const ClientSetup& setup) {
   auto maxRequestID = getMaxRequestIDIfPresent(setup.params);
 
   // TODO: Potentially rethink what we're doing here. If the client
@@ -1558,11 +2211,38 @@ folly::coro::Task<ServerSetup> MoQSession::setup(ClientSetup setup) {
       writeClientSetup(controlWriteBuf_, setup, setupSerializationVersion);
   if (!res) {
     XLOG(ERR) << "writeClientSetup failed sess=" << this;
-    co_yield folly::coro::co_error(std::runtime_error("Failed to write setup"));
+    return false;
   }
   maxRequestID_ = maxRequestID;
   maxConcurrentRequests_ = maxRequestID_ / getRequestIDMultiplier();
   controlWriteEvent_.signal();
+  return true;
+}
+
+void MoQSession::applyServerSetupParams(const ServerSetup& serverSetup) {
+  peerMaxRequestID_ = getMaxRequestIDIfPresent(serverSetup.params);
+  tokenCache_.setMaxSize(std::min(
+      kMaxSendTokenCacheSize,
+      getMaxAuthTokenCacheSizeIfPresent(serverSetup.params)));
+}
+
+void MoQSession::completeClientSetup(uint64_t selectedVersion) {
+  setupComplete_ = true;
+  initializeNegotiatedVersion(selectedVersion);
+  if (getDraftMajorVersion(selectedVersion) < 11) {
+    nextExpectedPeerRequestID_ = 0;
+  }
+}
+
+folly::coro::Task<ServerSetup> MoQSession::setup(ClientSetup setup) {
+  XCHECK(dir_ == MoQControlCodec::Direction::CLIENT);
+  XLOG(DBG1) << __func__ << " sess=" << this;
+  folly::coro::Future<ServerSetup> setupFuture;
+  std::tie(setupPromise_, setupFuture) =
+      folly::coro::makePromiseContract<ServerSetup>();
+  if (!writeSetup(setup)) {
+    co_yield folly::coro::co_error(std::runtime_error("Failed to write setup"));
+  }
 
   auto deletedToken = cancellationSource_.getToken();
   auto token = co_await folly::coro::co_current_cancellation_token;
@@ -1589,21 +2269,43 @@ folly::coro::Task<ServerSetup> MoQSession::setup(ClientSetup setup) {
     co_yield folly::coro::co_error(serverSetup.exception());
   }
 
-  setupComplete_ = true;
-  initializeNegotiatedVersion(serverSetup->selectedVersion);
-  if (getDraftMajorVersion(serverSetup->selectedVersion) < 11) {
-    nextExpectedPeerRequestID_ = 0;
-  }
+  completeClientSetup(serverSetup->selectedVersion);
   co_return *serverSetup;
 }
 
+folly::coro::Future<ServerSetup> MoQSession::setupOptimistic(
+    ClientSetup setup,
+    ServerSetup expected) {
+  XCHECK(dir_ == MoQControlCodec::Direction::CLIENT);
+  XLOG(DBG1) << __func__ << " sess=" << this;
+  folly::coro::Future<ServerSetup> setupFuture;
+  std::tie(setupPromise_, setupFuture) =
+      folly::coro::makePromiseContract<ServerSetup>();
+  if (!writeSetup(setup)) {
+    close(SessionCloseErrorCode::INTERNAL_ERROR);
+    return setupFuture;
+  }
+  optimisticVersion_ = expected.selectedVersion;
+  applyServerSetupParams(expected);
+  completeClientSetup(expected.selectedVersion);
+  return setupFuture;
+}
+
 void MoQSession::onServerSetup(ServerSetup serverSetup) {
   XCHECK(dir_ == MoQControlCodec::Direction::CLIENT);
   XLOG(DBG1) << __func__ << " sess=" << this;
-  peerMaxRequestID_ = getMaxRequestIDIfPresent(serverSetup.params);
-  tokenCache_.setMaxSize(std::min(
-      kMaxSendTokenCacheSize,
-      getMaxAuthTokenCacheSizeIfPresent(serverSetup.params)));
+  applyServerSetupParams(serverSetup);
+  if (optimisticVersion_ &&
+      serverSetup.selectedVersion != *optimisticVersion_) {
+    // Everything sent since CLIENT_SETUP used the wrong version
+    XLOG(ERR) << "Server chose version=" << serverSetup.selectedVersion
+              << " not the optimistic version=" << *optimisticVersion_
+              << " sess=" << this;
+    setupPromise_.setException(
+        std::runtime_error("SERVER_SETUP version mismatch"));
+    close(SessionCloseErrorCode::VERSION_NEGOTIATION_FAILED);
+    return;
+  }
   setupPromise_.setValue(std::move(serverSetup));
 }
 
@@ -1790,6 +2492,12 @@ class ObjectStreamCallback : public MoQObjectStreamCodec::ObjectCallback {
     if (isCancelled()) {
       return;
     }
+    MOQ_TRACK_STATS(
+        session_->getTrackStatsCallback(),
+        onObjectReceived,
+        fetchState_ ? fetchState_->fullTrackName()
+                    : subscribeState_->fullTrackName(),
+        length);
 
     folly::Expected<folly::Unit, MoQPublishError> res{folly::unit};
     if (objectComplete) {
@@ -1817,7 +2525,7 @@ class ObjectStreamCallback : public MoQObjectStreamCodec::ObjectCallback {
           std::move(extensions));
     }
     if (!res) {
-      error_ = std::move(res.error());
+      onConsumerError(std::move(res.error()));
     }
   }
 
@@ -1833,7 +2541,7 @@ class ObjectStreamCallback : public MoQObjectStreamCodec::ObjectCallback {
         std::move(payload),
         finStream);
     if (!res) {
-      error_ = std::move(res.error());
+      onConsumerError(std::move(res.error()));
     } else {
       XCHECK_EQ(objectComplete, res.value() == ObjectPublishStatus::DONE);
     }
@@ -1900,7 +2608,7 @@ class ObjectStreamCallback : public MoQObjectStreamCodec::ObjectCallback {
         break;
     }
     if (!res) {
-      error_ = std::move(res.error());
+      onConsumerError(std::move(res.error()));
     }
   }
 
@@ -1933,7 +2641,36 @@ class ObjectStreamCallback : public MoQObjectStreamCodec::ObjectCallback {
     return error_;
   }
 
+  // If the consumer returned BLOCKED, returns when it is ready for more and
+  // clears the blocked state
+  folly::Optional<folly::SemiFuture<folly::Unit>> takeBlocked() {
+    if (!blocked_) {
+      return folly::none;
+    }
+    blocked_ = false;
+    if (isCancelled()) {
+      return folly::none;
+    }
+    auto res = fetchState_
+        ? fetchState_->getFetchCallback()->awaitReadyToConsume()
+        : subgroupCallback_->awaitReadyToConsume();
+    if (!res) {
+      error_ = std::move(res.error());
+      return folly::none;
+    }
+    return std::move(res.value());
+  }
+
  private:
+  void onConsumerError(MoQPublishError err) {
+    if (err.code == MoQPublishError::BLOCKED) {
+      // Backpressure, not a failure.  The read loop pauses after this read.
+      blocked_ = true;
+    } else {
+      error_ = std::move(err);
+    }
+  }
+
   bool isCancelled() const {
     if (fetchState_) {
       return !fetchState_->getFetchCallback();
@@ -1965,6 +2702,7 @@ class ObjectStreamCallback : public MoQObjectStreamCodec::ObjectCallback {
   std::shared_ptr<SubgroupConsumer> subgroupCallback_;
   std::shared_ptr<MoQSession::FetchTrackReceiveState> fetchState_;
   folly::Optional<MoQPublishError> error_;
+  bool blocked_{false};
 };
 } // namespace
 
@@ -1980,6 +2718,7 @@ folly::coro::Task<void> MoQSession::unidirectionalReadLoop(
   auto token = co_await folly::coro::co_current_cancellation_token;
   MoQObjectStreamCodec codec(nullptr);
   codec.initializeVersion(*negotiatedVersion_);
+  codec.setIngressAccounting(dataIngressBytes_);
   ObjectStreamCallback dcb(session, /*by ref*/ token);
   codec.setCallback(&dcb);
   codec.setStreamId(id);
@@ -2011,8 +2750,10 @@ folly::coro::Task<void> MoQSession::unidirectionalReadLoop(
       if (streamData->data || streamData->fin) {
         fin = streamData->fin;
         folly::Optional<MoQPublishError> err;
+        folly::Optional<folly::SemiFuture<folly::Unit>> readyToConsume;
         try {
           codec.onIngress(std::move(streamData->data), streamData->fin);
+          readyToConsume = dcb.takeBlocked();
           err = dcb.error();
         } catch (const std::exception& ex) {
           err = MoQPublishError(
@@ -2028,6 +2769,16 @@ folly::coro::Task<void> MoQSession::unidirectionalReadLoop(
             break;
           }
         }
+        if (readyToConsume && !fin) {
+          // Stop reading until the consumer drains.  Unread data holds the
+          // stream's flow control credit, so the peer is paced.
+          XLOG(DBG4) << "Consumer blocked, pausing id=" << id
+                     << " sess=" << this;
+          co_await folly::coro::co_awaitTry(folly::coro::co_withCancellation(
+              token,
+              folly::coro::toTaskInterruptOnCancel(
+                  std::move(*readyToConsume).via(evb_))));
+        }
       } // else empty read
     }
   }
@@ -2070,6 +2821,10 @@ void MoQSession::onSubscribe(SubscribeRequest subscribeRequest) {
       *negotiatedVersion_,
       moqSettings_.bufferingThresholds.perSubscription,
       forward);
+  if (auto deliveryTimeout = getDeliveryTimeoutIfPresent(
+          subscribeRequest.params, *negotiatedVersion_)) {
+    trackPublisher->setDeliveryTimeout(*deliveryTimeout);
+  }
   pubTracks_.emplace(requestID, trackPublisher);
   // TODO: there should be a timeout for the application to call
   // subscribeOK/Error
@@ -2133,7 +2888,6 @@ void MoQSession::onSubscribeUpdate(SubscribeUpdate subscribeUpdate) {
   }
 
   it->second->setSubPriority(subscribeUpdate.priority);
-  // TODO: update priority of tracks in flight
   auto pubTrackIt = pubTracks_.find(requestID);
   if (pubTrackIt == pubTracks_.end()) {
     XLOG(ERR) << "SubscribeUpdate track not found id=" << requestID
@@ -2146,6 +2900,12 @@ void MoQSession::onSubscribeUpdate(SubscribeUpdate subscribeUpdate) {
     XLOG(ERR) << "RequestID in SubscribeUpdate is for a FETCH, id=" << requestID
               << " sess=" << this;
   } else {
+    if (auto deliveryTimeout = getDeliveryTimeoutIfPresent(
+            subscribeUpdate.params, *negotiatedVersion_)) {
+      trackPublisher->setDeliveryTimeout(*deliveryTimeout);
+    }
+    // Streams already in flight shift to the new priority immediately
+    trackPublisher->updateSubgroupPriorities();
     trackPublisher->subscribeUpdate(std::move(subscribeUpdate));
   }
 }
@@ -2178,6 +2938,7 @@ void MoQSession::onUnsubscribe(Unsubscribe unsubscribe) {
     if (pubTracks_.erase(unsubscribe.requestID)) {
       retireRequestID(/*signalWriteLoop=*/true);
     } // else, the caller invoked subscribeDone, which isn't needed but fine
+    checkForCloseOnDrain();
   }
 }
 
@@ -2341,6 +3102,34 @@ void MoQSession::onFetch(Fetch fetch) {
       moqSettings_.bufferingThresholds.perSubscription);
   fetchPublisher->initialize();
   pubTracks_.emplace(fetch.requestID, fetchPublisher);
+  startFetch(std::move(fetch), std::move(fetchPublisher), 0);
+}
+
+void MoQSession::startFetch(
+    Fetch fetch,
+    std::shared_ptr<FetchPublisherImpl> fetchPublisher,
+    size_t limiterIndex) {
+  if (limiterIndex < fetchLimiters_.size()) {
+    auto limiter = fetchLimiters_[limiterIndex];
+    limiter->acquire(
+        evb_,
+        [weakSelf = weak_from_this(),
+         limiter,
+         fetch = std::move(fetch),
+         fetchPublisher = std::move(fetchPublisher),
+         limiterIndex]() mutable {
+          auto self = weakSelf.lock();
+          if (!self || !fetchPublisher->getStreamPublisher()) {
+            // The FETCH was cancelled or the session closed while waiting
+            limiter->release();
+            return;
+          }
+          fetchPublisher->addLimiterSlot(std::move(limiter));
+          self->startFetch(
+              std::move(fetch), std::move(fetchPublisher), limiterIndex + 1);
+        });
+    return;
+  }
   handleFetch(std::move(fetch), std::move(fetchPublisher))
       .scheduleOn(evb_)
       .start();
@@ -2505,20 +3294,26 @@ folly::coro::Task<void> MoQSession::handleAnnounce(Announce announce) {
 }
 
 void MoQSession::maybeAddLegacyRequestIDMapping(
-    const FullTrackName& ftn,
+    const TrackNamespace& trackNamespace,
+    folly::StringPiece trackName,
     RequestID id) {
-  if (getDraftMajorVersion(*getNegotiatedVersion()) >= 11) {
+  if (!moqFrameWriter_.draftTraits().legacy) {
     return;
   } else {
-    fullTrackNameToRequestID_[ftn] = id;
+    fullTrackNameToRequestID_[FullTrackName{trackNamespace, trackName.str()}] =
+        id;
   }
 }
 
-RequestID MoQSession::getRequestID(RequestID id, const FullTrackName& ftn) {
-  if (getDraftMajorVersion(*getNegotiatedVersion()) >= 11) {
+RequestID MoQSession::getRequestID(
+    RequestID id,
+    const TrackNamespace& trackNamespace,
+    folly::StringPiece trackName) {
+  if (!moqFrameWriter_.draftTraits().legacy) {
     return id;
   } else {
-    auto it = fullTrackNameToRequestID_.find(ftn);
+    auto it = fullTrackNameToRequestID_.find(
+        FullTrackName{trackNamespace, trackName.str()});
     if (it == fullTrackNameToRequestID_.end()) {
       return std::numeric_limits<uint64_t>::max();
     } else {
@@ -2531,8 +3326,7 @@ RequestID MoQSession::getRequestID(RequestID id, const FullTrackName& ftn) {
 
 void MoQSession::onAnnounceOk(AnnounceOk annOk) {
   XLOG(DBG1) << __func__ << " ns=" << annOk.trackNamespace << " sess=" << this;
-  auto reqID = getRequestID(
-      annOk.requestID, FullTrackName({annOk.trackNamespace, "announce"}));
+  auto reqID = getRequestID(annOk.requestID, annOk.trackNamespace, "announce");
   auto annIt = pendingAnnounce_.find(reqID);
   if (annIt == pendingAnnounce_.end()) {
     // unknown
@@ -2543,7 +3337,7 @@ void MoQSession::onAnnounceOk(AnnounceOk annOk) {
 
   publisherAnnounces_[annIt->second.trackNamespace] =
       std::move(annIt->second.callback);
-  annOk.trackNamespace = annIt->second.trackNamespace;
+  annOk.trackNamespace = std::move(annIt->second.trackNamespace);
   annIt->second.promise.setValue(std::move(annOk));
   pendingAnnounce_.erase(annIt);
 }
@@ -2552,8 +3346,7 @@ void MoQSession::onAnnounceError(AnnounceError announceError) {
   XLOG(DBG1) << __func__ << " ns=" << announceError.trackNamespace
              << " sess=" << this;
   auto reqID = getRequestID(
-      announceError.requestID,
-      FullTrackName({announceError.trackNamespace, "announce"}));
+      announceError.requestID, announceError.trackNamespace, "announce");
   auto annIt = pendingAnnounce_.find(reqID);
   if (annIt == pendingAnnounce_.end()) {
     // unknown
@@ -2664,8 +3457,7 @@ void MoQSession::onSubscribeAnnouncesOk(SubscribeAnnouncesOk saOk) {
   XLOG(DBG1) << __func__ << " prefix=" << saOk.trackNamespacePrefix
              << " sess=" << this;
   auto reqID = getRequestID(
-      saOk.requestID,
-      FullTrackName({saOk.trackNamespacePrefix, "subannounce"}));
+      saOk.requestID, saOk.trackNamespacePrefix, "subannounce");
   auto saIt = pendingSubscribeAnnounces_.find(reqID);
   if (saIt == pendingSubscribeAnnounces_.end()) {
     // unknown
@@ -2685,8 +3477,8 @@ void MoQSession::onSubscribeAnnouncesError(
              << " sess=" << this;
   auto reqID = getRequestID(
       subscribeAnnouncesError.requestID,
-      FullTrackName(
-          {subscribeAnnouncesError.trackNamespacePrefix, "subannounce"}));
+      subscribeAnnouncesError.trackNamespacePrefix,
+      "subannounce");
   auto saIt = pendingSubscribeAnnounces_.find(reqID);
   if (saIt == pendingSubscribeAnnounces_.end()) {
     // unknown
@@ -2781,7 +3573,9 @@ folly::coro::Task<Publisher::TrackStatusResult> MoQSession::trackStatus(
   aliasifyAuthTokens(trackStatusRequest.params);
   trackStatusRequest.requestID = getNextRequestID(/*legacyAction=*/true);
   maybeAddLegacyRequestIDMapping(
-      trackStatusRequest.fullTrackName, trackStatusRequest.requestID);
+      trackStatusRequest.fullTrackName.trackNamespace,
+      trackStatusRequest.fullTrackName.trackName,
+      trackStatusRequest.requestID);
 
   auto res = moqFrameWriter_.writeTrackStatusRequest(
       controlWriteBuf_, trackStatusRequest);
@@ -2804,7 +3598,10 @@ void MoQSession::onTrackStatus(TrackStatus trackStatus) {
   XLOG(DBG1) << __func__ << " ftn=" << trackStatus.fullTrackName
              << " code=" << uint64_t(trackStatus.statusCode)
              << " sess=" << this;
-  auto reqID = getRequestID(trackStatus.requestID, trackStatus.fullTrackName);
+  auto reqID = getRequestID(
+      trackStatus.requestID,
+      trackStatus.fullTrackName.trackNamespace,
+      trackStatus.fullTrackName.trackName);
   auto trackStatusIt = trackStatuses_.find(reqID);
   if (trackStatusIt == trackStatuses_.end()) {
     XLOG(ERR) << __func__
@@ -2867,8 +3664,7 @@ folly::coro::Task<Subscriber::AnnounceResult> MoQSession::announce(
   auto trackNamespace = ann.trackNamespace;
   aliasifyAuthTokens(ann.params);
   ann.requestID = getNextRequestID(/*legacyAction=*/true);
-  maybeAddLegacyRequestIDMapping(
-      FullTrackName({ann.trackNamespace, "announce"}), ann.requestID);
+  maybeAddLegacyRequestIDMapping(ann.trackNamespace, "announce", ann.requestID);
   auto res = moqFrameWriter_.writeAnnounce(controlWriteBuf_, ann);
   if (!res) {
     XLOG(ERR) << "writeAnnounce failed sess=" << this;
@@ -2995,7 +3791,7 @@ MoQSession::subscribeAnnounces(SubscribeAnnounces sa) {
   aliasifyAuthTokens(sa.params);
   sa.requestID = getNextRequestID(/*legacyAction=*/true);
   maybeAddLegacyRequestIDMapping(
-      FullTrackName({sa.trackNamespacePrefix, "subannounce"}), sa.requestID);
+      sa.trackNamespacePrefix, "subannounce", sa.requestID);
 
   auto res = moqFrameWriter_.writeSubscribeAnnounces(controlWriteBuf_, sa);
   if (!res) {
@@ -3220,9 +4016,10 @@ void MoQSession::subscribeError(const SubscribeError& subErr) {
   retireRequestID(/*signalWriteLoop=*/false);
   if (!res) {
     XLOG(ERR) << "writeSubscribeError failed sess=" << this;
-    return;
+  } else {
+    controlWriteEvent_.signal();
   }
-  controlWriteEvent_.signal();
+  checkForCloseOnDrain();
 }
 
 void MoQSession::unsubscribe(const Unsubscribe& unsubscribe) {
@@ -3268,6 +4065,11 @@ MoQSession::PublisherImpl::subscribeDone(SubscribeDone subscribeDone) {
 
 void MoQSession::subscribeDone(const SubscribeDone& subDone) {
   XLOG(DBG1) << __func__ << " sess=" << this;
+  // Datagrams from the track go out before SUBSCRIBE_DONE
+  flushDatagrams();
+  if (!egressScheduler_.empty()) {
+    flushEgress(/*ignoreWindow=*/true);
+  }
   MOQ_PUBLISHER_STATS(
       publisherStatsCallback_, onSubscribeDone, subDone.statusCode);
   auto it = pubTracks_.find(subDone.requestID);
@@ -3281,11 +4083,40 @@ void MoQSession::subscribeDone(const SubscribeDone& subDone) {
   if (!res) {
     XLOG(ERR) << "writeSubscribeDone failed sess=" << this;
     // TODO: any control write failure should probably result in close()
-    return;
+  } else {
+    retireRequestID(/*signalWriteLoop=*/false);
+    controlWriteEvent_.signal();
   }
+  checkForCloseOnDrain();
+}
 
-  retireRequestID(/*signalWriteLoop=*/false);
-  controlWriteEvent_.signal();
+void MoQSession::shedBufferedBytes(uint64_t numBytes, uint64_t streamPriority) {
+  auto threshold = moqSettings_.bufferingThresholds.perSession;
+  if (threshold == 0 || *bytesBuffered_ + numBytes <= threshold) {
+    return;
+  }
+  auto excess = *bytesBuffered_ + numBytes - threshold;
+  std::vector<std::shared_ptr<StreamPublisherImpl>> subgroups;
+  for (const auto& [_, pubTrack] : pubTracks_) {
+    auto trackPublisher = dynamic_cast<TrackPublisherImpl*>(pubTrack.get());
+    if (trackPublisher) {
+      trackPublisher->appendSheddableSubgroups(subgroups, streamPriority);
+    }
+  }
+  // Lowest precedence (largest priority value) first
+  std::sort(
+      subgroups.begin(), subgroups.end(), [](const auto& a, const auto& b) {
+        return a->streamPriority() > b->streamPriority();
+      });
+  uint64_t released = 0;
+  for (auto& subgroup : subgroups) {
+    if (released >= excess) {
+      break;
+    }
+    released += subgroup->dropBufferedBytes();
+  }
+  XLOG(DBG1) << "Session buffer over by " << excess << ", released "
+             << released << " sess=" << this;
 }
 
 void MoQSession::retireRequestID(bool signalWriteLoop) {
@@ -3298,6 +4129,18 @@ void MoQSession::retireRequestID(bool signalWriteLoop) {
   }
 }
 
+void MoQSession::requestsBlocked() {
+  XLOG(DBG1) << __func__ << " peerMaxRequestID=" << peerMaxRequestID_
+             << " sess=" << this;
+  auto res = moqFrameWriter_.writeRequestsBlocked(
+      controlWriteBuf_, {.maxRequestID = peerMaxRequestID_});
+  if (!res) {
+    XLOG(ERR) << "writeRequestsBlocked failed sess=" << this;
+    return;
+  }
+  controlWriteEvent_.signal();
+}
+
 void MoQSession::sendMaxRequestID(bool signalWriteLoop) {
   XLOG(DBG1) << "Issuing new maxRequestID=" << maxRequestID_
              << " sess=" << this;
@@ -3328,6 +4171,7 @@ void MoQSession::fetchComplete(RequestID requestID) {
   }
   pubTracks_.erase(it);
   retireRequestID(/*signalWriteLoop=*/true);
+  checkForCloseOnDrain();
 }
 
 void MoQSession::subscribeUpdate(const SubscribeUpdate& subUpdate) {
@@ -3482,9 +4326,10 @@ void MoQSession::fetchError(const FetchError& fetchErr) {
   auto res = moqFrameWriter_.writeFetchError(controlWriteBuf_, fetchErr);
   if (!res) {
     XLOG(ERR) << "writeFetchError failed sess=" << this;
-    return;
+  } else {
+    controlWriteEvent_.signal();
   }
-  controlWriteEvent_.signal();
+  checkForCloseOnDrain();
 }
 
 void MoQSession::fetchCancel(const FetchCancel& fetchCan) {
@@ -3528,6 +4373,19 @@ folly::coro::Task<MoQSession::JoinResult> MoQSession::join(
   co_return {subscribeResult, fetchResult};
 }
 
+folly::coro::Task<std::vector<Publisher::SubscribeResult>>
+MoQSession::subscribeBatch(
+    std::vector<std::pair<SubscribeRequest, std::shared_ptr<TrackConsumer>>>
+        subs) {
+  XLOG(DBG1) << __func__ << " n=" << subs.size() << " sess=" << this;
+  std::vector<folly::coro::Task<SubscribeResult>> tasks;
+  tasks.reserve(subs.size());
+  for (auto& [sub, callback] : subs) {
+    tasks.emplace_back(subscribe(std::move(sub), std::move(callback)));
+  }
+  co_return co_await folly::coro::collectAllRange(std::move(tasks));
+}
+
 void MoQSession::onNewUniStream(proxygen::WebTransport::StreamReadHandle* rh) {
   XLOG(DBG1) << __func__ << " sess=" << this;
   if (!setupComplete_) {
@@ -3609,6 +4467,11 @@ void MoQSession::onDatagram(std::unique_ptr<folly::IOBuf> datagram) {
   XCHECK(alias);
   auto state = getSubscribeTrackReceiveState(*alias).get();
   if (state) {
+    MOQ_TRACK_STATS(
+        trackStatsCallback_,
+        onObjectReceived,
+        state->fullTrackName(),
+        *res->length);
     auto callback = state->getSubscribeCallback();
     if (callback) {
       callback->datagram(std::move(*res), readBuf.move());
@@ -3671,6 +4534,20 @@ uint64_t MoQSession::getMaxRequestIDIfPresent(
   return 0;
 }
 
+/*static*/
+folly::Optional<std::chrono::milliseconds>
+MoQSession::getDeliveryTimeoutIfPresent(
+    const std::vector<TrackRequestParameter>& params,
+    uint64_t version) {
+  auto key = getDeliveryTimeoutParamKey(version);
+  for (const auto& param : params) {
+    if (param.key == key) {
+      return std::chrono::milliseconds(param.asUint64);
+    }
+  }
+  return folly::none;
+}
+
 uint64_t MoQSession::getMaxAuthTokenCacheSizeIfPresent(
     const std::vector<SetupParameter>& params) {
   for (const auto& param : params) {
@@ -3688,14 +4565,14 @@ void MoQSession::aliasifyAuthTokens(
   if (!version) {
     return;
   }
-  auto majorVersion = getDraftMajorVersion(*version);
-  if (majorVersion < 11) {
+  const auto& traits = moqFrameWriter_.draftTraits();
+  if (traits.legacy) {
     XLOG(DBG4)
         << "Not appliying aliasifyAuthTokens since version detected is < 11 ("
-        << majorVersion << ")";
+        << traits.majorVersion << ")";
     return;
   }
-  auto authParamKey = getAuthorizationParamKey(*version);
+  auto authParamKey = traits.authorizationParamKey;
   for (auto it = params.begin(); it != params.end(); ++it) {
     if (it->key == authParamKey) {
       const auto& token = it->asAuthToken;
@@ -3706,9 +4583,11 @@ void MoQSession::aliasifyAuthTokens(
           it->asString = moqFrameWriter_.encodeUseAlias(*lookupRes);
           continue;
         } // else, evict tokens and register this one
-        auto tokenCopy = token;
+        // token goes with the erased parameter
+        auto tokenCopy = std::move(it->asAuthToken);
         it = params.erase(it);
-        while (!tokenCache_.canRegister(token.tokenType, token.tokenValue)) {
+        while (!tokenCache_.canRegister(
+            tokenCopy.tokenType, tokenCopy.tokenValue)) {
           auto aliasToEvict = tokenCache_.evictOne();
           TrackRequestParameter p;
           p.key = authParamKey;
@@ -15,25 +15,81 @@
 #include <folly/coro/Promise.h>
 #include <folly/coro/Task.h>
 #include <folly/coro/UnboundedQueue.h>
+#include <folly/io/async/EventBase.h>
 #include <folly/logging/xlog.h>
 #include <moxygen/MoQConsumers.h>
+#include <moxygen/MoQEgressScheduler.h>
+#include <moxygen/MoQFetchLimiter.h>
 #include <moxygen/Publisher.h>
 #include <moxygen/Subscriber.h>
 #include <moxygen/stats/MoQStats.h>
+#include "moxygen/util/SlotTable.h"
 #include "moxygen/util/TimedBaton.h"
 
 #include <boost/variant.hpp>
 
+#include <functional>
+
 namespace moxygen {
 
 struct BufferingThresholds {
   // A value of 0 means no threshold
   uint64_t perSubscription{0};
-  uint64_t perSession{0}; // Currently unused
+  // Shared by all subscriptions in the session.  When exceeded, subgroups
+  // with the lowest precedence are reset to make room.
+  uint64_t perSession{0};
+  // When a subscription exceeds perSubscription, reset its open subgroups
+  // and keep the subscription, instead of ending it with TOO_FAR_BEHIND.
+  // The publisher can resume at the next group.
+  bool resetSubgroupsWhenTooFarBehind{false};
+};
+
+// For tracks publishing many small objects.  Objects published on a
+// subgroup stream are held and written together at the end of the event loop
+// iteration, saving a transport write per object.
+struct WriteCoalescing {
+  // Longest an object is held, 0 disables coalescing
+  std::chrono::microseconds maxDelay{0};
+  // Held bytes that are written right away
+  uint64_t maxBytes{16 * 1024};
+};
+
+// Orders the subgroup stream and datagram writes of every track in the
+// session by subscriber priority, publisher priority, group order and
+// subgroup, instead of leaving it to the transport.  Writes are held until
+// the end of the event loop iteration, then written in that order while the
+// session has fewer than windowBytes undelivered, so under congestion the
+// highest precedence tracks get the bandwidth.  Tracks tied on both
+// priorities share it in proportion to their weights.  FETCH streams are not
+// scheduled.
+struct EgressScheduling {
+  bool enabled{false};
+  // Undelivered bytes past which writes wait, 0 means no limit
+  uint64_t windowBytes{0};
+  // Bytes a subgroup may hold waiting for the window, past which its track
+  // is too far behind.  0 means no limit.
+  uint64_t maxHeldBytes{1024 * 1024};
+  // Weight of each track, 1 if unset
+  std::function<uint32_t(const FullTrackName&)> trackWeight;
+};
+
+// Keeps catch-up FETCHes from competing with live subscriptions.  A FETCH
+// waits for a slot in the session's limiter and in the shared one before its
+// handler runs, and its writes are paced to the tighter of their rates.
+struct FetchLimits {
+  // FETCH streams get a lower urgency than every subgroup stream, so the
+  // transport only sends them when live data is not waiting
+  bool belowLive{false};
+  MoQFetchLimiter::Config session{};
+  // Shared by several sessions, eg: every downstream session of a relay
+  std::shared_ptr<MoQFetchLimiter> shared;
 };
 
 struct MoQSettings {
   BufferingThresholds bufferingThresholds{};
+  WriteCoalescing writeCoalescing{};
+  EgressScheduling egressScheduling{};
+  FetchLimits fetchLimits{};
 };
 
 class MoQSession : public MoQControlCodec::ControlCallback,
@@ -91,6 +147,20 @@ class MoQSession : public MoQControlCodec::ControlCallback,
 
   void setMoqSettings(MoQSettings settings) {
     moqSettings_ = settings;
+    fetchLimiters_.clear();
+    if (moqSettings_.fetchLimits.session.enabled()) {
+      fetchLimiters_.push_back(std::make_shared<MoQFetchLimiter>(
+          moqSettings_.fetchLimits.session));
+    }
+    if (moqSettings_.fetchLimits.shared) {
+      fetchLimiters_.push_back(moqSettings_.fetchLimits.shared);
+    }
+  }
+
+  // Transport urgency of FETCH streams, below the subgroup streams' 1 with
+  // fetchLimits.belowLive
+  uint8_t fetchStreamUrgency() const {
+    return moqSettings_.fetchLimits.belowLive ? 2 : 1;
   }
 
   void setPublishHandler(std::shared_ptr<Publisher> publishHandler) {
@@ -123,6 +193,15 @@ class MoQSession : public MoQControlCodec::ControlCallback,
 
   folly::coro::Task<ServerSetup> setup(ClientSetup setup);
 
+  // Sends CLIENT_SETUP and carries on as if the server had answered with
+  // expected, usually the SERVER_SETUP of the last session to it, so
+  // requests can follow in the same flight, e.g. in 0-RTT data.  The future
+  // completes with the real SERVER_SETUP.  If that picks another version the
+  // session is closed and the future fails.
+  folly::coro::Future<ServerSetup> setupOptimistic(
+      ClientSetup setup,
+      ServerSetup expected);
+
   void setMaxConcurrentRequests(uint64_t maxConcurrent) {
     if (maxConcurrent > maxConcurrentRequests_) {
       auto delta = maxConcurrent - maxConcurrentRequests_;
@@ -135,6 +214,18 @@ class MoQSession : public MoQControlCodec::ControlCallback,
     return maxRequestID_;
   }
 
+  // Requests that can be issued before reaching the peer's MAX_REQUEST_ID
+  uint64_t availableRequests() const {
+    if (!getNegotiatedVersion() || nextRequestID_ >= peerMaxRequestID_) {
+      return 0;
+    }
+    auto multiplier = getRequestIDMultiplier();
+    return (peerMaxRequestID_ - nextRequestID_ + multiplier - 1) / multiplier;
+  }
+
+  // Sends REQUESTS_BLOCKED, asking the peer for more request IDs
+  void requestsBlocked();
+
   static GroupOrder resolveGroupOrder(
       GroupOrder pubOrder,
       GroupOrder subOrder) {
@@ -173,6 +264,13 @@ class MoQSession : public MoQControlCodec::ControlCallback,
       std::shared_ptr<FetchConsumer> fetchCallback,
       FetchType fetchType);
 
+  // Issues every SUBSCRIBE before waiting on any response, so the requests
+  // share control stream writes and all complete within one round trip.
+  // Results are in the order of subs.
+  folly::coro::Task<std::vector<SubscribeResult>> subscribeBatch(
+      std::vector<
+          std::pair<SubscribeRequest, std::shared_ptr<TrackConsumer>>> subs);
+
   void setPublisherStatsCallback(
       std::shared_ptr<MoQPublisherStatsCallback> publisherStatsCallback) {
     publisherStatsCallback_ = publisherStatsCallback;
@@ -183,6 +281,86 @@ class MoQSession : public MoQControlCodec::ControlCallback,
     subscriberStatsCallback_ = subscriberStatsCallback;
   }
 
+  // Must be set before the session publishes or subscribes
+  void setTrackStatsCallback(
+      std::shared_ptr<MoQTrackStatsCallback> trackStatsCallback) {
+    trackStatsCallback_ = std::move(trackStatsCallback);
+  }
+
+  const std::shared_ptr<MoQTrackStatsCallback>& getTrackStatsCallback() const {
+    return trackStatsCallback_;
+  }
+
+  // The WebTransport interface doesn't expose congestion state, so whoever
+  // made the transport can supply it, eg: quicTransportMetricsProvider
+  using TransportMetricsProvider =
+      std::function<folly::Optional<MoQTransportMetrics>()>;
+  void setTransportMetricsProvider(TransportMetricsProvider provider) {
+    transportMetricsProvider_ = std::move(provider);
+  }
+
+  // Stands in for steady_clock::now() in delivery timeouts, eg: in tests
+  using Clock = std::function<std::chrono::steady_clock::time_point()>;
+  void setClock(Clock clock) {
+    clock_ = std::move(clock);
+  }
+  std::chrono::steady_clock::time_point now() const {
+    return clock_ ? clock_() : std::chrono::steady_clock::now();
+  }
+
+  // A snapshot of the transport, none without a provider
+  folly::Optional<MoQTransportMetrics> getTransportMetrics() const {
+    return transportMetricsProvider_ ? transportMetricsProvider_()
+                                     : folly::none;
+  }
+
+  // Largest datagram the transport sends, 0 if unknown.  Read from the
+  // transport metrics once, then refreshed each time they are sampled.
+  uint64_t getMaxDatagramSize() {
+    if (!maxDatagramSize_) {
+      auto metrics = getTransportMetrics();
+      maxDatagramSize_ = metrics ? metrics->maxDatagramSize : 0;
+    }
+    return *maxDatagramSize_;
+  }
+
+  // Bytes queued in the session's subscriptions, waiting for the transport
+  uint64_t bytesBuffered() const {
+    return *bytesBuffered_;
+  }
+
+  // Bytes queued in one of the session's subscriptions
+  uint64_t bytesBuffered(RequestID requestID) const {
+    auto it = pubTracks_.find(requestID);
+    return it == pubTracks_.end() ? 0 : it->second->bytesBuffered();
+  }
+
+  // What the session holds in its own buffers.  Also sampled into the
+  // publisher stats callback every setTransportMetricsInterval.
+  MoQMemoryUsage memoryUsage() const {
+    MoQMemoryUsage usage;
+    usage.controlWriteBytes = controlWriteBuf_.chainLength();
+    usage.controlIngressBytes = controlCodec_.bufferedBytes();
+    usage.dataIngressBytes = *dataIngressBytes_;
+    usage.publishBufferedBytes = *bytesBuffered_;
+    return usage;
+  }
+
+  class TransportMetricsCallback {
+   public:
+    virtual ~TransportMetricsCallback() = default;
+    virtual void onTransportMetrics(const MoQTransportMetrics& metrics) = 0;
+  };
+
+  // Samples the transport every interval, 0 to stop.  Each sample goes to
+  // the publisher stats callback, and to the metrics callbacks when its send
+  // rate, RTT or loss moved noticeably from the last one they were sent.
+  void setTransportMetricsInterval(std::chrono::milliseconds interval);
+  void addTransportMetricsCallback(
+      std::shared_ptr<TransportMetricsCallback> callback);
+  void removeTransportMetricsCallback(
+      const TransportMetricsCallback* callback);
+
   class PublisherImpl : public std::enable_shared_from_this<PublisherImpl> {
    public:
     PublisherImpl(
@@ -199,7 +377,12 @@ class MoQSession : public MoQControlCodec::ControlCallback,
           subPriority_(subPriority),
           groupOrder_(groupOrder),
           version_(version),
-          bytesBufferedThreshold_(bytesBufferedThreshold) {
+          bytesBufferedThreshold_(bytesBufferedThreshold),
+          sessionBytesBuffered_(
+              session ? session->bytesBuffered_
+                      : std::make_shared<uint64_t>(0)),
+          trackStatsCallback_(
+              session ? session->trackStatsCallback_ : nullptr) {
       moqFrameWriter_.initializeVersion(version);
     }
 
@@ -217,6 +400,9 @@ class MoQSession : public MoQControlCodec::ControlCallback,
     void setSubPriority(uint8_t subPriority) {
       subPriority_ = subPriority;
     }
+    GroupOrder groupOrder() const {
+      return groupOrder_;
+    }
     void setGroupOrder(GroupOrder groupOrder) {
       groupOrder_ = groupOrder;
     }
@@ -238,6 +424,23 @@ class MoQSession : public MoQControlCodec::ControlCallback,
       return (bytesBuffered_ + numBytes <= bytesBufferedThreshold_);
     }
 
+    bool canBufferBytesInSession(uint64_t numBytes) const {
+      if (!session_) {
+        return true;
+      }
+      auto threshold = session_->moqSettings_.bufferingThresholds.perSession;
+      return threshold == 0 ||
+          *sessionBytesBuffered_ + numBytes <= threshold;
+    }
+
+    // Drops subgroups in the session with a lower precedence than
+    // streamPriority to make room for numBytes
+    void shedSessionBytes(uint64_t numBytes, uint64_t streamPriority) {
+      if (session_) {
+        session_->shedBufferedBytes(numBytes, streamPriority);
+      }
+    }
+
     folly::Expected<folly::Unit, MoQPublishError> subscribeDone(
         SubscribeDone subDone);
 
@@ -250,19 +453,107 @@ class MoQSession : public MoQControlCodec::ControlCallback,
       return nullptr;
     }
 
+    folly::EventBase* getEventBase() const {
+      if (session_) {
+        return session_->evb_;
+      }
+      return nullptr;
+    }
+
+    // nullptr when coalescing is off
+    const WriteCoalescing* writeCoalescing() const {
+      if (session_ &&
+          session_->moqSettings_.writeCoalescing.maxDelay.count() > 0) {
+        return &session_->moqSettings_.writeCoalescing;
+      }
+      return nullptr;
+    }
+
+    // nullptr when scheduling is off
+    const EgressScheduling* egressScheduling() const {
+      if (session_ && session_->moqSettings_.egressScheduling.enabled) {
+        return &session_->moqSettings_.egressScheduling;
+      }
+      return nullptr;
+    }
+
+    uint8_t fetchStreamUrgency() const {
+      return session_ ? session_->fetchStreamUrgency() : 1;
+    }
+
+    // Accounts for bytes written to a FETCH stream, returns how long the
+    // stream should wait before writing more
+    std::chrono::microseconds onFetchBytesWritten(uint64_t bytes) {
+      std::chrono::microseconds wait{0};
+      if (session_) {
+        for (auto& limiter : session_->fetchLimiters_) {
+          wait = std::max(wait, limiter->onBytesWritten(bytes));
+        }
+      }
+      return wait;
+    }
+
+    // Queues a write of this track with the session's egress scheduler
+    void scheduleEgress(uint64_t order, MoQEgressScheduler::Send send) {
+      session_->scheduleEgress(
+          order, requestID_.value, egressWeight(), std::move(send));
+    }
+
     uint64_t getVersion() const {
       return version_;
     }
 
+    const std::shared_ptr<MoQTrackStatsCallback>& trackStatsCallback() const {
+      return trackStatsCallback_;
+    }
+
+    uint64_t bytesBuffered() const {
+      return bytesBuffered_;
+    }
+
     void onBytesBuffered(uint64_t amount) {
       bytesBuffered_ += amount;
+      *sessionBytesBuffered_ += amount;
+      MOQ_TRACK_STATS(
+          trackStatsCallback_,
+          recordBufferedBytes,
+          fullTrackName_,
+          bytesBuffered_);
     }
 
     void onBytesUnbuffered(uint64_t amount) {
       bytesBuffered_ -= amount;
+      *sessionBytesBuffered_ -= amount;
+      if (session_) {
+        session_->onEgressWindowOpened();
+      }
+    }
+
+    // Subgroups holding objects older than this are dropped, 0 means never
+    std::chrono::milliseconds deliveryTimeout() const {
+      return deliveryTimeout_;
+    }
+    void setDeliveryTimeout(std::chrono::milliseconds deliveryTimeout) {
+      deliveryTimeout_ = deliveryTimeout;
     }
 
+    std::chrono::steady_clock::time_point now() const {
+      return session_ ? session_->now() : std::chrono::steady_clock::now();
+    }
+
+    // A write with a delivery timeout is buffered, and is late at deadline
+    virtual void onDeliveryDeadline(
+        std::chrono::steady_clock::time_point /*deadline*/) {}
+
    protected:
+    uint32_t egressWeight() {
+      if (!egressWeight_) {
+        auto& trackWeight = session_->moqSettings_.egressScheduling.trackWeight;
+        egressWeight_ = trackWeight ? trackWeight(fullTrackName_) : 1;
+      }
+      return *egressWeight_;
+    }
+
     MoQSession* session_{nullptr};
     FullTrackName fullTrackName_;
     RequestID requestID_;
@@ -272,6 +563,11 @@ class MoQSession : public MoQControlCodec::ControlCallback,
     uint64_t version_;
     uint64_t bytesBuffered_{0};
     uint64_t bytesBufferedThreshold_{0};
+    // Outlives the session, streams can be unbuffered after it closes
+    std::shared_ptr<uint64_t> sessionBytesBuffered_;
+    std::shared_ptr<MoQTrackStatsCallback> trackStatsCallback_;
+    std::chrono::milliseconds deliveryTimeout_{0};
+    folly::Optional<uint32_t> egressWeight_;
   };
 
   void onNewUniStream(proxygen::WebTransport::StreamReadHandle* rh) override;
@@ -329,6 +625,12 @@ class MoQSession : public MoQControlCodec::ControlCallback,
   void subscribeUpdate(const SubscribeUpdate& subUpdate);
   void subscribeDone(const SubscribeDone& subDone);
 
+  // Acquires a slot in each fetch limiter from limiterIndex on, then runs
+  // handleFetch
+  void startFetch(
+      Fetch fetch,
+      std::shared_ptr<FetchPublisherImpl> fetchPublisher,
+      size_t limiterIndex);
   folly::coro::Task<void> handleFetch(
       Fetch fetch,
       std::shared_ptr<FetchPublisherImpl> fetchPublisher);
@@ -393,6 +695,10 @@ class MoQSession : public MoQControlCodec::ControlCallback,
   // MUST NOT create any subscriptions
   static uint64_t getMaxRequestIDIfPresent(
       const std::vector<SetupParameter>& params);
+  // DELIVERY_TIMEOUT from a SUBSCRIBE or SUBSCRIBE_UPDATE
+  static folly::Optional<std::chrono::milliseconds> getDeliveryTimeoutIfPresent(
+      const std::vector<TrackRequestParameter>& params,
+      uint64_t version);
   static uint64_t getMaxAuthTokenCacheSizeIfPresent(
       const std::vector<SetupParameter>& params);
 
@@ -404,12 +710,24 @@ class MoQSession : public MoQControlCodec::ControlCallback,
       bool isNewRequest);
 
   void initializeNegotiatedVersion(uint64_t negotiatedVersion);
+  // Client setup steps shared by setup and setupOptimistic
+  bool writeSetup(const ClientSetup& setup);
+  void applyServerSetupParams(const ServerSetup& serverSetup);
+  void completeClientSetup(uint64_t selectedVersion);
   void aliasifyAuthTokens(std::vector<TrackRequestParameter>& params);
-  RequestID getRequestID(RequestID id, const FullTrackName& ftn);
+  // Below draft 11, requests are matched by track name.  The name is only
+  // built for those drafts.
+  RequestID getRequestID(
+      RequestID id,
+      const TrackNamespace& trackNamespace,
+      folly::StringPiece trackName);
   RequestID getNextRequestID(bool legacyAction = false);
-  void maybeAddLegacyRequestIDMapping(const FullTrackName& ftn, RequestID id);
+  void maybeAddLegacyRequestIDMapping(
+      const TrackNamespace& trackNamespace,
+      folly::StringPiece trackName,
+      RequestID id);
   uint8_t getRequestIDMultiplier() const {
-    return (getDraftMajorVersion(*getNegotiatedVersion()) >= 11) ? 2 : 1;
+    return moqFrameWriter_.draftTraits().requestIDMultiplier;
   }
 
   MoQControlCodec::Direction dir_;
@@ -419,17 +737,11 @@ class MoQSession : public MoQControlCodec::ControlCallback,
   moxygen::TimedBaton controlWriteEvent_;
 
   // Track Alias -> Receive State
-  folly::F14FastMap<
-      TrackAlias,
-      std::shared_ptr<SubscribeTrackReceiveState>,
-      TrackAlias::hash>
+  // Looked up for every incoming stream and datagram, so indexed directly
+  SlotTable<TrackAlias, std::shared_ptr<SubscribeTrackReceiveState>>
       subTracks_;
-  folly::F14FastMap<
-      RequestID,
-      std::shared_ptr<FetchTrackReceiveState>,
-      RequestID::hash>
-      fetches_;
-  folly::F14FastMap<RequestID, TrackAlias, RequestID::hash> subIdToTrackAlias_;
+  SlotTable<RequestID, std::shared_ptr<FetchTrackReceiveState>> fetches_;
+  SlotTable<RequestID, TrackAlias> subIdToTrackAlias_;
 
   struct PendingAnnounce {
     TrackNamespace trackNamespace;
@@ -459,8 +771,7 @@ class MoQSession : public MoQControlCodec::ControlCallback,
       fullTrackNameToRequestID_;
 
   // Subscriber ID -> metadata about a publish track
-  folly::F14FastMap<RequestID, std::shared_ptr<PublisherImpl>, RequestID::hash>
-      pubTracks_;
+  SlotTable<RequestID, std::shared_ptr<PublisherImpl>> pubTracks_;
 
   class SubscriberAnnounceCallback;
   class PublisherAnnounceHandle;
@@ -489,6 +800,8 @@ class MoQSession : public MoQControlCodec::ControlCallback,
   uint64_t peerMaxRequestID_{0};
 
   folly::coro::Promise<ServerSetup> setupPromise_;
+  // Version assumed by setupOptimistic until SERVER_SETUP arrives
+  folly::Optional<uint64_t> optimisticVersion_;
   bool setupComplete_{false};
   bool draining_{false};
   bool receivedGoaway_{false};
@@ -504,11 +817,94 @@ class MoQSession : public MoQControlCodec::ControlCallback,
 
   ServerSetupCallback* serverSetupCallback_{nullptr};
   MoQSettings moqSettings_;
+  // The session's own fetch limiter, then the shared one, if enabled
+  std::vector<std::shared_ptr<MoQFetchLimiter>> fetchLimiters_;
+  // Bytes written to publish streams and not yet delivered or cancelled
+  std::shared_ptr<uint64_t> bytesBuffered_{std::make_shared<uint64_t>(0)};
+  // Unparsed bytes across the data stream codecs, which can outlive the
+  // session
+  std::shared_ptr<uint64_t> dataIngressBytes_{std::make_shared<uint64_t>(0)};
+  void shedBufferedBytes(uint64_t numBytes, uint64_t streamPriority);
+
+  // Datagrams published in one EventBase loop are handed to the transport
+  // together at the end of it, highest priority first, so they can share
+  // packets and GSO batches.
+  class DatagramFlusher : public folly::EventBase::LoopCallback {
+   public:
+    explicit DatagramFlusher(MoQSession& session) : session_(session) {}
+    void runLoopCallback() noexcept override {
+      session_.flushDatagrams();
+    }
+
+   private:
+    MoQSession& session_;
+  };
+  struct PendingDatagram {
+    uint8_t priority;
+    std::unique_ptr<folly::IOBuf> datagram;
+  };
+  void queueDatagram(uint8_t priority, std::unique_ptr<folly::IOBuf> datagram);
+  void flushDatagrams();
+  std::vector<PendingDatagram> pendingDatagrams_;
+  DatagramFlusher datagramFlusher_{*this};
+
+  class TransportMetricsSampler : public folly::HHWheelTimer::Callback {
+   public:
+    explicit TransportMetricsSampler(MoQSession& session)
+        : session_(session) {}
+    void timeoutExpired() noexcept override {
+      session_.sampleTransportMetrics();
+    }
+
+   private:
+    MoQSession& session_;
+  };
+  void sampleTransportMetrics();
+  TransportMetricsProvider transportMetricsProvider_;
+  Clock clock_;
+  std::chrono::milliseconds transportMetricsInterval_{0};
+  TransportMetricsSampler transportMetricsSampler_{*this};
+  std::vector<std::shared_ptr<TransportMetricsCallback>>
+      transportMetricsCallbacks_;
+  // The last sample the metrics callbacks were sent
+  folly::Optional<MoQTransportMetrics> notifiedTransportMetrics_;
+  folly::Optional<uint64_t> maxDatagramSize_;
+
+  // Runs the egress scheduler at the end of the loop iteration
+  class EgressFlusher : public folly::EventBase::LoopCallback {
+   public:
+    explicit EgressFlusher(MoQSession& session) : session_(session) {}
+    void runLoopCallback() noexcept override {
+      session_.flushEgress(/*ignoreWindow=*/false);
+    }
+
+   private:
+    MoQSession& session_;
+  };
+  void scheduleEgress(
+      uint64_t order,
+      uint64_t flow,
+      uint32_t weight,
+      MoQEgressScheduler::Send send);
+  void scheduleDatagram(
+      uint64_t order,
+      uint64_t flow,
+      uint32_t weight,
+      std::unique_ptr<folly::IOBuf> datagram);
+  void flushEgress(bool ignoreWindow);
+  void onEgressWindowOpened();
+  MoQEgressScheduler egressScheduler_;
+  EgressFlusher egressFlusher_{*this};
+  // Datagram bytes written by the current flushEgress, they take up window
+  // until it returns
+  uint64_t egressDatagramBytes_{0};
+
   std::shared_ptr<Publisher> publishHandler_;
   std::shared_ptr<Subscriber> subscribeHandler_;
 
   std::shared_ptr<MoQPublisherStatsCallback> publisherStatsCallback_{nullptr};
   std::shared_ptr<MoQSubscriberStatsCallback> subscriberStatsCallback_{nullptr};
+  std::shared_ptr<MoQTrackStatsCallback> trackStatsCallback_{nullptr};
 
   MoQFrameWriter moqFrameWriter_;
   folly::Optional<uint64_t> negotiatedVersion_{0};
@@ -6,6 +6,7 @@
 
 #include <moxygen/MoQTokenCache.h>
 
+#include <folly/hash/Hash.h>
 #include <folly/logging/xlog.h>
 
 namespace moxygen {
@@ -42,23 +43,51 @@ MoQTokenCache::registerToken(
   totalSize_ += tokenSize;
 
   // Insert the new token into the cache with the provided alias
-  lru_.push_back(alias);
-  aliasToToken_.emplace(
-      alias, CachedToken{tokenType, std::move(tokenValue), --lru_.end()});
+  auto hash = hashToken(tokenType, tokenValue);
+  auto& cachedToken =
+      aliasToToken_
+          .try_emplace(alias, alias, tokenType, std::move(tokenValue), hash)
+          .first->second;
+  lru_.push_back(cachedToken);
+  tokenToAlias_.emplace(
+      TokenKey{tokenType, cachedToken.tokenValue, hash}, &cachedToken);
   return folly::unit;
 }
 
+size_t MoQTokenCache::hashToken(
+    uint64_t tokenType,
+    std::string_view tokenValue) {
+  return folly::hash::hash_combine(tokenType, tokenValue);
+}
+
 folly::Expected<MoQTokenCache::Alias, MoQTokenCache::ErrorCode>
 MoQTokenCache::getAliasForToken(
     uint64_t tokenType,
-    const TokenValue& tokenValue) {
-  for (const auto& [alias, cachedToken] : aliasToToken_) {
-    if (cachedToken.tokenType == tokenType &&
-        cachedToken.tokenValue == tokenValue) {
-      return alias;
-    }
+    std::string_view tokenValue) {
+  auto it = tokenToAlias_.find(
+      TokenKey{tokenType, tokenValue, hashToken(tokenType, tokenValue)});
+  if (it == tokenToAlias_.end()) {
+    return folly::makeUnexpected(ErrorCode::UNKNOWN_TOKEN);
   }
-  return folly::makeUnexpected(ErrorCode::UNKNOWN_TOKEN);
+  auto& cachedToken = *it->second;
+  cachedToken.lruHook.unlink();
+  lru_.push_back(cachedToken);
+  return cachedToken.alias;
+}
+
+void MoQTokenCache::eraseToken(CachedToken& cachedToken) {
+  auto size = cachedSize(cachedToken.tokenValue);
+  XCHECK_GE(totalSize_, size);
+  totalSize_ -= size;
+  auto indexIt = tokenToAlias_.find(TokenKey{
+      cachedToken.tokenType, cachedToken.tokenValue, cachedToken.hash});
+  if (indexIt != tokenToAlias_.end() && indexIt->second == &cachedToken) {
+    tokenToAlias_.erase(indexIt);
+  }
+  cachedToken.lruHook.unlink();
+  auto alias = cachedToken.alias;
+  // Destroys cachedToken
+  aliasToToken_.erase(alias);
 }
 
 folly::Expected<folly::Unit, MoQTokenCache::ErrorCode>
@@ -67,11 +96,7 @@ MoQTokenCache::deleteToken(Alias alias) {
   if (it == aliasToToken_.end()) {
     return folly::makeUnexpected(ErrorCode::UNKNOWN_ALIAS);
   }
-  auto size = cachedSize(it->second.tokenValue);
-  XCHECK_GE(totalSize_, size);
-  totalSize_ -= size;
-  lru_.erase(it->second.aliasIt);
-  aliasToToken_.erase(it);
+  eraseToken(it->second);
   return folly::Unit();
 }
 
@@ -83,19 +108,15 @@ MoQTokenCache::getTokenForAlias(Alias alias) {
   }
 
   auto& cachedToken = it->second;
-  lru_.splice(lru_.end(), lru_, cachedToken.aliasIt);
+  cachedToken.lruHook.unlink();
+  lru_.push_back(cachedToken);
   return TokenTypeAndValue{cachedToken.tokenType, cachedToken.tokenValue};
 }
 
 MoQTokenCache::Alias MoQTokenCache::evictOne() {
   XCHECK(!lru_.empty());
-  auto alias = lru_.front();
-  lru_.pop_front();
-  auto it = aliasToToken_.find(alias);
-  XCHECK(it != aliasToToken_.end());
-  XCHECK_GE(totalSize_, cachedSize(it->second.tokenValue));
-  totalSize_ -= cachedSize(it->second.tokenValue);
-  aliasToToken_.erase(it);
+  auto alias = lru_.front().alias;
+  eraseToken(lru_.front());
   return alias;
 }
 
@@ -7,11 +7,16 @@
 #pragma once
 
 #include <folly/Expected.h>
+#include <folly/IntrusiveList.h>
 #include <folly/container/F14Map.h>
 #include <cstdint>
-#include <list>
+#include <string>
+#include <string_view>
 
 namespace moxygen {
+// Tokens are indexed by alias and by (type, value), so both directions are
+// a single hash lookup.  Lookups by value view the caller's string and
+// don't allocate.
 class MoQTokenCache {
  public:
   explicit MoQTokenCache(uint64_t maxSize = 0) : maxSize_(maxSize) {}
@@ -42,9 +47,10 @@ class MoQTokenCache {
   folly::Expected<folly::Unit, ErrorCode>
   registerToken(Alias alias, uint64_t tokenType, TokenValue tokenValue);
 
+  // Marks the token most recently used
   folly::Expected<Alias, ErrorCode> getAliasForToken(
       uint64_t tokenType,
-      const TokenValue& tokenValue);
+      std::string_view tokenValue);
 
   folly::Expected<folly::Unit, ErrorCode> deleteToken(Alias alias);
   struct TokenTypeAndValue {
@@ -72,13 +78,52 @@ class MoQTokenCache {
     return token.size() + 8;
   }
 
+  static size_t hashToken(uint64_t tokenType, std::string_view tokenValue);
+
   struct CachedToken {
+    CachedToken(
+        Alias inAlias,
+        uint64_t inTokenType,
+        TokenValue inTokenValue,
+        size_t inHash)
+        : alias(inAlias),
+          tokenType(inTokenType),
+          tokenValue(std::move(inTokenValue)),
+          hash(inHash) {}
+
+    Alias alias;
     uint64_t tokenType;
     TokenValue tokenValue;
-    std::list<Alias>::iterator aliasIt;
+    // hashToken of the type and value
+    size_t hash;
+    folly::IntrusiveListHook lruHook;
   };
-  folly::F14FastMap<Alias, CachedToken> aliasToToken_;
-  std::list<Alias> lru_; // technically only used by encoders, but it's O(1)
+
+  // Views a token, for cached tokens its value lives in the CachedToken
+  struct TokenKey {
+    uint64_t tokenType;
+    std::string_view tokenValue;
+    size_t hash;
+
+    bool operator==(const TokenKey& other) const {
+      return tokenType == other.tokenType && tokenValue == other.tokenValue;
+    }
+  };
+  struct TokenKeyHash {
+    size_t operator()(const TokenKey& key) const {
+      return key.hash;
+    }
+  };
+
+  void eraseToken(CachedToken& cachedToken);
+
+  // Node map, the index and the LRU point into its entries
+  folly::F14NodeMap<Alias, CachedToken> aliasToToken_;
+  // A decoder can be given one token under several aliases, the first is
+  // indexed
+  folly::F14FastMap<TokenKey, CachedToken*, TokenKeyHash> tokenToAlias_;
+  // technically only used by encoders, but it's O(1)
+  folly::IntrusiveList<CachedToken, &CachedToken::lruHook> lru_;
   uint64_t maxSize_;
   uint64_t nextAlias_ = 0;
   uint64_t totalSize_ = 0;
@@ -2,6 +2,8 @@
 
 #include <moxygen/MoQConsumers.h>
 
+#include <folly/io/Cursor.h>
+
 namespace moxygen {
 
 class ObjectReceiverCallback {
@@ -15,6 +17,11 @@ class ObjectReceiverCallback {
   virtual void onEndOfStream() = 0;
   virtual void onError(ResetStreamErrorCode) = 0;
   virtual void onSubscribeDone(SubscribeDone done) = 0;
+  // After onObject returns BLOCKED, the session stops reading the stream
+  // until this completes
+  virtual folly::SemiFuture<folly::Unit> awaitReadyToConsume() {
+    return folly::makeSemiFuture();
+  }
 };
 
 class ObjectSubgroupReceiver : public SubgroupConsumer {
@@ -22,6 +29,22 @@ class ObjectSubgroupReceiver : public SubgroupConsumer {
   StreamType streamType_;
   ObjectHeader header_;
   folly::IOBufQueue payload_{folly::IOBufQueue::cacheChainLength()};
+  // With contiguous payloads, a multi-part object is copied into one buffer
+  // of the length from its header, allocated by beginObject.  Longer objects
+  // are chained, the peer's length isn't trusted with an allocation.
+  static constexpr uint64_t kMaxContiguousLength = 4 * 1024 * 1024;
+  bool contiguous_{false};
+  std::unique_ptr<folly::IOBuf> buffer_;
+
+  folly::Expected<ObjectPublishStatus, MoQPublishError> deliverPayload(
+      Payload payload) {
+    auto fcState = callback_->onObject(header_, std::move(payload));
+    if (fcState == ObjectReceiverCallback::FlowControlState::BLOCKED) {
+      // Is it bad that we can't return DONE here?
+      return folly::makeUnexpected(MoQPublishError(MoQPublishError::BLOCKED));
+    }
+    return ObjectPublishStatus::DONE;
+  }
 
  public:
   explicit ObjectSubgroupReceiver(
@@ -33,6 +56,10 @@ class ObjectSubgroupReceiver : public SubgroupConsumer {
         streamType_(StreamType::SUBGROUP_HEADER),
         header_(TrackAlias(0), groupID, subgroupID, 0, priority) {}
 
+  void setContiguousPayloads(bool contiguous) {
+    contiguous_ = contiguous;
+  }
+
   void setFetchGroupAndSubgroup(uint64_t groupID, uint64_t subgroupID) {
     streamType_ = StreamType::FETCH_HEADER;
     header_.group = groupID;
@@ -46,11 +73,7 @@ class ObjectSubgroupReceiver : public SubgroupConsumer {
     header_.extensions = std::move(ext);
     auto fcState = callback_->onObject(header_, std::move(payload));
     if (fcState == ObjectReceiverCallback::FlowControlState::BLOCKED) {
-      if (streamType_ == StreamType::FETCH_HEADER) {
-        return folly::makeUnexpected(MoQPublishError(MoQPublishError::BLOCKED));
-      } else {
-        XLOG(WARN) << "ObjectReceiverCallback returned BLOCKED for Subscribe";
-      }
+      return folly::makeUnexpected(MoQPublishError(MoQPublishError::BLOCKED));
     }
     return folly::unit;
   }
@@ -75,6 +98,12 @@ class ObjectSubgroupReceiver : public SubgroupConsumer {
     header_.length = length;
     header_.status = ObjectStatus::NORMAL;
     header_.extensions = std::move(ext);
+    auto initialLength =
+        initialPayload ? initialPayload->computeChainDataLength() : 0;
+    if (contiguous_ && initialLength < length &&
+        length <= kMaxContiguousLength) {
+      buffer_ = folly::IOBuf::create(length);
+    }
     objectPayload(std::move(initialPayload), false);
     return folly::unit;
   }
@@ -83,14 +112,25 @@ class ObjectSubgroupReceiver : public SubgroupConsumer {
       Payload payload,
       bool /*finSubgroup*/) override {
     // TODO: add common component for state verification
+    if (buffer_) {
+      if (payload) {
+        auto length = payload->computeChainDataLength();
+        if (length > buffer_->tailroom()) {
+          buffer_.reset();
+          return folly::makeUnexpected(MoQPublishError(
+              MoQPublishError::API_ERROR, "Payload exceeded length"));
+        }
+        folly::io::Cursor(payload.get()).pull(buffer_->writableTail(), length);
+        buffer_->append(length);
+      }
+      if (buffer_->length() == header_.length) {
+        return deliverPayload(std::move(buffer_));
+      }
+      return ObjectPublishStatus::IN_PROGRESS;
+    }
     payload_.append(std::move(payload));
     if (payload_.chainLength() == header_.length) {
-      auto fcState = callback_->onObject(header_, payload_.move());
-      if (fcState == ObjectReceiverCallback::FlowControlState::BLOCKED) {
-        // Is it bad that we can't return DONE here?
-        return folly::makeUnexpected(MoQPublishError(MoQPublishError::BLOCKED));
-      }
-      return ObjectPublishStatus::DONE;
+      return deliverPayload(payload_.move());
     }
     return ObjectPublishStatus::IN_PROGRESS;
   }
@@ -121,13 +161,20 @@ class ObjectSubgroupReceiver : public SubgroupConsumer {
   }
 
   void reset(ResetStreamErrorCode error) override {
+    buffer_.reset();
     callback_->onError(error);
   }
+
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitReadyToConsume() override {
+    return callback_->awaitReadyToConsume();
+  }
 };
 
 class ObjectReceiver : public TrackConsumer, public FetchConsumer {
   std::shared_ptr<ObjectReceiverCallback> callback_{nullptr};
   folly::Optional<ObjectSubgroupReceiver> fetchPublisher_;
+  bool contiguous_{false};
 
  public:
   enum Type { SUBSCRIBE, FETCH };
@@ -140,11 +187,22 @@ class ObjectReceiver : public TrackConsumer, public FetchConsumer {
     }
   }
 
+  // Objects that arrive in parts are reassembled into one contiguous buffer
+  // rather than a chain, for callbacks that would coalesce it anyway
+  void setContiguousPayloads(bool contiguous) {
+    contiguous_ = contiguous;
+    if (fetchPublisher_) {
+      fetchPublisher_->setContiguousPayloads(contiguous);
+    }
+  }
+
   folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
   beginSubgroup(uint64_t groupID, uint64_t subgroupID, Priority priority)
       override {
-    return std::make_shared<ObjectSubgroupReceiver>(
+    auto receiver = std::make_shared<ObjectSubgroupReceiver>(
         callback_, groupID, subgroupID, priority);
+    receiver->setContiguousPayloads(contiguous_);
+    return receiver;
   }
 
   folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
@@ -270,10 +328,7 @@ class ObjectReceiver : public TrackConsumer, public FetchConsumer {
 
   folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
   awaitReadyToConsume() override {
-    // TODO: Consider extending ObjectReceiverCallback with a mechanism
-    // to trigger backpressure here.  For now, FETCH consumers that want
-    // actual backpressure need to implement FetchConsumer directly.
-    return folly::makeSemiFuture();
+    return callback_->awaitReadyToConsume();
   }
 };
 
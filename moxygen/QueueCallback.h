@@ -1,8 +1,14 @@
 #pragma once
 
+#include <folly/ProducerConsumerQueue.h>
+#include <folly/Synchronized.h>
 #include <folly/coro/UnboundedQueue.h>
+#include <folly/futures/Promise.h>
 #include <moxygen/ObjectReceiver.h>
 
+#include <atomic>
+#include <deque>
+
 namespace moxygen {
 
 class QueueCallback : public ObjectReceiverCallback {
@@ -31,4 +37,147 @@ class QueueCallback : public ObjectReceiverCallback {
     queue.enqueue(folly::makeUnexpected(folly::unit));
   }
 };
+
+// QueueCallback for a consumer on another thread, through a fixed size
+// single producer single consumer ring.  Once the ring holds highWatermark
+// items onObject returns BLOCKED, and the session stops reading until the
+// consumer drains it to lowWatermark.  Objects already read when blocked are
+// still queued, objects that find the ring full are dropped and counted.
+// Object status, end of stream and errors are never dropped, they wait in an
+// overflow list, and objects arriving behind them are dropped until the
+// consumer has drained it.
+//
+// Methods of ObjectReceiverCallback are called on the session's thread,
+// tryDequeue on the consumer's.
+class BoundedQueueCallback : public ObjectReceiverCallback {
+ public:
+  using Object = QueueCallback::Object;
+  using Item = folly::Expected<Object, folly::Unit>;
+
+  explicit BoundedQueueCallback(
+      uint32_t capacity,
+      uint32_t highWatermark = 0,
+      uint32_t lowWatermark = 0)
+      // One slot of a ProducerConsumerQueue is always empty
+      : queue_(capacity + 1),
+        highWatermark_(highWatermark ? highWatermark : capacity * 3 / 4),
+        lowWatermark_(lowWatermark ? lowWatermark : capacity / 4) {}
+
+  FlowControlState onObject(const ObjectHeader& objHeader, Payload payload)
+      override {
+    enqueue(Object({objHeader, std::move(payload)}));
+    if (queue_.sizeGuess() < highWatermark_) {
+      return FlowControlState::UNBLOCKED;
+    }
+    blocked_.store(true, std::memory_order_release);
+    {
+      auto readyPromise = readyPromise_.wlock();
+      if (!*readyPromise) {
+        readyPromise->emplace();
+        readyFuture_ = false;
+      }
+    }
+    // The consumer may have drained the ring before seeing blocked_
+    maybeUnblock();
+    return FlowControlState::BLOCKED;
+  }
+  void onObjectStatus(const ObjectHeader& hdr) override {
+    enqueue(Object({hdr, nullptr}));
+  }
+  void onEndOfStream() override {
+    enqueue(folly::makeUnexpected(folly::unit));
+  }
+  void onError(ResetStreamErrorCode) override {
+    enqueue(folly::makeUnexpected(folly::unit));
+  }
+  void onSubscribeDone(SubscribeDone) override {
+    enqueue(folly::makeUnexpected(folly::unit));
+  }
+
+  folly::SemiFuture<folly::Unit> awaitReadyToConsume() override {
+    auto readyPromise = readyPromise_.wlock();
+    if (!*readyPromise || readyFuture_) {
+      return folly::makeSemiFuture();
+    }
+    readyFuture_ = true;
+    return (*readyPromise)->getSemiFuture();
+  }
+
+  // Consumer side, returns false if nothing is queued
+  bool tryDequeue(Item& item) {
+    if (!queue_.read(item) && !readOverflow(item)) {
+      return false;
+    }
+    if (blocked_.load(std::memory_order_acquire)) {
+      maybeUnblock();
+    }
+    return true;
+  }
+
+  size_t sizeGuess() const {
+    return queue_.sizeGuess();
+  }
+
+  uint64_t dropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  void enqueue(Item item) {
+    // The ring is skipped while the overflow is non-empty, to keep order
+    if (!overflowed_.load(std::memory_order_acquire) &&
+        queue_.write(std::move(item))) {
+      return;
+    }
+    if (item.hasValue() && item->header.status == ObjectStatus::NORMAL) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    auto overflow = overflow_.wlock();
+    overflow->push_back(std::move(item));
+    overflowed_.store(true, std::memory_order_release);
+  }
+
+  // Called with the ring empty, so every ring item is older
+  bool readOverflow(Item& item) {
+    if (!overflowed_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    auto overflow = overflow_.wlock();
+    if (overflow->empty()) {
+      return false;
+    }
+    item = std::move(overflow->front());
+    overflow->pop_front();
+    if (overflow->empty()) {
+      overflowed_.store(false, std::memory_order_release);
+    }
+    return true;
+  }
+
+  void maybeUnblock() {
+    if (queue_.sizeGuess() > lowWatermark_) {
+      return;
+    }
+    auto readyPromise = readyPromise_.wlock();
+    if (*readyPromise) {
+      (*readyPromise)->setValue();
+      readyPromise->reset();
+    }
+    blocked_.store(false, std::memory_order_release);
+  }
+
+  folly::ProducerConsumerQueue<Item> queue_;
+  const uint32_t highWatermark_;
+  const uint32_t lowWatermark_;
+  std::atomic<bool> blocked_{false};
+  std::atomic<uint64_t> dropped_{0};
+  // Items the full ring could not take, only locked while it is non-empty
+  std::atomic<bool> overflowed_{false};
+  folly::Synchronized<std::deque<Item>> overflow_;
+  // Only locked crossing the watermarks, readyFuture_ is guarded by it too
+  folly::Synchronized<folly::Optional<folly::Promise<folly::Unit>>>
+      readyPromise_;
+  bool readyFuture_{false};
+};
 } // namespace moxygen
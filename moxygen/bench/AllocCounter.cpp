@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/bench/AllocCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+std::atomic<uint64_t> gNumAllocs{0};
+std::atomic<uint64_t> gAllocBytes{0};
+
+void* countedAlloc(size_t size) {
+  gNumAllocs.fetch_add(1, std::memory_order_relaxed);
+  gAllocBytes.fetch_add(size, std::memory_order_relaxed);
+  if (auto p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+} // namespace
+
+namespace moxygen::bench {
+
+uint64_t numAllocs() {
+  return gNumAllocs.load(std::memory_order_relaxed);
+}
+
+uint64_t allocBytes() {
+  return gAllocBytes.load(std::memory_order_relaxed);
+}
+
+} // namespace moxygen::bench
+
+void* operator new(size_t size) {
+  return countedAlloc(size);
+}
+void* operator new[](size_t size) {
+  return countedAlloc(size);
+}
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+void operator delete[](void* p) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+void operator delete[](void* p, size_t) noexcept {
+  std::free(p);
+}
@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace moxygen::bench {
+
+// Linking AllocCounter.cpp replaces the global operator new of the binary
+// with one that counts every allocation.  Aligned allocations are not
+// counted.
+uint64_t numAllocs();
+uint64_t allocBytes();
+
+} // namespace moxygen::bench
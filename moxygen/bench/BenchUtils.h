@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/io/Cursor.h>
+#include <folly/io/IOBufQueue.h>
+#include <moxygen/MoQConsumers.h>
+#include <moxygen/MoQFramer.h>
+#include <moxygen/moqtest/Types.h>
+
+// Synthetic workloads and no-op consumers shared by the benchmarks
+
+namespace moxygen::bench {
+
+constexpr uint64_t kBenchVersion = kVersionDraft11;
+
+struct BenchObject {
+  uint64_t group;
+  uint64_t subgroup;
+  uint64_t id;
+  uint64_t size;
+};
+
+// Objects of the first numGroups groups of the moq-test track described by
+// params, in publish order.  End of group markers are not included.
+inline std::vector<BenchObject> makeWorkload(
+    const MoQTestParameters& params,
+    uint64_t numGroups) {
+  std::vector<BenchObject> objects;
+  auto group = params.startGroup;
+  for (uint64_t i = 0; i < numGroups && group <= params.lastGroupInTrack;
+       i++, group += params.groupIncrement) {
+    auto lastObject = params.lastObjectInTrack - params.sendEndOfGroupMarkers;
+    for (auto id = params.startObject; id < lastObject;
+         id += params.objectIncrement) {
+      uint64_t subgroup = 0;
+      switch (params.forwardingPreference) {
+        case ForwardingPreference::ONE_SUBGROUP_PER_OBJECT:
+          subgroup = id;
+          break;
+        case ForwardingPreference::TWO_SUBGROUPS_PER_GROUP:
+          subgroup = id % 2;
+          break;
+        case ForwardingPreference::ONE_SUBGROUP_PER_GROUP:
+        case ForwardingPreference::DATAGRAM:
+          break;
+      }
+      objects.push_back(
+          {group,
+           subgroup,
+           id,
+           id == params.startObject ? params.sizeOfObjectZero
+                                    : params.sizeOfObjectGreaterThanZero});
+    }
+  }
+  return objects;
+}
+
+// Like moqtest getExtensions, but with fixed values so runs are comparable
+inline Extensions makeExtensions(const MoQTestParameters& params) {
+  Extensions extensions;
+  if (params.testIntegerExtension >= 0) {
+    extensions.emplace_back(
+        static_cast<uint64_t>(2 * params.testIntegerExtension), 12345);
+  }
+  if (params.testVariableExtension >= 0) {
+    extensions.emplace_back(
+        static_cast<uint64_t>(2 * params.testVariableExtension + 1),
+        folly::IOBuf::copyBuffer(std::string(10, 'e')));
+  }
+  return extensions;
+}
+
+// A payload as large as the largest object of the track.  Benchmarks trim
+// clones of it to each object's size.
+inline std::unique_ptr<folly::IOBuf> makePayload(
+    const MoQTestParameters& params) {
+  return folly::IOBuf::copyBuffer(std::string(
+      std::max(params.sizeOfObjectZero, params.sizeOfObjectGreaterThanZero),
+      't'));
+}
+
+// Serialized subgroup stream (header and objects) for the objects of
+// workload in the given group and subgroup
+inline std::unique_ptr<folly::IOBuf> makeSubgroupStream(
+    const MoQFrameWriter& writer,
+    const std::vector<BenchObject>& workload,
+    const Extensions& extensions,
+    uint64_t group,
+    uint64_t subgroup) {
+  folly::IOBufQueue buf{folly::IOBufQueue::cacheChainLength()};
+  ObjectHeader header(TrackAlias(1), group, subgroup, 0);
+  (void)writer.writeSubgroupHeader(buf, header);
+  auto streamType = getSubgroupStreamType(
+      kBenchVersion, SubgroupIDFormat::Present, /*includeExtensions=*/true);
+  for (const auto& obj : workload) {
+    if (obj.group != group || obj.subgroup != subgroup) {
+      continue;
+    }
+    header.id = obj.id;
+    header.length = obj.size;
+    header.extensions = extensions;
+    (void)writer.writeStreamObject(
+        buf,
+        streamType,
+        header,
+        folly::IOBuf::copyBuffer(std::string(obj.size, 't')));
+  }
+  return buf.move();
+}
+
+// Splits buf into an IOBuf chain of chunkSize byte buffers
+inline std::unique_ptr<folly::IOBuf> fragment(
+    const folly::IOBuf& buf,
+    size_t chunkSize) {
+  folly::IOBufQueue out{folly::IOBufQueue::cacheChainLength()};
+  folly::io::Cursor cursor(&buf);
+  while (!cursor.isAtEnd()) {
+    std::unique_ptr<folly::IOBuf> chunk;
+    cursor.clone(chunk, std::min(chunkSize, cursor.totalLength()));
+    chunk->coalesce();
+    out.append(std::move(chunk));
+  }
+  return out.move();
+}
+
+// Hands out the same DiscardSubgroupConsumer for every subgroup, so only the
+// caller's work is measured
+class NullTrackConsumer : public TrackConsumer {
+ public:
+  folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
+  beginSubgroup(uint64_t, uint64_t, Priority) override {
+    return subgroup_;
+  }
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitStreamCredit() override {
+    return folly::makeSemiFuture();
+  }
+  folly::Expected<folly::Unit, MoQPublishError> objectStream(
+      const ObjectHeader&,
+      Payload) override {
+    return folly::unit;
+  }
+  folly::Expected<folly::Unit, MoQPublishError> datagram(
+      const ObjectHeader&,
+      Payload) override {
+    return folly::unit;
+  }
+  folly::Expected<folly::Unit, MoQPublishError>
+  groupNotExists(uint64_t, uint64_t, Priority, Extensions) override {
+    return folly::unit;
+  }
+  folly::Expected<folly::Unit, MoQPublishError> subscribeDone(
+      SubscribeDone) override {
+    return folly::unit;
+  }
+
+ private:
+  std::shared_ptr<SubgroupConsumer> subgroup_{
+      std::make_shared<DiscardSubgroupConsumer>()};
+};
+
+class NullFetchConsumer : public FetchConsumer {
+ public:
+  folly::Expected<folly::Unit, MoQPublishError> object(
+      uint64_t,
+      uint64_t,
+      uint64_t,
+      Payload,
+      Extensions,
+      bool finFetch) override {
+    objects++;
+    fetchComplete |= finFetch;
+    return folly::unit;
+  }
+  folly::Expected<folly::Unit, MoQPublishError> objectNotExists(
+      uint64_t,
+      uint64_t,
+      uint64_t,
+      Extensions,
+      bool finFetch) override {
+    fetchComplete |= finFetch;
+    return folly::unit;
+  }
+  folly::Expected<folly::Unit, MoQPublishError>
+  groupNotExists(uint64_t, uint64_t, Extensions, bool finFetch) override {
+    fetchComplete |= finFetch;
+    return folly::unit;
+  }
+  folly::Expected<folly::Unit, MoQPublishError> beginObject(
+      uint64_t,
+      uint64_t,
+      uint64_t,
+      uint64_t,
+      Payload,
+      Extensions) override {
+    return folly::unit;
+  }
+  folly::Expected<ObjectPublishStatus, MoQPublishError> objectPayload(
+      Payload,
+      bool) override {
+    return ObjectPublishStatus::DONE;
+  }
+  folly::Expected<folly::Unit, MoQPublishError> endOfGroup(
+      uint64_t,
+      uint64_t,
+      uint64_t,
+      Extensions,
+      bool finFetch) override {
+    fetchComplete |= finFetch;
+    return folly::unit;
+  }
+  folly::Expected<folly::Unit, MoQPublishError>
+  endOfTrackAndGroup(uint64_t, uint64_t, uint64_t, Extensions) override {
+    fetchComplete = true;
+    return folly::unit;
+  }
+  folly::Expected<folly::Unit, MoQPublishError> endOfFetch() override {
+    fetchComplete = true;
+    return folly::unit;
+  }
+  void reset(ResetStreamErrorCode) override {}
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitReadyToConsume() override {
+    return folly::makeSemiFuture();
+  }
+
+  uint64_t objects{0};
+  bool fetchComplete{false};
+};
+
+} // namespace moxygen::bench
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Benchmark.h>
+#include <folly/container/F14Map.h>
+#include <folly/coro/BlockingWait.h>
+#include <folly/executors/ManualExecutor.h>
+#include <folly/init/Init.h>
+#include <moxygen/bench/BenchUtils.h>
+#include <moxygen/relay/MoQCache.h>
+
+using namespace moxygen;
+using namespace moxygen::bench;
+
+namespace {
+
+const FullTrackName kBenchTrackName{TrackNamespace{{"bench"}}, "track"};
+constexpr uint64_t kMaxCachedGroups = 50;
+
+// Writes the given group of the workload through a subscribe writeback,
+// ending it with an END_OF_GROUP so the cache knows the group is complete
+void writeGroup(
+    TrackConsumer& writeback,
+    const std::vector<BenchObject>& workload,
+    const Extensions& extensions,
+    const folly::IOBuf& payload,
+    uint64_t group) {
+  folly::F14FastMap<uint64_t, std::shared_ptr<SubgroupConsumer>> subgroups;
+  for (const auto& obj : workload) {
+    auto& subgroup = subgroups[obj.subgroup];
+    if (!subgroup) {
+      subgroup = writeback.beginSubgroup(group, obj.subgroup, 0).value();
+    }
+    auto objPayload = payload.cloneOne();
+    objPayload->trimEnd(payload.length() - obj.size);
+    (void)subgroup->object(obj.id, std::move(objPayload), extensions);
+  }
+  const auto& last = workload.back();
+  for (auto& subgroup : subgroups) {
+    if (subgroup.first == last.subgroup) {
+      (void)subgroup.second->endOfGroup(last.id + 1);
+    } else {
+      (void)subgroup.second->endOfSubgroup();
+    }
+  }
+}
+
+} // namespace
+
+// Caches one group of the moq-test track per iteration from a live
+// subscription.  Past kMaxCachedGroups, each group also evicts the oldest.
+BENCHMARK(CacheSubscribeWriteback, iters) {
+  MoQCache cache(MoQCache::Config{0, kMaxCachedGroups});
+  std::shared_ptr<TrackConsumer> writeback;
+  std::vector<BenchObject> workload;
+  Extensions extensions;
+  std::unique_ptr<folly::IOBuf> payload;
+  BENCHMARK_SUSPEND {
+    MoQTestParameters params;
+    writeback = cache.getSubscribeWriteback(
+        kBenchTrackName, std::make_shared<NullTrackConsumer>());
+    workload = makeWorkload(params, 1);
+    extensions = makeExtensions(params);
+    payload = makePayload(params);
+  }
+  for (uint64_t group = 0; group < iters; group++) {
+    writeGroup(*writeback, workload, extensions, *payload, group);
+  }
+}
+
+// FETCH of all kMaxCachedGroups cached groups, served entirely from the cache
+BENCHMARK(CacheFetchHit, iters) {
+  MoQCache cache(MoQCache::Config{0, kMaxCachedGroups});
+  std::shared_ptr<TrackConsumer> writeback;
+  folly::ManualExecutor executor;
+  BENCHMARK_SUSPEND {
+    MoQTestParameters params;
+    writeback = cache.getSubscribeWriteback(
+        kBenchTrackName, std::make_shared<NullTrackConsumer>());
+    auto workload = makeWorkload(params, 1);
+    auto extensions = makeExtensions(params);
+    auto payload = makePayload(params);
+    for (uint64_t group = 0; group < kMaxCachedGroups; group++) {
+      writeGroup(*writeback, workload, extensions, *payload, group);
+    }
+  }
+  while (iters--) {
+    auto consumer = std::make_shared<NullFetchConsumer>();
+    auto res = folly::coro::blockingWait(
+        cache.fetch(
+            Fetch(
+                RequestID(iters),
+                kBenchTrackName,
+                AbsoluteLocation{0, 0},
+                AbsoluteLocation{kMaxCachedGroups, 0}),
+            consumer,
+            nullptr),
+        &executor);
+    CHECK(res.hasValue());
+    // The FETCH is served asynchronously after FETCH_OK
+    executor.drain();
+    CHECK(consumer->fetchComplete);
+  }
+}
+
+int main(int argc, char** argv) {
+  folly::Init init(&argc, &argv);
+  folly::runBenchmarks();
+  return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Benchmark.h>
+#include <folly/init/Init.h>
+#include <moxygen/MoQCodec.h>
+#include <moxygen/bench/BenchUtils.h>
+
+using namespace moxygen;
+using namespace moxygen::bench;
+
+namespace {
+
+class NullObjectCallback : public MoQObjectStreamCodec::ObjectCallback {
+ public:
+  void onConnectionError(ErrorCode) override {
+    CHECK(false) << "parse error";
+  }
+  void onFetchHeader(RequestID) override {}
+  void onSubgroup(TrackAlias, uint64_t, uint64_t, uint8_t) override {}
+  void onObjectBegin(
+      uint64_t,
+      uint64_t,
+      uint64_t,
+      Extensions,
+      uint64_t,
+      Payload,
+      bool objectComplete,
+      bool) override {
+    objects += objectComplete;
+  }
+  void onObjectStatus(
+      uint64_t,
+      uint64_t,
+      uint64_t,
+      Priority,
+      ObjectStatus,
+      Extensions) override {}
+  void onObjectPayload(Payload, bool objectComplete) override {
+    objects += objectComplete;
+  }
+  void onEndOfStream() override {}
+
+  uint64_t objects{0};
+};
+
+// Parses one subgroup stream of the moq-test track, delivered in chunkSize
+// byte reads like a transport would
+void onIngressChunks(
+    size_t iters,
+    size_t chunkSize,
+    MoQTestParameters params) {
+  std::vector<std::unique_ptr<folly::IOBuf>> chunks;
+  BENCHMARK_SUSPEND {
+    MoQFrameWriter writer;
+    writer.initializeVersion(kBenchVersion);
+    auto workload = makeWorkload(params, 1);
+    auto stream = makeSubgroupStream(
+        writer, workload, makeExtensions(params), params.startGroup, 0);
+    auto fragmented = fragment(*stream, chunkSize);
+    for (auto& chunk : *fragmented) {
+      chunks.push_back(folly::IOBuf::copyBuffer(chunk));
+    }
+  }
+  NullObjectCallback callback;
+  while (iters--) {
+    MoQObjectStreamCodec codec(&callback);
+    codec.initializeVersion(kBenchVersion);
+    for (size_t i = 0; i < chunks.size(); i++) {
+      codec.onIngress(chunks[i]->cloneOne(), i + 1 == chunks.size());
+    }
+  }
+  folly::doNotOptimizeAway(callback.objects);
+}
+
+void onIngressDefault(size_t iters, size_t chunkSize) {
+  onIngressChunks(iters, chunkSize, MoQTestParameters());
+}
+
+void onIngressLargeObjects(size_t iters, size_t chunkSize) {
+  MoQTestParameters params;
+  params.sizeOfObjectZero = 64 * 1024;
+  params.sizeOfObjectGreaterThanZero = 16 * 1024;
+  onIngressChunks(iters, chunkSize, params);
+}
+
+} // namespace
+
+BENCHMARK_PARAM(onIngressDefault, 64)
+BENCHMARK_PARAM(onIngressDefault, 1200)
+BENCHMARK_PARAM(onIngressDefault, 16384)
+BENCHMARK_PARAM(onIngressDefault, 65536)
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(onIngressLargeObjects, 1200)
+BENCHMARK_PARAM(onIngressLargeObjects, 16384)
+BENCHMARK_PARAM(onIngressLargeObjects, 65536)
+
+int main(int argc, char** argv) {
+  folly::Init init(&argc, &argv);
+  folly::runBenchmarks();
+  return 0;
+}
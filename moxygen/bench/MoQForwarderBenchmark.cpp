@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Benchmark.h>
+#include <folly/container/F14Map.h>
+#include <folly/init/Init.h>
+#include <moxygen/bench/BenchUtils.h>
+#include <moxygen/relay/MoQForwarder.h>
+
+using namespace moxygen;
+using namespace moxygen::bench;
+
+namespace {
+
+const FullTrackName kBenchTrackName{TrackNamespace{{"bench"}}, "track"};
+
+SubscribeRequest getSubscribe(uint64_t requestID) {
+  return SubscribeRequest{
+      RequestID(requestID),
+      TrackAlias(requestID),
+      kBenchTrackName,
+      kDefaultPriority,
+      GroupOrder::OldestFirst,
+      true,
+      LocationType::LatestObject,
+      folly::none,
+      0,
+      {}};
+}
+
+// Publishes one group of the moq-test track per iteration through a forwarder
+// with numSubscribers subscribers.  Subscribers have no session, only the
+// forwarding work and the per-subscriber payload clones are measured.
+void fanOut(size_t iters, size_t numSubscribers, MoQTestParameters params) {
+  MoQForwarder forwarder(kBenchTrackName);
+  std::vector<BenchObject> workload;
+  std::unique_ptr<folly::IOBuf> payload;
+  BENCHMARK_SUSPEND {
+    for (size_t i = 0; i < numSubscribers; i++) {
+      forwarder.addSubscriber(
+          nullptr, getSubscribe(i), std::make_shared<NullTrackConsumer>());
+    }
+    workload = makeWorkload(params, 1);
+    payload = makePayload(params);
+  }
+  uint64_t group = 0;
+  while (iters--) {
+    folly::F14FastMap<uint64_t, std::shared_ptr<SubgroupConsumer>> subgroups;
+    for (const auto& obj : workload) {
+      auto& subgroup = subgroups[obj.subgroup];
+      if (!subgroup) {
+        subgroup = forwarder.beginSubgroup(group, obj.subgroup, 0).value();
+      }
+      auto objPayload = payload->cloneOne();
+      objPayload->trimEnd(payload->length() - obj.size);
+      (void)subgroup->object(obj.id, std::move(objPayload));
+    }
+    for (auto& subgroup : subgroups) {
+      (void)subgroup.second->endOfSubgroup();
+    }
+    group++;
+  }
+}
+
+void fanOutOneSubgroup(size_t iters, size_t numSubscribers) {
+  fanOut(iters, numSubscribers, MoQTestParameters());
+}
+
+void fanOutTwoSubgroups(size_t iters, size_t numSubscribers) {
+  MoQTestParameters params;
+  params.forwardingPreference = ForwardingPreference::TWO_SUBGROUPS_PER_GROUP;
+  fanOut(iters, numSubscribers, params);
+}
+
+} // namespace
+
+BENCHMARK_PARAM(fanOutOneSubgroup, 1)
+BENCHMARK_PARAM(fanOutOneSubgroup, 100)
+BENCHMARK_PARAM(fanOutOneSubgroup, 10000)
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(fanOutTwoSubgroups, 1)
+BENCHMARK_PARAM(fanOutTwoSubgroups, 100)
+BENCHMARK_PARAM(fanOutTwoSubgroups, 10000)
+
+int main(int argc, char** argv) {
+  folly::Init init(&argc, &argv);
+  folly::runBenchmarks();
+  return 0;
+}
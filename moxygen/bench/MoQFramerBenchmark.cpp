@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Benchmark.h>
+#include <folly/init/Init.h>
+#include <moxygen/MoQFramer.h>
+#include <moxygen/bench/BenchUtils.h>
+
+using namespace moxygen;
+using namespace moxygen::bench;
+
+namespace {
+
+// A mix of 1, 2, 4 and 8 byte varints, like the fields of object headers
+std::unique_ptr<folly::IOBuf> makeVarints(size_t count) {
+  folly::IOBufQueue buf{folly::IOBufQueue::cacheChainLength()};
+  static constexpr uint64_t kValues[] = {7, 1000, 70000, 1ULL << 40};
+  size_t size = 0;
+  bool error = false;
+  for (size_t i = 0; i < count; i++) {
+    writeVarint(buf, kValues[i % 4], size, error);
+  }
+  auto res = buf.move();
+  res->coalesce();
+  return res;
+}
+
+// Subgroup object headers with a length and a 100 byte payload
+std::unique_ptr<folly::IOBuf> makeSubgroupObjects(
+    const MoQFrameWriter& writer,
+    size_t count) {
+  folly::IOBufQueue buf{folly::IOBufQueue::cacheChainLength()};
+  for (size_t i = 0; i < count; i++) {
+    ObjectHeader header(TrackAlias(1), 5, 0, 1000 + i, 0, 100);
+    (void)writer.writeStreamObject(
+        buf,
+        StreamType::SUBGROUP_HEADER_SG,
+        header,
+        folly::IOBuf::copyBuffer(std::string(100, 'x')));
+  }
+  auto res = buf.move();
+  res->coalesce();
+  return res;
+}
+
+constexpr size_t kNumVarints = 1000;
+constexpr size_t kNumObjects = 100;
+
+template <typename Decode>
+void decodeAll(const folly::IOBuf& buf, Decode decode) {
+  folly::io::Cursor cursor(&buf);
+  for (size_t i = 0; i < kNumVarints; i++) {
+    auto res = decode(cursor);
+    folly::doNotOptimizeAway(res);
+  }
+}
+
+void parseObjects(
+    const MoQFrameParser& parser,
+    const folly::IOBuf& buf,
+    const ObjectHeader& headerTemplate) {
+  folly::io::Cursor cursor(&buf);
+  for (size_t i = 0; i < kNumObjects; i++) {
+    auto res = parser.parseSubgroupObjectHeader(
+        cursor, headerTemplate, SubgroupIDFormat::Present, false);
+    cursor.skip(*res->length);
+    folly::doNotOptimizeAway(res);
+  }
+}
+
+} // namespace
+
+BENCHMARK(DecodeQuicInteger, iters) {
+  std::unique_ptr<folly::IOBuf> buf;
+  BENCHMARK_SUSPEND {
+    buf = makeVarints(kNumVarints);
+  }
+  while (iters--) {
+    decodeAll(
+        *buf, [](auto& cursor) { return quic::decodeQuicInteger(cursor); });
+  }
+}
+
+BENCHMARK_RELATIVE(DecodeVarint, iters) {
+  std::unique_ptr<folly::IOBuf> buf;
+  BENCHMARK_SUSPEND {
+    buf = makeVarints(kNumVarints);
+  }
+  while (iters--) {
+    decodeAll(*buf, [](auto& cursor) { return decodeVarint(cursor); });
+  }
+}
+
+BENCHMARK_RELATIVE(DecodeVarintFragmented, iters) {
+  std::unique_ptr<folly::IOBuf> buf;
+  BENCHMARK_SUSPEND {
+    buf = fragment(*makeVarints(kNumVarints), 3);
+  }
+  while (iters--) {
+    decodeAll(*buf, [](auto& cursor) { return decodeVarint(cursor); });
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(ParseSubgroupObjectHeader, iters) {
+  MoQFrameWriter writer;
+  MoQFrameParser parser;
+  std::unique_ptr<folly::IOBuf> buf;
+  ObjectHeader headerTemplate;
+  BENCHMARK_SUSPEND {
+    writer.initializeVersion(kVersionDraft11);
+    parser.initializeVersion(kVersionDraft11);
+    buf = makeSubgroupObjects(writer, kNumObjects);
+    headerTemplate.trackIdentifier = TrackAlias(1);
+    headerTemplate.group = 5;
+  }
+  while (iters--) {
+    parseObjects(parser, *buf, headerTemplate);
+  }
+}
+
+BENCHMARK_RELATIVE(ParseSubgroupObjectHeaderFragmented, iters) {
+  MoQFrameWriter writer;
+  MoQFrameParser parser;
+  std::unique_ptr<folly::IOBuf> buf;
+  ObjectHeader headerTemplate;
+  BENCHMARK_SUSPEND {
+    writer.initializeVersion(kVersionDraft11);
+    parser.initializeVersion(kVersionDraft11);
+    buf = fragment(*makeSubgroupObjects(writer, kNumObjects), 3);
+    headerTemplate.trackIdentifier = TrackAlias(1);
+    headerTemplate.group = 5;
+  }
+  while (iters--) {
+    parseObjects(parser, *buf, headerTemplate);
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+namespace {
+
+// Encodes one group of the moq-test track: subgroup header and objects
+void writeGroups(size_t iters, MoQTestParameters params) {
+  MoQFrameWriter writer;
+  std::vector<BenchObject> workload;
+  Extensions extensions;
+  std::unique_ptr<folly::IOBuf> payload;
+  BENCHMARK_SUSPEND {
+    writer.initializeVersion(kBenchVersion);
+    workload = makeWorkload(params, 1);
+    extensions = makeExtensions(params);
+    payload = makePayload(params);
+  }
+  auto streamType = getSubgroupStreamType(
+      kBenchVersion, SubgroupIDFormat::Present, /*includeExtensions=*/true);
+  while (iters--) {
+    folly::IOBufQueue buf{folly::IOBufQueue::cacheChainLength()};
+    ObjectHeader header(TrackAlias(1), 0, 0, 0);
+    (void)writer.writeSubgroupHeader(buf, header);
+    for (const auto& obj : workload) {
+      header.id = obj.id;
+      header.length = obj.size;
+      header.extensions = extensions;
+      auto objPayload = payload->cloneOne();
+      objPayload->trimEnd(payload->length() - obj.size);
+      (void)writer.writeStreamObject(
+          buf, streamType, header, std::move(objPayload));
+    }
+    folly::doNotOptimizeAway(buf);
+  }
+}
+
+} // namespace
+
+BENCHMARK(WriteSubgroupGroup, iters) {
+  writeGroups(iters, MoQTestParameters());
+}
+
+BENCHMARK_RELATIVE(WriteSubgroupGroupExtensions, iters) {
+  MoQTestParameters params;
+  params.testIntegerExtension = 1;
+  params.testVariableExtension = 1;
+  writeGroups(iters, params);
+}
+
+int main(int argc, char** argv) {
+  folly::Init init(&argc, &argv);
+  folly::runBenchmarks();
+  return 0;
+}
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Benchmark.h>
+#include <folly/container/F14Map.h>
+#include <folly/coro/BlockingWait.h>
+#include <folly/init/Init.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/logging/xlog.h>
+#include <proxygen/lib/http/webtransport/test/FakeSharedWebTransport.h>
+#include <moxygen/MoQSession.h>
+#include <moxygen/bench/AllocCounter.h>
+#include <moxygen/bench/BenchUtils.h>
+#include <moxygen/relay/MoQRelay.h>
+
+#include <ctime>
+
+using namespace moxygen;
+using namespace moxygen::bench;
+
+namespace {
+
+const FullTrackName kBenchTrackName{TrackNamespace{{"bench"}}, "track"};
+constexpr uint64_t kMaxRequestID = 1000;
+// A group not delivered by then is lost, not slow
+constexpr std::chrono::seconds kDeliveryTimeout{10};
+
+class BenchSetupCallback : public MoQSession::ServerSetupCallback {
+ public:
+  folly::Try<ServerSetup> onClientSetup(ClientSetup) override {
+    return folly::Try<ServerSetup>(ServerSetup{
+        kVersionDraft11,
+        {{folly::to_underlying(SetupKey::MAX_REQUEST_ID),
+          "",
+          kMaxRequestID,
+          {}}}});
+  }
+};
+
+ClientSetup getClientSetup() {
+  return ClientSetup{
+      {kVersionDraft11},
+      {{folly::to_underlying(SetupKey::MAX_REQUEST_ID),
+        "",
+        kMaxRequestID,
+        {}}}};
+}
+
+SubscribeRequest getSubscribe() {
+  return SubscribeRequest{
+      RequestID(0),
+      TrackAlias(0),
+      kBenchTrackName,
+      kDefaultPriority,
+      GroupOrder::OldestFirst,
+      true,
+      LocationType::LatestObject,
+      folly::none,
+      0,
+      {}};
+}
+
+// A client and server session joined by an in-memory WebTransport
+struct SessionPair {
+  SessionPair(folly::EventBase& evb, MoQSession::ServerSetupCallback& cb) {
+    std::tie(clientWt, serverWt) =
+        proxygen::test::FakeSharedWebTransport::makeSharedWebTransport();
+    client = std::make_shared<MoQSession>(clientWt.get(), &evb);
+    serverWt->setPeerHandler(client.get());
+    server = std::make_shared<MoQSession>(serverWt.get(), cb, &evb);
+    clientWt->setPeerHandler(server.get());
+  }
+
+  void setup(folly::EventBase& evb) {
+    client->start();
+    server->start();
+    folly::coro::blockingWait(client->setup(getClientSetup()), &evb);
+  }
+
+  void close() {
+    client->close(SessionCloseErrorCode::NO_ERROR);
+  }
+
+  std::unique_ptr<proxygen::test::FakeSharedWebTransport> clientWt;
+  std::unique_ptr<proxygen::test::FakeSharedWebTransport> serverWt;
+  std::shared_ptr<MoQSession> client;
+  std::shared_ptr<MoQSession> server;
+};
+
+class BenchSubscriptionHandle : public Publisher::SubscriptionHandle {
+ public:
+  explicit BenchSubscriptionHandle(SubscribeOk ok)
+      : SubscriptionHandle(std::move(ok)) {}
+  void unsubscribe() override {}
+  void subscribeUpdate(SubscribeUpdate) override {}
+};
+
+// Serves kBenchTrackName, keeping the consumer of the one SUBSCRIBE
+class BenchPublisher : public Publisher {
+ public:
+  folly::coro::Task<SubscribeResult> subscribe(
+      SubscribeRequest sub,
+      std::shared_ptr<TrackConsumer> callback) override {
+    consumer = std::move(callback);
+    co_return std::make_shared<BenchSubscriptionHandle>(SubscribeOk{
+        sub.requestID,
+        std::chrono::milliseconds(0),
+        GroupOrder::OldestFirst,
+        folly::none,
+        {}});
+  }
+
+  std::shared_ptr<TrackConsumer> consumer;
+};
+
+class CountingSubgroupConsumer : public DiscardSubgroupConsumer {
+ public:
+  explicit CountingSubgroupConsumer(uint64_t& received)
+      : received_(received) {}
+
+  folly::Expected<folly::Unit, MoQPublishError>
+  object(uint64_t, Payload, Extensions, bool) override {
+    received_++;
+    return folly::unit;
+  }
+
+ private:
+  uint64_t& received_;
+};
+
+// Counts the objects every subscriber received
+class CountingTrackConsumer : public NullTrackConsumer {
+ public:
+  explicit CountingTrackConsumer(uint64_t& received)
+      : subgroup_(std::make_shared<CountingSubgroupConsumer>(received)) {}
+
+  folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
+  beginSubgroup(uint64_t, uint64_t, Priority) override {
+    return subgroup_;
+  }
+
+ private:
+  std::shared_ptr<SubgroupConsumer> subgroup_;
+};
+
+uint64_t threadCpuNs() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Publishes one group of the moq-test track per iteration into consumer and
+// runs evb until received counts every object at every subscriber.  Reports
+// CPU time and allocations per published object, setup excluded.
+void publishGroups(
+    folly::UserCounters& counters,
+    size_t iters,
+    folly::EventBase& evb,
+    TrackConsumer& consumer,
+    uint64_t& received,
+    size_t numSubscribers) {
+  MoQTestParameters params;
+  std::vector<BenchObject> workload;
+  std::unique_ptr<folly::IOBuf> payload;
+  BENCHMARK_SUSPEND {
+    workload = makeWorkload(params, 1);
+    payload = makePayload(params);
+  }
+  auto numObjects = iters * workload.size();
+  auto cpuStart = threadCpuNs();
+  auto allocsStart = numAllocs();
+  auto bytesStart = allocBytes();
+  uint64_t expected = 0;
+  for (uint64_t group = 0; group < iters; group++) {
+    folly::F14FastMap<uint64_t, std::shared_ptr<SubgroupConsumer>> subgroups;
+    for (const auto& obj : workload) {
+      auto& subgroup = subgroups[obj.subgroup];
+      if (!subgroup) {
+        subgroup = consumer.beginSubgroup(group, obj.subgroup, 0).value();
+      }
+      auto objPayload = payload->cloneOne();
+      objPayload->trimEnd(payload->length() - obj.size);
+      (void)subgroup->object(obj.id, std::move(objPayload));
+    }
+    for (auto& subgroup : subgroups) {
+      (void)subgroup.second->endOfSubgroup();
+    }
+    expected += workload.size() * numSubscribers;
+    auto deadline = std::chrono::steady_clock::now() + kDeliveryTimeout;
+    while (received < expected) {
+      evb.loopOnce(EVLOOP_NONBLOCK);
+      if (std::chrono::steady_clock::now() > deadline) {
+        XLOG(FATAL) << "Group " << group << " not delivered in "
+                    << kDeliveryTimeout.count() << "s received=" << received
+                    << " expected=" << expected;
+      }
+    }
+  }
+  auto perObject = [numObjects](uint64_t total) {
+    return int64_t(numObjects ? total / numObjects : 0);
+  };
+  counters["cpu_ns/obj"] = perObject(threadCpuNs() - cpuStart);
+  counters["allocs/obj"] = perObject(numAllocs() - allocsStart);
+  counters["alloc_bytes/obj"] = perObject(allocBytes() - bytesStart);
+}
+
+// One publisher session and one subscriber session, no relay.  The cost of
+// a single session hop, egress framing plus ingress parsing.
+void sessionHop(folly::UserCounters& counters, size_t iters) {
+  folly::EventBase evb;
+  BenchSetupCallback setupCallback;
+  std::unique_ptr<SessionPair> pair;
+  auto publisher = std::make_shared<BenchPublisher>();
+  uint64_t received = 0;
+  BENCHMARK_SUSPEND {
+    pair = std::make_unique<SessionPair>(evb, setupCallback);
+    pair->client->setPublishHandler(publisher);
+    pair->setup(evb);
+    auto res = folly::coro::blockingWait(
+        pair->server->subscribe(
+            getSubscribe(), std::make_shared<CountingTrackConsumer>(received)),
+        &evb);
+    XCHECK(res.hasValue());
+  }
+  publishGroups(counters, iters, evb, *publisher->consumer, received, 1);
+  BENCHMARK_SUSPEND {
+    pair->close();
+    evb.loopOnce(EVLOOP_NONBLOCK);
+  }
+}
+
+// Publisher session -> MoQRelay -> numSubscribers subscriber sessions, all on
+// one EventBase.  Compared with sessionHop this adds the relay's forwarding,
+// the cache when enabled, and a session hop per subscriber.
+void relayFanOut(
+    folly::UserCounters& counters,
+    size_t iters,
+    size_t numSubscribers,
+    bool enableCache) {
+  folly::EventBase evb;
+  BenchSetupCallback setupCallback;
+  auto relay = std::make_shared<MoQRelay>(enableCache);
+  auto publisher = std::make_shared<BenchPublisher>();
+  std::unique_ptr<SessionPair> upstream;
+  std::vector<std::unique_ptr<SessionPair>> downstreams;
+  uint64_t received = 0;
+  BENCHMARK_SUSPEND {
+    upstream = std::make_unique<SessionPair>(evb, setupCallback);
+    upstream->client->setPublishHandler(publisher);
+    upstream->server->setPublishHandler(relay);
+    upstream->server->setSubscribeHandler(relay);
+    upstream->setup(evb);
+    auto ann = folly::coro::blockingWait(
+        upstream->client->announce(
+            Announce{RequestID(0), kBenchTrackName.trackNamespace, {}}),
+        &evb);
+    XCHECK(ann.hasValue());
+    for (size_t i = 0; i < numSubscribers; i++) {
+      auto& downstream = downstreams.emplace_back(
+          std::make_unique<SessionPair>(evb, setupCallback));
+      downstream->server->setPublishHandler(relay);
+      downstream->server->setSubscribeHandler(relay);
+      downstream->setup(evb);
+      auto res = folly::coro::blockingWait(
+          downstream->client->subscribe(
+              getSubscribe(),
+              std::make_shared<CountingTrackConsumer>(received)),
+          &evb);
+      XCHECK(res.hasValue());
+    }
+  }
+  publishGroups(
+      counters, iters, evb, *publisher->consumer, received, numSubscribers);
+  BENCHMARK_SUSPEND {
+    for (auto& downstream : downstreams) {
+      downstream->close();
+    }
+    upstream->close();
+    evb.loopOnce(EVLOOP_NONBLOCK);
+  }
+}
+
+} // namespace
+
+BENCHMARK_COUNTERS(sessionHop, counters, iters) {
+  sessionHop(counters, iters);
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_COUNTERS(relayNoCache_1, counters, iters) {
+  relayFanOut(counters, iters, 1, false);
+}
+BENCHMARK_COUNTERS(relayNoCache_10, counters, iters) {
+  relayFanOut(counters, iters, 10, false);
+}
+BENCHMARK_COUNTERS(relayNoCache_100, counters, iters) {
+  relayFanOut(counters, iters, 100, false);
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_COUNTERS(relayCache_1, counters, iters) {
+  relayFanOut(counters, iters, 1, true);
+}
+BENCHMARK_COUNTERS(relayCache_10, counters, iters) {
+  relayFanOut(counters, iters, 10, true);
+}
+BENCHMARK_COUNTERS(relayCache_100, counters, iters) {
+  relayFanOut(counters, iters, 100, true);
+}
+
+int main(int argc, char** argv) {
+  folly::Init init(&argc, &argv);
+  folly::runBenchmarks();
+  return 0;
+}
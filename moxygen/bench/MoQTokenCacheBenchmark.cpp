@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Benchmark.h>
+#include <folly/Conv.h>
+#include <folly/init/Init.h>
+#include <moxygen/MoQTokenCache.h>
+
+using namespace moxygen;
+
+namespace {
+
+constexpr uint64_t kTokenType = 1;
+
+std::string makeToken(size_t i) {
+  // Long enough to defeat the small string optimization, like real tokens
+  return folly::to<std::string>("bench-auth-token-", i, "-0123456789abcdef");
+}
+
+// Looks up tokens already registered in a cache holding numTokens, as
+// aliasifyAuthTokens does for every request after the first
+void lookupHit(size_t iters, size_t numTokens) {
+  std::vector<std::string> tokens;
+  MoQTokenCache cache(numTokens * 64);
+  BENCHMARK_SUSPEND {
+    for (size_t i = 0; i < numTokens; i++) {
+      tokens.push_back(makeToken(i));
+      cache.registerToken(kTokenType, tokens.back()).value();
+    }
+  }
+  size_t i = 0;
+  while (iters--) {
+    folly::doNotOptimizeAway(
+        cache.getAliasForToken(kTokenType, tokens[i++ % numTokens]));
+  }
+}
+
+// Every request brings a new token, evicting the least recently used
+void registerEvict(size_t iters, size_t numTokens) {
+  std::vector<std::string> tokens;
+  MoQTokenCache cache(numTokens * 64);
+  BENCHMARK_SUSPEND {
+    for (size_t i = 0; i < numTokens * 2; i++) {
+      tokens.push_back(makeToken(i));
+    }
+  }
+  size_t i = 0;
+  while (iters--) {
+    const auto& token = tokens[i++ % tokens.size()];
+    if (cache.getAliasForToken(kTokenType, token)) {
+      continue;
+    }
+    while (!cache.canRegister(kTokenType, token)) {
+      cache.evictOne();
+    }
+    folly::doNotOptimizeAway(cache.registerToken(kTokenType, token));
+  }
+}
+
+} // namespace
+
+BENCHMARK_PARAM(lookupHit, 1)
+BENCHMARK_PARAM(lookupHit, 64)
+BENCHMARK_PARAM(lookupHit, 4096)
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(registerEvict, 64)
+BENCHMARK_PARAM(registerEvict, 4096)
+
+int main(int argc, char** argv) {
+  folly::Init init(&argc, &argv);
+  folly::runBenchmarks();
+  return 0;
+}
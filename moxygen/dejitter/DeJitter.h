@@ -8,6 +8,9 @@
 
 #include <folly/Optional.h>
 #include <folly/logging/xlog.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
 #include <map>
 
@@ -31,8 +34,44 @@ class DeJitter {
         : gapType(gapType), gapSize(gapSize) {}
   };
 
+  using Clock = std::chrono::steady_clock;
+
+  // Sizes the buffer from the inter-arrival jitter of consecutive items,
+  // estimated as in RFC 3550 section 6.4.1
+  struct AdaptiveConfig {
+    uint64_t minBufferSizeMs{0};
+    uint64_t maxBufferSizeMs{1000};
+    // Buffer size until the jitter estimate settles, 0 for maxBufferSizeMs
+    uint64_t initialBufferSizeMs{0};
+    // Buffered multiple of the jitter estimate
+    double jitterMultiplier{4.0};
+  };
+
+  struct Stats {
+    uint64_t released{0};
+    // Dropped for arriving after a later item was released
+    uint64_t arrivedLate{0};
+    // Releases that skipped items, and the items skipped
+    uint64_t gaps{0};
+    uint64_t skippedItems{0};
+    // Jitter estimate and the buffer size targeted from it
+    double jitterMs{0};
+    uint64_t targetBufferSizeMs{0};
+  };
+
   explicit DeJitter(uint64_t bufferSizeMs) : maxBufferSizeMs_(bufferSizeMs) {
     CHECK_GT(maxBufferSizeMs_, 0);
+    stats_.targetBufferSizeMs = maxBufferSizeMs_;
+  }
+
+  explicit DeJitter(AdaptiveConfig config)
+      : maxBufferSizeMs_(
+            config.initialBufferSizeMs > 0 ? config.initialBufferSizeMs
+                                           : config.maxBufferSizeMs),
+        adaptive_(config) {
+    CHECK_GT(config.maxBufferSizeMs, 0);
+    CHECK_LE(config.minBufferSizeMs, config.maxBufferSizeMs);
+    stats_.targetBufferSizeMs = maxBufferSizeMs_;
   }
 
   size_t size() const {
@@ -42,11 +81,28 @@ class DeJitter {
     return currentBufferSizeMs_;
   }
 
+  // Buffered duration at which items are released
+  uint64_t targetSizeMs() const {
+    return maxBufferSizeMs_;
+  }
+
+  const Stats& getStats() const {
+    return stats_;
+  }
+
   // Assuming pos in monotically increasing
   inline std::tuple<folly::Optional<T>, typename DeJitter<T>::GapInfo>
-  insertItem(uint64_t pos, uint64_t durationMs, T item) {
+  insertItem(
+      uint64_t pos,
+      uint64_t durationMs,
+      T item,
+      Clock::time_point arrival = Clock::now()) {
+    if (adaptive_) {
+      updateJitter(pos, durationMs, arrival);
+    }
     // Arrived late
     if (lastSent_.has_value() && pos <= lastSent_.value()) {
+      stats_.arrivedLate++;
       return std::make_tuple(
           folly::none,
           GapInfo{DeJitter<T>::GapType::ARRIVED_LATE, lastSent_.value() - pos});
@@ -54,59 +110,103 @@ class DeJitter {
 
     // Add to buffer
     auto itemAndDur = ItemAndDuration{std::move(item), durationMs};
-    buffer_.emplace(std::make_pair(pos, std::move(itemAndDur)));
-    currentBufferSizeMs_ += durationMs;
+    if (buffer_.emplace(pos, std::move(itemAndDur)).second) {
+      currentBufferSizeMs_ += durationMs;
+    }
     if (currentBufferSizeMs_ <= maxBufferSizeMs_) {
       return std::make_tuple(
           folly::none, GapInfo{DeJitter<T>::GapType::FILLING_BUFFER, 0});
     }
+    return releaseFirst();
+  }
 
-    // Check next item
-    folly::Optional<uint64_t> minVal;
-    for (auto it = buffer_.begin(); it != buffer_.end(); it++) {
-      if (!minVal.has_value() || it->first < minVal.value()) {
-        minVal = it->first;
-      }
-      if (lastSent_.has_value()) {
-        if (it->first == lastSent_.value() + 1) {
-          lastSent_ = it->first;
-          auto v = std::make_tuple(std::move(it->second.item), GapInfo{});
-          currentBufferSizeMs_ -= it->second.durationMs;
-          buffer_.erase(it);
-          return v;
-        }
-      }
-    }
-    if (!minVal.has_value()) {
-      // Should never happen
+  // Releases the next item while more than the target is buffered.  After
+  // the adaptive target shrinks, insertItem releases one item at a time, so
+  // call this until it returns none to drain the buffer to the new target.
+  inline std::tuple<folly::Optional<T>, typename DeJitter<T>::GapInfo>
+  popExcess() {
+    if (currentBufferSizeMs_ <= maxBufferSizeMs_ || buffer_.empty()) {
       return std::make_tuple(
-          folly::none, GapInfo{DeJitter<T>::GapType::INTERNAL_ERROR, 0});
+          folly::none, GapInfo{DeJitter<T>::GapType::NO_GAP, 0});
     }
+    return releaseFirst();
+  }
 
-    auto itemDur = std::move(buffer_[minVal.value()]);
+ private:
+  struct ItemAndDuration {
+    T item;
+    uint64_t durationMs;
+  };
+
+  std::tuple<folly::Optional<T>, typename DeJitter<T>::GapInfo>
+  releaseFirst() {
+    // Everything buffered is past lastSent_, so the next item is the first
+    auto it = buffer_.begin();
     uint64_t gapSize = 0;
     if (lastSent_.has_value()) {
-      gapSize = minVal.value() - lastSent_.value_or(0) - 1;
+      gapSize = it->first - lastSent_.value() - 1;
     }
-    lastSent_ = minVal.value();
-    buffer_.erase(minVal.value());
+    lastSent_ = it->first;
+    auto itemDur = std::move(it->second);
+    buffer_.erase(it);
     currentBufferSizeMs_ -= itemDur.durationMs;
-    // At start there is NO gat
+    stats_.released++;
+    // At start there is NO gap
+    if (gapSize > 0) {
+      stats_.gaps++;
+      stats_.skippedItems += gapSize;
+    }
     auto gap = (gapSize > 0) ? DeJitter<T>::GapType::GAP
                              : DeJitter<T>::GapType::NO_GAP;
     return std::make_tuple(std::move(itemDur.item), GapInfo{gap, gapSize});
   }
 
- private:
-  struct ItemAndDuration {
-    T item;
+  // Consecutive items should arrive one duration apart, the difference is a
+  // jitter sample
+  void updateJitter(
+      uint64_t pos,
+      uint64_t durationMs,
+      Clock::time_point arrival) {
+    if (lastArrival_ && pos == lastArrival_->pos + 1) {
+      auto interArrivalMs = std::chrono::duration<double, std::milli>(
+                                arrival - lastArrival_->time)
+                                .count();
+      auto deviationMs =
+          std::abs(interArrivalMs - double(lastArrival_->durationMs));
+      stats_.jitterMs += (deviationMs - stats_.jitterMs) / kJitterGain;
+      jitterSamples_++;
+      if (jitterSamples_ >= kJitterGain) {
+        auto targetMs =
+            uint64_t(std::ceil(adaptive_->jitterMultiplier * stats_.jitterMs));
+        maxBufferSizeMs_ = std::clamp(
+            targetMs,
+            std::max<uint64_t>(adaptive_->minBufferSizeMs, 1),
+            adaptive_->maxBufferSizeMs);
+        stats_.targetBufferSizeMs = maxBufferSizeMs_;
+      }
+    }
+    if (!lastArrival_ || pos > lastArrival_->pos) {
+      lastArrival_ = Arrival{pos, durationMs, arrival};
+    }
+  }
+
+  // RFC 3550 smoothing, also the samples taken before adapting
+  static constexpr uint64_t kJitterGain = 16;
+
+  struct Arrival {
+    uint64_t pos;
     uint64_t durationMs;
+    Clock::time_point time;
   };
 
   std::map<uint64_t, ItemAndDuration> buffer_;
   uint64_t maxBufferSizeMs_{0};
   uint64_t currentBufferSizeMs_{0};
   folly::Optional<uint64_t> lastSent_;
+  folly::Optional<AdaptiveConfig> adaptive_;
+  folly::Optional<Arrival> lastArrival_;
+  uint64_t jitterSamples_{0};
+  Stats stats_;
 };
 
 } // namespace moxygen::dejitter
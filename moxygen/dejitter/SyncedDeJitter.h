@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "moxygen/dejitter/DeJitter.h"
+
+#include <folly/Optional.h>
+#include <folly/logging/xlog.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <vector>
+
+namespace moxygen::dejitter {
+
+// Dejitters several tracks, eg audio and video, on one playout clock.  Each
+// item has a media time on a timeline shared by the tracks, like MoQ-MI
+// wallclock, and is released once the playout clock passes it, so items of
+// different tracks with the same media time are released together.
+//
+// An item's transit is its arrival minus its media time.  The clock runs
+// one playout delay behind the smallest transit seen on any track.  Each
+// track needs its own smallest transit above that, plus a multiple of its
+// jitter estimated as in RFC 3550 section 6.4.1, and the delay is what the
+// track that needs most needs.  Tracks are never padded to their own
+// worst case.
+//
+// Items of a track are released in pos order.
+template <class T>
+class SyncedDeJitter {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using GapType = typename DeJitter<T>::GapType;
+  using GapInfo = typename DeJitter<T>::GapInfo;
+
+  struct Config {
+    uint64_t minDelayMs{0};
+    uint64_t maxDelayMs{1000};
+    // Delay until the tracks' estimates settle, 0 for maxDelayMs
+    uint64_t initialDelayMs{0};
+    // Buffered multiple of the jitter estimate
+    double jitterMultiplier{4.0};
+  };
+
+  struct TrackStats {
+    uint64_t released{0};
+    // Dropped for arriving after a later item of the track was released
+    uint64_t arrivedLate{0};
+    // Releases that skipped items, and the items skipped
+    uint64_t gaps{0};
+    uint64_t skippedItems{0};
+    double jitterMs{0};
+    // Delay this track needs
+    uint64_t delayMs{0};
+  };
+
+  struct Released {
+    size_t track;
+    T item;
+    GapInfo gap;
+  };
+
+  SyncedDeJitter(size_t numTracks, Config config)
+      : tracks_(numTracks),
+        config_(config),
+        delayMs_(
+            config.initialDelayMs > 0 ? config.initialDelayMs
+                                      : config.maxDelayMs) {
+    CHECK_GT(numTracks, 0);
+    CHECK_LE(config.minDelayMs, config.maxDelayMs);
+  }
+
+  size_t size() const {
+    size_t size = 0;
+    for (const auto& track : tracks_) {
+      size += track.buffer.size();
+    }
+    return size;
+  }
+
+  // Playout delay, behind the smallest transit
+  uint64_t delayMs() const {
+    return delayMs_;
+  }
+
+  const TrackStats& getStats(size_t track) const {
+    return tracks_.at(track).stats;
+  }
+
+  // Returns false if the item arrived late and was dropped
+  bool insertItem(
+      size_t track,
+      uint64_t pos,
+      uint64_t mediaTimeMs,
+      T item,
+      Clock::time_point arrival = Clock::now()) {
+    auto& t = tracks_.at(track);
+    updateClock(t, mediaTimeMs, arrival);
+    if (t.lastReleased && pos <= *t.lastReleased) {
+      t.stats.arrivedLate++;
+      return false;
+    }
+    t.buffer.emplace(pos, Entry{mediaTimeMs, std::move(item)});
+    return true;
+  }
+
+  // Items whose playout time is now or earlier, by media time
+  std::vector<Released> popReady(Clock::time_point now = Clock::now()) {
+    std::vector<Released> released;
+    auto nowMs = toMs(now);
+    while (true) {
+      Track* next = nullptr;
+      size_t nextIndex = 0;
+      for (size_t i = 0; i < tracks_.size(); i++) {
+        auto& t = tracks_[i];
+        if (t.buffer.empty() ||
+            playoutMs(t.buffer.begin()->second.mediaTimeMs) > nowMs) {
+          continue;
+        }
+        if (!next ||
+            t.buffer.begin()->second.mediaTimeMs <
+                next->buffer.begin()->second.mediaTimeMs) {
+          next = &tracks_[i];
+          nextIndex = i;
+        }
+      }
+      if (!next) {
+        return released;
+      }
+      auto it = next->buffer.begin();
+      uint64_t gapSize = 0;
+      if (next->lastReleased) {
+        gapSize = it->first - *next->lastReleased - 1;
+      }
+      next->lastReleased = it->first;
+      next->stats.released++;
+      if (gapSize > 0) {
+        next->stats.gaps++;
+        next->stats.skippedItems += gapSize;
+      }
+      released.push_back(Released{
+          nextIndex,
+          std::move(it->second.item),
+          GapInfo{gapSize > 0 ? GapType::GAP : GapType::NO_GAP, gapSize}});
+      next->buffer.erase(it);
+    }
+  }
+
+  // When popReady next has something, to schedule it
+  folly::Optional<Clock::time_point> nextReadyTime() const {
+    folly::Optional<int64_t> nextMs;
+    for (const auto& t : tracks_) {
+      if (!t.buffer.empty()) {
+        auto ms = playoutMs(t.buffer.begin()->second.mediaTimeMs);
+        nextMs = nextMs ? std::min(*nextMs, ms) : ms;
+      }
+    }
+    if (!nextMs) {
+      return folly::none;
+    }
+    return Clock::time_point(std::chrono::milliseconds(*nextMs));
+  }
+
+ private:
+  struct Entry {
+    uint64_t mediaTimeMs;
+    T item;
+  };
+
+  struct Track {
+    std::map<uint64_t, Entry> buffer;
+    folly::Optional<uint64_t> lastReleased;
+    folly::Optional<int64_t> lastTransitMs;
+    int64_t minTransitMs{std::numeric_limits<int64_t>::max()};
+    uint64_t jitterSamples{0};
+    TrackStats stats;
+  };
+
+  static int64_t toMs(Clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               time.time_since_epoch())
+        .count();
+  }
+
+  int64_t playoutMs(uint64_t mediaTimeMs) const {
+    return int64_t(mediaTimeMs) + baseTransitMs_ + int64_t(delayMs_);
+  }
+
+  void updateClock(Track& t, uint64_t mediaTimeMs, Clock::time_point arrival) {
+    auto transitMs = toMs(arrival) - int64_t(mediaTimeMs);
+    if (t.lastTransitMs) {
+      auto deviationMs = double(std::abs(transitMs - *t.lastTransitMs));
+      t.stats.jitterMs += (deviationMs - t.stats.jitterMs) / kJitterGain;
+      t.jitterSamples++;
+    }
+    t.lastTransitMs = transitMs;
+    t.minTransitMs = std::min(t.minTransitMs, transitMs);
+    if (!clockStarted_ || transitMs < baseTransitMs_) {
+      baseTransitMs_ = transitMs;
+      clockStarted_ = true;
+    }
+    updateDelay();
+  }
+
+  // Tracks that haven't had an item yet don't hold the others back
+  void updateDelay() {
+    uint64_t neededMs = 0;
+    for (auto& t : tracks_) {
+      if (!t.lastTransitMs) {
+        continue;
+      }
+      if (t.jitterSamples < kJitterGain) {
+        return;
+      }
+      t.stats.delayMs = uint64_t(t.minTransitMs - baseTransitMs_) +
+          uint64_t(std::ceil(config_.jitterMultiplier * t.stats.jitterMs));
+      neededMs = std::max(neededMs, t.stats.delayMs);
+    }
+    delayMs_ = std::clamp(neededMs, config_.minDelayMs, config_.maxDelayMs);
+  }
+
+  // RFC 3550 smoothing, also the samples taken before adapting
+  static constexpr uint64_t kJitterGain = 16;
+
+  std::vector<Track> tracks_;
+  Config config_;
+  uint64_t delayMs_;
+  bool clockStarted_{false};
+  int64_t baseTransitMs_{0};
+};
+
+} // namespace moxygen::dejitter
@@ -8,6 +8,9 @@
 #include <folly/io/IOBuf.h>
 #include <folly/portability/GTest.h>
 
+#include <cmath>
+#include <vector>
+
 using namespace moxygen::dejitter;
 
 TEST(DeJitterTest, NoGapsUniquePrt) {
@@ -225,3 +228,75 @@ TEST(DeJitterTest, ArriveLate) {
   EXPECT_EQ(dejitter.size(), 3);
   EXPECT_EQ(dejitter.sizeMs(), 30);
 }
+
+TEST(DeJitterTest, Stats) {
+  DeJitter<int> dejitter(10);
+  dejitter.insertItem(0, 10, 0);
+  dejitter.insertItem(2, 10, 2);
+  auto r3 = dejitter.insertItem(3, 10, 3);
+  EXPECT_EQ(std::get<0>(r3).value(), 2);
+  EXPECT_EQ(std::get<1>(r3).gapType, DeJitter<int>::GapType::GAP);
+  dejitter.insertItem(1, 10, 1);
+
+  const auto& stats = dejitter.getStats();
+  EXPECT_EQ(stats.released, 2);
+  EXPECT_EQ(stats.gaps, 1);
+  EXPECT_EQ(stats.skippedItems, 1);
+  EXPECT_EQ(stats.arrivedLate, 1);
+  EXPECT_EQ(stats.targetBufferSizeMs, 10);
+}
+
+TEST(DeJitterTest, AdaptiveShrinksWithoutJitter) {
+  DeJitter<int> dejitter(DeJitter<int>::AdaptiveConfig{20, 500, 0, 4.0});
+  EXPECT_EQ(dejitter.targetSizeMs(), 500);
+  auto start = DeJitter<int>::Clock::now();
+  for (int i = 0; i < 16; i++) {
+    auto r = dejitter.insertItem(
+        i, 10, i, start + std::chrono::milliseconds(10 * i));
+    EXPECT_EQ(std::get<1>(r).gapType, DeJitter<int>::GapType::FILLING_BUFFER);
+  }
+  // Sixteen samples of perfectly paced arrivals, down to the minimum
+  auto r = dejitter.insertItem(
+      16, 10, 16, start + std::chrono::milliseconds(160));
+  EXPECT_EQ(dejitter.targetSizeMs(), 20);
+  EXPECT_EQ(dejitter.getStats().jitterMs, 0);
+  ASSERT_TRUE(std::get<0>(r).has_value());
+  EXPECT_EQ(std::get<0>(r).value(), 0);
+  EXPECT_EQ(std::get<1>(r).gapType, DeJitter<int>::GapType::NO_GAP);
+}
+
+TEST(DeJitterTest, AdaptiveTracksJitter) {
+  DeJitter<int> dejitter(DeJitter<int>::AdaptiveConfig{0, 500, 0, 4.0});
+  auto arrival = DeJitter<int>::Clock::now();
+  for (int i = 0; i <= 16; i++) {
+    dejitter.insertItem(i, 10, i, arrival);
+    // Arrivals alternate 0ms and 20ms apart, 10ms off their duration
+    arrival += std::chrono::milliseconds(i % 2 ? 0 : 20);
+  }
+  auto expectedJitterMs = 10 * (1 - std::pow(15.0 / 16, 16));
+  EXPECT_NEAR(dejitter.getStats().jitterMs, expectedJitterMs, 0.01);
+  EXPECT_EQ(
+      dejitter.targetSizeMs(), uint64_t(std::ceil(4 * expectedJitterMs)));
+}
+
+TEST(DeJitterTest, AdaptiveDrainsWhenJitterDrops) {
+  DeJitter<int> dejitter(DeJitter<int>::AdaptiveConfig{20, 500, 0, 4.0});
+  auto start = DeJitter<int>::Clock::now();
+  for (int i = 0; i <= 16; i++) {
+    dejitter.insertItem(i, 10, i, start + std::chrono::milliseconds(10 * i));
+  }
+  // Filled to the initial 500ms target, which then dropped to 20ms
+  EXPECT_EQ(dejitter.targetSizeMs(), 20);
+  EXPECT_EQ(dejitter.sizeMs(), 160);
+  std::vector<int> released;
+  for (auto r = dejitter.popExcess(); std::get<0>(r).has_value();
+       r = dejitter.popExcess()) {
+    EXPECT_EQ(std::get<1>(r).gapType, DeJitter<int>::GapType::NO_GAP);
+    released.push_back(std::get<0>(r).value());
+  }
+  EXPECT_EQ(
+      released,
+      (std::vector<int>{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14}));
+  EXPECT_EQ(dejitter.sizeMs(), 20);
+  EXPECT_EQ(dejitter.getStats().released, 15);
+}
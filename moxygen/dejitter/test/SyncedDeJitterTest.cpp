@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/dejitter/SyncedDeJitter.h"
+#include <folly/portability/GTest.h>
+
+using namespace moxygen::dejitter;
+
+namespace {
+using SyncedInts = SyncedDeJitter<int>;
+constexpr size_t kAudio = 0;
+constexpr size_t kVideo = 1;
+
+SyncedInts::Clock::time_point at(uint64_t ms) {
+  return SyncedInts::Clock::time_point(std::chrono::milliseconds(ms));
+}
+} // namespace
+
+TEST(SyncedDeJitterTest, ReleasesTracksTogether) {
+  SyncedInts dejitter(2, {0, 1000, 100, 4.0});
+  // Audio arrives 10ms after its media time, video 50ms
+  EXPECT_TRUE(dejitter.insertItem(kAudio, 0, 1000, 0, at(1010)));
+  EXPECT_TRUE(dejitter.insertItem(kVideo, 0, 1000, 1, at(1050)));
+  EXPECT_EQ(dejitter.delayMs(), 100);
+  // Playout runs 100ms behind the smallest transit
+  EXPECT_TRUE(dejitter.popReady(at(1109)).empty());
+  EXPECT_EQ(*dejitter.nextReadyTime(), at(1110));
+  auto released = dejitter.popReady(at(1110));
+  ASSERT_EQ(released.size(), 2);
+  EXPECT_EQ(released[0].track, kAudio);
+  EXPECT_EQ(released[1].track, kVideo);
+  EXPECT_EQ(released[1].item, 1);
+  EXPECT_EQ(dejitter.size(), 0);
+}
+
+TEST(SyncedDeJitterTest, DelayFromTrackThatNeedsMost) {
+  SyncedInts dejitter(2, {0, 1000, 0, 4.0});
+  for (uint64_t i = 0; i < 20; i++) {
+    auto mediaTimeMs = 1000 + i * 20;
+    dejitter.insertItem(kAudio, i, mediaTimeMs, 0, at(mediaTimeMs + 10));
+    dejitter.insertItem(kVideo, i, mediaTimeMs, 1, at(mediaTimeMs + 50));
+  }
+  // No jitter, video's extra 40ms of transit is all that's buffered
+  EXPECT_EQ(dejitter.getStats(kAudio).delayMs, 0);
+  EXPECT_EQ(dejitter.getStats(kVideo).delayMs, 40);
+  EXPECT_EQ(dejitter.delayMs(), 40);
+
+  // An item is playable when the video for it arrives
+  auto released = dejitter.popReady(at(1050));
+  ASSERT_EQ(released.size(), 2);
+  EXPECT_EQ(released[0].track, kAudio);
+  EXPECT_EQ(released[1].track, kVideo);
+  EXPECT_EQ(released[1].gap.gapType, SyncedInts::GapType::NO_GAP);
+}
+
+TEST(SyncedDeJitterTest, JitterAddsDelay) {
+  SyncedInts dejitter(1, {0, 1000, 0, 4.0});
+  for (uint64_t i = 0; i < 32; i++) {
+    auto mediaTimeMs = 1000 + i * 20;
+    // Transit alternates between 10ms and 20ms
+    auto transitMs = 10 * (1 + i % 2);
+    dejitter.insertItem(kAudio, i, mediaTimeMs, 0, at(mediaTimeMs + transitMs));
+  }
+  EXPECT_GT(dejitter.getStats(kAudio).jitterMs, 5);
+  EXPECT_GT(dejitter.delayMs(), 20);
+}
+
+TEST(SyncedDeJitterTest, GapsAndLateItems) {
+  SyncedInts dejitter(1, {0, 1000, 10, 4.0});
+  dejitter.insertItem(kAudio, 0, 1000, 0, at(1000));
+  dejitter.insertItem(kAudio, 2, 1040, 2, at(1040));
+  auto released = dejitter.popReady(at(1050));
+  ASSERT_EQ(released.size(), 2);
+  EXPECT_EQ(released[1].gap.gapType, SyncedInts::GapType::GAP);
+  EXPECT_EQ(released[1].gap.gapSize, 1);
+  EXPECT_EQ(dejitter.getStats(kAudio).skippedItems, 1);
+
+  EXPECT_FALSE(dejitter.insertItem(kAudio, 1, 1020, 1, at(1060)));
+  EXPECT_EQ(dejitter.getStats(kAudio).arrivedLate, 1);
+}
@@ -5,20 +5,74 @@
  */
 
 #include "moxygen/flv_parser/FlvReader.h"
-#include <netinet/in.h>
+
+#include <fcntl.h>
+#include <folly/FileUtil.h>
+#include <folly/ScopeGuard.h>
+#include <folly/logging/xlog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
 
 namespace moxygen::flv {
 
+namespace {
+constexpr size_t kFlvHeaderSize = 9;
+constexpr size_t kPrevTagSizeSize = 4;
+constexpr size_t kTagHeaderSize = 11;
+
+struct MappingSize {
+  size_t size;
+};
+
+void unmap(void* buf, void* userData) {
+  auto mappingSize = static_cast<MappingSize*>(userData);
+  munmap(buf, mappingSize->size);
+  delete mappingSize;
+}
+
+uint32_t load3Bytes(const uint8_t* p) {
+  return uint32_t(p[0]) << 16 | uint32_t(p[1]) << 8 | p[2];
+}
+} // namespace
+
+FlvReader::FlvReader(const std::string& filename) {
+  int fd = folly::openNoInt(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    XLOG(ERR) << "Failed to open " << filename;
+    return;
+  }
+  SCOPE_EXIT {
+    folly::closeNoInt(fd);
+  };
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    XLOG(ERR) << "Failed to stat " << filename << " or it is empty";
+    return;
+  }
+  size_t size = st.st_size;
+  // Private and writable so payload owners may modify them in place
+  auto addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) {
+    XLOG(ERR) << "Failed to map " << filename;
+    return;
+  }
+  madvise(addr, size, MADV_SEQUENTIAL);
+  file_ = folly::IOBuf::takeOwnership(
+      addr, size, unmap, new MappingSize{size});
+}
+
 FlvTag FlvReader::readNextTag() {
   if (!header_) {
     // Read header
-    header_ = readBytes(9);
+    header_ = readBytes(kFlvHeaderSize);
   }
 
   // Prev tag size
   read4Bytes();
 
-  if (f_.peek() == EOF) {
+  if (offset_ == file_->length()) {
     // Clean end of file
     return FlvReadCmd::FLV_EOF;
   }
@@ -137,71 +191,115 @@ FlvTag FlvReader::readNextTag() {
   return FlvReadCmd::FLV_UNKNOWN_TAG;
 }
 
-uint8_t FlvReader::read1Byte() {
-  uint8_t ret = 0;
-  char tmp = 0;
-  const int64_t bytesToRead = 1;
-  f_.read(&tmp, bytesToRead);
-  if (f_.gcount() == bytesToRead && f_.rdstate() == std::ios::goodbit) {
-    ret = tmp;
-  } else {
-    // TODO: handle EOF
-    if (f_.eof()) {
-      throw std::runtime_error("EOF!");
-    }
-    throw std::runtime_error(fmt::format(
-        "Failed to read 1 byte at offset {}", static_cast<int>(f_.tellg())));
+folly::Optional<uint32_t> FlvReader::seek(uint32_t timestampMs) {
+  const auto& index = getSeekIndex();
+  if (index.empty()) {
+    return folly::none;
   }
-  return ret;
+  auto it = std::upper_bound(
+      index.begin(),
+      index.end(),
+      timestampMs,
+      [](uint32_t timestamp, const SeekPoint& point) {
+        return timestamp < point.timestamp;
+      });
+  if (it != index.begin()) {
+    --it;
+  }
+  if (!header_) {
+    header_ = readBytes(kFlvHeaderSize);
+  }
+  offset_ = it->offset;
+  return it->timestamp;
 }
 
-uint32_t FlvReader::read3Bytes() {
-  uint32_t ret = 0;
-  uint32_t readData = 0;
-  f_.read(reinterpret_cast<char*>(&readData), 3);
-  if (f_.gcount() == 3 && f_.rdstate() == std::ios::goodbit) {
-    ret = ntohl(readData << 8);
-  } else {
-    throw std::runtime_error(fmt::format(
-        "Failed to read 3 byte at offset {}", static_cast<int>(f_.tellg())));
+const std::vector<FlvReader::SeekPoint>& FlvReader::getSeekIndex() {
+  if (!seekIndex_) {
+    buildSeekIndex();
   }
-  return ret;
+  return *seekIndex_;
 }
 
-uint32_t FlvReader::read4Bytes() {
-  uint32_t ret = 0;
-  uint32_t readData;
-  f_.read(reinterpret_cast<char*>(&readData), 4);
-  if (f_.gcount() == 4 && f_.rdstate() == std::ios::goodbit) {
-    ret = ntohl(readData);
+void FlvReader::buildSeekIndex() {
+  seekIndex_.emplace();
+  if (!file_) {
+    return;
+  }
+  const uint8_t* data = file_->data();
+  size_t size = file_->length();
+  std::vector<SeekPoint> allTags;
+  bool hasVideo = false;
+  size_t offset = kFlvHeaderSize;
+  while (offset + kPrevTagSizeSize + kTagHeaderSize <= size) {
+    const uint8_t* tag = data + offset + kPrevTagSizeSize;
+    auto dataSize = load3Bytes(tag + 1);
+    if (offset + kPrevTagSizeSize + kTagHeaderSize + dataSize > size) {
+      // Truncated tag
+      break;
+    }
+    SeekPoint point{uint32_t(tag[7]) << 24 | load3Bytes(tag + 4), offset};
+    allTags.push_back(point);
+    if (tag[0] == 0x09 && dataSize >= 2) {
+      hasVideo = true;
+      // Key frame carrying NALUs, not a sequence header
+      auto body = tag + kTagHeaderSize;
+      if (((body[0] >> 4) & 0x0f) == 1 && body[1] == 1) {
+        seekIndex_->push_back(point);
+      }
+    }
+    offset += kPrevTagSizeSize + kTagHeaderSize + dataSize;
+  }
+  if (!hasVideo) {
+    *seekIndex_ = std::move(allTags);
+  }
+  // Timestamps may step back, keep the index sorted for lookups
+  std::stable_sort(
+      seekIndex_->begin(),
+      seekIndex_->end(),
+      [](const SeekPoint& a, const SeekPoint& b) {
+        return a.timestamp < b.timestamp;
+      });
+}
 
-  } else {
+void FlvReader::checkAvailable(size_t n) const {
+  if (!file_) {
+    throw std::runtime_error("FLV file could not be mapped");
+  }
+  if (n > file_->length() - offset_) {
     throw std::runtime_error(fmt::format(
-        "Failed to read 4 byte at offset {}. bytesRead: {}, rdstate: {}",
-        static_cast<int>(f_.tellg()),
-        static_cast<size_t>(f_.gcount()),
-        static_cast<int>(f_.rdstate())));
+        "Failed to read {} bytes at offset {}. fileSize: {}",
+        n,
+        offset_,
+        file_->length()));
   }
+}
+
+uint8_t FlvReader::read1Byte() {
+  checkAvailable(1);
+  return file_->data()[offset_++];
+}
+
+uint32_t FlvReader::read3Bytes() {
+  checkAvailable(3);
+  auto ret = load3Bytes(file_->data() + offset_);
+  offset_ += 3;
   return ret;
 }
 
+uint32_t FlvReader::read4Bytes() {
+  checkAvailable(4);
+  auto p = file_->data() + offset_;
+  offset_ += 4;
+  return uint32_t(p[0]) << 24 | load3Bytes(p + 1);
+}
+
 std::unique_ptr<folly::IOBuf> FlvReader::readBytes(size_t n) {
-  std::unique_ptr<folly::IOBuf> ret;
-  if (n > std::numeric_limits<int32_t>::max()) {
-    throw std::runtime_error(
-        fmt::format("Cannot read more than int64_t::max {}", n));
-  }
-  const int64_t bytesToRead = n;
-  uint8_t tmp[bytesToRead];
-  f_.read((char*)tmp, bytesToRead);
-  if (f_.gcount() == bytesToRead && f_.rdstate() == std::ios::goodbit) {
-    ret = folly::IOBuf::copyBuffer(tmp, bytesToRead);
-  } else {
-    throw std::runtime_error(fmt::format(
-        "Failed to read {} bytes at offset {}",
-        n,
-        static_cast<int>(f_.tellg())));
-  }
+  checkAvailable(n);
+  // Shares the mapping
+  auto ret = file_->cloneOne();
+  ret->trimStart(offset_);
+  ret->trimEnd(ret->length() - n);
+  offset_ += n;
   return ret;
 }
 
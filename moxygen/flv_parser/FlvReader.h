@@ -6,32 +6,50 @@
 
 #pragma once
 
+#include <folly/Optional.h>
 #include <folly/io/IOBuf.h>
-#include <fstream> // std::ifstream
 #include "moxygen/flv_parser/FlvCommon.h"
 
 namespace moxygen::flv {
 
+// Reads tags from a memory mapped FLV file.  Tag payloads are IOBufs sharing
+// the mapping rather than copies, and stay valid after the reader is gone.
+// The mapping is private, so writing to a payload doesn't touch the file.
 class FlvReader {
  public:
-  explicit FlvReader(const std::string& filename)
-      : f_(filename, std::ifstream::binary) {}
+  struct SeekPoint {
+    uint32_t timestamp{0};
+    // Offset of the previous tag size field before the tag
+    size_t offset{0};
+  };
 
-  ~FlvReader() {
-    f_.close();
-  }
+  explicit FlvReader(const std::string& filename);
 
   flv::FlvTag readNextTag();
 
+  // Moves the reader to the last seek point at or before timestampMs, or the
+  // first one if there is none, and returns its timestamp.  Seek points are
+  // video key frames, or every tag in a file without video.  Sequence
+  // headers are not replayed, read them before seeking.  Returns none if the
+  // file has no seek points.
+  folly::Optional<uint32_t> seek(uint32_t timestampMs);
+
+  // Built by scanning tag headers on first use
+  const std::vector<SeekPoint>& getSeekIndex();
+
  private:
+  void checkAvailable(size_t n) const;
   uint8_t read1Byte();
   uint32_t read3Bytes();
   uint32_t read4Bytes();
   std::unique_ptr<folly::IOBuf> readBytes(size_t n);
+  void buildSeekIndex();
 
-  std::ifstream f_;
+  std::unique_ptr<folly::IOBuf> file_;
+  size_t offset_{0};
 
   std::unique_ptr<folly::IOBuf> header_;
+  folly::Optional<std::vector<SeekPoint>> seekIndex_;
 };
 
 } // namespace moxygen::flv
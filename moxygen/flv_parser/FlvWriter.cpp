@@ -5,10 +5,39 @@
  */
 
 #include "moxygen/flv_parser/FlvWriter.h"
-#include <netinet/in.h>
+#include <fcntl.h>
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <folly/io/Cursor.h>
+#include <folly/logging/xlog.h>
+#include <climits>
 
 namespace moxygen::flv {
 
+namespace {
+// Headers of a tag are at most 16 bytes, plus the previous tag size
+constexpr size_t kHeaderGrowth = 64;
+} // namespace
+
+FlvWriter::FlvWriter(const std::string& filename, Options options)
+    : options_(options) {
+  int fd = folly::openNoInt(
+      filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    XLOG(ERR) << "Failed to open " << filename
+              << " err=" << folly::errnoStr(errno);
+    return;
+  }
+  file_ = folly::File(fd, /*ownsFd=*/true);
+}
+
+FlvWriter::~FlvWriter() {
+  flush();
+  if (file_ && options_.syncBytes > 0 && unsyncedBytes_ > 0) {
+    folly::fdatasyncNoInt(file_.fd());
+  }
+}
+
 bool FlvWriter::writeTag(FlvTag tag) {
   if (tag.index() == FlvTagTypeIndex::FLV_TAG_INDEX_READCMD) {
     auto readsCmd = std::get<flv::FlvReadCmd>(tag);
@@ -19,7 +48,7 @@ bool FlvWriter::writeTag(FlvTag tag) {
   }
 
   if (!headerWrote_) {
-    f_.write(flvHeader_, sizeof(flvHeader_));
+    pending_.append(flvHeader_, sizeof(flvHeader_));
     uint32_t tagSize = 0x00;
     write4Bytes(tagSize);
     headerWrote_ = true;
@@ -49,8 +78,37 @@ bool FlvWriter::writeTag(FlvTag tag) {
   }
   CHECK(tagSize > 0);
   write4Bytes(tagSize);
-  f_.flush();
 
+  if (pending_.chainLength() < options_.bufferBytes) {
+    return true;
+  }
+  return flush();
+}
+
+bool FlvWriter::flush() {
+  if (pending_.empty()) {
+    return true;
+  }
+  auto chain = pending_.move();
+  if (!file_) {
+    return false;
+  }
+  auto iov = chain->getIov();
+  for (size_t i = 0; i < iov.size(); i += IOV_MAX) {
+    auto count = std::min<size_t>(IOV_MAX, iov.size() - i);
+    if (folly::writevFull(file_.fd(), iov.data() + i, int(count)) < 0) {
+      XLOG(ERR) << "FLV write failed err=" << folly::errnoStr(errno);
+      return false;
+    }
+  }
+  unsyncedBytes_ += chain->computeChainDataLength();
+  if (options_.syncBytes > 0 && unsyncedBytes_ >= options_.syncBytes) {
+    if (folly::fdatasyncNoInt(file_.fd()) != 0) {
+      XLOG(ERR) << "FLV sync failed err=" << folly::errnoStr(errno);
+      return false;
+    }
+    unsyncedBytes_ = 0;
+  }
   return true;
 }
 
@@ -89,35 +147,27 @@ size_t FlvWriter::writeAudioTagHeader(const FlvAudioTag& tagAudio) {
 }
 
 void FlvWriter::write4Bytes(uint32_t v) {
-  auto nv = htonl(v);
-  f_.write(reinterpret_cast<char*>(&nv), 4);
+  folly::io::QueueAppender appender(&pending_, kHeaderGrowth);
+  appender.writeBE<uint32_t>(v);
 }
 
 void FlvWriter::write3Bytes(uint32_t v) {
-  auto nv = htonl(v & 0x00FFFFFF) >> 8;
-  f_.write(reinterpret_cast<char*>(&nv), 3);
+  folly::io::QueueAppender appender(&pending_, kHeaderGrowth);
+  appender.writeBE<uint8_t>((v >> 16) & 0xFF);
+  appender.writeBE<uint16_t>(v & 0xFFFF);
 }
 
 void FlvWriter::writeByte(std::byte b) {
-  f_.write(reinterpret_cast<const char*>(&b), 1);
+  folly::io::QueueAppender appender(&pending_, kHeaderGrowth);
+  appender.writeBE<uint8_t>(static_cast<uint8_t>(b));
 }
 
 size_t FlvWriter::writeIoBuf(std::unique_ptr<folly::IOBuf> buf) {
-  size_t ret = 0;
   CHECK(buf != nullptr);
 
-  // Write all the chain if IOBuf without coalesing
-  const folly::IOBuf* current = buf.get();
-  do {
-    if (current->length() > 0) {
-      f_.write(
-          reinterpret_cast<const char*>(current->data()), current->length());
-      ret += current->length();
-    }
-    current = current->next();
-
-  } while (current != buf.get());
-
+  // The chain is queued as is, without coalescing or copying
+  size_t ret = buf->computeChainDataLength();
+  pending_.append(std::move(buf));
   return ret;
 }
 
@@ -6,23 +6,39 @@
 
 #pragma once
 
+#include <folly/File.h>
 #include <folly/io/IOBuf.h>
-#include <fstream> // std::ofstream
+#include <folly/io/IOBufQueue.h>
 #include "moxygen/flv_parser/FlvCommon.h"
 
 namespace moxygen::flv {
 
+// Tag headers are encoded into a pending queue next to the tag payloads,
+// which are chained rather than copied, and the queue goes to the file with
+// writev.
 class FlvWriter {
  public:
+  struct Options {
+    // Tags are gathered until this many bytes are pending, then written
+    // together.  0 writes each tag as it comes.
+    size_t bufferBytes{0};
+    // Written data is synced to disk every this many bytes, 0 to leave it to
+    // the OS
+    size_t syncBytes{0};
+  };
+
   explicit FlvWriter(const std::string& filename)
-      : f_(filename, std::ofstream::binary) {}
+      : FlvWriter(filename, Options()) {}
+  FlvWriter(const std::string& filename, Options options);
 
-  ~FlvWriter() {
-    f_.close();
-  }
+  ~FlvWriter();
 
+  // Returns false on EOF or if the file can't be written
   bool writeTag(FlvTag tag);
 
+  // Writes the pending tags, returns false if the file can't be written
+  bool flush();
+
  private:
   size_t writeTagHeader(const FlvTagBase& tagBase);
   size_t writeVideoTagHeader(const FlvVideoTag& tagVideo);
@@ -36,7 +52,10 @@ class FlvWriter {
   const char flvHeader_[9] =
       {'F', 'L', 'V', 0x1, 0b00000101, 0x00, 0x00, 0x00, 0x09};
 
-  std::ofstream f_;
+  Options options_;
+  folly::File file_;
+  folly::IOBufQueue pending_{folly::IOBufQueue::cacheChainLength()};
+  size_t unsyncedBytes_{0};
   bool headerWrote_{false};
   bool audioHeaderWritten_{false};
   bool videoHeaderWritten_{false};
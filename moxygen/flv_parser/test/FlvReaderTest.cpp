@@ -96,3 +96,46 @@ TEST(FlvReaderTest, ReadOk) {
       numAudioFrames,
       49); // 48000 / 1024 = 47.6 + rounding + 1 primimng = 49
 }
+
+TEST(FlvReaderTest, PayloadsShareTheMapping) {
+  FlvReader flvr(kTestDir + "/" + kFlvOkTestFilePath);
+  auto tag = flvr.readNextTag();
+  while (tag.index() != FlvTagTypeIndex::FLV_TAG_INDEX_VIDEO) {
+    ASSERT_EQ(tag.index(), FlvTagTypeIndex::FLV_TAG_INDEX_SCRIPT);
+    tag = flvr.readNextTag();
+  }
+  auto& videoTag = std::get<FlvTagTypeIndex::FLV_TAG_INDEX_VIDEO>(tag);
+  ASSERT_NE(videoTag->data, nullptr);
+  EXPECT_TRUE(videoTag->data->isShared());
+  EXPECT_EQ(videoTag->data->computeChainDataLength(), videoTag->size - 5);
+}
+
+TEST(FlvReaderTest, SeekToKeyFrame) {
+  FlvReader flvr(kTestDir + "/" + kFlvOkTestFilePath);
+  const auto& index = flvr.getSeekIndex();
+  // The test file has a single IDR after the AVC sequence header
+  ASSERT_EQ(index.size(), 1u);
+  EXPECT_EQ(index[0].timestamp, 43);
+
+  EXPECT_EQ(flvr.seek(500), 43);
+  auto tag = flvr.readNextTag();
+  ASSERT_EQ(tag.index(), FlvTagTypeIndex::FLV_TAG_INDEX_VIDEO);
+  auto videoTag =
+      std::move(std::get<FlvTagTypeIndex::FLV_TAG_INDEX_VIDEO>(tag));
+  EXPECT_EQ(videoTag->timestamp, 43);
+  EXPECT_EQ(videoTag->frameType, 1);
+  EXPECT_EQ(videoTag->avcPacketType, 1);
+
+  // Before the first seek point goes to the first one
+  EXPECT_EQ(flvr.seek(0), 43);
+  tag = flvr.readNextTag();
+  ASSERT_EQ(tag.index(), FlvTagTypeIndex::FLV_TAG_INDEX_VIDEO);
+  EXPECT_EQ(std::get<FlvTagTypeIndex::FLV_TAG_INDEX_VIDEO>(tag)->timestamp, 43);
+}
+
+TEST(FlvReaderTest, MissingFile) {
+  FlvReader flvr(kTestDir + "/resources/doesNotExist.flv");
+  EXPECT_TRUE(flvr.getSeekIndex().empty());
+  EXPECT_FALSE(flvr.seek(0).has_value());
+  EXPECT_THROW(flvr.readNextTag(), std::runtime_error);
+}
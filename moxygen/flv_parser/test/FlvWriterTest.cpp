@@ -8,8 +8,10 @@
 #include "common/files/FileUtil.h"
 #include "moxygen/flv_parser/FlvReader.h"
 
+#include <folly/FileUtil.h>
 #include <folly/logging/xlog.h>
 #include <folly/portability/GTest.h>
+#include <filesystem>
 
 using namespace moxygen::flv;
 
@@ -160,3 +162,52 @@ TEST_F(FlvWriterTest, WriteOK) {
   readAudioTags.pop_front();
   EXPECT_TRUE(*tagAudioFrame1 == *tagAudioFrame1Read);
 }
+
+TEST_F(FlvWriterTest, BufferedWriteMatchesUnbuffered) {
+  std::string unbufferedPath = dir_ + "/" + "unbuffered.flv";
+  std::string bufferedPath = dir_ + "/" + "buffered.flv";
+  auto writeTags = [](FlvWriter& flvw) {
+    flvw.writeTag(createScriptTag(10, folly::IOBuf::copyBuffer("testScript")));
+    for (uint32_t ts = 0; ts < 100; ts++) {
+      // Payload split across a chain, written without coalescing
+      auto data = folly::IOBuf::copyBuffer("testVideo");
+      data->appendToChain(folly::IOBuf::copyBuffer("Frame"));
+      EXPECT_TRUE(
+          flvw.writeTag(createVideoTag(ts, 2, 7, 1, 0, std::move(data))));
+    }
+  };
+  {
+    FlvWriter flvw(unbufferedPath);
+    writeTags(flvw);
+  }
+  {
+    FlvWriter flvw(bufferedPath, {1 << 20, 4096});
+    writeTags(flvw);
+    // Nothing reaches the file until the buffer fills or it is flushed
+    EXPECT_EQ(std::filesystem::file_size(bufferedPath), 0);
+    EXPECT_TRUE(flvw.flush());
+    EXPECT_GT(std::filesystem::file_size(bufferedPath), 0);
+    flvw.writeTag(
+        createVideoTag(100, 2, 7, 1, 0, folly::IOBuf::copyBuffer("x")));
+  }
+  std::string unbuffered;
+  std::string buffered;
+  ASSERT_TRUE(folly::readFile(unbufferedPath.c_str(), unbuffered));
+  ASSERT_TRUE(folly::readFile(bufferedPath.c_str(), buffered));
+  // The buffered file has one more tag, flushed on destruction
+  ASSERT_GT(buffered.size(), unbuffered.size());
+  EXPECT_EQ(buffered.substr(0, unbuffered.size()), unbuffered);
+
+  FlvReader flvr(bufferedPath);
+  size_t videoTags = 0;
+  while (true) {
+    auto tag = flvr.readNextTag();
+    if (tag.index() == FlvTagTypeIndex::FLV_TAG_INDEX_READCMD) {
+      break;
+    }
+    if (tag.index() == FlvTagTypeIndex::FLV_TAG_INDEX_VIDEO) {
+      videoTags++;
+    }
+  }
+  EXPECT_EQ(videoTags, 101);
+}
@@ -75,7 +75,8 @@ MoQMi::MoqMiItem MoQMi::decodeMoQMi(
   std::unique_ptr<AudioAACMP4LCWCPData> audioAACMP4LCWCPData;
 
   // Parse extensions
-  for (const Extension& ext : obj->extensions) {
+  // obj is ours, so array values are moved out rather than cloned
+  for (Extension& ext : obj->extensions.mutableValues()) {
     // Media type
     if (ext.type ==
         folly::to_underlying(
@@ -118,7 +119,7 @@ MoQMi::MoqMiItem MoQMi::decodeMoQMi(
         // AVCC extradata empty
         return MoQMi::MoqMiReadCmd::MOQMI_ERR;
       }
-      extradata = ext.arrayValue->clone();
+      extradata = std::move(ext.arrayValue);
     }
 
     // Metadata AVCC
@@ -185,41 +186,70 @@ MoQMi::MoqMiItem MoQMi::decodeMoQMi(
   return MoQMi::MoqMiReadCmd::MOQMI_ERR;
 }
 
+folly::Optional<std::chrono::microseconds> MoQMi::keyframeTime(
+    const Extensions& extensions,
+    const folly::IOBuf* payload) noexcept {
+  for (const auto& ext : extensions) {
+    if (ext.type !=
+            folly::to_underlying(
+                HeaderExtensionsTypeIDs::
+                    MOQ_EXT_HEADER_TYPE_MOQMI_VIDEO_H264_IN_AVCC_METADATA) ||
+        !ext.arrayValue) {
+      continue;
+    }
+    if (!VideoH264AVCCWCPData::hasIdr(payload)) {
+      return folly::none;
+    }
+    auto metadata = decodeMoqMiAVCCMetadata(*ext.arrayValue);
+    if (!metadata || metadata->timescale == 0) {
+      return folly::none;
+    }
+    // Split to keep pts * 1000000 from overflowing
+    auto seconds = metadata->pts / metadata->timescale;
+    auto remainder = metadata->pts % metadata->timescale;
+    return std::chrono::microseconds(
+        seconds * 1000000 + remainder * 1000000 / metadata->timescale);
+  }
+  return folly::none;
+}
+
 std::unique_ptr<folly::IOBuf> MoQMi::encodeMoqMiAVCCMetadata(
     const MediaItem& item) noexcept {
-  folly::IOBufQueue buffQueue{folly::IOBufQueue::cacheChainLength()};
+  auto buf = folly::IOBuf::create(6 * kMaxQuicIntSize);
+  folly::io::Appender appender(buf.get(), 0);
   size_t size = 0;
   bool error = false;
 
-  writeVarint(buffQueue, item.id, size, error);
-  writeVarint(buffQueue, item.pts, size, error);
-  writeVarint(buffQueue, item.dts, size, error);
-  writeVarint(buffQueue, item.timescale, size, error);
-  writeVarint(buffQueue, item.duration, size, error);
-  writeVarint(buffQueue, item.wallclock, size, error);
+  writeVarint(appender, item.id, size, error);
+  writeVarint(appender, item.pts, size, error);
+  writeVarint(appender, item.dts, size, error);
+  writeVarint(appender, item.timescale, size, error);
+  writeVarint(appender, item.duration, size, error);
+  writeVarint(appender, item.wallclock, size, error);
   if (error) {
     return nullptr;
   }
-  return buffQueue.move();
+  return buf;
 }
 
 std::unique_ptr<folly::IOBuf> MoQMi::encodeMoqMiAACLCMetadata(
     const MediaItem& item) noexcept {
-  folly::IOBufQueue buffQueue{folly::IOBufQueue::cacheChainLength()};
+  auto buf = folly::IOBuf::create(7 * kMaxQuicIntSize);
+  folly::io::Appender appender(buf.get(), 0);
   size_t size = 0;
   bool error = false;
 
-  writeVarint(buffQueue, item.id, size, error);
-  writeVarint(buffQueue, item.pts, size, error);
-  writeVarint(buffQueue, item.timescale, size, error);
-  writeVarint(buffQueue, item.sampleFreq, size, error);
-  writeVarint(buffQueue, item.numChannels, size, error);
-  writeVarint(buffQueue, item.duration, size, error);
-  writeVarint(buffQueue, item.wallclock, size, error);
+  writeVarint(appender, item.id, size, error);
+  writeVarint(appender, item.pts, size, error);
+  writeVarint(appender, item.timescale, size, error);
+  writeVarint(appender, item.sampleFreq, size, error);
+  writeVarint(appender, item.numChannels, size, error);
+  writeVarint(appender, item.duration, size, error);
+  writeVarint(appender, item.wallclock, size, error);
   if (error) {
     return nullptr;
   }
-  return buffQueue.move();
+  return buf;
 }
 
 std::unique_ptr<MoQMi::VideoH264AVCCWCPData> MoQMi::decodeMoqMiAVCCMetadata(
@@ -302,30 +332,15 @@ std::unique_ptr<MoQMi::AudioAACMP4LCWCPData> MoQMi::decodeMoqMiAACLCMetadata(
       numChannels->first);
 }
 
-void MoQMi::writeBuffer(
-    folly::IOBufQueue& buf,
-    std::unique_ptr<folly::IOBuf> data,
-    size_t& size,
-    bool& error) noexcept {
-  if (error || data == nullptr) {
-    return;
-  }
-  size += data->computeChainDataLength();
-  buf.append(std::move(data));
-}
-
 void MoQMi::writeVarint(
-    folly::IOBufQueue& buf,
+    folly::io::Appender& buf,
     uint64_t value,
     size_t& size,
     bool& error) noexcept {
   if (error) {
     return;
   }
-  folly::io::QueueAppender appender(&buf, MoQMi::kMaxQuicIntSize);
-  auto appenderOp = [appender = std::move(appender)](auto val) mutable {
-    appender.writeBE(val);
-  };
+  auto appenderOp = [&buf](auto val) { buf.writeBE(val); };
   auto res = quic::encodeQuicInteger(value, appenderOp);
   if (res.hasError()) {
     error = true;
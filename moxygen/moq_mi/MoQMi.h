@@ -8,9 +8,9 @@
 
 #include <folly/io/Cursor.h>
 #include <folly/io/IOBuf.h>
-#include <folly/io/IOBufQueue.h>
 #include <gtest/gtest.h>
 #include <moxygen/moq_mi/MediaItem.h>
+#include <chrono>
 #include <cstdint>
 #include <variant>
 #include "moxygen/MoQFramer.h"
@@ -98,33 +98,34 @@ class MoQMi {
         const VideoH264AVCCWCPData& v);
 
     bool isIdr() const {
+      return hasIdr(data.get());
+    }
+
+    static bool hasIdr(const folly::IOBuf* data) {
       bool ret = false;
       // Assuming AVCC 4bytes NALU header
       if (data == nullptr) {
         return ret;
       }
 
-      folly::IOBufQueue queue{folly::IOBufQueue::cacheChainLength()};
-      queue.append(*data);
-      folly::io::Cursor cursor(queue.front());
+      // Walks the chain in place, the frame may span several buffers
+      folly::io::Cursor cursor(data);
 
       // We expect h264 payload to be in AVCC format and the NALUs to be
       // prefixed by 4 bytes field representing length of the NALU
-      int32_t naluLength = 0;
-      while (cursor.canAdvance(sizeof(naluLength)) &&
-             cursor.tryReadBE(naluLength)) {
+      uint32_t naluLength = 0;
+      while (cursor.tryReadBE(naluLength)) {
         if (naluLength == 0 || !cursor.canAdvance(naluLength)) {
           break;
         }
         uint8_t nh = cursor.read<uint8_t>();
-        cursor.retreat(1);
 
         if ((nh & 0x1f) == 5) {
           // IDR
           ret = true;
           break;
         } else {
-          cursor.skip(naluLength);
+          cursor.skip(naluLength - 1);
         }
       }
       return ret;
@@ -164,13 +165,13 @@ class MoQMi {
   };
 
   struct MoqMiObject {
-    std::vector<Extension> extensions;
+    Extensions extensions;
     std::unique_ptr<folly::IOBuf> payload;
     MoqMiObject() : extensions(), payload(nullptr) {}
     explicit MoqMiObject(std::unique_ptr<folly::IOBuf> payload)
         : extensions(), payload(std::move(payload)) {}
     MoqMiObject(
-        std::vector<Extension> extensions,
+        Extensions extensions,
         std::unique_ptr<folly::IOBuf> payload)
         : extensions(std::move(extensions)), payload(std::move(payload)) {}
   };
@@ -192,8 +193,15 @@ class MoQMi {
   static std::unique_ptr<MoqMiObject> encodeToMoQMi(
       std::unique_ptr<MediaItem> item) noexcept;
 
+  // Presentation time of a video object whose payload has an IDR, from its
+  // AVCC metadata extension.  None for any other object.  Fits
+  // MoQCache::Config::keyframeTime.
+  static folly::Optional<std::chrono::microseconds> keyframeTime(
+      const Extensions& extensions,
+      const folly::IOBuf* payload) noexcept;
+
  private:
-  static const size_t kMaxQuicIntSize = 32;
+  static const size_t kMaxQuicIntSize = 8;
 
   static std::unique_ptr<folly::IOBuf> encodeMoqMiAVCCMetadata(
       const MediaItem& item) noexcept;
@@ -205,18 +213,13 @@ class MoQMi {
   static std::unique_ptr<MoQMi::AudioAACMP4LCWCPData> decodeMoqMiAACLCMetadata(
       const folly::IOBuf& extValue) noexcept;
 
+  // Appends to buf, which must have kMaxQuicIntSize bytes of tailroom
   static void writeVarint(
-      folly::IOBufQueue& buf,
+      folly::io::Appender& buf,
       uint64_t value,
       size_t& size,
       bool& error) noexcept;
 
-  static void writeBuffer(
-      folly::IOBufQueue& buf,
-      std::unique_ptr<folly::IOBuf> data,
-      size_t& size,
-      bool& error) noexcept;
-
   FRIEND_TEST(MoQMiTest, EncodeVideoH264TestNoMetadata);
   FRIEND_TEST(MoQMiTest, EncodeVideoH264TestWithMetadata);
   FRIEND_TEST(MoQMiTest, EncodeAudioAAC);
@@ -212,6 +212,8 @@ TEST(MoQMiTest, DecodeVideoH264TestWithExtradata) {
 
   auto obj =
       std::make_unique<MoQMi::MoqMiObject>(extensions, kTestData->clone());
+  auto extradataBuf =
+      obj->extensions[obj->extensions.size() - 1].arrayValue.get();
 
   auto res = MoQMi::decodeMoQMi(std::move(obj));
 
@@ -225,6 +227,8 @@ TEST(MoQMiTest, DecodeVideoH264TestWithExtradata) {
   folly::IOBufEqualTo eq;
   EXPECT_TRUE(eq(std::get<0>(res)->data, kTestData));
   EXPECT_TRUE(eq(std::get<0>(res)->metadata, kTestExtradata));
+  // Extradata is handed over, not copied
+  EXPECT_EQ(std::get<0>(res)->metadata.get(), extradataBuf);
 }
 
 TEST(MoQMiTest, DecodeVideoH264TestNoMetadata) {
@@ -371,6 +375,52 @@ TEST(MoQMi, IsIdr) {
   EXPECT_FALSE(dataVideoNoIdr->isIdr());
 }
 
+TEST(MoQMi, IsIdrChained) {
+  // A non IDR NALU then an IDR NALU, with the second length prefix split
+  // across buffers
+  uint8_t first[6] = {0x00, 0x00, 0x00, 0x02, 0x01, 0xaa};
+  uint8_t second[2] = {0x00, 0x00};
+  uint8_t third[4] = {0x00, 0x02, 0x05, 0xbb};
+  auto data = folly::IOBuf::copyBuffer(first, sizeof(first));
+  data->appendToChain(folly::IOBuf::copyBuffer(second, sizeof(second)));
+  data->appendToChain(folly::IOBuf::copyBuffer(third, sizeof(third)));
+  MoQMi::VideoH264AVCCWCPData video(1, 2, 3, 4, 5, std::move(data), nullptr, 6);
+  EXPECT_TRUE(video.isIdr());
+
+  // Truncated NALU
+  third[1] = 0x03;
+  data = folly::IOBuf::copyBuffer(first, sizeof(first));
+  data->appendToChain(folly::IOBuf::copyBuffer(second, sizeof(second)));
+  data->appendToChain(folly::IOBuf::copyBuffer(third, sizeof(third)));
+  video.data = std::move(data);
+  EXPECT_FALSE(video.isIdr());
+}
+
+TEST(MoQMi, KeyframeTime) {
+  auto makeObject = [](const std::unique_ptr<folly::IOBuf>& data) {
+    return MoQMi::encodeToMoQMi(std::make_unique<moxygen::MediaItem>(
+        data->clone(),
+        nullptr /* metadata */,
+        MediaType::VIDEO,
+        1 /* id */,
+        270000 /* pts*/,
+        270000 /* dts*/,
+        90000 /* timescale */,
+        3000 /* duration */,
+        5 /* wallclock*/,
+        false /* isIDR */,
+        false /* EOF*/));
+  };
+  auto idr = makeObject(kTestVideoDataIDR);
+  auto time = MoQMi::keyframeTime(idr->extensions, idr->payload.get());
+  ASSERT_TRUE(time.has_value());
+  EXPECT_EQ(*time, std::chrono::seconds(3));
+
+  auto noIdr = makeObject(kTestVideoDataNoIDR);
+  EXPECT_FALSE(MoQMi::keyframeTime(noIdr->extensions, noIdr->payload.get()));
+  EXPECT_FALSE(MoQMi::keyframeTime(noExtensions(), idr->payload.get()));
+}
+
 TEST(MoQMi, AscAudioHeader) {
   flv::AscHeaderData expectedAsc = flv::AscHeaderData(2, 48000, 2);
   auto audioData = std::make_unique<MoQMi::AudioAACMP4LCWCPData>(
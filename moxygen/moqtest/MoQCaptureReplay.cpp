@@ -0,0 +1,572 @@
+// (c) Meta Platforms, Inc. and affiliates. Confidential and proprietary.
+
+#include "moxygen/moqtest/MoQCaptureReplay.h"
+#include <folly/coro/Sleep.h>
+#include <folly/coro/WithCancellation.h>
+#include "moxygen/ObjectReceiver.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace moxygen {
+
+namespace {
+using Type = MoQCaptureRecord::Type;
+
+class ReplayFetchHandle : public Publisher::FetchHandle {
+ public:
+  explicit ReplayFetchHandle(FetchOk ok)
+      : Publisher::FetchHandle(std::move(ok)) {}
+  void fetchCancel() override {
+    cancelSource.requestCancellation();
+  }
+  folly::CancellationSource cancelSource;
+};
+
+bool inRange(const MoQCaptureRecord& record, const StandaloneFetch& range) {
+  AbsoluteLocation loc{record.group, record.objectID};
+  return !(loc < range.start) && loc < range.end;
+}
+} // namespace
+
+MoQCaptureIndex::MoQCaptureIndex(std::vector<MoQCaptureRecord> records)
+    : records_(std::move(records)) {
+  bool started = false;
+  uint64_t maxLength = 0;
+  for (const auto& record : records_) {
+    switch (record.type) {
+      case Type::TRACK:
+        trackIDs_[record.fullTrackName] = record.trackID;
+        trackNames_[record.trackID] = record.fullTrackName;
+        break;
+      case Type::SUBSCRIBE:
+      case Type::FETCH:
+        if (!started) {
+          startTime_ = record.time;
+          started = true;
+        }
+        break;
+      case Type::OBJECT:
+        maxLength = std::max(maxLength, record.length);
+        objects_[record.trackID].push_back(&record);
+        break;
+      case Type::SUBGROUP_END:
+        objects_[record.trackID].push_back(&record);
+        break;
+      default:
+        break;
+    }
+  }
+  payload_ = folly::IOBuf::create(maxLength);
+  std::memset(payload_->writableData(), 'r', maxLength);
+  payload_->append(maxLength);
+}
+
+folly::Optional<uint64_t> MoQCaptureIndex::trackID(
+    const FullTrackName& ftn) const {
+  auto it = trackIDs_.find(ftn);
+  if (it == trackIDs_.end()) {
+    return folly::none;
+  }
+  return it->second;
+}
+
+const FullTrackName* MoQCaptureIndex::trackName(uint64_t trackID) const {
+  auto it = trackNames_.find(trackID);
+  return it == trackNames_.end() ? nullptr : &it->second;
+}
+
+const std::vector<const MoQCaptureRecord*>& MoQCaptureIndex::objects(
+    uint64_t trackID) const {
+  static const std::vector<const MoQCaptureRecord*> kNoObjects;
+  auto it = objects_.find(trackID);
+  return it == objects_.end() ? kNoObjects : it->second;
+}
+
+Payload MoQCaptureIndex::payload(uint64_t length) const {
+  auto payload = payload_->clone();
+  payload->trimEnd(payload->length() - length);
+  return payload;
+}
+
+std::chrono::microseconds MoQCaptureClock::now() const {
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - origin_;
+  return startTime_ +
+      std::chrono::duration_cast<std::chrono::microseconds>(elapsed * speed_);
+}
+
+folly::coro::Task<void> MoQCaptureClock::sleepUntil(
+    std::chrono::microseconds time) const {
+  auto at = origin_ +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double, std::micro>(time - startTime_) /
+                speed_);
+  auto wait = at - std::chrono::steady_clock::now();
+  if (wait.count() > 0) {
+    co_await folly::coro::sleep(
+        std::chrono::duration_cast<folly::HighResDuration>(wait));
+  }
+}
+
+MoQCaptureReplayServer::MoQCaptureReplayServer(
+    uint16_t port,
+    std::shared_ptr<const MoQCaptureIndex> capture,
+    double speed)
+    : MoQServer(port, "fake_cert", "fake_key", "fake_endpoint"),
+      capture_(std::move(capture)),
+      clock_(capture_->startTime(), speed) {}
+
+void MoQCaptureReplayServer::terminateClientSession(
+    std::shared_ptr<MoQSession> session) {
+  for (auto& [_, track] : tracks_) {
+    track.forwarder->removeSession(session);
+  }
+}
+
+folly::coro::Task<Publisher::SubscribeResult>
+MoQCaptureReplayServer::subscribe(
+    SubscribeRequest subReq,
+    std::shared_ptr<TrackConsumer> consumer) {
+  auto trackID = capture_->trackID(subReq.fullTrackName);
+  if (!trackID) {
+    co_return folly::makeUnexpected(SubscribeError{
+        subReq.requestID,
+        SubscribeErrorCode::TRACK_NOT_EXIST,
+        "Not in capture"});
+  }
+  if (!clock_.started()) {
+    clock_.start();
+  }
+  auto& track =
+      tracks_.try_emplace(*trackID, subReq.fullTrackName).first->second;
+  if (track.done) {
+    co_return folly::makeUnexpected(SubscribeError{
+        subReq.requestID, SubscribeErrorCode::INVALID_RANGE, "Track ended"});
+  }
+  auto session = MoQSession::getRequestSession();
+  if (!track.playing) {
+    track.playing = true;
+    play(*trackID).scheduleOn(session->getEventBase()).start();
+  }
+  co_return track.forwarder->addSubscriber(
+      std::move(session), subReq, std::move(consumer));
+}
+
+folly::coro::Task<void> MoQCaptureReplayServer::play(uint64_t trackID) {
+  auto& track = tracks_.at(trackID);
+  auto forwarder = track.forwarder;
+  const auto& objects = capture_->objects(trackID);
+  // Objects before the subscribe are gone, like those of a live track
+  auto now = clock_.now();
+  while (track.next < objects.size() && objects[track.next]->time < now) {
+    track.next++;
+  }
+  XLOG(DBG1) << "Capture replay: playing "
+             << forwarder->fullTrackName().trackNamespace << "/"
+             << forwarder->fullTrackName().trackName << " from object "
+             << track.next << " of " << objects.size();
+
+  folly::F14FastMap<
+      std::pair<uint64_t, uint64_t>,
+      std::shared_ptr<SubgroupConsumer>>
+      subgroups;
+  for (; track.next < objects.size(); track.next++) {
+    const auto& record = *objects[track.next];
+    co_await clock_.sleepUntil(record.time);
+    if (record.datagram) {
+      ObjectHeader header(
+          TrackAlias(0),
+          record.group,
+          record.subgroup,
+          record.objectID,
+          record.priority,
+          record.status);
+      Payload payload;
+      if (record.status == ObjectStatus::NORMAL) {
+        header.length = record.length;
+        payload = capture_->payload(record.length);
+      }
+      forwarder->datagram(header, std::move(payload));
+      continue;
+    }
+    if (record.status == ObjectStatus::GROUP_NOT_EXIST) {
+      forwarder->groupNotExists(
+          record.group, record.subgroup, record.priority, noExtensions());
+      continue;
+    }
+
+    auto key = std::make_pair(record.group, record.subgroup);
+    auto it = subgroups.find(key);
+    if (record.type == Type::SUBGROUP_END) {
+      if (it != subgroups.end()) {
+        it->second->endOfSubgroup();
+        subgroups.erase(it);
+      }
+      continue;
+    }
+    if (it == subgroups.end()) {
+      auto subgroup = forwarder->beginSubgroup(
+          record.group, record.subgroup, record.priority);
+      if (subgroup.hasError()) {
+        XLOG(DBG1) << "Capture replay: beginSubgroup failed err="
+                   << subgroup.error().what();
+        continue;
+      }
+      it = subgroups.emplace(key, std::move(subgroup.value())).first;
+    }
+    auto& subgroup = it->second;
+    switch (record.status) {
+      case ObjectStatus::NORMAL:
+        subgroup->object(
+            record.objectID, capture_->payload(record.length), noExtensions());
+        break;
+      case ObjectStatus::OBJECT_NOT_EXIST:
+        subgroup->objectNotExists(record.objectID, noExtensions());
+        break;
+      case ObjectStatus::END_OF_GROUP:
+        subgroup->endOfGroup(record.objectID, noExtensions());
+        subgroups.erase(it);
+        break;
+      case ObjectStatus::END_OF_TRACK:
+        subgroup->endOfTrackAndGroup(record.objectID, noExtensions());
+        subgroups.erase(it);
+        break;
+      default:
+        break;
+    }
+  }
+
+  for (auto& [_, subgroup] : subgroups) {
+    subgroup->endOfSubgroup();
+  }
+  track.playing = false;
+  track.done = true;
+  forwarder->subscribeDone(SubscribeDone{
+      RequestID(0), SubscribeDoneStatusCode::TRACK_ENDED, 0, "Capture ended"});
+}
+
+folly::coro::Task<Publisher::FetchResult> MoQCaptureReplayServer::fetch(
+    Fetch fetch,
+    std::shared_ptr<FetchConsumer> consumer) {
+  auto [standalone, joining] = fetchType(fetch);
+  if (!standalone) {
+    co_return folly::makeUnexpected(FetchError{
+        fetch.requestID,
+        FetchErrorCode::NOT_SUPPORTED,
+        "Joining fetch not supported"});
+  }
+  auto trackID = capture_->trackID(fetch.fullTrackName);
+  if (!trackID) {
+    co_return folly::makeUnexpected(FetchError{
+        fetch.requestID, FetchErrorCode::TRACK_NOT_EXIST, "Not in capture"});
+  }
+  if (!clock_.started()) {
+    clock_.start();
+  }
+
+  auto now = clock_.now();
+  std::vector<const MoQCaptureRecord*> objects;
+  for (const auto* record : capture_->objects(*trackID)) {
+    if (record->time > now) {
+      break;
+    }
+    if (record->type == Type::OBJECT && inRange(*record, *standalone)) {
+      objects.push_back(record);
+    }
+  }
+  if (objects.empty()) {
+    co_return folly::makeUnexpected(FetchError{
+        fetch.requestID, FetchErrorCode::NO_OBJECTS, "No objects"});
+  }
+  auto groupOrder = MoQSession::resolveGroupOrder(
+      GroupOrder::OldestFirst, fetch.groupOrder);
+  std::stable_sort(
+      objects.begin(), objects.end(), [groupOrder](auto* a, auto* b) {
+        if (a->group != b->group) {
+          return groupOrder == GroupOrder::NewestFirst ? a->group > b->group
+                                                       : a->group < b->group;
+        }
+        return a->objectID < b->objectID;
+      });
+  const auto* last = objects.back();
+  auto fetchHandle = std::make_shared<ReplayFetchHandle>(FetchOk{
+      fetch.requestID,
+      groupOrder,
+      last->status == ObjectStatus::END_OF_TRACK,
+      AbsoluteLocation{last->group, last->objectID},
+      {}});
+  auto session = MoQSession::getRequestSession();
+  folly::coro::co_withCancellation(
+      fetchHandle->cancelSource.getToken(),
+      serveFetch(std::move(objects), std::move(consumer)))
+      .scheduleOn(session->getEventBase())
+      .start();
+  co_return fetchHandle;
+}
+
+folly::coro::Task<void> MoQCaptureReplayServer::serveFetch(
+    std::vector<const MoQCaptureRecord*> objects,
+    std::shared_ptr<FetchConsumer> consumer) {
+  auto token = co_await folly::coro::co_current_cancellation_token;
+  for (const auto* record : objects) {
+    if (token.isCancellationRequested()) {
+      consumer->reset(ResetStreamErrorCode::CANCELLED);
+      co_return;
+    }
+    folly::Expected<folly::Unit, MoQPublishError> res{folly::unit};
+    switch (record->status) {
+      case ObjectStatus::NORMAL:
+        res = consumer->object(
+            record->group,
+            record->subgroup,
+            record->objectID,
+            capture_->payload(record->length));
+        break;
+      case ObjectStatus::OBJECT_NOT_EXIST:
+        res = consumer->objectNotExists(
+            record->group, record->subgroup, record->objectID);
+        break;
+      case ObjectStatus::GROUP_NOT_EXIST:
+        res = consumer->groupNotExists(record->group, record->subgroup);
+        break;
+      case ObjectStatus::END_OF_GROUP:
+        res = consumer->endOfGroup(
+            record->group, record->subgroup, record->objectID);
+        break;
+      case ObjectStatus::END_OF_TRACK:
+        // Implies endOfFetch
+        consumer->endOfTrackAndGroup(
+            record->group, record->subgroup, record->objectID);
+        co_return;
+      default:
+        break;
+    }
+    if (res.hasError()) {
+      if (res.error().code != MoQPublishError::BLOCKED) {
+        XLOG(DBG1) << "Capture replay: fetch error=" << res.error().what();
+        consumer->reset(ResetStreamErrorCode::INTERNAL_ERROR);
+        co_return;
+      }
+      auto ready = consumer->awaitReadyToConsume();
+      if (ready.hasError()) {
+        consumer->reset(ResetStreamErrorCode::INTERNAL_ERROR);
+        co_return;
+      }
+      co_await std::move(ready.value());
+    }
+  }
+  consumer->endOfFetch();
+}
+
+class MoQCaptureReplayClient::Receiver : public ObjectReceiverCallback {
+ public:
+  explicit Receiver(Stats& stats) : stats_(stats) {}
+
+  FlowControlState onObject(const ObjectHeader&, Payload payload) override {
+    stats_.objects++;
+    if (payload) {
+      stats_.bytes += payload->computeChainDataLength();
+    }
+    return FlowControlState::UNBLOCKED;
+  }
+  void onObjectStatus(const ObjectHeader&) override {}
+  void onEndOfStream() override {}
+  void onError(ResetStreamErrorCode error) override {
+    XLOG(DBG1) << "Capture replay: stream error="
+               << folly::to_underlying(error);
+  }
+  void onSubscribeDone(SubscribeDone) override {}
+
+ private:
+  Stats& stats_;
+};
+
+MoQCaptureReplayClient::MoQCaptureReplayClient(
+    folly::EventBase* evb,
+    proxygen::URL url,
+    std::shared_ptr<const MoQCaptureIndex> capture,
+    double speed,
+    std::chrono::milliseconds connectTimeout,
+    std::chrono::milliseconds transactionTimeout)
+    : evb_(evb),
+      url_(std::move(url)),
+      capture_(std::move(capture)),
+      clock_(capture_->startTime(), speed),
+      connectTimeout_(connectTimeout),
+      transactionTimeout_(transactionTimeout),
+      receiver_(std::make_shared<Receiver>(stats_)) {}
+
+folly::coro::Task<void> MoQCaptureReplayClient::run() {
+  clock_.start();
+  for (const auto& record : capture_->records()) {
+    if (record.type != Type::SUBSCRIBE && record.type != Type::SUBSCRIBE_END &&
+        record.type != Type::FETCH && record.type != Type::SESSION_END) {
+      continue;
+    }
+    co_await clock_.sleepUntil(record.time);
+    if (record.type == Type::SESSION_END) {
+      auto it = sessions_.find(record.sessionID);
+      if (it != sessions_.end()) {
+        close(*it->second);
+        sessions_.erase(it);
+      }
+      continue;
+    }
+    auto session = getSession(record.sessionID);
+    switch (record.type) {
+      case Type::SUBSCRIBE:
+        subscribe(std::move(session), record).scheduleOn(evb_).start();
+        break;
+      case Type::FETCH:
+        fetch(std::move(session), record).scheduleOn(evb_).start();
+        break;
+      case Type::SUBSCRIBE_END:
+        unsubscribe(*session, record.requestID);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+void MoQCaptureReplayClient::stop() {
+  for (auto& [_, session] : sessions_) {
+    close(*session);
+  }
+  sessions_.clear();
+}
+
+std::shared_ptr<MoQCaptureReplayClient::Session>
+MoQCaptureReplayClient::getSession(uint64_t sessionID) {
+  auto& session = sessions_[sessionID];
+  if (!session) {
+    session = std::make_shared<Session>();
+    session->client = std::make_unique<MoQClient>(evb_, url_);
+    stats_.sessions++;
+    connect(session).scheduleOn(evb_).start();
+  }
+  return session;
+}
+
+folly::coro::Task<void> MoQCaptureReplayClient::connect(
+    std::shared_ptr<Session> session) {
+  try {
+    co_await session->client->setupMoQSession(
+        connectTimeout_,
+        transactionTimeout_,
+        /*publishHandler=*/nullptr,
+        /*subscribeHandler=*/nullptr);
+  } catch (const std::exception& ex) {
+    XLOG(ERR) << "Capture replay: connect failed err=" << ex.what();
+    stats_.connectErrors++;
+    session->failed = true;
+  }
+  session->connected.setValue(folly::unit);
+}
+
+folly::coro::Task<void> MoQCaptureReplayClient::subscribe(
+    std::shared_ptr<Session> session,
+    const MoQCaptureRecord& record) {
+  co_await session->connected.getFuture();
+  if (session->failed || session->closed ||
+      session->ended.erase(record.requestID)) {
+    co_return;
+  }
+  const auto* ftn = capture_->trackName(record.trackID);
+  if (!ftn) {
+    stats_.requestErrors++;
+    co_return;
+  }
+  SubscribeRequest sub;
+  sub.requestID = 0;
+  sub.trackAlias = TrackAlias(0);
+  sub.fullTrackName = *ftn;
+  sub.priority = record.priority;
+  sub.groupOrder = GroupOrder::OldestFirst;
+  sub.forward = record.forward;
+  sub.locType = record.locType;
+  if (record.locType == LocationType::AbsoluteStart ||
+      record.locType == LocationType::AbsoluteRange) {
+    sub.start = record.start;
+  }
+  sub.endGroup = record.end.group;
+  stats_.subscribes++;
+  auto res = co_await session->client->moqSession_->subscribe(
+      sub,
+      std::make_shared<ObjectReceiver>(ObjectReceiver::SUBSCRIBE, receiver_));
+  if (res.hasError()) {
+    XLOG(DBG1) << "Capture replay: subscribe failed err="
+               << res.error().reasonPhrase;
+    stats_.requestErrors++;
+    co_return;
+  }
+  if (session->closed || session->ended.erase(record.requestID)) {
+    res.value()->unsubscribe();
+    co_return;
+  }
+  session->subscriptions[record.requestID] = std::move(res.value());
+}
+
+folly::coro::Task<void> MoQCaptureReplayClient::fetch(
+    std::shared_ptr<Session> session,
+    const MoQCaptureRecord& record) {
+  co_await session->connected.getFuture();
+  if (session->failed || session->closed) {
+    co_return;
+  }
+  const auto* ftn = capture_->trackName(record.trackID);
+  if (!ftn) {
+    stats_.requestErrors++;
+    co_return;
+  }
+  stats_.fetches++;
+  auto res = co_await session->client->moqSession_->fetch(
+      Fetch(
+          0,
+          *ftn,
+          record.start,
+          record.end,
+          kDefaultPriority,
+          GroupOrder::OldestFirst),
+      std::make_shared<ObjectReceiver>(ObjectReceiver::FETCH, receiver_));
+  if (res.hasError()) {
+    XLOG(DBG1) << "Capture replay: fetch failed err="
+               << res.error().reasonPhrase;
+    stats_.requestErrors++;
+    co_return;
+  }
+  if (session->closed) {
+    res.value()->fetchCancel();
+    co_return;
+  }
+  session->fetches[record.requestID] = std::move(res.value());
+}
+
+void MoQCaptureReplayClient::unsubscribe(Session& session, uint64_t requestID) {
+  auto it = session.subscriptions.find(requestID);
+  if (it == session.subscriptions.end()) {
+    // Still subscribing
+    session.ended.insert(requestID);
+    return;
+  }
+  it->second->unsubscribe();
+  session.subscriptions.erase(it);
+}
+
+void MoQCaptureReplayClient::close(Session& session) {
+  session.closed = true;
+  for (auto& [_, subscription] : session.subscriptions) {
+    subscription->unsubscribe();
+  }
+  session.subscriptions.clear();
+  for (auto& [_, fetch] : session.fetches) {
+    fetch->fetchCancel();
+  }
+  session.fetches.clear();
+  if (session.client->moqSession_) {
+    session.client->moqSession_->close(SessionCloseErrorCode::NO_ERROR);
+  }
+}
+
+} // namespace moxygen
@@ -0,0 +1,205 @@
+// (c) Meta Platforms, Inc. and affiliates. Confidential and proprietary.
+
+#pragma once
+
+#include <folly/container/F14Map.h>
+#include <folly/container/F14Set.h>
+#include <folly/coro/SharedPromise.h>
+#include "moxygen/MoQCapture.h"
+#include "moxygen/MoQClient.h"
+#include "moxygen/MoQServer.h"
+#include "moxygen/Publisher.h"
+#include "moxygen/relay/MoQForwarder.h"
+
+namespace moxygen {
+
+/*
+ * Replays a capture written by a relay, see MoQCapture.h, against another
+ * relay.  MoQCaptureReplayServer stands in for the upstream publishers and
+ * MoQCaptureReplayClient for the downstream sessions, so the relay under test
+ * sees the captured requests and objects with their captured timing, divided
+ * by a speedup.  Payloads are synthetic bytes of the captured lengths, so
+ * two replays of one capture send identical objects.
+ *
+ * The capture's timeline starts at its first SUBSCRIBE or FETCH.  The client
+ * starts it when run() is called, the server when it gets its first request.
+ */
+class MoQCaptureIndex {
+ public:
+  explicit MoQCaptureIndex(std::vector<MoQCaptureRecord> records);
+
+  const std::vector<MoQCaptureRecord>& records() const {
+    return records_;
+  }
+
+  folly::Optional<uint64_t> trackID(const FullTrackName& ftn) const;
+  const FullTrackName* trackName(uint64_t trackID) const;
+
+  // OBJECT and SUBGROUP_END records of a track, in capture order
+  const std::vector<const MoQCaptureRecord*>& objects(uint64_t trackID) const;
+
+  std::chrono::microseconds startTime() const {
+    return startTime_;
+  }
+
+  // A payload of length bytes, shared by every object
+  Payload payload(uint64_t length) const;
+
+ private:
+  std::vector<MoQCaptureRecord> records_;
+  folly::F14FastMap<FullTrackName, uint64_t, FullTrackName::hash> trackIDs_;
+  folly::F14FastMap<uint64_t, FullTrackName> trackNames_;
+  folly::F14FastMap<uint64_t, std::vector<const MoQCaptureRecord*>> objects_;
+  std::chrono::microseconds startTime_{0};
+  std::unique_ptr<folly::IOBuf> payload_;
+};
+
+// Maps capture times to steady_clock times once started
+class MoQCaptureClock {
+ public:
+  MoQCaptureClock(std::chrono::microseconds startTime, double speed)
+      : startTime_(startTime), speed_(speed) {}
+
+  void start() {
+    origin_ = std::chrono::steady_clock::now();
+    started_ = true;
+  }
+
+  bool started() const {
+    return started_;
+  }
+
+  // The capture time playback has reached
+  std::chrono::microseconds now() const;
+
+  folly::coro::Task<void> sleepUntil(std::chrono::microseconds time) const;
+
+ private:
+  std::chrono::microseconds startTime_;
+  double speed_;
+  std::chrono::steady_clock::time_point origin_;
+  bool started_{false};
+};
+
+// Publishes every track in a capture.  A track starts playing at its first
+// subscriber, from the current point of the timeline, and ends with the
+// capture.  Runs on one worker thread, every session shares its EventBase.
+class MoQCaptureReplayServer
+    : public Publisher,
+      public MoQServer,
+      public std::enable_shared_from_this<MoQCaptureReplayServer> {
+ public:
+  MoQCaptureReplayServer(
+      uint16_t port,
+      std::shared_ptr<const MoQCaptureIndex> capture,
+      double speed);
+
+  void onNewSession(std::shared_ptr<MoQSession> clientSession) override {
+    clientSession->setPublishHandler(shared_from_this());
+  }
+
+  void terminateClientSession(std::shared_ptr<MoQSession> session) override;
+
+  folly::coro::Task<SubscribeResult> subscribe(
+      SubscribeRequest subReq,
+      std::shared_ptr<TrackConsumer> consumer) override;
+
+  // Serves the objects of the range the track has already played
+  folly::coro::Task<FetchResult> fetch(
+      Fetch fetch,
+      std::shared_ptr<FetchConsumer> consumer) override;
+
+ private:
+  struct Track {
+    explicit Track(FullTrackName ftn)
+        : forwarder(std::make_shared<MoQForwarder>(std::move(ftn))) {}
+    std::shared_ptr<MoQForwarder> forwarder;
+    bool playing{false};
+    bool done{false};
+    // Index of the next object to play
+    size_t next{0};
+  };
+
+  folly::coro::Task<void> play(uint64_t trackID);
+  folly::coro::Task<void> serveFetch(
+      std::vector<const MoQCaptureRecord*> objects,
+      std::shared_ptr<FetchConsumer> consumer);
+
+  std::shared_ptr<const MoQCaptureIndex> capture_;
+  MoQCaptureClock clock_;
+  // Stable references, play() holds its Track across suspensions
+  folly::F14NodeMap<uint64_t, Track> tracks_;
+};
+
+// Issues the requests of a capture, one session for each captured session,
+// connected at its first request and closed at its SESSION_END.  Objects
+// received are counted but not validated.
+class MoQCaptureReplayClient {
+ public:
+  struct Stats {
+    uint64_t sessions{0};
+    uint64_t connectErrors{0};
+    uint64_t subscribes{0};
+    uint64_t fetches{0};
+    uint64_t requestErrors{0};
+    uint64_t objects{0};
+    uint64_t bytes{0};
+  };
+
+  MoQCaptureReplayClient(
+      folly::EventBase* evb,
+      proxygen::URL url,
+      std::shared_ptr<const MoQCaptureIndex> capture,
+      double speed,
+      std::chrono::milliseconds connectTimeout,
+      std::chrono::milliseconds transactionTimeout);
+
+  // Returns after the last captured request has been issued
+  folly::coro::Task<void> run();
+
+  // Closes every open session
+  void stop();
+
+  const Stats& getStats() const {
+    return stats_;
+  }
+
+ private:
+  class Receiver;
+  struct Session {
+    std::unique_ptr<MoQClient> client;
+    folly::coro::SharedPromise<folly::Unit> connected;
+    bool failed{false};
+    bool closed{false};
+    // By captured request ID
+    folly::F14FastMap<uint64_t, std::shared_ptr<Publisher::SubscriptionHandle>>
+        subscriptions;
+    folly::F14FastMap<uint64_t, std::shared_ptr<Publisher::FetchHandle>>
+        fetches;
+    // Captured request IDs that ended before their subscribe returned
+    folly::F14FastSet<uint64_t> ended;
+  };
+
+  std::shared_ptr<Session> getSession(uint64_t sessionID);
+  folly::coro::Task<void> connect(std::shared_ptr<Session> session);
+  folly::coro::Task<void> subscribe(
+      std::shared_ptr<Session> session,
+      const MoQCaptureRecord& record);
+  folly::coro::Task<void> fetch(
+      std::shared_ptr<Session> session,
+      const MoQCaptureRecord& record);
+  void unsubscribe(Session& session, uint64_t requestID);
+  void close(Session& session);
+
+  folly::EventBase* evb_;
+  proxygen::URL url_;
+  std::shared_ptr<const MoQCaptureIndex> capture_;
+  MoQCaptureClock clock_;
+  std::chrono::milliseconds connectTimeout_;
+  std::chrono::milliseconds transactionTimeout_;
+  std::shared_ptr<Receiver> receiver_;
+  folly::F14FastMap<uint64_t, std::shared_ptr<Session>> sessions_;
+  Stats stats_;
+};
+
+} // namespace moxygen
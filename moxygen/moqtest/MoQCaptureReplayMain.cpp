@@ -0,0 +1,79 @@
+// (c) Meta Platforms, Inc. and affiliates. Confidential and proprietary.
+
+#include <folly/coro/BlockingWait.h>
+#include "folly/init/Init.h"
+#include "folly/io/async/ScopedEventBaseThread.h"
+#include "moxygen/moqtest/MoQCaptureReplay.h"
+
+#include <thread>
+
+DEFINE_string(capture, "", "Capture file written by moqrelayserver");
+DEFINE_string(
+    mode,
+    "client",
+    "server: publish the captured tracks, client: issue the captured requests");
+DEFINE_double(speed, 1.0, "Replay speed, 2 replays twice as fast");
+DEFINE_int32(port, 9999, "Port to listen on in server mode");
+DEFINE_string(url, "http://localhost:9999", "URL to connect to in client mode");
+DEFINE_int32(connect_timeout, 1000, "Connect timeout (ms)");
+DEFINE_int32(transaction_timeout, 1000, "Transaction timeout (ms)");
+DEFINE_int32(
+    linger_s,
+    5,
+    "Seconds to keep sessions open after the last request in client mode");
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  folly::Init init(&argc, &argv);
+
+  auto records = moxygen::readCapture(FLAGS_capture);
+  if (records.hasError()) {
+    XLOG(ERR) << "Failed to read capture " << FLAGS_capture
+              << " err=" << records.error().what();
+    return 1;
+  }
+  if (FLAGS_speed <= 0) {
+    XLOG(ERR) << "--speed must be positive";
+    return 1;
+  }
+  XLOG(INFO) << "Replaying " << records->size() << " records at "
+             << FLAGS_speed << "x";
+  auto capture =
+      std::make_shared<const moxygen::MoQCaptureIndex>(std::move(*records));
+
+  if (FLAGS_mode == "server") {
+    auto server = std::make_shared<moxygen::MoQCaptureReplayServer>(
+        FLAGS_port, std::move(capture), FLAGS_speed);
+    std::cout << "\nEnter anything to exit." << std::endl;
+    std::string input;
+    std::getline(std::cin, input);
+    std::cout << "\nExiting." << std::endl;
+    return 0;
+  }
+  if (FLAGS_mode != "client") {
+    XLOG(ERR) << "Unknown --mode=" << FLAGS_mode;
+    return 1;
+  }
+
+  folly::ScopedEventBaseThread evb;
+  moxygen::MoQCaptureReplayClient client(
+      evb.getEventBase(),
+      proxygen::URL(FLAGS_url),
+      std::move(capture),
+      FLAGS_speed,
+      std::chrono::milliseconds(FLAGS_connect_timeout),
+      std::chrono::milliseconds(FLAGS_transaction_timeout));
+  folly::coro::blockingWait(client.run().scheduleOn(evb.getEventBase()));
+  std::this_thread::sleep_for(std::chrono::seconds(FLAGS_linger_s));
+  evb.getEventBase()->runInEventBaseThreadAndWait([&client] {
+    client.stop();
+    const auto& stats = client.getStats();
+    XLOG(INFO) << "Capture replay: sessions=" << stats.sessions
+               << " connectErrors=" << stats.connectErrors
+               << " subscribes=" << stats.subscribes
+               << " fetches=" << stats.fetches
+               << " requestErrors=" << stats.requestErrors
+               << " objects=" << stats.objects << " bytes=" << stats.bytes;
+  });
+  return 0;
+}
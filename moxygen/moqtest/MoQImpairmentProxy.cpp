@@ -0,0 +1,203 @@
+// (c) Meta Platforms, Inc. and affiliates. Confidential and proprietary.
+
+#include "moxygen/moqtest/MoQImpairmentProxy.h"
+#include <folly/logging/xlog.h>
+
+#include <algorithm>
+
+namespace moxygen {
+
+namespace {
+// Larger than any QUIC packet, GSO is not enabled on the proxy sockets
+constexpr size_t kMaxPacketSize = 4096;
+} // namespace
+
+// Forwards packets of one client to the server from its own socket, so the
+// server sees one address per client, and packets back through the proxy
+class MoQImpairmentProxy::Flow : public folly::AsyncUDPSocket::ReadCallback {
+ public:
+  Flow(MoQImpairmentProxy& proxy, folly::SocketAddress client)
+      : proxy_(proxy), client_(std::move(client)), socket_(proxy.evb_) {
+    folly::SocketAddress any;
+    any.setFromIpPort(
+        proxy_.serverAddress_.getFamily() == AF_INET6 ? "::" : "0.0.0.0", 0);
+    socket_.bind(any);
+    socket_.resumeRead(this);
+  }
+
+  ~Flow() override {
+    socket_.pauseRead();
+    socket_.close();
+  }
+
+  void send(std::unique_ptr<folly::IOBuf> buf) {
+    socket_.write(proxy_.serverAddress_, buf);
+  }
+
+  void getReadBuffer(void** buf, size_t* len) noexcept override {
+    readBuf_ = folly::IOBuf::create(kMaxPacketSize);
+    *buf = readBuf_->writableData();
+    *len = kMaxPacketSize;
+  }
+
+  void onDataAvailable(
+      const folly::SocketAddress&,
+      size_t len,
+      bool truncated,
+      OnDataAvailableParams) noexcept override {
+    if (truncated) {
+      return;
+    }
+    readBuf_->append(len);
+    proxy_.impair(
+        proxy_.down_,
+        std::move(readBuf_),
+        [this](std::unique_ptr<folly::IOBuf> buf) {
+          proxy_.socket_.write(client_, buf);
+        });
+  }
+
+  void onReadError(const folly::AsyncSocketException& ex) noexcept override {
+    XLOG(ERR) << "Impairment proxy: read error from server err=" << ex.what();
+  }
+
+  void onReadClosed() noexcept override {}
+
+ private:
+  MoQImpairmentProxy& proxy_;
+  folly::SocketAddress client_;
+  folly::AsyncUDPSocket socket_;
+  std::unique_ptr<folly::IOBuf> readBuf_;
+};
+
+MoQImpairmentProxy::MoQImpairmentProxy(
+    folly::EventBase* evb,
+    const folly::SocketAddress& listenAddress,
+    folly::SocketAddress serverAddress,
+    MoQImpairmentConfig config)
+    : evb_(evb),
+      serverAddress_(std::move(serverAddress)),
+      config_(config),
+      socket_(evb),
+      timer_(folly::HHWheelTimerHighRes::newTimer(
+          evb,
+          std::chrono::microseconds(100))),
+      rng_(config.seed) {
+  socket_.bind(listenAddress);
+  socket_.resumeRead(this);
+}
+
+MoQImpairmentProxy::~MoQImpairmentProxy() {
+  // Pending deliveries refer to the flows
+  timer_->cancelAll();
+  flows_.clear();
+  socket_.pauseRead();
+  socket_.close();
+}
+
+void MoQImpairmentProxy::getReadBuffer(void** buf, size_t* len) noexcept {
+  readBuf_ = folly::IOBuf::create(kMaxPacketSize);
+  *buf = readBuf_->writableData();
+  *len = kMaxPacketSize;
+}
+
+void MoQImpairmentProxy::onDataAvailable(
+    const folly::SocketAddress& client,
+    size_t len,
+    bool truncated,
+    OnDataAvailableParams) noexcept {
+  if (truncated) {
+    return;
+  }
+  readBuf_->append(len);
+  auto& flow = flows_[client];
+  if (!flow) {
+    XLOG(DBG1) << "Impairment proxy: new client " << client.describe();
+    flow = std::make_unique<Flow>(*this, client);
+  }
+  impair(
+      up_,
+      std::move(readBuf_),
+      [flow = flow.get()](std::unique_ptr<folly::IOBuf> buf) {
+        flow->send(std::move(buf));
+      });
+}
+
+void MoQImpairmentProxy::onReadError(
+    const folly::AsyncSocketException& ex) noexcept {
+  XLOG(ERR) << "Impairment proxy: read error from client err=" << ex.what();
+}
+
+bool MoQImpairedLink::chance(double percent) {
+  if (percent <= 0) {
+    return false;
+  }
+  return std::uniform_real_distribution<double>(0, 100)(rng_) < percent;
+}
+
+folly::Optional<MoQImpairedLink::TimePoint> MoQImpairedLink::deliveryTime(
+    uint64_t size,
+    TimePoint now) {
+  if (chance(config_.lossPercent)) {
+    stats_.lost++;
+    return folly::none;
+  }
+
+  auto departure = now;
+  if (config_.bandwidthBps > 0) {
+    auto start = std::max(now, busyUntil_);
+    double queuedBytes = std::chrono::duration<double>(start - now).count() *
+        config_.bandwidthBps / 8;
+    if (queuedBytes + size > config_.queueBytes) {
+      stats_.queueDrops++;
+      return folly::none;
+    }
+    busyUntil_ = start +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                     std::chrono::duration<double>(
+                         double(size) * 8 / config_.bandwidthBps));
+    departure = busyUntil_;
+  }
+
+  auto delivery = departure + config_.rtt / 2;
+  if (config_.jitter.count() > 0) {
+    auto jitterUs =
+        std::chrono::duration_cast<std::chrono::microseconds>(config_.jitter);
+    delivery += std::chrono::microseconds(
+        std::uniform_int_distribution<int64_t>(0, jitterUs.count())(rng_));
+  }
+  if (chance(config_.reorderPercent)) {
+    delivery += config_.reorderDelay;
+    stats_.reordered++;
+  } else {
+    delivery = std::max(delivery, lastDelivery_);
+    lastDelivery_ = delivery;
+  }
+  stats_.packets++;
+  stats_.bytes += size;
+  return delivery;
+}
+
+void MoQImpairmentProxy::impair(
+    MoQImpairedLink& link,
+    std::unique_ptr<folly::IOBuf> buf,
+    folly::Function<void(std::unique_ptr<folly::IOBuf>)> send) {
+  auto now = std::chrono::steady_clock::now();
+  auto delivery = link.deliveryTime(buf->computeChainDataLength(), now);
+  if (!delivery) {
+    return;
+  }
+  // Rounded up, a packet may leave late by under a tick but never early
+  auto delay = std::chrono::ceil<std::chrono::microseconds>(*delivery - now);
+  if (delay.count() <= 0) {
+    send(std::move(buf));
+    return;
+  }
+  timer_->scheduleTimeoutFn(
+      [send = std::move(send), buf = std::move(buf)]() mutable {
+        send(std::move(buf));
+      },
+      delay);
+}
+
+} // namespace moxygen
@@ -0,0 +1,140 @@
+// (c) Meta Platforms, Inc. and affiliates. Confidential and proprietary.
+
+#pragma once
+
+#include <folly/Optional.h>
+#include <folly/SocketAddress.h>
+#include <folly/container/F14Map.h>
+#include <folly/io/async/AsyncUDPSocket.h>
+#include <folly/io/async/HHWheelTimer.h>
+
+#include <chrono>
+#include <random>
+
+namespace moxygen {
+
+struct MoQImpairmentConfig {
+  // Bits per second in each direction, 0 for unlimited
+  uint64_t bandwidthBps{0};
+  // Bytes that can wait behind the bandwidth cap before packets are dropped
+  uint64_t queueBytes{64 * 1024};
+  // Split evenly between the two directions
+  std::chrono::milliseconds rtt{0};
+  // Extra one way delay, uniform in [0, jitter].  Packets stay in order.
+  std::chrono::milliseconds jitter{0};
+  double lossPercent{0};
+  // Packets held back by reorderDelay, letting later packets pass them
+  double reorderPercent{0};
+  std::chrono::milliseconds reorderDelay{10};
+  uint32_t seed{1};
+};
+
+/*
+ * One direction of an impaired path.  Decides, for each packet as it
+ * arrives, when it is delivered or that it is dropped.  Times are kept to
+ * the clock's resolution, unrounded.
+ */
+class MoQImpairedLink {
+ public:
+  using TimePoint = std::chrono::steady_clock::time_point;
+
+  struct Stats {
+    uint64_t packets{0};
+    uint64_t bytes{0};
+    uint64_t lost{0};
+    uint64_t queueDrops{0};
+    uint64_t reordered{0};
+  };
+
+  // config and rng must outlive the link, rng may be shared between links
+  MoQImpairedLink(const MoQImpairmentConfig& config, std::mt19937& rng)
+      : config_(config), rng_(rng) {}
+
+  // When a packet of size bytes that arrived at now is delivered, none if
+  // it is dropped
+  folly::Optional<TimePoint> deliveryTime(uint64_t size, TimePoint now);
+
+  const Stats& stats() const {
+    return stats_;
+  }
+
+ private:
+  bool chance(double percent);
+
+  const MoQImpairmentConfig& config_;
+  std::mt19937& rng_;
+  Stats stats_;
+  // When the bottleneck finishes sending what is queued
+  TimePoint busyUntil_;
+  TimePoint lastDelivery_;
+};
+
+/*
+ * A UDP proxy that emulates a network path between QUIC clients and a
+ * server: a bandwidth cap with a drop tail queue, delay, jitter, random loss
+ * and reordering, applied to each direction separately.  Every client shares
+ * the bottleneck, like sessions behind one access link.  Decisions come from
+ * a seeded generator, so runs with the same traffic see the same impairment.
+ * Packets are released by a timer with a 100us tick, never early.
+ *
+ * Lives on one EventBase.  Client flows are kept until the proxy is
+ * destroyed.
+ */
+class MoQImpairmentProxy : public folly::AsyncUDPSocket::ReadCallback {
+ public:
+  using LinkStats = MoQImpairedLink::Stats;
+  struct Stats {
+    // Client to server
+    LinkStats up;
+    // Server to client
+    LinkStats down;
+  };
+
+  MoQImpairmentProxy(
+      folly::EventBase* evb,
+      const folly::SocketAddress& listenAddress,
+      folly::SocketAddress serverAddress,
+      MoQImpairmentConfig config);
+  ~MoQImpairmentProxy() override;
+
+  // Where clients should send, with the bound port
+  folly::SocketAddress address() const {
+    return socket_.address();
+  }
+
+  Stats getStats() const {
+    return {up_.stats(), down_.stats()};
+  }
+
+  // ReadCallback, for packets from clients
+  void getReadBuffer(void** buf, size_t* len) noexcept override;
+  void onDataAvailable(
+      const folly::SocketAddress& client,
+      size_t len,
+      bool truncated,
+      OnDataAvailableParams params) noexcept override;
+  void onReadError(const folly::AsyncSocketException& ex) noexcept override;
+  void onReadClosed() noexcept override {}
+
+ private:
+  class Flow;
+
+  // Delivers buf with send after the impairments of link, unless dropped
+  void impair(
+      MoQImpairedLink& link,
+      std::unique_ptr<folly::IOBuf> buf,
+      folly::Function<void(std::unique_ptr<folly::IOBuf>)> send);
+
+  folly::EventBase* evb_;
+  folly::SocketAddress serverAddress_;
+  MoQImpairmentConfig config_;
+  folly::AsyncUDPSocket socket_;
+  folly::HHWheelTimerHighRes::UniquePtr timer_;
+  std::mt19937 rng_;
+  MoQImpairedLink up_{config_, rng_};
+  MoQImpairedLink down_{config_, rng_};
+  std::unique_ptr<folly::IOBuf> readBuf_;
+  folly::F14FastMap<folly::SocketAddress, std::unique_ptr<Flow>> flows_;
+};
+
+} // namespace moxygen
@@ -336,7 +336,7 @@ AdjustedExpectedResult MoQTestClient::adjustExpectedForDatagram(
 }
 
 folly::Expected<folly::Unit, ExtensionError> MoQTestClient::validateExtensions(
-    std::vector<Extension> extensions,
+    const Extensions& extensions,
     MoQTestParameters* params) {
   // validate extension size
   if (!validateExtensionSize(extensions, params)) {
@@ -356,6 +356,9 @@ folly::Expected<folly::Unit, ExtensionError> MoQTestClient::validateExtensions(
   Extension intExt;
   Extension varExt;
   for (Extension ext : extensions) {
+    if (ext.type == kTimestampExtensionType) {
+      continue;
+    }
     if (ext.type % 2 == 0) {
       intExt = ext;
     } else {
@@ -89,7 +89,7 @@ class MoQTestClient : public moxygen::Subscriber,
       const ObjectHeader& header,
       const std::string& payload);
   folly::Expected<folly::Unit, ExtensionError> validateExtensions(
-      std::vector<Extension> extensions,
+      const Extensions& extensions,
       MoQTestParameters* params);
 
   AdjustedExpectedResult adjustExpected(MoQTestParameters& params);
@@ -4,9 +4,14 @@
 #include <folly/coro/BlockingWait.h>
 #include "folly/init/Init.h"
 #include "folly/io/async/ScopedEventBaseThread.h"
+#include "moxygen/moqtest/MoQImpairmentProxy.h"
 #include "moxygen/moqtest/MoQTestClient.h"
+#include "moxygen/moqtest/MoQTestLoadClient.h"
 #include "moxygen/moqtest/Utils.h"
 
+#include <algorithm>
+#include <thread>
+
 namespace moxygen {
 DEFINE_string(url, "http://localhost:9999", "URL to connect to");
 DEFINE_int64(forwarding_preference, 0, "Forwarding preference");
@@ -36,6 +41,134 @@ DEFINE_uint64(
     last_object_in_track,
     FLAGS_objects_per_group + (int)FLAGS_send_end_of_group_markers,
     "Last object in track");
+DEFINE_uint32(
+    load_sessions,
+    0,
+    "Number of concurrent sessions to run in load mode.  0 to run a single "
+    "validating session");
+DEFINE_uint32(load_threads, 1, "Number of worker threads in load mode");
+DEFINE_bool(load_fetch, false, "Fetch instead of subscribe in load mode");
+DEFINE_uint32(
+    load_duration_s,
+    60,
+    "Seconds to run in load mode, unless every request finishes first");
+DEFINE_uint32(report_interval_s, 1, "Seconds between load mode reports");
+DEFINE_uint32(
+    load_priority_classes,
+    1,
+    "The server's --priority_classes, to report objects by priority");
+DEFINE_uint64(
+    impair_bandwidth_kbps,
+    0,
+    "Emulated path bandwidth in each direction, 0 for unlimited");
+DEFINE_uint64(
+    impair_queue_kb,
+    64,
+    "Emulated path queue behind the bandwidth cap before packets drop");
+DEFINE_uint32(impair_rtt_ms, 0, "Emulated path round trip time");
+DEFINE_uint32(impair_jitter_ms, 0, "Emulated path jitter in each direction");
+DEFINE_double(impair_loss_pct, 0, "Emulated path packet loss percent");
+DEFINE_double(impair_reorder_pct, 0, "Emulated path reordered packet percent");
+DEFINE_uint32(
+    impair_reorder_delay_ms,
+    10,
+    "How long the emulated path holds back reordered packets");
+DEFINE_uint32(impair_seed, 1, "Seed of the emulated path's impairments");
+DECLARE_int32(connect_timeout);
+DECLARE_int32(transaction_timeout);
+
+// With any --impair_ flag set, runs a MoQImpairmentProxy in front of the
+// server in --url and points --url at it, logging its stats when done
+class ImpairmentProxyRunner {
+ public:
+  ImpairmentProxyRunner() {
+    MoQImpairmentConfig config;
+    config.bandwidthBps = FLAGS_impair_bandwidth_kbps * 1000;
+    config.queueBytes = FLAGS_impair_queue_kb * 1024;
+    config.rtt = std::chrono::milliseconds(FLAGS_impair_rtt_ms);
+    config.jitter = std::chrono::milliseconds(FLAGS_impair_jitter_ms);
+    config.lossPercent = FLAGS_impair_loss_pct;
+    config.reorderPercent = FLAGS_impair_reorder_pct;
+    config.reorderDelay =
+        std::chrono::milliseconds(FLAGS_impair_reorder_delay_ms);
+    config.seed = FLAGS_impair_seed;
+    if (config.bandwidthBps == 0 && config.rtt.count() == 0 &&
+        config.jitter.count() == 0 && config.lossPercent <= 0 &&
+        config.reorderPercent <= 0) {
+      return;
+    }
+
+    proxygen::URL url(FLAGS_url);
+    folly::SocketAddress server(
+        url.getHost(), url.getPort(), /*allowNameLookup=*/true);
+    folly::SocketAddress listen("127.0.0.1", 0);
+    thread_ = std::make_unique<folly::ScopedEventBaseThread>("MoQImpairment");
+    auto evb = thread_->getEventBase();
+    evb->runInEventBaseThreadAndWait([&] {
+      proxy_ = std::make_unique<MoQImpairmentProxy>(
+          evb, listen, std::move(server), config);
+    });
+    FLAGS_url = folly::to<std::string>(
+        url.getScheme(),
+        "://127.0.0.1:",
+        proxy_->address().getPort(),
+        url.makeRelativeURL());
+    XLOG(INFO) << "Impairing the path to " << url.getHostAndPort()
+               << " through " << FLAGS_url;
+  }
+
+  ~ImpairmentProxyRunner() {
+    if (!proxy_) {
+      return;
+    }
+    thread_->getEventBase()->runInEventBaseThreadAndWait([this] {
+      auto stats = proxy_->getStats();
+      for (auto [name, link] : {std::make_pair("up", stats.up),
+                                std::make_pair("down", stats.down)}) {
+        XLOG(INFO) << "Impairment " << name << ": packets=" << link.packets
+                   << " bytes=" << link.bytes << " lost=" << link.lost
+                   << " queueDrops=" << link.queueDrops
+                   << " reordered=" << link.reordered;
+      }
+      proxy_.reset();
+    });
+  }
+
+ private:
+  std::unique_ptr<folly::ScopedEventBaseThread> thread_;
+  std::unique_ptr<MoQImpairmentProxy> proxy_;
+};
+
+int runLoad(MoQTestParameters params) {
+  MoQTestLoadConfig config;
+  config.url = proxygen::URL(FLAGS_url);
+  config.sessions = FLAGS_load_sessions;
+  config.threads = FLAGS_load_threads;
+  config.receivingType =
+      FLAGS_load_fetch ? ReceivingType::FETCH : ReceivingType::SUBSCRIBE;
+  config.params = params;
+  config.priorityClasses =
+      std::clamp<uint32_t>(FLAGS_load_priority_classes, 1, 128);
+  config.connectTimeout = std::chrono::milliseconds(FLAGS_connect_timeout);
+  config.transactionTimeout = std::chrono::seconds(FLAGS_transaction_timeout);
+
+  MoQTestLoadClient loadClient(std::move(config));
+  XLOG(INFO) << "Starting " << FLAGS_load_sessions << " sessions on "
+             << FLAGS_load_threads << " threads to " << FLAGS_url;
+  loadClient.start();
+  auto deadline = std::chrono::steady_clock::now() +
+      std::chrono::seconds(FLAGS_load_duration_s);
+  auto interval = std::chrono::seconds(std::max(FLAGS_report_interval_s, 1u));
+  while (std::chrono::steady_clock::now() < deadline &&
+         !loadClient.allRequestsDone()) {
+    std::this_thread::sleep_for(interval);
+    loadClient.report();
+  }
+  loadClient.stop();
+  loadClient.report();
+  const auto& stats = loadClient.getStats();
+  return stats.connectErrors.load() + stats.requestErrors.load() == 0 ? 0 : 1;
+}
 
 } // namespace moxygen
 
@@ -43,6 +176,7 @@ int main(int argc, char** argv) {
   gflags::ParseCommandLineFlags(&argc, &argv, false);
   folly::Init init(&argc, &argv);
 
+  moxygen::ImpairmentProxyRunner impairment;
   folly::ScopedEventBaseThread evb;
 
   // Initialize Client with url and moq params
@@ -68,6 +202,10 @@ int main(int argc, char** argv) {
       moxygen::FLAGS_publisher_delivery_timeout;
   defaultMoqParams.lastObjectInTrack = moxygen::FLAGS_last_object_in_track;
 
+  if (moxygen::FLAGS_load_sessions > 0) {
+    return moxygen::runLoad(defaultMoqParams);
+  }
+
   auto url = proxygen::URL(moxygen::FLAGS_url);
   std::shared_ptr<moxygen::MoQTestClient> client =
       std::make_shared<moxygen::MoQTestClient>(evb.getEventBase(), url);
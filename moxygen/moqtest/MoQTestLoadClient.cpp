@@ -0,0 +1,342 @@
+// (c) Meta Platforms, Inc. and affiliates. Confidential and proprietary.
+
+#include "moxygen/moqtest/MoQTestLoadClient.h"
+#include <folly/coro/BlockingWait.h>
+#include <folly/container/F14Map.h>
+#include <folly/coro/Collect.h>
+#include "moxygen/moqtest/Utils.h"
+
+namespace moxygen {
+
+namespace {
+const std::string kLoadTrackName = "test";
+
+void increment(std::atomic<uint64_t>& counter, uint64_t amount = 1) {
+  counter.fetch_add(amount, std::memory_order_relaxed);
+}
+
+uint64_t usecSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+} // namespace
+
+class MoQTestLoadClient::LoadSession
+    : public ObjectReceiverCallback,
+      public std::enable_shared_from_this<LoadSession> {
+ public:
+  LoadSession(
+      folly::EventBase* evb,
+      const MoQTestLoadConfig& config,
+      MoQTestLoadStats& stats)
+      : evb_(evb),
+        config_(config),
+        stats_(stats),
+        params_(config.params),
+        moqClient_(std::make_unique<MoQClient>(evb, config.url)) {}
+
+  folly::EventBase* getEventBase() const {
+    return evb_;
+  }
+
+  bool isDone() const {
+    return done_.load(std::memory_order_relaxed);
+  }
+
+  folly::coro::Task<void> run() {
+    try {
+      co_await moqClient_->setupMoQSession(
+          config_.connectTimeout,
+          config_.transactionTimeout,
+          /*publishHandler=*/nullptr,
+          /*subscribeHandler=*/nullptr);
+    } catch (const std::exception& ex) {
+      XLOG(ERR) << "MoQTest load: connect failed err=" << ex.what();
+      increment(stats_.connectErrors);
+      markDone();
+      co_return;
+    }
+    increment(stats_.sessionsConnected);
+
+    auto params = config_.params;
+    auto trackNamespace = convertMoqTestParamToTrackNamespace(&params);
+    if (trackNamespace.hasError()) {
+      XLOG(ERR) << "MoQTest load: " << trackNamespace.error().what();
+      increment(stats_.requestErrors);
+      markDone();
+      co_return;
+    }
+    FullTrackName ftn{std::move(trackNamespace.value()), kLoadTrackName};
+
+    auto requestStart = std::chrono::steady_clock::now();
+    if (config_.receivingType == ReceivingType::SUBSCRIBE) {
+      SubscribeRequest sub;
+      sub.requestID = 0;
+      sub.trackAlias = TrackAlias(0);
+      sub.fullTrackName = std::move(ftn);
+      sub.groupOrder = GroupOrder::OldestFirst;
+      sub.locType = LocationType::LatestObject;
+      sub.endGroup = 0;
+      auto res = co_await moqClient_->moqSession_->subscribe(
+          sub,
+          std::make_shared<ObjectReceiver>(
+              ObjectReceiver::SUBSCRIBE, shared_from_this()));
+      if (res.hasError()) {
+        XLOG(ERR) << "MoQTest load: subscribe failed err="
+                  << res.error().reasonPhrase;
+        increment(stats_.requestErrors);
+        markDone();
+        co_return;
+      }
+      subHandle_ = std::move(res.value());
+    } else {
+      Fetch fetch(
+          0,
+          std::move(ftn),
+          {params.startGroup, params.startObject},
+          {params.lastGroupInTrack, params.lastObjectInTrack + 1},
+          kDefaultPriority,
+          GroupOrder::OldestFirst);
+      auto res = co_await moqClient_->moqSession_->fetch(
+          fetch,
+          std::make_shared<ObjectReceiver>(
+              ObjectReceiver::FETCH, shared_from_this()));
+      if (res.hasError()) {
+        XLOG(ERR) << "MoQTest load: fetch failed err="
+                  << res.error().reasonPhrase;
+        increment(stats_.requestErrors);
+        markDone();
+        co_return;
+      }
+      fetchHandle_ = std::move(res.value());
+    }
+    stats_.requestLatencyUsec.record(usecSince(requestStart));
+  }
+
+  void close() {
+    if (subHandle_) {
+      subHandle_->unsubscribe();
+      subHandle_.reset();
+    }
+    if (fetchHandle_) {
+      fetchHandle_->fetchCancel();
+      fetchHandle_.reset();
+    }
+    if (moqClient_->moqSession_) {
+      moqClient_->moqSession_->close(SessionCloseErrorCode::NO_ERROR);
+    }
+  }
+
+  FlowControlState onObject(const ObjectHeader& objHeader, Payload payload)
+      override {
+    increment(stats_.objects);
+    if (payload) {
+      increment(stats_.bytes, payload->computeChainDataLength());
+    }
+    auto priorityClass = getPriorityClass(objHeader.priority);
+    auto& priorityStats = *stats_.byPriority[priorityClass];
+    increment(priorityStats.objects);
+    auto sentUsec = getTimestampExtension(objHeader.extensions);
+    if (sentUsec) {
+      auto nowUsec = getTimestampUsec();
+      // Clocks skewed the other way count as zero latency
+      auto latencyUsec = nowUsec > *sentUsec ? nowUsec - *sentUsec : 0;
+      stats_.deliveryLatencyUsec.record(latencyUsec);
+      priorityStats.deliveryLatencyUsec.record(latencyUsec);
+    }
+    accountObject(objHeader.group, priorityClass);
+    return FlowControlState::UNBLOCKED;
+  }
+
+  void onObjectStatus(const ObjectHeader&) override {}
+
+  void onEndOfStream() override {
+    // Only the fetch stream ends, subgroup ends are not reported
+    if (config_.receivingType == ReceivingType::FETCH) {
+      markDone();
+    }
+  }
+
+  void onError(ResetStreamErrorCode error) override {
+    XLOG(DBG1) << "MoQTest load: stream error=" << folly::to_underlying(error);
+    if (config_.receivingType == ReceivingType::FETCH) {
+      markDone();
+    }
+  }
+
+  void onSubscribeDone(SubscribeDone) override {
+    markDone();
+  }
+
+ private:
+  void markDone() {
+    if (!done_.exchange(true, std::memory_order_relaxed)) {
+      increment(stats_.requestsDone);
+      // Nothing more is coming
+      while (firstGroup_ && accountedThrough_ < maxGroup_) {
+        accountGroup(accountedThrough_ + params_.groupIncrement);
+      }
+    }
+  }
+
+  size_t getPriorityClass(uint8_t priority) const {
+    size_t priorityClass =
+        priority > kDefaultPriority ? priority - kDefaultPriority : 0;
+    return std::min(priorityClass, stats_.byPriority.size() - 1);
+  }
+
+  void accountObject(uint64_t group, size_t priorityClass) {
+    if (!firstGroup_) {
+      firstGroup_ = group;
+      accountedThrough_ = group;
+      maxGroup_ = group;
+    }
+    if (group <= accountedThrough_) {
+      // Reordered past the accounting of its group
+      if (group > *firstGroup_) {
+        increment(stats_.byPriority[priorityClass]->received);
+      }
+      return;
+    }
+    auto& received = pendingGroups_[group];
+    received.resize(stats_.byPriority.size());
+    received[priorityClass]++;
+    maxGroup_ = std::max(maxGroup_, group);
+    auto next = accountedThrough_ + params_.groupIncrement;
+    while (maxGroup_ > next + params_.groupIncrement) {
+      accountGroup(next);
+      next += params_.groupIncrement;
+    }
+  }
+
+  void accountGroup(uint64_t group) {
+    auto expected = getObjectsPerPriorityClass(
+        group, &params_, stats_.byPriority.size());
+    auto it = pendingGroups_.find(group);
+    for (size_t i = 0; i < stats_.byPriority.size(); i++) {
+      increment(stats_.byPriority[i]->expected, expected[i]);
+      if (it != pendingGroups_.end()) {
+        increment(stats_.byPriority[i]->received, it->second[i]);
+      }
+    }
+    if (it != pendingGroups_.end()) {
+      pendingGroups_.erase(it);
+    }
+    accountedThrough_ = group;
+  }
+
+  folly::EventBase* evb_;
+  const MoQTestLoadConfig config_;
+  MoQTestLoadStats& stats_;
+  MoQTestParameters params_;
+  std::unique_ptr<MoQClient> moqClient_;
+  std::shared_ptr<Publisher::SubscriptionHandle> subHandle_;
+  std::shared_ptr<Publisher::FetchHandle> fetchHandle_;
+  std::atomic<bool> done_{false};
+  // Drop accounting by priority class, see MoQTestPriorityStats
+  folly::Optional<uint64_t> firstGroup_;
+  uint64_t accountedThrough_{0};
+  uint64_t maxGroup_{0};
+  // Objects received by priority class, for groups not accounted yet
+  folly::F14FastMap<uint64_t, std::vector<uint64_t>> pendingGroups_;
+};
+
+MoQTestLoadClient::MoQTestLoadClient(MoQTestLoadConfig config)
+    : config_(std::move(config)) {
+  auto priorityClasses = std::max<uint8_t>(config_.priorityClasses, 1);
+  for (uint8_t i = 0; i < priorityClasses; i++) {
+    stats_.byPriority.push_back(std::make_unique<MoQTestPriorityStats>());
+  }
+  auto numThreads = std::max<uint32_t>(config_.threads, 1);
+  for (uint32_t i = 0; i < numThreads; i++) {
+    threads_.push_back(std::make_unique<folly::ScopedEventBaseThread>(
+        folly::to<std::string>("MoQTestLoad", i)));
+  }
+}
+
+MoQTestLoadClient::~MoQTestLoadClient() {
+  stop();
+}
+
+void MoQTestLoadClient::start() {
+  std::vector<folly::coro::TaskWithExecutor<void>> tasks;
+  for (uint32_t i = 0; i < config_.sessions; i++) {
+    auto evb = threads_[i % threads_.size()]->getEventBase();
+    auto session = std::make_shared<LoadSession>(evb, config_, stats_);
+    sessions_.push_back(session);
+    tasks.push_back(session->run().scheduleOn(evb));
+  }
+  lastReportTime_ = std::chrono::steady_clock::now();
+  folly::coro::blockingWait(folly::coro::collectAllRange(std::move(tasks)));
+}
+
+void MoQTestLoadClient::stop() {
+  for (auto& session : sessions_) {
+    auto evb = session->getEventBase();
+    evb->runInEventBaseThreadAndWait([session = std::move(session)]() mutable {
+      session->close();
+      session.reset();
+    });
+  }
+  sessions_.clear();
+}
+
+bool MoQTestLoadClient::allRequestsDone() const {
+  return std::all_of(
+      sessions_.begin(), sessions_.end(), [](const auto& session) {
+        return session->isDone();
+      });
+}
+
+void MoQTestLoadClient::report() {
+  auto now = std::chrono::steady_clock::now();
+  auto elapsedSec =
+      std::chrono::duration<double>(now - lastReportTime_).count();
+  auto objects = stats_.objects.load(std::memory_order_relaxed);
+  auto bytes = stats_.bytes.load(std::memory_order_relaxed);
+  double objectsPerSec = 0;
+  double goodputMbps = 0;
+  if (elapsedSec > 0) {
+    objectsPerSec = double(objects - lastReportObjects_) / elapsedSec;
+    goodputMbps = double(bytes - lastReportBytes_) * 8 / elapsedSec / 1e6;
+  }
+  lastReportTime_ = now;
+  lastReportObjects_ = objects;
+  lastReportBytes_ = bytes;
+
+  const auto& delivery = stats_.deliveryLatencyUsec;
+  const auto& request = stats_.requestLatencyUsec;
+  XLOG(INFO) << "MoQTest load: sessions="
+             << stats_.sessionsConnected.load(std::memory_order_relaxed)
+             << " connectErrors="
+             << stats_.connectErrors.load(std::memory_order_relaxed)
+             << " requestErrors="
+             << stats_.requestErrors.load(std::memory_order_relaxed)
+             << " done=" << stats_.requestsDone.load(std::memory_order_relaxed)
+             << " objects/s=" << objectsPerSec
+             << " goodputMbps=" << goodputMbps
+             << " deliveryUs p50=" << delivery.percentile(50)
+             << " p90=" << delivery.percentile(90)
+             << " p99=" << delivery.percentile(99)
+             << " p999=" << delivery.percentile(99.9)
+             << " requestUs p50=" << request.percentile(50)
+             << " p99=" << request.percentile(99);
+  for (size_t i = 0; i < stats_.byPriority.size(); i++) {
+    const auto& priorityStats = *stats_.byPriority[i];
+    auto expected = priorityStats.expected.load(std::memory_order_relaxed);
+    auto received = priorityStats.received.load(std::memory_order_relaxed);
+    auto dropped = expected > received ? expected - received : 0;
+    const auto& latency = priorityStats.deliveryLatencyUsec;
+    XLOG(INFO) << "MoQTest load: priority=" << kDefaultPriority + i
+               << " objects="
+               << priorityStats.objects.load(std::memory_order_relaxed)
+               << " dropped=" << dropped << " dropPct="
+               << (expected > 0 ? 100.0 * dropped / expected : 0)
+               << " deliveryUs p50=" << latency.percentile(50)
+               << " p90=" << latency.percentile(90)
+               << " p99=" << latency.percentile(99);
+  }
+}
+
+} // namespace moxygen
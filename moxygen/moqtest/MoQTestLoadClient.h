@@ -0,0 +1,96 @@
+// (c) Meta Platforms, Inc. and affiliates. Confidential and proprietary.
+
+#pragma once
+
+#include <folly/io/async/ScopedEventBaseThread.h>
+#include "moxygen/moqtest/MoQTestClient.h"
+#include "moxygen/stats/MoQTrackStats.h"
+
+namespace moxygen {
+
+struct MoQTestLoadConfig {
+  proxygen::URL url;
+  uint32_t sessions{1};
+  uint32_t threads{1};
+  ReceivingType receivingType{ReceivingType::SUBSCRIBE};
+  MoQTestParameters params;
+  std::chrono::milliseconds connectTimeout{1000};
+  std::chrono::milliseconds transactionTimeout{1000};
+  // The server's MoQTestServer::Config::priorityClasses, to account objects
+  // by priority class
+  uint8_t priorityClasses{1};
+};
+
+// Objects of one publisher priority
+struct MoQTestPriorityStats {
+  std::atomic<uint64_t> objects{0};
+  // Objects the server sent and objects received, in groups accounted so
+  // far.  A group is accounted once objects from two later groups arrived,
+  // or the request is done.  The first group a session receives is skipped,
+  // a subscription can start inside it.
+  std::atomic<uint64_t> expected{0};
+  std::atomic<uint64_t> received{0};
+  MoQHistogram deliveryLatencyUsec;
+};
+
+// Shared by every session of a load run
+struct MoQTestLoadStats {
+  std::atomic<uint64_t> sessionsConnected{0};
+  std::atomic<uint64_t> connectErrors{0};
+  std::atomic<uint64_t> requestErrors{0};
+  // Subscriptions or fetches that have finished delivering
+  std::atomic<uint64_t> requestsDone{0};
+  std::atomic<uint64_t> objects{0};
+  std::atomic<uint64_t> bytes{0};
+  // Receive time minus the kTimestampExtensionType stamped by the server,
+  // empty unless the server runs with --timestamp_extension
+  MoQHistogram deliveryLatencyUsec;
+  // SUBSCRIBE or FETCH to its OK
+  MoQHistogram requestLatencyUsec;
+  // Indexed by priority class, priority - kDefaultPriority
+  std::vector<std::unique_ptr<MoQTestPriorityStats>> byPriority;
+};
+
+/*
+ * Measures what a MoQTestServer, or a relay in front of one, can deliver.
+ * Sessions are spread round robin over a pool of EventBase threads, and each
+ * subscribes to or fetches the track described by the config's parameters.
+ * Objects are counted but not validated.
+ *
+ * Delivery latency compares system clocks, so it is only meaningful when the
+ * client and server clocks are synchronized.
+ */
+class MoQTestLoadClient {
+ public:
+  explicit MoQTestLoadClient(MoQTestLoadConfig config);
+  ~MoQTestLoadClient();
+
+  // Connects every session and issues its request.  Returns once every
+  // request has been answered.
+  void start();
+
+  // Closes every session
+  void stop();
+
+  bool allRequestsDone() const;
+
+  const MoQTestLoadStats& getStats() const {
+    return stats_;
+  }
+
+  // Logs rates since the last report, and latency percentiles since start
+  void report();
+
+ private:
+  class LoadSession;
+
+  MoQTestLoadConfig config_;
+  MoQTestLoadStats stats_;
+  std::vector<std::unique_ptr<folly::ScopedEventBaseThread>> threads_;
+  std::vector<std::shared_ptr<LoadSession>> sessions_;
+  std::chrono::steady_clock::time_point lastReportTime_;
+  uint64_t lastReportObjects_{0};
+  uint64_t lastReportBytes_{0};
+};
+
+} // namespace moxygen
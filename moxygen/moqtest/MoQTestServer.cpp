@@ -2,9 +2,13 @@
 
 #include "moxygen/moqtest/MoQTestServer.h"
 #include <folly/coro/BlockingWait.h>
+#include <folly/coro/CurrentExecutor.h>
 #include <folly/coro/Sleep.h>
+#include <folly/coro/WithCancellation.h>
 #include "moxygen/moqtest/Utils.h"
 
+#include <algorithm>
+
 std::string kCert = "fake_cert";
 std::string kKey = "fake_key";
 std::string kEndpointName = "fake_endpoint";
@@ -14,8 +18,107 @@ namespace moxygen {
 const int kDefaultExpires = 0;
 const std::string kDefaultSubscribeDoneReason = "Testing";
 
+namespace {
+// Objects of a track only come in two sizes with the same content, so the
+// payloads are built once and every object sends a clone
+class MoQTestPayloads {
+ public:
+  explicit MoQTestPayloads(MoQTestParameters& params)
+      : startObject_(params.startObject),
+        objectZero_(folly::IOBuf::copyBuffer(
+            std::string(getObjectSize(params.startObject, &params), 't'))),
+        otherObject_(folly::IOBuf::copyBuffer(std::string(
+            getObjectSize(params.startObject + 1, &params), 't'))) {}
+
+  Payload get(uint64_t objectId) const {
+    return objectId == startObject_ ? objectZero_->clone()
+                                    : otherObject_->clone();
+  }
+
+ private:
+  uint64_t startObject_;
+  std::unique_ptr<folly::IOBuf> objectZero_;
+  std::unique_ptr<folly::IOBuf> otherObject_;
+};
+
+// Decides when a track sends its next object.  By default objects are
+// objectFrequency ms apart.  With a target bitrate a token bucket paces the
+// bytes sent, and at line rate a track only waits for its consumer to be
+// ready, yielding every few objects so other tracks on the EventBase run.
+class MoQTestPacer {
+ public:
+  MoQTestPacer(
+      const MoQTestServer::Config& config,
+      const MoQTestParameters& params)
+      : config_(config),
+        objectInterval_(params.objectFrequency),
+        bytesPerSec_(double(config.targetBitrate) / 8),
+        burstBytes_(std::max(
+            bytesPerSec_ * kBurstDuration.count() / 1000,
+            double(std::max(
+                params.sizeOfObjectZero,
+                params.sizeOfObjectGreaterThanZero)))),
+        tokens_(burstBytes_),
+        lastRefill_(std::chrono::steady_clock::now()) {}
+
+  // Call after sending an object of the given size
+  folly::coro::Task<void> wait(uint64_t bytes) {
+    if (config_.lineRate) {
+      if (++sinceYield_ >= kLineRateBatch) {
+        sinceYield_ = 0;
+        co_await folly::coro::co_reschedule_on_current_executor;
+      }
+      co_return;
+    }
+    if (config_.targetBitrate == 0) {
+      co_await folly::coro::sleep(objectInterval_);
+      co_return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    tokens_ = std::min(
+        burstBytes_,
+        tokens_ +
+            bytesPerSec_ *
+                std::chrono::duration<double>(now - lastRefill_).count());
+    lastRefill_ = now;
+    tokens_ -= double(bytes);
+    if (tokens_ < 0) {
+      co_await folly::coro::sleep(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::duration<double>(-tokens_ / bytesPerSec_)));
+    }
+  }
+
+  // Also honors the consumer's flow control at line rate
+  template <typename Consumer>
+  folly::coro::Task<void> wait(uint64_t bytes, Consumer& consumer) {
+    if (config_.lineRate) {
+      auto ready = consumer.awaitReadyToConsume();
+      if (ready.hasValue() && !ready->isReady()) {
+        co_await folly::coro::co_awaitTry(std::move(ready.value()));
+      }
+    }
+    co_await wait(bytes);
+  }
+
+ private:
+  static constexpr uint32_t kLineRateBatch = 16;
+  static constexpr std::chrono::milliseconds kBurstDuration{10};
+
+  const MoQTestServer::Config& config_;
+  std::chrono::milliseconds objectInterval_;
+  double bytesPerSec_;
+  double burstBytes_;
+  double tokens_;
+  std::chrono::steady_clock::time_point lastRefill_;
+  uint32_t sinceYield_{0};
+};
+} // namespace
+
 void MoQTestSubscriptionHandle::unsubscribe() {
-  cancelSource_->requestCancellation();
+  if (cancelSource_) {
+    cancelSource_->requestCancellation();
+  }
 }
 
 void MoQTestSubscriptionHandle::subscribeUpdate(SubscribeUpdate subUpdate) {
@@ -23,25 +126,18 @@ void MoQTestSubscriptionHandle::subscribeUpdate(SubscribeUpdate subUpdate) {
 }
 
 void MoQTestFetchHandle::fetchCancel() {
-  cancelSource_->requestCancellation();
+  if (cancelSource_) {
+    cancelSource_->requestCancellation();
+  }
 }
 
-MoQTestServer::MoQTestServer(uint16_t port)
-    : MoQServer(port, kCert, kKey, kEndpointName) {}
+MoQTestServer::MoQTestServer(uint16_t port, Config config)
+    : MoQServer(port, kCert, kKey, kEndpointName), config_(config) {}
 
 folly::coro::Task<MoQSession::SubscribeResult> MoQTestServer::subscribe(
     SubscribeRequest sub,
     std::shared_ptr<TrackConsumer> callback) {
   LOG(INFO) << "Recieved Subscription";
-  if (subCancelSource_) {
-    SubscribeError error;
-    error.requestID = sub.requestID;
-    error.errorCode = SubscribeErrorCode::INTERNAL_ERROR;
-    error.reasonPhrase = "Cannot have concurrent subscriptions";
-    return folly::coro::makeTask<SubscribeResult>(folly::makeUnexpected(error));
-  }
-
-  subCancelSource_ = std::make_shared<folly::CancellationSource>();
 
   // Ensure Params are valid according to spec, if not return SubscribeError
   auto res = moxygen::convertTrackNamespaceToMoqTestParam(
@@ -57,8 +153,14 @@ folly::coro::Task<MoQSession::SubscribeResult> MoQTestServer::subscribe(
   // Request Session
   auto session = MoQSession::getRequestSession();
 
-  // Start a Co-routine to send objects back according to spec
-  onSubscribe(sub, callback).scheduleOn(session->getEventBase()).start();
+  // Start a Co-routine to send objects back according to spec.  Each
+  // subscription has its own cancellation source, so tracks are served
+  // concurrently.
+  subCancelSource_ = std::make_shared<folly::CancellationSource>();
+  folly::coro::co_withCancellation(
+      subCancelSource_->getToken(), onSubscribe(sub, callback))
+      .scheduleOn(session->getEventBase())
+      .start();
 
   // Return a SubscribeOk
   SubscribeOk subRes{
@@ -67,8 +169,7 @@ folly::coro::Task<MoQSession::SubscribeResult> MoQTestServer::subscribe(
       sub.groupOrder,
       folly::none};
   return folly::coro::makeTask<SubscribeResult>(
-      std::make_shared<MoQTestSubscriptionHandle>(
-          subRes, &(*subCancelSource_)));
+      std::make_shared<MoQTestSubscriptionHandle>(subRes, subCancelSource_));
 }
 
 // Perform Co-routine
@@ -132,28 +233,30 @@ folly::coro::Task<void> MoQTestServer::onSubscribe(
   done.reasonPhrase = kDefaultSubscribeDoneReason;
   callback->subscribeDone(done);
 
-  // Reset Session
-  subCancelSource_ = nullptr;
-
   co_return;
 }
 
 folly::coro::Task<void> MoQTestServer::sendOneSubgroupPerGroup(
     MoQTestParameters params,
     std::shared_ptr<TrackConsumer> callback) {
+  auto token = co_await folly::coro::co_current_cancellation_token;
+  MoQTestPayloads payloads(params);
+  MoQTestPacer pacer(config_, params);
   // Iterate through Groups
   for (int groupNum = params.startGroup; groupNum <= params.lastGroupInTrack;
        groupNum += params.groupIncrement) {
-    // Begin a New Subgroup (Default Priority)
-    auto maybeSubConsumer =
-        callback->beginSubgroup(groupNum, 0, kDefaultPriority);
+    // Begin a New Subgroup
+    auto maybeSubConsumer = callback->beginSubgroup(
+        groupNum,
+        0,
+        getPublisherPriority(groupNum, 0, config_.priorityClasses));
     auto subConsumer = maybeSubConsumer->get();
 
     // Iterate Through Objects in SubGroup
     for (int objectId = params.startObject;
          objectId <= params.lastObjectInTrack;
          objectId += params.objectIncrement) {
-      if (isSubCancelled()) {
+      if (token.isCancellationRequested()) {
         co_return;
       }
       // Find Object Size
@@ -161,28 +264,28 @@ folly::coro::Task<void> MoQTestServer::sendOneSubgroupPerGroup(
 
       // Add Integer/Variable Extensions if needed
       std::vector<Extension> extensions = getExtensions(
-          params.testIntegerExtension, params.testVariableExtension);
+          params.testIntegerExtension,
+          params.testVariableExtension,
+          config_.timestampExtension);
 
       // If there are send end of group markers and j == lastObjectID, send
       // the end of group
       if (objectId < params.lastObjectInTrack ||
           !params.sendEndOfGroupMarkers) {
         // Begin Delivering Object With Payload
-        std::string p = std::string(objectSize, 't');
-        auto objectPayload = folly::IOBuf::copyBuffer(p);
+        auto objectPayload = payloads.get(objectId);
         subConsumer->object(
             objectId, std::move(objectPayload), extensions, false);
       } else {
         subConsumer->endOfGroup(objectId);
       }
 
-      // Set Delay Based on Object Frequency
-      co_await folly::coro::sleep(
-          std::chrono::milliseconds(params.objectFrequency));
+      // Wait for the next object's send time
+      co_await pacer.wait(objectSize, *subConsumer);
     }
 
     // If SubGroup Hasn't Been Ended Already
-    if (!isSubCancelled() && !params.sendEndOfGroupMarkers) {
+    if (!token.isCancellationRequested() && !params.sendEndOfGroupMarkers) {
       subConsumer->endOfSubgroup();
     }
   }
@@ -191,6 +294,9 @@ folly::coro::Task<void> MoQTestServer::sendOneSubgroupPerGroup(
 folly::coro::Task<void> MoQTestServer::sendOneSubgroupPerObject(
     MoQTestParameters params,
     std::shared_ptr<TrackConsumer> callback) {
+  auto token = co_await folly::coro::co_current_cancellation_token;
+  MoQTestPayloads payloads(params);
+  MoQTestPacer pacer(config_, params);
   // Iterate through Objects
   for (int groupNum = params.startGroup; groupNum <= params.lastGroupInTrack;
        groupNum += params.groupIncrement) {
@@ -198,27 +304,30 @@ folly::coro::Task<void> MoQTestServer::sendOneSubgroupPerObject(
     for (int objectId = params.startObject;
          objectId <= params.lastObjectInTrack;
          objectId += params.objectIncrement) {
-      if (isSubCancelled()) {
+      if (token.isCancellationRequested()) {
         co_return;
       }
-      // Begin a New Subgroup per object (Default Priority)
-      auto maybeSubConsumer =
-          callback->beginSubgroup(groupNum, objectId, kDefaultPriority);
+      // Begin a New Subgroup per object
+      auto maybeSubConsumer = callback->beginSubgroup(
+          groupNum,
+          objectId,
+          getPublisherPriority(groupNum, objectId, config_.priorityClasses));
       auto subConsumer = maybeSubConsumer->get();
       // Find Object Size
       int objectSize = moxygen::getObjectSize(objectId, &params);
 
       // Add Integer/Variable Extensions if needed
       std::vector<Extension> extensions = getExtensions(
-          params.testIntegerExtension, params.testVariableExtension);
+          params.testIntegerExtension,
+          params.testVariableExtension,
+          config_.timestampExtension);
 
       // If there are send end of group markers and j == lastObjectID, send
       // the end of group
       if (objectId < params.lastObjectInTrack ||
           !params.sendEndOfGroupMarkers) {
         // Begin Delivering Object With Payload
-        std::string p = std::string(objectSize, 't');
-        auto objectPayload = folly::IOBuf::copyBuffer(p);
+        auto objectPayload = payloads.get(objectId);
         subConsumer->object(
             objectId, std::move(objectPayload), extensions, false);
       } else {
@@ -230,9 +339,8 @@ folly::coro::Task<void> MoQTestServer::sendOneSubgroupPerObject(
         subConsumer->endOfSubgroup();
       }
 
-      // Set Delay Based on Object Frequency
-      co_await folly::coro::sleep(
-          std::chrono::milliseconds(params.objectFrequency));
+      // Wait for the next object's send time
+      co_await pacer.wait(objectSize, *subConsumer);
     }
   }
   co_return;
@@ -241,6 +349,9 @@ folly::coro::Task<void> MoQTestServer::sendOneSubgroupPerObject(
 folly::coro::Task<void> MoQTestServer::sendTwoSubgroupsPerGroup(
     MoQTestParameters params,
     std::shared_ptr<TrackConsumer> callback) {
+  auto token = co_await folly::coro::co_current_cancellation_token;
+  MoQTestPayloads payloads(params);
+  MoQTestPacer pacer(config_, params);
   // Iterate through Objects
 
   // Odd number of objects in track means end on subgroupZero
@@ -248,31 +359,38 @@ folly::coro::Task<void> MoQTestServer::sendTwoSubgroupsPerGroup(
   for (int groupNum = params.startGroup; groupNum <= params.lastGroupInTrack;
        groupNum += params.groupIncrement) {
     std::vector<std::shared_ptr<SubgroupConsumer>> subConsumers;
-    subConsumers.push_back(
-        callback->beginSubgroup(groupNum, 0, kDefaultPriority).value());
-    subConsumers.push_back(
-        callback->beginSubgroup(groupNum, 1, kDefaultPriority).value());
+    for (uint64_t subgroup = 0; subgroup < 2; subgroup++) {
+      subConsumers.push_back(
+          callback
+              ->beginSubgroup(
+                  groupNum,
+                  subgroup,
+                  getPublisherPriority(
+                      groupNum, subgroup, config_.priorityClasses))
+              .value());
+    }
 
     // Iterate Through Objects in SubGroup
     for (int objectId = params.startObject;
          objectId <= params.lastObjectInTrack;
          objectId += params.objectIncrement) {
-      if (isSubCancelled()) {
+      if (token.isCancellationRequested()) {
         co_return;
       }
       // Find Object Size
       int objectSize = getObjectSize(objectId, &params);
       // Add Integer/Variable Extensions if needed
       std::vector<Extension> extensions = getExtensions(
-          params.testIntegerExtension, params.testVariableExtension);
+          params.testIntegerExtension,
+          params.testVariableExtension,
+          config_.timestampExtension);
 
       // If there are send end of group markers and j == lastObjectID, send
       // the end of group
       if (objectId < params.lastObjectInTrack ||
           !params.sendEndOfGroupMarkers) {
         // Begin Delivering Object With Payload
-        std::string p = std::string(objectSize, 't');
-        auto objectPayload = folly::IOBuf::copyBuffer(p);
+        auto objectPayload = payloads.get(objectId);
         subConsumers[(objectId % 2)]->object(
             objectId, std::move(objectPayload), extensions, false);
 
@@ -281,13 +399,12 @@ folly::coro::Task<void> MoQTestServer::sendTwoSubgroupsPerGroup(
         subConsumers[(int)endZero]->endOfSubgroup();
       }
 
-      // Set Delay Based on Object Frequency
-      co_await folly::coro::sleep(
-          std::chrono::milliseconds(params.objectFrequency));
+      // Wait for the next object's send time
+      co_await pacer.wait(objectSize, *subConsumers[objectId % 2]);
     }
 
     // If SubGroup Hasn't Been Ended Already
-    if (!isSubCancelled() && !params.sendEndOfGroupMarkers) {
+    if (!token.isCancellationRequested() && !params.sendEndOfGroupMarkers) {
       subConsumers[0]->endOfSubgroup();
       subConsumers[1]->endOfSubgroup();
     }
@@ -300,6 +417,9 @@ folly::coro::Task<MoQSession::SubscribeResult> MoQTestServer::sendDatagram(
     SubscribeRequest sub,
     MoQTestParameters params,
     std::shared_ptr<TrackConsumer> callback) {
+  auto token = co_await folly::coro::co_current_cancellation_token;
+  MoQTestPayloads payloads(params);
+  MoQTestPacer pacer(config_, params);
   // Iterate through Objects
   for (int groupNum = params.startGroup; groupNum <= params.lastGroupInTrack;
        groupNum += params.groupIncrement) {
@@ -307,7 +427,7 @@ folly::coro::Task<MoQSession::SubscribeResult> MoQTestServer::sendDatagram(
     for (int objectId = params.startObject;
          objectId <= params.lastObjectInTrack;
          objectId += params.objectIncrement) {
-      if (isSubCancelled()) {
+      if (token.isCancellationRequested()) {
         co_return folly::makeUnexpected(SubscribeError{
             sub.requestID,
             SubscribeErrorCode::INTERNAL_ERROR,
@@ -315,19 +435,22 @@ folly::coro::Task<MoQSession::SubscribeResult> MoQTestServer::sendDatagram(
       }
       // Add Integer/Variable Extensions if needed
       std::vector<Extension> extensions = getExtensions(
-          params.testIntegerExtension, params.testVariableExtension);
+          params.testIntegerExtension,
+          params.testVariableExtension,
+          config_.timestampExtension);
 
       // Find Object Size
       int objectSize = getObjectSize(objectId, &params);
 
-      std::string p = std::string(objectSize, 't');
-      auto objectPayload = folly::IOBuf::copyBuffer(p);
+      auto objectPayload = payloads.get(objectId);
 
       // Build object header
       ObjectHeader header;
       header.trackIdentifier = TrackIdentifier(sub.trackAlias);
       header.group = groupNum;
       header.id = objectId;
+      header.priority =
+          getPublisherPriority(groupNum, objectId, config_.priorityClasses);
       header.extensions = extensions;
 
       auto res = callback->datagram(header, std::move(objectPayload));
@@ -338,10 +461,8 @@ folly::coro::Task<MoQSession::SubscribeResult> MoQTestServer::sendDatagram(
             "Error Sending Datagram Objects"});
       }
 
-      // Set Delay Based on Object Frequency
-      co_await folly::coro::sleep(
-          std::chrono::milliseconds(params.objectFrequency))
-          .scheduleOn(folly::getGlobalCPUExecutor());
+      // Wait for the next object's send time
+      co_await pacer.wait(objectSize);
     }
   }
 
@@ -351,8 +472,7 @@ folly::coro::Task<MoQSession::SubscribeResult> MoQTestServer::sendDatagram(
       std::chrono::milliseconds(kDefaultExpires),
       sub.groupOrder,
       folly::none};
-  co_return std::make_shared<MoQTestSubscriptionHandle>(
-      subRes, &(*subCancelSource_));
+  co_return std::make_shared<MoQTestSubscriptionHandle>(subRes, nullptr);
 }
 
 // Fetch Methods
@@ -360,14 +480,6 @@ folly::coro::Task<MoQSession::FetchResult> MoQTestServer::fetch(
     Fetch fetch,
     std::shared_ptr<FetchConsumer> fetchCallback) {
   LOG(INFO) << "Recieved Fetch Request";
-  if (fetchCancelSource_) {
-    FetchError error;
-    error.requestID = fetch.requestID;
-    error.errorCode = FetchErrorCode::INTERNAL_ERROR;
-    error.reasonPhrase = "Cannot have concurrent fetches";
-    return folly::coro::makeTask<FetchResult>(folly::makeUnexpected(error));
-  }
-  fetchCancelSource_ = std::make_shared<folly::CancellationSource>();
 
   // Ensure Params are valid according to spec, if not return FetchError
   auto res = moxygen::convertTrackNamespaceToMoqTestParam(
@@ -392,14 +504,18 @@ folly::coro::Task<MoQSession::FetchResult> MoQTestServer::fetch(
   auto session = MoQSession::getRequestSession();
 
   // Start a Co-routine
-  onFetch(fetch, fetchCallback).scheduleOn(session->getEventBase()).start();
+  fetchCancelSource_ = std::make_shared<folly::CancellationSource>();
+  folly::coro::co_withCancellation(
+      fetchCancelSource_->getToken(), onFetch(fetch, fetchCallback))
+      .scheduleOn(session->getEventBase())
+      .start();
 
   FetchOk ok;
   ok.requestID = fetch.requestID;
   ok.groupOrder = fetch.groupOrder;
 
   return folly::coro::makeTask<FetchResult>(
-      std::make_shared<MoQTestFetchHandle>(ok, &(*fetchCancelSource_)));
+      std::make_shared<MoQTestFetchHandle>(ok, fetchCancelSource_));
 }
 
 folly::coro::Task<void> MoQTestServer::onFetch(
@@ -411,7 +527,7 @@ folly::coro::Task<void> MoQTestServer::onFetch(
       &fetch.fullTrackName.trackNamespace);
   CHECK(res.hasValue())
       << "Only valid params must be passed into this function";
-  CHECK(res.value().forwardingPreference == ForwardingPreference::DATAGRAM)
+  CHECK(res.value().forwardingPreference != ForwardingPreference::DATAGRAM)
       << "Datagram Forwarding Preference is not supported for fetch";
   MoQTestParameters params = res.value();
 
@@ -441,15 +557,15 @@ folly::coro::Task<void> MoQTestServer::onFetch(
     }
   }
 
-  // Reset Session
-  fetchCancelSource_ = nullptr;
-
   co_return;
 }
 
 folly::coro::Task<void> MoQTestServer::fetchOneSubgroupPerGroup(
     MoQTestParameters params,
     std::shared_ptr<FetchConsumer> callback) {
+  auto token = co_await folly::coro::co_current_cancellation_token;
+  MoQTestPayloads payloads(params);
+  MoQTestPacer pacer(config_, params);
   // Iterate through Groups
   for (int groupNum = params.startGroup; groupNum <= params.lastGroupInTrack;
        groupNum += params.groupIncrement) {
@@ -457,7 +573,7 @@ folly::coro::Task<void> MoQTestServer::fetchOneSubgroupPerGroup(
     for (int objectId = params.startObject;
          objectId <= params.lastObjectInTrack;
          objectId += params.objectIncrement) {
-      if (isFetchCancelled()) {
+      if (token.isCancellationRequested()) {
         co_return;
       }
       // Find Object Size
@@ -465,15 +581,16 @@ folly::coro::Task<void> MoQTestServer::fetchOneSubgroupPerGroup(
 
       // Add Integer/Variable Extensions if needed
       std::vector<Extension> extensions = getExtensions(
-          params.testIntegerExtension, params.testVariableExtension);
+          params.testIntegerExtension,
+          params.testVariableExtension,
+          config_.timestampExtension);
 
       // If there are send end of group markers and j == lastObjectID, send
       // the end of group
       if (objectId < params.lastObjectInTrack ||
           !params.sendEndOfGroupMarkers) {
         // Begin Delivering Object With Payload
-        std::string p = std::string(objectSize, 't');
-        auto objectPayload = folly::IOBuf::copyBuffer(p);
+        auto objectPayload = payloads.get(objectId);
         callback->object(
             groupNum,
             0 /* subgroupId */,
@@ -486,9 +603,8 @@ folly::coro::Task<void> MoQTestServer::fetchOneSubgroupPerGroup(
             groupNum, 0 /* subgroupId */, objectId, extensions, false);
       }
 
-      // Set Delay Based on Object Frequency
-      co_await folly::coro::sleep(
-          std::chrono::milliseconds(params.objectFrequency));
+      // Wait for the next object's send time
+      co_await pacer.wait(objectSize, *callback);
     }
   }
 
@@ -499,6 +615,9 @@ folly::coro::Task<void> MoQTestServer::fetchOneSubgroupPerGroup(
 folly::coro::Task<void> MoQTestServer::fetchOneSubgroupPerObject(
     MoQTestParameters params,
     std::shared_ptr<FetchConsumer> callback) {
+  auto token = co_await folly::coro::co_current_cancellation_token;
+  MoQTestPayloads payloads(params);
+  MoQTestPacer pacer(config_, params);
   // Iterate through Groups
   for (int groupNum = params.startGroup; groupNum <= params.lastGroupInTrack;
        groupNum += params.groupIncrement) {
@@ -506,7 +625,7 @@ folly::coro::Task<void> MoQTestServer::fetchOneSubgroupPerObject(
     for (int objectId = params.startObject;
          objectId <= params.lastObjectInTrack;
          objectId += params.objectIncrement) {
-      if (isFetchCancelled()) {
+      if (token.isCancellationRequested()) {
         co_return;
       }
       // Find Object Size
@@ -514,15 +633,16 @@ folly::coro::Task<void> MoQTestServer::fetchOneSubgroupPerObject(
 
       // Add Integer/Variable Extensions if needed
       std::vector<Extension> extensions = getExtensions(
-          params.testIntegerExtension, params.testVariableExtension);
+          params.testIntegerExtension,
+          params.testVariableExtension,
+          config_.timestampExtension);
 
       // If there are send end of group markers and j == lastObjectID, send
       // the end of group
       if (objectId < params.lastObjectInTrack ||
           !params.sendEndOfGroupMarkers) {
         // Begin Delivering Object With Payload
-        std::string p = std::string(objectSize, 't');
-        auto objectPayload = folly::IOBuf::copyBuffer(p);
+        auto objectPayload = payloads.get(objectId);
         callback->object(
             groupNum,
             objectId,
@@ -534,9 +654,8 @@ folly::coro::Task<void> MoQTestServer::fetchOneSubgroupPerObject(
         callback->endOfGroup(groupNum, objectId, objectId, extensions, false);
       }
 
-      // Set Delay Based on Object Frequency
-      co_await folly::coro::sleep(
-          std::chrono::milliseconds(params.objectFrequency));
+      // Wait for the next object's send time
+      co_await pacer.wait(objectSize, *callback);
     }
   }
 
@@ -547,6 +666,9 @@ folly::coro::Task<void> MoQTestServer::fetchOneSubgroupPerObject(
 folly::coro::Task<void> MoQTestServer::fetchTwoSubgroupsPerGroup(
     MoQTestParameters params,
     std::shared_ptr<FetchConsumer> callback) {
+  auto token = co_await folly::coro::co_current_cancellation_token;
+  MoQTestPayloads payloads(params);
+  MoQTestPacer pacer(config_, params);
   // Iterate through Groups
   for (int groupNum = params.startGroup; groupNum <= params.lastGroupInTrack;
        groupNum += params.groupIncrement) {
@@ -554,7 +676,7 @@ folly::coro::Task<void> MoQTestServer::fetchTwoSubgroupsPerGroup(
     for (int objectId = params.startObject;
          objectId <= params.lastObjectInTrack;
          objectId += params.objectIncrement) {
-      if (isFetchCancelled()) {
+      if (token.isCancellationRequested()) {
         co_return;
       }
       // Find Object Size
@@ -562,7 +684,9 @@ folly::coro::Task<void> MoQTestServer::fetchTwoSubgroupsPerGroup(
 
       // Add Integer/Variable Extensions if needed
       std::vector<Extension> extensions = getExtensions(
-          params.testIntegerExtension, params.testVariableExtension);
+          params.testIntegerExtension,
+          params.testVariableExtension,
+          config_.timestampExtension);
 
       int subGroupId = objectId % 2;
       // If there are send end of group markers and j == lastObjectID, send
@@ -570,8 +694,7 @@ folly::coro::Task<void> MoQTestServer::fetchTwoSubgroupsPerGroup(
       if (objectId < params.lastObjectInTrack ||
           !params.sendEndOfGroupMarkers) {
         // Begin Delivering Object With Payload
-        std::string p = std::string(objectSize, 't');
-        auto objectPayload = folly::IOBuf::copyBuffer(p);
+        auto objectPayload = payloads.get(objectId);
         callback->object(
             groupNum,
             subGroupId,
@@ -583,9 +706,8 @@ folly::coro::Task<void> MoQTestServer::fetchTwoSubgroupsPerGroup(
         callback->endOfGroup(groupNum, subGroupId, objectId, extensions, false);
       }
 
-      // Set Delay Based on Object Frequency
-      co_await folly::coro::sleep(
-          std::chrono::milliseconds(params.objectFrequency));
+      // Wait for the next object's send time
+      co_await pacer.wait(objectSize, *callback);
     }
   }
 
@@ -12,36 +12,53 @@ class MoQTestSubscriptionHandle : public Publisher::SubscriptionHandle {
  public:
   MoQTestSubscriptionHandle(
       SubscribeOk ok,
-      folly::CancellationSource* cancellationSource)
-      : Publisher::SubscriptionHandle(ok), cancelSource_(cancellationSource){};
+      std::shared_ptr<folly::CancellationSource> cancellationSource)
+      : Publisher::SubscriptionHandle(ok),
+        cancelSource_(std::move(cancellationSource)){};
 
   virtual void unsubscribe() override;
   virtual void subscribeUpdate(SubscribeUpdate subUpdate) override;
 
  private:
   SubscribeOk subscribeOk_;
-  folly::CancellationSource* cancelSource_;
+  std::shared_ptr<folly::CancellationSource> cancelSource_;
 };
 
 class MoQTestFetchHandle : public Publisher::FetchHandle {
  public:
-  MoQTestFetchHandle(FetchOk ok, folly::CancellationSource* cancellationSource)
+  MoQTestFetchHandle(
+      FetchOk ok,
+      std::shared_ptr<folly::CancellationSource> cancellationSource)
       : Publisher::FetchHandle(ok),
         fetchOk_(ok),
-        cancelSource_(cancellationSource){};
+        cancelSource_(std::move(cancellationSource)){};
 
   virtual void fetchCancel() override;
 
  private:
   FetchOk fetchOk_;
-  folly::CancellationSource* cancelSource_;
+  std::shared_ptr<folly::CancellationSource> cancelSource_;
 };
 
 class MoQTestServer : public moxygen::Publisher,
                       public moxygen::MoQServer,
                       public std::enable_shared_from_this<MoQTestServer> {
  public:
-  MoQTestServer(uint16_t port);
+  struct Config {
+    // Ignore objectFrequency and send as fast as each consumer accepts
+    bool lineRate{false};
+    // When non-zero, ignore objectFrequency and pace each track to this many
+    // bits per second
+    uint64_t targetBitrate{0};
+    // Spread the subgroups of each track over this many publisher
+    // priorities, see getPublisherPriority
+    uint8_t priorityClasses{1};
+    // Stamp objects with their send time, for MoQTestLoadClient's delivery
+    // latency
+    bool timestampExtension{false};
+  };
+
+  explicit MoQTestServer(uint16_t port, Config config = {});
   // Override onNewSession to set publisher handler to be this object
   virtual void onNewSession(
       std::shared_ptr<MoQSession> clientSession) override {
@@ -95,7 +112,8 @@ class MoQTestServer : public moxygen::Publisher,
       MoQTestParameters params,
       std::shared_ptr<FetchConsumer> callback);
 
-  // Methods For Tests in MoQTrackServerTest
+  // Methods For Tests in MoQTrackServerTest.  These refer to the most recent
+  // subscription and fetch.
   bool isSubCancelled();
   bool isFetchCancelled();
   void initializeCancellationSources() {
@@ -104,6 +122,7 @@ class MoQTestServer : public moxygen::Publisher,
   }
 
  private:
+  Config config_;
   std::shared_ptr<folly::CancellationSource> subCancelSource_;
   std::shared_ptr<folly::CancellationSource> fetchCancelSource_;
 };
@@ -2,18 +2,44 @@
 
 #include "moxygen/moqtest/MoQTestServer.h"
 
+#include <algorithm>
+
 namespace moxygen {
 
 } // namespace moxygen
 
 DEFINE_int32(port, 9999, "Port to listen on");
+DEFINE_bool(
+    line_rate,
+    false,
+    "Ignore object_frequency and send objects as fast as subscribers accept");
+DEFINE_uint64(
+    target_bitrate_bps,
+    0,
+    "Ignore object_frequency and pace each track to this bitrate, 0 to "
+    "disable");
+
+DEFINE_uint32(
+    priority_classes,
+    1,
+    "Spread the subgroups of each track over this many publisher priorities");
+DEFINE_bool(
+    timestamp_extension,
+    false,
+    "Stamp each object with its send time, for the load client's delivery "
+    "latency");
 
 int main(int argc, char** argv) {
   gflags::ParseCommandLineFlags(&argc, &argv, false);
   folly::Init init(&argc, &argv);
 
   // Initialize Server with correct port
-  auto server = std::make_shared<moxygen::MoQTestServer>(FLAGS_port);
+  moxygen::MoQTestServer::Config config;
+  config.lineRate = FLAGS_line_rate;
+  config.targetBitrate = FLAGS_target_bitrate_bps;
+  config.priorityClasses = std::clamp<uint32_t>(FLAGS_priority_classes, 1, 128);
+  config.timestampExtension = FLAGS_timestamp_extension;
+  auto server = std::make_shared<moxygen::MoQTestServer>(FLAGS_port, config);
 
   std::cout << "\nEnter anything to exit." << std::endl;
   std::string input;
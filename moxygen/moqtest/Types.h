@@ -26,6 +26,10 @@ const uint64_t kDefaultLastGroupInTrack = (1ULL << 62) - 1;
 const uint64_t kDefaultStart = 0;
 const uint64_t kDefaultIncrement = 1;
 const uint64_t kDefaultPublisherDeliveryTimeout = 0;
+// Integer extension MoQTestServer adds to every object, holding the time it
+// was sent in microseconds since the Unix epoch.  Not counted as a test
+// extension.
+const uint64_t kTimestampExtensionType = 0xF0E0;
 
 struct MoQTestParameters {
   ForwardingPreference forwardingPreference =
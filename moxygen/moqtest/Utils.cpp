@@ -2,6 +2,9 @@
 
 #include "moxygen/moqtest/Utils.h"
 
+#include <algorithm>
+#include <chrono>
+
 namespace moxygen {
 
 const int kNumParams = 16;
@@ -92,12 +95,12 @@ convertMoqTestParamToTrackNamespace(MoQTestParameters* params) {
 folly::Expected<moxygen::MoQTestParameters, std::runtime_error>
 convertTrackNamespaceToMoqTestParam(TrackNamespace* track) {
   // Check if TrackNamespace is of length 16
-  if ((track->trackNamespace).size() != kNumParams) {
+  if (track->size() != kNumParams) {
     return folly::makeUnexpected(
         std::runtime_error("TrackNamespace is not of length 16"));
   }
   // Check if TrackNamespace is correct protocol (Tuple Field 0)
-  if ((track->trackNamespace)[0] != kField0) {
+  if ((*track)[0] != kField0) {
     return folly::makeUnexpected(
         std::runtime_error("Tuple element 0 is not moq-test-00"));
   }
@@ -108,23 +111,23 @@ convertTrackNamespaceToMoqTestParam(TrackNamespace* track) {
   // Assign values to appropriate positions in params
   try {
     params.forwardingPreference =
-        ForwardingPreference(std::stoi((track->trackNamespace)[1]));
-    params.startGroup = std::stoull((track->trackNamespace)[2]);
-    params.startObject = std::stoull((track->trackNamespace)[3]);
-    params.lastGroupInTrack = std::stoull((track->trackNamespace)[4]);
-    params.lastObjectInTrack = std::stoull((track->trackNamespace)[5]);
-    params.objectsPerGroup = std::stoull((track->trackNamespace)[6]);
-    params.sizeOfObjectZero = std::stoull((track->trackNamespace)[7]);
+        ForwardingPreference(std::stoi((*track)[1]));
+    params.startGroup = std::stoull((*track)[2]);
+    params.startObject = std::stoull((*track)[3]);
+    params.lastGroupInTrack = std::stoull((*track)[4]);
+    params.lastObjectInTrack = std::stoull((*track)[5]);
+    params.objectsPerGroup = std::stoull((*track)[6]);
+    params.sizeOfObjectZero = std::stoull((*track)[7]);
     params.sizeOfObjectGreaterThanZero =
-        std::stoull((track->trackNamespace)[8]);
-    params.objectFrequency = std::stoull((track->trackNamespace)[9]);
-    params.groupIncrement = std::stoull((track->trackNamespace)[10]);
-    params.objectIncrement = std::stoull((track->trackNamespace)[11]);
+        std::stoull((*track)[8]);
+    params.objectFrequency = std::stoull((*track)[9]);
+    params.groupIncrement = std::stoull((*track)[10]);
+    params.objectIncrement = std::stoull((*track)[11]);
     params.sendEndOfGroupMarkers =
-        static_cast<bool>(std::stoi((track->trackNamespace)[12]));
-    params.testIntegerExtension = (std::stoi((track->trackNamespace)[13]));
-    params.testVariableExtension = (std::stoi((track->trackNamespace)[14]));
-    params.publisherDeliveryTimeout = std::stoull((track->trackNamespace)[15]);
+        static_cast<bool>(std::stoi((*track)[12]));
+    params.testIntegerExtension = (std::stoi((*track)[13]));
+    params.testVariableExtension = (std::stoi((*track)[14]));
+    params.publisherDeliveryTimeout = std::stoull((*track)[15]);
   } catch (const std::exception& e) {
     return folly::makeUnexpected(std::runtime_error(
         "Error Converting TrackNamespace String value to Digit: " +
@@ -143,8 +146,12 @@ convertTrackNamespaceToMoqTestParam(TrackNamespace* track) {
 
 std::vector<Extension> getExtensions(
     int integerExtensionId,
-    int variableExtensionId) {
+    int variableExtensionId,
+    bool timestamp) {
   std::vector<Extension> extensions;
+  if (timestamp) {
+    extensions.emplace_back(kTimestampExtensionType, getTimestampUsec());
+  }
   if (integerExtensionId >= 0) {
     uint64_t randomNumber = std::rand();
     Extension ext{static_cast<uint64_t>(2 * integerExtensionId), randomNumber};
@@ -161,6 +168,21 @@ std::vector<Extension> getExtensions(
   return extensions;
 }
 
+uint64_t getTimestampUsec() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+folly::Optional<uint64_t> getTimestampExtension(const Extensions& extensions) {
+  for (const auto& ext : extensions) {
+    if (ext.type == kTimestampExtensionType) {
+      return ext.intValue;
+    }
+  }
+  return folly::none;
+}
+
 int getObjectSize(int objectId, MoQTestParameters* params) {
   if (objectId == params->startObject) {
     return params->sizeOfObjectZero;
@@ -169,11 +191,55 @@ int getObjectSize(int objectId, MoQTestParameters* params) {
   }
 }
 
+uint64_t getSubgroupId(uint64_t objectId, MoQTestParameters* params) {
+  switch (params->forwardingPreference) {
+    case ForwardingPreference::ONE_SUBGROUP_PER_GROUP:
+      return 0;
+    case ForwardingPreference::TWO_SUBGROUPS_PER_GROUP:
+      return objectId % 2;
+    default:
+      return objectId;
+  }
+}
+
+uint8_t getPublisherPriority(
+    uint64_t group,
+    uint64_t subgroup,
+    uint8_t priorityClasses) {
+  if (priorityClasses <= 1) {
+    return kDefaultPriority;
+  }
+  return kDefaultPriority + (group + subgroup) % priorityClasses;
+}
+
+std::vector<uint64_t> getObjectsPerPriorityClass(
+    uint64_t group,
+    MoQTestParameters* params,
+    uint8_t priorityClasses) {
+  std::vector<uint64_t> objects(std::max<uint8_t>(priorityClasses, 1), 0);
+  for (uint64_t objectId = params->startObject;
+       objectId <= params->lastObjectInTrack;
+       objectId += params->objectIncrement) {
+    // The last object is an end of group marker without a payload
+    if (params->sendEndOfGroupMarkers &&
+        objectId == params->lastObjectInTrack &&
+        params->forwardingPreference != ForwardingPreference::DATAGRAM) {
+      continue;
+    }
+    auto priority = getPublisherPriority(
+        group, getSubgroupId(objectId, params), priorityClasses);
+    objects[priority - kDefaultPriority]++;
+  }
+  return objects;
+}
+
 // Extension Validation Helper Functions
 bool validateExtensionSize(
-    std::vector<Extension> extensions,
+    const Extensions& extensions,
     MoQTestParameters* params) {
-  return extensions.size() ==
+  auto numTestExtensions =
+      extensions.size() - (getTimestampExtension(extensions) ? 1 : 0);
+  return numTestExtensions ==
       (int)(params->testIntegerExtension >= 0) +
       (int)(params->testVariableExtension >= 0);
 }
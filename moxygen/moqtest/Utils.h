@@ -19,16 +19,40 @@ convertMoqTestParamToTrackNamespace(MoQTestParameters* params);
 folly::Expected<moxygen::MoQTestParameters, std::runtime_error>
 convertTrackNamespaceToMoqTestParam(TrackNamespace* track);
 
+// With timestamp, the send time goes first in a kTimestampExtensionType
+// extension
 std::vector<Extension> getExtensions(
     int integerExtensionId,
-    int variableExtensionId);
+    int variableExtensionId,
+    bool timestamp = false);
+
+// Microseconds since the Unix epoch, for kTimestampExtensionType
+uint64_t getTimestampUsec();
+folly::Optional<uint64_t> getTimestampExtension(const Extensions& extensions);
 
 int getObjectSize(int objectId, MoQTestParameters* params);
 
+// Subgroup MoQTestServer sends an object on, the object ID for datagrams
+uint64_t getSubgroupId(uint64_t objectId, MoQTestParameters* params);
+
+// Publisher priority of a subgroup when the subgroups of a track are spread
+// round robin over priorityClasses priorities.  Class 0 is kDefaultPriority,
+// each later class is one less important.
+uint8_t getPublisherPriority(
+    uint64_t group,
+    uint64_t subgroup,
+    uint8_t priorityClasses);
+
+// Objects with a payload MoQTestServer sends in group, by priority class
+std::vector<uint64_t> getObjectsPerPriorityClass(
+    uint64_t group,
+    MoQTestParameters* params,
+    uint8_t priorityClasses);
+
 bool validatePayload(int objectSize, std::string payload);
 
 bool validateExtensionSize(
-    std::vector<Extension> extensions,
+    const Extensions& extensions,
     MoQTestParameters* params);
 bool validateIntExtensions(Extension intExt, MoQTestParameters* params);
 bool validateVarExtensions(Extension varExt, MoQTestParameters* params);
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/relay/MoQAbrSwitcher.h"
+
+#include <folly/logging/xlog.h>
+
+namespace moxygen {
+
+class MoQAbrSwitcher::Source : public TrackConsumer {
+ public:
+  Source(std::shared_ptr<MoQAbrSwitcher> switcher, size_t index)
+      : switcher_(std::move(switcher)), index_(index) {}
+
+  folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
+  beginSubgroup(uint64_t groupID, uint64_t subgroupID, Priority priority)
+      override {
+    if (!switcher_->accept(index_, groupID)) {
+      // Another rendition carries the group
+      return std::make_shared<DiscardSubgroupConsumer>();
+    }
+    return switcher_->downstream_->beginSubgroup(
+        groupID, subgroupID, priority);
+  }
+
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitStreamCredit() override {
+    return switcher_->downstream_->awaitStreamCredit();
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objectStream(
+      const ObjectHeader& header,
+      Payload payload) override {
+    if (!switcher_->accept(index_, header.group)) {
+      return folly::unit;
+    }
+    return switcher_->downstream_->objectStream(header, std::move(payload));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> datagram(
+      const ObjectHeader& header,
+      Payload payload) override {
+    if (!switcher_->accept(index_, header.group)) {
+      return folly::unit;
+    }
+    return switcher_->downstream_->datagram(header, std::move(payload));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> groupNotExists(
+      uint64_t groupID,
+      uint64_t subgroup,
+      Priority pri,
+      Extensions extensions) override {
+    if (!switcher_->accept(index_, groupID)) {
+      return folly::unit;
+    }
+    return switcher_->downstream_->groupNotExists(
+        groupID, subgroup, pri, std::move(extensions));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> subscribeDone(
+      SubscribeDone subDone) override {
+    if (done_) {
+      return folly::unit;
+    }
+    done_ = true;
+    return switcher_->sourceDone(index_, std::move(subDone));
+  }
+
+ private:
+  std::shared_ptr<MoQAbrSwitcher> switcher_;
+  size_t index_;
+  bool done_{false};
+};
+
+MoQAbrSwitcher::MoQAbrSwitcher(
+    std::shared_ptr<TrackConsumer> downstream,
+    std::vector<uint64_t> bitratesBps,
+    SignalsFn signals,
+    Config config)
+    : downstream_(std::move(downstream)),
+      bitratesBps_(std::move(bitratesBps)),
+      active_(bitratesBps_.size(), true),
+      numActive_(bitratesBps_.size()),
+      signals_(std::move(signals)),
+      config_(config) {
+  XCHECK(!bitratesBps_.empty());
+  XCHECK(std::is_sorted(bitratesBps_.begin(), bitratesBps_.end()));
+}
+
+std::shared_ptr<TrackConsumer> MoQAbrSwitcher::source(size_t index) {
+  XCHECK_LT(index, bitratesBps_.size());
+  return std::make_shared<Source>(shared_from_this(), index);
+}
+
+void MoQAbrSwitcher::disable(size_t index) {
+  if (active_[index]) {
+    active_[index] = false;
+    numActive_--;
+  }
+}
+
+bool MoQAbrSwitcher::accept(size_t index, uint64_t groupID) {
+  if (!newestGroup_ || groupID > *newestGroup_) {
+    auto next = choose();
+    if (newestGroup_ && next != current_) {
+      XLOG(DBG1) << "ABR switch " << current_ << " -> " << next
+                 << " at group " << groupID;
+      switches_++;
+    }
+    current_ = next;
+    newestGroup_ = groupID;
+    groups_[groupID] = next;
+    for (auto it = groups_.begin(); it != groups_.end();) {
+      if (it->first + kGroupsKept < groupID) {
+        it = groups_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    return index == next;
+  }
+  auto it = groups_.find(groupID);
+  if (it != groups_.end()) {
+    return it->second == index;
+  }
+  if (groupID + kGroupsKept < *newestGroup_) {
+    return false;
+  }
+  // A recent group that arrived out of order, nobody has begun it
+  groups_.emplace(groupID, index);
+  return true;
+}
+
+size_t MoQAbrSwitcher::choose() const {
+  size_t lowest = 0;
+  while (lowest + 1 < active_.size() && !active_[lowest]) {
+    lowest++;
+  }
+  bool started = newestGroup_.has_value() && active_[current_];
+  auto from = started ? current_ : lowest;
+  auto signals = signals_ ? signals_() : Signals();
+  if (signals.bytesBuffered > config_.maxBufferedBytes) {
+    for (auto i = from; i > 0; i--) {
+      if (active_[i - 1]) {
+        return i - 1;
+      }
+    }
+    return from;
+  }
+  if (!signals.sendRateBps) {
+    return from;
+  }
+  auto budget = uint64_t(double(*signals.sendRateBps) * config_.headroom);
+  auto target = lowest;
+  for (size_t i = lowest; i < bitratesBps_.size(); i++) {
+    if (active_[i] && bitratesBps_[i] <= budget) {
+      target = i;
+    }
+  }
+  if (started && target > current_) {
+    // One step up at a time
+    for (auto i = current_ + 1; i <= target; i++) {
+      if (active_[i]) {
+        return i;
+      }
+    }
+  }
+  return target;
+}
+
+folly::Expected<folly::Unit, MoQPublishError> MoQAbrSwitcher::sourceDone(
+    size_t index,
+    SubscribeDone subDone) {
+  if (!active_[index]) {
+    return folly::unit;
+  }
+  disable(index);
+  if (numActive_ > 0) {
+    XLOG(DBG1) << "ABR rendition " << index << " done, " << numActive_
+               << " left";
+    return folly::unit;
+  }
+  return downstream_->subscribeDone(std::move(subDone));
+}
+
+} // namespace moxygen
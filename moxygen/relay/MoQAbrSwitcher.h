@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/container/F14Map.h>
+#include <moxygen/MoQConsumers.h>
+
+namespace moxygen {
+
+// Forwards one of several renditions of a track to one downstream consumer,
+// picking the rendition afresh for each group.  Every rendition is a source
+// publishing the same group numbering, ordered by increasing bitrate.  The
+// first source to begin a group decides which rendition carries it, from the
+// downstream's current signals, and that group comes only from that source.
+// Subgroups already begun carry on, so a switch never cuts a group short.
+//
+// Going down is immediate, going up is one rendition per group, so a brief
+// overestimate doesn't jump straight to the top.
+class MoQAbrSwitcher : public std::enable_shared_from_this<MoQAbrSwitcher> {
+ public:
+  // What is known about the downstream's path
+  struct Signals {
+    // Estimated send rate, none when unknown
+    folly::Optional<uint64_t> sendRateBps;
+    // Bytes queued towards the downstream
+    uint64_t bytesBuffered{0};
+  };
+  using SignalsFn = std::function<Signals()>;
+
+  struct Config {
+    // Share of the send rate a rendition may use
+    double headroom{0.8};
+    // Above this many buffered bytes, step down a rendition per group
+    uint64_t maxBufferedBytes{512 * 1024};
+  };
+
+  // Groups remembered behind the newest one, older ones from any source are
+  // dropped
+  static constexpr uint64_t kGroupsKept = 4;
+
+  MoQAbrSwitcher(
+      std::shared_ptr<TrackConsumer> downstream,
+      std::vector<uint64_t> bitratesBps,
+      SignalsFn signals,
+      Config config);
+
+  // The consumer for rendition index.  The downstream sees SUBSCRIBE_DONE
+  // when every rendition is done.
+  std::shared_ptr<TrackConsumer> source(size_t index);
+
+  // Rendition index won't publish, e.g. its SUBSCRIBE failed
+  void disable(size_t index);
+
+  // The rendition picked for the newest group
+  size_t current() const {
+    return current_;
+  }
+
+  // Groups carried by a different rendition than the group before
+  uint64_t switches() const {
+    return switches_;
+  }
+
+ private:
+  class Source;
+
+  // True if index carries groupID, picking the rendition for a new group
+  bool accept(size_t index, uint64_t groupID);
+  size_t choose() const;
+  folly::Expected<folly::Unit, MoQPublishError> sourceDone(
+      size_t index,
+      SubscribeDone subDone);
+
+  std::shared_ptr<TrackConsumer> downstream_;
+  std::vector<uint64_t> bitratesBps_;
+  std::vector<bool> active_;
+  size_t numActive_{0};
+  SignalsFn signals_;
+  Config config_;
+  size_t current_{0};
+  folly::Optional<uint64_t> newestGroup_;
+  // Rendition carrying each recent group
+  folly::F14FastMap<uint64_t, size_t> groups_;
+  uint64_t switches_{0};
+};
+
+} // namespace moxygen
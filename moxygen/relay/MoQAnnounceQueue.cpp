@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/relay/MoQAnnounceQueue.h"
+
+#include <folly/coro/Collect.h>
+#include <folly/coro/Invoke.h>
+#include <folly/logging/xlog.h>
+
+namespace moxygen {
+
+void MoQAnnounceQueue::push(
+    Announce ann,
+    StillAnnounced stillAnnounced,
+    OnAnnounced onAnnounced) {
+  if (closed_) {
+    return;
+  }
+  pending_.push_back(
+      {std::move(ann), std::move(stillAnnounced), std::move(onAnnounced)});
+  pump();
+}
+
+void MoQAnnounceQueue::close() {
+  closed_ = true;
+  pending_.clear();
+}
+
+void MoQAnnounceQueue::pump() {
+  if (closed_ || pending_.empty() || batchScheduled_ ||
+      inFlight_ >= kMaxInFlight) {
+    return;
+  }
+  // Runs later in the loop, picking up what else is queued by then
+  batchScheduled_ = true;
+  folly::coro::co_invoke(
+      [self = shared_from_this()]() -> folly::coro::Task<void> {
+        co_await self->sendBatch();
+      })
+      .scheduleOn(evb_)
+      .start();
+}
+
+folly::coro::Task<void> MoQAnnounceQueue::sendBatch() {
+  batchScheduled_ = false;
+  std::vector<PendingAnnounce> batch;
+  while (!pending_.empty() && batch.size() < kBatchSize &&
+         inFlight_ + batch.size() < kMaxInFlight) {
+    auto entry = std::move(pending_.front());
+    pending_.pop_front();
+    // Skip namespaces unannounced while queued
+    if (entry.stillAnnounced()) {
+      batch.push_back(std::move(entry));
+    }
+  }
+  if (batch.empty()) {
+    co_return;
+  }
+  inFlight_ += batch.size();
+  // The next batch can go out while this one waits for replies
+  pump();
+
+  // Written to the control stream together
+  std::vector<folly::coro::Task<Subscriber::AnnounceResult>> announces;
+  announces.reserve(batch.size());
+  for (const auto& entry : batch) {
+    announces.push_back(subscriber_->announce(entry.ann));
+  }
+  auto results = co_await folly::coro::collectAllTryRange(std::move(announces))
+                     .scheduleOn(subscriberEvb_);
+
+  for (size_t i = 0; i < batch.size(); i++) {
+    auto& result = results[i];
+    if (result.hasException()) {
+      XLOG(ERR) << "Announce failed ex=" << result.exception().what();
+      continue;
+    }
+    if (result->hasError()) {
+      XLOG(ERR) << "Announce failed err=" << result->error().reasonPhrase;
+      continue;
+    }
+    if (closed_ || !batch[i].stillAnnounced()) {
+      // Unannounced, or the subscriber was removed, while in flight
+      subscriberEvb_->runInEventBaseThread(
+          [announceHandle = std::move(result->value())] {
+            announceHandle->unannounce();
+          });
+      continue;
+    }
+    batch[i].onAnnounced(std::move(result->value()));
+  }
+  inFlight_ -= batch.size();
+  pump();
+}
+
+} // namespace moxygen
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/coro/Task.h>
+#include <folly/io/async/EventBase.h>
+#include <moxygen/Subscriber.h>
+
+#include <deque>
+
+namespace moxygen {
+
+// ANNOUNCEs to one SUBSCRIBE_ANNOUNCES subscriber.  They are queued and sent
+// in batches of kBatchSize, each written to the control stream in one loop
+// iteration, with at most kMaxInFlight awaiting a reply.
+//
+// The queue runs on evb and calls the subscriber on subscriberEvb.
+class MoQAnnounceQueue : public std::enable_shared_from_this<MoQAnnounceQueue> {
+ public:
+  static constexpr size_t kBatchSize = 128;
+  static constexpr size_t kMaxInFlight = 1024;
+
+  // Whether the namespace is still announced, checked when its batch is
+  // sent and again when the subscriber replies
+  using StillAnnounced = std::function<bool()>;
+  // Takes the subscriber's handle once it accepts the ANNOUNCE
+  using OnAnnounced =
+      std::function<void(std::shared_ptr<Subscriber::AnnounceHandle>)>;
+
+  MoQAnnounceQueue(
+      std::shared_ptr<Subscriber> subscriber,
+      folly::EventBase* evb,
+      folly::EventBase* subscriberEvb)
+      : subscriber_(std::move(subscriber)),
+        evb_(evb),
+        subscriberEvb_(subscriberEvb) {}
+
+  void push(
+      Announce ann,
+      StillAnnounced stillAnnounced,
+      OnAnnounced onAnnounced);
+
+  // Sends nothing more, ANNOUNCEs still in flight are unannounced as they
+  // complete
+  void close();
+
+  size_t pending() const {
+    return pending_.size();
+  }
+
+  size_t inFlight() const {
+    return inFlight_;
+  }
+
+ private:
+  struct PendingAnnounce {
+    Announce ann;
+    StillAnnounced stillAnnounced;
+    OnAnnounced onAnnounced;
+  };
+
+  // Schedules a batch if under the in-flight limit
+  void pump();
+  // Sends what is queued when it runs, up to a batch
+  folly::coro::Task<void> sendBatch();
+
+  std::shared_ptr<Subscriber> subscriber_;
+  folly::EventBase* evb_;
+  folly::EventBase* subscriberEvb_;
+  std::deque<PendingAnnounce> pending_;
+  size_t inFlight_{0};
+  bool batchScheduled_{false};
+  bool closed_{false};
+};
+
+} // namespace moxygen
@@ -1,8 +1,12 @@
 #include <moxygen/relay/MoQCache.h>
+#include <moxygen/relay/MoQForwarder.h>
+#include <moxygen/util/Trace.h>
 
-// TTL / MAX_CACHE_DURATION
-// Maxmimum cache size / per track? Number of groups
-// Fancy: handle streaming incomplete objects (forwarder?)
+#include <folly/CancellationToken.h>
+#include <folly/coro/Invoke.h>
+#include <folly/io/Cursor.h>
+
+#include <map>
 
 namespace {
 using namespace moxygen;
@@ -11,6 +15,27 @@ bool isEndOfTrack(ObjectStatus status) {
   return status == ObjectStatus::END_OF_TRACK;
 }
 
+// Approximate memory held by a cached object
+uint64_t entryBytes(const MoQCache::CacheEntry& entry) {
+  return sizeof(MoQCache::CacheEntry) +
+      (entry.payload ? entry.payload->computeChainDataLength() : 0);
+}
+
+// Start of the last group in range, where a descending FETCH begins
+AbsoluteLocation newestGroupStart(const StandaloneFetch& range) {
+  if (!(range.start < range.end)) {
+    return range.start;
+  }
+  // end is exclusive
+  auto group = range.end.object > 0 ? range.end.group : range.end.group - 1;
+  return std::max(range.start, AbsoluteLocation{group, 0});
+}
+
+std::chrono::microseconds elapsedSince(MoQCache::Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      MoQCache::Clock::now() - start);
+}
+
 bool exists(ObjectStatus status) {
   return status != ObjectStatus::OBJECT_NOT_EXIST &&
       status != ObjectStatus::GROUP_NOT_EXIST;
@@ -53,6 +78,71 @@ folly::Expected<folly::Unit, MoQPublishError> publishObject(
       MoQPublishError{MoQPublishError::API_ERROR, "Unknown status"});
 }
 
+// FETCHes in a row that must start where the previous one ended before the
+// cache reads the track ahead
+constexpr uint32_t kReadAheadAfterFetches = 2;
+
+// Consumer for FETCHes that only fill the cache
+class FillSink : public FetchConsumer {
+ public:
+  folly::Expected<folly::Unit, MoQPublishError> object(
+      uint64_t,
+      uint64_t,
+      uint64_t,
+      Payload,
+      Extensions,
+      bool) override {
+    return folly::unit;
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError>
+  objectNotExists(uint64_t, uint64_t, uint64_t, Extensions, bool) override {
+    return folly::unit;
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError>
+  groupNotExists(uint64_t, uint64_t, Extensions, bool) override {
+    return folly::unit;
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> beginObject(
+      uint64_t,
+      uint64_t,
+      uint64_t,
+      uint64_t,
+      Payload,
+      Extensions) override {
+    return folly::unit;
+  }
+
+  folly::Expected<ObjectPublishStatus, MoQPublishError> objectPayload(
+      Payload,
+      bool) override {
+    return ObjectPublishStatus::IN_PROGRESS;
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError>
+  endOfGroup(uint64_t, uint64_t, uint64_t, Extensions, bool) override {
+    return folly::unit;
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError>
+  endOfTrackAndGroup(uint64_t, uint64_t, uint64_t, Extensions) override {
+    return folly::unit;
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> endOfFetch() override {
+    return folly::unit;
+  }
+
+  void reset(ResetStreamErrorCode) override {}
+
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitReadyToConsume() override {
+    return folly::makeSemiFuture();
+  }
+};
+
 } // namespace
 
 namespace moxygen {
@@ -66,9 +156,20 @@ folly::Expected<folly::Unit, MoQPublishError> MoQCache::CacheGroup::cacheObject(
     bool complete) {
   XLOG(DBG1) << "caching objID=" << objectID << " status=" << (uint32_t)status
              << " complete=" << uint32_t(complete);
-  auto it = objects.find(objectID);
-  if (it != objects.end()) {
-    auto& cachedObject = it->second;
+  MOXYGEN_TRACE_SPAN(
+      "MoQCache::cacheObject",
+      track ? FullTrackName::hash()(track->fullTrackName) : 0,
+      groupID,
+      objectID);
+  if (cache && complete) {
+    payload = cache->compactPayload(std::move(payload));
+  }
+  uint64_t oldBytes = 0;
+  uint64_t newBytes = 0;
+  CacheEntry* entry = nullptr;
+  auto cachedObject = objects.find(objectID);
+  if (cachedObject) {
+    oldBytes = entryBytes(*cachedObject);
     if (status != cachedObject->status &&
         status != ObjectStatus::OBJECT_NOT_EXIST) {
       XLOG(ERR) << "Invalid cache status change; objID=" << objectID
@@ -92,9 +193,16 @@ folly::Expected<folly::Unit, MoQPublishError> MoQCache::CacheGroup::cacheObject(
     cachedObject->extensions = extensions;
     cachedObject->payload = std::move(payload);
     cachedObject->complete = complete;
+    if (complete) {
+      cachedObject->arriving = false;
+    }
+    cachedObject->notifyProgress();
+    newBytes = entryBytes(*cachedObject);
+    entry = cachedObject;
   } else {
-    objects[objectID] = std::make_unique<CacheEntry>(
-        subgroup, status, extensions, std::move(payload), complete);
+    entry = &objects.emplace(
+        objectID, subgroup, status, extensions, std::move(payload), complete);
+    newBytes = entryBytes(*entry);
   }
   if (objectID >= maxCachedObject) {
     maxCachedObject = objectID;
@@ -102,6 +210,12 @@ folly::Expected<folly::Unit, MoQPublishError> MoQCache::CacheGroup::cacheObject(
         (status == ObjectStatus::END_OF_GROUP ||
          status == ObjectStatus::GROUP_NOT_EXIST);
   }
+  if (cache && complete) {
+    cache->indexKeyframe(*this, objectID, *entry);
+  }
+  maybeSpill();
+  // May evict this group, don't touch members after
+  updateBytes(oldBytes, newBytes);
   return folly::unit;
 }
 
@@ -115,6 +229,80 @@ void MoQCache::CacheGroup::cacheMissingStatus(
       kInvalidSubgroup, objectID, status, noExtensions(), nullptr, true);
 }
 
+MoQCache::CacheEntry* MoQCache::CacheGroup::appendPayload(
+    uint64_t objectID,
+    Payload payload,
+    bool complete) {
+  auto object = objects.find(objectID);
+  if (!object) {
+    XLOG(ERR) << "Payload for uncached objID=" << objectID;
+    return nullptr;
+  }
+  auto oldBytes = entryBytes(*object);
+  if (object->payload) {
+    object->payload->appendChain(std::move(payload));
+  } else {
+    object->payload = std::move(payload);
+  }
+  if (complete) {
+    object->complete = true;
+    object->arriving = false;
+    if (cache) {
+      object->payload = cache->compactPayload(std::move(object->payload));
+      cache->indexKeyframe(*this, objectID, *object);
+    }
+    maybeSpill();
+  }
+  object->notifyProgress();
+  updateBytes(oldBytes, entryBytes(*object));
+  return object;
+}
+
+void MoQCache::CacheGroup::setArriving(
+    uint64_t objectID,
+    uint64_t length,
+    bool arriving) {
+  auto object = objects.find(objectID);
+  if (!object || object->complete) {
+    return;
+  }
+  object->arriving = arriving;
+  object->length = length;
+  if (!arriving) {
+    // Waiting FETCHes give up on it
+    object->notifyProgress();
+  }
+}
+
+bool MoQCache::CacheGroup::isComplete() {
+  if (!endOfGroup || objects.size() != maxCachedObject + 1) {
+    return false;
+  }
+  for (uint64_t objectID = 0; objectID <= maxCachedObject; objectID++) {
+    auto object = objects.find(objectID);
+    if (!object || !object->complete) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void MoQCache::CacheGroup::maybeSpill() {
+  if (!onDisk && cache && cache->diskCache_ && isComplete()) {
+    cache->spillGroup(*this);
+  }
+}
+
+void MoQCache::CacheGroup::updateBytes(uint64_t oldBytes, uint64_t newBytes) {
+  bytes = bytes - oldBytes + newBytes;
+  if (cache) {
+    cache->cachedBytes_ = cache->cachedBytes_ - oldBytes + newBytes;
+    track->bytes = track->bytes - oldBytes + newBytes;
+    cache->touch(*this);
+    cache->evictToBudget();
+  }
+}
+
 class MoQCache::FetchHandle : public Publisher::FetchHandle {
  public:
   explicit FetchHandle(FetchOk ok) : Publisher::FetchHandle(std::move(ok)) {}
@@ -167,58 +355,486 @@ MoQCache::CacheTrack::updateLatest(AbsoluteLocation current, bool eot) {
   return folly::unit;
 }
 
-MoQCache::CacheGroup& MoQCache::CacheTrack::getOrCreateGroup(uint64_t groupID) {
+std::shared_ptr<MoQCache::CacheGroup> MoQCache::CacheTrack::getOrCreateGroup(
+    uint64_t groupID) {
   auto it = groups.find(groupID);
-  if (it == groups.end()) {
-    it = groups.emplace(groupID, std::make_unique<CacheGroup>()).first;
+  if (it != groups.end()) {
+    return it->second;
+  }
+  auto group = std::allocate_shared<CacheGroup>(
+      PoolAllocator<CacheGroup>(cache ? cache->pool_ : nullptr),
+      cache,
+      this,
+      groupID);
+  groups.emplace(groupID, group);
+  groupIDs.insert(groupID);
+  if (cache) {
+    cache->onGroupCreated(*this, *group);
+  }
+  return group;
+}
+
+void MoQCache::setConfig(Config config) {
+  if (config.diskCacheDir != config_.diskCacheDir || !diskCache_) {
+    diskCache_.reset();
+    if (!config.diskCacheDir.empty()) {
+      diskCache_ = std::make_unique<MoQDiskCache>(config.diskCacheDir);
+    }
+  }
+  if (config.payloadSlabSize != config_.payloadSlabSize ||
+      config.payloadHugePages != config_.payloadHugePages || !payloadPool_) {
+    payloadPool_.reset();
+    if (config.payloadSlabSize > 0) {
+      payloadPool_ = std::make_unique<PayloadSlabPool>(
+          config.payloadSlabSize, config.payloadHugePages);
+    }
+  }
+  admission_ = config.admission ? config.admission() : nullptr;
+  config_ = std::move(config);
+  evictExpired();
+  evictToBudget();
+  if (config_.maxCachedGroupsPerTrack > 0) {
+    for (auto& trackIt : cache_) {
+      evictOldestGroups(*trackIt.second);
+    }
+  }
+}
+
+Payload MoQCache::compactPayload(Payload payload) {
+  if (!payloadPool_ || !payload) {
+    return payload;
+  }
+  auto length = payload->computeChainDataLength();
+  // Tolerate some slack in a buffer of its own
+  if (!payload->isChained() && payload->capacity() - length <= length / 4) {
+    return payload;
+  }
+  auto compacted = payloadPool_->copy(*payload);
+  if (!compacted) {
+    return payload;
+  }
+  stats_.compactedObjects++;
+  stats_.compactedBytes += length;
+  return compacted;
+}
+
+void MoQCache::setMaxCacheDuration(
+    const FullTrackName& ftn,
+    std::chrono::milliseconds maxCacheDuration) {
+  auto trackIt = cache_.find(ftn);
+  if (trackIt == cache_.end()) {
+    XLOG(DBG1) << "setMaxCacheDuration for uncached track=" << ftn;
+    return;
+  }
+  XLOG(DBG1) << "maxCacheDuration=" << maxCacheDuration.count()
+             << "ms for track=" << ftn;
+  trackIt->second->maxCacheDuration = maxCacheDuration;
+}
+
+void MoQCache::clear() {
+  for (auto& trackIt : cache_) {
+    detachTrack(*trackIt.second);
+  }
+  cache_.clear();
+  DCHECK(lru_.empty());
+  DCHECK(expiry_.empty());
+  DCHECK_EQ(cachedBytes_, 0);
+}
+
+std::shared_ptr<MoQCache::CacheTrack> MoQCache::getOrCreateTrack(
+    const FullTrackName& ftn) {
+  auto trackIt = cache_.find(ftn);
+  if (trackIt == cache_.end()) {
+    trackIt =
+        cache_.emplace(ftn, std::make_shared<CacheTrack>(this, ftn)).first;
+  }
+  return trackIt->second;
+}
+
+std::shared_ptr<MoQCache::CacheTrack> MoQCache::findTrack(
+    const FullTrackName& ftn) {
+  auto trackIt = cache_.find(ftn);
+  if (trackIt != cache_.end()) {
+    return trackIt->second;
+  }
+  if (!diskCache_) {
+    return nullptr;
+  }
+  auto latest = diskCache_->latest(ftn);
+  if (!latest) {
+    return nullptr;
   }
-  return *it->second;
+  // Groups are read back on demand, only the largest location is known
+  XLOG(DBG1) << "Restoring track=" << ftn << " from disk";
+  auto track = getOrCreateTrack(ftn);
+  track->latestGroupAndObject = *latest;
+  return track;
 }
 
-class MoQCache::SubgroupWriteback : public SubgroupConsumer {
+void MoQCache::spillGroup(CacheGroup& group) {
+  if (diskCache_->hasGroup(group.track->fullTrackName, group.groupID)) {
+    // Written before it was evicted and cached again
+    group.onDisk = true;
+    return;
+  }
+  std::vector<MoQDiskCache::Object> objects;
+  objects.reserve(group.maxCachedObject + 1);
+  for (uint64_t objectID = 0; objectID <= group.maxCachedObject; objectID++) {
+    auto object = group.objects.find(objectID);
+    objects.push_back(
+        {objectID,
+         object->subgroup,
+         object->status,
+         object->extensions,
+         object->payload ? object->payload->clone() : nullptr});
+  }
+  if (diskCache_->writeGroup(
+          group.track->fullTrackName, group.groupID, objects)) {
+    stats_.diskWrites++;
+    group.onDisk = true;
+  }
+}
+
+std::shared_ptr<MoQCache::CacheGroup> MoQCache::restoreGroup(
+    CacheTrack& track,
+    uint64_t groupID) {
+  auto maxCacheDuration = track.maxCacheDuration.count() > 0
+      ? track.maxCacheDuration
+      : config_.defaultMaxCacheDuration;
+  if (!diskCache_ ||
+      !diskCache_->hasGroup(track.fullTrackName, groupID, maxCacheDuration)) {
+    return nullptr;
+  }
+  auto objects = diskCache_->readGroup(track.fullTrackName, groupID);
+  if (!objects || objects->empty()) {
+    return nullptr;
+  }
+  XLOG(DBG1) << "Restoring group=" << groupID
+             << " track=" << track.fullTrackName << " from disk";
+  stats_.diskReads++;
+  // The caller holds the group, it may be evicted again right away
+  auto group = track.getOrCreateGroup(groupID);
+  group->onDisk = true;
+  uint64_t bytes = 0;
+  for (auto& object : *objects) {
+    if (group->objects.find(object.objectID)) {
+      continue;
+    }
+    auto& entry = group->objects.emplace(
+        object.objectID,
+        object.subgroup,
+        object.status,
+        std::move(object.extensions),
+        std::move(object.payload),
+        true);
+    bytes += entryBytes(entry);
+    indexKeyframe(*group, object.objectID, entry);
+  }
+  group->maxCachedObject =
+      std::max(group->maxCachedObject, objects->back().objectID);
+  group->endOfGroup = true;
+  group->updateBytes(0, bytes);
+  return group;
+}
+
+void MoQCache::onGroupCreated(CacheTrack& track, CacheGroup& group) {
+  group.lruIt = lru_.insert(lru_.end(), &group);
+  auto maxCacheDuration = track.maxCacheDuration.count() > 0
+      ? track.maxCacheDuration
+      : config_.defaultMaxCacheDuration;
+  if (maxCacheDuration.count() > 0) {
+    group.expiryIt = expiry_.emplace(Clock::now() + maxCacheDuration, &group);
+  }
+  evictExpired();
+  evictOldestGroups(track);
+}
+
+void MoQCache::indexKeyframe(
+    CacheGroup& group,
+    uint64_t objectID,
+    const CacheEntry& entry) {
+  if (!config_.keyframeTime || entry.status != ObjectStatus::NORMAL ||
+      !group.track) {
+    return;
+  }
+  auto& gops = group.track->gops;
+  if (group.gopTime && gops.at(*group.gopTime).object <= objectID) {
+    // Only the first keyframe of a group starts a GOP
+    return;
+  }
+  auto time = config_.keyframeTime(entry.extensions, entry.payload.get());
+  if (!time) {
+    return;
+  }
+  if (group.gopTime) {
+    gops.erase(*group.gopTime);
+  }
+  // Keyframes of earlier groups at or past time are from before the media
+  // clock was reset, they would shadow this one
+  for (auto it = gops.lower_bound(*time); it != gops.end();) {
+    if (it->second.group < group.groupID) {
+      if (auto stale = group.track->groups.find(it->second.group);
+          stale != group.track->groups.end()) {
+        stale->second->gopTime.reset();
+      }
+      it = gops.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (auto existing = gops.find(*time); existing != gops.end()) {
+    // A later group with the same time, keep the earlier keyframe
+    return;
+  }
+  XLOG(DBG1) << "Indexing keyframe group=" << group.groupID
+             << " obj=" << objectID << " time=" << time->count() << "us";
+  gops.emplace(*time, AbsoluteLocation{group.groupID, objectID});
+  group.gopTime = *time;
+}
+
+folly::Optional<MoQCache::GopLocation> MoQCache::latestGop(
+    const FullTrackName& ftn,
+    bool complete) {
+  auto trackIt = cache_.find(ftn);
+  if (trackIt == cache_.end()) {
+    return folly::none;
+  }
+  auto& track = *trackIt->second;
+  for (auto it = track.gops.rbegin(); it != track.gops.rend(); ++it) {
+    if (complete) {
+      auto groupIt = track.groups.find(it->second.group);
+      if (groupIt == track.groups.end() || !groupIt->second->isComplete()) {
+        continue;
+      }
+    }
+    return GopLocation{it->second, it->first};
+  }
+  return folly::none;
+}
+
+folly::Optional<MoQCache::GopLocation> MoQCache::gopAt(
+    const FullTrackName& ftn,
+    std::chrono::microseconds time) const {
+  auto trackIt = cache_.find(ftn);
+  if (trackIt == cache_.end()) {
+    return folly::none;
+  }
+  auto& gops = trackIt->second->gops;
+  auto it = gops.upper_bound(time);
+  if (it == gops.begin()) {
+    return folly::none;
+  }
+  --it;
+  return GopLocation{it->second, it->first};
+}
+
+folly::Optional<AbsoluteLocation> MoQCache::endOfTrack(
+    const FullTrackName& ftn) const {
+  auto trackIt = cache_.find(ftn);
+  if (trackIt == cache_.end() || !trackIt->second->endOfTrack) {
+    return folly::none;
+  }
+  return trackIt->second->latestGroupAndObject;
+}
+
+void MoQCache::touch(CacheGroup& group) {
+  if (group.cache) {
+    lru_.splice(lru_.end(), lru_, group.lruIt);
+  }
+}
+
+bool MoQCache::isExpired(const CacheGroup& group) const {
+  return group.expiryIt && (*group.expiryIt)->first <= Clock::now();
+}
+
+void MoQCache::evictToBudget() {
+  if (config_.maxCachedBytes == 0) {
+    return;
+  }
+  auto it = lru_.begin();
+  while (cachedBytes_ > config_.maxCachedBytes && it != lru_.end()) {
+    auto group = *it++;
+    // Keep the group currently being written at the live edge
+    if (group->track->isLiveEdge(group->groupID)) {
+      continue;
+    }
+    evictGroup(*group);
+  }
+}
+
+void MoQCache::evictOldestGroups(CacheTrack& track) {
+  if (config_.maxCachedGroupsPerTrack == 0) {
+    return;
+  }
+  while (track.groups.size() > config_.maxCachedGroupsPerTrack) {
+    auto oldest = track.groupIDs.begin();
+    // Only one group is the live edge
+    if (oldest != track.groupIDs.end() && track.isLiveEdge(*oldest)) {
+      ++oldest;
+    }
+    if (oldest == track.groupIDs.end()) {
+      return;
+    }
+    auto groupIt = track.groups.find(*oldest);
+    if (groupIt == track.groups.end()) {
+      track.groupIDs.erase(oldest);
+      continue;
+    }
+    evictGroup(*groupIt->second);
+  }
+}
+
+void MoQCache::evictExpired() {
+  auto now = Clock::now();
+  auto it = expiry_.begin();
+  while (it != expiry_.end() && it->first <= now) {
+    auto group = (it++)->second;
+    if (group->track->isLiveEdge(group->groupID)) {
+      continue;
+    }
+    evictGroup(*group);
+  }
+}
+
+void MoQCache::evictGroup(CacheGroup& group) {
+  XLOG(DBG1) << "Evicting group=" << group.groupID << " bytes=" << group.bytes
+             << " track=" << group.track->fullTrackName;
+  auto track = group.track;
+  auto groupID = group.groupID;
+  if (group.gopTime) {
+    track->gops.erase(*group.gopTime);
+    group.gopTime.reset();
+  }
+  unlinkGroup(group);
+  // FETCHes waiting on arriving objects check whether they still arrive
+  group.objects.forEach([](CacheEntry& object) { object.notifyProgress(); });
+  // This may destroy the group, unless a writeback or fetch is holding it
+  track->groups.erase(groupID);
+  track->groupIDs.erase(groupID);
+  if (track->groups.empty() && !track->isLive &&
+      track->fetchInProgress.empty()) {
+    // Nothing left worth keeping, drop the track state too.  Anyone still
+    // holding the track sees it as detached.
+    XLOG(DBG1) << "Evicting track=" << track->fullTrackName;
+    auto holder = cache_.find(track->fullTrackName);
+    if (holder != cache_.end() && holder->second.get() == track) {
+      detachTrack(*track);
+      cache_.erase(holder);
+    }
+  }
+}
+
+void MoQCache::unlinkGroup(CacheGroup& group) {
+  if (!group.cache) {
+    return;
+  }
+  lru_.erase(group.lruIt);
+  if (group.expiryIt) {
+    expiry_.erase(*group.expiryIt);
+    group.expiryIt.reset();
+  }
+  cachedBytes_ -= group.bytes;
+  group.track->bytes -= group.bytes;
+  group.cache = nullptr;
+}
+
+void MoQCache::detachTrack(CacheTrack& track) {
+  for (auto& groupIt : track.groups) {
+    unlinkGroup(*groupIt.second);
+  }
+  track.cache = nullptr;
+}
+
+class MoQCache::SubgroupWriteback final : public SubgroupConsumer {
  public:
   SubgroupWriteback(
       uint64_t group,
       uint64_t subgroup,
       std::shared_ptr<SubgroupConsumer> consumer,
-      CacheTrack& cacheTrack,
-      CacheGroup& cacheGroup)
+      std::shared_ptr<CacheTrack> cacheTrack,
+      std::shared_ptr<CacheGroup> cacheGroup)
       : group_(group),
         subgroup_(subgroup),
         consumer_(std::move(consumer)),
-        cacheTrack_(cacheTrack),
-        cacheGroup_(cacheGroup) {}
+        forwarder_(
+            dynamic_cast<MoQForwarder::SubgroupForwarder*>(consumer_.get())),
+        cacheTrack_(std::move(cacheTrack)),
+        cacheGroup_(std::move(cacheGroup)) {}
   SubgroupWriteback() = delete;
   SubgroupWriteback(const SubgroupWriteback&) = delete;
   SubgroupWriteback& operator=(const SubgroupWriteback&) = delete;
   SubgroupWriteback(SubgroupWriteback&&) = delete;
   SubgroupWriteback& operator=(SubgroupWriteback&&) = delete;
 
+  ~SubgroupWriteback() override {
+    abandonObject();
+  }
+
   folly::Expected<folly::Unit, MoQPublishError> object(
       uint64_t objID,
       Payload payload,
       Extensions ext,
       bool finSub) override {
-    auto res = cacheTrack_.updateLatest({group_, objID});
+    auto res = cacheTrack_->updateLatest({group_, objID});
     if (!res) {
       return res;
     }
-    auto cPayload = payload ? payload->clone() : nullptr;
-    auto cacheRes = cacheGroup_.cacheObject(
-        subgroup_, objID, ObjectStatus::NORMAL, ext, std::move(cPayload), true);
-    if (cacheRes.hasError()) {
-      return cacheRes;
+    if (cacheGroup_) {
+      auto cacheRes = cacheGroup_->cacheObject(
+          subgroup_,
+          objID,
+          ObjectStatus::NORMAL,
+          ext,
+          payload ? payload->clone() : nullptr,
+          true);
+      if (cacheRes.hasError()) {
+        return cacheRes;
+      }
+    }
+    if (forwarder_) {
+      return forwarder_->object(
+          objID, std::move(payload), std::move(ext), finSub);
     }
     return consumer_->object(objID, std::move(payload), std::move(ext), finSub);
   }
 
+  folly::Expected<folly::Unit, MoQPublishError> objects(
+      std::span<SubgroupObject> batch,
+      bool finSub) override {
+    for (auto& obj : batch) {
+      auto res = cacheTrack_->updateLatest({group_, obj.objectID});
+      if (!res) {
+        return res;
+      }
+      if (!cacheGroup_) {
+        continue;
+      }
+      auto cacheRes = cacheGroup_->cacheObject(
+          subgroup_,
+          obj.objectID,
+          ObjectStatus::NORMAL,
+          obj.extensions,
+          obj.payload ? obj.payload->clone() : nullptr,
+          true);
+      if (cacheRes.hasError()) {
+        return cacheRes;
+      }
+    }
+    if (forwarder_) {
+      return forwarder_->objects(batch, finSub);
+    }
+    return consumer_->objects(batch, finSub);
+  }
+
   folly::Expected<folly::Unit, MoQPublishError>
   objectNotExists(uint64_t objID, Extensions ext, bool finSub) override {
-    auto res = cacheTrack_.updateLatest({group_, objID});
+    auto res = cacheTrack_->updateLatest({group_, objID});
     if (!res) {
       return res;
     }
-    cacheGroup_.cacheMissingStatus(objID, ObjectStatus::OBJECT_NOT_EXIST);
+    if (cacheGroup_) {
+      cacheGroup_->cacheMissingStatus(objID, ObjectStatus::OBJECT_NOT_EXIST);
+    }
     return consumer_->objectNotExists(objID, std::move(ext), finSub);
   }
 
@@ -231,11 +847,15 @@ class MoQCache::SubgroupWriteback : public SubgroupConsumer {
       uint64_t length,
       Payload initialPayload,
       Extensions extensions) override {
-    auto res = cacheTrack_.updateLatest({group_, objectID});
+    auto res = cacheTrack_->updateLatest({group_, objectID});
     if (!res) {
       return res;
     }
-    auto cacheRes = cacheGroup_.cacheObject(
+    if (!cacheGroup_) {
+      return consumer_->beginObject(
+          objectID, length, std::move(initialPayload), std::move(extensions));
+    }
+    auto cacheRes = cacheGroup_->cacheObject(
         subgroup_,
         objectID,
         ObjectStatus::NORMAL,
@@ -250,6 +870,9 @@ class MoQCache::SubgroupWriteback : public SubgroupConsumer {
     if (initialPayload) {
       currentLength_ -= initialPayload->computeChainDataLength();
     }
+    if (currentLength_ > 0) {
+      cacheGroup_->setArriving(objectID, length, true);
+    }
     return consumer_->beginObject(
         objectID, length, std::move(initialPayload), std::move(extensions));
   }
@@ -257,11 +880,10 @@ class MoQCache::SubgroupWriteback : public SubgroupConsumer {
   folly::Expected<ObjectPublishStatus, MoQPublishError> objectPayload(
       Payload payload,
       bool finSubgroup) override {
-    auto& object = cacheGroup_.objects[currentObject_];
-    object->payload->appendChain(payload->clone());
-    currentLength_ -= payload->computeChainDataLength();
-    if (currentLength_ == 0) {
-      object->complete = true;
+    if (cacheGroup_) {
+      currentLength_ -= payload->computeChainDataLength();
+      cacheGroup_->appendPayload(
+          currentObject_, payload->clone(), currentLength_ == 0);
     }
     return consumer_->objectPayload(std::move(payload), finSubgroup);
   }
@@ -269,19 +891,21 @@ class MoQCache::SubgroupWriteback : public SubgroupConsumer {
   folly::Expected<folly::Unit, MoQPublishError> endOfGroup(
       uint64_t endOfGroupObjectID,
       Extensions extensions) override {
-    auto res = cacheTrack_.updateLatest({group_, endOfGroupObjectID});
+    auto res = cacheTrack_->updateLatest({group_, endOfGroupObjectID});
     if (!res) {
       return res;
     }
-    auto cacheRes = cacheGroup_.cacheObject(
-        subgroup_,
-        endOfGroupObjectID,
-        ObjectStatus::END_OF_GROUP,
-        extensions,
-        nullptr,
-        true);
-    if (cacheRes.hasError()) {
-      return cacheRes;
+    if (cacheGroup_) {
+      auto cacheRes = cacheGroup_->cacheObject(
+          subgroup_,
+          endOfGroupObjectID,
+          ObjectStatus::END_OF_GROUP,
+          extensions,
+          nullptr,
+          true);
+      if (cacheRes.hasError()) {
+        return cacheRes;
+      }
     }
     return consumer_->endOfGroup(endOfGroupObjectID, std::move(extensions));
   }
@@ -289,19 +913,21 @@ class MoQCache::SubgroupWriteback : public SubgroupConsumer {
   folly::Expected<folly::Unit, MoQPublishError> endOfTrackAndGroup(
       uint64_t endOfTrackObjectID,
       Extensions extensions) override {
-    auto res = cacheTrack_.updateLatest({group_, endOfTrackObjectID}, true);
+    auto res = cacheTrack_->updateLatest({group_, endOfTrackObjectID}, true);
     if (!res) {
       return res;
     }
-    auto cacheRes = cacheGroup_.cacheObject(
-        subgroup_,
-        endOfTrackObjectID,
-        ObjectStatus::END_OF_TRACK,
-        extensions,
-        nullptr,
-        true);
-    if (cacheRes.hasError()) {
-      return cacheRes;
+    if (cacheGroup_) {
+      auto cacheRes = cacheGroup_->cacheObject(
+          subgroup_,
+          endOfTrackObjectID,
+          ObjectStatus::END_OF_TRACK,
+          extensions,
+          nullptr,
+          true);
+      if (cacheRes.hasError()) {
+        return cacheRes;
+      }
     }
     return consumer_->endOfTrackAndGroup(
         endOfTrackObjectID, std::move(extensions));
@@ -312,15 +938,28 @@ class MoQCache::SubgroupWriteback : public SubgroupConsumer {
   }
 
   void reset(ResetStreamErrorCode error) override {
+    abandonObject();
     return consumer_->reset(error);
   }
 
  private:
+  // The rest of a partial object is never coming
+  void abandonObject() {
+    if (currentLength_ > 0) {
+      cacheGroup_->setArriving(currentObject_, 0, false);
+      currentLength_ = 0;
+    }
+  }
+
   uint64_t group_;
   uint64_t subgroup_;
   std::shared_ptr<SubgroupConsumer> consumer_;
-  CacheTrack& cacheTrack_;
-  CacheGroup& cacheGroup_;
+  // consumer_ when it is a relay's forwarder, which is final, so the calls
+  // for every object are direct and can be inlined
+  MoQForwarder::SubgroupForwarder* forwarder_;
+  std::shared_ptr<CacheTrack> cacheTrack_;
+  // nullptr if the group was not admitted, only the track's latest is kept
+  std::shared_ptr<CacheGroup> cacheGroup_;
   uint64_t currentObject_{0};
   uint64_t currentLength_{0};
 };
@@ -329,9 +968,14 @@ class MoQCache::SubgroupWriteback : public SubgroupConsumer {
 // Also maintains the "live" bit for tracks in the cache.
 class MoQCache::SubscribeWriteback : public TrackConsumer {
  public:
-  SubscribeWriteback(std::shared_ptr<TrackConsumer> consumer, CacheTrack& track)
-      : consumer_(std::move(consumer)), track_(track) {
-    track_.isLive = true;
+  SubscribeWriteback(
+      std::shared_ptr<TrackConsumer> consumer,
+      std::shared_ptr<CacheTrack> track,
+      std::function<size_t()> subscribers)
+      : consumer_(std::move(consumer)),
+        track_(std::move(track)),
+        subscribers_(std::move(subscribers)) {
+    track_->isLive = true;
   }
   SubscribeWriteback() = delete;
   SubscribeWriteback(const SubscribeWriteback&) = delete;
@@ -340,7 +984,7 @@ class MoQCache::SubscribeWriteback : public TrackConsumer {
   SubscribeWriteback& operator=(SubscribeWriteback&&) = delete;
 
   ~SubscribeWriteback() override {
-    track_.isLive = false;
+    track_->isLive = false;
   }
 
   folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
@@ -353,7 +997,7 @@ class MoQCache::SubscribeWriteback : public TrackConsumer {
           subgroupID,
           std::move(res.value()),
           track_,
-          track_.getOrCreateGroup(groupID));
+          admitGroup(groupID) ? track_->getOrCreateGroup(groupID) : nullptr);
     } else {
       return res;
     }
@@ -372,16 +1016,18 @@ class MoQCache::SubscribeWriteback : public TrackConsumer {
     if (!res) {
       return res;
     }
-    auto cacheRes = track_.getOrCreateGroup(header.group)
-                        .cacheObject(
-                            header.subgroup,
-                            header.id,
-                            header.status,
-                            header.extensions,
-                            payload ? payload->clone() : nullptr,
-                            true);
-    if (cacheRes.hasError()) {
-      return cacheRes;
+    if (admitGroup(header.group)) {
+      auto cacheRes = track_->getOrCreateGroup(header.group)
+                          ->cacheObject(
+                              header.subgroup,
+                              header.id,
+                              header.status,
+                              header.extensions,
+                              payload ? payload->clone() : nullptr,
+                              true);
+      if (cacheRes.hasError()) {
+        return cacheRes;
+      }
     }
     return consumer_->objectStream(header, std::move(payload));
   }
@@ -394,16 +1040,18 @@ class MoQCache::SubscribeWriteback : public TrackConsumer {
     if (!res) {
       return res;
     }
-    auto cacheRes = track_.getOrCreateGroup(header.group)
-                        .cacheObject(
-                            header.subgroup,
-                            header.id,
-                            header.status,
-                            header.extensions,
-                            payload ? payload->clone() : nullptr,
-                            true);
-    if (cacheRes.hasError()) {
-      return cacheRes;
+    if (admitGroup(header.group)) {
+      auto cacheRes = track_->getOrCreateGroup(header.group)
+                          ->cacheObject(
+                              header.subgroup,
+                              header.id,
+                              header.status,
+                              header.extensions,
+                              payload ? payload->clone() : nullptr,
+                              true);
+      if (cacheRes.hasError()) {
+        return cacheRes;
+      }
     }
     return consumer_->datagram(header, std::move(payload));
   }
@@ -417,8 +1065,10 @@ class MoQCache::SubscribeWriteback : public TrackConsumer {
     if (!res) {
       return res;
     }
-    track_.getOrCreateGroup(groupID).cacheMissingStatus(
-        0, ObjectStatus::GROUP_NOT_EXIST);
+    if (admitGroup(groupID)) {
+      track_->getOrCreateGroup(groupID)->cacheMissingStatus(
+          0, ObjectStatus::GROUP_NOT_EXIST);
+    }
     return consumer_->groupNotExists(
         groupID, subgroup, pri, std::move(extensions));
   }
@@ -429,8 +1079,52 @@ class MoQCache::SubscribeWriteback : public TrackConsumer {
   }
 
  private:
+  // Whether objects of groupID are cached, decided at its first object
+  bool admitGroup(uint64_t groupID) {
+    auto cache = track_->cache;
+    if (!cache || !cache->admission_) {
+      return true;
+    }
+    auto it = admitted_.find(groupID);
+    if (it != admitted_.end()) {
+      return it->second;
+    }
+    // Groups a FETCH already brought in keep being filled
+    bool admitted = track_->groups.contains(groupID) ||
+        cache->admitGroup(*track_, groupID, subscribers_ ? subscribers_() : 0);
+    admitted_.emplace(groupID, admitted);
+    if (admitted_.size() > kMaxOpenGroups) {
+      admitted_.erase(admitted_.begin());
+    }
+    return admitted;
+  }
+
+  // Subgroups of this many groups may be open at once
+  static constexpr size_t kMaxOpenGroups = 8;
+
   std::shared_ptr<TrackConsumer> consumer_;
-  CacheTrack& track_;
+  std::shared_ptr<CacheTrack> track_;
+  std::function<size_t()> subscribers_;
+  // The decision for each of the newest groups
+  std::map<uint64_t, bool> admitted_;
+};
+
+// Shared by a FETCH and the writebacks of its upstream FETCHes.  The stats
+// are reported when the last of them is done.
+struct MoQCache::FetchStatsReporter {
+  FetchStatsReporter(
+      std::shared_ptr<FetchStatsCallback> inCallback,
+      FullTrackName fullTrackName)
+      : callback(std::move(inCallback)) {
+    stats.fullTrackName = std::move(fullTrackName);
+  }
+
+  ~FetchStatsReporter() {
+    callback->onFetchComplete(stats);
+  }
+
+  std::shared_ptr<FetchStatsCallback> callback;
+  FetchStats stats;
 };
 
 // Caches incoming objects and forwards them to the consumer. Handles gaps in
@@ -442,20 +1136,25 @@ class MoQCache::FetchWriteback : public FetchConsumer {
       AbsoluteLocation end,
       bool proxyFin,
       std::shared_ptr<FetchConsumer> consumer,
-      CacheTrack& track)
+      std::shared_ptr<CacheTrack> track,
+      std::shared_ptr<FetchStatsReporter> fetchStats)
       : start_(start),
         end_(end),
         proxyFin_(proxyFin),
         consumer_(std::move(consumer)),
-        track_(track) {
-    inProgressIntervalIt_ = track_.fetchInProgress.insert(start_, end_, this);
+        track_(std::move(track)),
+        fetchStats_(std::move(fetchStats)) {
+    if (fetchStats_) {
+      fetchStats_->stats.missRanges.emplace_back(start_, end_);
+    }
+    inProgressIntervalIt_ = track_->fetchInProgress.insert(start_, end_, this);
   }
 
   ~FetchWriteback() override {
     XLOG(DBG1) << "FetchWriteback destructing";
     inProgress_.post();
     if (inProgressIntervalIt_) {
-      track_.fetchInProgress.erase(*inProgressIntervalIt_);
+      track_->fetchInProgress.erase(*inProgressIntervalIt_);
     }
     cancelSource_.requestCancellation();
   }
@@ -468,7 +1167,7 @@ class MoQCache::FetchWriteback : public FetchConsumer {
         inProgress_.reset();
       } else {
         XLOG(DBG1) << "Erasing inProgressIntervalIt_";
-        track_.fetchInProgress.erase(*inProgressIntervalIt_);
+        track_->fetchInProgress.erase(*inProgressIntervalIt_);
         inProgressIntervalIt_.reset();
       }
     } // else, maybe object() after reset()?
@@ -496,6 +1195,7 @@ class MoQCache::FetchWriteback : public FetchConsumer {
       Extensions ext,
       bool fin) override {
     constexpr auto kNormal = ObjectStatus::NORMAL;
+    countUpstream(1, payload);
     auto res =
         cacheImpl(gID, sgID, objID, kNormal, ext, payload->clone(), true, fin);
     if (!res) {
@@ -553,6 +1253,7 @@ class MoQCache::FetchWriteback : public FetchConsumer {
       Payload initPayload,
       Extensions ext) override {
     constexpr auto kNormal = ObjectStatus::NORMAL;
+    countUpstream(1, initPayload);
     auto payload = initPayload ? initPayload->clone() : nullptr;
     auto res = cacheImpl(
         gID, sgID, objID, kNormal, ext, std::move(payload), false, false);
@@ -570,17 +1271,10 @@ class MoQCache::FetchWriteback : public FetchConsumer {
   folly::Expected<ObjectPublishStatus, MoQPublishError> objectPayload(
       Payload payload,
       bool finFetch) override {
-    auto& group = track_.getOrCreateGroup(start_.group);
-    auto& object = group.objects[start_.object];
-    if (object->payload) {
-      object->payload->appendChain(payload->clone());
-    } else {
-      object->payload = payload->clone();
-    }
+    countUpstream(0, payload);
     currentLength_ -= payload->computeChainDataLength();
-    if (currentLength_ == 0) {
-      object->complete = true;
-    }
+    track_->getOrCreateGroup(start_.group)
+        ->appendPayload(start_.object, payload->clone(), currentLength_ == 0);
     if (finFetch) {
       cacheMissing(end_);
       updateInProgress();
@@ -658,7 +1352,7 @@ class MoQCache::FetchWriteback : public FetchConsumer {
   AbsoluteLocation end_;
   bool proxyFin_{false};
   std::shared_ptr<FetchConsumer> consumer_;
-  CacheTrack& track_;
+  std::shared_ptr<CacheTrack> track_;
   folly::Optional<FetchInProgresSet::IntervalMap::iterator>
       inProgressIntervalIt_;
   folly::coro::Baton inProgress_;
@@ -666,22 +1360,32 @@ class MoQCache::FetchWriteback : public FetchConsumer {
   uint64_t currentLength_{0};
   bool wasReset_{false};
   folly::CancellationSource cancelSource_;
+  std::shared_ptr<FetchStatsReporter> fetchStats_;
+
+  void countUpstream(uint64_t objects, const Payload& payload) {
+    if (fetchStats_) {
+      fetchStats_->stats.upstreamObjects += objects;
+      fetchStats_->stats.upstreamBytes +=
+          payload ? payload->computeChainDataLength() : 0;
+    }
+  }
 
   void cacheMissing(AbsoluteLocation current) {
     while (start_ < current) {
-      auto& group = track_.getOrCreateGroup(start_.group);
+      auto group = track_->getOrCreateGroup(start_.group);
       if (start_.group < current.group) {
         if (start_.object == 0) {
-          track_.updateLatest({start_.group, 0});
-          group.cacheMissingStatus(0, ObjectStatus::GROUP_NOT_EXIST);
+          track_->updateLatest({start_.group, 0});
+          group->cacheMissingStatus(0, ObjectStatus::GROUP_NOT_EXIST);
         } else {
-          group.endOfGroup = true;
+          group->endOfGroup = true;
         }
         start_.group++;
         start_.object = 0;
       } else {
-        track_.updateLatest({start_.group, start_.object});
-        group.cacheMissingStatus(start_.object, ObjectStatus::OBJECT_NOT_EXIST);
+        track_->updateLatest({start_.group, start_.object});
+        group->cacheMissingStatus(
+            start_.object, ObjectStatus::OBJECT_NOT_EXIST);
         start_.object++;
       }
     }
@@ -697,14 +1401,14 @@ class MoQCache::FetchWriteback : public FetchConsumer {
       bool complete,
       bool finFetch) {
     cacheMissing({groupID, objectID});
-    auto& group = track_.getOrCreateGroup(groupID);
-    auto cacheRes = group.cacheObject(
+    auto group = track_->getOrCreateGroup(groupID);
+    auto cacheRes = group->cacheObject(
         subgroupID, objectID, status, extensions, std::move(payload), complete);
     if (cacheRes.hasError()) {
       updateInProgress();
       return cacheRes;
     }
-    auto res = track_.updateLatest({groupID, objectID}, isEndOfTrack(status));
+    auto res = track_->updateLatest({groupID, objectID}, isEndOfTrack(status));
     if (!res) {
       updateInProgress();
       return res;
@@ -723,13 +1427,36 @@ class MoQCache::FetchWriteback : public FetchConsumer {
 
 std::shared_ptr<TrackConsumer> MoQCache::getSubscribeWriteback(
     const FullTrackName& ftn,
-    std::shared_ptr<TrackConsumer> consumer) {
-  auto trackIt = cache_.find(ftn);
-  if (trackIt == cache_.end()) {
-    trackIt = cache_.emplace(ftn, CacheTrack()).first;
-  }
+    std::shared_ptr<TrackConsumer> consumer,
+    std::function<size_t()> subscribers) {
   return std::make_shared<SubscribeWriteback>(
-      std::move(consumer), trackIt->second);
+      std::move(consumer), getOrCreateTrack(ftn), std::move(subscribers));
+}
+
+void MoQCache::onTrackRequested(const FullTrackName& ftn) {
+  if (admission_) {
+    admission_->onRequest(ftn);
+  }
+}
+
+bool MoQCache::admitGroup(
+    const CacheTrack& track,
+    uint64_t groupID,
+    size_t subscribers) {
+  // The group evicted next, once the cache is within 1/16th of its budget
+  const FullTrackName* victim = nullptr;
+  if (config_.maxCachedBytes > 0 && !lru_.empty() &&
+      cachedBytes_ >= config_.maxCachedBytes - config_.maxCachedBytes / 16) {
+    victim = &lru_.front()->track->fullTrackName;
+  }
+  bool admitted = admission_->admit(
+      {track.fullTrackName, groupID, subscribers, victim});
+  if (admitted) {
+    stats_.admittedGroups++;
+  } else {
+    stats_.rejectedGroups++;
+  }
+  return admitted;
 }
 
 folly::coro::Task<Publisher::FetchResult> MoQCache::fetch(
@@ -738,12 +1465,29 @@ folly::coro::Task<Publisher::FetchResult> MoQCache::fetch(
     std::shared_ptr<Publisher> upstream) {
   auto standalone = std::get_if<StandaloneFetch>(&fetch.args);
   CHECK(standalone);
-  auto emplaceResult = cache_.emplace(fetch.fullTrackName, CacheTrack());
-  auto trackIt = emplaceResult.first;
-  auto& track = trackIt->second;
-  if (emplaceResult.second) {
+  evictExpired();
+  stats_.fetches++;
+  std::shared_ptr<FetchStatsReporter> fetchStats;
+  if (fetchStatsCallback_) {
+    fetchStats = std::make_shared<FetchStatsReporter>(
+        fetchStatsCallback_, fetch.fullTrackName);
+  }
+  auto track = findTrack(fetch.fullTrackName);
+  bool cached = track != nullptr;
+  if (!cached) {
+    track = getOrCreateTrack(fetch.fullTrackName);
+  }
+  maybeReadAhead(
+      track, fetch, upstream, co_await folly::coro::co_current_executor);
+  bool newestFirst = fetch.groupOrder == GroupOrder::NewestFirst;
+  if (!cached) {
     // track is new (not cached), forward upstream, with writeback
     XLOG(DBG1) << "Cache miss, upstream fetch";
+    stats_.upstreamFetches++;
+    if (newestFirst) {
+      // Writebacks fill the cache in ascending order only
+      co_return co_await upstream->fetch(std::move(fetch), std::move(consumer));
+    }
     co_return co_await upstream->fetch(
         fetch,
         std::make_shared<FetchWriteback>(
@@ -751,7 +1495,13 @@ folly::coro::Task<Publisher::FetchResult> MoQCache::fetch(
             standalone->end,
             true,
             std::move(consumer),
-            track));
+            track,
+            std::move(fetchStats)));
+  }
+  // A descending FETCH past what the cache knows is forwarded as is
+  folly::Optional<Fetch> passThrough;
+  if (newestFirst) {
+    passThrough = fetch;
   }
   AbsoluteLocation last = standalone->end;
   if (last.object > 0) {
@@ -763,27 +1513,43 @@ folly::coro::Task<Publisher::FetchResult> MoQCache::fetch(
     // TODO: handle case where track.largestGroupAndObject is an END_OF_GROUP
     // or END_OF_TRACK
   }
-  if (track.latestGroupAndObject &&
-      (track.isLive || last <= *track.latestGroupAndObject)) {
+  if (track->latestGroupAndObject &&
+      (track->isLive || last <= *track->latestGroupAndObject)) {
     // we can immediately return fetch OK
     XLOG(DBG1) << "Live track or known past data, return FetchOK";
     AbsoluteLocation largestInFetch = standalone->end;
     bool isEndOfTrack = false;
-    if (standalone->end >= *track.latestGroupAndObject) {
-      standalone->end = *track.latestGroupAndObject;
+    if (standalone->end >= *track->latestGroupAndObject) {
+      standalone->end = *track->latestGroupAndObject;
       standalone->end.object++;
       largestInFetch = standalone->end;
-      isEndOfTrack = track.endOfTrack;
+      isEndOfTrack = track->endOfTrack;
       // fetchImpl range exclusive of end
     } else if (largestInFetch.object == 0) {
       largestInFetch.group--;
     }
     auto fetchHandle = std::make_shared<FetchHandle>(FetchOk(
         {fetch.requestID,
-         GroupOrder::OldestFirst,
+         newestFirst ? GroupOrder::NewestFirst : GroupOrder::OldestFirst,
          isEndOfTrack,
          largestInFetch,
          {}}));
+    if (newestFirst) {
+      auto from = newestGroupStart(*standalone);
+      folly::coro::co_withCancellation(
+          fetchHandle->getToken(),
+          fetchDescending(
+              fetchHandle,
+              std::move(fetch),
+              from,
+              track,
+              std::move(consumer),
+              std::move(upstream),
+              std::move(fetchStats)))
+          .scheduleOn(co_await folly::coro::co_current_executor)
+          .start();
+      co_return fetchHandle;
+    }
     folly::coro::co_withCancellation(
         fetchHandle->getToken(),
         fetchImpl(
@@ -791,10 +1557,16 @@ folly::coro::Task<Publisher::FetchResult> MoQCache::fetch(
             std::move(fetch),
             track,
             std::move(consumer),
-            std::move(upstream)))
+            std::move(upstream),
+            std::move(fetchStats)))
         .scheduleOn(co_await folly::coro::co_current_executor)
         .start();
     co_return fetchHandle;
+  } else if (passThrough) {
+    XLOG(DBG1) << "Descending fetch past known objects, upstream fetch";
+    stats_.upstreamFetches++;
+    co_return co_await upstream->fetch(
+        std::move(*passThrough), std::move(consumer));
   } else {
     XLOG(DBG1) << "No objects, or end > lastest and not live, fetchImpl";
     co_return co_await fetchImpl(
@@ -802,16 +1574,367 @@ folly::coro::Task<Publisher::FetchResult> MoQCache::fetch(
         std::move(fetch),
         track,
         std::move(consumer),
-        std::move(upstream));
+        std::move(upstream),
+        std::move(fetchStats));
+  }
+}
+
+folly::Optional<Publisher::FetchResult> MoQCache::tryFetchFromCache(
+    const Fetch& fetch,
+    std::shared_ptr<FetchConsumer> consumer,
+    std::shared_ptr<Publisher> upstream,
+    folly::Executor::KeepAlive<> executor) {
+  auto standalone = std::get_if<StandaloneFetch>(&fetch.args);
+  if (!standalone) {
+    return folly::none;
+  }
+  evictExpired();
+  auto track = findTrack(fetch.fullTrackName);
+  if (!track) {
+    return folly::none;
+  }
+  // Same range and FETCH_OK as fetch() gives for known past data
+  auto end = standalone->end;
+  AbsoluteLocation last = end;
+  if (last.object > 0) {
+    last.object--;
+  } else {
+    last.object = std::numeric_limits<uint64_t>::max();
+    end.group++;
+  }
+  if (!track->latestGroupAndObject ||
+      !(track->isLive || last <= *track->latestGroupAndObject)) {
+    return folly::none;
+  }
+  AbsoluteLocation largestInFetch = end;
+  bool endOfTrack = false;
+  if (end >= *track->latestGroupAndObject) {
+    end = *track->latestGroupAndObject;
+    end.object++;
+    largestInFetch = end;
+    endOfTrack = track->endOfTrack;
+  } else if (largestInFetch.object == 0) {
+    largestInFetch.group--;
+  }
+
+  // Find every object before publishing any, so a miss changes nothing
+  std::vector<std::pair<AbsoluteLocation, const CacheEntry*>> objects;
+  // Groups read back from disk, which could otherwise be evicted again
+  std::vector<std::shared_ptr<CacheGroup>> restored;
+  // Collects the objects in [current, stop), false on a miss
+  auto collect = [&](AbsoluteLocation current, AbsoluteLocation stop) {
+    while (current < stop &&
+           (!track->endOfTrack || current <= *track->latestGroupAndObject)) {
+      auto groupIt = track->groups.find(current.group);
+      CacheGroup* groupPtr = nullptr;
+      if (groupIt != track->groups.end()) {
+        if (isExpired(*groupIt->second) && !track->isLiveEdge(current.group)) {
+          return false;
+        }
+        groupPtr = groupIt->second.get();
+      } else if (auto group = restoreGroup(*track, current.group)) {
+        groupPtr = group.get();
+        restored.push_back(std::move(group));
+      } else {
+        return false;
+      }
+      auto& group = *groupPtr;
+      auto object = group.objects.find(current.object);
+      if (!object || !object->complete) {
+        return false;
+      }
+      touch(group);
+      objects.emplace_back(current, object);
+      if (isEndOfTrack(object->status)) {
+        break;
+      }
+      current.object++;
+      if (current.object > group.maxCachedObject && group.endOfGroup) {
+        current.group++;
+        current.object = 0;
+      }
+    }
+    return true;
+  };
+  bool newestFirst = fetch.groupOrder == GroupOrder::NewestFirst;
+  StandaloneFetch range(standalone->start, end);
+  if (!newestFirst) {
+    if (!collect(range.start, range.end)) {
+      return folly::none;
+    }
+  } else if (range.start < range.end) {
+    // Groups from the newest, each from its first object
+    for (auto group = newestGroupStart(range).group;; group--) {
+      auto groupStart = std::max(range.start, AbsoluteLocation{group, 0});
+      auto groupEnd = std::min(range.end, AbsoluteLocation{group + 1, 0});
+      if (!collect(groupStart, groupEnd)) {
+        return folly::none;
+      }
+      if (group <= range.start.group) {
+        break;
+      }
+    }
+  }
+  if (objects.empty()) {
+    return folly::none;
+  }
+
+  stats_.fetches++;
+  stats_.syncFetches++;
+  maybeReadAhead(track, fetch, upstream, executor);
+  std::shared_ptr<FetchStatsReporter> fetchStats;
+  if (fetchStatsCallback_) {
+    fetchStats = std::make_shared<FetchStatsReporter>(
+        fetchStatsCallback_, fetch.fullTrackName);
+  }
+  auto fetchHandle = std::make_shared<FetchHandle>(FetchOk(
+      {fetch.requestID,
+       newestFirst ? GroupOrder::NewestFirst : GroupOrder::OldestFirst,
+       endOfTrack,
+       largestInFetch,
+       {}}));
+  for (size_t i = 0; i < objects.size(); i++) {
+    const auto& [location, object] = objects[i];
+    auto lastObject = i + 1 == objects.size();
+    auto objectBytes =
+        object->payload ? object->payload->computeChainDataLength() : 0;
+    stats_.hitObjects++;
+    stats_.hitBytes += objectBytes;
+    if (fetchStats) {
+      fetchStats->stats.hitObjects++;
+      fetchStats->stats.hitBytes += objectBytes;
+    }
+    MOXYGEN_TRACE_SPAN(
+        "MoQCache::serveObject",
+        FullTrackName::hash()(fetch.fullTrackName),
+        location.group,
+        location.object);
+    auto res =
+        publishObject(object->status, consumer, location, *object, lastObject);
+    if (res.hasError()) {
+      if (res.error().code != MoQPublishError::BLOCKED) {
+        XLOG(ERR) << "Consumer error=" << res.error().msg;
+        consumer->reset(ResetStreamErrorCode::INTERNAL_ERROR);
+        return folly::makeUnexpected(FetchError{
+            fetch.requestID,
+            FetchErrorCode::INTERNAL_ERROR,
+            folly::to<std::string>(
+                "Consumer error on object=", res.error().msg)});
+      }
+      if (lastObject) {
+        break;
+      }
+      // fetchImpl resumes from the next object once the consumer unblocks
+      XLOG(DBG1) << "Fetch blocked, serving the rest from a task";
+      auto from = objects[i + 1].first;
+      auto rest = fetch;
+      rest.args = newestFirst ? range : StandaloneFetch(from, end);
+      folly::coro::co_withCancellation(
+          fetchHandle->getToken(),
+          folly::coro::co_invoke(
+              [this,
+               fetchHandle,
+               rest = std::move(rest),
+               from,
+               newestFirst,
+               track,
+               consumer,
+               upstream = std::move(upstream),
+               fetchStats = std::move(fetchStats)]() mutable
+              -> folly::coro::Task<void> {
+                auto blockedStart = Clock::now();
+                auto blockedRes = co_await handleBlocked(consumer, rest);
+                if (fetchStats) {
+                  fetchStats->stats.blockedTime += elapsedSince(blockedStart);
+                }
+                if (blockedRes.hasError()) {
+                  co_return;
+                }
+                if (newestFirst) {
+                  co_await fetchDescending(
+                      std::move(fetchHandle),
+                      std::move(rest),
+                      from,
+                      std::move(track),
+                      std::move(consumer),
+                      std::move(upstream),
+                      std::move(fetchStats));
+                  co_return;
+                }
+                co_await fetchImpl(
+                    std::move(fetchHandle),
+                    std::move(rest),
+                    std::move(track),
+                    std::move(consumer),
+                    std::move(upstream),
+                    std::move(fetchStats));
+              }))
+          .scheduleOn(std::move(executor))
+          .start();
+      return fetchHandle;
+    }
+  }
+  stats_.fetchHits++;
+  return fetchHandle;
+}
+
+void MoQCache::maybeReadAhead(
+    std::shared_ptr<CacheTrack> track,
+    const Fetch& fetch,
+    std::shared_ptr<Publisher> upstream,
+    folly::Executor::KeepAlive<> executor) {
+  auto standalone = std::get_if<StandaloneFetch>(&fetch.args);
+  if (config_.readAheadGroups == 0 || !standalone || !upstream ||
+      fetch.groupOrder == GroupOrder::NewestFirst) {
+    return;
+  }
+  auto firstGroup = standalone->start.group;
+  auto lastGroup = standalone->end.group;
+  if (track->lastFetchedGroup && firstGroup >= *track->lastFetchedGroup &&
+      firstGroup <= *track->lastFetchedGroup + 1) {
+    track->sequentialFetches++;
+  } else {
+    track->sequentialFetches = 1;
+  }
+  track->lastFetchedGroup = lastGroup;
+  if (track->sequentialFetches < kReadAheadAfterFetches) {
+    return;
+  }
+  auto start = std::max(lastGroup + 1, track->readAheadEnd);
+  auto end = lastGroup + 1 + config_.readAheadGroups;
+  if (track->latestGroupAndObject) {
+    if (track->endOfTrack) {
+      end = std::min(end, track->latestGroupAndObject->group + 1);
+    } else if (track->isLive) {
+      // Groups from the live edge on come from the subscription
+      end = std::min(end, track->latestGroupAndObject->group);
+    }
+  }
+  // Skip groups that are cached or on their way
+  while (start < end) {
+    auto groupIt = track->groups.find(start);
+    if ((groupIt == track->groups.end() || !groupIt->second->isComplete()) &&
+        !track->fetchInProgress.getValue({start, 0})) {
+      break;
+    }
+    start++;
+  }
+  if (start >= end) {
+    return;
+  }
+  track->readAheadEnd = end;
+  XLOG(DBG1) << "Read ahead groups [" << start << ", " << end
+             << ") track=" << track->fullTrackName;
+  stats_.readAheadFetches++;
+  // Behind any FETCH a viewer is waiting on
+  fillFromUpstream(
+      std::move(track),
+      fetch.fullTrackName,
+      start,
+      end,
+      std::numeric_limits<uint8_t>::max(),
+      std::move(upstream),
+      std::move(executor));
+}
+
+void MoQCache::issueFetchChunks(
+    const std::shared_ptr<CacheTrack>& track,
+    const Fetch& fetch,
+    uint64_t startGroup,
+    uint64_t endGroup,
+    const std::shared_ptr<Publisher>& upstream,
+    folly::Executor::KeepAlive<> executor) {
+  if (track->latestGroupAndObject) {
+    if (track->endOfTrack) {
+      endGroup = std::min(endGroup, track->latestGroupAndObject->group + 1);
+    } else if (track->isLive) {
+      endGroup = std::min(endGroup, track->latestGroupAndObject->group);
+    }
+  }
+  // The caller's own upstream FETCH is one of maxParallelFetches
+  for (uint32_t i = 1; i < config_.maxParallelFetches && startGroup < endGroup;
+       i++) {
+    auto chunkEnd =
+        std::min(startGroup + config_.fetchChunkGroups, endGroup);
+    // Only chunks nothing has been cached or requested for
+    auto inProgress = track->fetchInProgress.getIntersecting(
+        AbsoluteLocation{startGroup, 0}, AbsoluteLocation{chunkEnd, 0});
+    if (!inProgress.empty()) {
+      return;
+    }
+    for (auto group = startGroup; group < chunkEnd; group++) {
+      if (track->groups.contains(group)) {
+        return;
+      }
+    }
+    XLOG(DBG1) << "Parallel FETCH chunk [" << startGroup << ", " << chunkEnd
+               << ") track=" << track->fullTrackName;
+    stats_.parallelFetchChunks++;
+    fillFromUpstream(
+        track,
+        fetch.fullTrackName,
+        startGroup,
+        chunkEnd,
+        fetch.priority,
+        upstream,
+        executor);
+    startGroup = chunkEnd;
   }
 }
 
+void MoQCache::fillFromUpstream(
+    std::shared_ptr<CacheTrack> track,
+    const FullTrackName& ftn,
+    uint64_t startGroup,
+    uint64_t endGroup,
+    uint8_t priority,
+    std::shared_ptr<Publisher> upstream,
+    folly::Executor::KeepAlive<> executor) {
+  AbsoluteLocation start{startGroup, 0};
+  // The writeback covers whole groups, the FETCH ends with the last one
+  auto writeback = std::make_shared<FetchWriteback>(
+      start,
+      AbsoluteLocation{endGroup, 0},
+      false,
+      std::make_shared<FillSink>(),
+      std::move(track),
+      nullptr);
+  Fetch fill(
+      0,
+      ftn,
+      start,
+      AbsoluteLocation{endGroup - 1, 0},
+      priority,
+      GroupOrder::OldestFirst);
+  folly::coro::co_invoke(
+      [fill = std::move(fill),
+       writeback = std::move(writeback),
+       upstream = std::move(upstream)]() -> folly::coro::Task<void> {
+        auto res = co_await upstream->fetch(fill, writeback);
+        if (res.hasError()) {
+          if (res.error().errorCode == FetchErrorCode::NO_OBJECTS) {
+            writeback->noObjects();
+          } else {
+            XLOG(DBG1) << "Cache fill failed err=" << res.error().reasonPhrase;
+          }
+          co_return;
+        }
+        // Keep the upstream FETCH open until it's all cached
+        auto handle = std::move(res.value());
+        co_await writeback->complete();
+      })
+      .scheduleOn(std::move(executor))
+      .start();
+}
+
 folly::coro::Task<Publisher::FetchResult> MoQCache::fetchImpl(
     std::shared_ptr<FetchHandle> fetchHandle,
     Fetch fetch,
-    CacheTrack& track,
+    std::shared_ptr<CacheTrack> track,
     std::shared_ptr<FetchConsumer> consumer,
-    std::shared_ptr<Publisher> upstream) {
+    std::shared_ptr<Publisher> upstream,
+    std::shared_ptr<FetchStatsReporter> fetchStats,
+    DescendingFetch* descending) {
   auto standalone = std::get_if<StandaloneFetch>(&fetch.args);
   XLOG(DBG1) << "fetchImpl for {" << standalone->start.group << ","
              << standalone->start.object << "}, {" << standalone->end.group
@@ -821,32 +1944,88 @@ folly::coro::Task<Publisher::FetchResult> MoQCache::fetchImpl(
   folly::Optional<AbsoluteLocation> fetchStart;
   auto current = standalone->start;
   bool servedOneObject = false;
+  bool fetchedUpstream = false;
+  // Only the oldest group of a descending FETCH ends it
+  bool endsFetch = !descending || descending->lastGroup;
   folly::CancellationCallback cancelCallback(token, [consumer] {
     XLOG(DBG1) << "Fetch cancelled";
     consumer->reset(ResetStreamErrorCode::CANCELLED);
   });
   while (!token.isCancellationRequested() && current < standalone->end &&
-         (!track.endOfTrack || current <= *track.latestGroupAndObject)) {
-    auto writeback = track.fetchInProgress.getValue(current);
+         (!track->endOfTrack || current <= *track->latestGroupAndObject)) {
+    auto writeback = track->fetchInProgress.getValue(current);
     if (writeback) {
       XLOG(DBG1) << "fetchInProgress for {" << current.group << ","
                  << current.object << "}";
+      stats_.coalescedWaits++;
+      auto waitStart = Clock::now();
       co_await (*writeback)->waitFor(current);
+      if (fetchStats) {
+        fetchStats->stats.coalescedWaitTime += elapsedSince(waitStart);
+      }
     }
-    auto groupIt = track.groups.find(current.group);
-    if (groupIt == track.groups.end()) {
+    auto groupIt = track->groups.find(current.group);
+    // Hold the group, it may be evicted while we're suspended below
+    std::shared_ptr<CacheGroup> group;
+    if (groupIt == track->groups.end()) {
+      group = restoreGroup(*track, current.group);
+    } else if (
+        isExpired(*groupIt->second) && !track->isLiveEdge(current.group)) {
+      XLOG(DBG1) << "group expired g=" << current.group;
+      evictGroup(*groupIt->second);
+    } else {
+      group = groupIt->second;
+    }
+    if (!group) {
       // group not cached, include in range
       XLOG(DBG1) << "group cache miss for g=" << current.group;
       if (!fetchStart) {
         fetchStart = current;
       }
-      current.group++;
-      current.object = 0;
+      // Stop at a fetch already in progress within the group, so it is
+      // awaited rather than fetched again
+      AbsoluteLocation nextGroup{current.group + 1, 0};
+      auto inProgress =
+          track->fetchInProgress.getIntersecting(current, nextGroup);
+      if (!inProgress.empty() && current < inProgress.front()->start) {
+        current = inProgress.front()->start;
+      } else {
+        current = nextGroup;
+      }
+      if (config_.fetchChunkGroups > 0 && current < standalone->end &&
+          (current.group - fetchStart->group >= config_.fetchChunkGroups ||
+           track->fetchInProgress.getValue(current))) {
+        // Fetch this chunk while the ones after it are fetched in parallel
+        if (current.object == 0) {
+          issueFetchChunks(
+              track,
+              fetch,
+              current.group,
+              standalone->end.group,
+              upstream,
+              co_await folly::coro::co_current_executor);
+        }
+        fetchedUpstream = true;
+        auto res = co_await fetchUpstream(
+            fetchHandle,
+            *fetchStart,
+            current,
+            /*lastObject=*/false,
+            fetch,
+            track,
+            consumer,
+            upstream,
+            fetchStats);
+        if (res.hasError() &&
+            res.error().errorCode != FetchErrorCode::NO_OBJECTS) {
+          co_return folly::makeUnexpected(res.error());
+        }
+        fetchStart.reset();
+      }
       continue;
     }
-    auto& group = groupIt->second;
-    auto objIt = group->objects.find(current.object);
-    if (objIt == group->objects.end() || !objIt->second->complete) {
+    auto object = group->objects.find(current.object);
+    if (!object || (!object->complete && !object->arriving)) {
       // object not cached or complete, include in range
       XLOG(DBG1) << "object cache miss for {" << current.group << ","
                  << current.object << "}";
@@ -863,10 +2042,9 @@ folly::coro::Task<Publisher::FetchResult> MoQCache::fetchImpl(
     // found the object, first fetch missing range, if any
     XLOG(DBG1) << "object cache HIT for {" << current.group << ","
                << current.object << "}";
-    auto object = objIt->second.get();
-    // TODO: once we support eviction, this object may need to be
-    // shared_ptr
+    touch(*group);
     if (fetchStart) {
+      fetchedUpstream = true;
       // Call the helper function
       auto res = co_await fetchUpstream(
           fetchHandle,
@@ -876,12 +2054,18 @@ folly::coro::Task<Publisher::FetchResult> MoQCache::fetchImpl(
           fetch,
           track,
           consumer,
-          upstream);
+          upstream,
+          fetchStats);
       if (res.hasError() &&
           res.error().errorCode != FetchErrorCode::NO_OBJECTS) {
         co_return folly::makeUnexpected(res.error());
       } // else success but only returns FetchOk on lastObject
       fetchStart.reset();
+      if (!object->complete && !object->arriving) {
+        // Stopped arriving while the range before it was fetched, it's a
+        // miss now
+        continue;
+      }
     }
     XLOG(DBG1) << "Publish object from cache";
 
@@ -892,13 +2076,41 @@ folly::coro::Task<Publisher::FetchResult> MoQCache::fetchImpl(
       next.object = 0;
     } // unless known end of group, continue current and trigger upstream
       // fetch
-    auto lastObject = next >= standalone->end || isEndOfTrack(object->status);
+    auto lastObject = endsFetch &&
+        (next >= standalone->end || isEndOfTrack(object->status));
+    if (!object->complete) {
+      auto arrivingRes = co_await serveArrivingObject(
+          group, current, lastObject, fetch, consumer, fetchStats);
+      if (arrivingRes.hasError()) {
+        co_return folly::makeUnexpected(arrivingRes.error());
+      }
+      servedOneObject = true;
+      current = next;
+      continue;
+    }
+    auto objectBytes =
+        object->payload ? object->payload->computeChainDataLength() : 0;
+    stats_.hitObjects++;
+    stats_.hitBytes += objectBytes;
+    if (fetchStats) {
+      fetchStats->stats.hitObjects++;
+      fetchStats->stats.hitBytes += objectBytes;
+    }
+    MOXYGEN_TRACE_SPAN(
+        "MoQCache::serveObject",
+        FullTrackName::hash()(fetch.fullTrackName),
+        current.group,
+        current.object);
     auto res =
         publishObject(object->status, consumer, current, *object, lastObject);
     if (res.hasError()) {
       if (res.error().code == MoQPublishError::BLOCKED) {
         XLOG(DBG1) << "Fetch blocked, waiting";
+        auto blockedStart = Clock::now();
         auto blockedRes = co_await handleBlocked(consumer, fetch);
+        if (fetchStats) {
+          fetchStats->stats.blockedTime += elapsedSince(blockedStart);
+        }
         if (blockedRes.hasError()) {
           co_return folly::makeUnexpected(blockedRes.error());
         }
@@ -917,16 +2129,23 @@ folly::coro::Task<Publisher::FetchResult> MoQCache::fetchImpl(
   }
   if (fetchStart) {
     XLOG(DBG1) << "Fetching missing tail";
+    if (descending) {
+      descending->fetchedUpstream = true;
+    }
     auto res = co_await fetchUpstream(
         fetchHandle,
         *fetchStart,
         standalone->end,
-        /*lastObject=*/true,
+        /*lastObject=*/endsFetch,
         fetch,
         track,
         consumer,
-        std::move(upstream));
+        std::move(upstream),
+        std::move(fetchStats));
     if (res.hasError()) {
+      if (!endsFetch && res.error().errorCode == FetchErrorCode::NO_OBJECTS) {
+        co_return nullptr;
+      }
       if (servedOneObject &&
           res.error().errorCode == FetchErrorCode::NO_OBJECTS) {
         consumer->endOfFetch();
@@ -945,6 +2164,11 @@ folly::coro::Task<Publisher::FetchResult> MoQCache::fetchImpl(
       co_return nullptr;
     }
   }
+  if (descending) {
+    descending->fetchedUpstream |= fetchedUpstream;
+  } else if (!fetchedUpstream) {
+    stats_.fetchHits++;
+  }
   if (!fetchHandle) {
     XLOG(DBG1) << "Fetch completed entirely from cache";
     // test for empty range with no latest group and object?
@@ -953,9 +2177,9 @@ folly::coro::Task<Publisher::FetchResult> MoQCache::fetchImpl(
         standalone->end.group--;
       }
       bool endOfTrack = false;
-      if (track.endOfTrack && standalone->end >= *track.latestGroupAndObject) {
+      if (track->endOfTrack && standalone->end >= *track->latestGroupAndObject) {
         endOfTrack = true;
-        standalone->end = *track.latestGroupAndObject;
+        standalone->end = *track->latestGroupAndObject;
       }
       co_return std::make_shared<FetchHandle>(FetchOk(
           {fetch.requestID,
@@ -971,15 +2195,127 @@ folly::coro::Task<Publisher::FetchResult> MoQCache::fetchImpl(
   co_return nullptr;
 }
 
+folly::coro::Task<void> MoQCache::fetchDescending(
+    std::shared_ptr<FetchHandle> fetchHandle,
+    Fetch fetch,
+    AbsoluteLocation from,
+    std::shared_ptr<CacheTrack> track,
+    std::shared_ptr<FetchConsumer> consumer,
+    std::shared_ptr<Publisher> upstream,
+    std::shared_ptr<FetchStatsReporter> fetchStats) {
+  auto standalone = std::get_if<StandaloneFetch>(&fetch.args);
+  CHECK(standalone);
+  auto token = co_await folly::coro::co_current_cancellation_token;
+  DescendingFetch descending;
+  auto rangeOf = [&](uint64_t first, uint64_t last) {
+    return StandaloneFetch(
+        std::max(
+            standalone->start,
+            first == from.group ? from : AbsoluteLocation{first, 0}),
+        std::min(standalone->end, AbsoluteLocation{last + 1, 0}));
+  };
+  // Uncached groups at or above it were already FETCHed upstream
+  folly::Optional<uint64_t> filledFrom;
+  // Each group is served in ascending object order, with its misses
+  // FETCHed upstream into the cache, before moving to the one before it.
+  // A run of uncached groups is first FETCHed into the cache as one range,
+  // then the groups of it upstream had are served from the cache.
+  auto group = from.group;
+  while (!token.isCancellationRequested()) {
+    if (!track->groups.contains(group) &&
+        (!filledFrom || group < *filledFrom)) {
+      // Down to the newest cached group before it
+      auto gapStart = standalone->start.group;
+      auto cached = track->groupIDs.lower_bound(group);
+      if (cached != track->groupIDs.begin()) {
+        gapStart = std::max(gapStart, *std::prev(cached) + 1);
+      }
+      auto fill = fetch;
+      fill.args = rangeOf(gapStart, group);
+      DescendingFetch filling;
+      folly::Expected<std::shared_ptr<FetchHandle>, FetchError> res{nullptr};
+      {
+        folly::CancellationCallback cancelCallback(token, [consumer] {
+          consumer->reset(ResetStreamErrorCode::CANCELLED);
+        });
+        res = co_await fetchImpl(
+            fetchHandle,
+            std::move(fill),
+            track,
+            std::make_shared<FillSink>(),
+            upstream,
+            fetchStats,
+            &filling);
+      }
+      descending.fetchedUpstream |= filling.fetchedUpstream;
+      if (token.isCancellationRequested()) {
+        co_return;
+      }
+      if (res.hasError() &&
+          res.error().errorCode != FetchErrorCode::NO_OBJECTS) {
+        consumer->reset(ResetStreamErrorCode::CANCELLED);
+        co_return;
+      }
+      filledFrom = gapStart;
+    }
+    if (!track->groups.contains(group)) {
+      // Not upstream either, or evicted since.  Continue at the newest
+      // cached group before it, or the first group not filled yet.
+      folly::Optional<uint64_t> next;
+      auto cached = track->groupIDs.lower_bound(group);
+      if (cached != track->groupIDs.begin()) {
+        next = *std::prev(cached);
+      }
+      if (*filledFrom > standalone->start.group) {
+        next = std::max(next.value_or(0), *filledFrom - 1);
+      }
+      if (!next || *next < standalone->start.group) {
+        // Newer groups were served, FETCH_OK was already sent
+        consumer->endOfFetch();
+        co_return;
+      }
+      group = *next;
+      continue;
+    }
+    descending.lastGroup = group <= standalone->start.group;
+    auto groupFetch = fetch;
+    groupFetch.args = rangeOf(group, group);
+    auto res = co_await fetchImpl(
+        fetchHandle,
+        std::move(groupFetch),
+        track,
+        consumer,
+        upstream,
+        fetchStats,
+        &descending);
+    if (res.hasError()) {
+      if (descending.lastGroup &&
+          res.error().errorCode == FetchErrorCode::NO_OBJECTS) {
+        // Newer groups were served, FETCH_OK was already sent
+        consumer->endOfFetch();
+      }
+      co_return;
+    }
+    if (descending.lastGroup) {
+      if (!descending.fetchedUpstream) {
+        stats_.fetchHits++;
+      }
+      co_return;
+    }
+    group--;
+  }
+}
+
 folly::coro::Task<Publisher::FetchResult> MoQCache::fetchUpstream(
     std::shared_ptr<MoQCache::FetchHandle> fetchHandle,
     const AbsoluteLocation& fetchStart,
     const AbsoluteLocation& fetchEnd,
     bool lastObject,
     Fetch fetch,
-    CacheTrack& track,
+    std::shared_ptr<CacheTrack> track,
     std::shared_ptr<FetchConsumer> consumer,
-    std::shared_ptr<Publisher> upstream) {
+    std::shared_ptr<Publisher> upstream,
+    std::shared_ptr<FetchStatsReporter> fetchStats) {
   XLOG(DBG1) << "Fetching upstream for {" << fetchStart.group << ","
              << fetchStart.object << "}, {" << fetchEnd.group << ","
              << fetchEnd.object << "}";
@@ -988,7 +2324,13 @@ folly::coro::Task<Publisher::FetchResult> MoQCache::fetchUpstream(
     adjFetchEnd.group--;
   }
   auto writeback = std::make_shared<FetchWriteback>(
-      fetchStart, adjFetchEnd, lastObject, consumer, track);
+      fetchStart,
+      adjFetchEnd,
+      lastObject,
+      consumer,
+      track,
+      std::move(fetchStats));
+  stats_.upstreamFetches++;
   auto res = co_await upstream->fetch(
       Fetch(
           0,
@@ -996,7 +2338,8 @@ folly::coro::Task<Publisher::FetchResult> MoQCache::fetchUpstream(
           fetchStart,
           adjFetchEnd,
           fetch.priority,
-          fetch.groupOrder),
+          // The writeback expects objects in ascending order
+          GroupOrder::OldestFirst),
       writeback);
   if (res.hasError()) {
     if (res.error().errorCode == FetchErrorCode::NO_OBJECTS) {
@@ -1040,6 +2383,116 @@ folly::coro::Task<Publisher::FetchResult> MoQCache::fetchUpstream(
   co_return nullptr;
 }
 
+folly::coro::Task<folly::Expected<folly::Unit, FetchError>>
+MoQCache::serveArrivingObject(
+    std::shared_ptr<CacheGroup> group,
+    AbsoluteLocation current,
+    bool lastObject,
+    const Fetch& fetch,
+    std::shared_ptr<FetchConsumer> consumer,
+    std::shared_ptr<FetchStatsReporter> fetchStats) {
+  auto object = group->objects.find(current.object);
+  XCHECK(object);
+  XLOG(DBG1) << "Cut-through for arriving object {" << current.group << ","
+             << current.object << "}";
+  auto length = object->length;
+  stats_.cutThroughObjects++;
+  stats_.hitObjects++;
+  stats_.hitBytes += length;
+  if (fetchStats) {
+    fetchStats->stats.hitObjects++;
+    fetchStats->stats.hitBytes += length;
+  }
+  MOXYGEN_TRACE_SPAN(
+      "MoQCache::serveObject",
+      FullTrackName::hash()(fetch.fullTrackName),
+      current.group,
+      current.object);
+  uint64_t sent =
+      object->payload ? object->payload->computeChainDataLength() : 0;
+  folly::Expected<folly::Unit, MoQPublishError> res = consumer->beginObject(
+      current.group,
+      object->subgroup,
+      current.object,
+      length,
+      object->payload ? object->payload->clone() : nullptr,
+      object->extensions);
+  auto token = co_await folly::coro::co_current_cancellation_token;
+  while (true) {
+    if (res.hasError()) {
+      if (res.error().code != MoQPublishError::BLOCKED) {
+        XLOG(ERR) << "Consumer error=" << res.error().msg;
+        consumer->reset(ResetStreamErrorCode::INTERNAL_ERROR);
+        co_return folly::makeUnexpected(FetchError{
+            fetch.requestID,
+            FetchErrorCode::INTERNAL_ERROR,
+            folly::to<std::string>(
+                "Consumer error on object=", res.error().msg)});
+      }
+      auto blockedStart = Clock::now();
+      auto blockedRes = co_await handleBlocked(consumer, fetch);
+      if (fetchStats) {
+        fetchStats->stats.blockedTime += elapsedSince(blockedStart);
+      }
+      if (blockedRes.hasError()) {
+        co_return folly::makeUnexpected(blockedRes.error());
+      }
+    }
+    if (sent >= length) {
+      co_return folly::unit;
+    }
+    if (token.isCancellationRequested()) {
+      co_return folly::makeUnexpected(FetchError{
+          fetch.requestID, FetchErrorCode::CANCELLED, "Fetch cancelled"});
+    }
+    object = group->objects.find(current.object);
+    uint64_t available = object && object->payload
+        ? object->payload->computeChainDataLength()
+        : 0;
+    if (available > sent) {
+      auto chunkLength = std::min(available, length) - sent;
+      folly::io::Cursor cursor(object->payload.get());
+      cursor.skip(sent);
+      Payload chunk;
+      cursor.clone(chunk, chunkLength);
+      sent += chunkLength;
+      auto payloadRes = consumer->objectPayload(
+          std::move(chunk), lastObject && sent == length);
+      if (payloadRes.hasError()) {
+        res = folly::makeUnexpected(payloadRes.error());
+      } else {
+        res = folly::unit;
+      }
+      continue;
+    }
+    if (!object || !object->arriving || available < sent) {
+      // The consumer has part of the object, it can't be served another way
+      XLOG(ERR) << "Object stopped arriving {" << current.group << ","
+                << current.object << "}";
+      consumer->reset(ResetStreamErrorCode::INTERNAL_ERROR);
+      co_return folly::makeUnexpected(FetchError{
+          fetch.requestID,
+          FetchErrorCode::INTERNAL_ERROR,
+          "Object stopped arriving"});
+    }
+    if (!object->progress) {
+      object->progress = std::make_shared<folly::coro::Baton>();
+    }
+    auto progress = object->progress;
+    {
+      folly::CancellationCallback onCancel(
+          token, [progress] { progress->post(); });
+      co_await *progress;
+    }
+    // Cancelling posts the shared baton early, don't leave it posted for
+    // the next waiter
+    object = group->objects.find(current.object);
+    if (object && object->progress == progress) {
+      object->progress.reset();
+    }
+  }
+}
+
 folly::coro::Task<folly::Expected<folly::Unit, FetchError>>
 MoQCache::handleBlocked(
     std::shared_ptr<FetchConsumer> consumer,
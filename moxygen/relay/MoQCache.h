@@ -1,22 +1,108 @@
 #pragma once
 
+#include <folly/Executor.h>
+#include <folly/container/F14Map.h>
 #include <folly/container/F14Set.h>
 #include <folly/coro/Baton.h>
 #include <folly/coro/Task.h>
 #include <moxygen/MoQConsumers.h>
 #include <moxygen/MoQFramer.h>
 #include <moxygen/Publisher.h>
+#include <moxygen/relay/MoQCacheAdmission.h>
+#include <moxygen/relay/MoQDiskCache.h>
+#include <moxygen/util/BlockPool.h>
 #include <moxygen/util/FetchIntervalSet.h>
+#include <moxygen/util/PayloadSlabPool.h>
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
 
 namespace moxygen {
 
 class MoQCache {
  public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Config {
+    // A value of 0 means no limit
+    uint64_t maxCachedBytes{0};
+    uint64_t maxCachedGroupsPerTrack{0};
+    // Used for tracks that have not advertised a MAX_CACHE_DURATION
+    std::chrono::milliseconds defaultMaxCacheDuration{0};
+    // Directory for the disk tier, empty to keep groups in memory only.
+    // Completed groups are written through to disk and read back when
+    // fetched after eviction, or after a restart.
+    std::string diskCacheDir;
+    // Returns the media time of an object that starts a GOP, none for other
+    // objects.  When set, each track keeps an index of its cached keyframes,
+    // see latestGop and gopAt.
+    std::function<folly::Optional<std::chrono::microseconds>(
+        const Extensions&,
+        const folly::IOBuf*)>
+        keyframeTime;
+    // Once FETCHes of a track look sequential, FETCH this many groups past
+    // the latest one upstream in the background, so the next FETCH finds
+    // them cached.  0 disables read-ahead.
+    uint64_t readAheadGroups{0};
+    // Upstream FETCHes for misses longer than this many groups are split in
+    // group aligned chunks of this size, up to maxParallelFetches of them
+    // at a time, each on its own FETCH stream.  Chunks past the first fill
+    // the cache and are served from it in order.  0 disables splitting.
+    uint64_t fetchChunkGroups{0};
+    uint32_t maxParallelFetches{4};
+    // When set, payloads of complete objects are copied into slabs of this
+    // size if they arrived chained or in oversized buffers, which frees the
+    // transport's buffers.  0 caches payloads as they arrived.
+    size_t payloadSlabSize{0};
+    // Slabs are 2MB and backed by transparent hugepages
+    bool payloadHugePages{false};
+    // Makes the policy deciding which groups arriving on subscriptions are
+    // cached, all of them when unset.  Each cache makes its own.
+    std::function<std::unique_ptr<MoQCacheAdmission>()> admission;
+  };
+
+  MoQCache() = default;
+  explicit MoQCache(Config config) {
+    setConfig(std::move(config));
+  }
+  MoQCache(const MoQCache&) = delete;
+  MoQCache& operator=(const MoQCache&) = delete;
+  MoQCache(MoQCache&&) = delete;
+  MoQCache& operator=(MoQCache&&) = delete;
+  ~MoQCache() {
+    clear();
+  }
+
+  // Updates the limits and immediately evicts down to the new budget
+  void setConfig(Config config);
+
+  const Config& getConfig() const {
+    return config_;
+  }
+
+  // Sets the TTL for groups of this track, usually from the MAX_CACHE_DURATION
+  // parameter in SUBSCRIBE_OK or FETCH_OK.  Applies to groups cached after the
+  // call.  0 means the default from Config.
+  void setMaxCacheDuration(
+      const FullTrackName& ftn,
+      std::chrono::milliseconds maxCacheDuration);
+
   // Returns a filter for a subscribe that writes objects to the cache and
-  // passes to the next consumer
+  // passes to the next consumer.  subscribers returns the track's subscriber
+  // count for the admission policy.
   std::shared_ptr<TrackConsumer> getSubscribeWriteback(
       const FullTrackName& ftn,
-      std::shared_ptr<TrackConsumer> consumer);
+      std::shared_ptr<TrackConsumer> consumer,
+      std::function<size_t()> subscribers = nullptr);
+
+  // Notes a SUBSCRIBE or FETCH of the track for the admission policy
+  void onTrackRequested(const FullTrackName& ftn);
 
   // Serves objects from the cache to the consumer.  If objects in the range are
   // not in cache, issue one-or-more FETCH'es upstream.  Objects fetched from
@@ -29,8 +115,126 @@ class MoQCache {
       std::shared_ptr<FetchConsumer> consumer,
       std::shared_ptr<Publisher> upstream);
 
-  void clear() {
-    cache_.clear();
+  // Serves a FETCH without suspending when the whole range is cached, as for
+  // a joining FETCH at the live edge.  Returns none, having published
+  // nothing, if any of it would need an upstream FETCH.  If the consumer
+  // blocks, the rest of the range is served by a task on executor.
+  folly::Optional<Publisher::FetchResult> tryFetchFromCache(
+      const Fetch& fetch,
+      std::shared_ptr<FetchConsumer> consumer,
+      std::shared_ptr<Publisher> upstream,
+      folly::Executor::KeepAlive<> executor);
+
+  void clear();
+
+  // A cached keyframe, where a viewer can start decoding
+  struct GopLocation {
+    AbsoluteLocation keyframe;
+    std::chrono::microseconds time{0};
+  };
+
+  // The newest cached keyframe of the track, or with complete set, the
+  // keyframe of the newest group that is cached through its end
+  folly::Optional<GopLocation> latestGop(
+      const FullTrackName& ftn,
+      bool complete = false);
+
+  // The cached keyframe starting the GOP that contains time, none if time
+  // is before every cached keyframe
+  folly::Optional<GopLocation> gopAt(
+      const FullTrackName& ftn,
+      std::chrono::microseconds time) const;
+
+  // The last location of the track, if the cache has seen it end
+  folly::Optional<AbsoluteLocation> endOfTrack(const FullTrackName& ftn) const;
+
+  // Bytes currently held by cached groups, including per-object overhead
+  uint64_t cachedBytes() const {
+    return cachedBytes_;
+  }
+
+  size_t numCachedGroups() const {
+    return lru_.size();
+  }
+
+  // Share of cachedBytes() held by the track's groups
+  uint64_t trackBytes(const FullTrackName& ftn) const {
+    auto it = cache_.find(ftn);
+    return it == cache_.end() ? 0 : it->second->bytes;
+  }
+
+  // Calls fn(fullTrackName, trackBytes) for every cached track
+  template <typename Fn>
+  void forEachTrackBytes(Fn&& fn) const {
+    for (const auto& track : cache_) {
+      fn(track.first, track.second->bytes);
+    }
+  }
+
+  struct Stats {
+    // FETCHes served by the cache
+    uint64_t fetches{0};
+    // FETCHes served without any upstream FETCH
+    uint64_t fetchHits{0};
+    // FETCHes served by tryFetchFromCache
+    uint64_t syncFetches{0};
+    // FETCHes issued upstream for missing ranges
+    uint64_t upstreamFetches{0};
+    // Times a FETCH waited for an upstream FETCH already in progress rather
+    // than issuing its own
+    uint64_t coalescedWaits{0};
+    // Objects streamed to a FETCH while a subscription was still delivering
+    // them
+    uint64_t cutThroughObjects{0};
+    // Upstream FETCHes issued to read ahead of sequential FETCHes
+    uint64_t readAheadFetches{0};
+    // Upstream FETCHes issued in parallel for chunks of a long miss
+    uint64_t parallelFetchChunks{0};
+    // Objects and payload bytes served from the cache
+    uint64_t hitObjects{0};
+    uint64_t hitBytes{0};
+    // Groups written to and read back from the disk tier
+    uint64_t diskWrites{0};
+    uint64_t diskReads{0};
+    // Objects and payload bytes copied into the payload slabs
+    uint64_t compactedObjects{0};
+    uint64_t compactedBytes{0};
+    // New groups of subscribed tracks the admission policy cached or not
+    uint64_t admittedGroups{0};
+    uint64_t rejectedGroups{0};
+  };
+
+  const Stats& getStats() const {
+    return stats_;
+  }
+
+  // Accounting for a single FETCH served by the cache
+  struct FetchStats {
+    FullTrackName fullTrackName;
+    // Objects and payload bytes served from the cache
+    uint64_t hitObjects{0};
+    uint64_t hitBytes{0};
+    // Start and end of each upstream FETCH issued for missing ranges
+    std::vector<std::pair<AbsoluteLocation, AbsoluteLocation>> missRanges;
+    // Objects and payload bytes received from those upstream FETCHes
+    uint64_t upstreamObjects{0};
+    uint64_t upstreamBytes{0};
+    // Time spent waiting on upstream FETCHes issued by other FETCHes
+    std::chrono::microseconds coalescedWaitTime{0};
+    // Time spent waiting for a blocked consumer
+    std::chrono::microseconds blockedTime{0};
+  };
+
+  class FetchStatsCallback {
+   public:
+    virtual ~FetchStatsCallback() = default;
+
+    // Called once the FETCH and every upstream FETCH it issued are done
+    virtual void onFetchComplete(const FetchStats& stats) = 0;
+  };
+
+  void setFetchStatsCallback(std::shared_ptr<FetchStatsCallback> callback) {
+    fetchStatsCallback_ = std::move(callback);
   }
 
   // Entry for single cached object
@@ -52,6 +256,98 @@ class MoQCache {
     Extensions extensions;
     Payload payload;
     bool complete{false};
+    // Set while a subscription is still delivering the payload, FETCHes
+    // stream it as it arrives rather than fetching it upstream
+    bool arriving{false};
+    // Total payload length of an arriving object
+    uint64_t length{0};
+    // Posted when an arriving object gets more payload or stops arriving.
+    // Allocated by the first FETCH that waits on it.
+    std::shared_ptr<folly::coro::Baton> progress;
+
+    CacheEntry(CacheEntry&&) = default;
+    CacheEntry& operator=(CacheEntry&&) = default;
+    // FETCHes waiting on the object give up on it
+    ~CacheEntry() {
+      notifyProgress();
+    }
+
+    void notifyProgress() {
+      if (progress) {
+        std::exchange(progress, nullptr)->post();
+      }
+    }
+  };
+
+  // Objects of a group, by object ID.  IDs are usually dense and ascending
+  // from 0, so they are stored contiguously by ID; IDs far past the highest
+  // dense ID go in a sparse map.  Entry addresses are stable until the
+  // group is destroyed.  Storage comes from pool, or the heap without one.
+  class CacheObjects {
+   public:
+    CacheObjects() : CacheObjects(nullptr) {}
+    explicit CacheObjects(std::shared_ptr<BlockPool> pool)
+        : dense_(DenseAllocator(pool)), sparse_(SparseAllocator(pool)) {}
+
+    CacheEntry* find(uint64_t objectID) {
+      if (objectID < dense_.size() && dense_[objectID]) {
+        return &*dense_[objectID];
+      }
+      auto it = sparse_.find(objectID);
+      return it == sparse_.end() ? nullptr : &it->second;
+    }
+
+    // objectID must not already be present
+    template <typename... Args>
+    CacheEntry& emplace(uint64_t objectID, Args&&... args) {
+      size_++;
+      if (objectID - std::min<uint64_t>(objectID, dense_.size()) <=
+          kMaxDenseGap) {
+        // emplace_back does not invalidate references to existing entries
+        while (dense_.size() <= objectID) {
+          dense_.emplace_back();
+        }
+        return dense_[objectID].emplace(std::forward<Args>(args)...);
+      }
+      return sparse_
+          .emplace(
+              std::piecewise_construct,
+              std::forward_as_tuple(objectID),
+              std::forward_as_tuple(std::forward<Args>(args)...))
+          .first->second;
+    }
+
+    size_t size() const {
+      return size_;
+    }
+
+    template <typename Fn>
+    void forEach(Fn&& fn) {
+      for (auto& entry : dense_) {
+        if (entry) {
+          fn(*entry);
+        }
+      }
+      for (auto& [objectID, entry] : sparse_) {
+        fn(entry);
+      }
+    }
+
+   private:
+    // Largest run of missing IDs allowed before an ID goes to sparse_
+    static constexpr uint64_t kMaxDenseGap = 64;
+    using DenseAllocator = PoolAllocator<folly::Optional<CacheEntry>>;
+    using SparseAllocator =
+        PoolAllocator<std::pair<const uint64_t, CacheEntry>>;
+    std::deque<folly::Optional<CacheEntry>, DenseAllocator> dense_;
+    folly::F14NodeMap<
+        uint64_t,
+        CacheEntry,
+        folly::f14::DefaultHasher<uint64_t>,
+        folly::f14::DefaultKeyEqual<uint64_t>,
+        SparseAllocator>
+        sparse_;
+    size_t size_{0};
   };
 
  private:
@@ -59,12 +355,38 @@ class MoQCache {
   class SubgroupWriteback;
   class FetchWriteback;
   class FetchHandle;
+  struct FetchStatsReporter;
+
+  struct CacheGroup;
+  struct CacheTrack;
+  // Front is the least recently used group
+  using LruList = std::list<CacheGroup*>;
+  using ExpiryMap = std::multimap<Clock::time_point, CacheGroup*>;
 
   // Entry for a group
   struct CacheGroup {
-    folly::F14FastMap<uint64_t, std::unique_ptr<CacheEntry>> objects;
+    CacheGroup(MoQCache* inCache, CacheTrack* inTrack, uint64_t inGroupID)
+        : objects(inCache ? inCache->pool_ : nullptr),
+          cache(inCache),
+          track(inTrack),
+          groupID(inGroupID) {}
+
+    CacheObjects objects;
     uint64_t maxCachedObject{0};
     bool endOfGroup{false};
+    // Written to, or read from, the disk tier
+    bool onDisk{false};
+    // Media time of the group's indexed keyframe
+    folly::Optional<std::chrono::microseconds> gopTime;
+
+    // Eviction state.  cache is cleared once the group is evicted; writebacks
+    // holding an evicted group can still write to it, but it is not accounted.
+    MoQCache* cache{nullptr};
+    CacheTrack* track{nullptr};
+    uint64_t groupID{0};
+    uint64_t bytes{0};
+    LruList::iterator lruIt;
+    folly::Optional<ExpiryMap::iterator> expiryIt;
 
     folly::Expected<folly::Unit, MoQPublishError> cacheObject(
         uint64_t subgroup,
@@ -74,31 +396,152 @@ class MoQCache {
         Payload payload,
         bool complete);
     void cacheMissingStatus(uint64_t objectID, ObjectStatus status);
+    // Appends to a partially cached object, returns nullptr if not found
+    CacheEntry*
+    appendPayload(uint64_t objectID, Payload payload, bool complete);
+    // The rest of an object's payload will be delivered by, or will no longer
+    // come from, a subscription
+    void setArriving(uint64_t objectID, uint64_t length, bool arriving);
+    void updateBytes(uint64_t oldBytes, uint64_t newBytes);
+    // Every object through the end of the group is cached and complete
+    bool isComplete();
+    void maybeSpill();
   };
 
   // Entry for a track
   using FetchInProgresSet = FetchIntervalSet<AbsoluteLocation, FetchWriteback*>;
   struct CacheTrack {
-    folly::F14FastMap<uint64_t, std::unique_ptr<CacheGroup>> groups;
+    CacheTrack(MoQCache* inCache, FullTrackName inFullTrackName)
+        : cache(inCache), fullTrackName(std::move(inFullTrackName)) {}
+
+    // cache is cleared when the track is removed from the cache
+    MoQCache* cache{nullptr};
+    FullTrackName fullTrackName;
+    folly::F14FastMap<uint64_t, std::shared_ptr<CacheGroup>> groups;
+    // The IDs of groups, in order, for evicting the oldest
+    std::set<uint64_t> groupIDs;
+    // Bytes of the groups still accounted in the cache
+    uint64_t bytes{0};
+    std::chrono::milliseconds maxCacheDuration{0};
     bool isLive{false};
     bool endOfTrack{false};
     folly::Optional<AbsoluteLocation> latestGroupAndObject;
     FetchInProgresSet fetchInProgress;
+    // Cached keyframes by media time, at most one per group
+    std::map<std::chrono::microseconds, AbsoluteLocation> gops;
+    // Read-ahead state: the last group of the previous FETCH, how many
+    // FETCHes in a row started where the one before ended, and the first
+    // group not read ahead yet
+    folly::Optional<uint64_t> lastFetchedGroup;
+    uint32_t sequentialFetches{0};
+    uint64_t readAheadEnd{0};
 
     folly::Expected<folly::Unit, MoQPublishError> updateLatest(
         AbsoluteLocation current,
         bool endOfTrack = false);
-    CacheGroup& getOrCreateGroup(uint64_t groupID);
+    std::shared_ptr<CacheGroup> getOrCreateGroup(uint64_t groupID);
+    bool isLiveEdge(uint64_t groupID) const {
+      return latestGroupAndObject && latestGroupAndObject->group == groupID;
+    }
   };
 
-  folly::F14FastMap<FullTrackName, CacheTrack, FullTrackName::hash> cache_;
+  Config config_;
+  folly::F14FastMap<
+      FullTrackName,
+      std::shared_ptr<CacheTrack>,
+      FullTrackName::hash>
+      cache_;
+  LruList lru_;
+  ExpiryMap expiry_;
+  uint64_t cachedBytes_{0};
+  Stats stats_;
+  std::shared_ptr<FetchStatsCallback> fetchStatsCallback_;
+  std::unique_ptr<MoQDiskCache> diskCache_;
+  std::unique_ptr<MoQCacheAdmission> admission_;
+  // Groups and their objects are allocated from here.  Groups held past
+  // eviction keep it alive.
+  std::shared_ptr<BlockPool> pool_{std::make_shared<BlockPool>()};
+  std::unique_ptr<PayloadSlabPool> payloadPool_;
+
+  // payload, or its copy in payloadPool_ when it wastes memory
+  Payload compactPayload(Payload payload);
+
+  std::shared_ptr<CacheTrack> getOrCreateTrack(const FullTrackName& ftn);
+  // The cached track, or one restored from disk, or nullptr
+  std::shared_ptr<CacheTrack> findTrack(const FullTrackName& ftn);
+  void spillGroup(CacheGroup& group);
+  // Reads a group back from disk, nullptr if it isn't there
+  std::shared_ptr<CacheGroup> restoreGroup(CacheTrack& track, uint64_t groupID);
+  void onGroupCreated(CacheTrack& track, CacheGroup& group);
+  void indexKeyframe(
+      CacheGroup& group,
+      uint64_t objectID,
+      const CacheEntry& entry);
+  // Asks the admission policy about a new group of a subscribed track
+  bool admitGroup(const CacheTrack& track, uint64_t groupID, size_t subs);
+  void touch(CacheGroup& group);
+  bool isExpired(const CacheGroup& group) const;
+  void evictToBudget();
+  void evictOldestGroups(CacheTrack& track);
+  void evictExpired();
+  void evictGroup(CacheGroup& group);
+  void unlinkGroup(CacheGroup& group);
+  void detachTrack(CacheTrack& track);
+
+  // Notes a FETCH of the track, and reads the groups after it ahead if the
+  // FETCHes are sequential
+  void maybeReadAhead(
+      std::shared_ptr<CacheTrack> track,
+      const Fetch& fetch,
+      std::shared_ptr<Publisher> upstream,
+      folly::Executor::KeepAlive<> executor);
+
+  // Fills up to maxParallelFetches - 1 chunks from startGroup on, stopping
+  // before endGroup or at the first chunk that is partly cached
+  void issueFetchChunks(
+      const std::shared_ptr<CacheTrack>& track,
+      const Fetch& fetch,
+      uint64_t startGroup,
+      uint64_t endGroup,
+      const std::shared_ptr<Publisher>& upstream,
+      folly::Executor::KeepAlive<> executor);
+
+  // FETCHes groups [startGroup, endGroup) upstream into the cache in the
+  // background
+  void fillFromUpstream(
+      std::shared_ptr<CacheTrack> track,
+      const FullTrackName& ftn,
+      uint64_t startGroup,
+      uint64_t endGroup,
+      uint8_t priority,
+      std::shared_ptr<Publisher> upstream,
+      folly::Executor::KeepAlive<> executor);
+
+  // A FETCH in descending group order, served by one fetchImpl per group
+  struct DescendingFetch {
+    // The group being served is the oldest, so it ends the FETCH
+    bool lastGroup{false};
+    bool fetchedUpstream{false};
+  };
 
   folly::coro::Task<Publisher::FetchResult> fetchImpl(
       std::shared_ptr<FetchHandle> fetchHandle,
       Fetch fetch,
-      CacheTrack& track,
+      std::shared_ptr<CacheTrack> track,
       std::shared_ptr<FetchConsumer> consumer,
-      std::shared_ptr<Publisher> upstream);
+      std::shared_ptr<Publisher> upstream,
+      std::shared_ptr<FetchStatsReporter> fetchStats,
+      DescendingFetch* descending = nullptr);
+
+  // Serves fetch newest group first, starting at from in its newest group
+  folly::coro::Task<void> fetchDescending(
+      std::shared_ptr<FetchHandle> fetchHandle,
+      Fetch fetch,
+      AbsoluteLocation from,
+      std::shared_ptr<CacheTrack> track,
+      std::shared_ptr<FetchConsumer> consumer,
+      std::shared_ptr<Publisher> upstream,
+      std::shared_ptr<FetchStatsReporter> fetchStats);
 
   folly::coro::Task<Publisher::FetchResult> fetchUpstream(
       std::shared_ptr<MoQCache::FetchHandle> fetchHandle,
@@ -106,9 +549,20 @@ class MoQCache {
       const AbsoluteLocation& fetchEnd,
       bool lastObject,
       Fetch fetch,
-      CacheTrack& track,
+      std::shared_ptr<CacheTrack> track,
       std::shared_ptr<FetchConsumer> consumer,
-      std::shared_ptr<Publisher> upstream);
+      std::shared_ptr<Publisher> upstream,
+      std::shared_ptr<FetchStatsReporter> fetchStats);
+
+  // Streams an object still arriving from a subscription to the consumer
+  folly::coro::Task<folly::Expected<folly::Unit, FetchError>>
+  serveArrivingObject(
+      std::shared_ptr<CacheGroup> group,
+      AbsoluteLocation current,
+      bool lastObject,
+      const Fetch& fetch,
+      std::shared_ptr<FetchConsumer> consumer,
+      std::shared_ptr<FetchStatsReporter> fetchStats);
 
   folly::coro::Task<folly::Expected<folly::Unit, FetchError>> handleBlocked(
       std::shared_ptr<FetchConsumer> consumer,
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/relay/MoQCacheAdmission.h"
+
+#include <folly/Bits.h>
+#include <folly/hash/Hash.h>
+
+#include <algorithm>
+
+namespace moxygen {
+
+namespace {
+bool underAny(
+    const TrackNamespace& ns,
+    const std::vector<TrackNamespace>& prefixes) {
+  return std::any_of(
+      prefixes.begin(), prefixes.end(), [&ns](const TrackNamespace& prefix) {
+        return ns.startsWith(prefix);
+      });
+}
+} // namespace
+
+MoQCacheAdmissionPolicy::MoQCacheAdmissionPolicy(Config config)
+    : config_(std::move(config)) {
+  if (config_.frequencySketch) {
+    auto width = folly::nextPowTwo(std::max<size_t>(config_.sketchWidth, 16));
+    mask_ = width - 1;
+    sampleSize_ = config_.sampleSize ? config_.sampleSize : 10 * width;
+    counters_.resize(kRows * width, 0);
+  }
+}
+
+size_t MoQCacheAdmissionPolicy::counterIndex(uint64_t hash, size_t row) const {
+  // An independent hash per row
+  auto rowHash = folly::hash::twang_mix64(hash + row * 0x9e3779b97f4a7c15ULL);
+  return row * (mask_ + 1) + (rowHash & mask_);
+}
+
+void MoQCacheAdmissionPolicy::onRequest(const FullTrackName& ftn) {
+  if (counters_.empty()) {
+    return;
+  }
+  auto hash = FullTrackName::hash()(ftn);
+  // Conservative update: only the smallest counters grow, which keeps
+  // collisions from inflating the estimate
+  auto estimate = frequency(ftn);
+  if (estimate < kMaxCount) {
+    for (size_t row = 0; row < kRows; row++) {
+      auto& counter = counters_[counterIndex(hash, row)];
+      if (counter == estimate) {
+        counter++;
+      }
+    }
+  }
+  if (++requests_ >= sampleSize_) {
+    halve();
+  }
+}
+
+uint32_t MoQCacheAdmissionPolicy::frequency(const FullTrackName& ftn) const {
+  if (counters_.empty()) {
+    return 0;
+  }
+  auto hash = FullTrackName::hash()(ftn);
+  uint8_t estimate = kMaxCount;
+  for (size_t row = 0; row < kRows; row++) {
+    estimate = std::min(estimate, counters_[counterIndex(hash, row)]);
+  }
+  return estimate;
+}
+
+void MoQCacheAdmissionPolicy::halve() {
+  for (auto& counter : counters_) {
+    counter >>= 1;
+  }
+  requests_ /= 2;
+}
+
+bool MoQCacheAdmissionPolicy::admit(const Candidate& candidate) {
+  const auto& ns = candidate.fullTrackName.trackNamespace;
+  if (underAny(ns, config_.neverCache)) {
+    return false;
+  }
+  if (underAny(ns, config_.alwaysCache)) {
+    return true;
+  }
+  if (candidate.subscribers < config_.minSubscribers) {
+    return false;
+  }
+  if (config_.frequencySketch && candidate.victim &&
+      !(*candidate.victim == candidate.fullTrackName)) {
+    return frequency(candidate.fullTrackName) > frequency(*candidate.victim);
+  }
+  return true;
+}
+
+} // namespace moxygen
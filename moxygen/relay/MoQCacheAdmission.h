@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "moxygen/MoQFramer.h"
+
+#include <vector>
+
+namespace moxygen {
+
+// Decides which groups arriving on a subscription MoQCache keeps.  Groups a
+// FETCH brings in are always cached, the FETCH asked for them.
+class MoQCacheAdmission {
+ public:
+  struct Candidate {
+    const FullTrackName& fullTrackName;
+    uint64_t groupID;
+    // Subscribers of the track at the relay, 0 if unknown
+    size_t subscribers;
+    // The track of the group that would be evicted next, when the cache is
+    // close to its budget
+    const FullTrackName* victim;
+  };
+
+  virtual ~MoQCacheAdmission() = default;
+
+  // A SUBSCRIBE or FETCH for the track arrived
+  virtual void onRequest(const FullTrackName& /* ftn */) {}
+
+  // Called once for each new group of a subscribed track
+  virtual bool admit(const Candidate& candidate) = 0;
+};
+
+/*
+ * The built in admission policy.  Rules apply in order:
+ *   - tracks under a neverCache namespace are not cached
+ *   - tracks under an alwaysCache namespace are
+ *   - tracks with fewer than minSubscribers subscribers are not
+ *   - with frequencySketch, once the cache is near its budget, a group is
+ *     cached only if its track has been requested more often than the
+ *     track it would evict, as TinyLFU does
+ *
+ * Request counts are kept in a count-min sketch of 4 rows of small
+ * counters.  Every sampleSize requests the counters are halved, so the
+ * counts follow recent popularity and the sketch stays a fixed size however
+ * many tracks there are.
+ *
+ * Not thread safe, like MoQCache.
+ */
+class MoQCacheAdmissionPolicy : public MoQCacheAdmission {
+ public:
+  struct Config {
+    std::vector<TrackNamespace> neverCache;
+    std::vector<TrackNamespace> alwaysCache;
+    size_t minSubscribers{0};
+    bool frequencySketch{false};
+    // Counters in each row, rounded up to a power of 2
+    size_t sketchWidth{4096};
+    // Requests between halvings, 0 for 10 times sketchWidth
+    uint64_t sampleSize{0};
+  };
+
+  explicit MoQCacheAdmissionPolicy(Config config);
+
+  void onRequest(const FullTrackName& ftn) override;
+  bool admit(const Candidate& candidate) override;
+
+  // Estimated requests for ftn since the counters were last halved
+  uint32_t frequency(const FullTrackName& ftn) const;
+
+ private:
+  static constexpr size_t kRows = 4;
+  static constexpr uint8_t kMaxCount = 15;
+
+  size_t counterIndex(uint64_t hash, size_t row) const;
+  void halve();
+
+  Config config_;
+  size_t mask_{0};
+  uint64_t sampleSize_{0};
+  uint64_t requests_{0};
+  std::vector<uint8_t> counters_;
+};
+
+} // namespace moxygen
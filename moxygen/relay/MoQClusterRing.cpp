@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/relay/MoQClusterRing.h"
+
+#include <folly/Conv.h>
+#include <folly/hash/Hash.h>
+
+namespace moxygen {
+
+namespace {
+uint64_t hashBytes(folly::StringPiece bytes, uint64_t hash) {
+  return folly::hash::fnv64_buf(bytes.data(), bytes.size(), hash);
+}
+
+// FNV alone clusters similar strings, like a peer's virtual node names
+uint64_t finish(uint64_t hash) {
+  return folly::hash::twang_mix64(hash);
+}
+
+const std::string kNoPeer;
+} // namespace
+
+MoQClusterRing::MoQClusterRing(
+    std::vector<std::string> peers,
+    uint32_t virtualNodes)
+    : peers_(std::move(peers)) {
+  std::sort(peers_.begin(), peers_.end());
+  peers_.erase(std::unique(peers_.begin(), peers_.end()), peers_.end());
+  virtualNodes = std::max(virtualNodes, 1u);
+  ring_.reserve(peers_.size() * virtualNodes);
+  for (size_t i = 0; i < peers_.size(); i++) {
+    auto peerHash = hashBytes(peers_[i], folly::hash::fnv64_hash_start);
+    for (uint32_t v = 0; v < virtualNodes; v++) {
+      auto vnodeHash = hashBytes(folly::to<std::string>('#', v), peerHash);
+      ring_.emplace_back(finish(vnodeHash), i);
+    }
+  }
+  std::sort(ring_.begin(), ring_.end());
+}
+
+uint64_t MoQClusterRing::hash(const FullTrackName& ftn) {
+  // Each element is followed by a NUL so ("ab", "c") and ("a", "bc") differ
+  static constexpr char kDelimiter = '\0';
+  auto hash = folly::hash::fnv64_hash_start;
+  for (const auto& element : ftn.trackNamespace.elements()) {
+    hash = hashBytes(element, hash);
+    hash = hashBytes(folly::StringPiece(&kDelimiter, 1), hash);
+  }
+  hash = hashBytes(folly::StringPiece(&kDelimiter, 1), hash);
+  return finish(hashBytes(ftn.trackName, hash));
+}
+
+const std::string& MoQClusterRing::owner(const FullTrackName& ftn) const {
+  if (ring_.empty()) {
+    return kNoPeer;
+  }
+  auto it = std::lower_bound(
+      ring_.begin(),
+      ring_.end(),
+      std::make_pair(hash(ftn), size_t(0)));
+  if (it == ring_.end()) {
+    it = ring_.begin();
+  }
+  return peers_[it->second];
+}
+
+} // namespace moxygen
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <moxygen/MoQFramer.h>
+
+namespace moxygen {
+
+// Assigns each track to one relay of a cluster by consistent hashing of its
+// FullTrackName.  Every peer is placed on the ring virtualNodes times, and a
+// track is owned by the first peer at or after its hash.  Adding or removing
+// a peer only moves the tracks that peer gains or loses.
+//
+// The hash doesn't depend on the process, so relays built from the same peer
+// list agree on every owner.  A ring is immutable, a new one is built when
+// membership changes.
+class MoQClusterRing {
+ public:
+  static constexpr uint32_t kDefaultVirtualNodes = 100;
+
+  explicit MoQClusterRing(
+      std::vector<std::string> peers,
+      uint32_t virtualNodes = kDefaultVirtualNodes);
+
+  // The peer owning ftn, empty if there are no peers
+  const std::string& owner(const FullTrackName& ftn) const;
+
+  const std::vector<std::string>& peers() const {
+    return peers_;
+  }
+
+  static uint64_t hash(const FullTrackName& ftn);
+
+ private:
+  std::vector<std::string> peers_;
+  // (position, index into peers_), sorted by position
+  std::vector<std::pair<uint64_t, size_t>> ring_;
+};
+
+} // namespace moxygen
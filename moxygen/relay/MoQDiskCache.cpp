@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/relay/MoQDiskCache.h"
+
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <folly/io/IOBufQueue.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <filesystem>
+#include <map>
+
+namespace {
+using namespace moxygen;
+
+constexpr folly::StringPiece kSegmentMagic{"MOQSEG1\0", 8};
+constexpr uint32_t kGroupMagic = 0x4d6f5147; // "MoQG"
+// magic, group, write time, last object, object count, body length
+constexpr size_t kGroupHeaderLength = 4 + 8 + 8 + 8 + 4 + 8;
+constexpr folly::StringPiece kSegmentSuffix{".seg"};
+
+uint64_t nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+void writeString(folly::io::QueueAppender& appender, const std::string& str) {
+  appender.writeBE<uint32_t>(str.size());
+  appender.push(reinterpret_cast<const uint8_t*>(str.data()), str.size());
+}
+
+std::string readString(folly::io::Cursor& cursor) {
+  auto length = cursor.readBE<uint32_t>();
+  return cursor.readFixedString(length);
+}
+
+void writeBuf(folly::io::QueueAppender& appender, const folly::IOBuf* buf) {
+  if (!buf) {
+    appender.writeBE<uint64_t>(0);
+    return;
+  }
+  appender.writeBE<uint64_t>(buf->computeChainDataLength());
+  appender.insert(buf->clone());
+}
+
+// Throws std::out_of_range on a malformed header
+FullTrackName readSegmentHeader(folly::io::Cursor& cursor) {
+  auto magic = cursor.readFixedString(kSegmentMagic.size());
+  if (folly::StringPiece(magic) != kSegmentMagic) {
+    throw std::out_of_range("bad segment magic");
+  }
+  std::vector<std::string> elements(cursor.readBE<uint32_t>());
+  for (auto& element : elements) {
+    element = readString(cursor);
+  }
+  auto trackName = readString(cursor);
+  return {TrackNamespace(std::move(elements)), std::move(trackName)};
+}
+} // namespace
+
+namespace moxygen {
+
+// Read-only mapping of a segment, held by every payload served from it
+struct MoQDiskCache::Mapping {
+  Mapping(void* inAddr, size_t inLength) : addr(inAddr), length(inLength) {}
+  Mapping(const Mapping&) = delete;
+  Mapping& operator=(const Mapping&) = delete;
+  ~Mapping() {
+    munmap(addr, length);
+  }
+
+  void* addr;
+  size_t length;
+};
+
+struct MoQDiskCache::Segment {
+  struct Record {
+    // Offset and length of the record body
+    uint64_t offset{0};
+    uint64_t length{0};
+    uint64_t lastObject{0};
+    // Milliseconds since the epoch
+    uint64_t writeTimeMs{0};
+  };
+
+  FullTrackName fullTrackName;
+  std::string path;
+  folly::File file;
+  uint64_t size{0};
+  std::map<uint64_t, Record> groups;
+  std::shared_ptr<Mapping> mapping;
+
+  // Maps the whole file, if it has grown past the current mapping.  Payloads
+  // from an older mapping keep it alive.
+  bool remap() {
+    if (mapping && mapping->length >= size) {
+      return true;
+    }
+    auto addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, file.fd(), 0);
+    if (addr == MAP_FAILED) {
+      XLOG(ERR) << "mmap failed for " << path
+                << " err=" << folly::errnoStr(errno);
+      return false;
+    }
+    mapping = std::make_shared<Mapping>(addr, size);
+    return true;
+  }
+
+  // Wraps [offset, offset + length) of the mapping without copying
+  std::unique_ptr<folly::IOBuf> wrap(uint64_t offset, uint64_t length) {
+    auto holder = new std::shared_ptr<Mapping>(mapping);
+    return folly::IOBuf::takeOwnership(
+        static_cast<uint8_t*>(mapping->addr) + offset,
+        length,
+        0,
+        length,
+        [](void*, void* userData) {
+          delete static_cast<std::shared_ptr<Mapping>*>(userData);
+        },
+        holder);
+  }
+};
+
+MoQDiskCache::MoQDiskCache(std::string dir) : dir_(std::move(dir)) {
+  std::error_code ec;
+  std::filesystem::create_directories(dir_, ec);
+  if (ec) {
+    XLOG(ERR) << "Can't create disk cache dir=" << dir_
+              << " err=" << ec.message();
+    return;
+  }
+  for (const auto& entry : std::filesystem::directory_iterator(dir_, ec)) {
+    if (entry.is_regular_file() &&
+        entry.path().extension() == kSegmentSuffix.str()) {
+      openSegment(entry.path().string());
+    }
+  }
+  XLOG(INFO) << "Disk cache dir=" << dir_ << " tracks=" << segments_.size()
+             << " bytes=" << diskBytes_;
+}
+
+MoQDiskCache::~MoQDiskCache() = default;
+
+void MoQDiskCache::openSegment(const std::string& path) {
+  auto segment = std::make_unique<Segment>();
+  segment->path = path;
+  try {
+    segment->file = folly::File(path, O_RDWR | O_APPEND);
+  } catch (const std::system_error& ex) {
+    XLOG(ERR) << "Can't open segment " << path << " err=" << ex.what();
+    return;
+  }
+  struct stat st;
+  if (fstat(segment->file.fd(), &st) != 0 || st.st_size == 0) {
+    return;
+  }
+  segment->size = st.st_size;
+  if (!segment->remap()) {
+    return;
+  }
+  auto buf = segment->wrap(0, segment->size);
+  folly::io::Cursor cursor(buf.get());
+  try {
+    segment->fullTrackName = readSegmentHeader(cursor);
+  } catch (const std::out_of_range&) {
+    XLOG(ERR) << "Skipping segment with a bad header " << path;
+    return;
+  }
+  if (segments_.contains(segment->fullTrackName)) {
+    XLOG(ERR) << "Skipping duplicate segment " << path
+              << " for track=" << segment->fullTrackName;
+    return;
+  }
+  // Index records until the first one that is cut short
+  auto validLength = cursor.getCurrentPosition();
+  while (cursor.canAdvance(kGroupHeaderLength)) {
+    if (cursor.readBE<uint32_t>() != kGroupMagic) {
+      break;
+    }
+    auto groupID = cursor.readBE<uint64_t>();
+    Segment::Record record;
+    record.writeTimeMs = cursor.readBE<uint64_t>();
+    record.lastObject = cursor.readBE<uint64_t>();
+    cursor.skip(sizeof(uint32_t));
+    record.length = cursor.readBE<uint64_t>();
+    record.offset = cursor.getCurrentPosition();
+    if (!cursor.canAdvance(record.length)) {
+      break;
+    }
+    cursor.skip(record.length);
+    // A later record for the same group replaces the earlier one
+    segment->groups[groupID] = record;
+    validLength = cursor.getCurrentPosition();
+  }
+  if (validLength < segment->size) {
+    XLOG(WARN) << "Truncating " << (segment->size - validLength)
+               << " bytes from segment " << path;
+    if (ftruncate(segment->file.fd(), validLength) != 0) {
+      XLOG(ERR) << "ftruncate failed for " << path
+                << " err=" << folly::errnoStr(errno);
+      return;
+    }
+    segment->size = validLength;
+  }
+  XLOG(DBG1) << "Loaded segment " << path
+             << " track=" << segment->fullTrackName
+             << " groups=" << segment->groups.size();
+  diskBytes_ += segment->size;
+  auto ftn = segment->fullTrackName;
+  segments_.emplace(std::move(ftn), std::move(segment));
+}
+
+MoQDiskCache::Segment* MoQDiskCache::getOrCreateSegment(
+    const FullTrackName& ftn) {
+  auto it = segments_.find(ftn);
+  if (it != segments_.end()) {
+    return it->second.get();
+  }
+  // Names only need to be unique, the header identifies the track
+  auto base = folly::to<std::string>(
+      dir_, "/", folly::to<std::string>(FullTrackName::hash()(ftn)));
+  auto path = folly::to<std::string>(base, kSegmentSuffix);
+  std::error_code ec;
+  for (uint32_t i = 1; std::filesystem::exists(path, ec); i++) {
+    path = folly::to<std::string>(base, "-", i, kSegmentSuffix);
+  }
+  auto segment = std::make_unique<Segment>();
+  segment->fullTrackName = ftn;
+  segment->path = path;
+  try {
+    segment->file = folly::File(path, O_RDWR | O_APPEND | O_CREAT, 0644);
+  } catch (const std::system_error& ex) {
+    XLOG(ERR) << "Can't create segment " << path << " err=" << ex.what();
+    return nullptr;
+  }
+  folly::IOBufQueue queue{folly::IOBufQueue::cacheChainLength()};
+  folly::io::QueueAppender appender(&queue, 256);
+  appender.push(
+      reinterpret_cast<const uint8_t*>(kSegmentMagic.data()),
+      kSegmentMagic.size());
+  appender.writeBE<uint32_t>(ftn.trackNamespace.size());
+  for (const auto& element : ftn.trackNamespace.elements()) {
+    writeString(appender, element);
+  }
+  writeString(appender, ftn.trackName);
+  auto header = queue.move();
+  auto range = header->coalesce();
+  if (folly::writeFull(segment->file.fd(), range.data(), range.size()) !=
+      ssize_t(range.size())) {
+    XLOG(ERR) << "Can't write segment " << path
+              << " err=" << folly::errnoStr(errno);
+    segment->file.close();
+    if (!std::filesystem::remove(path, ec) && ec) {
+      XLOG(ERR) << "Can't remove segment " << path << " err=" << ec.message();
+    }
+    return nullptr;
+  }
+  segment->size = range.size();
+  diskBytes_ += segment->size;
+  return segments_.emplace(ftn, std::move(segment)).first->second.get();
+}
+
+bool MoQDiskCache::writeGroup(
+    const FullTrackName& ftn,
+    uint64_t groupID,
+    const std::vector<Object>& objects) {
+  if (objects.empty()) {
+    return false;
+  }
+  auto segment = getOrCreateSegment(ftn);
+  if (!segment) {
+    return false;
+  }
+  folly::IOBufQueue body{folly::IOBufQueue::cacheChainLength()};
+  folly::io::QueueAppender appender(&body, 1024);
+  for (const auto& object : objects) {
+    appender.writeBE<uint64_t>(object.objectID);
+    appender.writeBE<uint64_t>(object.subgroup);
+    appender.writeBE<uint8_t>(uint8_t(object.status));
+    appender.writeBE<uint32_t>(object.extensions.size());
+    for (const auto& ext : object.extensions) {
+      appender.writeBE<uint64_t>(ext.type);
+      appender.writeBE<uint64_t>(ext.intValue);
+      writeBuf(appender, ext.arrayValue.get());
+    }
+    writeBuf(appender, object.payload.get());
+  }
+  auto bodyLength = body.chainLength();
+
+  folly::IOBufQueue record{folly::IOBufQueue::cacheChainLength()};
+  folly::io::QueueAppender recordAppender(&record, kGroupHeaderLength);
+  recordAppender.writeBE<uint32_t>(kGroupMagic);
+  recordAppender.writeBE<uint64_t>(groupID);
+  auto writeTimeMs = nowMs();
+  recordAppender.writeBE<uint64_t>(writeTimeMs);
+  recordAppender.writeBE<uint64_t>(objects.back().objectID);
+  recordAppender.writeBE<uint32_t>(objects.size());
+  recordAppender.writeBE<uint64_t>(bodyLength);
+  record.append(body.move());
+  auto buf = record.move();
+  auto range = buf->coalesce();
+  if (folly::writeFull(segment->file.fd(), range.data(), range.size()) !=
+      ssize_t(range.size())) {
+    XLOG(ERR) << "Can't write group=" << groupID << " to " << segment->path
+              << " err=" << folly::errnoStr(errno);
+    // Drop whatever part of the record made it out
+    if (ftruncate(segment->file.fd(), segment->size) != 0) {
+      XLOG(ERR) << "ftruncate failed for " << segment->path;
+    }
+    return false;
+  }
+  XLOG(DBG1) << "Wrote group=" << groupID << " bytes=" << range.size()
+             << " track=" << ftn;
+  segment->groups[groupID] = Segment::Record{
+      segment->size + kGroupHeaderLength,
+      bodyLength,
+      objects.back().objectID,
+      writeTimeMs};
+  segment->size += range.size();
+  diskBytes_ += range.size();
+  return true;
+}
+
+bool MoQDiskCache::hasGroup(
+    const FullTrackName& ftn,
+    uint64_t groupID,
+    std::chrono::milliseconds maxAge) const {
+  auto it = segments_.find(ftn);
+  if (it == segments_.end()) {
+    return false;
+  }
+  auto recordIt = it->second->groups.find(groupID);
+  if (recordIt == it->second->groups.end()) {
+    return false;
+  }
+  return maxAge.count() == 0 ||
+      recordIt->second.writeTimeMs + maxAge.count() > nowMs();
+}
+
+folly::Optional<std::vector<MoQDiskCache::Object>> MoQDiskCache::readGroup(
+    const FullTrackName& ftn,
+    uint64_t groupID) {
+  auto it = segments_.find(ftn);
+  if (it == segments_.end()) {
+    return folly::none;
+  }
+  auto& segment = *it->second;
+  auto recordIt = segment.groups.find(groupID);
+  if (recordIt == segment.groups.end() || !segment.remap()) {
+    return folly::none;
+  }
+  const auto& record = recordIt->second;
+  auto buf = segment.wrap(record.offset, record.length);
+  folly::io::Cursor cursor(buf.get());
+  std::vector<Object> objects;
+  try {
+    while (!cursor.isAtEnd()) {
+      auto& object = objects.emplace_back();
+      object.objectID = cursor.readBE<uint64_t>();
+      object.subgroup = cursor.readBE<uint64_t>();
+      object.status = ObjectStatus(cursor.readBE<uint8_t>());
+      auto numExtensions = cursor.readBE<uint32_t>();
+      std::vector<Extension> extensions;
+      extensions.reserve(numExtensions);
+      for (uint32_t i = 0; i < numExtensions; i++) {
+        auto type = cursor.readBE<uint64_t>();
+        auto intValue = cursor.readBE<uint64_t>();
+        auto arrayLength = cursor.readBE<uint64_t>();
+        if (type & 0x1) {
+          std::unique_ptr<folly::IOBuf> arrayValue;
+          cursor.clone(arrayValue, arrayLength);
+          extensions.emplace_back(type, std::move(arrayValue));
+        } else {
+          extensions.emplace_back(type, intValue);
+        }
+      }
+      object.extensions = Extensions(std::move(extensions));
+      auto payloadLength = cursor.readBE<uint64_t>();
+      if (object.status == ObjectStatus::NORMAL) {
+        cursor.clone(object.payload, payloadLength);
+      } else {
+        cursor.skip(payloadLength);
+      }
+    }
+  } catch (const std::out_of_range&) {
+    XLOG(ERR) << "Malformed group=" << groupID << " in " << segment.path;
+    return folly::none;
+  }
+  return objects;
+}
+
+folly::Optional<AbsoluteLocation> MoQDiskCache::latest(
+    const FullTrackName& ftn) const {
+  auto it = segments_.find(ftn);
+  if (it == segments_.end() || it->second->groups.empty()) {
+    return folly::none;
+  }
+  const auto& [groupID, record] = *it->second->groups.rbegin();
+  return AbsoluteLocation{groupID, record.lastObject};
+}
+
+} // namespace moxygen
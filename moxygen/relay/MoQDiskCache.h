@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/File.h>
+#include <folly/container/F14Map.h>
+#include <moxygen/MoQFramer.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+namespace moxygen {
+
+/*
+ * Disk tier for MoQCache.  Completed groups are appended to one segment file
+ * per track, and read back with payloads pointing into a read-only mapping of
+ * the file, so serving them copies nothing.  Segments found in the directory
+ * are indexed at construction, so the cache is warm across restarts.
+ *
+ * A segment is a header naming the track, followed by one record per group.
+ * Records carry their wall clock write time, so cache durations hold across
+ * restarts.  A record cut short by a crash is truncated on the next open.
+ * I/O is blocking and nothing is ever removed from disk.
+ */
+class MoQDiskCache {
+ public:
+  struct Object {
+    uint64_t objectID{0};
+    uint64_t subgroup{0};
+    ObjectStatus status{ObjectStatus::NORMAL};
+    Extensions extensions;
+    Payload payload;
+  };
+
+  explicit MoQDiskCache(std::string dir);
+  ~MoQDiskCache();
+  MoQDiskCache(const MoQDiskCache&) = delete;
+  MoQDiskCache& operator=(const MoQDiskCache&) = delete;
+
+  // Appends a group, objects must be complete.  Returns false on I/O errors.
+  bool writeGroup(
+      const FullTrackName& ftn,
+      uint64_t groupID,
+      const std::vector<Object>& objects);
+
+  // True if the group is stored, and was written within maxAge unless that
+  // is 0
+  bool hasGroup(
+      const FullTrackName& ftn,
+      uint64_t groupID,
+      std::chrono::milliseconds maxAge = std::chrono::milliseconds(0)) const;
+
+  // Objects of a stored group in ID order, or none
+  folly::Optional<std::vector<Object>> readGroup(
+      const FullTrackName& ftn,
+      uint64_t groupID);
+
+  // Largest location stored for the track
+  folly::Optional<AbsoluteLocation> latest(const FullTrackName& ftn) const;
+
+  uint64_t diskBytes() const {
+    return diskBytes_;
+  }
+
+ private:
+  struct Mapping;
+  struct Segment;
+
+  Segment* getOrCreateSegment(const FullTrackName& ftn);
+  void openSegment(const std::string& path);
+
+  std::string dir_;
+  folly::F14FastMap<FullTrackName, std::unique_ptr<Segment>, FullTrackName::hash>
+      segments_;
+  uint64_t diskBytes_{0};
+};
+
+} // namespace moxygen
@@ -0,0 +1,659 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "moxygen/MoQConsumers.h"
+#include "moxygen/Publisher.h"
+#include "moxygen/Subscriber.h"
+
+#include <folly/io/async/EventBase.h>
+#include <folly/logging/xlog.h>
+
+#include <atomic>
+
+// Proxies that move calls onto the EventBase owning the wrapped object.
+//
+// These are used when relay state and a session live on different worker
+// threads.  Calls are queued with runInEventBaseThread, which preserves order
+// and does not take a lock on the hot path, and return success immediately.
+// An error from the wrapped object is surfaced on the next call through the
+// proxy.  Flow control signals (BLOCKED, awaitReadyToConsume,
+// awaitStreamCredit) do not cross the hop.
+
+namespace moxygen {
+
+namespace detail {
+
+template <typename T>
+struct EvbProxyState {
+  explicit EvbProxyState(std::shared_ptr<T> inConsumer)
+      : consumer(std::move(inConsumer)) {}
+
+  // Only accessed on the target EventBase
+  std::shared_ptr<T> consumer;
+  std::atomic<bool> failed{false};
+};
+
+// Runs fn(consumer) on evb, or fails fast if an earlier call failed
+template <typename T, typename Fn>
+folly::Expected<folly::Unit, MoQPublishError> postToEvb(
+    folly::EventBase* evb,
+    const std::shared_ptr<EvbProxyState<T>>& state,
+    Fn&& fn) {
+  if (state->failed) {
+    return folly::makeUnexpected(MoQPublishError(
+        MoQPublishError::CANCELLED, "Proxied consumer failed"));
+  }
+  evb->runInEventBaseThread(
+      [state, fn = std::forward<Fn>(fn)]() mutable {
+        if (!state->consumer || state->failed) {
+          return;
+        }
+        if constexpr (std::is_void_v<decltype(fn(*state->consumer))>) {
+          fn(*state->consumer);
+        } else {
+          auto res = fn(*state->consumer);
+          if (res.hasError()) {
+            XLOG(DBG1) << "Proxied call failed " << res.error().describe();
+            state->failed = true;
+          }
+        }
+      });
+  return folly::unit;
+}
+
+// Drops the last reference to ptr on evb
+template <typename T>
+void releaseOnEvb(folly::EventBase* evb, std::shared_ptr<T> ptr) {
+  if (evb && ptr) {
+    evb->runInEventBaseThread([ptr = std::move(ptr)]() mutable { ptr.reset(); });
+  }
+}
+
+} // namespace detail
+
+class EvbSubgroupConsumer : public SubgroupConsumer {
+ public:
+  using State = detail::EvbProxyState<SubgroupConsumer>;
+
+  // Opens the subgroup on trackState's consumer, on evb
+  EvbSubgroupConsumer(
+      folly::EventBase* evb,
+      std::shared_ptr<detail::EvbProxyState<TrackConsumer>> trackState,
+      uint64_t groupID,
+      uint64_t subgroupID,
+      Priority priority)
+      : evb_(evb), state_(std::make_shared<State>(nullptr)) {
+    evb_->runInEventBaseThread([state = state_,
+                                trackState = std::move(trackState),
+                                groupID,
+                                subgroupID,
+                                priority] {
+      if (!trackState->consumer || trackState->failed) {
+        state->failed = true;
+        return;
+      }
+      auto res =
+          trackState->consumer->beginSubgroup(groupID, subgroupID, priority);
+      if (res.hasError()) {
+        XLOG(DBG1) << "Proxied beginSubgroup failed "
+                   << res.error().describe();
+        state->failed = true;
+        trackState->failed = true;
+      } else {
+        state->consumer = std::move(res.value());
+      }
+    });
+  }
+  EvbSubgroupConsumer(const EvbSubgroupConsumer&) = delete;
+  EvbSubgroupConsumer& operator=(const EvbSubgroupConsumer&) = delete;
+  EvbSubgroupConsumer(EvbSubgroupConsumer&&) = delete;
+  EvbSubgroupConsumer& operator=(EvbSubgroupConsumer&&) = delete;
+
+  ~EvbSubgroupConsumer() override {
+    detail::releaseOnEvb(evb_, std::move(state_));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> object(
+      uint64_t objectID,
+      Payload payload,
+      Extensions extensions,
+      bool finSubgroup) override {
+    return detail::postToEvb(
+        evb_,
+        state_,
+        [objectID,
+         payload = std::move(payload),
+         extensions = std::move(extensions),
+         finSubgroup](SubgroupConsumer& consumer) mutable {
+          return consumer.object(
+              objectID, std::move(payload), std::move(extensions), finSubgroup);
+        });
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objects(
+      std::span<SubgroupObject> batch,
+      bool finSubgroup) override {
+    return detail::postToEvb(
+        evb_,
+        state_,
+        [batch = std::vector<SubgroupObject>(
+             std::make_move_iterator(batch.begin()),
+             std::make_move_iterator(batch.end())),
+         finSubgroup](SubgroupConsumer& consumer) mutable {
+          return consumer.objects(batch, finSubgroup);
+        });
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objectNotExists(
+      uint64_t objectID,
+      Extensions extensions,
+      bool finSubgroup) override {
+    return detail::postToEvb(
+        evb_,
+        state_,
+        [objectID, extensions = std::move(extensions), finSubgroup](
+            SubgroupConsumer& consumer) mutable {
+          return consumer.objectNotExists(
+              objectID, std::move(extensions), finSubgroup);
+        });
+  }
+
+  void checkpoint() override {
+    detail::postToEvb(
+        evb_, state_, [](SubgroupConsumer& consumer) { consumer.checkpoint(); });
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> beginObject(
+      uint64_t objectID,
+      uint64_t length,
+      Payload initialPayload,
+      Extensions extensions) override {
+    remainingLength_ = length -
+        (initialPayload ? initialPayload->computeChainDataLength() : 0);
+    return detail::postToEvb(
+        evb_,
+        state_,
+        [objectID,
+         length,
+         initialPayload = std::move(initialPayload),
+         extensions = std::move(extensions)](
+            SubgroupConsumer& consumer) mutable {
+          return consumer.beginObject(
+              objectID,
+              length,
+              std::move(initialPayload),
+              std::move(extensions));
+        });
+  }
+
+  folly::Expected<ObjectPublishStatus, MoQPublishError> objectPayload(
+      Payload payload,
+      bool finSubgroup) override {
+    auto length = payload ? payload->computeChainDataLength() : 0;
+    remainingLength_ -= std::min(remainingLength_, length);
+    auto res = detail::postToEvb(
+        evb_,
+        state_,
+        [payload = std::move(payload),
+         finSubgroup](SubgroupConsumer& consumer) mutable {
+          return consumer.objectPayload(std::move(payload), finSubgroup);
+        });
+    if (res.hasError()) {
+      return folly::makeUnexpected(res.error());
+    }
+    return remainingLength_ == 0 ? ObjectPublishStatus::DONE
+                                 : ObjectPublishStatus::IN_PROGRESS;
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> endOfGroup(
+      uint64_t endOfGroupObjectID,
+      Extensions extensions) override {
+    return detail::postToEvb(
+        evb_,
+        state_,
+        [endOfGroupObjectID, extensions = std::move(extensions)](
+            SubgroupConsumer& consumer) mutable {
+          return consumer.endOfGroup(
+              endOfGroupObjectID, std::move(extensions));
+        });
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> endOfTrackAndGroup(
+      uint64_t endOfTrackObjectID,
+      Extensions extensions) override {
+    return detail::postToEvb(
+        evb_,
+        state_,
+        [endOfTrackObjectID, extensions = std::move(extensions)](
+            SubgroupConsumer& consumer) mutable {
+          return consumer.endOfTrackAndGroup(
+              endOfTrackObjectID, std::move(extensions));
+        });
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> endOfSubgroup() override {
+    return detail::postToEvb(evb_, state_, [](SubgroupConsumer& consumer) {
+      return consumer.endOfSubgroup();
+    });
+  }
+
+  void reset(ResetStreamErrorCode error) override {
+    detail::postToEvb(evb_, state_, [error](SubgroupConsumer& consumer) {
+      consumer.reset(error);
+    });
+  }
+
+ private:
+  folly::EventBase* evb_;
+  std::shared_ptr<State> state_;
+  uint64_t remainingLength_{0};
+};
+
+class EvbTrackConsumer : public TrackConsumer {
+ public:
+  using State = detail::EvbProxyState<TrackConsumer>;
+
+  EvbTrackConsumer(folly::EventBase* evb, std::shared_ptr<TrackConsumer> consumer)
+      : evb_(evb), state_(std::make_shared<State>(std::move(consumer))) {}
+  EvbTrackConsumer(const EvbTrackConsumer&) = delete;
+  EvbTrackConsumer& operator=(const EvbTrackConsumer&) = delete;
+  EvbTrackConsumer(EvbTrackConsumer&&) = delete;
+  EvbTrackConsumer& operator=(EvbTrackConsumer&&) = delete;
+
+  ~EvbTrackConsumer() override {
+    detail::releaseOnEvb(evb_, std::move(state_));
+  }
+
+  folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
+  beginSubgroup(uint64_t groupID, uint64_t subgroupID, Priority priority)
+      override {
+    if (state_->failed) {
+      return folly::makeUnexpected(MoQPublishError(
+          MoQPublishError::CANCELLED, "Proxied consumer failed"));
+    }
+    return std::make_shared<EvbSubgroupConsumer>(
+        evb_, state_, groupID, subgroupID, priority);
+  }
+
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitStreamCredit() override {
+    return folly::makeSemiFuture();
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objectStream(
+      const ObjectHeader& header,
+      Payload payload) override {
+    return detail::postToEvb(
+        evb_,
+        state_,
+        [header, payload = std::move(payload)](TrackConsumer& consumer) mutable {
+          return consumer.objectStream(header, std::move(payload));
+        });
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> datagram(
+      const ObjectHeader& header,
+      Payload payload) override {
+    return detail::postToEvb(
+        evb_,
+        state_,
+        [header, payload = std::move(payload)](TrackConsumer& consumer) mutable {
+          return consumer.datagram(header, std::move(payload));
+        });
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> groupNotExists(
+      uint64_t groupID,
+      uint64_t subgroup,
+      Priority pri,
+      Extensions extensions) override {
+    return detail::postToEvb(
+        evb_,
+        state_,
+        [groupID, subgroup, pri, extensions = std::move(extensions)](
+            TrackConsumer& consumer) mutable {
+          return consumer.groupNotExists(
+              groupID, subgroup, pri, std::move(extensions));
+        });
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> subscribeDone(
+      SubscribeDone subDone) override {
+    return detail::postToEvb(
+        evb_,
+        state_,
+        [subDone = std::move(subDone)](TrackConsumer& consumer) mutable {
+          return consumer.subscribeDone(std::move(subDone));
+        });
+  }
+
+ private:
+  folly::EventBase* evb_;
+  std::shared_ptr<State> state_;
+};
+
+class EvbFetchConsumer : public FetchConsumer {
+ public:
+  using State = detail::EvbProxyState<FetchConsumer>;
+
+  EvbFetchConsumer(folly::EventBase* evb, std::shared_ptr<FetchConsumer> consumer)
+      : evb_(evb), state_(std::make_shared<State>(std::move(consumer))) {}
+  EvbFetchConsumer(const EvbFetchConsumer&) = delete;
+  EvbFetchConsumer& operator=(const EvbFetchConsumer&) = delete;
+  EvbFetchConsumer(EvbFetchConsumer&&) = delete;
+  EvbFetchConsumer& operator=(EvbFetchConsumer&&) = delete;
+
+  ~EvbFetchConsumer() override {
+    detail::releaseOnEvb(evb_, std::move(state_));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> object(
+      uint64_t groupID,
+      uint64_t subgroupID,
+      uint64_t objectID,
+      Payload payload,
+      Extensions extensions,
+      bool finFetch) override {
+    return detail::postToEvb(
+        evb_,
+        state_,
+        [groupID,
+         subgroupID,
+         objectID,
+         payload = std::move(payload),
+         extensions = std::move(extensions),
+         finFetch](FetchConsumer& consumer) mutable {
+          return consumer.object(
+              groupID,
+              subgroupID,
+              objectID,
+              std::move(payload),
+              std::move(extensions),
+              finFetch);
+        });
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objectNotExists(
+      uint64_t groupID,
+      uint64_t subgroupID,
+      uint64_t objectID,
+      Extensions extensions,
+      bool finFetch) override {
+    return detail::postToEvb(
+        evb_,
+        state_,
+        [groupID,
+         subgroupID,
+         objectID,
+         extensions = std::move(extensions),
+         finFetch](FetchConsumer& consumer) mutable {
+          return consumer.objectNotExists(
+              groupID, subgroupID, objectID, std::move(extensions), finFetch);
+        });
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> groupNotExists(
+      uint64_t groupID,
+      uint64_t subgroupID,
+      Extensions extensions,
+      bool finFetch) override {
+    return detail::postToEvb(
+        evb_,
+        state_,
+        [groupID, subgroupID, extensions = std::move(extensions), finFetch](
+            FetchConsumer& consumer) mutable {
+          return consumer.groupNotExists(
+              groupID, subgroupID, std::move(extensions), finFetch);
+        });
+  }
+
+  void checkpoint() override {
+    detail::postToEvb(
+        evb_, state_, [](FetchConsumer& consumer) { consumer.checkpoint(); });
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> beginObject(
+      uint64_t groupID,
+      uint64_t subgroupID,
+      uint64_t objectID,
+      uint64_t length,
+      Payload initialPayload,
+      Extensions extensions) override {
+    remainingLength_ = length -
+        (initialPayload ? initialPayload->computeChainDataLength() : 0);
+    return detail::postToEvb(
+        evb_,
+        state_,
+        [groupID,
+         subgroupID,
+         objectID,
+         length,
+         initialPayload = std::move(initialPayload),
+         extensions = std::move(extensions)](FetchConsumer& consumer) mutable {
+          return consumer.beginObject(
+              groupID,
+              subgroupID,
+              objectID,
+              length,
+              std::move(initialPayload),
+              std::move(extensions));
+        });
+  }
+
+  folly::Expected<ObjectPublishStatus, MoQPublishError> objectPayload(
+      Payload payload,
+      bool finFetch) override {
+    auto length = payload ? payload->computeChainDataLength() : 0;
+    remainingLength_ -= std::min(remainingLength_, length);
+    auto res = detail::postToEvb(
+        evb_,
+        state_,
+        [payload = std::move(payload),
+         finFetch](FetchConsumer& consumer) mutable {
+          return consumer.objectPayload(std::move(payload), finFetch);
+        });
+    if (res.hasError()) {
+      return folly::makeUnexpected(res.error());
+    }
+    return remainingLength_ == 0 ? ObjectPublishStatus::DONE
+                                 : ObjectPublishStatus::IN_PROGRESS;
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> endOfGroup(
+      uint64_t groupID,
+      uint64_t subgroupID,
+      uint64_t objectID,
+      Extensions extensions,
+      bool finFetch) override {
+    return detail::postToEvb(
+        evb_,
+        state_,
+        [groupID,
+         subgroupID,
+         objectID,
+         extensions = std::move(extensions),
+         finFetch](FetchConsumer& consumer) mutable {
+          return consumer.endOfGroup(
+              groupID, subgroupID, objectID, std::move(extensions), finFetch);
+        });
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> endOfTrackAndGroup(
+      uint64_t groupID,
+      uint64_t subgroupID,
+      uint64_t objectID,
+      Extensions extensions) override {
+    return detail::postToEvb(
+        evb_,
+        state_,
+        [groupID, subgroupID, objectID, extensions = std::move(extensions)](
+            FetchConsumer& consumer) mutable {
+          return consumer.endOfTrackAndGroup(
+              groupID, subgroupID, objectID, std::move(extensions));
+        });
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> endOfFetch() override {
+    return detail::postToEvb(evb_, state_, [](FetchConsumer& consumer) {
+      return consumer.endOfFetch();
+    });
+  }
+
+  void reset(ResetStreamErrorCode error) override {
+    detail::postToEvb(evb_, state_, [error](FetchConsumer& consumer) {
+      consumer.reset(error);
+    });
+  }
+
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitReadyToConsume() override {
+    return folly::makeSemiFuture();
+  }
+
+ private:
+  folly::EventBase* evb_;
+  std::shared_ptr<State> state_;
+  uint64_t remainingLength_{0};
+};
+
+class EvbSubscriptionHandle : public Publisher::SubscriptionHandle {
+ public:
+  EvbSubscriptionHandle(
+      folly::EventBase* evb,
+      std::shared_ptr<Publisher::SubscriptionHandle> handle)
+      : Publisher::SubscriptionHandle(handle->subscribeOk()),
+        evb_(evb),
+        handle_(std::move(handle)) {}
+
+  ~EvbSubscriptionHandle() override {
+    detail::releaseOnEvb(evb_, std::move(handle_));
+  }
+
+  void unsubscribe() override {
+    evb_->runInEventBaseThread([handle = handle_] { handle->unsubscribe(); });
+  }
+
+  void subscribeUpdate(SubscribeUpdate subUpdate) override {
+    evb_->runInEventBaseThread(
+        [handle = handle_, subUpdate = std::move(subUpdate)]() mutable {
+          handle->subscribeUpdate(std::move(subUpdate));
+        });
+  }
+
+ private:
+  folly::EventBase* evb_;
+  std::shared_ptr<Publisher::SubscriptionHandle> handle_;
+};
+
+class EvbFetchHandle : public Publisher::FetchHandle {
+ public:
+  EvbFetchHandle(
+      folly::EventBase* evb,
+      std::shared_ptr<Publisher::FetchHandle> handle)
+      : Publisher::FetchHandle(handle->fetchOk()),
+        evb_(evb),
+        handle_(std::move(handle)) {}
+
+  ~EvbFetchHandle() override {
+    detail::releaseOnEvb(evb_, std::move(handle_));
+  }
+
+  void fetchCancel() override {
+    evb_->runInEventBaseThread([handle = handle_] { handle->fetchCancel(); });
+  }
+
+ private:
+  folly::EventBase* evb_;
+  std::shared_ptr<Publisher::FetchHandle> handle_;
+};
+
+class EvbSubscribeAnnouncesHandle : public Publisher::SubscribeAnnouncesHandle {
+ public:
+  EvbSubscribeAnnouncesHandle(
+      folly::EventBase* evb,
+      std::shared_ptr<Publisher::SubscribeAnnouncesHandle> handle)
+      : Publisher::SubscribeAnnouncesHandle(handle->subscribeAnnouncesOk()),
+        evb_(evb),
+        handle_(std::move(handle)) {}
+
+  ~EvbSubscribeAnnouncesHandle() override {
+    detail::releaseOnEvb(evb_, std::move(handle_));
+  }
+
+  void unsubscribeAnnounces() override {
+    evb_->runInEventBaseThread(
+        [handle = handle_] { handle->unsubscribeAnnounces(); });
+  }
+
+ private:
+  folly::EventBase* evb_;
+  std::shared_ptr<Publisher::SubscribeAnnouncesHandle> handle_;
+};
+
+// Calls into a Publisher living on publisherEvb from homeEvb.  Track and fetch
+// data is delivered back to the caller's consumer on homeEvb, and the
+// returned handles post back to publisherEvb.
+class EvbPublisher : public Publisher {
+ public:
+  EvbPublisher(
+      folly::EventBase* homeEvb,
+      std::shared_ptr<Publisher> publisher,
+      folly::EventBase* publisherEvb)
+      : homeEvb_(homeEvb),
+        publisher_(std::move(publisher)),
+        publisherEvb_(publisherEvb) {}
+
+  ~EvbPublisher() override {
+    detail::releaseOnEvb(publisherEvb_, std::move(publisher_));
+  }
+
+  folly::coro::Task<TrackStatusResult> trackStatus(
+      TrackStatusRequest trackStatusRequest) override {
+    co_return co_await publisher_->trackStatus(std::move(trackStatusRequest))
+        .scheduleOn(publisherEvb_);
+  }
+
+  folly::coro::Task<SubscribeResult> subscribe(
+      SubscribeRequest sub,
+      std::shared_ptr<TrackConsumer> callback) override {
+    auto res =
+        co_await publisher_
+            ->subscribe(
+                std::move(sub),
+                std::make_shared<EvbTrackConsumer>(homeEvb_, std::move(callback)))
+            .scheduleOn(publisherEvb_);
+    if (res.hasError()) {
+      co_return folly::makeUnexpected(res.error());
+    }
+    co_return std::make_shared<EvbSubscriptionHandle>(
+        publisherEvb_, std::move(res.value()));
+  }
+
+  folly::coro::Task<FetchResult> fetch(
+      Fetch fetch,
+      std::shared_ptr<FetchConsumer> fetchCallback) override {
+    auto res = co_await publisher_
+                   ->fetch(
+                       std::move(fetch),
+                       std::make_shared<EvbFetchConsumer>(
+                           homeEvb_, std::move(fetchCallback)))
+                   .scheduleOn(publisherEvb_);
+    if (res.hasError()) {
+      co_return folly::makeUnexpected(res.error());
+    }
+    co_return std::make_shared<EvbFetchHandle>(
+        publisherEvb_, std::move(res.value()));
+  }
+
+ private:
+  folly::EventBase* homeEvb_;
+  std::shared_ptr<Publisher> publisher_;
+  folly::EventBase* publisherEvb_;
+};
+
+} // namespace moxygen
@@ -8,6 +8,7 @@
 
 #include "moxygen/MoQLocation.h"
 #include "moxygen/MoQSession.h"
+#include "moxygen/util/Trace.h"
 
 #include <folly/container/F14Set.h>
 #include <folly/hash/Hash.h>
@@ -32,6 +33,7 @@ class MoQForwarder : public TrackConsumer {
 
   void setLatest(AbsoluteLocation latest) {
     latest_ = latest;
+    onLiveEdgeMoved();
   }
 
   folly::Optional<AbsoluteLocation> latest() {
@@ -42,12 +44,21 @@ class MoQForwarder : public TrackConsumer {
    public:
     virtual ~Callback() = default;
     virtual void onEmpty(MoQForwarder*) = 0;
+    // A subscriber sent SUBSCRIBE_UPDATE or left, and others remain
+    virtual void onSubscribersChanged(MoQForwarder*) {}
+    // A datagram too large for a subscriber's path went on a stream
+    virtual void onDatagramStreamFallback(MoQForwarder*) {}
   };
 
   void setCallback(std::shared_ptr<Callback> callback) {
     callback_ = std::move(callback);
   }
 
+  void setTrackStatsCallback(
+      std::shared_ptr<MoQTrackStatsCallback> trackStatsCallback) {
+    trackStatsCallback_ = std::move(trackStatsCallback);
+  }
+
   struct SubgroupIdentifier {
     uint64_t group;
     uint64_t subgroup;
@@ -62,11 +73,6 @@ class MoQForwarder : public TrackConsumer {
   };
   class SubgroupForwarder;
   struct Subscriber : public Publisher::SubscriptionHandle {
-    using SubgroupConsumerMap = folly::F14FastMap<
-        SubgroupIdentifier,
-        std::shared_ptr<SubgroupConsumer>,
-        SubgroupIdentifier::hash>;
-
     Subscriber(
         MoQForwarder& f,
         SubscribeOk ok,
@@ -75,7 +81,8 @@ class MoQForwarder : public TrackConsumer {
         TrackAlias ta,
         SubscribeRange r,
         std::shared_ptr<TrackConsumer> tc,
-        bool shouldForwardIn)
+        bool shouldForwardIn,
+        uint8_t priorityIn = kDefaultPriority)
         : SubscriptionHandle(std::move(ok)),
           session(std::move(s)),
           requestID(sid),
@@ -83,7 +90,8 @@ class MoQForwarder : public TrackConsumer {
           range(r),
           trackConsumer(std::move(tc)),
           forwarder(f),
-          shouldForward(shouldForwardIn) {}
+          shouldForward(shouldForwardIn),
+          priority(priorityIn) {}
 
     // This method is for a relay to fixup the publisher group order of the
     // first subscriber if it was added before the upstream SubscribeOK.
@@ -103,11 +111,16 @@ class MoQForwarder : public TrackConsumer {
       // generate SUBSCRIBE_DONE
       range.start = subscribeUpdate.start;
       range.end = {subscribeUpdate.endGroup, 0};
+      forwarder.placeSubscriber(*this);
       shouldForward = subscribeUpdate.forward;
+      priority = subscribeUpdate.priority;
+      if (forwarder.callback_) {
+        forwarder.callback_->onSubscribersChanged(&forwarder);
+      }
     }
 
     void unsubscribe() override {
-      forwarder.removeSession(session);
+      forwarder.removeSubscriber(*this);
     }
 
     bool checkShouldForward() {
@@ -117,21 +130,103 @@ class MoQForwarder : public TrackConsumer {
       return shouldForward;
     }
 
+    bool checkResumeGroup(uint64_t group) const {
+      return group >= resumeGroup;
+    }
+
     std::shared_ptr<MoQSession> session;
     RequestID requestID;
     TrackAlias trackAlias;
     SubscribeRange range;
     std::shared_ptr<TrackConsumer> trackConsumer;
-    // Stores the SubgroupConsumer for this subscriber for all currently
-    // publishing subgroups.  Having this state here makes it easy to remove
-    // a Subscriber and all open subgroups.
-    SubgroupConsumerMap subgroups;
     MoQForwarder& forwarder;
     bool shouldForward;
+    // Subscriber priority, lower values first
+    uint8_t priority;
+    // Objects from earlier groups are not forwarded, set after the subscriber
+    // falls too far behind
+    uint64_t resumeGroup{0};
+    // Index into subscribers_, and into each SubgroupForwarder's consumers.
+    // Stable for the lifetime of the subscription.
+    size_t slot{0};
+    // The live edge is within range, see activeSlots_
+    bool active{false};
+    // Identifies this subscriber's current range in the range heaps
+    uint64_t rangeVersion{0};
   };
 
   [[nodiscard]] bool empty() const {
-    return subscribers_.empty();
+    return numSubscribers_ == 0;
+  }
+
+  // What the subscribers need from upstream taken together
+  struct Demand {
+    // Most urgent subscriber priority, none without subscribers
+    folly::Optional<uint8_t> priority;
+    // True if any subscriber wants objects forwarded
+    bool forward{false};
+  };
+  [[nodiscard]] Demand demand() const {
+    Demand demand;
+    for (const auto& sub : subscribers_) {
+      if (!sub) {
+        continue;
+      }
+      demand.priority = demand.priority
+          ? std::min(*demand.priority, sub->priority)
+          : sub->priority;
+      demand.forward |= sub->shouldForward;
+    }
+    return demand;
+  }
+
+  [[nodiscard]] size_t numSubscribers() const {
+    return numSubscribers_;
+  }
+
+  // Metrics of the subscriber session with the lowest estimated send rate,
+  // none if no session reports them.  Sessions on other EventBases are
+  // skipped.
+  [[nodiscard]] folly::Optional<MoQTransportMetrics> slowestTransport() const {
+    folly::Optional<MoQTransportMetrics> slowest;
+    for (const auto& sub : subscribers_) {
+      if (!sub || !sub->session || !onSessionThread(*sub)) {
+        continue;
+      }
+      auto metrics = sub->session->getTransportMetrics();
+      if (metrics &&
+          (!slowest ||
+           metrics->estimatedSendRateBps() < slowest->estimatedSendRateBps())) {
+        slowest = std::move(metrics);
+      }
+    }
+    return slowest;
+  }
+
+  // Whether sub's session may be used from this thread.  With a sharded
+  // relay it can belong to another EventBase.
+  static bool onSessionThread(const Subscriber& sub) {
+    auto evb = sub.session->getEventBase();
+    return !evb || evb->isInEventBaseThread();
+  }
+
+  // Bytes the subscriber sessions have queued for this track and not yet
+  // written.  With evb set, subscribers on other EventBases are skipped.
+  [[nodiscard]] uint64_t bytesBuffered(folly::EventBase* evb = nullptr) const {
+    uint64_t total = 0;
+    for (const auto& sub : subscribers_) {
+      if (!sub || !sub->session ||
+          (evb && sub->session->getEventBase() != evb)) {
+        continue;
+      }
+      total += sub->session->bytesBuffered(sub->requestID);
+    }
+    return total;
+  }
+
+  // True once the upstream has ended the track
+  [[nodiscard]] bool upstreamDone() const {
+    return upstreamDone_;
   }
 
   std::shared_ptr<MoQForwarder::Subscriber> addSubscriber(
@@ -139,6 +234,14 @@ class MoQForwarder : public TrackConsumer {
       const SubscribeRequest& subReq,
       std::shared_ptr<TrackConsumer> consumer) {
     auto sessionPtr = session.get();
+    if (sessionPtr) {
+      auto existing = sessionSlots_.find(sessionPtr);
+      if (existing != sessionSlots_.end()) {
+        // A session subscribes to a track once, the first subscription stays
+        XLOG(ERR) << "Session already subscribed to " << fullTrackName_;
+        return subscribers_[existing->second];
+      }
+    }
     auto subscriber = std::make_shared<MoQForwarder::Subscriber>(
         *this,
         SubscribeOk{
@@ -152,23 +255,37 @@ class MoQForwarder : public TrackConsumer {
         subReq.trackAlias,
         toSubscribeRange(subReq, latest_),
         std::move(consumer),
-        subReq.forward);
-    subscribers_.emplace(sessionPtr, subscriber);
+        subReq.forward,
+        subReq.priority);
+    if (freeSlots_.empty()) {
+      subscriber->slot = subscribers_.size();
+      subscribers_.emplace_back(subscriber);
+    } else {
+      subscriber->slot = freeSlots_.back();
+      freeSlots_.pop_back();
+      subscribers_[subscriber->slot] = subscriber;
+    }
+    if (sessionPtr) {
+      sessionSlots_.emplace(sessionPtr, subscriber->slot);
+    }
+    numSubscribers_++;
+    placeSubscriber(*subscriber);
     return subscriber;
   }
 
   folly::Expected<SubscribeRange, FetchError> resolveJoiningFetch(
       const std::shared_ptr<MoQSession>& session,
       const JoiningFetch& joining) const {
-    auto subIt = subscribers_.find(session.get());
-    if (subIt == subscribers_.end()) {
+    auto slotIt = sessionSlots_.find(session.get());
+    if (slotIt == sessionSlots_.end()) {
       XLOG(ERR) << "Session not found";
       return folly::makeUnexpected(FetchError{
           RequestID(0),
           FetchErrorCode::TRACK_NOT_EXIST,
           "Session has no active subscribe"});
     }
-    if (subIt->second->requestID != joining.joiningRequestID) {
+    const auto& sub = subscribers_[slotIt->second];
+    if (sub->requestID != joining.joiningRequestID) {
       XLOG(ERR) << joining.joiningRequestID
                 << " does not name a Subscribe "
                    " for this track";
@@ -177,7 +294,7 @@ class MoQForwarder : public TrackConsumer {
           FetchErrorCode::INTERNAL_ERROR,
           "Incorrect RequestID for Track"});
     }
-    if (!subIt->second->subscribeOk().latest) {
+    if (!sub->subscribeOk().latest) {
       // No content exists, fetch error
       // Relay caller verifies upstream SubscribeOK has been processed before
       // calling resolveJoiningFetch()
@@ -187,7 +304,7 @@ class MoQForwarder : public TrackConsumer {
     CHECK(
         joining.fetchType == FetchType::RELATIVE_JOINING ||
         joining.fetchType == FetchType::ABSOLUTE_JOINING);
-    auto& latest = *subIt->second->subscribeOk().latest;
+    auto& latest = *sub->subscribeOk().latest;
     if (joining.fetchType == FetchType::RELATIVE_JOINING) {
       AbsoluteLocation start{latest};
       start.group -=
@@ -204,18 +321,25 @@ class MoQForwarder : public TrackConsumer {
   void removeSession(
       const std::shared_ptr<MoQSession>& session,
       folly::Optional<SubscribeDone> subDone = folly::none) {
-    auto subIt = subscribers_.find(session.get());
-    if (subIt == subscribers_.end()) {
+    auto slotIt = sessionSlots_.find(session.get());
+    if (slotIt == sessionSlots_.end()) {
       // ?
       XLOG(ERR) << "Session not found";
       return;
     }
-    subscribeDone(*subIt->second, subDone);
-    subscribers_.erase(subIt);
-    XLOG(DBG1) << "subscribers_.size()=" << subscribers_.size();
-    if (subscribers_.empty() && callback_) {
-      callback_->onEmpty(this);
+    removeSlot(slotIt->second, std::move(subDone));
+  }
+
+  // Subscribers without a session can only be removed this way
+  void removeSubscriber(
+      const Subscriber& sub,
+      folly::Optional<SubscribeDone> subDone = folly::none) {
+    if (sub.slot >= subscribers_.size() ||
+        subscribers_[sub.slot].get() != &sub) {
+      // Already removed
+      return;
     }
+    removeSlot(sub.slot, std::move(subDone));
   }
 
   void subscribeDone(
@@ -223,8 +347,9 @@ class MoQForwarder : public TrackConsumer {
       folly::Optional<SubscribeDone> subDone) {
     // TODO: Resetting subgroups here is too aggressive
     XLOG(DBG1) << "Resetting open subgroups for subscriber=" << &subscriber;
-    for (auto& subgroup : subscriber.subgroups) {
-      subgroup.second->reset(ResetStreamErrorCode::CANCELLED);
+    for (auto& subgroup : subgroups_) {
+      subgroup.second->resetSubscriber(
+          subscriber, ResetStreamErrorCode::CANCELLED);
     }
     if (subDone) {
       subDone->requestID = subscriber.requestID;
@@ -232,46 +357,61 @@ class MoQForwarder : public TrackConsumer {
     }
   }
 
-  void forEachSubscriber(
-      std::function<void(const std::shared_ptr<Subscriber>&)> fn) {
-    for (auto subscriberIt = subscribers_.begin();
-         subscriberIt != subscribers_.end();) {
-      const auto& sub = subscriberIt->second;
-      subscriberIt++;
+  // fn may remove the subscriber it is passed, or any other subscriber.
+  template <typename Fn>
+  void forEachSubscriber(Fn&& fn) {
+    // Subscribers added by fn are not visited
+    auto numSlots = subscribers_.size();
+    for (size_t slot = 0; slot < numSlots; slot++) {
+      if (!subscribers_[slot]) {
+        continue;
+      }
+      auto sub = subscribers_[slot];
       fn(sub);
     }
   }
 
+  // Like forEachSubscriber, for the subscribers whose range holds the live
+  // edge.  fn is passed a raw pointer, subscribers removed meanwhile are
+  // retired until the iteration is over, so there is no refcounting per
+  // subscriber.
+  template <typename Fn>
+  void forEachActiveSubscriber(Fn&& fn) {
+    iterating_++;
+    auto numActive = activeSlots_.size();
+    for (size_t i = 0; i < numActive; i++) {
+      auto sub = subscribers_[activeSlots_[i]].get();
+      if (!sub || !sub->active) {
+        continue;
+      }
+      fn(sub);
+    }
+    if (--iterating_ == 0) {
+      syncActiveSlots();
+      // Destructors may re-enter the forwarder
+      auto retired = std::exchange(retired_, {});
+    }
+  }
+
+  // Keeps ptr alive until the current iteration of the active subscribers
+  // is over, or drops it now if there is none
+  void retire(std::shared_ptr<void> ptr) {
+    if (ptr && iterating_ > 0) {
+      retired_.push_back(std::move(ptr));
+    }
+  }
+
   void updateLatest(uint64_t group, uint64_t object = 0) {
     AbsoluteLocation now{group, object};
     if (!latest_ || now > *latest_) {
       latest_ = now;
+      onLiveEdgeMoved();
     }
   }
 
-  bool checkRange(const Subscriber& sub) {
-    XCHECK(latest_);
-    if (*latest_ < sub.range.start) {
-      // future
-      return false;
-    } else if (*latest_ > sub.range.end) {
-      // now past, send subscribeDone
-      // TOOD: maybe this is too early for a relay.
-      removeSession(
-          sub.session,
-          SubscribeDone{
-              sub.requestID,
-              SubscribeDoneStatusCode::SUBSCRIPTION_ENDED,
-              0, // filled in by session
-              ""});
-      return false;
-    }
-    return true;
-  }
-
   void removeSession(const Subscriber& sub, const MoQPublishError& err) {
-    removeSession(
-        sub.session,
+    removeSubscriber(
+        sub,
         SubscribeDone{
             sub.requestID,
             SubscribeDoneStatusCode::INTERNAL_ERROR,
@@ -279,6 +419,28 @@ class MoQForwarder : public TrackConsumer {
             err.what()});
   }
 
+  // A subscriber that is TOO_FAR_BEHIND has its in-flight subgroups reset and
+  // resumes at the next group, rather than being removed.  Other errors
+  // remove the subscriber.
+  void onPublishError(Subscriber& sub, const MoQPublishError& err) {
+    if (err.code == MoQPublishError::TOO_FAR_BEHIND) {
+      skipToNextGroup(sub);
+    } else {
+      removeSession(sub, err);
+    }
+  }
+
+  void skipToNextGroup(Subscriber& sub) {
+    auto nextGroup = latest_ ? latest_->group + 1 : 0;
+    XLOG(DBG1) << "Subscriber too far behind, resuming at group=" << nextGroup
+               << " subscriber=" << &sub;
+    sub.resumeGroup = std::max(sub.resumeGroup, nextGroup);
+    for (auto& subgroup : subgroups_) {
+      subgroup.second->resetSubscriber(
+          sub, ResetStreamErrorCode::DELIVERY_TIMEOUT);
+    }
+  }
+
   folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
   beginSubgroup(uint64_t groupID, uint64_t subgroupID, Priority priority)
       override {
@@ -286,19 +448,19 @@ class MoQForwarder : public TrackConsumer {
     auto subgroupForwarder = std::make_shared<SubgroupForwarder>(
         *this, groupID, subgroupID, priority);
     SubgroupIdentifier subgroupIdentifier({groupID, subgroupID});
-    forEachSubscriber([&](const std::shared_ptr<Subscriber>& sub) {
-      if (!checkRange(*sub) || !sub->checkShouldForward()) {
+    subgroups_.emplace(subgroupIdentifier, subgroupForwarder);
+    forEachActiveSubscriber([&](Subscriber* sub) {
+      if (!sub->checkShouldForward() || !sub->checkResumeGroup(groupID)) {
         return;
       }
       auto res =
           sub->trackConsumer->beginSubgroup(groupID, subgroupID, priority);
       if (res.hasError()) {
-        removeSession(*sub, res.error());
+        onPublishError(*sub, res.error());
       } else {
-        sub->subgroups[subgroupIdentifier] = res.value();
+        subgroupForwarder->setConsumer(*sub, std::move(res.value()));
       }
     });
-    subgroups_.emplace(subgroupIdentifier, subgroupForwarder);
     return subgroupForwarder;
   }
 
@@ -311,12 +473,19 @@ class MoQForwarder : public TrackConsumer {
       const ObjectHeader& header,
       Payload payload) override {
     updateLatest(header.group, header.id);
-    forEachSubscriber([&](const std::shared_ptr<Subscriber>& sub) {
-      if (!checkRange(*sub) || !sub->checkShouldForward()) {
+    MOXYGEN_TRACE_SPAN(
+        "MoQForwarder::objectStream",
+        FullTrackName::hash()(fullTrackName_),
+        header.group,
+        header.id);
+    ObjectHeaderFanoutScope fanoutScope;
+    ForwardLatencyScope latencyScope(*this);
+    forEachActiveSubscriber([&](Subscriber* sub) {
+      if (!sub->checkShouldForward() || !sub->checkResumeGroup(header.group)) {
         return;
       }
       sub->trackConsumer->objectStream(header, maybeClone(payload))
-          .onError([this, sub](const auto& err) { removeSession(*sub, err); });
+          .onError([this, sub](const auto& err) { onPublishError(*sub, err); });
     });
     return folly::unit;
   }
@@ -327,12 +496,12 @@ class MoQForwarder : public TrackConsumer {
       Priority pri,
       Extensions extensions) override {
     updateLatest(groupID, 0);
-    forEachSubscriber([&](const std::shared_ptr<Subscriber>& sub) {
-      if (!checkRange(*sub) || !sub->checkShouldForward()) {
+    forEachActiveSubscriber([&](Subscriber* sub) {
+      if (!sub->checkShouldForward() || !sub->checkResumeGroup(groupID)) {
         return;
       }
       sub->trackConsumer->groupNotExists(groupID, subgroup, pri, extensions)
-          .onError([this, sub](const auto& err) { removeSession(*sub, err); });
+          .onError([this, sub](const auto& err) { onPublishError(*sub, err); });
     });
     return folly::unit;
   }
@@ -341,65 +510,102 @@ class MoQForwarder : public TrackConsumer {
       const ObjectHeader& header,
       Payload payload) override {
     updateLatest(header.group, header.id);
-    forEachSubscriber([&](const std::shared_ptr<Subscriber>& sub) {
-      if (!checkRange(*sub) || !sub->checkShouldForward()) {
+    MOXYGEN_TRACE_SPAN(
+        "MoQForwarder::datagram",
+        FullTrackName::hash()(fullTrackName_),
+        header.group,
+        header.id);
+    ForwardLatencyScope latencyScope(*this);
+    auto size = (header.status == ObjectStatus::NORMAL && payload)
+        ? maxDatagramHeaderSize(header) + payload->computeChainDataLength()
+        : 0;
+    forEachActiveSubscriber([&](Subscriber* sub) {
+      if (!sub->checkShouldForward() || !sub->checkResumeGroup(header.group)) {
         return;
       }
+      // A session on another shard drops what it can't send itself
+      if (size > 0 && sub->session && onSessionThread(*sub)) {
+        auto maxSize = sub->session->getMaxDatagramSize();
+        if (maxSize > 0 && size > maxSize) {
+          datagramOnStream(*sub, header, maybeClone(payload));
+          return;
+        }
+      }
       sub->trackConsumer->datagram(header, maybeClone(payload))
-          .onError([this, sub](const auto& err) { removeSession(*sub, err); });
+          .onError([this, sub](const auto& err) { onPublishError(*sub, err); });
     });
     return folly::unit;
   }
 
   folly::Expected<folly::Unit, MoQPublishError> subscribeDone(
       SubscribeDone subDone) override {
+    upstreamDone_ = true;
+    if (numSubscribers_ == 0 && callback_) {
+      // Nobody to tell, but the callback may be keeping the track around
+      callback_->onEmpty(this);
+      return folly::unit;
+    }
     forEachSubscriber([&](const std::shared_ptr<Subscriber>& sub) {
-      removeSession(sub->session, subDone);
+      removeSubscriber(*sub, subDone);
     });
     return folly::unit;
   }
 
-  class SubgroupForwarder : public SubgroupConsumer {
+  class SubgroupForwarder final : public SubgroupConsumer {
     folly::Optional<uint64_t> currentObjectLength_;
     MoQForwarder& forwarder_;
     SubgroupIdentifier identifier_;
     Priority priority_;
+    // Downstream consumer for this subgroup, indexed by Subscriber::slot
+    std::vector<std::shared_ptr<SubgroupConsumer>> consumers_;
 
-    void forEachSubscriberSubgroup(
-        std::function<void(
-            const std::shared_ptr<Subscriber>& sub,
-            const std::shared_ptr<SubgroupConsumer>&)> fn) {
-      forwarder_.forEachSubscriber([&](const std::shared_ptr<Subscriber>& sub) {
-        if (forwarder_.latest_ && forwarder_.checkRange(*sub)) {
-          auto subgroupConsumerIt = sub->subgroups.find(identifier_);
-          if (subgroupConsumerIt == sub->subgroups.end()) {
-            if (!sub->checkShouldForward()) {
-              // If shouldForward == false, we shouldn't be creating any
-              // subgroups.
-              return;
-            }
-            auto res = sub->trackConsumer->beginSubgroup(
-                identifier_.group, identifier_.subgroup, priority_);
-            if (res.hasError()) {
-              forwarder_.removeSession(*sub, res.error());
-            } else {
-              auto emplaceRes =
-                  sub->subgroups.emplace(identifier_, res.value());
-              subgroupConsumerIt = emplaceRes.first;
-            }
-          }
+    std::shared_ptr<SubgroupConsumer>* findConsumer(const Subscriber& sub) {
+      return (sub.slot < consumers_.size() && consumers_[sub.slot])
+          ? &consumers_[sub.slot]
+          : nullptr;
+    }
+
+    void closeSubscriber(const Subscriber& sub) {
+      if (sub.slot < consumers_.size()) {
+        forwarder_.retire(std::move(consumers_[sub.slot]));
+      }
+    }
+
+    // fn is passed the subscriber and its consumer for this subgroup
+    template <typename Fn>
+    void forEachSubscriberSubgroup(Fn&& fn) {
+      forwarder_.forEachActiveSubscriber([&](const auto& sub) {
+        if (!sub->checkResumeGroup(identifier_.group)) {
+          return;
+        }
+        auto consumer = findConsumer(*sub);
+        if (!consumer) {
           if (!sub->checkShouldForward()) {
-            // If we're attempting to send anything on an existing subgroup when
-            // forward == false, then we reset the stream, so that we don't end
-            // up with "holes" in the subgroup. If, at some point in the future,
-            // we set forward = true, then we'll create a new stream for the
-            // subgroup.
-            subgroupConsumerIt->second->reset(
-                ResetStreamErrorCode::INTERNAL_ERROR);
-            sub->subgroups.erase(identifier_);
-          } else {
-            fn(sub, subgroupConsumerIt->second);
+            // If shouldForward == false, we shouldn't be creating any
+            // subgroups.
+            return;
+          }
+          auto res = sub->trackConsumer->beginSubgroup(
+              identifier_.group, identifier_.subgroup, priority_);
+          if (res.hasError()) {
+            forwarder_.onPublishError(*sub, res.error());
+            return;
           }
+          setConsumer(*sub, std::move(res.value()));
+          consumer = &consumers_[sub->slot];
+        }
+        if (!sub->checkShouldForward()) {
+          // If we're attempting to send anything on an existing subgroup when
+          // forward == false, then we reset the stream, so that we don't end
+          // up with "holes" in the subgroup. If, at some point in the future,
+          // we set forward = true, then we'll create a new stream for the
+          // subgroup.
+          auto subgroupConsumer = std::move(*consumer);
+          subgroupConsumer->reset(ResetStreamErrorCode::INTERNAL_ERROR);
+          forwarder_.retire(std::move(subgroupConsumer));
+        } else {
+          // fn may remove the subscriber, which retires its consumer
+          fn(sub, consumer->get());
         }
       });
     }
@@ -414,6 +620,25 @@ class MoQForwarder : public TrackConsumer {
           identifier_{group, subgroup},
           priority_(priority) {}
 
+    void setConsumer(
+        const Subscriber& sub,
+        std::shared_ptr<SubgroupConsumer> consumer) {
+      if (sub.slot >= consumers_.size()) {
+        consumers_.resize(sub.slot + 1);
+      }
+      consumers_[sub.slot] = std::move(consumer);
+    }
+
+    // Resets and forgets the subscriber's consumer for this subgroup, if any
+    void resetSubscriber(const Subscriber& sub, ResetStreamErrorCode error) {
+      auto consumer = findConsumer(sub);
+      if (consumer) {
+        auto subgroupConsumer = std::move(*consumer);
+        subgroupConsumer->reset(error);
+        forwarder_.retire(std::move(subgroupConsumer));
+      }
+    }
+
     folly::Expected<folly::Unit, MoQPublishError> object(
         uint64_t objectID,
         Payload payload,
@@ -424,16 +649,65 @@ class MoQForwarder : public TrackConsumer {
             MoQPublishError::API_ERROR, "Still publishing previous object"));
       }
       forwarder_.updateLatest(identifier_.group, objectID);
+      MOXYGEN_TRACE_SPAN(
+          "MoQForwarder::object",
+          FullTrackName::hash()(forwarder_.fullTrackName_),
+          identifier_.group,
+          objectID);
+      ObjectHeaderFanoutScope fanoutScope;
+      ForwardLatencyScope latencyScope(forwarder_);
       forEachSubscriberSubgroup(
-          [&](const std::shared_ptr<Subscriber>& sub,
-              const std::shared_ptr<SubgroupConsumer>& subgroupConsumer) {
+          [&](Subscriber* sub, SubgroupConsumer* subgroupConsumer) {
             subgroupConsumer
                 ->object(objectID, maybeClone(payload), extensions, finSubgroup)
                 .onError([this, sub](const auto& err) {
-                  forwarder_.removeSession(*sub, err);
+                  forwarder_.onPublishError(*sub, err);
                 });
             if (finSubgroup) {
-              sub->subgroups.erase(identifier_);
+              closeSubscriber(*sub);
+            }
+          });
+      if (finSubgroup) {
+        forwarder_.subgroups_.erase(identifier_);
+      }
+      return folly::unit;
+    }
+
+    folly::Expected<folly::Unit, MoQPublishError> objects(
+        std::span<SubgroupObject> batch,
+        bool finSubgroup) override {
+      if (currentObjectLength_) {
+        return folly::makeUnexpected(MoQPublishError(
+            MoQPublishError::API_ERROR, "Still publishing previous object"));
+      }
+      if (batch.empty()) {
+        if (finSubgroup) {
+          return endOfSubgroup();
+        }
+        return folly::unit;
+      }
+      forwarder_.updateLatest(identifier_.group, batch.back().objectID);
+      MOXYGEN_TRACE_SPAN(
+          "MoQForwarder::objects",
+          FullTrackName::hash()(forwarder_.fullTrackName_),
+          identifier_.group,
+          batch.front().objectID);
+      ObjectHeaderFanoutScope fanoutScope;
+      ForwardLatencyScope latencyScope(forwarder_);
+      std::vector<SubgroupObject> copy;
+      forEachSubscriberSubgroup(
+          [&](Subscriber* sub, SubgroupConsumer* subgroupConsumer) {
+            copy.clear();
+            for (const auto& obj : batch) {
+              copy.push_back(
+                  {obj.objectID, maybeClone(obj.payload), obj.extensions});
+            }
+            subgroupConsumer->objects(copy, finSubgroup)
+                .onError([this, sub](const auto& err) {
+                  forwarder_.onPublishError(*sub, err);
+                });
+            if (finSubgroup) {
+              closeSubscriber(*sub);
             }
           });
       if (finSubgroup) {
@@ -451,15 +725,15 @@ class MoQForwarder : public TrackConsumer {
             MoQPublishError::API_ERROR, "Still publishing previous object"));
       }
       forwarder_.updateLatest(identifier_.group, objectID);
+      ObjectHeaderFanoutScope fanoutScope;
       forEachSubscriberSubgroup(
-          [&](const std::shared_ptr<Subscriber>& sub,
-              const std::shared_ptr<SubgroupConsumer>& subgroupConsumer) {
+          [&](Subscriber* sub, SubgroupConsumer* subgroupConsumer) {
             subgroupConsumer->objectNotExists(objectID, extensions, finSubgroup)
                 .onError([this, sub](const auto& err) {
-                  forwarder_.removeSession(*sub, err);
+                  forwarder_.onPublishError(*sub, err);
                 });
             if (finSubgroup) {
-              sub->subgroups.erase(identifier_);
+              closeSubscriber(*sub);
             }
           });
       if (finSubgroup) {
@@ -484,14 +758,19 @@ class MoQForwarder : public TrackConsumer {
       if (length > payloadLength) {
         currentObjectLength_ = length - payloadLength;
       }
+      MOXYGEN_TRACE_SPAN(
+          "MoQForwarder::beginObject",
+          FullTrackName::hash()(forwarder_.fullTrackName_),
+          identifier_.group,
+          objectID);
+      ObjectHeaderFanoutScope fanoutScope;
       forEachSubscriberSubgroup(
-          [&](const std::shared_ptr<Subscriber>& sub,
-              const std::shared_ptr<SubgroupConsumer>& subgroupConsumer) {
+          [&](Subscriber* sub, SubgroupConsumer* subgroupConsumer) {
             subgroupConsumer
                 ->beginObject(
                     objectID, length, maybeClone(initialPayload), extensions)
                 .onError([this, sub](const auto& err) {
-                  forwarder_.removeSession(*sub, err);
+                  forwarder_.onPublishError(*sub, err);
                 });
           });
       return folly::unit;
@@ -505,14 +784,14 @@ class MoQForwarder : public TrackConsumer {
             MoQPublishError::API_ERROR, "Still publishing previous object"));
       }
       forwarder_.updateLatest(identifier_.group, endOfGroupObjectID);
+      ObjectHeaderFanoutScope fanoutScope;
       forEachSubscriberSubgroup(
-          [&](const std::shared_ptr<Subscriber>& sub,
-              const std::shared_ptr<SubgroupConsumer>& subgroupConsumer) {
+          [&](Subscriber* sub, SubgroupConsumer* subgroupConsumer) {
             subgroupConsumer->endOfGroup(endOfGroupObjectID, extensions)
                 .onError([this, sub](const auto& err) {
-                  forwarder_.removeSession(*sub, err);
+                  forwarder_.onPublishError(*sub, err);
                 });
-            sub->subgroups.erase(identifier_);
+            closeSubscriber(*sub);
           });
       forwarder_.subgroups_.erase(identifier_);
       return folly::unit;
@@ -526,14 +805,14 @@ class MoQForwarder : public TrackConsumer {
             MoQPublishError::API_ERROR, "Still publishing previous object"));
       }
       forwarder_.updateLatest(identifier_.group, endOfTrackObjectID);
+      ObjectHeaderFanoutScope fanoutScope;
       forEachSubscriberSubgroup(
-          [&](const std::shared_ptr<Subscriber>& sub,
-              const std::shared_ptr<SubgroupConsumer>& subgroupConsumer) {
+          [&](Subscriber* sub, SubgroupConsumer* subgroupConsumer) {
             subgroupConsumer->endOfTrackAndGroup(endOfTrackObjectID, extensions)
                 .onError([this, sub](const auto& err) {
-                  forwarder_.removeSession(*sub, err);
+                  forwarder_.onPublishError(*sub, err);
                 });
-            sub->subgroups.erase(identifier_);
+            closeSubscriber(*sub);
           });
       forwarder_.subgroups_.erase(identifier_);
       return folly::unit;
@@ -545,13 +824,12 @@ class MoQForwarder : public TrackConsumer {
             MoQPublishError::API_ERROR, "Still publishing previous object"));
       }
       forEachSubscriberSubgroup(
-          [&](const std::shared_ptr<Subscriber>& sub,
-              const std::shared_ptr<SubgroupConsumer>& subgroupConsumer) {
+          [&](Subscriber* sub, SubgroupConsumer* subgroupConsumer) {
             subgroupConsumer->endOfSubgroup().onError(
                 [this, sub](const auto& err) {
-                  forwarder_.removeSession(*sub, err);
+                  forwarder_.onPublishError(*sub, err);
                 });
-            sub->subgroups.erase(identifier_);
+            closeSubscriber(*sub);
           });
       forwarder_.subgroups_.erase(identifier_);
       return folly::unit;
@@ -559,10 +837,9 @@ class MoQForwarder : public TrackConsumer {
 
     void reset(ResetStreamErrorCode error) override {
       forEachSubscriberSubgroup(
-          [&](const std::shared_ptr<Subscriber>& sub,
-              const std::shared_ptr<SubgroupConsumer>& subgroupConsumer) {
+          [&](Subscriber* sub, SubgroupConsumer* subgroupConsumer) {
             subgroupConsumer->reset(error);
-            sub->subgroups.erase(identifier_);
+            closeSubscriber(*sub);
           });
       forwarder_.subgroups_.erase(identifier_);
     }
@@ -581,14 +858,13 @@ class MoQForwarder : public TrackConsumer {
       }
       *currentObjectLength_ -= payloadLength;
       forEachSubscriberSubgroup(
-          [&](const std::shared_ptr<Subscriber>& sub,
-              const std::shared_ptr<SubgroupConsumer>& subgroupConsumer) {
+          [&](Subscriber* sub, SubgroupConsumer* subgroupConsumer) {
             subgroupConsumer->objectPayload(maybeClone(payload), finSubgroup)
                 .onError([this, sub](const auto& err) {
-                  forwarder_.removeSession(*sub, err);
+                  forwarder_.onPublishError(*sub, err);
                 });
             if (finSubgroup) {
-              sub->subgroups.erase(identifier_);
+              closeSubscriber(*sub);
             }
           });
       if (*currentObjectLength_ == 0) {
@@ -603,12 +879,246 @@ class MoQForwarder : public TrackConsumer {
   };
 
  private:
+  void removeSlot(size_t slot, folly::Optional<SubscribeDone> subDone) {
+    // Keep the subscriber alive until it has been fully torn down
+    auto subscriber = std::move(subscribers_[slot]);
+    if (subscriber->session) {
+      sessionSlots_.erase(subscriber->session.get());
+    }
+    deactivate(*subscriber);
+    subscriber->rangeVersion = 0;
+    freeSlots_.push_back(slot);
+    numSubscribers_--;
+    subscribeDone(*subscriber, subDone);
+    retire(std::move(subscriber));
+    XLOG(DBG1) << "subscribers_.size()=" << numSubscribers_;
+    if (!callback_) {
+      return;
+    }
+    if (numSubscribers_ == 0) {
+      callback_->onEmpty(this);
+    } else if (!upstreamDone_) {
+      callback_->onSubscribersChanged(this);
+    }
+  }
+
   static Payload maybeClone(const Payload& payload) {
     return payload ? payload->clone() : nullptr;
   }
 
+  // Bounds the encoded datagram header: type, track alias, group, object
+  // and priority, then the extensions
+  static uint64_t maxDatagramHeaderSize(const ObjectHeader& header) {
+    constexpr uint64_t kMaxVarint = 8;
+    uint64_t size = 1 + 3 * kMaxVarint + 1 + kMaxVarint;
+    for (const auto& ext : header.extensions) {
+      size += 2 * kMaxVarint +
+          (ext.arrayValue ? ext.arrayValue->computeChainDataLength() : 0);
+    }
+    return size;
+  }
+
+  // Sends an object too large for the subscriber's path on a subgroup
+  // stream of its own.  As for datagrams, the subgroup is the object ID.
+  void datagramOnStream(
+      Subscriber& sub,
+      const ObjectHeader& header,
+      Payload payload) {
+    if (callback_) {
+      callback_->onDatagramStreamFallback(this);
+    }
+    auto subgroup = sub.trackConsumer->beginSubgroup(
+        header.group, header.id, header.priority);
+    if (subgroup.hasError()) {
+      onPublishError(sub, subgroup.error());
+      return;
+    }
+    subgroup.value()
+        ->object(header.id, std::move(payload), header.extensions, true)
+        .onError([this, &sub](const auto& err) { onPublishError(sub, err); });
+  }
+
+  // Where the live edge crosses a subscriber's range start or end
+  struct RangeEvent {
+    AbsoluteLocation at;
+    size_t slot;
+    uint64_t version;
+    bool operator>(const RangeEvent& other) const {
+      return other.at < at;
+    }
+  };
+  using RangeHeap = std::vector<RangeEvent>;
+
+  static void pushEvent(RangeHeap& heap, RangeEvent event) {
+    heap.push_back(event);
+    std::push_heap(heap.begin(), heap.end(), std::greater<>());
+  }
+
+  static RangeEvent popEvent(RangeHeap& heap) {
+    std::pop_heap(heap.begin(), heap.end(), std::greater<>());
+    auto event = heap.back();
+    heap.pop_back();
+    return event;
+  }
+
+  // The subscriber event was queued for, if its range hasn't changed since
+  Subscriber* eventSubscriber(const RangeEvent& event) const {
+    auto& sub = subscribers_[event.slot];
+    return (sub && sub->rangeVersion == event.version) ? sub.get() : nullptr;
+  }
+
+  // Drops events for departed subscribers and old ranges once they
+  // outnumber the live ones
+  void pruneEvents(RangeHeap& heap) {
+    if (heap.size() <= 2 * numSubscribers_ + kMinPrunedEvents) {
+      return;
+    }
+    std::erase_if(
+        heap, [this](const auto& event) { return !eventSubscriber(event); });
+    std::make_heap(heap.begin(), heap.end(), std::greater<>());
+  }
+
+  // Activates sub if the live edge is in its range, otherwise waits for it to
+  // reach the start.  Passing the end is left to onLiveEdgeMoved.
+  void placeSubscriber(Subscriber& sub) {
+    sub.rangeVersion = ++nextRangeVersion_;
+    if (!latest_ || *latest_ < sub.range.start) {
+      deactivate(sub);
+      pushEvent(pendingStarts_, {sub.range.start, sub.slot, sub.rangeVersion});
+      pruneEvents(pendingStarts_);
+    } else {
+      activate(sub);
+    }
+  }
+
+  void activate(Subscriber& sub) {
+    if (sub.range.end != kLocationMax) {
+      pushEvent(pendingEnds_, {sub.range.end, sub.slot, sub.rangeVersion});
+      pruneEvents(pendingEnds_);
+    }
+    if (sub.active) {
+      return;
+    }
+    sub.active = true;
+    if (iterating_ > 0) {
+      deferredActivations_.push_back(sub.slot);
+      return;
+    }
+    insertActiveSlot(sub.slot);
+  }
+
+  void deactivate(Subscriber& sub) {
+    if (!sub.active) {
+      return;
+    }
+    sub.active = false;
+    if (iterating_ > 0) {
+      // Skipped until the iteration is over
+      activeSlotsChanged_ = true;
+      return;
+    }
+    auto it =
+        std::lower_bound(activeSlots_.begin(), activeSlots_.end(), sub.slot);
+    if (it != activeSlots_.end() && *it == sub.slot) {
+      activeSlots_.erase(it);
+    }
+  }
+
+  void insertActiveSlot(size_t slot) {
+    auto it = std::lower_bound(activeSlots_.begin(), activeSlots_.end(), slot);
+    if (it == activeSlots_.end() || *it != slot) {
+      activeSlots_.insert(it, slot);
+    }
+  }
+
+  // Applies the changes made while iterating the active subscribers
+  void syncActiveSlots() {
+    if (activeSlotsChanged_) {
+      activeSlotsChanged_ = false;
+      std::erase_if(activeSlots_, [this](size_t slot) {
+        return !subscribers_[slot] || !subscribers_[slot]->active;
+      });
+    }
+    for (auto slot : std::exchange(deferredActivations_, {})) {
+      if (subscribers_[slot] && subscribers_[slot]->active) {
+        insertActiveSlot(slot);
+      }
+    }
+  }
+
+  // Activates the subscribers whose start the live edge reached, and ends
+  // those whose end it passed
+  void onLiveEdgeMoved() {
+    while (!pendingStarts_.empty() && !(*latest_ < pendingStarts_[0].at)) {
+      auto event = popEvent(pendingStarts_);
+      if (auto sub = eventSubscriber(event)) {
+        activate(*sub);
+      }
+    }
+    std::vector<std::shared_ptr<Subscriber>> ended;
+    while (!pendingEnds_.empty() && *latest_ > pendingEnds_[0].at) {
+      auto event = popEvent(pendingEnds_);
+      if (eventSubscriber(event)) {
+        ended.push_back(subscribers_[event.slot]);
+      }
+    }
+    for (const auto& sub : ended) {
+      // TOOD: maybe this is too early for a relay.
+      removeSubscriber(
+          *sub,
+          SubscribeDone{
+              sub->requestID,
+              SubscribeDoneStatusCode::SUBSCRIPTION_ENDED,
+              0, // filled in by session
+              ""});
+    }
+  }
+
+  // Reports the time taken to fan one object out to every subscriber
+  class ForwardLatencyScope {
+   public:
+    explicit ForwardLatencyScope(const MoQForwarder& forwarder)
+        : forwarder_(forwarder) {
+      if (forwarder_.trackStatsCallback_) {
+        start_ = std::chrono::steady_clock::now();
+      }
+    }
+
+    ~ForwardLatencyScope() {
+      if (forwarder_.trackStatsCallback_) {
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_);
+        forwarder_.trackStatsCallback_->recordForwardLatency(
+            forwarder_.fullTrackName_, latency.count());
+      }
+    }
+
+   private:
+    const MoQForwarder& forwarder_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
   FullTrackName fullTrackName_;
-  folly::F14FastMap<MoQSession*, std::shared_ptr<Subscriber>> subscribers_;
+  // Dense by slot, with nullptr for free slots.  Fan-out walks this vector.
+  std::vector<std::shared_ptr<Subscriber>> subscribers_;
+  std::vector<size_t> freeSlots_;
+  // Slots of the active subscribers in order, the only ones published to
+  std::vector<size_t> activeSlots_;
+  // Changes to activeSlots_ wait while it is being iterated
+  size_t iterating_{0};
+  bool activeSlotsChanged_{false};
+  std::vector<size_t> deferredActivations_;
+  // Subscribers and subgroup consumers removed while iterating
+  std::vector<std::shared_ptr<void>> retired_;
+  // Min-heaps of range starts of inactive subscribers, and range ends of
+  // active ones.  Events whose version no longer matches are skipped.
+  RangeHeap pendingStarts_;
+  RangeHeap pendingEnds_;
+  uint64_t nextRangeVersion_{0};
+  static constexpr size_t kMinPrunedEvents = 16;
+  folly::F14FastMap<MoQSession*, size_t> sessionSlots_;
+  size_t numSubscribers_{0};
+  bool upstreamDone_{false};
   folly::F14FastMap<
       SubgroupIdentifier,
       std::shared_ptr<SubgroupForwarder>,
@@ -617,6 +1127,7 @@ class MoQForwarder : public TrackConsumer {
   GroupOrder groupOrder_{GroupOrder::OldestFirst};
   folly::Optional<AbsoluteLocation> latest_;
   std::shared_ptr<Callback> callback_;
+  std::shared_ptr<MoQTrackStatsCallback> trackStatsCallback_;
 };
 
 } // namespace moxygen
@@ -6,8 +6,15 @@
 
 #include "moxygen/relay/MoQRelay.h"
 
+#include <folly/coro/Collect.h>
+#include <folly/coro/Invoke.h>
+#include <folly/coro/Sleep.h>
+
+#include <sstream>
+
 namespace {
 constexpr uint8_t kDefaultUpstreamPriority = 128;
+constexpr uint8_t kMaxPriority = 255;
 }
 
 namespace moxygen {
@@ -15,32 +22,108 @@ namespace moxygen {
 std::shared_ptr<MoQRelay::AnnounceNode> MoQRelay::findNamespaceNode(
     const TrackNamespace& ns,
     bool createMissingNodes,
-    std::vector<std::shared_ptr<MoQSession>>* sessions) {
+    std::vector<std::shared_ptr<MoQSession>>* sessions,
+    std::vector<AnnounceNode*>* path) {
   std::shared_ptr<AnnounceNode> nodePtr(
       std::shared_ptr<void>(), &announceRoot_);
-  for (auto i = 0ul; i < ns.size(); i++) {
+  size_t i = 0;
+  while (i < ns.size()) {
     if (sessions) {
       sessions->insert(
           sessions->end(), nodePtr->sessions.begin(), nodePtr->sessions.end());
     }
-    auto& name = ns[i];
-    auto it = nodePtr->children.find(name);
+    if (path) {
+      path->push_back(nodePtr.get());
+    }
+    auto it = nodePtr->children.find(ns[i]);
     if (it == nodePtr->children.end()) {
-      if (createMissingNodes) {
-        auto node = std::make_shared<AnnounceNode>(*this);
-        nodePtr->children.emplace(name, node);
-        nodePtr = std::move(node);
-      } else {
+      if (!createMissingNodes) {
         XLOG(ERR) << "prefix not found in announce tree";
         return nullptr;
       }
-    } else {
-      nodePtr = it->second;
+      // One node for the whole remainder of ns
+      auto node = std::make_shared<AnnounceNode>(*this);
+      node->label.assign(ns.elements().begin() + i, ns.elements().end());
+      nodePtr->children.emplace(ns[i], node);
+      return node;
+    }
+    auto& child = it->second;
+    size_t matched = 1;
+    while (matched < child->label.size() && i + matched < ns.size() &&
+           child->label[matched] == ns[i + matched]) {
+      matched++;
     }
+    if (matched < child->label.size()) {
+      // ns ends or diverges inside the edge
+      if (!createMissingNodes) {
+        XLOG(ERR) << "prefix not found in announce tree";
+        return nullptr;
+      }
+      auto split = std::make_shared<AnnounceNode>(*this);
+      split->label.assign(
+          std::make_move_iterator(child->label.begin()),
+          std::make_move_iterator(child->label.begin() + matched));
+      child->label.erase(child->label.begin(), child->label.begin() + matched);
+      auto key = child->label.front();
+      split->children.emplace(std::move(key), std::move(child));
+      child = std::move(split);
+    }
+    nodePtr = child;
+    i += matched;
+  }
+  if (path) {
+    path->push_back(nodePtr.get());
   }
   return nodePtr;
 }
 
+void MoQRelay::AnnounceNode::pruneChild(const std::string& key) {
+  auto it = children.find(key);
+  if (it == children.end() || !it->second->isIdle()) {
+    return;
+  }
+  auto& child = it->second;
+  if (child->children.empty()) {
+    children.erase(it);
+  } else if (child->children.size() == 1) {
+    auto grandchild = std::move(child->children.begin()->second);
+    grandchild->label.insert(
+        grandchild->label.begin(),
+        std::make_move_iterator(child->label.begin()),
+        std::make_move_iterator(child->label.end()));
+    child = std::move(grandchild);
+  }
+}
+
+void MoQRelay::pruneNamespace(const TrackNamespace& ns) {
+  std::vector<AnnounceNode*> path;
+  if (!findNamespaceNode(ns, /*createMissingNodes=*/false, nullptr, &path)) {
+    return;
+  }
+  // Stop at the first node that is still needed, or was merged into its child
+  for (auto j = path.size() - 1; j > 0; j--) {
+    auto parent = path[j - 1];
+    auto key = path[j]->label.front();
+    auto numChildren = parent->children.size();
+    parent->pruneChild(key);
+    if (parent->children.size() == numChildren) {
+      break;
+    }
+  }
+}
+
+void MoQRelay::pruneAnnounceTree(AnnounceNode& node) {
+  std::vector<std::string> keys;
+  keys.reserve(node.children.size());
+  for (auto& child : node.children) {
+    pruneAnnounceTree(*child.second);
+    keys.push_back(child.first);
+  }
+  for (const auto& key : keys) {
+    node.pruneChild(key);
+  }
+}
+
 folly::coro::Task<Subscriber::AnnounceResult> MoQRelay::announce(
     Announce ann,
     std::shared_ptr<Subscriber::AnnounceCallback>) {
@@ -53,43 +136,97 @@ folly::coro::Task<Subscriber::AnnounceResult> MoQRelay::announce(
         AnnounceErrorCode::UNINTERESTED,
         "bad namespace"});
   }
+  // Its tracks may exist now
+  invalidateNegative(ann.trackNamespace);
   std::vector<std::shared_ptr<MoQSession>> sessions;
   auto nodePtr = findNamespaceNode(
       ann.trackNamespace, /*createMissingNodes=*/true, &sessions);
 
   // TODO: store auth for forwarding on future SubscribeAnnounces?
   auto session = MoQSession::getRequestSession();
-  nodePtr->sourceSession = std::move(session);
+  bool newlyAnnounced = !nodePtr->sourceSession;
+  std::erase(nodePtr->standbySources, session);
+  if (nodePtr->sourceSession && nodePtr->sourceSession != session) {
+    // The newest announcer is used, the earlier one stands by
+    nodePtr->standbySources.push_back(std::move(nodePtr->sourceSession));
+  }
+  nodePtr->sourceSession = session;
   nodePtr->setAnnounceOk({ann.requestID, ann.trackNamespace});
-  for (auto& outSession : sessions) {
-    if (outSession != session) {
-      auto evb = outSession->getEventBase();
-      announceToSession(outSession, ann, nodePtr).scheduleOn(evb).start();
+  if (newlyAnnounced) {
+    for (auto& outSession : sessions) {
+      if (outSession != session) {
+        queueAnnounce(outSession, ann, nodePtr);
+      }
+    }
+  } else if (hotStandbyPrefix_) {
+    // Tracks already subscribed in the namespace can use the new announcer
+    for (const auto& subscription : subscriptions_) {
+      if (subscription.first.trackNamespace == ann.trackNamespace) {
+        startStandby(subscription.first);
+      }
     }
   }
-  co_return nodePtr;
+  if (newlyAnnounced && !pins_.empty()) {
+    pinAnnounced(ann.trackNamespace, relayEvb(session));
+  }
+  co_return std::make_shared<AnnounceSource>(
+      nodePtr, session, AnnounceOk{ann.requestID, ann.trackNamespace});
 }
 
-folly::coro::Task<void> MoQRelay::announceToSession(
-    std::shared_ptr<MoQSession> session,
+void MoQRelay::queueAnnounce(
+    const std::shared_ptr<MoQSession>& session,
     Announce ann,
     std::shared_ptr<AnnounceNode> nodePtr) {
-  auto announceHandle = co_await session->announce(ann);
-  if (announceHandle.hasError()) {
-    XLOG(ERR) << "Announce failed err=" << announceHandle.error().reasonPhrase;
-  } else {
-    // This can race with unsubscribeAnnounces
-    nodePtr->announcements[session] = std::move(announceHandle.value());
+  auto& queue = announceQueues_[session.get()];
+  if (!queue) {
+    queue = std::make_shared<MoQAnnounceQueue>(
+        session, relayEvb(session), session->getEventBase());
+  }
+  queue->push(
+      std::move(ann),
+      [nodePtr, target = session.get()] {
+        return nodePtr->sourceSession &&
+            nodePtr->sourceSession.get() != target;
+      },
+      [nodePtr, session](std::shared_ptr<Subscriber::AnnounceHandle> handle) {
+        nodePtr->announcements[session] = std::move(handle);
+      });
+}
+
+bool MoQRelay::removeAnnounceSource(
+    AnnounceNode& node,
+    const std::shared_ptr<MoQSession>& session) {
+  std::erase(node.standbySources, session);
+  if (!session || node.sourceSession != session) {
+    return false;
+  }
+  if (!node.standbySources.empty()) {
+    XLOG(INFO) << "Standby announcer takes over ns="
+               << node.announceOk().trackNamespace;
+    node.sourceSession = std::move(node.standbySources.back());
+    node.standbySources.pop_back();
+    return false;
   }
+  node.sourceSession = nullptr;
+  return true;
 }
 
-void MoQRelay::unannounce(const TrackNamespace& trackNamespace, AnnounceNode*) {
+void MoQRelay::unannounce(
+    const TrackNamespace& trackNamespace,
+    AnnounceNode* node,
+    const std::shared_ptr<MoQSession>& session) {
   XLOG(DBG1) << __func__ << " ns=" << trackNamespace;
-  // Node would be useful if there were back links
   auto nodePtr =
       findNamespaceNode(trackNamespace, /*createMissingNodes=*/false, nullptr);
-  XCHECK(nodePtr);
-  nodePtr->sourceSession = nullptr;
+  if (!nodePtr || nodePtr.get() != node) {
+    // The node was pruned after an earlier unannounce
+    XLOG(ERR) << "Unannounce for a namespace no longer in the tree";
+    return;
+  }
+  if (!removeAnnounceSource(*nodePtr, session)) {
+    // Still announced by another session
+    return;
+  }
   for (auto& announcement : nodePtr->announcements) {
     auto evb = announcement.first->getEventBase();
     evb->runInEventBaseThread([announceHandle = announcement.second] {
@@ -97,9 +234,36 @@ void MoQRelay::unannounce(const TrackNamespace& trackNamespace, AnnounceNode*) {
     });
   }
   nodePtr->announcements.clear();
-  // TODO: prune Announce tree
+  nodePtr.reset();
+  pruneNamespace(trackNamespace);
 }
 
+// Held by each announcing session, so unannouncing only removes that session
+// from the namespace's sources
+class MoQRelay::AnnounceSource : public Subscriber::AnnounceHandle {
+ public:
+  AnnounceSource(
+      std::shared_ptr<AnnounceNode> node,
+      std::shared_ptr<MoQSession> session,
+      AnnounceOk ok)
+      : Subscriber::AnnounceHandle(std::move(ok)),
+        node_(std::move(node)),
+        session_(std::move(session)) {}
+
+  void unannounce() override {
+    if (node_) {
+      node_->relay_.unannounce(
+          announceOk().trackNamespace, node_.get(), session_);
+      node_.reset();
+      session_.reset();
+    }
+  }
+
+ private:
+  std::shared_ptr<AnnounceNode> node_;
+  std::shared_ptr<MoQSession> session_;
+};
+
 class MoQRelay::AnnouncesSubscription
     : public Publisher::SubscribeAnnouncesHandle {
  public:
@@ -143,19 +307,18 @@ MoQRelay::subscribeAnnounces(SubscribeAnnounces subNs) {
   // Find all nested Announcements and forward
   std::deque<std::tuple<TrackNamespace, std::shared_ptr<AnnounceNode>>> nodes{
       {subNs.trackNamespacePrefix, nodePtr}};
-  auto evb = session->getEventBase();
   while (!nodes.empty()) {
     auto [prefix, nodePtr] = std::move(*nodes.begin());
     nodes.pop_front();
     if (nodePtr->sourceSession && nodePtr->sourceSession != session) {
       // TODO: Auth/params
-      announceToSession(session, {subNs.requestID, prefix, {}}, nodePtr)
-          .scheduleOn(evb)
-          .start();
+      queueAnnounce(session, {subNs.requestID, prefix, {}}, nodePtr);
     }
     for (auto& nextNodeIt : nodePtr->children) {
       TrackNamespace nodePrefix(prefix);
-      nodePrefix.append(nextNodeIt.first);
+      for (const auto& token : nextNodeIt.second->label) {
+        nodePrefix.append(token);
+      }
       nodes.emplace_back(std::forward_as_tuple(nodePrefix, nextNodeIt.second));
     }
   }
@@ -178,12 +341,12 @@ void MoQRelay::unsubscribeAnnounces(
   auto it = nodePtr->sessions.find(session);
   if (it != nodePtr->sessions.end()) {
     nodePtr->sessions.erase(it);
+    nodePtr.reset();
+    pruneNamespace(trackNamespacePrefix);
     return;
   }
   // TODO: error?
   XLOG(DBG1) << "Namespace prefix was not subscribed by this session";
-
-  // TODO: prune Announce tree
 }
 
 std::shared_ptr<MoQSession> MoQRelay::findAnnounceSession(
@@ -195,10 +358,277 @@ std::shared_ptr<MoQSession> MoQRelay::findAnnounceSession(
   return nodePtr->sourceSession;
 }
 
+std::shared_ptr<MoQSession> MoQRelay::findStandbySession(
+    const TrackNamespace& ns,
+    const std::shared_ptr<MoQSession>& exclude) {
+  auto nodePtr = findNamespaceNode(ns, /*createMissingNodes=*/false);
+  if (!nodePtr) {
+    return nullptr;
+  }
+  if (nodePtr->sourceSession && nodePtr->sourceSession != exclude) {
+    return nodePtr->sourceSession;
+  }
+  for (auto it = nodePtr->standbySources.rbegin();
+       it != nodePtr->standbySources.rend();
+       ++it) {
+    if (*it != exclude) {
+      return *it;
+    }
+  }
+  return nullptr;
+}
+
+// Forwards an upstream subscription on a pooled session, except that losing
+// the session resubscribes instead of ending the track downstream
+class MoQRelay::PooledUpstreamConsumer : public TrackConsumer {
+ public:
+  PooledUpstreamConsumer(
+      std::weak_ptr<MoQRelay> relay,
+      folly::EventBase* evb,
+      FullTrackName ftn,
+      std::shared_ptr<TrackConsumer> consumer)
+      : relay_(std::move(relay)),
+        evb_(evb),
+        ftn_(std::move(ftn)),
+        consumer_(std::move(consumer)) {}
+
+  folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
+  beginSubgroup(uint64_t groupID, uint64_t subgroupID, Priority priority)
+      override {
+    return consumer_->beginSubgroup(groupID, subgroupID, priority);
+  }
+
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitStreamCredit() override {
+    return consumer_->awaitStreamCredit();
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objectStream(
+      const ObjectHeader& header,
+      Payload payload) override {
+    return consumer_->objectStream(header, std::move(payload));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> datagram(
+      const ObjectHeader& header,
+      Payload payload) override {
+    return consumer_->datagram(header, std::move(payload));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> groupNotExists(
+      uint64_t groupID,
+      uint64_t subgroup,
+      Priority pri,
+      Extensions extensions) override {
+    return consumer_->groupNotExists(
+        groupID, subgroup, pri, std::move(extensions));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> subscribeDone(
+      SubscribeDone subDone) override {
+    auto relay = relay_.lock();
+    if (!relay || subDone.statusCode != SubscribeDoneStatusCode::SESSION_CLOSED) {
+      return consumer_->subscribeDone(std::move(subDone));
+    }
+    // The session is still tearing down, resubscribe once it is gone
+    XLOG(INFO) << "Upstream session lost for " << ftn_ << ", resubscribing";
+    folly::coro::co_invoke(
+        [relay = std::move(relay),
+         ftn = ftn_,
+         subDone = std::move(subDone)]() mutable -> folly::coro::Task<void> {
+          co_await relay->resubscribe(std::move(ftn), std::move(subDone));
+        })
+        .scheduleOn(evb_)
+        .start();
+    return folly::unit;
+  }
+
+ private:
+  std::weak_ptr<MoQRelay> relay_;
+  folly::EventBase* evb_;
+  FullTrackName ftn_;
+  std::shared_ptr<TrackConsumer> consumer_;
+};
+
+folly::coro::Task<std::shared_ptr<MoQSession>> MoQRelay::getPooledSession(
+    const FullTrackName& ftn) {
+  if (!upstreamPool_) {
+    co_return nullptr;
+  }
+  if (clusterRing_) {
+    const auto& owner = clusterRing_->owner(ftn);
+    if (!owner.empty() && owner != clusterSelf_) {
+      proxygen::URL peer(owner);
+      if (peer.isValid() && peer.hasHost()) {
+        peerRequests_++;
+        co_return co_await upstreamPool_->getSession(peer);
+      }
+      XLOG(ERR) << "Invalid cluster peer " << owner << ", using origin";
+    }
+  }
+  co_return co_await upstreamPool_->getSession(*upstreamOrigin_);
+}
+
+std::shared_ptr<TrackConsumer> MoQRelay::getUpstreamConsumer(
+    const FullTrackName& ftn,
+    std::shared_ptr<MoQForwarder> forwarder,
+    bool pooled) {
+  auto consumer = getSubscribeWriteback(ftn, std::move(forwarder));
+  if (!pooled) {
+    return consumer;
+  }
+  return std::make_shared<PooledUpstreamConsumer>(
+      weak_from_this(),
+      upstreamPool_->getEventBase(),
+      ftn,
+      std::move(consumer));
+}
+
+folly::coro::Task<void> MoQRelay::resubscribe(
+    FullTrackName ftn,
+    SubscribeDone subDone) {
+  if (!subscriptions_.contains(ftn)) {
+    co_return;
+  }
+  auto upstreamSession = co_await getPooledSession(ftn);
+  // The last subscriber may have left while connecting
+  auto it = subscriptions_.find(ftn);
+  if (it == subscriptions_.end()) {
+    co_return;
+  }
+  auto forwarder = it->second.forwarder;
+  if (!upstreamSession) {
+    XLOG(ERR) << "No upstream session to resubscribe " << ftn;
+    forwarder->subscribeDone(std::move(subDone));
+    co_return;
+  }
+  auto subReq = it->second.request;
+  it->second.upstream = upstreamSession;
+  it->second.handle.reset();
+  auto subRes =
+      co_await getUpstream(upstreamSession)
+          ->subscribe(subReq, getUpstreamConsumer(ftn, forwarder, true));
+  it = subscriptions_.find(ftn);
+  if (it == subscriptions_.end()) {
+    if (subRes.hasValue()) {
+      subRes.value()->unsubscribe();
+    }
+    co_return;
+  }
+  if (subRes.hasError()) {
+    XLOG(ERR) << "Resubscribe failed for " << ftn
+              << " err=" << subRes.error().reasonPhrase;
+    forwarder->subscribeDone(std::move(subDone));
+    co_return;
+  }
+  it->second.requestID = subRes.value()->subscribeOk().requestID;
+  it->second.handle = std::move(subRes.value());
+  // The new upstream got the original request, bring it up to date
+  it->second.upstreamPriority = subReq.priority;
+  it->second.upstreamForward = subReq.forward;
+  updateUpstream(it->second);
+}
+
+// The downstream's subscription to the ABR track, one per rendition
+class MoQRelay::AbrSubscription : public Publisher::SubscriptionHandle {
+ public:
+  AbrSubscription(
+      SubscribeOk ok,
+      std::vector<std::shared_ptr<Publisher::SubscriptionHandle>> renditions)
+      : SubscriptionHandle(std::move(ok)), renditions_(std::move(renditions)) {}
+
+  void subscribeUpdate(SubscribeUpdate subUpdate) override {
+    for (auto& rendition : renditions_) {
+      rendition->subscribeUpdate(subUpdate);
+    }
+  }
+
+  void unsubscribe() override {
+    for (auto& rendition : std::exchange(renditions_, {})) {
+      rendition->unsubscribe();
+    }
+  }
+
+ private:
+  std::vector<std::shared_ptr<Publisher::SubscriptionHandle>> renditions_;
+};
+
+folly::coro::Task<Publisher::SubscribeResult> MoQRelay::subscribeAbr(
+    SubscribeRequest subReq,
+    std::shared_ptr<TrackConsumer> consumer) {
+  // The ABR track may be reconfigured while subscribing
+  auto abr = *abrTrack_;
+  std::weak_ptr<MoQSession> session = MoQSession::getRequestSession();
+  auto signals = [session, evb = evb_]() {
+    MoQAbrSwitcher::Signals signals;
+    auto locked = session.lock();
+    if (!locked || (evb && evb != locked->getEventBase())) {
+      return signals;
+    }
+    if (auto metrics = locked->getTransportMetrics()) {
+      signals.sendRateBps = metrics->estimatedSendRateBps();
+    }
+    signals.bytesBuffered = locked->bytesBuffered();
+    return signals;
+  };
+  std::vector<uint64_t> bitrates;
+  for (const auto& rendition : abr.renditions) {
+    bitrates.push_back(rendition.bitrateBps);
+  }
+  auto switcher = std::make_shared<MoQAbrSwitcher>(
+      std::move(consumer), std::move(bitrates), std::move(signals), abr.config);
+  abrSubscribes_++;
+  std::vector<std::shared_ptr<Publisher::SubscriptionHandle>> handles;
+  folly::Optional<SubscribeOk> subscribeOk;
+  folly::Optional<SubscribeError> error;
+  for (size_t i = 0; i < abr.renditions.size(); i++) {
+    auto renditionReq = subReq;
+    renditionReq.fullTrackName.trackName = abr.renditions[i].trackName;
+    auto res =
+        co_await subscribe(std::move(renditionReq), switcher->source(i));
+    if (res.hasError()) {
+      XLOG(DBG1) << "ABR rendition " << abr.renditions[i].trackName
+                 << " failed: " << res.error().reasonPhrase;
+      switcher->disable(i);
+      error = std::move(res.error());
+      continue;
+    }
+    if (!subscribeOk) {
+      subscribeOk = res.value()->subscribeOk();
+    }
+    handles.push_back(std::move(res.value()));
+  }
+  if (handles.empty()) {
+    error->requestID = subReq.requestID;
+    co_return folly::makeUnexpected(std::move(*error));
+  }
+  subscribeOk->requestID = subReq.requestID;
+  co_return std::make_shared<AbrSubscription>(
+      std::move(*subscribeOk), std::move(handles));
+}
+
 folly::coro::Task<Publisher::SubscribeResult> MoQRelay::subscribe(
     SubscribeRequest subReq,
     std::shared_ptr<TrackConsumer> consumer) {
-  auto session = MoQSession::getRequestSession();
+  if (capture_) {
+    consumer = capture_->subscribe(
+        MoQSession::getRequestSession().get(), subReq, std::move(consumer));
+  }
+  if (abrTrack_ && subReq.fullTrackName.trackName == abrTrack_->trackName &&
+      !abrTrack_->renditions.empty()) {
+    co_return co_await subscribeAbr(std::move(subReq), std::move(consumer));
+  }
+  co_return co_await subscribeFrom(
+      MoQSession::getRequestSession(), std::move(subReq), std::move(consumer));
+}
+
+folly::coro::Task<Publisher::SubscribeResult> MoQRelay::subscribeFrom(
+    std::shared_ptr<MoQSession> session,
+    SubscribeRequest subReq,
+    std::shared_ptr<TrackConsumer> consumer) {
+  if (cache_) {
+    cache_->onTrackRequested(subReq.fullTrackName);
+  }
   auto subscriptionIt = subscriptions_.find(subReq.fullTrackName);
   if (subscriptionIt == subscriptions_.end()) {
     // first subscriber
@@ -212,8 +642,32 @@ folly::coro::Task<Publisher::SubscribeResult> MoQRelay::subscribe(
            SubscribeErrorCode::TRACK_NOT_EXIST,
            "namespace required"}));
     }
+    if (auto negative = findNegative(subReq.fullTrackName);
+        negative && negative->trackNotExist) {
+      negativeCacheHits_++;
+      co_return folly::makeUnexpected(SubscribeError(
+          {subReq.requestID,
+           SubscribeErrorCode::TRACK_NOT_EXIST,
+           negative->reason}));
+    }
     auto upstreamSession =
         findAnnounceSession(subReq.fullTrackName.trackNamespace);
+    bool pooled = false;
+    if (!upstreamSession && upstreamPool_) {
+      upstreamSession = co_await getPooledSession(subReq.fullTrackName);
+      pooled = true;
+      if (subscriptions_.contains(subReq.fullTrackName)) {
+        // Another subscriber went upstream while this one was connecting
+        co_return co_await subscribeFrom(
+            std::move(session), std::move(subReq), std::move(consumer));
+      }
+      if (!upstreamSession) {
+        co_return folly::makeUnexpected(SubscribeError(
+            {subReq.requestID,
+             SubscribeErrorCode::INTERNAL_ERROR,
+             "upstream unavailable"}));
+      }
+    }
     if (!upstreamSession) {
       // no such namespace has been announced
       co_return folly::makeUnexpected(SubscribeError(
@@ -228,7 +682,8 @@ folly::coro::Task<Publisher::SubscribeResult> MoQRelay::subscribe(
            SubscribeErrorCode::INTERNAL_ERROR,
            "self subscribe"}));
     }
-    subReq.priority = kDefaultUpstreamPriority;
+    // The first subscriber's priority, then the most urgent of all of them,
+    // see updateUpstream
     subReq.groupOrder = GroupOrder::Default;
     // We only subscribe upstream with LatestObject. This is to satisfy other
     // subscribers that join with narrower filters
@@ -236,10 +691,24 @@ folly::coro::Task<Publisher::SubscribeResult> MoQRelay::subscribe(
     auto forwarder =
         std::make_shared<MoQForwarder>(subReq.fullTrackName, folly::none);
     forwarder->setCallback(shared_from_this());
-    subscriptions_.emplace(
-        std::piecewise_construct,
-        std::forward_as_tuple(subReq.fullTrackName),
-        std::forward_as_tuple(forwarder, upstreamSession));
+    forwarder->setTrackStatsCallback(trackStatsCallback_);
+    auto& newSubscription =
+        subscriptions_
+            .emplace(
+                std::piecewise_construct,
+                std::forward_as_tuple(subReq.fullTrackName),
+                std::forward_as_tuple(forwarder, upstreamSession))
+            .first->second;
+    std::shared_ptr<TrackConsumer> upstreamConsumer;
+    if (!pooled && wantsHotStandby(subReq.fullTrackName)) {
+      // A standby announcer may be added once this one answers
+      newSubscription.merger = std::make_shared<MoQTrackMerger>(
+          getSubscribeWriteback(subReq.fullTrackName, forwarder));
+      upstreamConsumer = newSubscription.merger->addSource();
+    } else {
+      upstreamConsumer =
+          getUpstreamConsumer(subReq.fullTrackName, forwarder, pooled);
+    }
     // The iterator returned from emplace does not survive across coroutine
     // resumption, so both the guard and updating the RelaySubscription below
     // require another lookup in the subscriptions_ map.
@@ -256,9 +725,15 @@ folly::coro::Task<Publisher::SubscribeResult> MoQRelay::subscribe(
     // As per the spec, we must set forward = true in the subscribe request
     // to the upstream.
     subReq.forward = true;
-    auto subRes = co_await upstreamSession->subscribe(
-        subReq, getSubscribeWriteback(subReq.fullTrackName, forwarder));
+    upstreamSubscribes_++;
+    auto subRes = co_await getUpstream(upstreamSession)
+                      ->subscribe(subReq, std::move(upstreamConsumer));
     if (subRes.hasError()) {
+      if (subRes.error().errorCode == SubscribeErrorCode::TRACK_NOT_EXIST) {
+        cacheNegative(
+            subReq.fullTrackName,
+            {.trackNotExist = true, .reason = subRes.error().reasonPhrase});
+      }
       co_return folly::makeUnexpected(SubscribeError(
           {subReq.requestID,
            subRes.error().errorCode,
@@ -271,21 +746,82 @@ folly::coro::Task<Publisher::SubscribeResult> MoQRelay::subscribe(
       forwarder->updateLatest(latest->group, latest->object);
       subscriber->updateLatest(*latest);
     }
+    auto version = upstreamSession->getNegotiatedVersion();
+    if (cache_ && version) {
+      auto maxCacheDurationKey = getMaxCacheDurationParamKey(*version);
+      for (const auto& param : subRes.value()->subscribeOk().params) {
+        if (param.key == maxCacheDurationKey) {
+          cache_->setMaxCacheDuration(
+              subReq.fullTrackName, std::chrono::milliseconds(param.asUint64));
+        }
+      }
+    }
     auto pubGroupOrder = subRes.value()->subscribeOk().groupOrder;
     forwarder->setGroupOrder(pubGroupOrder);
     subscriber->setPublisherGroupOrder(pubGroupOrder);
     auto it = subscriptions_.find(subReq.fullTrackName);
     XCHECK(it != subscriptions_.end());
     auto& rsub = it->second;
+    rsub.request = subReq;
     rsub.requestID = subRes.value()->subscribeOk().requestID;
     rsub.handle = std::move(subRes.value());
+    for (auto& pending : rsub.pendingSubscribers) {
+      if (latest) {
+        pending->updateLatest(*latest);
+      }
+      pending->setPublisherGroupOrder(pubGroupOrder);
+    }
+    rsub.pendingSubscribers.clear();
+    rsub.upstreamPriority = subReq.priority;
+    // Subscribers that joined meanwhile may need more
+    updateUpstream(rsub);
     rsub.promise.setValue(folly::unit);
+    if (rsub.merger) {
+      startStandby(subReq.fullTrackName);
+    }
     co_return subscriber;
   } else {
+    if (subscriptionIt->second.forwarder->upstreamDone()) {
+      // Ended upstream while lingering, subscribe again
+      unsubscribeUpstream(subscriptionIt->second);
+      subscriptions_.erase(subscriptionIt);
+      co_return co_await subscribeFrom(
+          std::move(session), std::move(subReq), std::move(consumer));
+    }
+    if (subscriptionIt->second.lingerID) {
+      endLinger(subscriptionIt->second);
+    }
     if (!subscriptionIt->second.promise.isFulfilled()) {
-      // this will throw if the dependent subscribe failed, which is good
-      // because subscriptionIt will be invalid
-      co_await subscriptionIt->second.promise.getFuture();
+      coalescedSubscribes_++;
+      std::shared_ptr<MoQForwarder::Subscriber> subscriber;
+      if (subReq.locType != LocationType::AbsoluteRange) {
+        // Attach now so no objects are missed.  The upstream SUBSCRIBE_OK
+        // completes every pending subscriber at once.
+        subscriber = subscriptionIt->second.forwarder->addSubscriber(
+            session, subReq, consumer);
+        subscriptionIt->second.pendingSubscribers.push_back(subscriber);
+      }
+      auto upstreamDone = subscriptionIt->second.promise.getFuture();
+      try {
+        co_await std::move(upstreamDone);
+      } catch (const std::exception&) {
+        // The subscription, and any subscriber attached to it, are gone
+        co_return folly::makeUnexpected(SubscribeError{
+            subReq.requestID,
+            SubscribeErrorCode::INTERNAL_ERROR,
+            "upstream subscribe failed"});
+      }
+      if (subscriber) {
+        co_return subscriber;
+      }
+      // Ranges are checked against latest, which needs the SUBSCRIBE_OK
+      subscriptionIt = subscriptions_.find(subReq.fullTrackName);
+      if (subscriptionIt == subscriptions_.end()) {
+        co_return folly::makeUnexpected(SubscribeError{
+            subReq.requestID,
+            SubscribeErrorCode::INTERNAL_ERROR,
+            "upstream subscription ended"});
+      }
     }
     auto& forwarder = subscriptionIt->second.forwarder;
     if (forwarder->latest() && subReq.locType == LocationType::AbsoluteRange &&
@@ -296,8 +832,10 @@ folly::coro::Task<Publisher::SubscribeResult> MoQRelay::subscribe(
           "Range in the past, use FETCH"});
       // start may be in the past, it will get adjusted forward to latest
     }
-    co_return subscriptionIt->second.forwarder->addSubscriber(
+    auto subscriber = subscriptionIt->second.forwarder->addSubscriber(
         std::move(session), subReq, std::move(consumer));
+    updateUpstream(subscriptionIt->second);
+    co_return subscriber;
   }
 }
 
@@ -305,6 +843,17 @@ folly::coro::Task<Publisher::FetchResult> MoQRelay::fetch(
     Fetch fetch,
     std::shared_ptr<FetchConsumer> consumer) {
   auto session = MoQSession::getRequestSession();
+  if (capture_) {
+    // Joining fetches are replayed from their SUBSCRIBE
+    if (auto standalone = fetchType(fetch).first) {
+      capture_->fetch(
+          session.get(),
+          fetch.requestID,
+          fetch.fullTrackName,
+          standalone->start,
+          standalone->end);
+    }
+  }
 
   // check auth
   // get trackNamespace
@@ -314,6 +863,13 @@ folly::coro::Task<Publisher::FetchResult> MoQRelay::fetch(
          FetchErrorCode::TRACK_NOT_EXIST,
          "namespace required"}));
   }
+  if (auto error = negativeFetchError(fetch)) {
+    negativeCacheHits_++;
+    co_return folly::makeUnexpected(std::move(*error));
+  }
+  if (cache_) {
+    cache_->onTrackRequested(fetch.fullTrackName);
+  }
 
   auto [standalone, joining] = fetchType(fetch);
   if (joining) {
@@ -341,6 +897,15 @@ folly::coro::Task<Publisher::FetchResult> MoQRelay::fetch(
 
   auto upstreamSession =
       findAnnounceSession(fetch.fullTrackName.trackNamespace);
+  if (!upstreamSession && upstreamPool_) {
+    upstreamSession = co_await getPooledSession(fetch.fullTrackName);
+    if (!upstreamSession) {
+      co_return folly::makeUnexpected(FetchError(
+          {fetch.requestID,
+           FetchErrorCode::INTERNAL_ERROR,
+           "upstream unavailable"}));
+    }
+  }
   if (!upstreamSession) {
     // no such namespace has been announced
     co_return folly::makeUnexpected(FetchError(
@@ -362,10 +927,359 @@ folly::coro::Task<Publisher::FetchResult> MoQRelay::fetch(
                  << standalone->start.object << "}.." << standalone->end.group
                  << "," << standalone->end.object << "}";
     }
-    co_return co_await upstreamSession->fetch(fetch, std::move(consumer));
+    auto res = co_await getUpstream(std::move(upstreamSession))
+                   ->fetch(fetch, std::move(consumer));
+    if (res.hasError()) {
+      onUpstreamFetchError(fetch, res.error());
+    }
+    co_return res;
   }
-  co_return co_await cache_->fetch(
-      fetch, std::move(consumer), std::move(upstreamSession));
+  auto upstream = getUpstream(std::move(upstreamSession));
+  // Joining FETCHes usually resolve to cached objects at the live edge
+  auto cached = cache_->tryFetchFromCache(
+      fetch, consumer, upstream, folly::getKeepAliveToken(relayEvb(session)));
+  if (cached) {
+    co_return std::move(*cached);
+  }
+  auto res =
+      co_await cache_->fetch(fetch, std::move(consumer), std::move(upstream));
+  if (res.hasError()) {
+    onUpstreamFetchError(fetch, res.error());
+  }
+  co_return res;
+}
+
+const MoQRelay::NegativeEntry* MoQRelay::findNegative(
+    const FullTrackName& ftn) {
+  if (negativeCache_.empty()) {
+    return nullptr;
+  }
+  auto it = negativeCache_.find(ftn);
+  if (it == negativeCache_.end()) {
+    return nullptr;
+  }
+  if (it->second.expires <= std::chrono::steady_clock::now()) {
+    eraseNegative(ftn);
+    return nullptr;
+  }
+  return &it->second;
+}
+
+void MoQRelay::cacheNegative(const FullTrackName& ftn, NegativeEntry entry) {
+  if (negativeCacheTtl_.count() == 0) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  while (!negativeExpiry_.empty() && negativeExpiry_.front().first <= now) {
+    auto it = negativeCache_.find(negativeExpiry_.front().second);
+    if (it != negativeCache_.end() && it->second.expires <= now) {
+      eraseNegative(negativeExpiry_.front().second);
+    }
+    negativeExpiry_.pop_front();
+  }
+  if (negativeCache_.size() >= kMaxNegativeEntries &&
+      !negativeCache_.contains(ftn)) {
+    // Requests for many names, all of them recent
+    return;
+  }
+  entry.expires = now + negativeCacheTtl_;
+  negativeExpiry_.emplace_back(entry.expires, ftn);
+  if (negativeCache_.insert_or_assign(ftn, std::move(entry)).second) {
+    negativeNamespaces_[ftn.trackNamespace].insert(ftn.trackName);
+  }
+}
+
+void MoQRelay::eraseNegative(const FullTrackName& ftn) {
+  negativeCache_.erase(ftn);
+  auto it = negativeNamespaces_.find(ftn.trackNamespace);
+  if (it != negativeNamespaces_.end()) {
+    it->second.erase(ftn.trackName);
+    if (it->second.empty()) {
+      negativeNamespaces_.erase(it);
+    }
+  }
+}
+
+void MoQRelay::invalidateNegative(const TrackNamespace& ns) {
+  // ns sorts first of the namespaces starting with it
+  auto it = negativeNamespaces_.lower_bound(ns);
+  while (it != negativeNamespaces_.end() && it->first.startsWith(ns)) {
+    for (const auto& trackName : it->second) {
+      negativeCache_.erase(FullTrackName{it->first, trackName});
+    }
+    it = negativeNamespaces_.erase(it);
+  }
+}
+
+folly::Optional<FetchError> MoQRelay::negativeFetchError(const Fetch& fetch) {
+  auto negative = findNegative(fetch.fullTrackName);
+  if (!negative) {
+    return folly::none;
+  }
+  if (negative->trackNotExist) {
+    return FetchError(
+        {fetch.requestID, FetchErrorCode::TRACK_NOT_EXIST, negative->reason});
+  }
+  auto standalone = fetchType(fetch).first;
+  if (standalone && negative->invalidRange &&
+      negative->invalidRange->first == standalone->start &&
+      negative->invalidRange->second == standalone->end) {
+    return FetchError(
+        {fetch.requestID, FetchErrorCode::INVALID_RANGE, negative->reason});
+  }
+  return folly::none;
+}
+
+void MoQRelay::onUpstreamFetchError(
+    const Fetch& fetch,
+    const FetchError& error) {
+  if (error.errorCode == FetchErrorCode::TRACK_NOT_EXIST) {
+    cacheNegative(
+        fetch.fullTrackName,
+        {.trackNotExist = true, .reason = error.reasonPhrase});
+    return;
+  }
+  auto standalone = fetchType(fetch).first;
+  if (error.errorCode == FetchErrorCode::INVALID_RANGE && standalone) {
+    if (auto negative = findNegative(fetch.fullTrackName);
+        negative && negative->trackNotExist) {
+      return;
+    }
+    cacheNegative(
+        fetch.fullTrackName,
+        {.invalidRange = std::make_pair(standalone->start, standalone->end),
+         .reason = error.reasonPhrase});
+  }
+}
+
+folly::coro::Task<Publisher::TrackStatusResult> MoQRelay::trackStatus(
+    TrackStatusRequest trackStatusRequest) {
+  const auto& ftn = trackStatusRequest.fullTrackName;
+  auto statusFor = [&](TrackStatusCode code,
+                       folly::Optional<AbsoluteLocation> latest) {
+    localTrackStatuses_++;
+    return TrackStatus{
+        trackStatusRequest.requestID, ftn, code, latest, {}};
+  };
+
+  // A live upstream subscription sees every object as it's published
+  auto subscriptionIt = subscriptions_.find(ftn);
+  if (subscriptionIt != subscriptions_.end() &&
+      subscriptionIt->second.promise.isFulfilled() &&
+      subscriptionIt->second.upstreamForward) {
+    auto latest = subscriptionIt->second.forwarder->latest();
+    co_return statusFor(
+        latest ? TrackStatusCode::IN_PROGRESS
+               : TrackStatusCode::TRACK_NOT_STARTED,
+        latest);
+  }
+  // An ended track doesn't change
+  if (cache_) {
+    if (auto endOfTrack = cache_->endOfTrack(ftn)) {
+      co_return statusFor(TrackStatusCode::TRACK_ENDED, endOfTrack);
+    }
+  }
+
+  auto upstreamSession = findAnnounceSession(ftn.trackNamespace);
+  if (!upstreamSession && upstreamPool_) {
+    upstreamSession = co_await getPooledSession(ftn);
+  }
+  if (!upstreamSession ||
+      upstreamSession.get() == MoQSession::getRequestSession().get()) {
+    co_return TrackStatus{
+        trackStatusRequest.requestID,
+        ftn,
+        TrackStatusCode::TRACK_NOT_EXIST,
+        folly::none,
+        {}};
+  }
+  upstreamTrackStatuses_++;
+  co_return co_await getUpstream(std::move(upstreamSession))
+      ->trackStatus(std::move(trackStatusRequest));
+}
+
+MoQRelay::Stats& MoQRelay::Stats::operator+=(const Stats& other) {
+  subscriptions += other.subscriptions;
+  subscribers += other.subscribers;
+  pendingSubscribers += other.pendingSubscribers;
+  upstreamSubscribes += other.upstreamSubscribes;
+  coalescedSubscribes += other.coalescedSubscribes;
+  lingeringSubscriptions += other.lingeringSubscriptions;
+  lingerRejoins += other.lingerRejoins;
+  upstreamSubscribeUpdates += other.upstreamSubscribeUpdates;
+  standbySubscriptions += other.standbySubscriptions;
+  standbyFailovers += other.standbyFailovers;
+  standbyDuplicates += other.standbyDuplicates;
+  negativeCacheHits += other.negativeCacheHits;
+  negativeCacheEntries += other.negativeCacheEntries;
+  localTrackStatuses += other.localTrackStatuses;
+  upstreamTrackStatuses += other.upstreamTrackStatuses;
+  peerRequests += other.peerRequests;
+  abrSubscribes += other.abrSubscribes;
+  datagramStreamFallbacks += other.datagramStreamFallbacks;
+  pinnedTracks += other.pinnedTracks;
+  cachedBytes += other.cachedBytes;
+  cachedGroups += other.cachedGroups;
+  subscriberBufferedBytes += other.subscriberBufferedBytes;
+  cache.fetches += other.cache.fetches;
+  cache.fetchHits += other.cache.fetchHits;
+  cache.syncFetches += other.cache.syncFetches;
+  cache.upstreamFetches += other.cache.upstreamFetches;
+  cache.coalescedWaits += other.cache.coalescedWaits;
+  cache.cutThroughObjects += other.cache.cutThroughObjects;
+  cache.readAheadFetches += other.cache.readAheadFetches;
+  cache.parallelFetchChunks += other.cache.parallelFetchChunks;
+  cache.hitObjects += other.cache.hitObjects;
+  cache.hitBytes += other.cache.hitBytes;
+  cache.diskWrites += other.cache.diskWrites;
+  cache.diskReads += other.cache.diskReads;
+  cache.compactedObjects += other.cache.compactedObjects;
+  cache.compactedBytes += other.cache.compactedBytes;
+  cache.admittedGroups += other.cache.admittedGroups;
+  cache.rejectedGroups += other.cache.rejectedGroups;
+  return *this;
+}
+
+MoQRelay::Stats MoQRelay::getStats() const {
+  Stats stats;
+  stats.subscriptions = subscriptions_.size();
+  for (const auto& subscription : subscriptions_) {
+    stats.subscribers += subscription.second.forwarder->numSubscribers();
+    stats.pendingSubscribers += subscription.second.pendingSubscribers.size();
+    stats.lingeringSubscriptions += subscription.second.lingerID ? 1 : 0;
+    stats.standbySubscriptions += subscription.second.standbyHandle ? 1 : 0;
+    if (subscription.second.merger) {
+      stats.standbyDuplicates += subscription.second.merger->duplicates();
+    }
+    stats.subscriberBufferedBytes +=
+        subscription.second.forwarder->bytesBuffered(evb_);
+  }
+  stats.upstreamSubscribes = upstreamSubscribes_;
+  stats.coalescedSubscribes = coalescedSubscribes_;
+  stats.lingerRejoins = lingerRejoins_;
+  stats.upstreamSubscribeUpdates = upstreamSubscribeUpdates_;
+  stats.standbyFailovers = standbyFailovers_;
+  stats.negativeCacheHits = negativeCacheHits_;
+  stats.negativeCacheEntries = negativeCache_.size();
+  stats.localTrackStatuses = localTrackStatuses_;
+  stats.upstreamTrackStatuses = upstreamTrackStatuses_;
+  stats.peerRequests = peerRequests_;
+  stats.abrSubscribes = abrSubscribes_;
+  stats.datagramStreamFallbacks = datagramStreamFallbacks_;
+  stats.pinnedTracks = pinnedTracks_.size();
+  if (cache_) {
+    stats.cachedBytes = cache_->cachedBytes();
+    stats.cachedGroups = cache_->numCachedGroups();
+    stats.cache = cache_->getStats();
+  }
+  return stats;
+}
+
+MoQRelay::MemoryReport& MoQRelay::MemoryReport::operator+=(
+    MemoryReport other) {
+  tracks.insert(
+      tracks.end(),
+      std::make_move_iterator(other.tracks.begin()),
+      std::make_move_iterator(other.tracks.end()));
+  sessions.insert(sessions.end(), other.sessions.begin(), other.sessions.end());
+  return *this;
+}
+
+std::string MoQRelay::MemoryReport::dump(size_t maxEntries) const {
+  // Shards report the same track or session separately
+  folly::F14FastMap<FullTrackName, TrackMemory, FullTrackName::hash>
+      trackTotals;
+  for (const auto& track : tracks) {
+    auto& total = trackTotals[track.fullTrackName];
+    total.fullTrackName = track.fullTrackName;
+    total.cachedBytes += track.cachedBytes;
+    total.bufferedBytes += track.bufferedBytes;
+  }
+  folly::F14FastMap<const MoQSession*, MoQMemoryUsage> sessionTotals;
+  for (const auto& session : sessions) {
+    sessionTotals[session.session] = session.usage;
+  }
+  std::vector<TrackMemory> sortedTracks;
+  sortedTracks.reserve(trackTotals.size());
+  uint64_t trackBytes = 0;
+  for (auto& track : trackTotals) {
+    trackBytes += track.second.total();
+    sortedTracks.push_back(std::move(track.second));
+  }
+  std::sort(
+      sortedTracks.begin(),
+      sortedTracks.end(),
+      [](const auto& a, const auto& b) { return a.total() > b.total(); });
+  std::vector<std::pair<const MoQSession*, MoQMemoryUsage>> sortedSessions(
+      sessionTotals.begin(), sessionTotals.end());
+  uint64_t sessionBytes = 0;
+  for (const auto& session : sortedSessions) {
+    sessionBytes += session.second.total();
+  }
+  std::sort(
+      sortedSessions.begin(),
+      sortedSessions.end(),
+      [](const auto& a, const auto& b) {
+        return a.second.total() > b.second.total();
+      });
+
+  std::ostringstream os;
+  os << "tracks=" << sortedTracks.size() << " bytes=" << trackBytes << "\n";
+  for (size_t i = 0; i < sortedTracks.size() && i < maxEntries; i++) {
+    const auto& track = sortedTracks[i];
+    os << "  " << track.fullTrackName << " cached=" << track.cachedBytes
+       << " buffered=" << track.bufferedBytes << "\n";
+  }
+  os << "sessions=" << sortedSessions.size() << " bytes=" << sessionBytes
+     << "\n";
+  for (size_t i = 0; i < sortedSessions.size() && i < maxEntries; i++) {
+    const auto& usage = sortedSessions[i].second;
+    os << "  sess=" << sortedSessions[i].first
+       << " control_write=" << usage.controlWriteBytes
+       << " control_ingress=" << usage.controlIngressBytes
+       << " data_ingress=" << usage.dataIngressBytes
+       << " publish_buffered=" << usage.publishBufferedBytes << "\n";
+  }
+  return os.str();
+}
+
+MoQRelay::MemoryReport MoQRelay::getMemoryReport() const {
+  folly::F14FastMap<FullTrackName, TrackMemory, FullTrackName::hash> tracks;
+  folly::F14FastSet<const MoQSession*> seen;
+  MemoryReport report;
+  auto addSession = [&](const std::shared_ptr<MoQSession>& session) {
+    if (session && (!evb_ || session->getEventBase() == evb_) &&
+        seen.insert(session.get()).second) {
+      report.sessions.push_back({session.get(), session->memoryUsage()});
+    }
+  };
+  for (const auto& subscription : subscriptions_) {
+    auto& track = tracks[subscription.first];
+    track.bufferedBytes = subscription.second.forwarder->bytesBuffered(evb_);
+    addSession(subscription.second.upstream);
+    subscription.second.forwarder->forEachSubscriber(
+        [&](const auto& sub) { addSession(sub->session); });
+  }
+  if (cache_) {
+    cache_->forEachTrackBytes([&](const FullTrackName& ftn, uint64_t bytes) {
+      tracks[ftn].cachedBytes = bytes;
+    });
+  }
+  report.tracks.reserve(tracks.size());
+  for (auto& track : tracks) {
+    track.second.fullTrackName = track.first;
+    report.tracks.push_back(std::move(track.second));
+  }
+  return report;
+}
+
+std::shared_ptr<Publisher> MoQRelay::getUpstream(
+    std::shared_ptr<MoQSession> session) {
+  auto sessionEvb = session->getEventBase();
+  if (!evb_ || sessionEvb == evb_) {
+    return session;
+  }
+  return std::make_shared<EvbPublisher>(evb_, std::move(session), sessionEvb);
 }
 
 void MoQRelay::onEmpty(MoQForwarder* forwarder) {
@@ -377,16 +1291,347 @@ void MoQRelay::onEmpty(MoQForwarder* forwarder) {
     if (subscription.forwarder.get() != forwarder) {
       continue;
     }
-    XLOG(INFO) << "Removed last subscriber for " << subscriptionIt->first;
-    if (subscription.handle) {
-      subscription.handle->unsubscribe();
+    if (upstreamLinger_.count() > 0 && subscription.handle &&
+        !forwarder->upstreamDone()) {
+      if (subscription.lingerID) {
+        return;
+      }
+      XLOG(INFO) << "Removed last subscriber for " << subscriptionIt->first
+                 << ", lingering";
+      auto lingerID = nextLingerID_++;
+      subscription.lingerID = lingerID;
+      updateUpstream(subscription);
+      folly::coro::co_invoke(
+          [weakRelay = weak_from_this(),
+           ftn = subscriptionIt->first,
+           lingerID,
+           linger = upstreamLinger_]() -> folly::coro::Task<void> {
+            co_await folly::coro::sleep(linger);
+            if (auto relay = weakRelay.lock()) {
+              relay->onLingerTimeout(ftn, lingerID);
+            }
+          })
+          .scheduleOn(relayEvb(subscription.upstream))
+          .start();
+      return;
     }
+    XLOG(INFO) << "Removed last subscriber for " << subscriptionIt->first;
+    unsubscribeUpstream(subscription);
     subscriptionIt = subscriptions_.erase(subscriptionIt);
     return;
   }
 }
 
+void MoQRelay::onLingerTimeout(const FullTrackName& ftn, uint64_t lingerID) {
+  auto it = subscriptions_.find(ftn);
+  if (it == subscriptions_.end() || it->second.lingerID != lingerID) {
+    // Rejoined, or already gone
+    return;
+  }
+  XLOG(INFO) << "Linger expired for " << ftn;
+  unsubscribeUpstream(it->second);
+  subscriptions_.erase(it);
+}
+
+// Stands in for a subscriber to a pinned track.  What it is sent is already
+// cached by then, and is dropped.
+class MoQRelay::PinConsumer : public TrackConsumer {
+ public:
+  PinConsumer(std::weak_ptr<MoQRelay> relay, FullTrackName ftn)
+      : relay_(std::move(relay)), ftn_(std::move(ftn)) {}
+
+  folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
+  beginSubgroup(uint64_t, uint64_t, Priority) override {
+    return subgroup_;
+  }
+
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitStreamCredit() override {
+    return folly::makeSemiFuture();
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objectStream(
+      const ObjectHeader&,
+      Payload) override {
+    return folly::unit;
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> datagram(
+      const ObjectHeader&,
+      Payload) override {
+    return folly::unit;
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError>
+  groupNotExists(uint64_t, uint64_t, Priority, Extensions) override {
+    return folly::unit;
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> subscribeDone(
+      SubscribeDone) override {
+    if (auto relay = relay_.lock()) {
+      relay->onPinEnded(ftn_);
+    }
+    return folly::unit;
+  }
+
+ private:
+  std::weak_ptr<MoQRelay> relay_;
+  FullTrackName ftn_;
+  std::shared_ptr<SubgroupConsumer> subgroup_{
+      std::make_shared<DiscardSubgroupConsumer>()};
+};
+
+void MoQRelay::setPinnedTracks(
+    std::vector<PinnedTrack> pins,
+    folly::EventBase* evb,
+    std::function<bool(const FullTrackName&)> owns,
+    std::chrono::milliseconds retryInterval) {
+  pins_ = std::move(pins);
+  pinEvb_ = evb;
+  ownsPin_ = std::move(owns);
+  pinRetryInterval_ = retryInterval;
+  if (!upstreamPool_ || !pinEvb_) {
+    // Pinned as they are announced
+    return;
+  }
+  for (const auto& pin : pins_) {
+    FullTrackName ftn{pin.trackNamespace, pin.trackName};
+    if (!ownsPin_ || ownsPin_(ftn)) {
+      folly::coro::co_invoke(
+          [relay = shared_from_this(), ftn]() -> folly::coro::Task<void> {
+            co_await relay->pinTrack(ftn);
+          })
+          .scheduleOn(pinEvb_)
+          .start();
+    }
+  }
+}
+
+void MoQRelay::pinAnnounced(const TrackNamespace& ns, folly::EventBase* evb) {
+  for (const auto& pin : pins_) {
+    if (!ns.startsWith(pin.trackNamespace)) {
+      continue;
+    }
+    FullTrackName ftn{ns, pin.trackName};
+    if (pinnedTracks_.contains(ftn) || (ownsPin_ && !ownsPin_(ftn))) {
+      continue;
+    }
+    folly::coro::co_invoke(
+        [relay = shared_from_this(), ftn]() -> folly::coro::Task<void> {
+          co_await relay->pinTrack(ftn);
+        })
+        .scheduleOn(evb)
+        .start();
+  }
+}
+
+folly::coro::Task<void> MoQRelay::pinTrack(FullTrackName ftn) {
+  if (!pinnedTracks_.insert(ftn).second) {
+    co_return;
+  }
+  XLOG(INFO) << "Pinning " << ftn;
+  // Least urgent, so the upstream priority follows the real subscribers
+  SubscribeRequest subReq{
+      RequestID(0),
+      TrackAlias(0),
+      ftn,
+      kMaxPriority,
+      GroupOrder::Default,
+      true,
+      LocationType::LatestObject,
+      folly::none,
+      0,
+      {}};
+  auto res = co_await subscribeFrom(
+      nullptr,
+      std::move(subReq),
+      std::make_shared<PinConsumer>(weak_from_this(), ftn));
+  if (res.hasError()) {
+    XLOG(WARN) << "Pinning " << ftn
+               << " failed: " << res.error().reasonPhrase;
+    onPinEnded(ftn);
+  }
+}
+
+void MoQRelay::onPinEnded(const FullTrackName& ftn) {
+  if (pinnedTracks_.erase(ftn) == 0 || !upstreamPool_ || !pinEvb_) {
+    // Pinned again when next announced
+    return;
+  }
+  folly::coro::co_invoke(
+      [weakRelay = weak_from_this(),
+       ftn,
+       interval = pinRetryInterval_]() -> folly::coro::Task<void> {
+        co_await folly::coro::sleep(interval);
+        if (auto relay = weakRelay.lock()) {
+          co_await relay->pinTrack(ftn);
+        }
+      })
+      .scheduleOn(pinEvb_)
+      .start();
+}
+
+void MoQRelay::unsubscribeUpstream(RelaySubscription& subscription) {
+  if (subscription.handle) {
+    subscription.handle->unsubscribe();
+  }
+  if (subscription.standbyHandle) {
+    subscription.standbyHandle->unsubscribe();
+  }
+}
+
+void MoQRelay::startStandby(const FullTrackName& ftn) {
+  auto it = subscriptions_.find(ftn);
+  if (it == subscriptions_.end() || !it->second.merger ||
+      it->second.standby || !it->second.handle) {
+    return;
+  }
+  folly::coro::co_invoke(
+      [relay = shared_from_this(), ftn]() -> folly::coro::Task<void> {
+        co_await relay->addStandby(ftn);
+      })
+      .scheduleOn(relayEvb(it->second.upstream))
+      .start();
+}
+
+folly::coro::Task<void> MoQRelay::addStandby(FullTrackName ftn) {
+  auto it = subscriptions_.find(ftn);
+  if (it == subscriptions_.end()) {
+    co_return;
+  }
+  auto& rsub = it->second;
+  if (!rsub.merger || rsub.standby || !rsub.handle ||
+      rsub.forwarder->upstreamDone()) {
+    co_return;
+  }
+  auto standby = findStandbySession(ftn.trackNamespace, rsub.upstream);
+  if (!standby) {
+    co_return;
+  }
+  XLOG(INFO) << "Subscribing " << ftn << " on a standby announcer";
+  rsub.standby = standby;
+  auto source = rsub.merger->addSource();
+  auto subReq = rsub.request;
+  subReq.priority = rsub.upstreamPriority;
+  auto subRes = co_await getUpstream(standby)->subscribe(subReq, source);
+  it = subscriptions_.find(ftn);
+  if (it == subscriptions_.end() || it->second.standby != standby) {
+    // Gone, or the standby's session closed meanwhile
+    if (subRes.hasValue()) {
+      subRes.value()->unsubscribe();
+    }
+    co_return;
+  }
+  if (subRes.hasError()) {
+    XLOG(ERR) << "Standby subscribe failed for " << ftn
+              << " err=" << subRes.error().reasonPhrase;
+    it->second.standby.reset();
+    source->subscribeDone(
+        {RequestID(0),
+         SubscribeDoneStatusCode::SUBSCRIPTION_ENDED,
+         0,
+         "standby subscribe failed"});
+    co_return;
+  }
+  auto& handle = it->second.standbyHandle;
+  handle = std::move(subRes.value());
+  if (!it->second.upstreamForward) {
+    // Paused while subscribing
+    auto latest = it->second.forwarder->latest();
+    handle->subscribeUpdate(
+        {handle->subscribeOk().requestID,
+         latest.value_or(AbsoluteLocation{0, 0}),
+         subReq.endGroup,
+         it->second.upstreamPriority,
+         false,
+         {}});
+  }
+}
+
+void MoQRelay::endLinger(RelaySubscription& subscription) {
+  subscription.lingerID.reset();
+  lingerRejoins_++;
+}
+
+void MoQRelay::onSubscribersChanged(MoQForwarder* forwarder) {
+  auto it = subscriptions_.find(forwarder->fullTrackName());
+  if (it == subscriptions_.end() || it->second.forwarder.get() != forwarder ||
+      it->second.updateScheduled) {
+    return;
+  }
+  it->second.updateScheduled = true;
+  auto update = [weakRelay = weak_from_this(),
+                 ftn = forwarder->fullTrackName()] {
+    auto relay = weakRelay.lock();
+    if (!relay) {
+      return;
+    }
+    auto it = relay->subscriptions_.find(ftn);
+    if (it != relay->subscriptions_.end()) {
+      it->second.updateScheduled = false;
+      relay->updateUpstream(it->second);
+    }
+  };
+  auto evb = relayEvb(it->second.upstream);
+  if (subscribeUpdateDebounce_.count() > 0) {
+    evb->runAfterDelay(std::move(update), subscribeUpdateDebounce_.count());
+  } else {
+    evb->runInLoop(std::move(update));
+  }
+}
+
+void MoQRelay::updateUpstream(RelaySubscription& subscription) {
+  if (!subscription.handle) {
+    // Before SUBSCRIBE_OK, checked again once it arrives
+    return;
+  }
+  auto demand = subscription.forwarder->demand();
+  auto priority = demand.priority.value_or(subscription.upstreamPriority);
+  // A lingering track keeps filling the cache unless told to pause
+  auto forward = subscription.forwarder->empty() ? !pauseLingeringUpstream_
+                                                 : demand.forward;
+  if (priority == subscription.upstreamPriority &&
+      forward == subscription.upstreamForward) {
+    return;
+  }
+  XLOG(DBG1) << "Upstream SUBSCRIBE_UPDATE for "
+             << subscription.forwarder->fullTrackName()
+             << " priority=" << uint32_t(priority) << " forward=" << forward;
+  // The upstream range stays open, narrowing it would cut off subscribers
+  // that join later
+  auto latest = subscription.forwarder->latest();
+  subscription.handle->subscribeUpdate(
+      {subscription.requestID,
+       latest.value_or(AbsoluteLocation{0, 0}),
+       subscription.request.endGroup,
+       priority,
+       forward,
+       {}});
+  if (subscription.standbyHandle) {
+    subscription.standbyHandle->subscribeUpdate(
+        {subscription.standbyHandle->subscribeOk().requestID,
+         latest.value_or(AbsoluteLocation{0, 0}),
+         subscription.request.endGroup,
+         priority,
+         forward,
+         {}});
+  }
+  subscription.upstreamPriority = priority;
+  subscription.upstreamForward = forward;
+  upstreamSubscribeUpdates_++;
+}
+
 void MoQRelay::removeSession(const std::shared_ptr<MoQSession>& session) {
+  if (capture_) {
+    capture_->sessionEnd(session.get());
+  }
+  // ANNOUNCEs still in flight are unannounced as they complete
+  if (auto it = announceQueues_.find(session.get());
+      it != announceQueues_.end()) {
+    it->second->close();
+    announceQueues_.erase(it);
+  }
   // TODO: remove linear search by having each session track it's active
   // announcements, subscribes and subscribe namespaces
   std::vector<std::shared_ptr<MoQSession>> notifySessions;
@@ -403,13 +1648,17 @@ void MoQRelay::removeSession(const std::shared_ptr<MoQSession>& session) {
     if (it != nodePtr->announcements.end()) {
       // we've announced this node to the removing session.
       // Do we really need to unannounce?
-      it->second->unannounce();
+      if (evb_) {
+        session->getEventBase()->runInEventBaseThread(
+            [announceHandle = it->second] { announceHandle->unannounce(); });
+      } else {
+        it->second->unannounce();
+      }
       nodePtr->announcements.erase(it);
     }
 
-    if (nodePtr->sourceSession == session) {
+    if (removeAnnounceSource(*nodePtr, session)) {
       // This session is unannouncing
-      nodePtr->sourceSession = nullptr;
       for (auto& announcement : nodePtr->announcements) {
         auto evb = announcement.first->getEventBase();
         evb->runInEventBaseThread([announceHandle = announcement.second] {
@@ -420,26 +1669,44 @@ void MoQRelay::removeSession(const std::shared_ptr<MoQSession>& session) {
     }
     for (auto& nextNode : nodePtr->children) {
       TrackNamespace nodePrefix(prefix);
-      nodePrefix.append(nextNode.first);
+      for (const auto& token : nextNode.second->label) {
+        nodePrefix.append(token);
+      }
       nodes.emplace_back(
           std::forward_as_tuple(std::move(nodePrefix), nextNode.second.get()));
     }
   }
+  pruneAnnounceTree(announceRoot_);
 
   // TODO: we should keep a map from this session to all its subscriptions
   // and remove this linear search also
   for (auto subscriptionIt = subscriptions_.begin();
        subscriptionIt != subscriptions_.end();) {
+    const auto& ftn = subscriptionIt->first;
     auto& subscription = subscriptionIt->second;
     subscriptionIt++;
     // these actions may erase the current subscription
-    if (subscription.upstream.get() == session.get()) {
+    if (subscription.upstream.get() == session.get() &&
+        subscription.standbyHandle) {
+      // The merger already has everything the standby receives
+      XLOG(INFO) << "Upstream lost for " << ftn << ", standby takes over";
+      subscription.upstream = std::move(subscription.standby);
+      subscription.handle = std::move(subscription.standbyHandle);
+      subscription.requestID = subscription.handle->subscribeOk().requestID;
+      standbyFailovers_++;
+      startStandby(ftn);
+    } else if (subscription.upstream.get() == session.get()) {
       subscription.forwarder->subscribeDone(
           {RequestID(0),
            SubscribeDoneStatusCode::SUBSCRIPTION_ENDED,
            0, // filled in by session
            "upstream disconnect"});
     } else {
+      if (subscription.standby.get() == session.get()) {
+        subscription.standby.reset();
+        subscription.standbyHandle.reset();
+        startStandby(ftn);
+      }
       subscription.forwarder->removeSession(session);
     }
   }
@@ -7,12 +7,24 @@
 #pragma once
 
 #include <folly/coro/SharedPromise.h>
+#include "moxygen/MoQCapture.h"
+#include "moxygen/MoQFec.h"
+#include "moxygen/MoQLatencyProbe.h"
 #include "moxygen/MoQSession.h"
+#include "moxygen/relay/MoQAbrSwitcher.h"
+#include "moxygen/relay/MoQAnnounceQueue.h"
 #include "moxygen/relay/MoQCache.h"
+#include "moxygen/relay/MoQClusterRing.h"
+#include "moxygen/relay/MoQEvbProxies.h"
 #include "moxygen/relay/MoQForwarder.h"
+#include "moxygen/relay/MoQTrackMerger.h"
+#include "moxygen/relay/MoQUpstreamPool.h"
 
 #include <folly/container/F14Set.h>
 
+#include <deque>
+#include <map>
+
 namespace moxygen {
 
 class MoQRelay : public Publisher,
@@ -20,9 +32,15 @@ class MoQRelay : public Publisher,
                  public std::enable_shared_from_this<MoQRelay>,
                  public MoQForwarder::Callback {
  public:
-  explicit MoQRelay(bool enableCache) {
+  // If evb is set, all calls into the relay must be made on evb, and sessions
+  // living on other EventBases are reached through EvbProxies.
+  explicit MoQRelay(
+      bool enableCache,
+      MoQCache::Config cacheConfig = {},
+      folly::EventBase* evb = nullptr)
+      : evb_(evb) {
     if (enableCache) {
-      cache_ = std::make_unique<MoQCache>();
+      cache_ = std::make_unique<MoQCache>(cacheConfig);
     }
   }
 
@@ -30,6 +48,132 @@ class MoQRelay : public Publisher,
     allowedNamespacePrefix_ = std::move(allowed);
   }
 
+  // Reports forwarding latency for the relay's tracks
+  void setTrackStatsCallback(
+      std::shared_ptr<MoQTrackStatsCallback> trackStatsCallback) {
+    trackStatsCallback_ = std::move(trackStatsCallback);
+  }
+
+  // Tracks in namespaces nobody has announced are requested from origin
+  // through pool, which must run on the relay's EventBase.  Subscriptions
+  // whose pooled session is lost are resubscribed on a new one.
+  void setUpstreamOrigin(
+      proxygen::URL origin,
+      std::shared_ptr<MoQUpstreamPool> pool) {
+    upstreamOrigin_ = std::move(origin);
+    upstreamPool_ = std::move(pool);
+  }
+
+  // Keeps a track's upstream subscription for linger after its last
+  // subscriber leaves, so a subscriber rejoining within it is served at once
+  // and from a warm cache.  With pause, the upstream is asked to stop
+  // forwarding (forward=0) while the track lingers.  0 tears it down at once.
+  void setUpstreamLinger(std::chrono::milliseconds linger, bool pause) {
+    upstreamLinger_ = linger;
+    pauseLingeringUpstream_ = pause;
+  }
+
+  // A track's upstream subscription follows its subscribers: the most
+  // urgent subscriber priority, and forward=0 when none of them want
+  // objects.  Changes from their SUBSCRIBE_UPDATEs and departures are sent
+  // upstream as one SUBSCRIBE_UPDATE after debounce, or at the end of the
+  // loop iteration if it's 0.
+  void setSubscribeUpdateDebounce(std::chrono::milliseconds debounce) {
+    subscribeUpdateDebounce_ = debounce;
+  }
+
+  // Upstream answers that a track does not exist, or that a FETCH range is
+  // invalid, are remembered for ttl and repeated requests get the same
+  // error without going upstream.  0 disables.
+  void setNegativeCacheTtl(std::chrono::milliseconds ttl) {
+    negativeCacheTtl_ = ttl;
+  }
+
+  // Tracks under prefix also subscribe to a second session that announced
+  // their namespace, when there is one, and merge the two.  If either
+  // upstream goes away the other carries on with no gap, and another
+  // announcer becomes the new standby.
+  void setHotStandby(TrackNamespace prefix) {
+    hotStandbyPrefix_ = std::move(prefix);
+  }
+
+  // Adds XOR parity for every window of datagrams of each track to what is
+  // forwarded, see MoQFecEncoder, so subscribers can rebuild one lost
+  // datagram per window.  Tracks whose publisher adds parity are forwarded
+  // as they are.  0 disables, applies to tracks subscribed upstream after.
+  // Carrier and parity are kept within maxDatagramSize.
+  void setDatagramFec(
+      size_t window,
+      uint64_t maxDatagramSize = MoQFecEncoder::kDefaultMaxDatagramSize) {
+    datagramFecWindow_ = window;
+    datagramFecMaxSize_ = maxDatagramSize;
+  }
+
+  // Appends the time of arrival to the latency probes of tracks under
+  // prefix, see MoQLatencyProbeStamper.  Other tracks pay nothing.  Applies
+  // to tracks subscribed upstream after.
+  void setLatencyProbePrefix(TrackNamespace prefix) {
+    latencyProbePrefix_ = std::move(prefix);
+  }
+
+  // Records downstream requests, and the objects of tracks subscribed
+  // upstream after, to capture.  nullptr stops.
+  void setCapture(std::shared_ptr<MoQCaptureWriter> capture) {
+    capture_ = std::move(capture);
+  }
+
+  struct PinnedTrack {
+    // trackName is also pinned in every namespace announced under this one
+    TrackNamespace trackNamespace;
+    std::string trackName;
+  };
+  // Subscribes to pins upstream as if they had a subscriber and keeps them
+  // subscribed with none, so the cache is warm before the first viewer.  A
+  // pin is subscribed once its namespace is announced, or from the upstream
+  // origin on evb at once, and again retryInterval after it ends.  Only
+  // tracks owns accepts are pinned, all of them without it.  Call after
+  // setUpstreamOrigin.
+  static constexpr std::chrono::seconds kPinRetryInterval{5};
+  void setPinnedTracks(
+      std::vector<PinnedTrack> pins,
+      folly::EventBase* evb,
+      std::function<bool(const FullTrackName&)> owns = nullptr,
+      std::chrono::milliseconds retryInterval = kPinRetryInterval);
+
+  // Cluster mode: tracks nobody announced here are requested through the
+  // upstream pool from the peer ring says owns them, and only a track's
+  // owner, self, goes to the upstream origin.  Origin then sees one
+  // subscription per track for the whole cluster.  Call again with a new
+  // ring when membership changes, or nullptr to leave cluster mode.
+  void setClusterRing(
+      std::shared_ptr<const MoQClusterRing> ring,
+      std::string self) {
+    clusterRing_ = std::move(ring);
+    clusterSelf_ = std::move(self);
+  }
+
+  struct AbrRendition {
+    std::string trackName;
+    uint64_t bitrateBps{0};
+  };
+  // A virtual ABR track: subscribing to trackName in any namespace subscribes
+  // to each rendition in that namespace, and forwards one of them per group
+  // picked from the subscriber session's send rate and buffered bytes, see
+  // MoQAbrSwitcher.  The renditions must share group numbering.  Signals are
+  // only read for sessions on the relay's EventBase, others stay on the
+  // lowest rendition.
+  void setAbrTrack(
+      std::string trackName,
+      std::vector<AbrRendition> renditions,
+      MoQAbrSwitcher::Config config = {}) {
+    std::sort(
+        renditions.begin(), renditions.end(), [](const auto& a, const auto& b) {
+          return a.bitrateBps < b.bitrateBps;
+        });
+    abrTrack_ = AbrTrack{
+        std::move(trackName), std::move(renditions), config};
+  }
+
   folly::coro::Task<SubscribeResult> subscribe(
       SubscribeRequest subReq,
       std::shared_ptr<TrackConsumer> consumer) override;
@@ -38,6 +182,11 @@ class MoQRelay : public Publisher,
       Fetch fetch,
       std::shared_ptr<FetchConsumer> consumer) override;
 
+  // Answered from the track's live subscription or from a cached end of
+  // track when there is one, otherwise asked upstream
+  folly::coro::Task<TrackStatusResult> trackStatus(
+      TrackStatusRequest trackStatusRequest) override;
+
   folly::coro::Task<SubscribeAnnouncesResult> subscribeAnnounces(
       SubscribeAnnounces subAnn) override;
 
@@ -52,8 +201,95 @@ class MoQRelay : public Publisher,
     removeSession(MoQSession::getRequestSession());
   }
 
+  struct Stats {
+    // Tracks with an upstream subscription
+    uint64_t subscriptions{0};
+    // Downstream subscribers across all tracks
+    uint64_t subscribers{0};
+    // Subscribers attached while their track's upstream SUBSCRIBE is pending
+    uint64_t pendingSubscribers{0};
+    // First subscribers to a track, which send the SUBSCRIBE upstream
+    uint64_t upstreamSubscribes{0};
+    // Subscribers that joined a pending upstream SUBSCRIBE
+    uint64_t coalescedSubscribes{0};
+    // Upstream subscriptions kept after their last subscriber left
+    uint64_t lingeringSubscriptions{0};
+    // Subscribers that joined a lingering upstream subscription
+    uint64_t lingerRejoins{0};
+    // SUBSCRIBE_UPDATEs sent upstream for changes in subscriber demand
+    uint64_t upstreamSubscribeUpdates{0};
+    // Tracks with a hot standby subscription
+    uint64_t standbySubscriptions{0};
+    // Tracks whose standby took over from a lost upstream
+    uint64_t standbyFailovers{0};
+    // Objects the current hot standby subscriptions dropped because the
+    // other upstream delivered them first
+    uint64_t standbyDuplicates{0};
+    // SUBSCRIBEs and FETCHes refused with an upstream error cached earlier
+    uint64_t negativeCacheHits{0};
+    // Tracks with a cached upstream error
+    uint64_t negativeCacheEntries{0};
+    // TRACK_STATUS requests answered without asking upstream
+    uint64_t localTrackStatuses{0};
+    uint64_t upstreamTrackStatuses{0};
+    // Upstream requests sent to the owning peer rather than to origin
+    uint64_t peerRequests{0};
+    // Subscribers to the ABR track
+    uint64_t abrSubscribes{0};
+    // Datagrams too large for a subscriber's path, sent on a stream
+    uint64_t datagramStreamFallbacks{0};
+    // Pinned tracks subscribed or subscribing upstream
+    uint64_t pinnedTracks{0};
+    uint64_t cachedBytes{0};
+    uint64_t cachedGroups{0};
+    // Bytes the subscriber sessions have queued for the relay's tracks
+    uint64_t subscriberBufferedBytes{0};
+    MoQCache::Stats cache;
+
+    Stats& operator+=(const Stats& other);
+  };
+
+  // Must be called on the relay's EventBase
+  Stats getStats() const;
+
+  // Memory held for one track across the cache and its subscribers
+  struct TrackMemory {
+    FullTrackName fullTrackName;
+    uint64_t cachedBytes{0};
+    // Queued by the subscriber sessions and not yet written
+    uint64_t bufferedBytes{0};
+
+    uint64_t total() const {
+      return cachedBytes + bufferedBytes;
+    }
+  };
+
+  // Memory held by a session the relay publishes to or subscribes from
+  struct SessionMemory {
+    const MoQSession* session{nullptr};
+    MoQMemoryUsage usage;
+  };
+
+  struct MemoryReport {
+    std::vector<TrackMemory> tracks;
+    std::vector<SessionMemory> sessions;
+
+    MemoryReport& operator+=(MemoryReport other);
+
+    // The maxEntries largest tracks and sessions, one per line, for finding
+    // what holds a relay's memory
+    std::string dump(size_t maxEntries) const;
+  };
+
+  // Must be called on the relay's EventBase.  Sessions on other EventBases
+  // are left out.
+  MemoryReport getMemoryReport() const;
+
  private:
   class AnnouncesSubscription;
+  class AnnounceSource;
+  class PooledUpstreamConsumer;
+  class AbrSubscription;
   void unsubscribeAnnounces(
       const TrackNamespace& prefix,
       std::shared_ptr<MoQSession> session);
@@ -62,11 +298,25 @@ class MoQRelay : public Publisher,
     explicit AnnounceNode(MoQRelay& relay) : relay_(relay) {}
 
     void unannounce() override {
-      relay_.unannounce(announceOk().trackNamespace, this);
+      relay_.unannounce(announceOk().trackNamespace, this, sourceSession);
     }
 
     using Subscriber::AnnounceHandle::setAnnounceOk;
 
+    // True if nothing is announced or subscribed at this node
+    bool isIdle() const {
+      return !sourceSession && sessions.empty() && announcements.empty();
+    }
+
+    // Removes the child at key if it is idle and has no children, or merges
+    // it into its only child if it is idle
+    void pruneChild(const std::string& key);
+
+    // The namespace is a radix trie: chains of nodes with a single child and
+    // nothing announced or subscribed are collapsed into one edge.  label is
+    // the tuple elements on the edge from the parent, and children are keyed
+    // by the first element of their label.
+    std::vector<std::string> label;
     folly::F14FastMap<std::string, std::shared_ptr<AnnounceNode>> children;
     // Sessions with a SUBSCRIBE_ANNOUNCES here
     folly::F14FastSet<std::shared_ptr<MoQSession>> sessions;
@@ -76,14 +326,35 @@ class MoQRelay : public Publisher,
             announcements;
     // The session that ANNOUNCEd this node
     std::shared_ptr<MoQSession> sourceSession;
+    // Earlier announcers of the node, the most recent takes over when
+    // sourceSession leaves
+    std::vector<std::shared_ptr<MoQSession>> standbySources;
     MoQRelay& relay_;
   };
   AnnounceNode announceRoot_{*this};
+  // Returns the node for ns, splitting edges and adding nodes as needed if
+  // createMissingNodes is set.  sessions collects the SUBSCRIBE_ANNOUNCES
+  // sessions of strict prefixes of ns, and path the nodes walked through,
+  // ending with the returned node.
   std::shared_ptr<AnnounceNode> findNamespaceNode(
       const TrackNamespace& ns,
       bool createMissingNodes,
-      std::vector<std::shared_ptr<MoQSession>>* sessions = nullptr);
+      std::vector<std::shared_ptr<MoQSession>>* sessions = nullptr,
+      std::vector<AnnounceNode*>* path = nullptr);
+  // Removes the node for ns and its idle ancestors from the tree once they
+  // are no longer needed
+  void pruneNamespace(const TrackNamespace& ns);
+  void pruneAnnounceTree(AnnounceNode& node);
   std::shared_ptr<MoQSession> findAnnounceSession(const TrackNamespace& ns);
+  // Another session announcing ns, besides exclude
+  std::shared_ptr<MoQSession> findStandbySession(
+      const TrackNamespace& ns,
+      const std::shared_ptr<MoQSession>& exclude);
+  // Drops session as a source of node, promoting a standby source if any.
+  // Returns true if the namespace is no longer announced.
+  bool removeAnnounceSource(
+      AnnounceNode& node,
+      const std::shared_ptr<MoQSession>& session);
 
   struct RelaySubscription {
     RelaySubscription(
@@ -93,29 +364,201 @@ class MoQRelay : public Publisher,
 
     std::shared_ptr<MoQForwarder> forwarder;
     std::shared_ptr<MoQSession> upstream;
+    // What was sent upstream, for resubscribing
+    SubscribeRequest request;
     RequestID requestID{0};
     std::shared_ptr<Publisher::SubscriptionHandle> handle;
     folly::coro::SharedPromise<folly::Unit> promise;
+    // Joined before the upstream SUBSCRIBE_OK, which completes them
+    std::vector<std::shared_ptr<MoQForwarder::Subscriber>> pendingSubscribers;
+    // Set while the subscription lingers with no subscribers
+    folly::Optional<uint64_t> lingerID;
+    // Last priority and forward sent upstream
+    uint8_t upstreamPriority{kDefaultPriority};
+    bool upstreamForward{true};
+    bool updateScheduled{false};
+    // With hot standby, both upstreams publish into merger
+    std::shared_ptr<MoQTrackMerger> merger;
+    std::shared_ptr<MoQSession> standby;
+    std::shared_ptr<Publisher::SubscriptionHandle> standbyHandle;
   };
 
+  bool wantsHotStandby(const FullTrackName& ftn) const {
+    return hotStandbyPrefix_ &&
+        ftn.trackNamespace.startsWith(*hotStandbyPrefix_);
+  }
+  // Subscribes to another announcer of ftn if it has none yet
+  void startStandby(const FullTrackName& ftn);
+  folly::coro::Task<void> addStandby(FullTrackName ftn);
+  void unsubscribeUpstream(RelaySubscription& subscription);
+
+  void onSubscribersChanged(MoQForwarder* forwarder) override;
+  void onDatagramStreamFallback(MoQForwarder*) override {
+    datagramStreamFallbacks_++;
+  }
+  // Sends a SUBSCRIBE_UPDATE if the subscribers need a different priority or
+  // forward than the upstream has
+  void updateUpstream(RelaySubscription& subscription);
+  // Brings a lingering subscription back for a new subscriber
+  void endLinger(RelaySubscription& subscription);
+  // Unsubscribes upstream if the track is still lingering under lingerID
+  void onLingerTimeout(const FullTrackName& ftn, uint64_t lingerID);
+
   void onEmpty(MoQForwarder* forwarder) override;
 
-  folly::coro::Task<void> announceToSession(
+  // subscribe() for session, null for the relay's own pins
+  folly::coro::Task<SubscribeResult> subscribeFrom(
       std::shared_ptr<MoQSession> session,
+      SubscribeRequest subReq,
+      std::shared_ptr<TrackConsumer> consumer);
+
+  class PinConsumer;
+  // Pins the tracks under ns, as it was just announced
+  void pinAnnounced(const TrackNamespace& ns, folly::EventBase* evb);
+  folly::coro::Task<void> pinTrack(FullTrackName ftn);
+  // The pinned subscription to ftn ended, pin it again
+  void onPinEnded(const FullTrackName& ftn);
+
+  // An upstream error remembered for a track, see setNegativeCacheTtl
+  struct NegativeEntry {
+    std::chrono::steady_clock::time_point expires;
+    // Else only FETCHes of invalidRange fail
+    bool trackNotExist{false};
+    folly::Optional<std::pair<AbsoluteLocation, AbsoluteLocation>>
+        invalidRange;
+    std::string reason;
+  };
+  static constexpr size_t kMaxNegativeEntries = 16 * 1024;
+  // The unexpired entry for ftn, if any
+  const NegativeEntry* findNegative(const FullTrackName& ftn);
+  void cacheNegative(const FullTrackName& ftn, NegativeEntry entry);
+  void eraseNegative(const FullTrackName& ftn);
+  // Drops the entries for tracks under ns, which was just announced
+  void invalidateNegative(const TrackNamespace& ns);
+  // Returns the cached error that answers fetch, if any
+  folly::Optional<FetchError> negativeFetchError(const Fetch& fetch);
+  // Remembers an upstream error for fetch if it can be cached
+  void onUpstreamFetchError(const Fetch& fetch, const FetchError& error);
+
+  folly::coro::Task<SubscribeResult> subscribeAbr(
+      SubscribeRequest subReq,
+      std::shared_ptr<TrackConsumer> consumer);
+
+  // Returns a pooled session to ftn's owner in cluster mode, else to the
+  // upstream origin, if one is configured
+  folly::coro::Task<std::shared_ptr<MoQSession>> getPooledSession(
+      const FullTrackName& ftn);
+
+  // What the upstream subscription for ftn publishes into
+  std::shared_ptr<TrackConsumer> getUpstreamConsumer(
+      const FullTrackName& ftn,
+      std::shared_ptr<MoQForwarder> forwarder,
+      bool pooled);
+
+  // Moves a subscription to a new pooled session after its session closed.
+  // Ends the subscription with subDone if that fails.
+  folly::coro::Task<void> resubscribe(FullTrackName ftn, SubscribeDone subDone);
+
+  // ANNOUNCEs to a SUBSCRIBE_ANNOUNCES session go through its queue
+  void queueAnnounce(
+      const std::shared_ptr<MoQSession>& session,
       Announce ann,
       std::shared_ptr<AnnounceNode> nodePtr);
 
-  void unannounce(const TrackNamespace& trackNamespace, AnnounceNode* node);
+  void unannounce(
+      const TrackNamespace& trackNamespace,
+      AnnounceNode* node,
+      const std::shared_ptr<MoQSession>& session);
 
+  // Returns an interface for issuing requests to an upstream session from
+  // the relay's EventBase
+  std::shared_ptr<Publisher> getUpstream(std::shared_ptr<MoQSession> session);
+
+  folly::EventBase* relayEvb(const std::shared_ptr<MoQSession>& session) const {
+    return evb_ ? evb_ : session->getEventBase();
+  }
+
+  folly::EventBase* evb_{nullptr};
   TrackNamespace allowedNamespacePrefix_;
+  std::shared_ptr<MoQTrackStatsCallback> trackStatsCallback_;
+  folly::Optional<proxygen::URL> upstreamOrigin_;
+  std::shared_ptr<MoQUpstreamPool> upstreamPool_;
+  std::shared_ptr<const MoQClusterRing> clusterRing_;
+  std::string clusterSelf_;
+  uint64_t peerRequests_{0};
+  folly::F14FastMap<MoQSession*, std::shared_ptr<MoQAnnounceQueue>>
+      announceQueues_;
   folly::F14FastMap<FullTrackName, RelaySubscription, FullTrackName::hash>
       subscriptions_;
+  uint64_t upstreamSubscribes_{0};
+  uint64_t coalescedSubscribes_{0};
+  std::chrono::milliseconds upstreamLinger_{0};
+  bool pauseLingeringUpstream_{false};
+  uint64_t nextLingerID_{0};
+  uint64_t lingerRejoins_{0};
+  std::chrono::milliseconds subscribeUpdateDebounce_{0};
+  size_t datagramFecWindow_{0};
+  uint64_t datagramFecMaxSize_{MoQFecEncoder::kDefaultMaxDatagramSize};
+  folly::Optional<TrackNamespace> latencyProbePrefix_;
+  std::shared_ptr<MoQCaptureWriter> capture_;
+  uint64_t upstreamSubscribeUpdates_{0};
+  folly::Optional<TrackNamespace> hotStandbyPrefix_;
+  uint64_t standbyFailovers_{0};
+  uint64_t localTrackStatuses_{0};
+  std::chrono::milliseconds negativeCacheTtl_{0};
+  folly::F14FastMap<FullTrackName, NegativeEntry, FullTrackName::hash>
+      negativeCache_;
+  // Expiry and name of each entry in the order cached, which with one TTL is
+  // expiry order.  Refreshed or erased entries leave a stale record behind.
+  std::deque<std::pair<std::chrono::steady_clock::time_point, FullTrackName>>
+      negativeExpiry_;
+  // Names of the cached tracks by namespace, ordered so the namespaces
+  // under an announced one are adjacent
+  std::map<TrackNamespace, folly::F14FastSet<std::string>>
+      negativeNamespaces_;
+  uint64_t negativeCacheHits_{0};
+  uint64_t upstreamTrackStatuses_{0};
+  struct AbrTrack {
+    std::string trackName;
+    std::vector<AbrRendition> renditions;
+    MoQAbrSwitcher::Config config;
+  };
+  folly::Optional<AbrTrack> abrTrack_;
+  uint64_t abrSubscribes_{0};
+  uint64_t datagramStreamFallbacks_{0};
+  std::vector<PinnedTrack> pins_;
+  folly::EventBase* pinEvb_{nullptr};
+  std::function<bool(const FullTrackName&)> ownsPin_;
+  std::chrono::milliseconds pinRetryInterval_{kPinRetryInterval};
+  folly::F14FastSet<FullTrackName, FullTrackName::hash> pinnedTracks_;
 
   std::shared_ptr<TrackConsumer> getSubscribeWriteback(
       const FullTrackName& ftn,
-      std::shared_ptr<TrackConsumer> consumer) {
-    return cache_ ? cache_->getSubscribeWriteback(ftn, std::move(consumer))
-                  : consumer;
+      std::shared_ptr<MoQForwarder> forwarder) {
+    std::weak_ptr<MoQForwarder> weakForwarder = forwarder;
+    std::shared_ptr<TrackConsumer> consumer = std::move(forwarder);
+    if (datagramFecWindow_ > 0) {
+      // After the cache, which keeps the objects without parity
+      consumer = std::make_shared<MoQFecEncoder>(
+          std::move(consumer), datagramFecWindow_, datagramFecMaxSize_);
+    }
+    if (cache_) {
+      consumer = cache_->getSubscribeWriteback(
+          ftn, std::move(consumer), [weakForwarder]() -> size_t {
+            auto forwarder = weakForwarder.lock();
+            return forwarder ? forwarder->numSubscribers() : 0;
+          });
+    }
+    if (latencyProbePrefix_ &&
+        ftn.trackNamespace.startsWith(*latencyProbePrefix_)) {
+      // Ahead of the cache, so probes served from it carry this hop too
+      consumer = std::make_shared<MoQLatencyProbeStamper>(std::move(consumer));
+    }
+    if (capture_) {
+      // Outermost, to record what upstream sent
+      consumer = capture_->recordObjects(ftn, std::move(consumer));
+    }
+    return consumer;
   }
   std::unique_ptr<MoQCache> cache_;
 };
@@ -54,7 +54,7 @@ class MoQRelayClient {
             break;
           }
           Announce ann;
-          ann.trackNamespace.trackNamespace.push_back("ping");
+          ann.trackNamespace.append("ping");
           auto handle = co_await moqClient_->moqSession_->announce(ann);
           if (handle.hasError()) {
             break;
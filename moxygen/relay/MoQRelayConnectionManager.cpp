@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/relay/MoQRelayConnectionManager.h"
+
+#include <folly/coro/Sleep.h>
+#include <folly/coro/Timeout.h>
+#include <folly/futures/ThreadWheelTimekeeper.h>
+
+namespace moxygen {
+
+MoQRelayConnectionManager::MoQRelayConnectionManager(
+    folly::EventBase* evb,
+    std::vector<proxygen::URL> relays,
+    Config config,
+    ClientFactory clientFactory)
+    : evb_(evb), config_(config), clientFactory_(std::move(clientFactory)) {
+  relays_.reserve(relays.size());
+  for (auto& url : relays) {
+    relays_.emplace_back(std::move(url));
+  }
+  if (!clientFactory_) {
+    clientFactory_ = [](folly::EventBase* evb, proxygen::URL url) {
+      return std::make_unique<MoQClient>(evb, std::move(url));
+    };
+  }
+}
+
+void MoQRelayConnectionManager::start(
+    std::shared_ptr<Publisher> publisher,
+    std::shared_ptr<Subscriber> subscriber,
+    std::vector<TrackNamespace> namespaces) {
+  publisher_ = std::move(publisher);
+  subscriber_ = std::move(subscriber);
+  namespaces_ = std::move(namespaces);
+  maintain();
+  if (config_.healthCheckInterval.count() > 0) {
+    spawn(healthCheckLoop());
+  }
+}
+
+std::shared_ptr<MoQSession> MoQRelayConnectionManager::getSession() const {
+  return active_ ? session(*active_) : nullptr;
+}
+
+std::shared_ptr<MoQSession> MoQRelayConnectionManager::session(
+    size_t index) const {
+  const auto& relay = relays_[index];
+  if (!relay.client || !relay.client->moqSession_) {
+    return nullptr;
+  }
+  return relay.client->moqSession_;
+}
+
+void MoQRelayConnectionManager::spawn(folly::coro::Task<void> task) {
+  folly::coro::co_withCancellation(
+      cancellationSource_.getToken(),
+      folly::coro::co_invoke(
+          [self = shared_from_this(),
+           task = std::move(task)]() mutable -> folly::coro::Task<void> {
+            co_await std::move(task);
+          }))
+      .scheduleOn(evb_)
+      .start();
+}
+
+void MoQRelayConnectionManager::maintain() {
+  if (cancellationSource_.isCancellationRequested()) {
+    return;
+  }
+  if (!active_) {
+    for (size_t i = 0; i < relays_.size(); i++) {
+      if (session(i)) {
+        activate(i);
+        break;
+      }
+    }
+  }
+  size_t wanted = 1 + config_.warmSpares;
+  size_t open = 0;
+  for (size_t i = 0; i < relays_.size(); i++) {
+    if (relays_[i].connecting || session(i)) {
+      open++;
+    }
+  }
+  for (size_t i = 0; i < relays_.size() && open < wanted; i++) {
+    auto& relay = relays_[i];
+    if (relay.connecting || relay.backoff || relay.client) {
+      continue;
+    }
+    open++;
+    relay.connecting = true;
+    spawn(connect(i));
+  }
+}
+
+folly::coro::Task<void> MoQRelayConnectionManager::connect(size_t index) {
+  auto& relay = relays_[index];
+  auto client = clientFactory_(evb_, relay.url);
+  XLOG(DBG1) << "Connecting to relay " << relay.url.getUrl();
+  try {
+    co_await client->setupMoQSession(
+        config_.connectTimeout,
+        config_.transactionTimeout,
+        publisher_,
+        subscriber_);
+  } catch (const std::exception& ex) {
+    XLOG(ERR) << "Relay connect to " << relay.url.getUrl()
+              << " failed err=" << folly::exceptionStr(ex);
+  }
+  relay.connecting = false;
+  auto session = client->moqSession_;
+  if (!session || cancellationSource_.isCancellationRequested()) {
+    if (session) {
+      session->close(SessionCloseErrorCode::NO_ERROR);
+    }
+    // The transport may still call into the client from this loop
+    evb_->runInEventBaseThread([client = std::move(client)] {});
+    if (cancellationSource_.isCancellationRequested()) {
+      co_return;
+    }
+    relay.backoff = true;
+    // Another relay can be tried meanwhile
+    maintain();
+    co_await folly::coro::co_awaitTry(
+        folly::coro::sleep(config_.reconnectDelay));
+    relay.backoff = false;
+    maintain();
+    co_return;
+  }
+  XLOG(INFO) << "Connected to relay " << relay.url.getUrl();
+  auto generation = ++relay.generation;
+  // Closing runs inside the client's session teardown, so handle it later
+  relay.onClose = std::make_unique<folly::CancellationCallback>(
+      session->getCancelToken(),
+      [evb = evb_,
+       weakSelf = std::weak_ptr<MoQRelayConnectionManager>(shared_from_this()),
+       index,
+       generation] {
+        evb->runInEventBaseThread([weakSelf, index, generation] {
+          if (auto self = weakSelf.lock()) {
+            self->onClosed(index, generation);
+          }
+        });
+      });
+  relay.client = std::move(client);
+  maintain();
+}
+
+void MoQRelayConnectionManager::onClosed(size_t index, uint64_t generation) {
+  auto& relay = relays_[index];
+  if (relay.generation != generation || !relay.client) {
+    return;
+  }
+  XLOG(WARN) << "Relay session to " << relay.url.getUrl() << " closed";
+  relay.announceHandles.clear();
+  relay.onClose.reset();
+  evb_->runInEventBaseThread([client = std::move(relay.client)] {});
+  if (active_ == index) {
+    active_.reset();
+  }
+  maintain();
+}
+
+void MoQRelayConnectionManager::activate(size_t index) {
+  XLOG(INFO) << "Publishing through relay " << relays_[index].url.getUrl();
+  active_ = index;
+  spawn(announce(index));
+}
+
+folly::coro::Task<void> MoQRelayConnectionManager::announce(size_t index) {
+  auto& relay = relays_[index];
+  auto generation = relay.generation;
+  auto session = this->session(index);
+  // could parallelize
+  for (const auto& ns : namespaces_) {
+    if (!session || relay.generation != generation) {
+      co_return;
+    }
+    Announce ann;
+    ann.trackNamespace = ns;
+    auto res = co_await session->announce(std::move(ann));
+    if (relay.generation != generation || active_ != index) {
+      // Lost or replaced while announcing
+      if (res) {
+        res.value()->unannounce();
+      }
+      co_return;
+    }
+    if (!res) {
+      XLOG(ERR) << "AnnounceError namespace=" << res.error().trackNamespace
+                << " code=" << folly::to_underlying(res.error().errorCode)
+                << " reason=" << res.error().reasonPhrase;
+    } else {
+      relay.announceHandles.emplace_back(std::move(res.value()));
+    }
+  }
+}
+
+void MoQRelayConnectionManager::failover(
+    const std::shared_ptr<MoQSession>& session) {
+  if (!active_ || this->session(*active_) != session) {
+    return;
+  }
+  auto old = *active_;
+  folly::Optional<size_t> next;
+  for (size_t i = 0; i < relays_.size(); i++) {
+    if (i != old && this->session(i)) {
+      next = i;
+      break;
+    }
+  }
+  if (!next) {
+    XLOG(WARN) << "No spare relay to fail over to from "
+               << relays_[old].url.getUrl();
+    return;
+  }
+  for (auto& handle : relays_[old].announceHandles) {
+    handle->unannounce();
+  }
+  relays_[old].announceHandles.clear();
+  activate(*next);
+  // onClosed reconnects it as a spare
+  session->close(SessionCloseErrorCode::NO_ERROR);
+}
+
+folly::coro::Task<void> MoQRelayConnectionManager::healthCheckLoop() {
+  folly::EventBaseThreadTimekeeper tk(*evb_);
+  while (!cancellationSource_.isCancellationRequested()) {
+    co_await folly::coro::co_awaitTry(
+        folly::coro::sleep(config_.healthCheckInterval));
+    for (size_t i = 0; i < relays_.size(); i++) {
+      auto session = this->session(i);
+      if (!session || cancellationSource_.isCancellationRequested()) {
+        continue;
+      }
+      // An ANNOUNCE round trip shows the relay is still serving requests,
+      // even when it answers with an error
+      Announce ann;
+      ann.trackNamespace.append("ping");
+      auto res = co_await folly::coro::co_awaitTry(folly::coro::timeout(
+          session->announce(std::move(ann)), config_.healthCheckTimeout, &tk));
+      if (res.hasException()) {
+        if (cancellationSource_.isCancellationRequested()) {
+          co_return;
+        }
+        XLOG(WARN) << "Relay " << relays_[i].url.getUrl()
+                   << " failed health check err="
+                   << folly::exceptionStr(res.exception());
+        session->close(SessionCloseErrorCode::INTERNAL_ERROR);
+      } else if (res->hasValue()) {
+        res->value()->unannounce();
+      }
+    }
+  }
+}
+
+void MoQRelayConnectionManager::shutdown() {
+  cancellationSource_.requestCancellation();
+  active_.reset();
+  for (size_t i = 0; i < relays_.size(); i++) {
+    auto& relay = relays_[i];
+    for (auto& handle : relay.announceHandles) {
+      handle->unannounce();
+    }
+    relay.announceHandles.clear();
+    if (auto session = this->session(i)) {
+      session->close(SessionCloseErrorCode::NO_ERROR);
+    }
+  }
+}
+
+} // namespace moxygen
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/CancellationToken.h>
+#include <moxygen/MoQClient.h>
+
+namespace moxygen {
+
+// Keeps sessions handshaken to a list of relays, so a publisher doesn't wait
+// for a connection when it starts or when its relay fails.  The first relay
+// to connect becomes active and receives the ANNOUNCEs, and up to warmSpares
+// others are kept connected beside it.  When the active session closes or
+// fails a health check, the next connected relay in list order takes over,
+// and the lost one is reconnected in the background.
+//
+// All calls must be made on evb.
+class MoQRelayConnectionManager
+    : public std::enable_shared_from_this<MoQRelayConnectionManager> {
+ public:
+  struct Config {
+    std::chrono::milliseconds connectTimeout{std::chrono::seconds(5)};
+    std::chrono::milliseconds transactionTimeout{std::chrono::seconds(60)};
+    // How often each open session is probed, 0 to disable
+    std::chrono::milliseconds healthCheckInterval{std::chrono::seconds(5)};
+    // A probe taking longer than this closes the session
+    std::chrono::milliseconds healthCheckTimeout{std::chrono::seconds(2)};
+    // Wait before retrying a relay that could not be reached
+    std::chrono::milliseconds reconnectDelay{std::chrono::seconds(1)};
+    // Relays besides the active one to keep a session open to
+    uint32_t warmSpares{1};
+  };
+
+  using ClientFactory = std::function<std::unique_ptr<MoQClient>(
+      folly::EventBase*,
+      proxygen::URL)>;
+
+  MoQRelayConnectionManager(
+      folly::EventBase* evb,
+      std::vector<proxygen::URL> relays,
+      Config config,
+      ClientFactory clientFactory = nullptr);
+
+  // Connects, and keeps namespaces announced on the active relay until
+  // shutdown.  publisher and subscriber handle requests on every session.
+  void start(
+      std::shared_ptr<Publisher> publisher,
+      std::shared_ptr<Subscriber> subscriber,
+      std::vector<TrackNamespace> namespaces);
+
+  // The active relay's session, nullptr while none is connected
+  std::shared_ptr<MoQSession> getSession() const;
+
+  // Moves to the next connected relay if session is the active one, e.g.
+  // when it sends GOAWAY.  Without a spare the session is kept.
+  void failover(const std::shared_ptr<MoQSession>& session);
+
+  void shutdown();
+
+ private:
+  struct Relay {
+    explicit Relay(proxygen::URL u) : url(std::move(u)) {}
+
+    proxygen::URL url;
+    std::unique_ptr<MoQClient> client;
+    std::unique_ptr<folly::CancellationCallback> onClose;
+    std::vector<std::shared_ptr<Subscriber::AnnounceHandle>> announceHandles;
+    bool connecting{false};
+    // Waiting out reconnectDelay after a failed connect
+    bool backoff{false};
+    // Bumped on each connection, to ignore callbacks for an old one
+    uint64_t generation{0};
+  };
+
+  folly::coro::Task<void> connect(size_t index);
+  folly::coro::Task<void> announce(size_t index);
+  folly::coro::Task<void> healthCheckLoop();
+  // Runs task on evb, keeping the manager alive until it finishes
+  void spawn(folly::coro::Task<void> task);
+  void onClosed(size_t index, uint64_t generation);
+  // Picks an active relay and connects more until enough are warm
+  void maintain();
+  void activate(size_t index);
+  std::shared_ptr<MoQSession> session(size_t index) const;
+
+  folly::EventBase* evb_;
+  std::vector<Relay> relays_;
+  Config config_;
+  ClientFactory clientFactory_;
+  std::shared_ptr<Publisher> publisher_;
+  std::shared_ptr<Subscriber> subscriber_;
+  std::vector<TrackNamespace> namespaces_;
+  folly::Optional<size_t> active_;
+  folly::CancellationSource cancellationSource_;
+};
+
+} // namespace moxygen
@@ -5,9 +5,27 @@
  */
 
 #include "moxygen/MoQServer.h"
+#include "moxygen/moq_mi/MoQMi.h"
 #include "moxygen/relay/MoQRelay.h"
+#include "moxygen/relay/MoQShardedRelay.h"
+#include "moxygen/stats/MoQSessionStats.h"
+#include "moxygen/stats/PrometheusWriter.h"
+#include "moxygen/util/Trace.h"
 
+#include <folly/String.h>
+#include <folly/coro/BlockingWait.h>
+#include <folly/coro/Invoke.h>
+#include <folly/Synchronized.h>
+#include <folly/container/F14Set.h>
 #include <folly/init/Init.h>
+#include <folly/io/async/AsyncSignalHandler.h>
+#include <proxygen/httpserver/HTTPServer.h>
+#include <proxygen/httpserver/RequestHandler.h>
+#include <proxygen/httpserver/RequestHandlerFactory.h>
+#include <proxygen/httpserver/ResponseBuilder.h>
+
+#include <algorithm>
+#include <thread>
 
 using namespace proxygen;
 
@@ -16,27 +34,1016 @@ DEFINE_string(key, "", "Key path");
 DEFINE_string(endpoint, "/moq-relay", "End point");
 DEFINE_int32(port, 9668, "Relay Server Port");
 DEFINE_bool(enable_cache, false, "Enable relay cache");
+DEFINE_uint64(
+    cache_max_bytes,
+    0,
+    "Maximum bytes held by the relay cache, 0 for no limit");
+DEFINE_uint64(
+    cache_max_groups_per_track,
+    0,
+    "Maximum groups cached per track, 0 for no limit");
+DEFINE_uint64(
+    cache_default_duration_ms,
+    0,
+    "Cache duration for tracks without MAX_CACHE_DURATION, 0 for no limit");
+DEFINE_string(
+    cache_disk_dir,
+    "",
+    "Directory for the cache's disk tier, which keeps completed groups "
+    "across evictions and restarts.  Empty to cache in memory only");
+DEFINE_uint64(
+    cache_read_ahead_groups,
+    0,
+    "Groups to FETCH ahead of sequential FETCHes into the cache, 0 to "
+    "disable read-ahead");
+DEFINE_uint64(
+    cache_fetch_chunk_groups,
+    0,
+    "Split upstream FETCHes for longer cache misses into parallel FETCHes "
+    "of this many groups, 0 to disable");
+DEFINE_uint32(
+    cache_max_parallel_fetches,
+    4,
+    "Upstream FETCHes in flight at once for one split cache miss");
+DEFINE_uint64(
+    cache_payload_slab_kb,
+    0,
+    "Copy cached payloads that arrived fragmented or in oversized buffers "
+    "into slabs of this many KB, 0 to cache them as they arrived");
+DEFINE_bool(
+    cache_payload_hugepages,
+    false,
+    "Back the cache's payload slabs with 2MB transparent hugepages");
+DEFINE_uint32(
+    cache_admission_min_subscribers,
+    0,
+    "Cache groups of subscribed tracks only when they have at least this "
+    "many subscribers at the relay");
+DEFINE_bool(
+    cache_admission_tinylfu,
+    false,
+    "Once the cache is near cache_max_bytes, cache a new group only if its "
+    "track is requested more often than the track it would evict");
+DEFINE_string(
+    cache_never_namespaces,
+    "",
+    "Comma separated namespace prefixes, '/' delimited, whose subscribed "
+    "tracks are never cached");
+DEFINE_string(
+    cache_always_namespaces,
+    "",
+    "Comma separated namespace prefixes, '/' delimited, whose subscribed "
+    "tracks are always cached");
+DEFINE_bool(
+    cache_gop_index,
+    false,
+    "Index cached MoQ-MI video keyframes by presentation time");
+DEFINE_uint32(
+    worker_threads,
+    1,
+    "Number of worker threads.  With more than one, relay state is sharded "
+    "by track across the workers");
+DEFINE_string(
+    shard_by,
+    "track",
+    "How tracks are placed on workers: 'track' spreads them by track name, "
+    "'namespace' keeps each namespace on one worker");
+DEFINE_uint64(
+    subscription_buffer_bytes,
+    0,
+    "Maximum bytes buffered per downstream subscription, 0 for no limit");
+DEFINE_uint64(
+    session_buffer_bytes,
+    0,
+    "Maximum bytes buffered per downstream session, 0 for no limit");
+DEFINE_bool(
+    skip_groups_when_too_far_behind,
+    false,
+    "Subscribers over their buffer limit skip to the next group instead of "
+    "being unsubscribed");
+DEFINE_uint32(
+    write_coalescing_us,
+    0,
+    "Hold small objects on downstream subgroups up to this long to write "
+    "them together, 0 to write each object as it arrives");
+DEFINE_bool(
+    egress_scheduling,
+    false,
+    "Order writes to downstream sessions by subscriber and publisher "
+    "priority in the relay instead of the transport");
+DEFINE_uint64(
+    egress_window_bytes,
+    0,
+    "With egress_scheduling, undelivered bytes per downstream session past "
+    "which lower precedence writes wait, 0 for no limit");
+DEFINE_bool(
+    fetch_below_live,
+    false,
+    "Send downstream FETCH streams only when no subscription has data "
+    "waiting");
+DEFINE_uint32(
+    session_max_fetches,
+    0,
+    "FETCHes served at once per downstream session, later ones wait, 0 for "
+    "no limit");
+DEFINE_uint64(
+    session_fetch_bytes_per_sec,
+    0,
+    "FETCH bytes written per second per downstream session, 0 for no limit");
+DEFINE_uint32(
+    relay_max_fetches,
+    0,
+    "FETCHes served at once across downstream sessions, which also bounds "
+    "the upstream FETCHes of cache misses, 0 for no limit");
+DEFINE_uint64(
+    relay_fetch_bytes_per_sec,
+    0,
+    "FETCH bytes written per second across downstream sessions, 0 for no "
+    "limit");
+DEFINE_string(
+    upstream_url,
+    "",
+    "Origin to subscribe and fetch from for namespaces nobody has announced, "
+    "for running this relay as an edge");
+DEFINE_uint32(
+    upstream_linger_ms,
+    0,
+    "Keep a track's upstream subscription this long after its last "
+    "subscriber leaves, 0 to unsubscribe at once");
+DEFINE_bool(
+    pause_lingering_upstream,
+    false,
+    "Ask the upstream to stop forwarding lingering tracks");
+DEFINE_uint32(
+    subscribe_update_debounce_ms,
+    0,
+    "Wait this long to combine subscriber changes into one upstream "
+    "SUBSCRIBE_UPDATE, 0 for the end of the event loop iteration");
+DEFINE_uint32(
+    negative_cache_ttl_ms,
+    0,
+    "Answer SUBSCRIBEs and FETCHes for tracks upstream said do not exist, "
+    "and FETCHes of ranges it said are invalid, from the relay for this "
+    "long, 0 to always ask upstream");
+DEFINE_uint32(
+    datagram_fec_window,
+    0,
+    "Add XOR parity for every this many datagrams of a track, so subscribers "
+    "can rebuild one lost per window, 0 to disable");
+DEFINE_uint32(
+    datagram_fec_max_size,
+    moxygen::MoQFecEncoder::kDefaultMaxDatagramSize,
+    "Largest datagram, parity included, sent with datagram_fec_window");
+DEFINE_string(
+    pinned_tracks,
+    "",
+    "Comma separated namespace:track pairs, namespaces '/' delimited, kept "
+    "subscribed upstream with no subscribers.  The track is also pinned in "
+    "namespaces announced under the namespace");
+DEFINE_string(
+    hot_standby_prefix,
+    "",
+    "Tracks under this /-separated namespace prefix also subscribe to a "
+    "second announcer, to switch over without a gap if one fails");
+DEFINE_string(
+    latency_probe_prefix,
+    "",
+    "Append this relay's timestamp to the latency probes of tracks under this "
+    "/-separated namespace prefix, empty to disable");
+DEFINE_uint32(
+    upstream_max_sessions,
+    4,
+    "Sessions opened to the upstream origin when one runs out of request IDs");
+DEFINE_bool(
+    upstream_early_data,
+    false,
+    "Reconnect to the upstream origin with 0-RTT and send requests before "
+    "its SERVER_SETUP arrives");
+DEFINE_string(
+    cluster_peers,
+    "",
+    "Comma-separated URLs of every relay in the cluster, including this one. "
+    "Each track is owned by one of them, and the others request it from its "
+    "owner rather than upstream_url");
+DEFINE_string(
+    cluster_self,
+    "",
+    "This relay's URL as it appears in cluster_peers");
+DEFINE_string(
+    abr_track,
+    "",
+    "Name of a virtual track forwarding one of abr_renditions per group, "
+    "picked from each subscriber's bandwidth");
+DEFINE_string(
+    abr_renditions,
+    "",
+    "Comma-separated track:bitrate_bps pairs in the ABR track's namespace, "
+    "eg: video_360p:500000,video_720p:2000000");
+DEFINE_string(
+    goaway_uri,
+    "",
+    "URI sent in GOAWAY when draining, empty for clients to reconnect here");
+DEFINE_uint32(
+    drain_timeout_ms,
+    0,
+    "On SIGTERM, send every client GOAWAY and keep serving them this long "
+    "while they move their subscriptions, 0 to exit at once");
+DEFINE_uint32(
+    transport_metrics_ms,
+    1000,
+    "How often each session's transport congestion state is sampled into "
+    "the session stats, 0 to disable");
+DEFINE_int32(
+    admin_port,
+    0,
+    "Port for the admin HTTP server, which serves Prometheus metrics at "
+    "/metrics and the largest tracks and sessions by memory at "
+    "/debug/memory.  0 to disable");
+DEFINE_uint32(
+    memory_dump_entries,
+    20,
+    "Tracks and sessions listed at /debug/memory");
+DEFINE_string(
+    trace_file,
+    "",
+    "Write trace spans to this file in Chrome trace format.  Needs a "
+    "MOXYGEN_TRACE build");
+DEFINE_uint32(trace_seconds, 10, "Seconds of trace spans to record");
+DEFINE_string(
+    capture_file,
+    "",
+    "Record downstream requests and the metadata of objects received "
+    "upstream to this file, for replay with moqcapturereplay");
+DEFINE_uint32(
+    capture_seconds,
+    0,
+    "Seconds of traffic to capture, 0 until the relay exits");
 
 namespace {
 using namespace moxygen;
 
+// Returns the body served at path, none if there is nothing there
+using AdminPageFn =
+    std::function<folly::Optional<std::string>(const std::string& path)>;
+
+class MetricsHandler : public RequestHandler {
+ public:
+  explicit MetricsHandler(AdminPageFn getPage) : getPage_(std::move(getPage)) {}
+
+  void onRequest(std::unique_ptr<HTTPMessage> req) noexcept override {
+    path_ = req->getPath();
+  }
+
+  void onBody(std::unique_ptr<folly::IOBuf>) noexcept override {}
+
+  void onUpgrade(UpgradeProtocol) noexcept override {}
+
+  void onEOM() noexcept override {
+    auto page = getPage_(path_);
+    if (!page) {
+      ResponseBuilder(downstream_).status(404, "Not Found").sendWithEOM();
+      return;
+    }
+    ResponseBuilder(downstream_)
+        .status(200, "OK")
+        .header(
+            "Content-Type",
+            path_ == "/metrics" ? "text/plain; version=0.0.4" : "text/plain")
+        .body(std::move(*page))
+        .sendWithEOM();
+  }
+
+  void requestComplete() noexcept override {
+    delete this;
+  }
+
+  void onError(ProxygenError) noexcept override {
+    delete this;
+  }
+
+ private:
+  AdminPageFn getPage_;
+  std::string path_;
+};
+
+class MetricsHandlerFactory : public RequestHandlerFactory {
+ public:
+  explicit MetricsHandlerFactory(AdminPageFn getPage)
+      : getPage_(std::move(getPage)) {}
+
+  void onServerStart(folly::EventBase*) noexcept override {}
+
+  void onServerStop() noexcept override {}
+
+  RequestHandler* onRequest(RequestHandler*, HTTPMessage*) noexcept override {
+    return new MetricsHandler(getPage_);
+  }
+
+ private:
+  AdminPageFn getPage_;
+};
+
+// Parses comma separated, '/' delimited namespaces
+std::vector<TrackNamespace> parseNamespaces(const std::string& flag) {
+  std::vector<TrackNamespace> namespaces;
+  std::vector<std::string> entries;
+  folly::split(',', flag, entries, /*ignoreEmpty=*/true);
+  for (auto& entry : entries) {
+    namespaces.emplace_back(entry, "/");
+  }
+  return namespaces;
+}
+
+void writeRelayMetrics(PrometheusWriter& out, const MoQRelay::Stats& stats) {
+  using Type = PrometheusWriter::Type;
+  out.declare(
+      "moxygen_relay_subscriptions",
+      Type::Gauge,
+      "Tracks with an upstream subscription");
+  out.sample("moxygen_relay_subscriptions", stats.subscriptions);
+  out.declare(
+      "moxygen_relay_subscribers",
+      Type::Gauge,
+      "Downstream subscribers across all forwarders");
+  out.sample("moxygen_relay_subscribers", stats.subscribers);
+  out.declare(
+      "moxygen_relay_pending_subscribers",
+      Type::Gauge,
+      "Subscribers waiting on their track's upstream SUBSCRIBE_OK");
+  out.sample("moxygen_relay_pending_subscribers", stats.pendingSubscribers);
+  out.declare(
+      "moxygen_relay_upstream_subscribes_total",
+      Type::Counter,
+      "SUBSCRIBEs sent upstream for a track's first subscriber");
+  out.sample(
+      "moxygen_relay_upstream_subscribes_total", stats.upstreamSubscribes);
+  out.declare(
+      "moxygen_relay_coalesced_subscribes_total",
+      Type::Counter,
+      "SUBSCRIBEs that joined a pending upstream SUBSCRIBE");
+  out.sample(
+      "moxygen_relay_coalesced_subscribes_total", stats.coalescedSubscribes);
+  out.declare(
+      "moxygen_relay_lingering_subscriptions",
+      Type::Gauge,
+      "Upstream subscriptions kept after their last subscriber left");
+  out.sample(
+      "moxygen_relay_lingering_subscriptions", stats.lingeringSubscriptions);
+  out.declare(
+      "moxygen_relay_linger_rejoins_total",
+      Type::Counter,
+      "Subscribers that joined a lingering upstream subscription");
+  out.sample("moxygen_relay_linger_rejoins_total", stats.lingerRejoins);
+  out.declare(
+      "moxygen_relay_upstream_subscribe_updates_total",
+      Type::Counter,
+      "SUBSCRIBE_UPDATEs sent upstream as subscriber demand changed");
+  out.sample(
+      "moxygen_relay_upstream_subscribe_updates_total",
+      stats.upstreamSubscribeUpdates);
+  out.declare(
+      "moxygen_relay_standby_subscriptions",
+      Type::Gauge,
+      "Tracks with a hot standby upstream subscription");
+  out.sample(
+      "moxygen_relay_standby_subscriptions", stats.standbySubscriptions);
+  out.declare(
+      "moxygen_relay_standby_failovers_total",
+      Type::Counter,
+      "Tracks whose hot standby took over from a lost upstream");
+  out.sample("moxygen_relay_standby_failovers_total", stats.standbyFailovers);
+  out.declare(
+      "moxygen_relay_standby_duplicates",
+      Type::Gauge,
+      "Objects hot standby subscriptions dropped as already delivered");
+  out.sample("moxygen_relay_standby_duplicates", stats.standbyDuplicates);
+  out.declare(
+      "moxygen_relay_negative_cache_hits_total",
+      Type::Counter,
+      "SUBSCRIBEs and FETCHes refused with a cached upstream error");
+  out.sample(
+      "moxygen_relay_negative_cache_hits_total", stats.negativeCacheHits);
+  out.declare(
+      "moxygen_relay_negative_cache_entries",
+      Type::Gauge,
+      "Tracks with a cached upstream error");
+  out.sample(
+      "moxygen_relay_negative_cache_entries", stats.negativeCacheEntries);
+  out.declare(
+      "moxygen_relay_local_track_statuses_total",
+      Type::Counter,
+      "TRACK_STATUS requests answered from relay state");
+  out.sample(
+      "moxygen_relay_local_track_statuses_total", stats.localTrackStatuses);
+  out.declare(
+      "moxygen_relay_upstream_track_statuses_total",
+      Type::Counter,
+      "TRACK_STATUS requests forwarded upstream");
+  out.sample(
+      "moxygen_relay_upstream_track_statuses_total",
+      stats.upstreamTrackStatuses);
+  out.declare(
+      "moxygen_relay_peer_requests_total",
+      Type::Counter,
+      "Upstream requests sent to the cluster peer owning the track");
+  out.sample("moxygen_relay_peer_requests_total", stats.peerRequests);
+  out.declare(
+      "moxygen_relay_abr_subscribes_total",
+      Type::Counter,
+      "Subscribers to the ABR track");
+  out.sample("moxygen_relay_abr_subscribes_total", stats.abrSubscribes);
+  out.declare(
+      "moxygen_relay_datagram_stream_fallbacks_total",
+      Type::Counter,
+      "Datagrams too large for a subscriber's path, sent on a stream");
+  out.sample(
+      "moxygen_relay_datagram_stream_fallbacks_total",
+      stats.datagramStreamFallbacks);
+  out.declare(
+      "moxygen_relay_pinned_tracks",
+      Type::Gauge,
+      "Pinned tracks subscribed or subscribing upstream");
+  out.sample("moxygen_relay_pinned_tracks", stats.pinnedTracks);
+  out.declare(
+      "moxygen_relay_subscriber_buffered_bytes",
+      Type::Gauge,
+      "Bytes subscriber sessions have queued for the relay's tracks");
+  out.sample(
+      "moxygen_relay_subscriber_buffered_bytes", stats.subscriberBufferedBytes);
+  out.declare("moxygen_cache_bytes", Type::Gauge, "Bytes held by the cache");
+  out.sample("moxygen_cache_bytes", stats.cachedBytes);
+  out.declare("moxygen_cache_groups", Type::Gauge, "Groups held by the cache");
+  out.sample("moxygen_cache_groups", stats.cachedGroups);
+
+  const auto& cache = stats.cache;
+  out.declare(
+      "moxygen_cache_fetches_total", Type::Counter, "FETCHes served by cache");
+  out.sample("moxygen_cache_fetches_total", cache.fetches);
+  out.declare(
+      "moxygen_cache_fetch_hits_total",
+      Type::Counter,
+      "FETCHes served without an upstream request");
+  out.sample("moxygen_cache_fetch_hits_total", cache.fetchHits);
+  out.declare(
+      "moxygen_cache_sync_fetches_total",
+      Type::Counter,
+      "FETCHes served from cache without suspending");
+  out.sample("moxygen_cache_sync_fetches_total", cache.syncFetches);
+  out.declare(
+      "moxygen_cache_upstream_fetches_total",
+      Type::Counter,
+      "FETCHes sent upstream by the cache");
+  out.sample("moxygen_cache_upstream_fetches_total", cache.upstreamFetches);
+  out.declare(
+      "moxygen_cache_coalesced_waits_total",
+      Type::Counter,
+      "Times a FETCH waited on another FETCH's upstream request");
+  out.sample("moxygen_cache_coalesced_waits_total", cache.coalescedWaits);
+  out.declare(
+      "moxygen_cache_cut_through_objects_total",
+      Type::Counter,
+      "Objects streamed to a FETCH while still arriving from upstream");
+  out.sample(
+      "moxygen_cache_cut_through_objects_total", cache.cutThroughObjects);
+  out.declare(
+      "moxygen_cache_read_ahead_fetches_total",
+      Type::Counter,
+      "FETCHes sent upstream to read ahead of sequential FETCHes");
+  out.sample("moxygen_cache_read_ahead_fetches_total", cache.readAheadFetches);
+  out.declare(
+      "moxygen_cache_admitted_groups_total",
+      Type::Counter,
+      "Groups of subscribed tracks the admission policy cached");
+  out.sample("moxygen_cache_admitted_groups_total", cache.admittedGroups);
+  out.declare(
+      "moxygen_cache_rejected_groups_total",
+      Type::Counter,
+      "Groups of subscribed tracks the admission policy did not cache");
+  out.sample("moxygen_cache_rejected_groups_total", cache.rejectedGroups);
+  out.declare(
+      "moxygen_cache_parallel_fetch_chunks_total",
+      Type::Counter,
+      "Upstream FETCHes issued in parallel for chunks of a long cache miss");
+  out.sample(
+      "moxygen_cache_parallel_fetch_chunks_total", cache.parallelFetchChunks);
+  out.declare(
+      "moxygen_cache_hit_objects_total",
+      Type::Counter,
+      "Objects served from the cache");
+  out.sample("moxygen_cache_hit_objects_total", cache.hitObjects);
+  out.declare(
+      "moxygen_cache_hit_bytes_total",
+      Type::Counter,
+      "Payload bytes served from the cache");
+  out.sample("moxygen_cache_hit_bytes_total", cache.hitBytes);
+  out.declare(
+      "moxygen_cache_disk_writes_total",
+      Type::Counter,
+      "Groups written to the cache's disk tier");
+  out.sample("moxygen_cache_disk_writes_total", cache.diskWrites);
+  out.declare(
+      "moxygen_cache_disk_reads_total",
+      Type::Counter,
+      "Groups read back from the cache's disk tier");
+  out.sample("moxygen_cache_disk_reads_total", cache.diskReads);
+  out.declare(
+      "moxygen_cache_compacted_objects_total",
+      Type::Counter,
+      "Cached objects copied into the payload slabs");
+  out.sample("moxygen_cache_compacted_objects_total", cache.compactedObjects);
+  out.declare(
+      "moxygen_cache_compacted_bytes_total",
+      Type::Counter,
+      "Payload bytes copied into the payload slabs");
+  out.sample("moxygen_cache_compacted_bytes_total", cache.compactedBytes);
+  out.declare(
+      "moxygen_cache_fetch_hit_ratio",
+      Type::Gauge,
+      "Fraction of FETCHes served without an upstream request");
+  out.sample(
+      "moxygen_cache_fetch_hit_ratio",
+      cache.fetches ? double(cache.fetchHits) / double(cache.fetches) : 0.0);
+  auto upstreamDemand = cache.coalescedWaits + cache.upstreamFetches;
+  out.declare(
+      "moxygen_cache_coalesced_ratio",
+      Type::Gauge,
+      "Fraction of upstream demand coalesced onto an in-flight FETCH");
+  out.sample(
+      "moxygen_cache_coalesced_ratio",
+      upstreamDemand ? double(cache.coalescedWaits) / double(upstreamDemand)
+                     : 0.0);
+}
+
+void writeSessionMetrics(
+    PrometheusWriter& out,
+    const MoQSessionStats::Snapshot& stats) {
+  using Type = PrometheusWriter::Type;
+  out.declare(
+      "moxygen_session_events_total",
+      Type::Counter,
+      "Control messages handled, by session role");
+  for (size_t i = 0; i < MoQSessionStats::kNumEvents; i++) {
+    std::string event =
+        MoQSessionStats::eventName(MoQSessionStats::Event(uint8_t(i)));
+    out.sample(
+        "moxygen_session_events_total",
+        stats.publisherEvents[i],
+        {{"role", "publisher"}, {"event", event}});
+    out.sample(
+        "moxygen_session_events_total",
+        stats.subscriberEvents[i],
+        {{"role", "subscriber"}, {"event", event}});
+  }
+  out.declare(
+      "moxygen_session_announce_latency_ms",
+      Type::Summary,
+      "Time to ANNOUNCE_OK or ANNOUNCE_ERROR");
+  out.summary("moxygen_session_announce_latency_ms", stats.announceLatencyMsec);
+  out.declare(
+      "moxygen_session_subscribe_latency_ms",
+      Type::Summary,
+      "Time to SUBSCRIBE_OK or SUBSCRIBE_ERROR");
+  out.summary(
+      "moxygen_session_subscribe_latency_ms", stats.subscribeLatencyMsec);
+  out.declare(
+      "moxygen_session_fetch_latency_ms",
+      Type::Summary,
+      "Time to FETCH_OK or FETCH_ERROR");
+  out.summary("moxygen_session_fetch_latency_ms", stats.fetchLatencyMsec);
+  out.declare(
+      "moxygen_session_srtt_us",
+      Type::Summary,
+      "Smoothed RTT sampled from sessions the relay publishes to");
+  out.summary("moxygen_session_srtt_us", stats.srttUsec);
+  out.declare(
+      "moxygen_session_send_rate_kbps",
+      Type::Summary,
+      "Estimated send rate sampled from sessions the relay publishes to");
+  out.summary("moxygen_session_send_rate_kbps", stats.sendRateKbps);
+  out.declare(
+      "moxygen_session_memory_kb",
+      Type::Summary,
+      "Buffered bytes sampled from sessions the relay publishes to");
+  out.summary("moxygen_session_memory_kb", stats.sessionMemoryKB);
+}
+
+void writeTrackMetrics(
+    PrometheusWriter& out,
+    const MoQTrackStats::Snapshot& stats) {
+  using Type = PrometheusWriter::Type;
+  // Summed over tracks to keep the label cardinality bounded
+  MoQTrackCounters total;
+  for (const auto& [ftn, counters] : stats.tracks) {
+    total.objectsIn += counters.objectsIn;
+    total.bytesIn += counters.bytesIn;
+    total.objectsOut += counters.objectsOut;
+    total.bytesOut += counters.bytesOut;
+    total.tooFarBehind += counters.tooFarBehind;
+    total.subgroupsDropped += counters.subgroupsDropped;
+    total.bytesDropped += counters.bytesDropped;
+  }
+  out.declare("moxygen_tracks", Type::Gauge, "Tracks with recorded data");
+  out.sample("moxygen_tracks", uint64_t(stats.tracks.size()));
+  out.declare("moxygen_objects_total", Type::Counter, "Objects by direction");
+  out.sample("moxygen_objects_total", total.objectsIn, {{"direction", "in"}});
+  out.sample("moxygen_objects_total", total.objectsOut, {{"direction", "out"}});
+  out.declare("moxygen_bytes_total", Type::Counter, "Payload bytes by direction");
+  out.sample("moxygen_bytes_total", total.bytesIn, {{"direction", "in"}});
+  out.sample("moxygen_bytes_total", total.bytesOut, {{"direction", "out"}});
+  out.declare(
+      "moxygen_too_far_behind_total",
+      Type::Counter,
+      "Subscriptions that went over their buffer limit");
+  out.sample("moxygen_too_far_behind_total", total.tooFarBehind);
+  out.declare(
+      "moxygen_subgroups_dropped_total",
+      Type::Counter,
+      "Subgroups reset to catch up a subscriber");
+  out.sample("moxygen_subgroups_dropped_total", total.subgroupsDropped);
+  out.declare(
+      "moxygen_dropped_bytes_total",
+      Type::Counter,
+      "Buffered bytes discarded with dropped subgroups");
+  out.sample("moxygen_dropped_bytes_total", total.bytesDropped);
+  out.declare(
+      "moxygen_relay_forward_latency_us",
+      Type::Summary,
+      "Time to forward an object to all subscribers");
+  out.summary("moxygen_relay_forward_latency_us", stats.forwardLatencyUsec);
+  out.declare(
+      "moxygen_stream_credit_stall_us",
+      Type::Summary,
+      "Time spent waiting for stream credit");
+  out.summary("moxygen_stream_credit_stall_us", stats.streamCreditStallUsec);
+  out.declare(
+      "moxygen_subscription_buffered_bytes",
+      Type::Summary,
+      "Bytes buffered by a subscription when more were written");
+  out.summary("moxygen_subscription_buffered_bytes", stats.bufferedBytes);
+}
+
 class MoQRelayServer : MoQServer {
  public:
   MoQRelayServer()
-      : MoQServer(FLAGS_port, FLAGS_cert, FLAGS_key, FLAGS_endpoint) {}
+      : MoQServer(
+            FLAGS_port,
+            FLAGS_cert,
+            FLAGS_key,
+            FLAGS_endpoint,
+            std::max(FLAGS_worker_threads, 1u)) {
+    MoQCache::Config cacheConfig{
+        FLAGS_cache_max_bytes,
+        FLAGS_cache_max_groups_per_track,
+        std::chrono::milliseconds(FLAGS_cache_default_duration_ms),
+        FLAGS_cache_disk_dir};
+    if (FLAGS_cache_gop_index) {
+      cacheConfig.keyframeTime = MoQMi::keyframeTime;
+    }
+    cacheConfig.readAheadGroups = FLAGS_cache_read_ahead_groups;
+    cacheConfig.fetchChunkGroups = FLAGS_cache_fetch_chunk_groups;
+    cacheConfig.maxParallelFetches = FLAGS_cache_max_parallel_fetches;
+    cacheConfig.payloadSlabSize = FLAGS_cache_payload_slab_kb * 1024;
+    cacheConfig.payloadHugePages = FLAGS_cache_payload_hugepages;
+    if (FLAGS_cache_admission_min_subscribers > 0 ||
+        FLAGS_cache_admission_tinylfu ||
+        !FLAGS_cache_never_namespaces.empty() ||
+        !FLAGS_cache_always_namespaces.empty()) {
+      MoQCacheAdmissionPolicy::Config admission;
+      admission.neverCache = parseNamespaces(FLAGS_cache_never_namespaces);
+      admission.alwaysCache = parseNamespaces(FLAGS_cache_always_namespaces);
+      admission.minSubscribers = FLAGS_cache_admission_min_subscribers;
+      admission.frequencySketch = FLAGS_cache_admission_tinylfu;
+      cacheConfig.admission = [admission] {
+        return std::make_unique<MoQCacheAdmissionPolicy>(admission);
+      };
+    }
+    MoQFetchLimiter::Config fetchLimits;
+    fetchLimits.maxConcurrent = FLAGS_relay_max_fetches;
+    fetchLimits.maxBytesPerSecond = FLAGS_relay_fetch_bytes_per_sec;
+    if (fetchLimits.enabled()) {
+      fetchLimiter_ = std::make_shared<MoQFetchLimiter>(fetchLimits);
+    }
+    auto workerEvbs = getWorkerEvbs();
+    if (workerEvbs.size() > 1) {
+      shardedRelay_ = std::make_shared<MoQShardedRelay>(
+          workerEvbs, FLAGS_enable_cache, cacheConfig);
+      if (FLAGS_shard_by == "namespace") {
+        shardedRelay_->setPlacement(MoQShardedRelay::placeByNamespace);
+      } else if (FLAGS_shard_by != "track") {
+        XLOG(FATAL) << "Unknown --shard_by=" << FLAGS_shard_by;
+      }
+    } else {
+      relay_ = std::make_shared<MoQRelay>(FLAGS_enable_cache, cacheConfig);
+    }
+    std::chrono::milliseconds linger(FLAGS_upstream_linger_ms);
+    if (shardedRelay_) {
+      shardedRelay_->setUpstreamLinger(linger, FLAGS_pause_lingering_upstream);
+    } else {
+      relay_->setUpstreamLinger(linger, FLAGS_pause_lingering_upstream);
+    }
+    std::chrono::milliseconds debounce(FLAGS_subscribe_update_debounce_ms);
+    if (shardedRelay_) {
+      shardedRelay_->setSubscribeUpdateDebounce(debounce);
+    } else {
+      relay_->setSubscribeUpdateDebounce(debounce);
+    }
+    std::chrono::milliseconds negativeTtl(FLAGS_negative_cache_ttl_ms);
+    if (shardedRelay_) {
+      shardedRelay_->setNegativeCacheTtl(negativeTtl);
+    } else {
+      relay_->setNegativeCacheTtl(negativeTtl);
+    }
+    if (shardedRelay_) {
+      shardedRelay_->setDatagramFec(
+          FLAGS_datagram_fec_window, FLAGS_datagram_fec_max_size);
+    } else {
+      relay_->setDatagramFec(
+          FLAGS_datagram_fec_window, FLAGS_datagram_fec_max_size);
+    }
+    if (!FLAGS_latency_probe_prefix.empty()) {
+      TrackNamespace prefix(FLAGS_latency_probe_prefix, "/");
+      if (shardedRelay_) {
+        shardedRelay_->setLatencyProbePrefix(std::move(prefix));
+      } else {
+        relay_->setLatencyProbePrefix(std::move(prefix));
+      }
+    }
+    if (!FLAGS_capture_file.empty()) {
+      capture_ = MoQCaptureWriter::open(FLAGS_capture_file);
+      if (!capture_) {
+        XLOG(FATAL) << "Can't open capture_file: " << FLAGS_capture_file;
+      }
+      if (shardedRelay_) {
+        shardedRelay_->setCapture(capture_);
+      } else {
+        relay_->setCapture(capture_);
+      }
+    }
+    if (!FLAGS_hot_standby_prefix.empty()) {
+      TrackNamespace prefix(FLAGS_hot_standby_prefix, "/");
+      if (shardedRelay_) {
+        shardedRelay_->setHotStandby(std::move(prefix));
+      } else {
+        relay_->setHotStandby(std::move(prefix));
+      }
+    }
+    if (!FLAGS_upstream_url.empty()) {
+      proxygen::URL origin(FLAGS_upstream_url);
+      if (!origin.isValid() || !origin.hasHost()) {
+        XLOG(FATAL) << "Invalid upstream_url: " << FLAGS_upstream_url;
+      }
+      MoQUpstreamPool::Config poolConfig;
+      poolConfig.maxSessionsPerOrigin =
+          std::max(FLAGS_upstream_max_sessions, 1u);
+      poolConfig.earlyData = FLAGS_upstream_early_data;
+      if (shardedRelay_) {
+        shardedRelay_->setUpstreamOrigin(origin, poolConfig);
+      } else {
+        relay_->setUpstreamOrigin(
+            origin,
+            std::make_shared<MoQUpstreamPool>(workerEvbs[0], poolConfig));
+      }
+    }
+    if (!FLAGS_cluster_peers.empty()) {
+      if (FLAGS_upstream_url.empty()) {
+        XLOG(FATAL) << "cluster_peers requires upstream_url";
+      }
+      std::vector<std::string> peers;
+      folly::split(',', FLAGS_cluster_peers, peers, /*ignoreEmpty=*/true);
+      if (std::find(peers.begin(), peers.end(), FLAGS_cluster_self) ==
+          peers.end()) {
+        XLOG(FATAL) << "cluster_self must be one of cluster_peers";
+      }
+      auto ring = std::make_shared<const MoQClusterRing>(std::move(peers));
+      if (shardedRelay_) {
+        shardedRelay_->setClusterRing(std::move(ring), FLAGS_cluster_self);
+      } else {
+        relay_->setClusterRing(std::move(ring), FLAGS_cluster_self);
+      }
+    }
+    if (!FLAGS_abr_track.empty()) {
+      std::vector<MoQRelay::AbrRendition> renditions;
+      std::vector<folly::StringPiece> entries;
+      folly::split(',', FLAGS_abr_renditions, entries, /*ignoreEmpty=*/true);
+      for (auto entry : entries) {
+        folly::StringPiece name;
+        folly::StringPiece bitrate;
+        if (!folly::split(':', entry, name, bitrate)) {
+          XLOG(FATAL) << "Invalid abr_renditions entry: " << entry;
+        }
+        auto bps = folly::tryTo<uint64_t>(bitrate);
+        if (!bps) {
+          XLOG(FATAL) << "Invalid bitrate in abr_renditions: " << entry;
+        }
+        renditions.push_back({name.str(), *bps});
+      }
+      if (renditions.empty()) {
+        XLOG(FATAL) << "abr_track requires abr_renditions";
+      }
+      if (shardedRelay_) {
+        shardedRelay_->setAbrTrack(FLAGS_abr_track, renditions);
+      } else {
+        relay_->setAbrTrack(FLAGS_abr_track, std::move(renditions));
+      }
+    }
+    if (!FLAGS_pinned_tracks.empty()) {
+      std::vector<MoQRelay::PinnedTrack> pins;
+      std::vector<folly::StringPiece> entries;
+      folly::split(',', FLAGS_pinned_tracks, entries, /*ignoreEmpty=*/true);
+      for (auto entry : entries) {
+        folly::StringPiece ns;
+        folly::StringPiece trackName;
+        if (!folly::split(':', entry, ns, trackName) || ns.empty() ||
+            trackName.empty()) {
+          XLOG(FATAL) << "Invalid pinned_tracks entry: " << entry;
+        }
+        pins.push_back({TrackNamespace(ns.str(), "/"), trackName.str()});
+      }
+      if (shardedRelay_) {
+        shardedRelay_->setPinnedTracks(pins);
+      } else {
+        relay_->setPinnedTracks(std::move(pins), workerEvbs[0]);
+      }
+    }
+    if (FLAGS_admin_port > 0) {
+      sessionStats_ = std::make_shared<MoQSessionStats>();
+      trackStats_ = std::make_shared<MoQTrackStats>();
+      if (shardedRelay_) {
+        shardedRelay_->setTrackStatsCallback(trackStats_);
+      } else {
+        relay_->setTrackStatsCallback(trackStats_);
+      }
+      startAdminServer(workerEvbs[0]);
+    }
+  }
+
+  ~MoQRelayServer() {
+    if (adminServer_) {
+      adminServer_->stop();
+      adminThread_.join();
+    }
+  }
 
   void onNewSession(std::shared_ptr<MoQSession> clientSession) override {
-    clientSession->setPublishHandler(relay_);
-    clientSession->setSubscribeHandler(relay_);
+    sessions_.wlock()->insert(clientSession);
+    MoQSettings moqSettings;
+    moqSettings.bufferingThresholds.perSubscription =
+        FLAGS_subscription_buffer_bytes;
+    moqSettings.bufferingThresholds.perSession = FLAGS_session_buffer_bytes;
+    moqSettings.bufferingThresholds.resetSubgroupsWhenTooFarBehind =
+        FLAGS_skip_groups_when_too_far_behind;
+    moqSettings.writeCoalescing.maxDelay =
+        std::chrono::microseconds(FLAGS_write_coalescing_us);
+    moqSettings.egressScheduling.enabled = FLAGS_egress_scheduling;
+    moqSettings.egressScheduling.windowBytes = FLAGS_egress_window_bytes;
+    moqSettings.fetchLimits.belowLive = FLAGS_fetch_below_live;
+    moqSettings.fetchLimits.session.maxConcurrent = FLAGS_session_max_fetches;
+    moqSettings.fetchLimits.session.maxBytesPerSecond =
+        FLAGS_session_fetch_bytes_per_sec;
+    moqSettings.fetchLimits.shared = fetchLimiter_;
+    clientSession->setMoqSettings(moqSettings);
+    if (sessionStats_) {
+      clientSession->setPublisherStatsCallback(
+          sessionStats_->publisherStatsCallback());
+      clientSession->setSubscriberStatsCallback(
+          sessionStats_->subscriberStatsCallback());
+      clientSession->setTrackStatsCallback(trackStats_);
+      clientSession->setTransportMetricsInterval(
+          std::chrono::milliseconds(FLAGS_transport_metrics_ms));
+    }
+    if (shardedRelay_) {
+      clientSession->setPublishHandler(shardedRelay_);
+      clientSession->setSubscribeHandler(shardedRelay_);
+    } else {
+      clientSession->setPublishHandler(relay_);
+      clientSession->setSubscribeHandler(relay_);
+    }
   }
 
   void terminateClientSession(std::shared_ptr<MoQSession> session) override {
-    relay_->removeSession(session);
+    sessions_.wlock()->erase(session);
+    if (shardedRelay_) {
+      shardedRelay_->removeSession(session);
+    } else {
+      relay_->removeSession(session);
+    }
+  }
+
+  // Writes what was captured and stops capturing
+  void stopCapture() {
+    if (capture_ && capture_->close()) {
+      XLOG(INFO) << "Wrote capture to " << FLAGS_capture_file;
+    }
+  }
+
+  // Sends every client a GOAWAY pointing at uri.  Each session stays open
+  // while its client still has subscriptions here.
+  void drain(const std::string& uri) {
+    auto sessions = sessions_.copy();
+    XLOG(INFO) << "Draining " << sessions.size() << " sessions, uri=" << uri;
+    for (auto& session : sessions) {
+      session->getEventBase()->runInEventBaseThread([session, uri] {
+        session->goaway(Goaway{uri});
+      });
+    }
+  }
+
+ private:
+  void startAdminServer(folly::EventBase* relayEvb) {
+    HTTPServerOptions options;
+    options.threads = 1;
+    options.handlerFactories =
+        RequestHandlerChain()
+            .addThen<MetricsHandlerFactory>(
+                [this, relayEvb](
+                    const std::string& path) -> folly::Optional<std::string> {
+                  if (path == "/metrics") {
+                    return getMetrics(relayEvb);
+                  }
+                  if (path == "/debug/memory") {
+                    return getMemoryDump(relayEvb);
+                  }
+                  return folly::none;
+                })
+            .build();
+    adminServer_ = std::make_unique<HTTPServer>(std::move(options));
+    adminServer_->bind(
+        {{folly::SocketAddress("::", FLAGS_admin_port, true),
+          HTTPServer::Protocol::HTTP}});
+    adminThread_ = std::thread([this] { adminServer_->start(); });
+  }
+
+  // Runs on the admin thread.  Relay state is owned by the worker EventBases,
+  // so the admin thread blocks while each one reads its own.
+  std::string getMetrics(folly::EventBase* relayEvb) {
+    MoQRelay::Stats relayStats;
+    if (shardedRelay_) {
+      relayStats = folly::coro::blockingWait(shardedRelay_->getStats());
+    } else {
+      relayStats = folly::coro::blockingWait(
+          folly::coro::co_invoke(
+              [relay = relay_]() -> folly::coro::Task<MoQRelay::Stats> {
+                co_return relay->getStats();
+              })
+              .scheduleOn(relayEvb));
+    }
+    PrometheusWriter out;
+    writeRelayMetrics(out, relayStats);
+    writeSessionMetrics(out, sessionStats_->snapshot());
+    writeTrackMetrics(out, trackStats_->snapshot());
+    return out.str();
+  }
+
+  // Runs on the admin thread, like getMetrics
+  std::string getMemoryDump(folly::EventBase* relayEvb) {
+    MoQRelay::MemoryReport report;
+    if (shardedRelay_) {
+      report = folly::coro::blockingWait(shardedRelay_->getMemoryReport());
+    } else {
+      report = folly::coro::blockingWait(
+          folly::coro::co_invoke(
+              [relay = relay_]() -> folly::coro::Task<MoQRelay::MemoryReport> {
+                co_return relay->getMemoryReport();
+              })
+              .scheduleOn(relayEvb));
+    }
+    return report.dump(FLAGS_memory_dump_entries);
+  }
+
+  std::shared_ptr<MoQRelay> relay_;
+  std::shared_ptr<MoQShardedRelay> shardedRelay_;
+  std::shared_ptr<MoQSessionStats> sessionStats_;
+  std::shared_ptr<MoQTrackStats> trackStats_;
+  std::shared_ptr<MoQCaptureWriter> capture_;
+  // Shared by every downstream session
+  std::shared_ptr<MoQFetchLimiter> fetchLimiter_;
+  std::unique_ptr<HTTPServer> adminServer_;
+  std::thread adminThread_;
+  folly::Synchronized<folly::F14FastSet<std::shared_ptr<MoQSession>>>
+      sessions_;
+};
+
+class DrainSignalHandler : public folly::AsyncSignalHandler {
+ public:
+  DrainSignalHandler(folly::EventBase* evb, MoQRelayServer& server)
+      : folly::AsyncSignalHandler(evb), evb_(evb), server_(server) {}
+
+  void signalReceived(int /*signum*/) noexcept override {
+    if (draining_) {
+      // A second signal doesn't wait
+      evb_->terminateLoopSoon();
+      return;
+    }
+    draining_ = true;
+    server_.drain(FLAGS_goaway_uri);
+    evb_->runAfterDelay(
+        [evb = evb_] { evb->terminateLoopSoon(); }, FLAGS_drain_timeout_ms);
   }
 
  private:
-  std::shared_ptr<MoQRelay> relay_{
-      std::make_shared<MoQRelay>(FLAGS_enable_cache)};
+  folly::EventBase* evb_;
+  MoQRelayServer& server_;
+  bool draining_{false};
 };
 } // namespace
 
@@ -44,6 +1051,26 @@ int main(int argc, char* argv[]) {
   folly::Init init(&argc, &argv, true);
   MoQRelayServer moqRelayServer;
   folly::EventBase evb;
+  DrainSignalHandler drainHandler(&evb, moqRelayServer);
+  if (FLAGS_drain_timeout_ms > 0) {
+    drainHandler.registerSignalHandler(SIGTERM);
+  }
+  if (!FLAGS_trace_file.empty()) {
+    Tracer::start();
+    evb.runAfterDelay(
+        [] {
+          if (Tracer::stop(FLAGS_trace_file)) {
+            XLOG(INFO) << "Wrote trace to " << FLAGS_trace_file;
+          }
+        },
+        FLAGS_trace_seconds * 1000);
+  }
+  if (FLAGS_capture_seconds > 0) {
+    evb.runAfterDelay(
+        [&moqRelayServer] { moqRelayServer.stopCapture(); },
+        FLAGS_capture_seconds * 1000);
+  }
   evb.loopForever();
+  moqRelayServer.stopCapture();
   return 0;
 }
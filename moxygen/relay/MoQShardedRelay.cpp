@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/relay/MoQShardedRelay.h"
+
+#include <folly/coro/Invoke.h>
+
+namespace moxygen {
+
+class MoQShardedRelay::ShardedAnnounceHandle
+    : public Subscriber::AnnounceHandle {
+ public:
+  using ShardHandles = std::vector<
+      std::pair<folly::EventBase*, std::shared_ptr<Subscriber::AnnounceHandle>>>;
+
+  ShardedAnnounceHandle(AnnounceOk annOk, ShardHandles handles)
+      : Subscriber::AnnounceHandle(std::move(annOk)),
+        handles_(std::move(handles)) {}
+
+  void unannounce() override {
+    for (auto& [evb, handle] : handles_) {
+      evb->runInEventBaseThread(
+          [handle = std::move(handle)] { handle->unannounce(); });
+    }
+    handles_.clear();
+  }
+
+ private:
+  ShardHandles handles_;
+};
+
+MoQShardedRelay::MoQShardedRelay(
+    const std::vector<folly::EventBase*>& evbs,
+    bool enableCache,
+    MoQCache::Config cacheConfig) {
+  XCHECK(!evbs.empty());
+  shards_.reserve(evbs.size());
+  for (size_t i = 0; i < evbs.size(); i++) {
+    auto shardCacheConfig = cacheConfig;
+    if (!cacheConfig.diskCacheDir.empty()) {
+      // Each shard's cache owns its own segments.  Tracks only map back to
+      // the same shard when restarted with the same number of workers.
+      shardCacheConfig.diskCacheDir =
+          folly::to<std::string>(cacheConfig.diskCacheDir, "/shard", i);
+    }
+    shards_.push_back(
+        {evbs[i],
+         std::make_shared<MoQRelay>(enableCache, shardCacheConfig, evbs[i])});
+  }
+}
+
+/*static*/
+size_t MoQShardedRelay::placeByTrack(
+    const FullTrackName& ftn,
+    size_t numShards) {
+  return FullTrackName::hash()(ftn) % numShards;
+}
+
+/*static*/
+size_t MoQShardedRelay::placeByNamespace(
+    const FullTrackName& ftn,
+    size_t numShards) {
+  return TrackNamespace::hash()(ftn.trackNamespace) % numShards;
+}
+
+void MoQShardedRelay::setAllowedNamespacePrefix(TrackNamespace allowed) {
+  for (auto& shard : shards_) {
+    shard.relay->setAllowedNamespacePrefix(allowed);
+  }
+}
+
+void MoQShardedRelay::setUpstreamLinger(
+    std::chrono::milliseconds linger,
+    bool pause) {
+  for (auto& shard : shards_) {
+    shard.relay->setUpstreamLinger(linger, pause);
+  }
+}
+
+void MoQShardedRelay::setSubscribeUpdateDebounce(
+    std::chrono::milliseconds debounce) {
+  for (auto& shard : shards_) {
+    shard.relay->setSubscribeUpdateDebounce(debounce);
+  }
+}
+
+void MoQShardedRelay::setNegativeCacheTtl(std::chrono::milliseconds ttl) {
+  for (auto& shard : shards_) {
+    shard.relay->setNegativeCacheTtl(ttl);
+  }
+}
+
+void MoQShardedRelay::setHotStandby(TrackNamespace prefix) {
+  for (auto& shard : shards_) {
+    shard.relay->setHotStandby(prefix);
+  }
+}
+
+void MoQShardedRelay::setDatagramFec(
+    size_t window,
+    uint64_t maxDatagramSize) {
+  for (auto& shard : shards_) {
+    shard.relay->setDatagramFec(window, maxDatagramSize);
+  }
+}
+
+void MoQShardedRelay::setLatencyProbePrefix(TrackNamespace prefix) {
+  for (auto& shard : shards_) {
+    shard.relay->setLatencyProbePrefix(prefix);
+  }
+}
+
+void MoQShardedRelay::setCapture(std::shared_ptr<MoQCaptureWriter> capture) {
+  for (auto& shard : shards_) {
+    shard.relay->setCapture(capture);
+  }
+}
+
+void MoQShardedRelay::setPinnedTracks(
+    const std::vector<MoQRelay::PinnedTrack>& pins) {
+  for (auto& shard : shards_) {
+    shard.relay->setPinnedTracks(
+        pins, shard.evb, [this, relay = shard.relay.get()](const auto& ftn) {
+          return shardFor(ftn).relay.get() == relay;
+        });
+  }
+}
+
+void MoQShardedRelay::setAbrTrack(
+    const std::string& trackName,
+    const std::vector<MoQRelay::AbrRendition>& renditions,
+    MoQAbrSwitcher::Config config) {
+  for (auto& shard : shards_) {
+    shard.relay->setAbrTrack(trackName, renditions, config);
+  }
+}
+
+void MoQShardedRelay::setClusterRing(
+    std::shared_ptr<const MoQClusterRing> ring,
+    const std::string& self) {
+  for (auto& shard : shards_) {
+    shard.evb->runInEventBaseThread([relay = shard.relay, ring, self] {
+      relay->setClusterRing(ring, self);
+    });
+  }
+}
+
+void MoQShardedRelay::setTrackStatsCallback(
+    std::shared_ptr<MoQTrackStatsCallback> trackStatsCallback) {
+  for (auto& shard : shards_) {
+    shard.relay->setTrackStatsCallback(trackStatsCallback);
+  }
+}
+
+void MoQShardedRelay::setUpstreamOrigin(
+    const proxygen::URL& origin,
+    MoQUpstreamPool::Config config) {
+  for (auto& shard : shards_) {
+    shard.relay->setUpstreamOrigin(
+        origin, std::make_shared<MoQUpstreamPool>(shard.evb, config));
+  }
+}
+
+folly::coro::Task<Publisher::SubscribeResult> MoQShardedRelay::subscribe(
+    SubscribeRequest subReq,
+    std::shared_ptr<TrackConsumer> consumer) {
+  auto sessionEvb = MoQSession::getRequestSession()->getEventBase();
+  const auto& shard = shardFor(subReq.fullTrackName);
+  if (shard.evb == sessionEvb) {
+    co_return co_await shard.relay->subscribe(
+        std::move(subReq), std::move(consumer));
+  }
+  EvbPublisher shardPublisher(sessionEvb, shard.relay, shard.evb);
+  co_return co_await shardPublisher.subscribe(
+      std::move(subReq), std::move(consumer));
+}
+
+folly::coro::Task<Publisher::FetchResult> MoQShardedRelay::fetch(
+    Fetch fetch,
+    std::shared_ptr<FetchConsumer> consumer) {
+  auto sessionEvb = MoQSession::getRequestSession()->getEventBase();
+  const auto& shard = shardFor(fetch.fullTrackName);
+  if (shard.evb == sessionEvb) {
+    co_return co_await shard.relay->fetch(
+        std::move(fetch), std::move(consumer));
+  }
+  EvbPublisher shardPublisher(sessionEvb, shard.relay, shard.evb);
+  co_return co_await shardPublisher.fetch(
+      std::move(fetch), std::move(consumer));
+}
+
+folly::coro::Task<Publisher::TrackStatusResult> MoQShardedRelay::trackStatus(
+    TrackStatusRequest trackStatusRequest) {
+  auto sessionEvb = MoQSession::getRequestSession()->getEventBase();
+  const auto& shard = shardFor(trackStatusRequest.fullTrackName);
+  if (shard.evb == sessionEvb) {
+    co_return co_await shard.relay->trackStatus(std::move(trackStatusRequest));
+  }
+  EvbPublisher shardPublisher(sessionEvb, shard.relay, shard.evb);
+  co_return co_await shardPublisher.trackStatus(std::move(trackStatusRequest));
+}
+
+folly::coro::Task<Publisher::SubscribeAnnouncesResult>
+MoQShardedRelay::subscribeAnnounces(SubscribeAnnounces subAnn) {
+  auto sessionEvb = MoQSession::getRequestSession()->getEventBase();
+  const auto& shard = shards_.front();
+  if (shard.evb == sessionEvb) {
+    co_return co_await shard.relay->subscribeAnnounces(std::move(subAnn));
+  }
+  auto res = co_await shard.relay->subscribeAnnounces(std::move(subAnn))
+                 .scheduleOn(shard.evb);
+  if (res.hasError()) {
+    co_return folly::makeUnexpected(res.error());
+  }
+  co_return std::make_shared<EvbSubscribeAnnouncesHandle>(
+      shard.evb, std::move(res.value()));
+}
+
+folly::coro::Task<Subscriber::AnnounceResult> MoQShardedRelay::announce(
+    Announce ann,
+    std::shared_ptr<Subscriber::AnnounceCallback> callback) {
+  XLOG(DBG1) << __func__ << " ns=" << ann.trackNamespace;
+  ShardedAnnounceHandle::ShardHandles handles;
+  handles.reserve(shards_.size());
+  for (auto& shard : shards_) {
+    auto res =
+        co_await shard.relay->announce(ann, callback).scheduleOn(shard.evb);
+    if (res.hasError()) {
+      ShardedAnnounceHandle(
+          AnnounceOk{ann.requestID, ann.trackNamespace}, std::move(handles))
+          .unannounce();
+      co_return folly::makeUnexpected(res.error());
+    }
+    handles.emplace_back(shard.evb, std::move(res.value()));
+  }
+  co_return std::make_shared<ShardedAnnounceHandle>(
+      AnnounceOk{ann.requestID, ann.trackNamespace}, std::move(handles));
+}
+
+folly::coro::Task<MoQRelay::Stats> MoQShardedRelay::getStats() {
+  MoQRelay::Stats stats;
+  for (auto& shard : shards_) {
+    stats += co_await folly::coro::co_invoke(
+                 [relay = shard.relay]() -> folly::coro::Task<MoQRelay::Stats> {
+                   co_return relay->getStats();
+                 })
+                 .scheduleOn(shard.evb);
+  }
+  co_return stats;
+}
+
+folly::coro::Task<MoQRelay::MemoryReport> MoQShardedRelay::getMemoryReport() {
+  MoQRelay::MemoryReport report;
+  for (auto& shard : shards_) {
+    report += co_await folly::coro::co_invoke(
+                  [relay = shard.relay]()
+                      -> folly::coro::Task<MoQRelay::MemoryReport> {
+                    co_return relay->getMemoryReport();
+                  })
+                  .scheduleOn(shard.evb);
+  }
+  co_return report;
+}
+
+void MoQShardedRelay::removeSession(
+    const std::shared_ptr<MoQSession>& session) {
+  for (auto& shard : shards_) {
+    if (shard.evb->isInEventBaseThread()) {
+      shard.relay->removeSession(session);
+    } else {
+      shard.evb->runInEventBaseThread([relay = shard.relay, session] {
+        relay->removeSession(session);
+      });
+    }
+  }
+}
+
+} // namespace moxygen
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "moxygen/relay/MoQRelay.h"
+
+#include <functional>
+
+namespace moxygen {
+
+// Runs one MoQRelay per worker EventBase.  Subscriptions, fetches and the
+// cache for a track are owned by the shard selected by the placement policy,
+// so each track has a single upstream subscription per process.  Objects are
+// delivered to downstream sessions on other EventBases through EvbProxies.
+//
+// ANNOUNCEs are replicated to every shard so any shard can find the upstream
+// for its tracks.  SUBSCRIBE_ANNOUNCES is handled by the first shard, which
+// forwards the replicated announces.
+class MoQShardedRelay : public Publisher, public Subscriber {
+ public:
+  MoQShardedRelay(
+      const std::vector<folly::EventBase*>& evbs,
+      bool enableCache,
+      MoQCache::Config cacheConfig = {});
+
+  // Returns the index of the shard that owns a track, given the number of
+  // shards.  Must return the same shard for a track every time.
+  using Placement = std::function<size_t(const FullTrackName&, size_t)>;
+
+  // The default, spreads tracks across shards by FullTrackName hash
+  static size_t placeByTrack(const FullTrackName& ftn, size_t numShards);
+
+  // Keeps every track in a namespace on one shard, so the tracks of one
+  // broadcast, and sessions that only use them, don't cross threads
+  static size_t placeByNamespace(const FullTrackName& ftn, size_t numShards);
+
+  // Must be called before any sessions are attached
+  void setPlacement(Placement placement) {
+    placement_ = std::move(placement);
+  }
+
+  // Must be called before any sessions are attached
+  void setAllowedNamespacePrefix(TrackNamespace allowed);
+
+  // Must be called before any sessions are attached
+  void setUpstreamLinger(std::chrono::milliseconds linger, bool pause);
+
+  // Must be called before any sessions are attached
+  void setSubscribeUpdateDebounce(std::chrono::milliseconds debounce);
+
+  // Must be called before any sessions are attached
+  void setNegativeCacheTtl(std::chrono::milliseconds ttl);
+
+  // Must be called before any sessions are attached
+  void setHotStandby(TrackNamespace prefix);
+
+  // Must be called before any sessions are attached
+  void setDatagramFec(
+      size_t window,
+      uint64_t maxDatagramSize = MoQFecEncoder::kDefaultMaxDatagramSize);
+
+  // Must be called before any sessions are attached
+  void setLatencyProbePrefix(TrackNamespace prefix);
+
+  // Must be called before any sessions are attached.  The shards share
+  // capture.
+  void setCapture(std::shared_ptr<MoQCaptureWriter> capture);
+
+  // Must be called before any sessions are attached and after
+  // setUpstreamOrigin.  Each track is pinned by the shard that owns it.
+  void setPinnedTracks(const std::vector<MoQRelay::PinnedTrack>& pins);
+
+  // Must be called before any sessions are attached
+  void setAbrTrack(
+      const std::string& trackName,
+      const std::vector<MoQRelay::AbrRendition>& renditions,
+      MoQAbrSwitcher::Config config = {});
+
+  // May be called from any thread, each shard switches on its EventBase
+  void setClusterRing(
+      std::shared_ptr<const MoQClusterRing> ring,
+      const std::string& self);
+
+  // Must be called before any sessions are attached
+  void setTrackStatsCallback(
+      std::shared_ptr<MoQTrackStatsCallback> trackStatsCallback);
+
+  // Must be called before any sessions are attached.  Each shard pools its
+  // own upstream sessions on its EventBase.
+  void setUpstreamOrigin(
+      const proxygen::URL& origin,
+      MoQUpstreamPool::Config config);
+
+  folly::coro::Task<SubscribeResult> subscribe(
+      SubscribeRequest subReq,
+      std::shared_ptr<TrackConsumer> consumer) override;
+
+  folly::coro::Task<FetchResult> fetch(
+      Fetch fetch,
+      std::shared_ptr<FetchConsumer> consumer) override;
+
+  folly::coro::Task<TrackStatusResult> trackStatus(
+      TrackStatusRequest trackStatusRequest) override;
+
+  folly::coro::Task<SubscribeAnnouncesResult> subscribeAnnounces(
+      SubscribeAnnounces subAnn) override;
+
+  folly::coro::Task<Subscriber::AnnounceResult> announce(
+      Announce ann,
+      std::shared_ptr<Subscriber::AnnounceCallback> callback) override;
+
+  void removeSession(const std::shared_ptr<MoQSession>& session);
+
+  void goaway(Goaway goaway) override {
+    XLOG(INFO) << "Processing goaway uri=" << goaway.newSessionUri;
+    removeSession(MoQSession::getRequestSession());
+  }
+
+  size_t numShards() const {
+    return shards_.size();
+  }
+
+  // Sums the stats of every shard, each read on its own EventBase
+  folly::coro::Task<MoQRelay::Stats> getStats();
+
+  // Collects the memory report of every shard, each on its own EventBase
+  folly::coro::Task<MoQRelay::MemoryReport> getMemoryReport();
+
+ private:
+  class ShardedAnnounceHandle;
+
+  struct Shard {
+    folly::EventBase* evb;
+    std::shared_ptr<MoQRelay> relay;
+  };
+
+  const Shard& shardFor(const FullTrackName& ftn) const {
+    return shards_[placement_(ftn, shards_.size()) % shards_.size()];
+  }
+
+  std::vector<Shard> shards_;
+  Placement placement_{placeByTrack};
+};
+
+} // namespace moxygen
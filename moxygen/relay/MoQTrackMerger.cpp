@@ -0,0 +1,385 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/relay/MoQTrackMerger.h"
+
+#include <folly/logging/xlog.h>
+
+namespace moxygen {
+
+// One source's view of a merged subgroup.  Objects at or below the last one
+// forwarded, from any source, are dropped.  Objects come from the subgroup's
+// leader, another source only takes over by delivering the very next object
+// or once the leader is gone, so a source that is ahead can't skip objects
+// the leader still has.
+class MoQTrackMerger::SourceSubgroup : public SubgroupConsumer {
+ public:
+  SourceSubgroup(
+      std::shared_ptr<MoQTrackMerger> merger,
+      std::shared_ptr<MergedSubgroup> merged)
+      : merger_(std::move(merger)), merged_(std::move(merged)) {
+    merged_->attached++;
+  }
+
+  ~SourceSubgroup() override {
+    if (merged_->writer == this) {
+      // Gone in the middle of an object, like a reset
+      reset(ResetStreamErrorCode::INTERNAL_ERROR);
+    }
+    finish();
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> object(
+      uint64_t objectID,
+      Payload payload,
+      Extensions extensions,
+      bool finSubgroup) override {
+    if (!accept(objectID)) {
+      return skip(finSubgroup);
+    }
+    take(objectID);
+    auto downstream = merged_->downstream;
+    if (finSubgroup) {
+      complete();
+    }
+    return downstream->object(
+        objectID, std::move(payload), std::move(extensions), finSubgroup);
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objectNotExists(
+      uint64_t objectID,
+      Extensions extensions,
+      bool finSubgroup) override {
+    if (!accept(objectID)) {
+      return skip(finSubgroup);
+    }
+    take(objectID);
+    auto downstream = merged_->downstream;
+    if (finSubgroup) {
+      complete();
+    }
+    return downstream->objectNotExists(
+        objectID, std::move(extensions), finSubgroup);
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> beginObject(
+      uint64_t objectID,
+      uint64_t length,
+      Payload initialPayload,
+      Extensions extensions) override {
+    auto initialLength =
+        initialPayload ? initialPayload->computeChainDataLength() : 0;
+    if (!accept(objectID)) {
+      merger_->duplicates_++;
+      skipRemaining_ = length - std::min(length, initialLength);
+      return folly::unit;
+    }
+    take(objectID);
+    if (initialLength < length) {
+      merged_->writer = this;
+    }
+    return merged_->downstream->beginObject(
+        objectID, length, std::move(initialPayload), std::move(extensions));
+  }
+
+  folly::Expected<ObjectPublishStatus, MoQPublishError> objectPayload(
+      Payload payload,
+      bool finSubgroup) override {
+    if (merged_->writer != this) {
+      // The rest of a duplicate
+      auto length = payload ? payload->computeChainDataLength() : 0;
+      skipRemaining_ -= std::min(skipRemaining_, length);
+      if (skipRemaining_ > 0) {
+        return ObjectPublishStatus::IN_PROGRESS;
+      }
+      if (finSubgroup) {
+        finish();
+      }
+      return ObjectPublishStatus::DONE;
+    }
+    auto downstream = merged_->downstream;
+    auto res = downstream->objectPayload(std::move(payload), finSubgroup);
+    if (res.hasValue() && res.value() == ObjectPublishStatus::DONE) {
+      merged_->writer = nullptr;
+      if (finSubgroup) {
+        complete();
+      }
+    }
+    return res;
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> endOfGroup(
+      uint64_t endOfGroupObjectID,
+      Extensions extensions) override {
+    if (!accept(endOfGroupObjectID)) {
+      return skip(/*finSubgroup=*/true);
+    }
+    auto downstream = merged_->downstream;
+    complete();
+    return downstream->endOfGroup(endOfGroupObjectID, std::move(extensions));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> endOfTrackAndGroup(
+      uint64_t endOfTrackObjectID,
+      Extensions extensions) override {
+    if (!accept(endOfTrackObjectID)) {
+      return skip(/*finSubgroup=*/true);
+    }
+    auto downstream = merged_->downstream;
+    complete();
+    return downstream->endOfTrackAndGroup(
+        endOfTrackObjectID, std::move(extensions));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> endOfSubgroup() override {
+    if (merged_->done || (merged_->leader && merged_->leader != this)) {
+      // The leader ends it, it may still have objects this source skipped
+      finish();
+      return folly::unit;
+    }
+    auto downstream = merged_->downstream;
+    complete();
+    return downstream->endOfSubgroup();
+  }
+
+  void reset(ResetStreamErrorCode error) override {
+    bool cutObject = merged_->writer == this;
+    if (cutObject) {
+      merged_->writer = nullptr;
+    }
+    finish();
+    // Another source may still finish it, unless an object was cut short
+    if (!merged_->done &&
+        (cutObject ||
+         (merged_->attached == 0 && merger_->numSources_ <= 1))) {
+      merged_->done = true;
+      merged_->downstream->reset(error);
+    }
+  }
+
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitReadyToConsume() override {
+    if (!merged_->downstream) {
+      return folly::makeSemiFuture();
+    }
+    return merged_->downstream->awaitReadyToConsume();
+  }
+
+ private:
+  bool accept(uint64_t objectID) const {
+    if (merged_->done || merged_->writer ||
+        (merged_->lastObject && objectID <= *merged_->lastObject)) {
+      return false;
+    }
+    // Past the next object would skip ones the leader may still send
+    return !merged_->leader || merged_->leader == this ||
+        objectID == *merged_->lastObject + 1;
+  }
+
+  // objectID is forwarded from this source, which leads from now on
+  void take(uint64_t objectID) {
+    merged_->lastObject = objectID;
+    merged_->leader = this;
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> skip(bool finSubgroup) {
+    merger_->duplicates_++;
+    if (finSubgroup) {
+      finish();
+    }
+    return folly::unit;
+  }
+
+  // The downstream subgroup is finished by this source
+  void complete() {
+    merged_->done = true;
+    finish();
+  }
+
+  void finish() {
+    if (!finished_) {
+      finished_ = true;
+      if (merged_->leader == this) {
+        merged_->leader = nullptr;
+      }
+      merger_->detach(*merged_);
+    }
+  }
+
+  std::shared_ptr<MoQTrackMerger> merger_;
+  std::shared_ptr<MergedSubgroup> merged_;
+  uint64_t skipRemaining_{0};
+  bool finished_{false};
+};
+
+class MoQTrackMerger::Source : public TrackConsumer {
+ public:
+  explicit Source(std::shared_ptr<MoQTrackMerger> merger)
+      : merger_(std::move(merger)) {
+    merger_->numSources_++;
+  }
+
+  ~Source() override {
+    if (!done_) {
+      merger_->numSources_--;
+    }
+  }
+
+  folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
+  beginSubgroup(uint64_t groupID, uint64_t subgroupID, Priority priority)
+      override {
+    return merger_->beginSubgroup(groupID, subgroupID, priority);
+  }
+
+  folly::Expected<folly::SemiFuture<folly::Unit>, MoQPublishError>
+  awaitStreamCredit() override {
+    return merger_->downstream_->awaitStreamCredit();
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> objectStream(
+      const ObjectHeader& header,
+      Payload payload) override {
+    merger_->advance(header.group);
+    if (!merger_->claimObject(header.group, header.id)) {
+      merger_->duplicates_++;
+      return folly::unit;
+    }
+    return merger_->downstream_->objectStream(header, std::move(payload));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> datagram(
+      const ObjectHeader& header,
+      Payload payload) override {
+    merger_->advance(header.group);
+    if (!merger_->claimObject(header.group, header.id)) {
+      merger_->duplicates_++;
+      return folly::unit;
+    }
+    return merger_->downstream_->datagram(header, std::move(payload));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> groupNotExists(
+      uint64_t groupID,
+      uint64_t subgroup,
+      Priority pri,
+      Extensions extensions) override {
+    merger_->advance(groupID);
+    auto key = std::make_pair(groupID, subgroup);
+    if (groupID < merger_->mergeFloor() || merger_->subgroups_.contains(key)) {
+      merger_->duplicates_++;
+      return folly::unit;
+    }
+    auto merged = std::make_shared<MergedSubgroup>();
+    merged->done = true;
+    merger_->subgroups_.emplace(key, std::move(merged));
+    return merger_->downstream_->groupNotExists(
+        groupID, subgroup, pri, std::move(extensions));
+  }
+
+  folly::Expected<folly::Unit, MoQPublishError> subscribeDone(
+      SubscribeDone subDone) override {
+    if (done_) {
+      return folly::unit;
+    }
+    done_ = true;
+    return merger_->sourceDone(std::move(subDone));
+  }
+
+ private:
+  std::shared_ptr<MoQTrackMerger> merger_;
+  bool done_{false};
+};
+
+std::shared_ptr<TrackConsumer> MoQTrackMerger::addSource() {
+  return std::make_shared<Source>(shared_from_this());
+}
+
+folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
+MoQTrackMerger::beginSubgroup(
+    uint64_t groupID,
+    uint64_t subgroupID,
+    Priority priority) {
+  advance(groupID);
+  if (groupID < mergeFloor()) {
+    // Too far behind, the other sources have moved on
+    auto merged = std::make_shared<MergedSubgroup>();
+    merged->done = true;
+    return std::make_shared<SourceSubgroup>(
+        shared_from_this(), std::move(merged));
+  }
+  auto key = std::make_pair(groupID, subgroupID);
+  auto it = subgroups_.find(key);
+  if (it == subgroups_.end()) {
+    auto res = downstream_->beginSubgroup(groupID, subgroupID, priority);
+    if (res.hasError()) {
+      return folly::makeUnexpected(res.error());
+    }
+    auto merged = std::make_shared<MergedSubgroup>();
+    merged->downstream = std::move(res.value());
+    it = subgroups_.emplace(key, std::move(merged)).first;
+  }
+  return std::make_shared<SourceSubgroup>(shared_from_this(), it->second);
+}
+
+bool MoQTrackMerger::claimObject(uint64_t groupID, uint64_t objectID) {
+  if (groupID < mergeFloor()) {
+    return false;
+  }
+  return objects_[groupID].insert(objectID).second;
+}
+
+void MoQTrackMerger::advance(uint64_t groupID) {
+  if (groupID <= newestGroup_) {
+    return;
+  }
+  newestGroup_ = groupID;
+  auto floor = mergeFloor();
+  for (auto it = subgroups_.begin(); it != subgroups_.end();) {
+    if (it->first.first >= floor) {
+      ++it;
+      continue;
+    }
+    auto& merged = *it->second;
+    if (!merged.done && merged.attached == 0) {
+      // No source came back to finish it
+      merged.done = true;
+      merged.downstream->reset(ResetStreamErrorCode::CANCELLED);
+    }
+    it = subgroups_.erase(it);
+  }
+  for (auto it = objects_.begin(); it != objects_.end();) {
+    if (it->first < floor) {
+      it = objects_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void MoQTrackMerger::detach(MergedSubgroup& merged) {
+  XCHECK_GT(merged.attached, 0u);
+  merged.attached--;
+}
+
+folly::Expected<folly::Unit, MoQPublishError> MoQTrackMerger::sourceDone(
+    SubscribeDone subDone) {
+  XCHECK_GT(numSources_, 0u);
+  numSources_--;
+  if (numSources_ > 0) {
+    XLOG(DBG1) << "Merged source done, " << numSources_ << " left";
+    return folly::unit;
+  }
+  // Nobody is left to finish the subgroups no source has open
+  for (auto& [key, merged] : subgroups_) {
+    if (!merged->done && merged->attached == 0) {
+      merged->done = true;
+      merged->downstream->reset(ResetStreamErrorCode::CANCELLED);
+    }
+  }
+  return downstream_->subscribeDone(std::move(subDone));
+}
+
+} // namespace moxygen
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/container/F14Map.h>
+#include <folly/container/F14Set.h>
+#include <moxygen/MoQConsumers.h>
+
+namespace moxygen {
+
+// Merges one track arriving over several upstream subscriptions, e.g. from a
+// primary announcer and a hot standby, into one consumer.  Every object is
+// forwarded once, in order, so when a source fails the others carry on
+// without a gap downstream.  Within a subgroup a source that is ahead waits
+// for the leading one rather than skip objects.
+//
+// Subgroups are merged by (group, subgroup).  A merged subgroup ends with the
+// first source to finish it, and is reset only once no source is left that
+// could finish it.  Sources more than kMergeGroups behind the newest group
+// are ignored for those groups.
+class MoQTrackMerger : public std::enable_shared_from_this<MoQTrackMerger> {
+ public:
+  static constexpr uint64_t kMergeGroups = 4;
+
+  explicit MoQTrackMerger(std::shared_ptr<TrackConsumer> downstream)
+      : downstream_(std::move(downstream)) {}
+
+  // Returns the consumer for one more upstream subscription.  The downstream
+  // sees SUBSCRIBE_DONE when the last source is done.
+  std::shared_ptr<TrackConsumer> addSource();
+
+  // Sources that haven't sent SUBSCRIBE_DONE
+  size_t numSources() const {
+    return numSources_;
+  }
+
+  // Objects not forwarded because another source delivered them first
+  uint64_t duplicates() const {
+    return duplicates_;
+  }
+
+ private:
+  class Source;
+  class SourceSubgroup;
+
+  struct MergedSubgroup {
+    std::shared_ptr<SubgroupConsumer> downstream;
+    folly::Optional<uint64_t> lastObject;
+    // The source objects are forwarded from, set while it has the subgroup
+    // open.  Others may only deliver the next object.
+    SourceSubgroup* leader{nullptr};
+    // The source delivering a partial object, nobody else may write
+    SourceSubgroup* writer{nullptr};
+    // Sources with the subgroup open
+    size_t attached{0};
+    bool done{false};
+  };
+
+  folly::Expected<std::shared_ptr<SubgroupConsumer>, MoQPublishError>
+  beginSubgroup(uint64_t groupID, uint64_t subgroupID, Priority priority);
+  // Returns false if (groupID, objectID) was already forwarded outside a
+  // subgroup, otherwise records it
+  bool claimObject(uint64_t groupID, uint64_t objectID);
+  // Groups before this are no longer merged
+  uint64_t mergeFloor() const {
+    return newestGroup_ > kMergeGroups ? newestGroup_ - kMergeGroups : 0;
+  }
+  void advance(uint64_t groupID);
+  void detach(MergedSubgroup& merged);
+  folly::Expected<folly::Unit, MoQPublishError> sourceDone(
+      SubscribeDone subDone);
+
+  std::shared_ptr<TrackConsumer> downstream_;
+  size_t numSources_{0};
+  uint64_t duplicates_{0};
+  uint64_t newestGroup_{0};
+  folly::F14FastMap<
+      std::pair<uint64_t, uint64_t>,
+      std::shared_ptr<MergedSubgroup>>
+      subgroups_;
+  // Object streams and datagrams forwarded, by group
+  folly::F14FastMap<uint64_t, folly::F14FastSet<uint64_t>> objects_;
+};
+
+} // namespace moxygen
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/relay/MoQUpstreamPool.h"
+
+#include <algorithm>
+
+namespace moxygen {
+
+folly::coro::Task<std::shared_ptr<MoQSession>> MoQUpstreamPool::getSession(
+    const proxygen::URL& origin) {
+  auto key = origin.getUrl();
+  while (true) {
+    auto& entry = origins_[key];
+    // The open session with the most request IDs left
+    std::shared_ptr<MoQSession> best;
+    for (const auto& upstream : entry.upstreams) {
+      auto& session = upstream->client->moqSession_;
+      if (!session || session->getCancelToken().isCancellationRequested()) {
+        continue;
+      }
+      if (!best || session->availableRequests() > best->availableRequests()) {
+        best = session;
+      }
+    }
+    if (best && best->availableRequests() > 0) {
+      co_return best;
+    }
+    if (entry.connecting) {
+      auto connecting = entry.connecting;
+      co_await connecting->getFuture();
+      continue;
+    }
+    if (entry.upstreams.size() >= config_.maxSessionsPerOrigin) {
+      XLOG(WARN) << "Upstream sessions to " << key
+                 << " are at their request limit";
+      if (best) {
+        best->requestsBlocked();
+      }
+      co_return nullptr;
+    }
+    if (!co_await connect(origin)) {
+      co_return nullptr;
+    }
+  }
+}
+
+folly::coro::Task<bool> MoQUpstreamPool::connect(const proxygen::URL& origin) {
+  auto key = origin.getUrl();
+  auto connecting = std::make_shared<folly::coro::SharedPromise<folly::Unit>>();
+  origins_[key].connecting = connecting;
+  auto client = clientFactory_(evb_, origin);
+  if (resumptionCache_) {
+    client->setResumptionCache(resumptionCache_);
+  }
+  XLOG(DBG1) << "Connecting upstream to " << key;
+  bool connected = false;
+  try {
+    co_await client->setupMoQSession(
+        config_.connectTimeout,
+        config_.transactionTimeout,
+        /*publishHandler=*/nullptr,
+        /*subscribeHandler=*/nullptr);
+    connected = bool(client->moqSession_);
+  } catch (const std::exception& ex) {
+    XLOG(ERR) << "Upstream connect to " << key
+              << " failed err=" << folly::exceptionStr(ex);
+  }
+  // origins_ may have rehashed while connecting
+  auto& entry = origins_[key];
+  entry.connecting.reset();
+  if (!connected) {
+    if (client->moqSession_) {
+      client->moqSession_->close(SessionCloseErrorCode::INTERNAL_ERROR);
+    }
+    // The transport may still call into the client from this loop
+    evb_->runInEventBaseThread([client = std::move(client)] {});
+  } else {
+    auto upstream = std::make_unique<Upstream>();
+    // Closing runs inside the client's session teardown, so remove it later
+    upstream->onClose = std::make_unique<folly::CancellationCallback>(
+        client->moqSession_->getCancelToken(),
+        [evb = evb_,
+         weakPool = std::weak_ptr<MoQUpstreamPool>(shared_from_this()),
+         key,
+         rawClient = client.get()] {
+          evb->runInEventBaseThread([weakPool, key, rawClient] {
+            if (auto pool = weakPool.lock()) {
+              pool->removeUpstream(key, rawClient);
+            }
+          });
+        });
+    upstream->client = std::move(client);
+    entry.upstreams.push_back(std::move(upstream));
+  }
+  connecting->setValue(folly::unit);
+  co_return connected;
+}
+
+void MoQUpstreamPool::removeUpstream(
+    const std::string& key,
+    MoQClient* client) {
+  auto it = origins_.find(key);
+  if (it == origins_.end()) {
+    return;
+  }
+  auto& upstreams = it->second.upstreams;
+  auto upstreamIt = std::find_if(
+      upstreams.begin(), upstreams.end(), [client](const auto& upstream) {
+        return upstream->client.get() == client;
+      });
+  if (upstreamIt != upstreams.end()) {
+    XLOG(DBG1) << "Upstream session to " << key << " closed";
+    upstreams.erase(upstreamIt);
+  }
+  if (upstreams.empty() && !it->second.connecting) {
+    origins_.erase(it);
+  }
+}
+
+size_t MoQUpstreamPool::numSessions() const {
+  size_t sessions = 0;
+  for (const auto& [key, entry] : origins_) {
+    sessions += entry.upstreams.size();
+  }
+  return sessions;
+}
+
+void MoQUpstreamPool::shutdown() {
+  for (auto& [key, entry] : origins_) {
+    for (auto& upstream : entry.upstreams) {
+      if (upstream->client->moqSession_) {
+        upstream->client->moqSession_->close(SessionCloseErrorCode::NO_ERROR);
+      }
+    }
+  }
+}
+
+} // namespace moxygen
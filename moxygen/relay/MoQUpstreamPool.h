@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/CancellationToken.h>
+#include <folly/container/F14Map.h>
+#include <folly/coro/SharedPromise.h>
+#include "moxygen/MoQClient.h"
+
+namespace moxygen {
+
+// Client sessions from a relay to the origins it subscribes upstream to.
+// Requests to an origin share one session until the origin's request ID
+// budget is used up, then spill over to additional sessions.  Sessions are
+// dropped from the pool when they close, and reconnected on the next request.
+//
+// All calls must be made on evb.
+class MoQUpstreamPool : public std::enable_shared_from_this<MoQUpstreamPool> {
+ public:
+  struct Config {
+    // Sessions opened to one origin before requests fail as blocked
+    uint32_t maxSessionsPerOrigin{4};
+    std::chrono::milliseconds connectTimeout{std::chrono::seconds(5)};
+    std::chrono::milliseconds transactionTimeout{std::chrono::seconds(60)};
+    // Reconnect with 0-RTT and send requests before SERVER_SETUP
+    bool earlyData{false};
+  };
+
+  using ClientFactory = std::function<std::unique_ptr<MoQClient>(
+      folly::EventBase*,
+      proxygen::URL)>;
+
+  MoQUpstreamPool(
+      folly::EventBase* evb,
+      Config config,
+      ClientFactory clientFactory = nullptr)
+      : evb_(evb), config_(config), clientFactory_(std::move(clientFactory)) {
+    if (config_.earlyData) {
+      resumptionCache_ = std::make_shared<MoQResumptionCache>();
+    }
+    if (!clientFactory_) {
+      clientFactory_ = [](folly::EventBase* evb, proxygen::URL url) {
+        return std::make_unique<MoQClient>(evb, std::move(url));
+      };
+    }
+  }
+
+  folly::EventBase* getEventBase() const {
+    return evb_;
+  }
+
+  // Returns an open session to origin with a request ID available, connecting
+  // one if needed.  Concurrent callers share a connection attempt.  Returns
+  // nullptr if the origin can't be reached, or if every session is at its
+  // request limit and no more can be opened.
+  folly::coro::Task<std::shared_ptr<MoQSession>> getSession(
+      const proxygen::URL& origin);
+
+  size_t numSessions() const;
+
+  // Closes every pooled session
+  void shutdown();
+
+ private:
+  struct Upstream {
+    std::unique_ptr<MoQClient> client;
+    std::unique_ptr<folly::CancellationCallback> onClose;
+  };
+
+  struct Origin {
+    std::vector<std::unique_ptr<Upstream>> upstreams;
+    // Set while a session to the origin is connecting
+    std::shared_ptr<folly::coro::SharedPromise<folly::Unit>> connecting;
+  };
+
+  // Returns false if the session could not be set up
+  folly::coro::Task<bool> connect(const proxygen::URL& origin);
+  void removeUpstream(const std::string& key, MoQClient* client);
+
+  folly::EventBase* evb_;
+  Config config_;
+  ClientFactory clientFactory_;
+  std::shared_ptr<MoQResumptionCache> resumptionCache_;
+  folly::F14FastMap<std::string, Origin> origins_;
+};
+
+} // namespace moxygen
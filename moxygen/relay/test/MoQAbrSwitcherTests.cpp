@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GMock.h>
+#include <folly/portability/GTest.h>
+#include <moxygen/relay/MoQAbrSwitcher.h>
+#include <moxygen/test/Mocks.h>
+
+using namespace testing;
+namespace moxygen::test {
+
+namespace {
+const std::vector<uint64_t> kBitrates{500000, 1000000, 2000000};
+
+class MoQAbrSwitcherTest : public Test {
+ protected:
+  MoQAbrSwitcherTest()
+      : downstream_(std::make_shared<StrictMock<MockTrackConsumer>>()),
+        switcher_(std::make_shared<MoQAbrSwitcher>(
+            downstream_,
+            kBitrates,
+            [this] { return signals_; },
+            MoQAbrSwitcher::Config{})) {
+    for (size_t i = 0; i < kBitrates.size(); i++) {
+      sources_.push_back(switcher_->source(i));
+    }
+  }
+
+  // Every rendition begins group, returns the rendition forwarded
+  size_t deliverGroup(uint64_t group) {
+    auto subgroup = std::make_shared<StrictMock<MockSubgroupConsumer>>();
+    EXPECT_CALL(*downstream_, beginSubgroup(group, 0, _))
+        .WillOnce(Return(subgroup));
+    for (auto& source : sources_) {
+      EXPECT_TRUE(source->beginSubgroup(group, 0, 0).hasValue());
+    }
+    Mock::VerifyAndClearExpectations(downstream_.get());
+    return switcher_->current();
+  }
+
+  MoQAbrSwitcher::Signals signals_;
+  std::shared_ptr<StrictMock<MockTrackConsumer>> downstream_;
+  std::shared_ptr<MoQAbrSwitcher> switcher_;
+  std::vector<std::shared_ptr<TrackConsumer>> sources_;
+};
+} // namespace
+
+TEST_F(MoQAbrSwitcherTest, FirstGroupFitsEstimate) {
+  // 80% of 3Mbps fits the 2Mbps rendition
+  signals_.sendRateBps = 3000000;
+  auto subgroup = std::make_shared<StrictMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*downstream_, beginSubgroup(0, 0, _)).WillOnce(Return(subgroup));
+  // The lowest rendition begins the group first, its objects are dropped
+  auto low = sources_[0]->beginSubgroup(0, 0, 0);
+  EXPECT_EQ(switcher_->current(), 2);
+  EXPECT_TRUE(low.value()
+                  ->object(0, folly::IOBuf::copyBuffer("low"), {}, false)
+                  .hasValue());
+  auto high = sources_[2]->beginSubgroup(0, 0, 0);
+  EXPECT_EQ(high.value(), subgroup);
+}
+
+TEST_F(MoQAbrSwitcherTest, DownAtOnceUpOneStepPerGroup) {
+  // Nothing known yet
+  EXPECT_EQ(deliverGroup(0), 0);
+  signals_.sendRateBps = 10000000;
+  EXPECT_EQ(deliverGroup(1), 1);
+  EXPECT_EQ(deliverGroup(2), 2);
+  signals_.sendRateBps = 600000;
+  EXPECT_EQ(deliverGroup(3), 0);
+  EXPECT_EQ(switcher_->switches(), 3);
+
+  // Too much buffered steps down even with bandwidth to spare
+  signals_.sendRateBps = 10000000;
+  EXPECT_EQ(deliverGroup(4), 1);
+  signals_.bytesBuffered = MoQAbrSwitcher::Config{}.maxBufferedBytes + 1;
+  EXPECT_EQ(deliverGroup(5), 0);
+}
+
+TEST_F(MoQAbrSwitcherTest, SkipsDisabledRenditions) {
+  switcher_->disable(1);
+  signals_.sendRateBps = 1500000;
+  // Budget 1.2Mbps only fits the disabled rendition, fall back below it
+  EXPECT_EQ(deliverGroup(0), 0);
+  signals_.sendRateBps = 10000000;
+  EXPECT_EQ(deliverGroup(1), 2);
+}
+
+TEST_F(MoQAbrSwitcherTest, DoneWhenEveryRenditionIsDone) {
+  SubscribeDone subDone{
+      RequestID(0), SubscribeDoneStatusCode::TRACK_ENDED, 0, ""};
+  EXPECT_TRUE(sources_[0]->subscribeDone(subDone).hasValue());
+  EXPECT_TRUE(sources_[1]->subscribeDone(subDone).hasValue());
+  EXPECT_CALL(*downstream_, subscribeDone(_)).WillOnce(Return(folly::unit));
+  EXPECT_TRUE(sources_[2]->subscribeDone(subDone).hasValue());
+}
+
+} // namespace moxygen::test
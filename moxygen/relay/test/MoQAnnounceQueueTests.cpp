@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Conv.h>
+#include <folly/coro/Baton.h>
+#include <folly/coro/BlockingWait.h>
+#include <folly/coro/GtestHelpers.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/portability/GMock.h>
+#include <folly/portability/GTest.h>
+#include <moxygen/relay/MoQAnnounceQueue.h>
+#include <moxygen/test/Mocks.h>
+#include <moxygen/test/TestHelpers.h>
+
+using namespace testing;
+namespace moxygen::test {
+
+class MoQAnnounceQueueTest : public ::testing::Test {
+ public:
+  folly::DrivableExecutor* getExecutor() {
+    return &evb_;
+  }
+
+ protected:
+  void SetUp() override {
+    ON_CALL(*subscriber_, announce(_, _))
+        .WillByDefault(Invoke([this](Announce ann, auto) {
+          announced_.push_back(ann.trackNamespace);
+          return reply(std::move(ann));
+        }));
+  }
+
+  // Accepts ann once replies_ is posted
+  folly::coro::Task<Subscriber::AnnounceResult> reply(Announce ann) {
+    auto handle = std::make_shared<NiceMock<MockAnnounceHandle>>(
+        AnnounceOk{ann.requestID, ann.trackNamespace});
+    ON_CALL(*handle, unannounce()).WillByDefault(Invoke([this] {
+      unannounced_++;
+    }));
+    co_await replies_;
+    co_return handle;
+  }
+
+  // Announces name, counting it in accepted_ once the subscriber accepts
+  void push(const std::string& name, std::shared_ptr<bool> announced) {
+    queue_->push(
+        Announce{RequestID(0), TrackNamespace{{name}}, {}},
+        [announced] { return *announced; },
+        [this](std::shared_ptr<Subscriber::AnnounceHandle>) { accepted_++; });
+  }
+
+  void push(const std::string& name) {
+    push(name, std::make_shared<bool>(true));
+  }
+
+  // Lets callbacks posted to the EventBase run
+  folly::coro::Task<void> runUntil(std::function<bool()> done) {
+    for (int i = 0; i < 1000 && !done(); i++) {
+      co_await folly::coro::co_reschedule_on_current_executor;
+    }
+  }
+
+  folly::EventBase evb_;
+  std::shared_ptr<NiceMock<MockSubscriber>> subscriber_ =
+      std::make_shared<NiceMock<MockSubscriber>>();
+  std::shared_ptr<MoQAnnounceQueue> queue_ =
+      std::make_shared<MoQAnnounceQueue>(subscriber_, &evb_, &evb_);
+  folly::coro::Baton replies_;
+  std::vector<TrackNamespace> announced_;
+  size_t accepted_{0};
+  size_t unannounced_{0};
+};
+
+CO_TEST_F_X(MoQAnnounceQueueTest, BatchesUpToInFlightLimit) {
+  constexpr size_t kQueued = MoQAnnounceQueue::kMaxInFlight + 100;
+  for (size_t i = 0; i < kQueued; i++) {
+    push(folly::to<std::string>(i));
+  }
+  EXPECT_TRUE(announced_.empty());
+  // The first batch is sent when the loop runs, and schedules the next
+  co_await folly::coro::co_reschedule_on_current_executor;
+  EXPECT_EQ(announced_.size(), MoQAnnounceQueue::kBatchSize);
+
+  co_await runUntil(
+      [&] { return announced_.size() == MoQAnnounceQueue::kMaxInFlight; });
+  co_await runUntil([] { return false; });
+  EXPECT_EQ(announced_.size(), MoQAnnounceQueue::kMaxInFlight);
+  EXPECT_EQ(queue_->inFlight(), MoQAnnounceQueue::kMaxInFlight);
+  EXPECT_EQ(queue_->pending(), 100);
+
+  replies_.post();
+  co_await runUntil([&] { return accepted_ == kQueued; });
+  EXPECT_EQ(accepted_, kQueued);
+  EXPECT_EQ(announced_.size(), kQueued);
+  EXPECT_EQ(
+      announced_.back(),
+      TrackNamespace{{folly::to<std::string>(kQueued - 1)}});
+  EXPECT_EQ(queue_->inFlight(), 0);
+  EXPECT_EQ(queue_->pending(), 0);
+  EXPECT_EQ(unannounced_, 0);
+}
+
+CO_TEST_F_X(MoQAnnounceQueueTest, SkipsNamespacesUnannouncedWhileQueued) {
+  auto announced = std::make_shared<bool>(true);
+  push("a");
+  push("b", announced);
+  push("c");
+  *announced = false;
+  replies_.post();
+  co_await runUntil([&] { return accepted_ == 2; });
+  EXPECT_EQ(
+      announced_,
+      std::vector<TrackNamespace>(
+          {TrackNamespace{{"a"}}, TrackNamespace{{"c"}}}));
+  EXPECT_EQ(accepted_, 2);
+  EXPECT_EQ(unannounced_, 0);
+}
+
+CO_TEST_F_X(MoQAnnounceQueueTest, UnannouncesLateReplies) {
+  auto announced = std::make_shared<bool>(true);
+  push("a");
+  push("b", announced);
+  co_await runUntil([&] { return announced_.size() == 2; });
+  CO_ASSERT_EQ(announced_.size(), 2);
+  // Unannounced while in flight
+  *announced = false;
+  replies_.post();
+  co_await runUntil([&] { return accepted_ + unannounced_ == 2; });
+  EXPECT_EQ(accepted_, 1);
+  EXPECT_EQ(unannounced_, 1);
+}
+
+CO_TEST_F_X(MoQAnnounceQueueTest, UnannouncesRepliesAfterClose) {
+  push("a");
+  push("b");
+  co_await runUntil([&] { return announced_.size() == 2; });
+  CO_ASSERT_EQ(announced_.size(), 2);
+  push("c");
+  // The subscriber's session was removed
+  queue_->close();
+  EXPECT_EQ(queue_->pending(), 0);
+  replies_.post();
+  co_await runUntil([&] { return unannounced_ == 2; });
+  EXPECT_EQ(unannounced_, 2);
+  EXPECT_EQ(accepted_, 0);
+  EXPECT_EQ(announced_.size(), 2);
+}
+
+} // namespace moxygen::test
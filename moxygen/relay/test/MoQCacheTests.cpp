@@ -5,10 +5,12 @@
  */
 
 #include <folly/coro/Collect.h>
+#include <folly/coro/Sleep.h>
 #include <folly/experimental/coro/GtestHelpers.h>
 #include <folly/io/async/EventBase.h>
 #include <folly/portability/GMock.h>
 #include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
 #include <moxygen/relay/MoQCache.h>
 #include <moxygen/test/Mocks.h>
 #include <moxygen/test/TestUtils.h>
@@ -18,6 +20,10 @@ namespace moxygen::test {
 
 const FullTrackName kTestTrackName{TrackNamespace{{"foo"}}, "bar"};
 
+// populateCacheRange writes 10 objects of 100 bytes per group
+constexpr uint64_t kTestGroupBytes =
+    10 * (sizeof(MoQCache::CacheEntry) + 100);
+
 Fetch getFetch(AbsoluteLocation start, AbsoluteLocation end) {
   return Fetch{0, kTestTrackName, start, end};
 }
@@ -36,6 +42,7 @@ class MoQCacheTest : public ::testing::Test {
     ON_CALL(*trackConsumer_, beginSubgroup(_, _, _))
         .WillByDefault(Return(makeSubgroupConsumer()));
     cache_.clear();
+    cache_.setConfig({});
   }
 
   std::shared_ptr<MockSubgroupConsumer> makeSubgroupConsumer() {
@@ -221,6 +228,108 @@ CO_TEST_F(MoQCacheTest, TestFetchAllHitEOG) {
   EXPECT_EQ(res.value()->fetchOk().endLocation, (AbsoluteLocation{0, 0}));
 }
 
+TEST_F(MoQCacheTest, TestTryFetchFromCacheAllHit) {
+  folly::EventBase evb;
+  populateCacheRange({0, 0}, {0, 10});
+  expectFetchObjects({0, 0}, {0, 10}, false);
+  auto res = cache_.tryFetchFromCache(
+      getFetch({0, 0}, {0, 10}),
+      consumer_,
+      upstream_,
+      folly::getKeepAliveToken(&evb));
+  ASSERT_TRUE(res.has_value());
+  ASSERT_TRUE(res->hasValue());
+  EXPECT_EQ(res->value()->fetchOk().endLocation, (AbsoluteLocation{0, 10}));
+  EXPECT_EQ(cache_.getStats().syncFetches, 1);
+  EXPECT_EQ(cache_.getStats().fetchHits, 1);
+}
+
+TEST_F(MoQCacheTest, TestTryFetchFromCacheGapPublishesNothing) {
+  folly::EventBase evb;
+  // Odd objects are missing
+  populateCacheRange({0, 0}, {0, 10}, 5, 2);
+  auto res = cache_.tryFetchFromCache(
+      getFetch({0, 0}, {0, 9}),
+      consumer_,
+      upstream_,
+      folly::getKeepAliveToken(&evb));
+  EXPECT_FALSE(res.has_value());
+  EXPECT_EQ(cache_.getStats().fetches, 0);
+}
+
+TEST_F(MoQCacheTest, TestTryFetchFromCacheNewestFirst) {
+  folly::EventBase evb;
+  populateCacheRange({0, 0}, {3, 0}, 10, 1, 1, true);
+  {
+    // Groups descend, objects within each group ascend
+    InSequence newestFirst;
+    expectFetchObjects({2, 0}, {2, 11}, false, 10, 1, 1, true);
+    expectFetchObjects({1, 0}, {1, 11}, false, 10, 1, 1, true);
+    expectFetchObjects({0, 3}, {0, 11}, false, 10, 1, 1, true);
+  }
+  auto fetch = getFetch({0, 3}, {2, 11});
+  fetch.groupOrder = GroupOrder::NewestFirst;
+  auto res = cache_.tryFetchFromCache(
+      fetch, consumer_, upstream_, folly::getKeepAliveToken(&evb));
+  ASSERT_TRUE(res.has_value());
+  ASSERT_TRUE(res->hasValue());
+  EXPECT_EQ(res->value()->fetchOk().groupOrder, GroupOrder::NewestFirst);
+  EXPECT_EQ(res->value()->fetchOk().endLocation, (AbsoluteLocation{2, 11}));
+  EXPECT_EQ(cache_.getStats().fetchHits, 1);
+}
+
+CO_TEST_F(MoQCacheTest, TestFetchNewestFirstMissingGroup) {
+  populateCacheRange({0, 0}, {1, 0}, 10, 1, 1, true);
+  populateCacheRange({2, 0}, {3, 0}, 10, 1, 1, true);
+  {
+    InSequence newestFirst;
+    expectFetchObjects({2, 0}, {2, 11}, false, 10, 1, 1, true);
+    expectFetchObjects({1, 0}, {1, 11}, false, 10, 1, 1, true);
+    expectFetchObjects({0, 0}, {0, 11}, false, 10, 1, 1, true);
+  }
+  // Only the missing group goes upstream, before the groups older than it
+  auto upstreamConsumer =
+      expectUpstreamFetch({1, 0}, {1, 0}, false, AbsoluteLocation{1, 10});
+  auto fetch = getFetch({0, 0}, {2, 11});
+  fetch.groupOrder = GroupOrder::NewestFirst;
+  auto res = co_await cache_.fetch(fetch, consumer_, upstream_);
+  EXPECT_TRUE(res.hasValue());
+  EXPECT_EQ(res.value()->fetchOk().groupOrder, GroupOrder::NewestFirst);
+  co_await std::move(upstreamConsumer);
+  serveCacheRangeFromUpstream({1, 0}, {1, 11}, 10, 1, 1, true);
+  for (int i = 0; i < 4; i++) {
+    co_await folly::coro::co_reschedule_on_current_executor;
+  }
+  EXPECT_EQ(cache_.getStats().upstreamFetches, 1);
+  EXPECT_EQ(cache_.getStats().fetchHits, 0);
+}
+
+CO_TEST_F(MoQCacheTest, TestFetchNewestFirstGapIsOneUpstreamFetch) {
+  populateCacheRange({0, 0}, {1, 0}, 10, 1, 1, true);
+  populateCacheRange({4, 0}, {5, 0}, 10, 1, 1, true);
+  {
+    InSequence newestFirst;
+    expectFetchObjects({4, 0}, {4, 11}, false, 10, 1, 1, true);
+    expectFetchObjects({3, 0}, {3, 11}, false, 10, 1, 1, true);
+    expectFetchObjects({1, 0}, {1, 11}, false, 10, 1, 1, true);
+    expectFetchObjects({0, 0}, {0, 11}, false, 10, 1, 1, true);
+  }
+  // Groups 1 through 3 in one FETCH, upstream has no group 2
+  auto upstreamConsumer =
+      expectUpstreamFetch({1, 0}, {3, 0}, false, AbsoluteLocation{3, 10});
+  auto fetch = getFetch({0, 0}, {4, 11});
+  fetch.groupOrder = GroupOrder::NewestFirst;
+  auto res = co_await cache_.fetch(fetch, consumer_, upstream_);
+  EXPECT_TRUE(res.hasValue());
+  co_await std::move(upstreamConsumer);
+  serveCacheRangeFromUpstream({1, 0}, {2, 0}, 10, 1, 1, true, false);
+  serveCacheRangeFromUpstream({3, 0}, {4, 0}, 10, 1, 1, true);
+  for (int i = 0; i < 4; i++) {
+    co_await folly::coro::co_reschedule_on_current_executor;
+  }
+  EXPECT_EQ(cache_.getStats().upstreamFetches, 1);
+}
+
 CO_TEST_F(MoQCacheTest, TestFetchMissUpstreamError) {
   // Test case for fetch with complete cache miss when no track is present
   expectUpstreamFetch(
@@ -274,6 +383,47 @@ CO_TEST_F(MoQCacheTest, TestFetchPartialHitBeginning) {
   serveCacheRangeFromUpstream({0, 5}, {0, 10});
 }
 
+class RecordingFetchStatsCallback : public MoQCache::FetchStatsCallback {
+ public:
+  void onFetchComplete(const MoQCache::FetchStats& stats) override {
+    fetches.push_back(stats);
+  }
+
+  std::vector<MoQCache::FetchStats> fetches;
+};
+
+CO_TEST_F(MoQCacheTest, TestFetchStatsPartialHit) {
+  auto fetchStats = std::make_shared<RecordingFetchStatsCallback>();
+  cache_.setFetchStatsCallback(fetchStats);
+  populateCacheRange({0, 0}, {0, 5});
+  expectFetchObjects({0, 0}, {0, 10}, true);
+  expectUpstreamFetch({0, 5}, {0, 10}, 0, AbsoluteLocation{0, 10});
+  auto res =
+      co_await cache_.fetch(getFetch({0, 0}, {0, 10}), consumer_, upstream_);
+  EXPECT_TRUE(res.hasValue());
+  serveCacheRangeFromUpstream({0, 5}, {0, 10});
+  // Reported once the upstream writeback is released
+  co_await folly::coro::co_reschedule_on_current_executor;
+  EXPECT_TRUE(fetchStats->fetches.empty());
+  upstreamFetchConsumer_.reset();
+  co_await folly::coro::co_reschedule_on_current_executor;
+
+  ASSERT_EQ(fetchStats->fetches.size(), 1);
+  const auto& stats = fetchStats->fetches[0];
+  EXPECT_EQ(stats.fullTrackName, kTestTrackName);
+  EXPECT_EQ(stats.hitObjects, 5);
+  EXPECT_EQ(stats.hitBytes, 500);
+  ASSERT_EQ(stats.missRanges.size(), 1);
+  EXPECT_EQ(stats.missRanges[0].first, (AbsoluteLocation{0, 5}));
+  EXPECT_EQ(stats.missRanges[0].second, (AbsoluteLocation{0, 10}));
+  EXPECT_EQ(stats.upstreamObjects, 5);
+  EXPECT_EQ(stats.upstreamBytes, 500);
+  EXPECT_EQ(cache_.getStats().fetches, 1);
+  EXPECT_EQ(cache_.getStats().fetchHits, 0);
+  EXPECT_EQ(cache_.getStats().upstreamFetches, 1);
+  EXPECT_EQ(cache_.getStats().hitObjects, 5);
+}
+
 CO_TEST_F(MoQCacheTest, TestFetchPartialHitEnd) {
   populateCacheRange({0, 5}, {0, 10});
   expectFetchObjects({0, 0}, {0, 10}, false);
@@ -821,6 +971,127 @@ CO_TEST_F(MoQCacheTest, TestPopulateObjectUsingBeginObjectAndObjectPayload) {
   EXPECT_EQ(res.value()->fetchOk().endLocation, (AbsoluteLocation{0, 1}));
 }
 
+CO_TEST_F(MoQCacheTest, TestFetchCutsThroughArrivingObject) {
+  auto writeback = cache_.getSubscribeWriteback(kTestTrackName, trackConsumer_);
+  auto subgroupConsumer = writeback->beginSubgroup(0, 0, 0).value();
+  subgroupConsumer->beginObject(0, 100, makeBuf(50));
+
+  // Served from the cache as the payload arrives, not fetched upstream
+  EXPECT_CALL(*consumer_, beginObject(0, 0, 0, 100, _, _))
+      .WillOnce(Return(folly::unit));
+  EXPECT_CALL(*consumer_, objectPayload(_, true))
+      .WillOnce([](auto payload, auto) {
+        EXPECT_EQ(payload->computeChainDataLength(), 50);
+        return ObjectPublishStatus::DONE;
+      });
+  auto res =
+      co_await cache_.fetch(getFetch({0, 0}, {0, 1}), consumer_, upstream_);
+  EXPECT_TRUE(res.hasValue());
+  co_await folly::coro::co_reschedule_on_current_executor;
+  EXPECT_EQ(cache_.getStats().cutThroughObjects, 1);
+
+  subgroupConsumer->objectPayload(makeBuf(50), false);
+  co_await folly::coro::co_reschedule_on_current_executor;
+  co_await folly::coro::co_reschedule_on_current_executor;
+}
+
+CO_TEST_F(MoQCacheTest, TestFetchCancelWhileObjectArrives) {
+  auto writeback = cache_.getSubscribeWriteback(kTestTrackName, trackConsumer_);
+  auto subgroupConsumer = writeback->beginSubgroup(0, 0, 0).value();
+  subgroupConsumer->beginObject(0, 100, makeBuf(50));
+
+  EXPECT_CALL(*consumer_, beginObject(0, 0, 0, 100, _, _))
+      .WillOnce(Return(folly::unit));
+  auto res =
+      co_await cache_.fetch(getFetch({0, 0}, {0, 1}), consumer_, upstream_);
+  EXPECT_TRUE(res.hasValue());
+  co_await folly::coro::co_reschedule_on_current_executor;
+  // Waiting on the rest of the payload, which never comes
+  EXPECT_GT(consumer_.use_count(), 1);
+
+  res.value()->fetchCancel();
+  co_await folly::coro::co_reschedule_on_current_executor;
+  co_await folly::coro::co_reschedule_on_current_executor;
+  // The cancelled fetch stopped waiting and let go of the consumer
+  EXPECT_EQ(consumer_.use_count(), 1);
+}
+
+CO_TEST_F(MoQCacheTest, TestReadAheadSequentialFetch) {
+  MoQCache::Config config;
+  config.readAheadGroups = 2;
+  cache_.setConfig(config);
+  populateCacheRange({0, 0}, {2, 0});
+
+  expectFetchObjects({0, 0}, {0, 10}, false);
+  auto res =
+      co_await cache_.fetch(getFetch({0, 0}, {0, 10}), consumer_, upstream_);
+  EXPECT_TRUE(res.hasValue());
+  co_await folly::coro::co_reschedule_on_current_executor;
+  EXPECT_EQ(cache_.getStats().readAheadFetches, 0);
+
+  // The next FETCH starts where the last one ended, read groups 2 and 3
+  auto readAhead =
+      expectUpstreamFetch({2, 0}, {3, 0}, false, AbsoluteLocation{3, 9});
+  expectFetchObjects({1, 0}, {1, 10}, false);
+  res = co_await cache_.fetch(getFetch({1, 0}, {1, 10}), consumer_, upstream_);
+  EXPECT_TRUE(res.hasValue());
+  EXPECT_EQ(cache_.getStats().readAheadFetches, 1);
+  co_await std::move(readAhead);
+  serveCacheRangeFromUpstream({2, 0}, {4, 0});
+  EXPECT_EQ(cache_.numCachedGroups(), 4);
+}
+
+CO_TEST_F(MoQCacheTest, TestSplitFetchInParallel) {
+  MoQCache::Config config;
+  config.fetchChunkGroups = 1;
+  config.maxParallelFetches = 3;
+  cache_.setConfig(config);
+  populateCacheRange({0, 0}, {1, 0});
+
+  // One upstream FETCH per group, all issued before any completes
+  std::map<uint64_t, std::shared_ptr<FetchConsumer>> upstreamFetches;
+  EXPECT_CALL(*upstream_, fetch(_, _))
+      .Times(3)
+      .WillRepeatedly([&](auto fetch, auto consumer) {
+        auto [standalone, joining] = fetchType(fetch);
+        EXPECT_EQ(standalone->start.group, standalone->end.group);
+        upstreamFetches[standalone->start.group] = std::move(consumer);
+        return folly::coro::makeTask<Publisher::FetchResult>(
+            std::make_shared<moxygen::MockFetchHandle>(FetchOk{
+                0, GroupOrder::OldestFirst, false, standalone->end, {}}));
+      });
+  expectFetchObjects({1, 0}, {3, 10}, false);
+  auto executor = co_await folly::coro::co_current_executor;
+  auto fetchResult =
+      cache_.fetch(getFetch({1, 0}, {3, 0}), consumer_, upstream_)
+          .scheduleOn(executor)
+          .start();
+  for (int i = 0; i < 10 && upstreamFetches.size() < 3; i++) {
+    co_await folly::coro::co_reschedule_on_current_executor;
+  }
+  ASSERT_EQ(upstreamFetches.size(), 3);
+
+  // Later chunks finish first, the consumer still gets groups in order
+  for (uint64_t group : {3, 2, 1}) {
+    upstreamFetchConsumer_ = upstreamFetches[group];
+    serveCacheRangeFromUpstream({group, 0}, {group + 1, 0});
+  }
+  auto res = co_await std::move(fetchResult);
+  EXPECT_TRUE(res.hasValue());
+  EXPECT_EQ(cache_.getStats().parallelFetchChunks, 2);
+}
+
+TEST_F(MoQCacheTest, TestEndOfTrack) {
+  auto writeback = cache_.getSubscribeWriteback(kTestTrackName, trackConsumer_);
+  auto subgroupConsumer = writeback->beginSubgroup(3, 0, 0).value();
+  subgroupConsumer->object(0, makeBuf(10));
+  // Still live
+  EXPECT_FALSE(cache_.endOfTrack(kTestTrackName).has_value());
+  subgroupConsumer->endOfTrackAndGroup(1);
+  EXPECT_EQ(cache_.endOfTrack(kTestTrackName), (AbsoluteLocation{3, 1}));
+  EXPECT_FALSE(cache_.endOfTrack(FullTrackName({{"other"}, "track"})));
+}
+
 CO_TEST_F(MoQCacheTest, TestUpstreamFetchUsingBeginObjectAndObjectPayload) {
   // Test case for upstream fetch using beginObject and objectPayload
 
@@ -918,4 +1189,350 @@ CO_TEST_F(MoQCacheTest, TestFetchWithCacheGapAndUpstreamNoObjects) {
   EXPECT_EQ(res.value()->fetchOk().endLocation, (AbsoluteLocation{0, 3}));
 }
 
+CO_TEST_F(MoQCacheTest, TestEvictLeastRecentlyUsedGroups) {
+  cache_.setConfig({2 * kTestGroupBytes, 0, std::chrono::milliseconds(0)});
+  populateCacheRange({0, 0}, {1, 0});
+  EXPECT_EQ(cache_.cachedBytes(), kTestGroupBytes);
+  populateCacheRange({1, 0}, {5, 0});
+  EXPECT_EQ(cache_.numCachedGroups(), 2);
+  EXPECT_LE(cache_.cachedBytes(), 2 * kTestGroupBytes);
+  // Evicted groups no longer count against the track
+  EXPECT_EQ(cache_.trackBytes(kTestTrackName), cache_.cachedBytes());
+
+  // The two most recent groups are still served from cache
+  expectFetchObjects({3, 0}, {4, 10}, false);
+  auto res =
+      co_await cache_.fetch(getFetch({3, 0}, {4, 10}), consumer_, upstream_);
+  EXPECT_TRUE(res.hasValue());
+
+  cache_.clear();
+  EXPECT_EQ(cache_.cachedBytes(), 0);
+  EXPECT_EQ(cache_.numCachedGroups(), 0);
+}
+
+TEST_F(MoQCacheTest, TestCompactsWastefulPayloads) {
+  MoQCache::Config config;
+  config.payloadSlabSize = 64 * 1024;
+  cache_.setConfig(std::move(config));
+  auto writeback = cache_.getSubscribeWriteback(kTestTrackName, trackConsumer_);
+  // A slice of a larger read buffer, as delivered by the transport
+  auto readBuffer = folly::IOBuf::create(16 * 1024);
+  readBuffer->append(16 * 1024);
+  auto slice = readBuffer->cloneOne();
+  slice->trimEnd(16 * 1024 - 100);
+  writeback->datagram(
+      ObjectHeader(TrackAlias(0), 0, 0, 0, 0, 100), std::move(slice));
+  // Already right sized
+  auto exact = folly::IOBuf::create(100);
+  exact->append(100);
+  writeback->datagram(
+      ObjectHeader(TrackAlias(0), 0, 0, 1, 0, 100), std::move(exact));
+  EXPECT_EQ(cache_.getStats().compactedObjects, 1);
+  EXPECT_EQ(cache_.getStats().compactedBytes, 100);
+}
+
+CO_TEST_F(MoQCacheTest, TestFetchHitKeepsGroupResident) {
+  cache_.setConfig({3 * kTestGroupBytes, 0, std::chrono::milliseconds(0)});
+  populateCacheRange({0, 0}, {3, 0});
+  EXPECT_EQ(cache_.numCachedGroups(), 3);
+
+  // Touch group 0, group 1 becomes the least recently used
+  expectFetchObjects({0, 0}, {0, 10}, false);
+  auto res =
+      co_await cache_.fetch(getFetch({0, 0}, {0, 10}), consumer_, upstream_);
+  EXPECT_TRUE(res.hasValue());
+  co_await folly::coro::co_reschedule_on_current_executor;
+
+  populateCacheRange({3, 0}, {4, 0});
+  EXPECT_EQ(cache_.numCachedGroups(), 3);
+
+  // Still a hit, upstream is a StrictMock
+  expectFetchObjects({0, 0}, {0, 10}, false);
+  res = co_await cache_.fetch(getFetch({0, 0}, {0, 10}), consumer_, upstream_);
+  EXPECT_TRUE(res.hasValue());
+  co_await folly::coro::co_reschedule_on_current_executor;
+}
+
+CO_TEST_F(MoQCacheTest, TestMaxGroupsPerTrack) {
+  cache_.setConfig({0, 2, std::chrono::milliseconds(0)});
+  populateCacheRange({0, 0}, {5, 0});
+  EXPECT_EQ(cache_.numCachedGroups(), 2);
+  EXPECT_EQ(cache_.cachedBytes(), 2 * kTestGroupBytes);
+
+  expectFetchObjects({3, 0}, {4, 10}, false);
+  auto res =
+      co_await cache_.fetch(getFetch({3, 0}, {4, 10}), consumer_, upstream_);
+  EXPECT_TRUE(res.hasValue());
+}
+
+CO_TEST_F(MoQCacheTest, TestExpiredGroupFetchedUpstream) {
+  cache_.setConfig({0, 0, std::chrono::milliseconds(1)});
+  populateCacheRange({0, 0}, {1, 10});
+  co_await folly::coro::sleep(std::chrono::milliseconds(5));
+
+  // Group 0 expired, group 1 is the live edge and stays
+  expectFetchObjects({0, 0}, {0, 10}, true);
+  expectUpstreamFetch({0, 0}, {0, 10}, 0, AbsoluteLocation{0, 9});
+  auto res =
+      co_await cache_.fetch(getFetch({0, 0}, {0, 10}), consumer_, upstream_);
+  EXPECT_TRUE(res.hasValue());
+  EXPECT_EQ(cache_.numCachedGroups(), 1);
+  co_await folly::coro::co_reschedule_on_current_executor;
+  serveCacheRangeFromUpstream({0, 0}, {0, 10});
+}
+
+CO_TEST_F(MoQCacheTest, TestDiskTierServesEvictedGroups) {
+  folly::test::TemporaryDirectory dir;
+  cache_.setConfig({0, 0, std::chrono::milliseconds(0), dir.path().string()});
+  populateCacheRange({0, 0}, {2, 0}, 10, 1, 1, true);
+  EXPECT_EQ(cache_.getStats().diskWrites, 2);
+  cache_.clear();
+  EXPECT_EQ(cache_.numCachedGroups(), 0);
+
+  // Upstream is a StrictMock, group 0 comes back from disk
+  expectFetchObjects({0, 0}, {0, 11}, false, 10, 1, 1, true);
+  auto res =
+      co_await cache_.fetch(getFetch({0, 0}, {0, 11}), consumer_, upstream_);
+  EXPECT_TRUE(res.hasValue());
+  co_await folly::coro::co_reschedule_on_current_executor;
+  EXPECT_EQ(cache_.getStats().diskReads, 1);
+  EXPECT_EQ(cache_.numCachedGroups(), 1);
+}
+
+TEST_F(MoQCacheTest, TestDiskTierReloadsSegments) {
+  folly::test::TemporaryDirectory dir;
+  MoQCache::Config config{0, 0, std::chrono::milliseconds(0)};
+  config.diskCacheDir = dir.path().string();
+  cache_.setConfig(config);
+  populateCacheRange({0, 0}, {2, 0}, 10, 1, 1, true);
+  // As if restarted, the disk tier is reopened and indexes the segment
+  cache_.setConfig({});
+  cache_.clear();
+  cache_.setConfig(config);
+
+  folly::EventBase evb;
+  expectFetchObjects({1, 0}, {1, 11}, false, 10, 1, 1, true);
+  auto res = cache_.tryFetchFromCache(
+      getFetch({1, 0}, {1, 11}),
+      consumer_,
+      upstream_,
+      folly::getKeepAliveToken(&evb));
+  ASSERT_TRUE(res.has_value());
+  ASSERT_TRUE(res->hasValue());
+  EXPECT_EQ(res->value()->fetchOk().endLocation, (AbsoluteLocation{1, 11}));
+  EXPECT_EQ(cache_.getStats().diskReads, 1);
+}
+
+// Keyframes in the GOP tests carry their media time in ms in an extension
+constexpr uint64_t kTestKeyframeTimeExt = 0x10;
+
+folly::Optional<std::chrono::microseconds> testKeyframeTime(
+    const Extensions& extensions,
+    const folly::IOBuf*) {
+  for (const auto& ext : extensions) {
+    if (ext.type == kTestKeyframeTimeExt) {
+      return std::chrono::milliseconds(ext.intValue);
+    }
+  }
+  return folly::none;
+}
+
+void writeGop(
+    TrackConsumer& writeback,
+    uint64_t group,
+    uint64_t timeMs,
+    bool endOfGroup) {
+  Extensions keyframe{Extension(kTestKeyframeTimeExt, timeMs)};
+  writeback.datagram(
+      ObjectHeader(TrackAlias(0), group, 0, 0, 0, 100, keyframe), makeBuf(100));
+  for (uint64_t object = 1; object < 3; object++) {
+    writeback.datagram(
+        ObjectHeader(TrackAlias(0), group, 0, object, 0, 100), makeBuf(100));
+  }
+  if (endOfGroup) {
+    writeback.datagram(
+        ObjectHeader(
+            TrackAlias(0), group, 0, 3, 0, ObjectStatus::END_OF_GROUP),
+        nullptr);
+  }
+}
+
+TEST_F(MoQCacheTest, TestGopIndex) {
+  MoQCache::Config config;
+  config.keyframeTime = testKeyframeTime;
+  cache_.setConfig(config);
+  auto writeback = cache_.getSubscribeWriteback(kTestTrackName, trackConsumer_);
+  writeGop(*writeback, 0, 1000, true);
+  writeGop(*writeback, 1, 2000, true);
+  writeGop(*writeback, 2, 3000, false);
+
+  auto latest = cache_.latestGop(kTestTrackName);
+  ASSERT_TRUE(latest.has_value());
+  EXPECT_EQ(latest->keyframe, (AbsoluteLocation{2, 0}));
+  EXPECT_EQ(latest->time, std::chrono::milliseconds(3000));
+  // Group 2 is still being written
+  auto complete = cache_.latestGop(kTestTrackName, true);
+  ASSERT_TRUE(complete.has_value());
+  EXPECT_EQ(complete->keyframe, (AbsoluteLocation{1, 0}));
+
+  EXPECT_FALSE(cache_.gopAt(kTestTrackName, std::chrono::milliseconds(500)));
+  EXPECT_EQ(
+      cache_.gopAt(kTestTrackName, std::chrono::milliseconds(1000))
+          ->keyframe.group,
+      0);
+  EXPECT_EQ(
+      cache_.gopAt(kTestTrackName, std::chrono::milliseconds(2999))
+          ->keyframe.group,
+      1);
+  EXPECT_EQ(
+      cache_.gopAt(kTestTrackName, std::chrono::seconds(10))->keyframe.group,
+      2);
+  EXPECT_FALSE(cache_.latestGop(FullTrackName{TrackNamespace{{"foo"}}, "x"}));
+
+  // Evicted groups leave the index
+  config.maxCachedGroupsPerTrack = 1;
+  cache_.setConfig(config);
+  EXPECT_FALSE(cache_.gopAt(kTestTrackName, std::chrono::milliseconds(2000)));
+  EXPECT_FALSE(cache_.latestGop(kTestTrackName, true));
+}
+
+TEST_F(MoQCacheTest, TestGopIndexClockReset) {
+  MoQCache::Config config;
+  config.keyframeTime = testKeyframeTime;
+  cache_.setConfig(config);
+  auto writeback = cache_.getSubscribeWriteback(kTestTrackName, trackConsumer_);
+  writeGop(*writeback, 0, 1000, true);
+  writeGop(*writeback, 1, 2000, true);
+  // The publisher restarted its media clock
+  writeGop(*writeback, 2, 0, true);
+
+  EXPECT_EQ(cache_.latestGop(kTestTrackName)->keyframe.group, 2);
+  EXPECT_EQ(
+      cache_.gopAt(kTestTrackName, std::chrono::milliseconds(1500))
+          ->keyframe.group,
+      2);
+}
+
+TEST_F(MoQCacheTest, TestAdmissionMinSubscribers) {
+  MoQCache::Config config;
+  config.admission = [] {
+    return std::make_unique<MoQCacheAdmissionPolicy>(
+        MoQCacheAdmissionPolicy::Config{.minSubscribers = 2});
+  };
+  cache_.setConfig(config);
+  size_t subscribers = 1;
+  auto writeback = cache_.getSubscribeWriteback(
+      kTestTrackName, trackConsumer_, [&subscribers] { return subscribers; });
+  for (uint64_t id = 0; id < 3; id++) {
+    EXPECT_TRUE(writeback
+                    ->datagram(
+                        ObjectHeader(TrackAlias(0), 0, 0, id, 0, 100),
+                        makeBuf(100))
+                    .hasValue());
+  }
+  // Forwarded but not cached, the decision holds for the whole group
+  EXPECT_EQ(cache_.numCachedGroups(), 0);
+  EXPECT_EQ(cache_.getStats().rejectedGroups, 1);
+
+  subscribers = 2;
+  auto subgroup = writeback->beginSubgroup(1, 0, 0).value();
+  EXPECT_TRUE(subgroup->object(0, makeBuf(100)).hasValue());
+  EXPECT_TRUE(subgroup->endOfGroup(1).hasValue());
+  EXPECT_EQ(cache_.numCachedGroups(), 1);
+  EXPECT_EQ(cache_.getStats().admittedGroups, 1);
+  EXPECT_EQ(cache_.getStats().rejectedGroups, 1);
+}
+
+TEST_F(MoQCacheTest, TestAdmissionInterleavedGroups) {
+  MoQCache::Config config;
+  config.admission = [] {
+    return std::make_unique<MoQCacheAdmissionPolicy>(
+        MoQCacheAdmissionPolicy::Config{.minSubscribers = 2});
+  };
+  cache_.setConfig(config);
+  size_t subscribers = 1;
+  auto writeback = cache_.getSubscribeWriteback(
+      kTestTrackName, trackConsumer_, [&subscribers] { return subscribers; });
+  auto datagram = [&](uint64_t group, uint64_t id) {
+    EXPECT_TRUE(writeback
+                    ->datagram(
+                        ObjectHeader(TrackAlias(0), group, 0, id, 0, 100),
+                        makeBuf(100))
+                    .hasValue());
+  };
+  datagram(0, 0);
+  datagram(1, 0);
+  // Group 0 keeps its decision, though it would be admitted now
+  subscribers = 2;
+  datagram(0, 1);
+  datagram(1, 1);
+  EXPECT_EQ(cache_.numCachedGroups(), 0);
+  EXPECT_EQ(cache_.getStats().rejectedGroups, 2);
+  EXPECT_EQ(cache_.getStats().admittedGroups, 0);
+}
+
+TEST(MoQCacheAdmissionTest, NamespaceRules) {
+  MoQCacheAdmissionPolicy policy({
+      .neverCache = {TrackNamespace({"live", "private"})},
+      .alwaysCache = {TrackNamespace({"live"})},
+      .minSubscribers = 3,
+  });
+  FullTrackName privateTrack{TrackNamespace({"live", "private", "a"}), "v"};
+  FullTrackName liveTrack{TrackNamespace({"live", "b"}), "v"};
+  FullTrackName otherTrack{TrackNamespace({"vod"}), "v"};
+  EXPECT_FALSE(policy.admit({privateTrack, 0, 10, nullptr}));
+  EXPECT_TRUE(policy.admit({liveTrack, 0, 0, nullptr}));
+  EXPECT_FALSE(policy.admit({otherTrack, 0, 2, nullptr}));
+  EXPECT_TRUE(policy.admit({otherTrack, 0, 3, nullptr}));
+}
+
+TEST(MoQCacheAdmissionTest, FrequencySketch) {
+  MoQCacheAdmissionPolicy policy(
+      {.frequencySketch = true, .sketchWidth = 64, .sampleSize = 40});
+  FullTrackName hot{TrackNamespace({"foo"}), "hot"};
+  FullTrackName cold{TrackNamespace({"foo"}), "cold"};
+  for (int i = 0; i < 5; i++) {
+    policy.onRequest(hot);
+  }
+  policy.onRequest(cold);
+  EXPECT_GE(policy.frequency(hot), 5);
+  EXPECT_GE(policy.frequency(cold), 1);
+  EXPECT_LT(policy.frequency(cold), policy.frequency(hot));
+
+  // With room in the cache, or against its own groups, everything is cached
+  EXPECT_TRUE(policy.admit({cold, 0, 0, nullptr}));
+  EXPECT_TRUE(policy.admit({cold, 1, 0, &cold}));
+  // Near the budget the more popular track wins
+  EXPECT_TRUE(policy.admit({hot, 0, 0, &cold}));
+  EXPECT_FALSE(policy.admit({cold, 2, 0, &hot}));
+
+  // Counters are halved every sampleSize requests, and saturate
+  for (int i = 0; i < 34; i++) {
+    policy.onRequest(hot);
+  }
+  EXPECT_LE(policy.frequency(hot), 8);
+  EXPECT_EQ(policy.frequency(cold), 0);
+}
+
+TEST(MoQCacheObjectsTest, DenseAndSparseObjectIDs) {
+  MoQCache::CacheObjects objects;
+  auto& first = objects.emplace(
+      0, 0, ObjectStatus::NORMAL, noExtensions(), makeBuf(10), true);
+  objects.emplace(
+      1000, 0, ObjectStatus::NORMAL, noExtensions(), makeBuf(10), true);
+  for (uint64_t id = 1; id < 200; id++) {
+    objects.emplace(
+        id, 0, ObjectStatus::NORMAL, noExtensions(), makeBuf(10), true);
+  }
+  EXPECT_EQ(objects.size(), 201u);
+  // Growing the dense range does not move existing entries
+  EXPECT_EQ(objects.find(0), &first);
+  for (uint64_t id = 0; id < 200; id++) {
+    EXPECT_NE(objects.find(id), nullptr);
+  }
+  EXPECT_NE(objects.find(1000), nullptr);
+  EXPECT_EQ(objects.find(200), nullptr);
+  EXPECT_EQ(objects.find(999), nullptr);
+}
+
 } // namespace moxygen::test
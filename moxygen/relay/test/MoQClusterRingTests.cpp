@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/container/F14Map.h>
+#include <folly/portability/GTest.h>
+#include <moxygen/relay/MoQClusterRing.h>
+
+namespace moxygen::test {
+
+namespace {
+const std::vector<std::string> kPeers{
+    "https://relay-a:9668/moq-relay",
+    "https://relay-b:9668/moq-relay",
+    "https://relay-c:9668/moq-relay"};
+
+FullTrackName track(size_t i) {
+  return FullTrackName(
+      {TrackNamespace({"live", folly::to<std::string>("room", i / 10)}),
+       folly::to<std::string>("track", i)});
+}
+} // namespace
+
+TEST(MoQClusterRingTest, PeersAgreeOnOwner) {
+  MoQClusterRing ring(kPeers);
+  // Peer order doesn't matter
+  MoQClusterRing reversed({kPeers.rbegin(), kPeers.rend()});
+  for (size_t i = 0; i < 500; i++) {
+    EXPECT_EQ(ring.owner(track(i)), reversed.owner(track(i)));
+  }
+  EXPECT_TRUE(MoQClusterRing({}).owner(track(0)).empty());
+}
+
+TEST(MoQClusterRingTest, NamespaceBoundariesHashed) {
+  FullTrackName a({TrackNamespace({"ab", "c"}), "t"});
+  FullTrackName b({TrackNamespace({"a", "bc"}), "t"});
+  EXPECT_NE(MoQClusterRing::hash(a), MoQClusterRing::hash(b));
+}
+
+TEST(MoQClusterRingTest, OwnershipSpreadAcrossPeers) {
+  MoQClusterRing ring(kPeers);
+  folly::F14FastMap<std::string, size_t> owned;
+  constexpr size_t kTracks = 3000;
+  for (size_t i = 0; i < kTracks; i++) {
+    owned[ring.owner(track(i))]++;
+  }
+  ASSERT_EQ(owned.size(), kPeers.size());
+  for (const auto& peer : kPeers) {
+    EXPECT_GT(owned[peer], kTracks / kPeers.size() / 2) << peer;
+  }
+}
+
+TEST(MoQClusterRingTest, RemovingPeerMovesOnlyItsTracks) {
+  MoQClusterRing ring(kPeers);
+  MoQClusterRing smaller({kPeers[0], kPeers[2]});
+  for (size_t i = 0; i < 1000; i++) {
+    const auto& before = ring.owner(track(i));
+    if (before != kPeers[1]) {
+      EXPECT_EQ(smaller.owner(track(i)), before);
+    }
+  }
+}
+
+} // namespace moxygen::test
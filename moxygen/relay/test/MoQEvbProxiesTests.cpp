@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/io/async/ScopedEventBaseThread.h>
+#include <folly/portability/GMock.h>
+#include <folly/portability/GTest.h>
+#include <moxygen/relay/MoQEvbProxies.h>
+#include <moxygen/test/Mocks.h>
+
+using namespace testing;
+namespace moxygen::test {
+
+class MoQEvbProxiesTest : public ::testing::Test {
+ protected:
+  // Waits until everything posted to the target evb has run
+  void drain() {
+    evbThread_.getEventBase()->runInEventBaseThreadAndWait([] {});
+  }
+
+  folly::ScopedEventBaseThread evbThread_;
+  std::shared_ptr<MockTrackConsumer> trackConsumer_{
+      std::make_shared<StrictMock<MockTrackConsumer>>()};
+};
+
+TEST_F(MoQEvbProxiesTest, SubgroupDeliveredOnTargetEvb) {
+  auto evb = evbThread_.getEventBase();
+  auto subgroupConsumer = std::make_shared<StrictMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*trackConsumer_, beginSubgroup(0, 0, 1))
+      .WillOnce(Invoke([&](uint64_t, uint64_t, Priority)
+                           -> std::shared_ptr<SubgroupConsumer> {
+        EXPECT_TRUE(evb->isInEventBaseThread());
+        return subgroupConsumer;
+      }));
+  EXPECT_CALL(*subgroupConsumer, object(0, _, _, false))
+      .WillOnce(Invoke([&](uint64_t, Payload, Extensions, bool)
+                           -> folly::Expected<folly::Unit, MoQPublishError> {
+        EXPECT_TRUE(evb->isInEventBaseThread());
+        return folly::unit;
+      }));
+  EXPECT_CALL(*subgroupConsumer, object(1, _, _, true))
+      .WillOnce(Return(folly::unit));
+
+  EvbTrackConsumer proxy(evb, trackConsumer_);
+  auto subgroup = proxy.beginSubgroup(0, 0, 1);
+  ASSERT_TRUE(subgroup.hasValue());
+  EXPECT_TRUE(subgroup.value()
+                  ->object(0, folly::IOBuf::copyBuffer("a"), {}, false)
+                  .hasValue());
+  EXPECT_TRUE(subgroup.value()
+                  ->object(1, folly::IOBuf::copyBuffer("b"), {}, true)
+                  .hasValue());
+  drain();
+}
+
+TEST_F(MoQEvbProxiesTest, ObjectPayloadStatusTrackedLocally) {
+  auto subgroupConsumer = std::make_shared<NiceMock<MockSubgroupConsumer>>();
+  ON_CALL(*subgroupConsumer, beginObject(_, _, _, _))
+      .WillByDefault(Return(folly::unit));
+  ON_CALL(*subgroupConsumer, objectPayload(_, _))
+      .WillByDefault(Return(ObjectPublishStatus::IN_PROGRESS));
+  EXPECT_CALL(*trackConsumer_, beginSubgroup(0, 0, 1))
+      .WillOnce(Return(subgroupConsumer));
+
+  EvbTrackConsumer proxy(evbThread_.getEventBase(), trackConsumer_);
+  auto subgroup = proxy.beginSubgroup(0, 0, 1).value();
+  EXPECT_TRUE(
+      subgroup->beginObject(0, 4, folly::IOBuf::copyBuffer("a"), {})
+          .hasValue());
+  auto res = subgroup->objectPayload(folly::IOBuf::copyBuffer("b"), false);
+  ASSERT_TRUE(res.hasValue());
+  EXPECT_EQ(res.value(), ObjectPublishStatus::IN_PROGRESS);
+  res = subgroup->objectPayload(folly::IOBuf::copyBuffer("cd"), false);
+  ASSERT_TRUE(res.hasValue());
+  EXPECT_EQ(res.value(), ObjectPublishStatus::DONE);
+  drain();
+}
+
+TEST_F(MoQEvbProxiesTest, ErrorSurfacesOnNextCall) {
+  EXPECT_CALL(*trackConsumer_, objectStream(_, _))
+      .WillOnce(Return(folly::makeUnexpected(
+          MoQPublishError(MoQPublishError::WRITE_ERROR, "write failed"))));
+
+  EvbTrackConsumer proxy(evbThread_.getEventBase(), trackConsumer_);
+  ObjectHeader header(TrackAlias(0), 0, 0, 0);
+  EXPECT_TRUE(
+      proxy.objectStream(header, folly::IOBuf::copyBuffer("a")).hasValue());
+  drain();
+  auto res = proxy.objectStream(header, folly::IOBuf::copyBuffer("b"));
+  ASSERT_TRUE(res.hasError());
+  EXPECT_EQ(res.error().code, MoQPublishError::CANCELLED);
+  EXPECT_TRUE(proxy.beginSubgroup(0, 0, 0).hasError());
+}
+
+} // namespace moxygen::test
@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GMock.h>
+#include <folly/portability/GTest.h>
+#include <moxygen/relay/MoQForwarder.h>
+#include <moxygen/test/Mocks.h>
+
+using namespace testing;
+namespace moxygen::test {
+
+namespace {
+const FullTrackName kTestTrackName{TrackNamespace{{"foo"}}, "bar"};
+
+class MockForwarderCallback : public MoQForwarder::Callback {
+ public:
+  MOCK_METHOD(void, onEmpty, (MoQForwarder*), (override));
+  MOCK_METHOD(void, onSubscribersChanged, (MoQForwarder*), (override));
+};
+
+SubscribeRequest getSubscribe() {
+  return SubscribeRequest{
+      RequestID(0),
+      TrackAlias(0),
+      kTestTrackName,
+      0,
+      GroupOrder::OldestFirst,
+      true,
+      LocationType::LatestObject,
+      folly::none,
+      0,
+      {}};
+}
+} // namespace
+
+TEST(MoQForwarderTest, TooFarBehindSkipsToNextGroup) {
+  MoQForwarder forwarder(kTestTrackName);
+  auto trackConsumer = std::make_shared<StrictMock<MockTrackConsumer>>();
+  forwarder.addSubscriber(nullptr, getSubscribe(), trackConsumer);
+
+  auto subgroup0 = std::make_shared<StrictMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*trackConsumer, beginSubgroup(0, 0, _))
+      .WillOnce(Return(subgroup0));
+  EXPECT_CALL(*subgroup0, object(0, _, _, false))
+      .WillOnce(Return(folly::makeUnexpected(
+          MoQPublishError(MoQPublishError::TOO_FAR_BEHIND))));
+  EXPECT_CALL(*subgroup0, reset(ResetStreamErrorCode::DELIVERY_TIMEOUT));
+
+  auto sg = forwarder.beginSubgroup(0, 0, 0);
+  ASSERT_TRUE(sg.hasValue());
+  EXPECT_TRUE(sg.value()
+                  ->object(0, folly::IOBuf::copyBuffer("a"), {}, false)
+                  .hasValue());
+  // The rest of group 0 is not forwarded
+  EXPECT_TRUE(sg.value()
+                  ->object(1, folly::IOBuf::copyBuffer("b"), {}, true)
+                  .hasValue());
+  EXPECT_TRUE(forwarder.beginSubgroup(0, 1, 0).hasValue());
+
+  auto subgroup1 = std::make_shared<StrictMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*trackConsumer, beginSubgroup(1, 0, _))
+      .WillOnce(Return(subgroup1));
+  EXPECT_CALL(*subgroup1, object(0, _, _, true))
+      .WillOnce(Return(folly::unit));
+  sg = forwarder.beginSubgroup(1, 0, 0);
+  ASSERT_TRUE(sg.hasValue());
+  EXPECT_TRUE(sg.value()
+                  ->object(0, folly::IOBuf::copyBuffer("c"), {}, true)
+                  .hasValue());
+  EXPECT_FALSE(forwarder.empty());
+}
+
+TEST(MoQForwarderTest, ObjectsBatch) {
+  MoQForwarder forwarder(kTestTrackName);
+  std::vector<std::shared_ptr<StrictMock<MockSubgroupConsumer>>> subgroups;
+  for (int i = 0; i < 2; i++) {
+    auto trackConsumer = std::make_shared<StrictMock<MockTrackConsumer>>();
+    auto subscribe = getSubscribe();
+    subscribe.requestID = RequestID(i);
+    forwarder.addSubscriber(nullptr, subscribe, trackConsumer);
+    auto subgroup = std::make_shared<StrictMock<MockSubgroupConsumer>>();
+    EXPECT_CALL(*trackConsumer, beginSubgroup(0, 0, _))
+        .WillOnce(Return(subgroup));
+    InSequence seq;
+    EXPECT_CALL(*subgroup, object(0, _, _, false))
+        .WillOnce(Return(folly::unit));
+    EXPECT_CALL(*subgroup, object(1, _, _, true))
+        .WillOnce(Return(folly::unit));
+    subgroups.push_back(std::move(subgroup));
+  }
+
+  auto sg = forwarder.beginSubgroup(0, 0, 0);
+  ASSERT_TRUE(sg.hasValue());
+  std::vector<SubgroupObject> batch;
+  batch.push_back({0, folly::IOBuf::copyBuffer("a"), {}});
+  batch.push_back({1, folly::IOBuf::copyBuffer("b"), {}});
+  EXPECT_TRUE(sg.value()->objects(batch, true).hasValue());
+  EXPECT_EQ(forwarder.latest(), AbsoluteLocation(0, 1));
+}
+
+TEST(MoQForwarderTest, PublishErrorRemovesSubscriber) {
+  MoQForwarder forwarder(kTestTrackName);
+  auto trackConsumer = std::make_shared<StrictMock<MockTrackConsumer>>();
+  forwarder.addSubscriber(nullptr, getSubscribe(), trackConsumer);
+
+  auto subgroup0 = std::make_shared<StrictMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*trackConsumer, beginSubgroup(0, 0, _))
+      .WillOnce(Return(subgroup0));
+  EXPECT_CALL(*subgroup0, object(0, _, _, false))
+      .WillOnce(Return(folly::makeUnexpected(
+          MoQPublishError(MoQPublishError::WRITE_ERROR))));
+  EXPECT_CALL(*subgroup0, reset(ResetStreamErrorCode::CANCELLED));
+  EXPECT_CALL(*trackConsumer, subscribeDone(_))
+      .WillOnce(Return(folly::unit));
+
+  auto sg = forwarder.beginSubgroup(0, 0, 0);
+  ASSERT_TRUE(sg.hasValue());
+  EXPECT_TRUE(sg.value()
+                  ->object(0, folly::IOBuf::copyBuffer("a"), {}, false)
+                  .hasValue());
+  EXPECT_TRUE(forwarder.empty());
+}
+
+TEST(MoQForwarderTest, SubscriberRemovedDuringFanOut) {
+  MoQForwarder forwarder(kTestTrackName);
+  std::vector<std::shared_ptr<StrictMock<MockSubgroupConsumer>>> subgroups;
+  for (int i = 0; i < 2; i++) {
+    auto trackConsumer = std::make_shared<StrictMock<MockTrackConsumer>>();
+    auto subscribe = getSubscribe();
+    subscribe.requestID = RequestID(i);
+    forwarder.addSubscriber(nullptr, subscribe, trackConsumer);
+    auto subgroup = std::make_shared<StrictMock<MockSubgroupConsumer>>();
+    EXPECT_CALL(*trackConsumer, beginSubgroup(0, 0, _))
+        .WillOnce(Return(subgroup));
+    if (i == 0) {
+      EXPECT_CALL(*subgroup, object(0, _, _, false))
+          .WillOnce(Return(folly::makeUnexpected(
+              MoQPublishError(MoQPublishError::WRITE_ERROR))));
+      EXPECT_CALL(*subgroup, reset(ResetStreamErrorCode::CANCELLED));
+      EXPECT_CALL(*trackConsumer, subscribeDone(_))
+          .WillOnce(Return(folly::unit));
+    } else {
+      EXPECT_CALL(*subgroup, object(0, _, _, false))
+          .WillOnce(Return(folly::unit));
+    }
+    subgroups.push_back(std::move(subgroup));
+  }
+
+  auto sg = forwarder.beginSubgroup(0, 0, 0);
+  ASSERT_TRUE(sg.hasValue());
+  std::weak_ptr<MockSubgroupConsumer> removed = subgroups[0];
+  subgroups[0].reset();
+  EXPECT_TRUE(sg.value()
+                  ->object(0, folly::IOBuf::copyBuffer("a"), {}, false)
+                  .hasValue());
+  // Kept alive for the rest of the fan-out, released after it
+  EXPECT_TRUE(removed.expired());
+  EXPECT_EQ(forwarder.numSubscribers(), 1);
+}
+
+TEST(MoQForwarderTest, OversizedDatagramGoesOnStream) {
+  folly::EventBase evb;
+  auto session = std::make_shared<MoQSession>(
+      static_cast<proxygen::WebTransport*>(nullptr), &evb);
+  session->setTransportMetricsProvider([] {
+    MoQTransportMetrics metrics;
+    metrics.maxDatagramSize = 200;
+    return folly::Optional<MoQTransportMetrics>(metrics);
+  });
+  MoQForwarder forwarder(kTestTrackName);
+  auto trackConsumer = std::make_shared<StrictMock<MockTrackConsumer>>();
+  forwarder.addSubscriber(session, getSubscribe(), trackConsumer);
+
+  EXPECT_CALL(*trackConsumer, datagram(_, _)).WillOnce(Return(folly::unit));
+  EXPECT_TRUE(forwarder
+                  .datagram(
+                      ObjectHeader(TrackAlias(0), 0, 0, 0, 0, 10),
+                      folly::IOBuf::copyBuffer(std::string(10, 'a')))
+                  .hasValue());
+
+  // Too large for the path, sent alone on subgroup 1
+  auto subgroup = std::make_shared<StrictMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*trackConsumer, beginSubgroup(0, 1, _))
+      .WillOnce(Return(subgroup));
+  EXPECT_CALL(*subgroup, object(1, _, _, true)).WillOnce(Return(folly::unit));
+  EXPECT_TRUE(forwarder
+                  .datagram(
+                      ObjectHeader(TrackAlias(0), 0, 0, 1, 0, 500),
+                      folly::IOBuf::copyBuffer(std::string(500, 'b')))
+                  .hasValue());
+}
+
+TEST(MoQForwarderTest, DuplicateSessionSubscribeKeepsFirst) {
+  folly::EventBase evb;
+  auto session = std::make_shared<MoQSession>(
+      static_cast<proxygen::WebTransport*>(nullptr), &evb);
+  MoQForwarder forwarder(kTestTrackName);
+  auto callback = std::make_shared<StrictMock<MockForwarderCallback>>();
+  forwarder.setCallback(callback);
+  auto first = forwarder.addSubscriber(
+      session, getSubscribe(), std::make_shared<NiceMock<MockTrackConsumer>>());
+  auto subscribe = getSubscribe();
+  subscribe.requestID = RequestID(1);
+  auto second = forwarder.addSubscriber(
+      session, subscribe, std::make_shared<NiceMock<MockTrackConsumer>>());
+  EXPECT_EQ(first, second);
+  EXPECT_EQ(forwarder.numSubscribers(), 1);
+
+  EXPECT_CALL(*callback, onEmpty(&forwarder));
+  forwarder.removeSession(session);
+  EXPECT_TRUE(forwarder.empty());
+}
+
+TEST(MoQForwarderTest, SessionlessSubscribersUnsubscribe) {
+  MoQForwarder forwarder(kTestTrackName);
+  auto callback = std::make_shared<StrictMock<MockForwarderCallback>>();
+  forwarder.setCallback(callback);
+  std::vector<std::shared_ptr<MoQForwarder::Subscriber>> subscribers;
+  for (int i = 0; i < 2; i++) {
+    auto subscribe = getSubscribe();
+    subscribe.requestID = RequestID(i);
+    subscribers.push_back(forwarder.addSubscriber(
+        nullptr, subscribe, std::make_shared<NiceMock<MockTrackConsumer>>()));
+  }
+  EXPECT_EQ(forwarder.numSubscribers(), 2);
+
+  EXPECT_CALL(*callback, onSubscribersChanged(&forwarder));
+  subscribers[1]->unsubscribe();
+  EXPECT_EQ(forwarder.numSubscribers(), 1);
+  EXPECT_CALL(*callback, onEmpty(&forwarder));
+  subscribers[0]->unsubscribe();
+  EXPECT_TRUE(forwarder.empty());
+  // A second unsubscribe is a no-op
+  subscribers[0]->unsubscribe();
+}
+
+TEST(MoQForwarderTest, RangeActivatesAndEndsSubscriber) {
+  MoQForwarder forwarder(kTestTrackName);
+  auto trackConsumer = std::make_shared<StrictMock<MockTrackConsumer>>();
+  auto subscribe = getSubscribe();
+  subscribe.locType = LocationType::AbsoluteRange;
+  subscribe.start = AbsoluteLocation{2, 0};
+  subscribe.endGroup = 3;
+  forwarder.addSubscriber(nullptr, subscribe, trackConsumer);
+  auto publish = [&](uint64_t group) {
+    EXPECT_TRUE(forwarder
+                    .objectStream(
+                        ObjectHeader(TrackAlias(0), group, 0, 0),
+                        folly::IOBuf::copyBuffer("x"))
+                    .hasValue());
+  };
+
+  // Nothing before the start
+  publish(1);
+  EXPECT_CALL(*trackConsumer, objectStream(_, _))
+      .Times(2)
+      .WillRepeatedly(Return(folly::unit));
+  publish(2);
+  publish(3);
+  // Passing the end ends the subscription without forwarding
+  EXPECT_CALL(*trackConsumer, subscribeDone(_))
+      .WillOnce(Invoke([](const SubscribeDone& subDone) {
+        EXPECT_EQ(
+            subDone.statusCode, SubscribeDoneStatusCode::SUBSCRIPTION_ENDED);
+        return folly::unit;
+      }));
+  publish(4);
+  EXPECT_TRUE(forwarder.empty());
+}
+
+TEST(MoQForwarderTest, UpstreamDoneWhenEmptyCallsOnEmpty) {
+  MoQForwarder forwarder(kTestTrackName);
+  auto callback = std::make_shared<StrictMock<MockForwarderCallback>>();
+  forwarder.setCallback(callback);
+  EXPECT_FALSE(forwarder.upstreamDone());
+  // The relay may keep an empty forwarder subscribed, it has to hear about
+  // the track ending too
+  EXPECT_CALL(*callback, onEmpty(&forwarder));
+  forwarder.subscribeDone(
+      {RequestID(0), SubscribeDoneStatusCode::TRACK_ENDED, 0, ""});
+  EXPECT_TRUE(forwarder.upstreamDone());
+}
+
+TEST(MoQForwarderTest, DemandAggregatesSubscribers) {
+  MoQForwarder forwarder(kTestTrackName);
+  auto callback = std::make_shared<StrictMock<MockForwarderCallback>>();
+  forwarder.setCallback(callback);
+  EXPECT_FALSE(forwarder.demand().priority.has_value());
+  std::vector<std::shared_ptr<MoQForwarder::Subscriber>> subscribers;
+  for (uint8_t priority : {10, 5}) {
+    auto subscribe = getSubscribe();
+    subscribe.requestID = RequestID(priority);
+    subscribe.priority = priority;
+    subscribers.push_back(forwarder.addSubscriber(
+        nullptr, subscribe, std::make_shared<MockTrackConsumer>()));
+  }
+  EXPECT_EQ(forwarder.demand().priority, 5);
+  EXPECT_TRUE(forwarder.demand().forward);
+
+  EXPECT_CALL(*callback, onSubscribersChanged(&forwarder)).Times(2);
+  subscribers[1]->subscribeUpdate({RequestID(5), {0, 0}, 0, 20, false, {}});
+  EXPECT_EQ(forwarder.demand().priority, 10);
+  EXPECT_TRUE(forwarder.demand().forward);
+  subscribers[0]->subscribeUpdate({RequestID(10), {0, 0}, 0, 10, false, {}});
+  EXPECT_FALSE(forwarder.demand().forward);
+}
+
+} // namespace moxygen::test
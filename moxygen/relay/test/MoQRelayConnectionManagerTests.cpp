@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/coro/BlockingWait.h>
+#include <folly/coro/GtestHelpers.h>
+#include <folly/coro/Sleep.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/portability/GMock.h>
+#include <folly/portability/GTest.h>
+#include <moxygen/relay/MoQRelayConnectionManager.h>
+#include <moxygen/test/FakeMoQClient.h>
+#include <moxygen/test/Mocks.h>
+#include <moxygen/test/TestHelpers.h>
+
+using namespace testing;
+namespace moxygen::test {
+
+namespace {
+const TrackNamespace kNamespace{{"foo"}};
+} // namespace
+
+class MoQRelayConnectionManagerTest : public ::testing::Test {
+ public:
+  folly::DrivableExecutor* getExecutor() {
+    return &evb_;
+  }
+
+ protected:
+  // One relay the manager can connect to
+  struct Relay {
+    std::shared_ptr<NiceMock<MockSubscriber>> subscriber{
+        std::make_shared<NiceMock<MockSubscriber>>()};
+    std::vector<TrackNamespace> announces;
+    // Connects that fail before one succeeds
+    uint32_t failConnects{0};
+    uint32_t connects{0};
+    // The latest client that connects, owned by the manager
+    FakeMoQClient* client{nullptr};
+  };
+
+  void SetUp() override {
+    config_.healthCheckInterval = std::chrono::milliseconds(0);
+    config_.reconnectDelay = std::chrono::milliseconds(20);
+    for (auto& [host, relay] : relays_) {
+      ON_CALL(*relay.subscriber, announce(_, _))
+          .WillByDefault(Invoke(
+              [&relay](Announce ann, auto)
+                  -> folly::coro::Task<Subscriber::AnnounceResult> {
+                relay.announces.push_back(ann.trackNamespace);
+                return folly::coro::makeTask<Subscriber::AnnounceResult>(
+                    std::make_shared<NiceMock<MockAnnounceHandle>>(
+                        AnnounceOk{ann.requestID, ann.trackNamespace}));
+              }));
+    }
+  }
+
+  std::shared_ptr<MoQRelayConnectionManager> makeManager() {
+    std::vector<proxygen::URL> urls;
+    for (const auto& host : {"a", "b"}) {
+      urls.emplace_back(
+          folly::to<std::string>("moqt://", host, ".example:4433/moq"));
+    }
+    return std::make_shared<MoQRelayConnectionManager>(
+        &evb_,
+        std::move(urls),
+        config_,
+        [this](folly::EventBase* evb, proxygen::URL url) {
+          auto& relay = relays_.at(url.getHost().substr(0, 1));
+          auto client = std::make_unique<FakeMoQClient>(
+              evb, std::move(url), nullptr, relay.subscriber);
+          // A failed client is freed by the manager right away
+          bool fail = relay.connects++ < relay.failConnects;
+          client->setFailConnect(fail);
+          relay.client = fail ? nullptr : client.get();
+          return client;
+        });
+  }
+
+  std::shared_ptr<MoQSession> session(const std::string& host) {
+    auto client = relays_.at(host).client;
+    return client ? client->moqSession_ : nullptr;
+  }
+
+  // Runs the EventBase, including timers, until done or a second passes
+  folly::coro::Task<void> runUntil(std::function<bool()> done) {
+    for (int i = 0; i < 1000 && !done(); i++) {
+      co_await folly::coro::sleep(std::chrono::milliseconds(1));
+    }
+  }
+
+  folly::EventBase evb_;
+  MoQRelayConnectionManager::Config config_;
+  std::map<std::string, Relay> relays_{{"a", {}}, {"b", {}}};
+};
+
+CO_TEST_F_X(MoQRelayConnectionManagerTest, FirstRelayBecomesActive) {
+  auto manager = makeManager();
+  manager->start(nullptr, nullptr, {kNamespace});
+  co_await runUntil([&] {
+    return manager->getSession() && relays_["a"].announces.size() == 1 &&
+        session("b");
+  });
+  EXPECT_EQ(manager->getSession(), session("a"));
+  EXPECT_EQ(relays_["a"].announces, std::vector<TrackNamespace>{kNamespace});
+  // b is connected as a warm spare, without the ANNOUNCE
+  EXPECT_EQ(relays_["b"].connects, 1);
+  EXPECT_TRUE(relays_["b"].announces.empty());
+  manager->shutdown();
+}
+
+CO_TEST_F_X(MoQRelayConnectionManagerTest, FailsOverWhenActiveCloses) {
+  auto manager = makeManager();
+  manager->start(nullptr, nullptr, {kNamespace});
+  co_await runUntil([&] { return manager->getSession() && session("b"); });
+  CO_ASSERT_EQ(manager->getSession(), session("a"));
+
+  session("a")->close(SessionCloseErrorCode::INTERNAL_ERROR);
+  co_await runUntil([&] {
+    return relays_["b"].announces.size() == 1 && relays_["a"].connects == 2;
+  });
+  EXPECT_EQ(manager->getSession(), session("b"));
+  EXPECT_EQ(relays_["b"].announces, std::vector<TrackNamespace>{kNamespace});
+  // The lost relay is reconnected as the spare
+  EXPECT_EQ(relays_["a"].connects, 2);
+  EXPECT_EQ(relays_["a"].announces.size(), 1);
+  manager->shutdown();
+}
+
+CO_TEST_F_X(MoQRelayConnectionManagerTest, FailoverMovesToSpare) {
+  auto manager = makeManager();
+  manager->start(nullptr, nullptr, {kNamespace});
+  co_await runUntil([&] { return manager->getSession() && session("b"); });
+  auto active = manager->getSession();
+  CO_ASSERT_EQ(active, session("a"));
+
+  // e.g. the active relay sent GOAWAY
+  manager->failover(active);
+  EXPECT_EQ(manager->getSession(), session("b"));
+  co_await runUntil([&] { return relays_["b"].announces.size() == 1; });
+  EXPECT_EQ(relays_["b"].announces, std::vector<TrackNamespace>{kNamespace});
+  manager->shutdown();
+}
+
+CO_TEST_F_X(MoQRelayConnectionManagerTest, ReconnectsAfterBackoff) {
+  relays_["a"].failConnects = 1;
+  auto manager = makeManager();
+  manager->start(nullptr, nullptr, {kNamespace});
+  // b takes over while a waits out the reconnect delay
+  co_await runUntil([&] { return relays_["b"].announces.size() == 1; });
+  EXPECT_EQ(manager->getSession(), session("b"));
+  EXPECT_EQ(relays_["a"].connects, 1);
+
+  co_await runUntil([&] { return relays_["a"].connects == 2 && session("a"); });
+  EXPECT_EQ(relays_["a"].connects, 2);
+  EXPECT_TRUE(session("a"));
+  // The active relay is kept, a is only a spare now
+  EXPECT_EQ(manager->getSession(), session("b"));
+  EXPECT_TRUE(relays_["a"].announces.empty());
+  manager->shutdown();
+}
+
+} // namespace moxygen::test
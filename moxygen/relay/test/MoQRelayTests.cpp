@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/coro/BlockingWait.h>
+#include <folly/coro/GtestHelpers.h>
+#include <folly/coro/Sleep.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/portability/GMock.h>
+#include <folly/portability/GTest.h>
+#include <moxygen/relay/MoQRelay.h>
+#include <moxygen/relay/MoQUpstreamPool.h>
+#include <moxygen/test/FakeMoQClient.h>
+#include <moxygen/test/Mocks.h>
+#include <moxygen/test/TestHelpers.h>
+
+using namespace testing;
+namespace moxygen::test {
+
+namespace {
+
+const TrackNamespace kNamespace{{"live"}};
+
+} // namespace
+
+class MoQRelayTest : public ::testing::Test {
+ public:
+  folly::DrivableExecutor* getExecutor() {
+    return &evb_;
+  }
+
+ protected:
+  void SetUp() override {
+    ON_CALL(*origin_, subscribe(_, _))
+        .WillByDefault(Invoke(
+            [this](SubscribeRequest sub, std::shared_ptr<TrackConsumer> pub)
+                -> folly::coro::Task<Publisher::SubscribeResult> {
+              originSubscribes_.push_back(sub.fullTrackName);
+              publishers_.push_back(std::move(pub));
+              return folly::coro::makeTask<Publisher::SubscribeResult>(
+                  std::make_shared<NiceMock<MockSubscriptionHandle>>(
+                      SubscribeOk{
+                          sub.requestID,
+                          std::chrono::milliseconds(0),
+                          GroupOrder::OldestFirst,
+                          folly::none,
+                          {}}));
+            }));
+  }
+
+  std::shared_ptr<MoQUpstreamPool> makePool() {
+    return std::make_shared<MoQUpstreamPool>(
+        &evb_,
+        MoQUpstreamPool::Config{},
+        [this](folly::EventBase* evb, proxygen::URL url) {
+          return std::make_unique<FakeMoQClient>(evb, std::move(url), origin_);
+        });
+  }
+
+  // Runs the EventBase, including timers, until done or a second passes
+  folly::coro::Task<void> runUntil(std::function<bool()> done) {
+    for (int i = 0; i < 1000 && !done(); i++) {
+      co_await folly::coro::sleep(std::chrono::milliseconds(1));
+    }
+  }
+
+  folly::EventBase evb_;
+  std::shared_ptr<NiceMock<MockPublisher>> origin_ =
+      std::make_shared<NiceMock<MockPublisher>>();
+  std::vector<FullTrackName> originSubscribes_;
+  // The relay's upstream subscriptions, as the origin publishes to them
+  std::vector<std::shared_ptr<TrackConsumer>> publishers_;
+  proxygen::URL originUrl_{"moqt://origin.example:4433/moq"};
+};
+
+CO_TEST_F_X(MoQRelayTest, PinsOnlyOwnedTracks) {
+  auto pool = makePool();
+  auto relay = std::make_shared<MoQRelay>(/*enableCache=*/false);
+  relay->setUpstreamOrigin(originUrl_, pool);
+  const FullTrackName trackA{kNamespace, "a"};
+  relay->setPinnedTracks(
+      {{kNamespace, "a"}, {kNamespace, "b"}},
+      &evb_,
+      [&](const FullTrackName& ftn) { return ftn == trackA; });
+  co_await runUntil([&] { return relay->getStats().pinnedTracks == 1; });
+  // Let a subscribe to b reach the origin, if one was sent
+  co_await folly::coro::sleep(std::chrono::milliseconds(10));
+  EXPECT_EQ(originSubscribes_, std::vector<FullTrackName>({trackA}));
+  EXPECT_EQ(relay->getStats().pinnedTracks, 1);
+  pool->shutdown();
+}
+
+CO_TEST_F_X(MoQRelayTest, RepinsAfterRetryInterval) {
+  auto pool = makePool();
+  auto relay = std::make_shared<MoQRelay>(/*enableCache=*/false);
+  relay->setUpstreamOrigin(originUrl_, pool);
+  const FullTrackName track{kNamespace, "video"};
+  relay->setPinnedTracks(
+      {{kNamespace, "video"}},
+      &evb_,
+      nullptr,
+      /*retryInterval=*/std::chrono::milliseconds(50));
+  co_await runUntil([&] { return publishers_.size() == 1; });
+  CO_ASSERT_EQ(publishers_.size(), 1);
+
+  publishers_[0]->subscribeDone(
+      {RequestID(0), SubscribeDoneStatusCode::TRACK_ENDED, 0, "ended"});
+  co_await runUntil([&] { return relay->getStats().pinnedTracks == 0; });
+  EXPECT_EQ(relay->getStats().pinnedTracks, 0);
+  // Not before the retry interval
+  co_await folly::coro::sleep(std::chrono::milliseconds(10));
+  EXPECT_EQ(originSubscribes_.size(), 1);
+
+  co_await runUntil([&] { return originSubscribes_.size() == 2; });
+  EXPECT_EQ(originSubscribes_, std::vector<FullTrackName>({track, track}));
+  EXPECT_EQ(relay->getStats().pinnedTracks, 1);
+  pool->shutdown();
+}
+
+CO_TEST_F_X(MoQRelayTest, PinsUnderAnnouncedNamespace) {
+  auto relay = std::make_shared<MoQRelay>(/*enableCache=*/false);
+  relay->setPinnedTracks({{kNamespace, "video"}}, &evb_);
+  FakeMoQClient publisher(
+      &evb_, proxygen::URL("moqt://relay.example:4433/moq"), relay, relay);
+  co_await publisher.setupMoQSession(
+      std::chrono::seconds(1), std::chrono::seconds(1), origin_, nullptr);
+
+  const TrackNamespace room{{"live", "room1"}};
+  auto ann = co_await publisher.moqSession_->announce(
+      Announce{RequestID(0), room, {}});
+  CO_ASSERT_TRUE(ann.hasValue());
+  // Announced outside the pin's namespace, so not pinned
+  auto other = co_await publisher.moqSession_->announce(
+      Announce{RequestID(0), TrackNamespace{{"vod"}}, {}});
+  CO_ASSERT_TRUE(other.hasValue());
+  co_await runUntil([&] { return originSubscribes_.size() == 1; });
+  co_await folly::coro::sleep(std::chrono::milliseconds(10));
+  EXPECT_EQ(
+      originSubscribes_, std::vector<FullTrackName>({{room, "video"}}));
+  EXPECT_EQ(relay->getStats().pinnedTracks, 1);
+  publisher.moqSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
+} // namespace moxygen::test
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GMock.h>
+#include <folly/portability/GTest.h>
+#include <moxygen/relay/MoQTrackMerger.h>
+#include <moxygen/test/Mocks.h>
+
+using namespace testing;
+namespace moxygen::test {
+
+namespace {
+SubscribeDone getSubscribeDone(SubscribeDoneStatusCode code) {
+  return {RequestID(0), code, 0, ""};
+}
+} // namespace
+
+TEST(MoQTrackMergerTest, ForwardsEachObjectOnce) {
+  auto downstream = std::make_shared<StrictMock<MockTrackConsumer>>();
+  auto merger = std::make_shared<MoQTrackMerger>(downstream);
+  auto primary = merger->addSource();
+  auto standby = merger->addSource();
+
+  auto subgroup = std::make_shared<StrictMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*downstream, beginSubgroup(0, 0, _)).WillOnce(Return(subgroup));
+  {
+    InSequence seq;
+    for (uint64_t id = 0; id < 3; id++) {
+      EXPECT_CALL(*subgroup, object(id, _, _, false))
+          .WillOnce(Return(folly::unit));
+    }
+    EXPECT_CALL(*subgroup, endOfSubgroup()).WillOnce(Return(folly::unit));
+  }
+
+  auto primarySg = primary->beginSubgroup(0, 0, 0);
+  auto standbySg = standby->beginSubgroup(0, 0, 0);
+  ASSERT_TRUE(primarySg.hasValue());
+  ASSERT_TRUE(standbySg.hasValue());
+  auto deliver = [](auto& sg, uint64_t id) {
+    EXPECT_TRUE(sg.value()
+                    ->object(id, folly::IOBuf::copyBuffer("x"), {}, false)
+                    .hasValue());
+  };
+  deliver(primarySg, 0);
+  deliver(standbySg, 0);
+  deliver(standbySg, 1);
+  deliver(primarySg, 1);
+  deliver(primarySg, 2);
+  deliver(standbySg, 2);
+  EXPECT_TRUE(standbySg.value()->endOfSubgroup().hasValue());
+  EXPECT_TRUE(primarySg.value()->endOfSubgroup().hasValue());
+  EXPECT_EQ(merger->duplicates(), 3);
+}
+
+TEST(MoQTrackMergerTest, LosingSourceLeavesNoGap) {
+  auto downstream = std::make_shared<StrictMock<MockTrackConsumer>>();
+  auto merger = std::make_shared<MoQTrackMerger>(downstream);
+  auto primary = merger->addSource();
+  auto standby = merger->addSource();
+
+  auto subgroup = std::make_shared<StrictMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*downstream, beginSubgroup(0, 0, _)).WillOnce(Return(subgroup));
+  EXPECT_CALL(*subgroup, object(0, _, _, false)).WillOnce(Return(folly::unit));
+  auto primarySg = primary->beginSubgroup(0, 0, 0);
+  auto standbySg = standby->beginSubgroup(0, 0, 0);
+  EXPECT_TRUE(primarySg
+                  .value()
+                  ->object(0, folly::IOBuf::copyBuffer("a"), {}, false)
+                  .hasValue());
+
+  // Neither the reset nor the SUBSCRIBE_DONE reach downstream, the standby
+  // still has the subgroup
+  primarySg.value()->reset(ResetStreamErrorCode::SESSION_CLOSED);
+  EXPECT_TRUE(primary
+                  ->subscribeDone(
+                      getSubscribeDone(SubscribeDoneStatusCode::SESSION_CLOSED))
+                  .hasValue());
+  EXPECT_EQ(merger->numSources(), 1);
+
+  EXPECT_CALL(*subgroup, object(1, _, _, true)).WillOnce(Return(folly::unit));
+  EXPECT_TRUE(standbySg
+                  .value()
+                  ->object(0, folly::IOBuf::copyBuffer("a"), {}, false)
+                  .hasValue());
+  EXPECT_TRUE(standbySg
+                  .value()
+                  ->object(1, folly::IOBuf::copyBuffer("b"), {}, true)
+                  .hasValue());
+
+  EXPECT_CALL(*downstream, subscribeDone(_)).WillOnce(Return(folly::unit));
+  EXPECT_TRUE(standby
+                  ->subscribeDone(
+                      getSubscribeDone(SubscribeDoneStatusCode::TRACK_ENDED))
+                  .hasValue());
+}
+
+TEST(MoQTrackMergerTest, SourceAheadDoesNotSkip) {
+  auto downstream = std::make_shared<StrictMock<MockTrackConsumer>>();
+  auto merger = std::make_shared<MoQTrackMerger>(downstream);
+  auto primary = merger->addSource();
+  auto standby = merger->addSource();
+
+  auto subgroup = std::make_shared<StrictMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*downstream, beginSubgroup(0, 0, _)).WillOnce(Return(subgroup));
+  {
+    InSequence seq;
+    for (uint64_t id = 0; id < 3; id++) {
+      EXPECT_CALL(*subgroup, object(id, _, _, false))
+          .WillOnce(Return(folly::unit));
+    }
+    EXPECT_CALL(*subgroup, object(3, _, _, true))
+        .WillOnce(Return(folly::unit));
+  }
+
+  auto primarySg = primary->beginSubgroup(0, 0, 0);
+  auto standbySg = standby->beginSubgroup(0, 0, 0);
+  auto deliver = [](auto& sg, uint64_t id, bool fin = false) {
+    EXPECT_TRUE(sg.value()
+                    ->object(id, folly::IOBuf::copyBuffer("x"), {}, fin)
+                    .hasValue());
+  };
+  deliver(primarySg, 0);
+  // The standby lost 1 and 2, it must not jump ahead of the primary
+  deliver(standbySg, 3, true);
+  deliver(primarySg, 1);
+  deliver(primarySg, 2);
+  deliver(primarySg, 3, true);
+  EXPECT_EQ(merger->duplicates(), 1);
+}
+
+TEST(MoQTrackMergerTest, DestroyedWriterResetsSubgroup) {
+  auto downstream = std::make_shared<StrictMock<MockTrackConsumer>>();
+  auto merger = std::make_shared<MoQTrackMerger>(downstream);
+  auto primary = merger->addSource();
+  auto standby = merger->addSource();
+
+  auto subgroup = std::make_shared<StrictMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*downstream, beginSubgroup(0, 0, _)).WillOnce(Return(subgroup));
+  EXPECT_CALL(*subgroup, beginObject(0, 10, _, _))
+      .WillOnce(Return(folly::unit));
+  auto primarySg = primary->beginSubgroup(0, 0, 0);
+  auto standbySg = standby->beginSubgroup(0, 0, 0);
+  EXPECT_TRUE(primarySg.value()
+                  ->beginObject(0, 10, folly::IOBuf::copyBuffer("a"), {})
+                  .hasValue());
+
+  // Half an object went downstream, nobody can finish it
+  EXPECT_CALL(*subgroup, reset(ResetStreamErrorCode::INTERNAL_ERROR));
+  primarySg.value().reset();
+}
+
+TEST(MoQTrackMergerTest, DatagramsDeduplicated) {
+  auto downstream = std::make_shared<StrictMock<MockTrackConsumer>>();
+  auto merger = std::make_shared<MoQTrackMerger>(downstream);
+  auto primary = merger->addSource();
+  auto standby = merger->addSource();
+
+  EXPECT_CALL(*downstream, datagram(_, _))
+      .Times(2)
+      .WillRepeatedly(Return(folly::unit));
+  ObjectHeader first(TrackAlias(0), 0, 0, 0);
+  ObjectHeader second(TrackAlias(0), 0, 0, 1);
+  EXPECT_TRUE(
+      standby->datagram(second, folly::IOBuf::copyBuffer("b"))
+          .hasValue());
+  EXPECT_TRUE(
+      primary->datagram(first, folly::IOBuf::copyBuffer("a"))
+          .hasValue());
+  EXPECT_TRUE(
+      primary->datagram(second, folly::IOBuf::copyBuffer("b"))
+          .hasValue());
+  EXPECT_TRUE(
+      standby->datagram(first, folly::IOBuf::copyBuffer("a"))
+          .hasValue());
+  EXPECT_EQ(merger->duplicates(), 2);
+}
+
+} // namespace moxygen::test
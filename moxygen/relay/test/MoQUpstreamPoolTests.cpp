@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/coro/BlockingWait.h>
+#include <folly/coro/GtestHelpers.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/portability/GMock.h>
+#include <folly/portability/GTest.h>
+#include <moxygen/relay/MoQRelay.h>
+#include <moxygen/relay/MoQUpstreamPool.h>
+#include <moxygen/test/FakeMoQClient.h>
+#include <moxygen/test/Mocks.h>
+#include <moxygen/test/TestHelpers.h>
+
+using namespace testing;
+namespace moxygen::test {
+
+namespace {
+
+const FullTrackName kTrackA{TrackNamespace{{"foo"}}, "a"};
+const FullTrackName kTrackB{TrackNamespace{{"foo"}}, "b"};
+
+SubscribeRequest getSubscribe(const FullTrackName& ftn) {
+  return SubscribeRequest{
+      RequestID(0),
+      TrackAlias(0),
+      ftn,
+      0,
+      GroupOrder::OldestFirst,
+      true,
+      LocationType::LatestObject,
+      folly::none,
+      0,
+      {}};
+}
+
+} // namespace
+
+class MoQUpstreamPoolTest : public ::testing::Test {
+ public:
+  folly::DrivableExecutor* getExecutor() {
+    return &evb_;
+  }
+
+ protected:
+  void SetUp() override {
+    ON_CALL(*origin_, subscribe(_, _))
+        .WillByDefault(
+            Invoke([this](SubscribeRequest sub, std::shared_ptr<TrackConsumer>)
+                       -> folly::coro::Task<Publisher::SubscribeResult> {
+              originSubscribes_.push_back(sub.fullTrackName);
+              return folly::coro::makeTask<Publisher::SubscribeResult>(
+                  std::make_shared<NiceMock<MockSubscriptionHandle>>(
+                      SubscribeOk{
+                          sub.requestID,
+                          std::chrono::milliseconds(0),
+                          GroupOrder::OldestFirst,
+                          folly::none,
+                          {}}));
+            }));
+  }
+
+  std::shared_ptr<MoQUpstreamPool> makePool() {
+    return std::make_shared<MoQUpstreamPool>(
+        &evb_,
+        MoQUpstreamPool::Config{},
+        [this](folly::EventBase* evb, proxygen::URL url) {
+          auto client =
+              std::make_unique<FakeMoQClient>(evb, std::move(url), origin_);
+          clients_.push_back(client.get());
+          return client;
+        });
+  }
+
+  // Lets callbacks posted to the EventBase run
+  folly::coro::Task<void> runUntil(std::function<bool()> done) {
+    for (int i = 0; i < 1000 && !done(); i++) {
+      co_await folly::coro::co_reschedule_on_current_executor;
+    }
+  }
+
+  folly::EventBase evb_;
+  std::shared_ptr<NiceMock<MockPublisher>> origin_ =
+      std::make_shared<NiceMock<MockPublisher>>();
+  // Clients the pool created, in order.  The pool owns them and frees them
+  // once their session closes.
+  std::vector<FakeMoQClient*> clients_;
+  std::vector<FullTrackName> originSubscribes_;
+  proxygen::URL originUrl_{"moqt://origin.example:4433/moq"};
+};
+
+CO_TEST_F_X(MoQUpstreamPoolTest, TracksShareOneSession) {
+  auto pool = makePool();
+  auto first = co_await pool->getSession(originUrl_);
+  CO_ASSERT_TRUE(first);
+  auto consumer = std::make_shared<NiceMock<MockTrackConsumer>>();
+  auto subA = co_await first->subscribe(getSubscribe(kTrackA), consumer);
+  EXPECT_TRUE(subA.hasValue());
+
+  auto second = co_await pool->getSession(originUrl_);
+  EXPECT_EQ(first, second);
+  auto subB = co_await second->subscribe(getSubscribe(kTrackB), consumer);
+  EXPECT_TRUE(subB.hasValue());
+  EXPECT_EQ(clients_.size(), 1);
+  EXPECT_EQ(pool->numSessions(), 1);
+  EXPECT_EQ(originSubscribes_, std::vector<FullTrackName>({kTrackA, kTrackB}));
+  pool->shutdown();
+}
+
+CO_TEST_F_X(MoQUpstreamPoolTest, ReconnectsAfterSessionCloses) {
+  auto pool = makePool();
+  auto first = co_await pool->getSession(originUrl_);
+  CO_ASSERT_TRUE(first);
+  first->close(SessionCloseErrorCode::NO_ERROR);
+  co_await runUntil([&] { return pool->numSessions() == 0; });
+  EXPECT_EQ(pool->numSessions(), 0);
+
+  auto second = co_await pool->getSession(originUrl_);
+  CO_ASSERT_TRUE(second);
+  EXPECT_NE(first, second);
+  EXPECT_EQ(clients_.size(), 2);
+  EXPECT_EQ(pool->numSessions(), 1);
+  pool->shutdown();
+}
+
+CO_TEST_F_X(MoQUpstreamPoolTest, ConnectFailureReturnsNull) {
+  auto pool = std::make_shared<MoQUpstreamPool>(
+      &evb_,
+      MoQUpstreamPool::Config{},
+      [this](folly::EventBase* evb, proxygen::URL url) {
+        auto client =
+            std::make_unique<FakeMoQClient>(evb, std::move(url), origin_);
+        client->setFailConnect(true);
+        return client;
+      });
+  auto session = co_await pool->getSession(originUrl_);
+  EXPECT_FALSE(session);
+  EXPECT_EQ(pool->numSessions(), 0);
+}
+
+CO_TEST_F_X(MoQUpstreamPoolTest, RelayResubscribesWhenSessionCloses) {
+  auto pool = makePool();
+  auto relay = std::make_shared<MoQRelay>(/*enableCache=*/false);
+  relay->setUpstreamOrigin(originUrl_, pool);
+  FakeMoQClient downstream(
+      &evb_, proxygen::URL("moqt://relay.example:4433/moq"), relay);
+  co_await downstream.setupMoQSession(
+      std::chrono::seconds(1), std::chrono::seconds(1), nullptr, nullptr);
+
+  auto consumer = std::make_shared<NiceMock<MockTrackConsumer>>();
+  // Losing the upstream session must not end the track downstream
+  EXPECT_CALL(*consumer, subscribeDone(_)).Times(0);
+  auto sub = co_await downstream.moqSession_->subscribe(
+      getSubscribe(kTrackA), consumer);
+  CO_ASSERT_TRUE(sub.hasValue());
+  CO_ASSERT_EQ(clients_.size(), 1);
+  EXPECT_EQ(originSubscribes_.size(), 1);
+
+  clients_[0]->moqSession_->close(SessionCloseErrorCode::NO_ERROR);
+  co_await runUntil([&] { return originSubscribes_.size() == 2; });
+  EXPECT_EQ(clients_.size(), 2);
+  EXPECT_EQ(pool->numSessions(), 1);
+  EXPECT_EQ(originSubscribes_, std::vector<FullTrackName>({kTrackA, kTrackA}));
+  Mock::VerifyAndClearExpectations(consumer.get());
+
+  downstream.moqSession_->close(SessionCloseErrorCode::NO_ERROR);
+  pool->shutdown();
+}
+
+} // namespace moxygen::test
@@ -4,18 +4,23 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <folly/String.h>
 #include <folly/coro/Sleep.h>
+#include <moxygen/MoQLatencyProbe.h>
 #include <moxygen/MoQLocation.h>
 #include <moxygen/MoQServer.h>
 #include <moxygen/MoQWebTransportClient.h>
 #include <moxygen/relay/MoQForwarder.h>
-#include <moxygen/relay/MoQRelayClient.h>
+#include <moxygen/relay/MoQRelayConnectionManager.h>
 #include <iomanip>
 
 using namespace quic::samples;
 using namespace proxygen;
 
-DEFINE_string(relay_url, "", "Use specified relay");
+DEFINE_string(
+    relay_url,
+    "",
+    "Use specified relay, or a comma separated list to fail over between");
 DEFINE_int32(relay_connect_timeout, 1000, "Connect timeout (ms)");
 DEFINE_int32(relay_transaction_timeout, 120, "Transaction timeout (s)");
 DEFINE_string(cert, "", "Cert path");
@@ -27,6 +32,16 @@ DEFINE_string(
     "Transmission mode for track: stream-per-group (spg), "
     "stream-per-object(spo), datagram");
 DEFINE_bool(quic_transport, false, "Use raw QUIC transport");
+DEFINE_uint32(
+    write_coalescing_us,
+    0,
+    "Hold small objects up to this long to write them together, 0 to "
+    "write each object as it is published");
+DEFINE_uint32(
+    probe_interval_ms,
+    10,
+    "Publish a latency probe on moq-date/probe this often while it has "
+    "subscribers, 0 to disable the track");
 
 namespace {
 using namespace moxygen;
@@ -45,32 +60,52 @@ class MoQDateServer : public MoQServer,
   explicit MoQDateServer(Mode mode)
       : MoQServer(FLAGS_port, FLAGS_cert, FLAGS_key, "/moq-date"),
         forwarder_(dateTrackName()),
+        probeForwarder_(probeTrackName()),
         mode_(mode) {}
 
   bool startRelayClient() {
-    proxygen::URL url(FLAGS_relay_url);
-    if (!url.isValid() || !url.hasHost()) {
-      XLOG(ERR) << "Invalid url: " << FLAGS_relay_url;
-      return false;
+    std::vector<std::string> urls;
+    folly::split(',', FLAGS_relay_url, urls, /*ignoreEmpty=*/true);
+    std::vector<proxygen::URL> relays;
+    for (const auto& urlString : urls) {
+      proxygen::URL url(urlString);
+      if (!url.isValid() || !url.hasHost()) {
+        XLOG(ERR) << "Invalid url: " << urlString;
+        return false;
+      }
+      relays.push_back(std::move(url));
     }
     auto evb = getWorkerEvbs()[0];
-    relayClient_ = std::make_unique<MoQRelayClient>(
-        (FLAGS_quic_transport
-             ? std::make_unique<MoQClient>(evb, url)
-             : std::make_unique<MoQWebTransportClient>(evb, url)));
-    relayClient_
-        ->run(
-            /*publisher=*/shared_from_this(),
-            /*subscriber=*/nullptr,
-            {TrackNamespace({"moq-date"})},
-            std::chrono::milliseconds(FLAGS_relay_connect_timeout),
-            std::chrono::seconds(FLAGS_relay_transaction_timeout))
-        .scheduleOn(evb)
-        .start();
+    MoQRelayConnectionManager::Config config;
+    config.connectTimeout =
+        std::chrono::milliseconds(FLAGS_relay_connect_timeout);
+    config.transactionTimeout =
+        std::chrono::seconds(FLAGS_relay_transaction_timeout);
+    relayManager_ = std::make_shared<MoQRelayConnectionManager>(
+        evb,
+        std::move(relays),
+        config,
+        [](folly::EventBase* evb,
+           proxygen::URL url) -> std::unique_ptr<MoQClient> {
+          if (FLAGS_quic_transport) {
+            return std::make_unique<MoQClient>(evb, std::move(url));
+          }
+          return std::make_unique<MoQWebTransportClient>(evb, std::move(url));
+        });
+    evb->runInEventBaseThread([self = shared_from_this()] {
+      self->relayManager_->start(
+          /*publisher=*/self,
+          /*subscriber=*/nullptr,
+          {TrackNamespace({"moq-date"})});
+    });
     return true;
   }
 
   void onNewSession(std::shared_ptr<MoQSession> clientSession) override {
+    MoQSettings moqSettings;
+    moqSettings.writeCoalescing.maxDelay =
+        std::chrono::microseconds(FLAGS_write_coalescing_us);
+    clientSession->setMoqSettings(moqSettings);
     clientSession->setPublishHandler(shared_from_this());
   }
 
@@ -123,6 +158,16 @@ class MoQDateServer : public MoQServer,
                << " name=" << subReq.fullTrackName.trackName
                << " requestID=" << subReq.requestID
                << " track alias=" << subReq.trackAlias;
+    if (subReq.fullTrackName == probeTrackName() &&
+        FLAGS_probe_interval_ms > 0) {
+      auto session = MoQSession::getRequestSession();
+      if (!probeLoopRunning_) {
+        probeLoopRunning_ = true;
+        publishProbeLoop().scheduleOn(session->getEventBase()).start();
+      }
+      co_return probeForwarder_.addSubscriber(
+          std::move(session), subReq, std::move(consumer));
+    }
     if (subReq.fullTrackName != dateTrackName()) {
       co_return folly::makeUnexpected(SubscribeError{
           subReq.requestID,
@@ -221,10 +266,11 @@ class MoQDateServer : public MoQServer,
   void goaway(Goaway goaway) override {
     XLOG(INFO) << "Processing goaway uri=" << goaway.newSessionUri;
     auto session = MoQSession::getRequestSession();
-    if (relayClient_ && relayClient_->getSession() == session) {
-      // TODO: relay is going away
+    if (relayManager_ && relayManager_->getSession() == session) {
+      relayManager_->failover(session);
     } else {
       forwarder_.removeSession(session);
+      probeForwarder_.removeSession(session);
     }
   }
 
@@ -409,19 +455,81 @@ class MoQDateServer : public MoQServer,
     }
   }
 
+  // Each probe's extensions hold the time it was published, and relays
+  // append theirs, see MoQLatencyProbe.h.  A group per second of the clock.
+  folly::coro::Task<void> publishProbeLoop() {
+    auto cancelToken = co_await folly::coro::co_current_cancellation_token;
+    std::shared_ptr<SubgroupConsumer> subgroupPublisher;
+    uint64_t group = 0;
+    uint64_t object = 0;
+    while (!cancelToken.isCancellationRequested()) {
+      auto timestampUs = probeTimestampUs();
+      auto second = timestampUs / 1000000;
+      if (second != group) {
+        if (subgroupPublisher) {
+          subgroupPublisher->endOfSubgroup();
+          subgroupPublisher.reset();
+        }
+        group = second;
+        object = 0;
+      }
+      if (probeForwarder_.empty()) {
+        subgroupPublisher.reset();
+        probeForwarder_.setLatest({group, object});
+      } else if (mode_ == Mode::DATAGRAM) {
+        ObjectHeader header{
+            TrackAlias(0),
+            group,
+            0, // subgroup unused for datagrams
+            object,
+            /*priority=*/0,
+            ObjectStatus::NORMAL,
+            makeProbeExtensions(timestampUs),
+            folly::none};
+        probeForwarder_.datagram(header, probePayload(object));
+      } else {
+        // Probes share a stream per group in both stream modes, a stream
+        // per probe would measure stream setup more than the path
+        if (!subgroupPublisher) {
+          auto res = probeForwarder_.beginSubgroup(group, 0, /*priority=*/0);
+          if (res) {
+            subgroupPublisher = std::move(*res);
+          }
+        }
+        if (subgroupPublisher) {
+          subgroupPublisher->object(
+              object, probePayload(object), makeProbeExtensions(timestampUs));
+        }
+      }
+      object++;
+      co_await folly::coro::sleep(
+          std::chrono::milliseconds(FLAGS_probe_interval_ms));
+    }
+  }
+
+  Payload probePayload(uint64_t object) {
+    return folly::IOBuf::copyBuffer(folly::to<std::string>(object));
+  }
+
   void terminateClientSession(std::shared_ptr<MoQSession> session) override {
     XLOG(INFO) << __func__;
     forwarder_.removeSession(session);
+    probeForwarder_.removeSession(session);
   }
 
  private:
   static FullTrackName dateTrackName() {
     return FullTrackName({TrackNamespace({"moq-date"}), "date"});
   }
+  static FullTrackName probeTrackName() {
+    return FullTrackName({TrackNamespace({"moq-date"}), "probe"});
+  }
   MoQForwarder forwarder_;
-  std::unique_ptr<MoQRelayClient> relayClient_;
+  MoQForwarder probeForwarder_;
+  std::shared_ptr<MoQRelayConnectionManager> relayManager_;
   Mode mode_{Mode::STREAM_PER_GROUP};
   bool loopRunning_{false};
+  bool probeLoopRunning_{false};
 };
 } // namespace
 int main(int argc, char* argv[]) {
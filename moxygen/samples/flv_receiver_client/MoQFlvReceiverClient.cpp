@@ -6,13 +6,18 @@
 
 #include <folly/portability/GFlags.h>
 #include "moxygen/MoQClient.h"
+#include "moxygen/MoQFec.h"
 #include "moxygen/MoQWebTransportClient.h"
 #include "moxygen/ObjectReceiver.h"
+#include "moxygen/QueueCallback.h"
 
 #include <folly/init/Init.h>
 #include <folly/io/async/AsyncSignalHandler.h>
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/ScopedEventBaseThread.h>
 #include <signal.h>
 #include "moxygen/dejitter/DeJitter.h"
+#include "moxygen/dejitter/SyncedDeJitter.h"
 #include "moxygen/flv_parser/FlvWriter.h"
 #include "moxygen/moq_mi/MoQMi.h"
 
@@ -24,6 +29,15 @@ DEFINE_string(
     flv_outpath,
     "",
     "File name to save the received FLV file to (ex: /tmp/test.flv)");
+DEFINE_uint64(
+    flv_write_buffer_bytes,
+    0,
+    "Bytes of FLV output gathered before writing them together, 0 to write "
+    "each frame as it comes");
+DEFINE_uint64(
+    flv_sync_bytes,
+    0,
+    "Sync FLV output to disk every this many bytes, 0 to leave it to the OS");
 DEFINE_string(track_namespace, "flvstreamer", "Track Namespace");
 DEFINE_string(track_namespace_delimiter, "/", "Track Namespace Delimiter");
 DEFINE_string(video_track_name, "video0", "Video track Name");
@@ -34,6 +48,32 @@ DEFINE_int32(
     dejitter_buffer_size_ms,
     300,
     "Dejitter buffer size in ms (this translates to added latency)");
+DEFINE_bool(
+    dejitter_adaptive,
+    false,
+    "Size the dejitter buffer from the observed jitter, up to "
+    "dejitter_buffer_size_ms");
+DEFINE_int32(
+    dejitter_min_buffer_size_ms,
+    0,
+    "Smallest dejitter buffer size in ms when adaptive");
+DEFINE_bool(
+    dejitter_sync,
+    false,
+    "Play audio and video out on one clock from their MoQ-MI wallclock, "
+    "buffering what the track that needs most needs, from "
+    "dejitter_min_buffer_size_ms up to dejitter_buffer_size_ms");
+DEFINE_uint32(
+    decode_queue_objects,
+    256,
+    "Objects queued per track for the decode and write thread, reading from "
+    "the network pauses while it is 3/4 full.  0 to decode and write on the "
+    "session thread");
+DEFINE_bool(
+    fec,
+    false,
+    "Rebuild datagrams lost from windows protected by a relay's "
+    "datagram_fec_window before dejittering");
 DEFINE_bool(quic_transport, false, "Use raw QUIC transport");
 DEFINE_bool(fetch, false, "Use fetch rather than subscribe");
 DEFINE_string(auth, "secret", "MOQ subscription auth string");
@@ -63,7 +103,9 @@ class TrackType {
 class FlvWriterShared : flv::FlvWriter {
  public:
   explicit FlvWriterShared(const std::string& flvOutPath)
-      : flv::FlvWriter(flvOutPath) {}
+      : flv::FlvWriter(
+            flvOutPath,
+            {FLAGS_flv_write_buffer_bytes, FLAGS_flv_sync_bytes}) {}
 
   bool writeMoqMiPayload(MoQMi::MoqMiItem moqMiItem) {
     bool ret = false;
@@ -169,6 +211,71 @@ class FlvWriterShared : flv::FlvWriter {
   bool firstIDRWritten_{false};
 };
 
+using SyncedMoqMiDeJitter = dejitter::SyncedDeJitter<MoQMi::MoqMiItem>;
+
+// Writes the items of a SyncedMoqMiDeJitter at their playout time, from a
+// timer on the EventBase the track handlers run on, so a stalled track
+// doesn't hold up the others.  Created anywhere, then only used on evb.
+class SyncedPlayout : public folly::AsyncTimeout {
+ public:
+  SyncedPlayout(
+      folly::EventBase* evb,
+      size_t numTracks,
+      SyncedMoqMiDeJitter::Config config,
+      std::shared_ptr<FlvWriterShared> flvw)
+      : evb_(evb), deJitter_(numTracks, config), flvw_(std::move(flvw)) {}
+
+  SyncedMoqMiDeJitter& deJitter() {
+    return deJitter_;
+  }
+
+  // Writes what is due and schedules the next
+  void release() {
+    if (!attached_) {
+      // Attaching checks it is on evb
+      attachEventBase(evb_);
+      attached_ = true;
+    }
+    write(deJitter_.popReady());
+    auto next = deJitter_.nextReadyTime();
+    if (!next) {
+      cancelTimeout();
+      return;
+    }
+    auto delay = std::chrono::ceil<std::chrono::milliseconds>(
+        *next - SyncedMoqMiDeJitter::Clock::now());
+    scheduleTimeout(std::max(delay, std::chrono::milliseconds(0)));
+  }
+
+  // Writes everything buffered, at the end of a track
+  void flush() {
+    cancelTimeout();
+    write(deJitter_.popReady(SyncedMoqMiDeJitter::Clock::time_point::max()));
+  }
+
+  void timeoutExpired() noexcept override {
+    release();
+  }
+
+ private:
+  void write(std::vector<SyncedMoqMiDeJitter::Released> released) {
+    for (auto& item : released) {
+      if (item.gap.gapType == SyncedMoqMiDeJitter::GapType::GAP) {
+        XLOG(WARN) << "Track " << item.track
+                   << " GAP PASSED to decoder, size: " << item.gap.gapSize;
+      }
+      if (flvw_ && !flvw_->writeMoqMiPayload(std::move(item.item))) {
+        XLOG(WARNING) << "Track " << item.track << " Payload write failed";
+      }
+    }
+  }
+
+  folly::EventBase* evb_;
+  bool attached_{false};
+  SyncedMoqMiDeJitter deJitter_;
+  std::shared_ptr<FlvWriterShared> flvw_;
+};
+
 class TrackReceiverHandler : public ObjectReceiverCallback {
  public:
   explicit TrackReceiverHandler(
@@ -197,8 +304,18 @@ class TrackReceiverHandler : public ObjectReceiverCallback {
               MoQMi::MoqMIItemTypeIndex::MOQMI_ITEM_INDEX_VIDEO_H264_AVC ||
           payloadDecodedData.index() ==
               MoQMi::MoqMIItemTypeIndex::MOQMI_ITEM_INDEX_AUDIO_AAC_LC) {
+        if (syncedPlayout_) {
+          insertSynced(std::move(payloadDecodedData));
+          return FlowControlState::UNBLOCKED;
+        }
         // Create deJitter if not already created
-        if (!deJitter_) {
+        if (!deJitter_ && FLAGS_dejitter_adaptive) {
+          dejitter::DeJitter<MoQMi::MoqMiItem>::AdaptiveConfig config;
+          config.minBufferSizeMs = FLAGS_dejitter_min_buffer_size_ms;
+          config.maxBufferSizeMs = dejitterBufferSizeMs_;
+          deJitter_ = std::make_unique<dejitter::DeJitter<MoQMi::MoqMiItem>>(
+              config);
+        } else if (!deJitter_) {
           deJitter_ = std::make_unique<dejitter::DeJitter<MoQMi::MoqMiItem>>(
               dejitterBufferSizeMs_);
         }
@@ -244,18 +361,25 @@ class TrackReceiverHandler : public ObjectReceiverCallback {
             XLOG_EVERY_N(INFO, 60)
                 << trackMediaType_.toStr() << " For seqId: " << seqId.value()
                 << ", Dejitter size: " << deJitter_->size() << "("
-                << deJitter_->sizeMs() << "ms)";
+                << deJitter_->sizeMs() << "ms), target: "
+                << deJitter_->targetSizeMs()
+                << "ms, jitter: " << deJitter_->getStats().jitterMs
+                << "ms, late: " << deJitter_->getStats().arrivedLate
+                << ", skipped: " << deJitter_->getStats().skippedItems;
           }
         }
       }
 
-      if (flvw_ && std::get<0>(deJitterData).has_value()) {
-        if (flvw_->writeMoqMiPayload(
-                std::move(std::get<0>(deJitterData).value()))) {
-          XLOG(DBG1) << trackMediaType_.toStr() << " Wrote payload to output";
-        } else {
-          XLOG(WARNING) << trackMediaType_.toStr() << " Payload write failed";
+      if (std::get<0>(deJitterData).has_value()) {
+        write(std::move(std::get<0>(deJitterData).value()));
+      }
+      // What a shrinking adaptive target left buffered
+      while (deJitter_) {
+        auto excess = deJitter_->popExcess();
+        if (!std::get<0>(excess).has_value()) {
+          break;
         }
+        write(std::move(std::get<0>(excess).value()));
       }
     }
     return FlowControlState::UNBLOCKED;
@@ -263,6 +387,9 @@ class TrackReceiverHandler : public ObjectReceiverCallback {
   void onObjectStatus(const ObjectHeader& objHeader) override {
     std::cout << trackMediaType_.toStr()
               << " ObjectStatus=" << uint32_t(objHeader.status) << std::endl;
+    if (objHeader.status == ObjectStatus::END_OF_TRACK) {
+      flushDeJitter();
+    }
   }
   void onEndOfStream() override {}
   void onError(ResetStreamErrorCode error) override {
@@ -271,16 +398,68 @@ class TrackReceiverHandler : public ObjectReceiverCallback {
     ;
   }
   void onSubscribeDone(SubscribeDone) override {
+    flushDeJitter();
     baton.post();
   }
 
+  // On the thread objects are handled on
+  void flushDeJitter() {
+    if (syncedPlayout_) {
+      syncedPlayout_->flush();
+    }
+  }
+
   folly::coro::Baton baton;
 
   void setFlvWriterShared(std::shared_ptr<FlvWriterShared> flvw) {
     flvw_ = flvw;
   }
 
+  // Dejitters on the playout clock shared with the other tracks of
+  // syncedPlayout, which writes the items when they are due.
+  void setSyncedPlayout(
+      std::shared_ptr<SyncedPlayout> syncedPlayout,
+      size_t track) {
+    syncedPlayout_ = std::move(syncedPlayout);
+    syncedTrack_ = track;
+  }
+
  private:
+  void write(MoQMi::MoqMiItem item) {
+    if (!flvw_) {
+      return;
+    }
+    if (flvw_->writeMoqMiPayload(std::move(item))) {
+      XLOG(DBG1) << trackMediaType_.toStr() << " Wrote payload to output";
+    } else {
+      XLOG(WARNING) << trackMediaType_.toStr() << " Payload write failed";
+    }
+  }
+
+  void insertSynced(MoQMi::MoqMiItem item) {
+    auto seqId = getSeqId(item);
+    auto mediaTimeMs = getMediaTimeMs(item);
+    if (!seqId || !mediaTimeMs) {
+      XLOG(ERR) << trackMediaType_.toStr()
+                << " No seqId or timestamps found skipping frame";
+      return;
+    }
+    auto& deJitter = syncedPlayout_->deJitter();
+    if (!deJitter.insertItem(
+            syncedTrack_, *seqId, *mediaTimeMs, std::move(item))) {
+      XLOG(WARN) << trackMediaType_.toStr()
+                 << " Dropped, because arrived late. seqId: " << *seqId;
+    }
+    syncedPlayout_->release();
+    XLOG_EVERY_N(INFO, 60) << trackMediaType_.toStr() << " For seqId: "
+                           << *seqId << ", Dejitter size: " << deJitter.size()
+                           << ", delay: " << deJitter.delayMs()
+                           << "ms, needs: "
+                           << deJitter.getStats(syncedTrack_).delayMs
+                           << "ms, jitter: "
+                           << deJitter.getStats(syncedTrack_).jitterMs << "ms";
+  }
+
   void logData(const MoQMi::MoqMiItem& payloadDecodedData) const {
     if (payloadDecodedData.index() ==
         MoQMi::MoqMIItemTypeIndex::MOQMI_ITEM_INDEX_VIDEO_H264_AVC) {
@@ -318,6 +497,36 @@ class TrackReceiverHandler : public ObjectReceiverCallback {
     return folly::none;
   }
 
+  // MoQ-MI wallclock, shared by the tracks, or pts when there is none
+  folly::Optional<uint64_t> getMediaTimeMs(
+      const MoQMi::MoqMiItem& payloadDecodedData) const {
+    const MoQMi::CommonData* common = nullptr;
+    if (payloadDecodedData.index() ==
+        MoQMi::MoqMIItemTypeIndex::MOQMI_ITEM_INDEX_VIDEO_H264_AVC) {
+      common =
+          std::get<MoQMi::MoqMIItemTypeIndex::MOQMI_ITEM_INDEX_VIDEO_H264_AVC>(
+              payloadDecodedData)
+              .get();
+    } else if (
+        payloadDecodedData.index() ==
+        MoQMi::MoqMIItemTypeIndex::MOQMI_ITEM_INDEX_AUDIO_AAC_LC) {
+      common =
+          std::get<MoQMi::MoqMIItemTypeIndex::MOQMI_ITEM_INDEX_AUDIO_AAC_LC>(
+              payloadDecodedData)
+              .get();
+    }
+    if (!common) {
+      return folly::none;
+    }
+    if (common->wallclock > 0) {
+      return common->wallclock;
+    }
+    if (common->timescale == 0) {
+      return folly::none;
+    }
+    return common->pts * 1000 / common->timescale;
+  }
+
   folly::Optional<uint64_t> getDurationMs(
       const MoQMi::MoqMiItem& payloadDecodedData) const {
     folly::Optional<uint64_t> dur;
@@ -353,9 +562,96 @@ class TrackReceiverHandler : public ObjectReceiverCallback {
   std::shared_ptr<FlvWriterShared> flvw_;
   TrackType trackMediaType_;
   std::unique_ptr<dejitter::DeJitter<MoQMi::MoqMiItem>> deJitter_;
+  std::shared_ptr<SyncedPlayout> syncedPlayout_;
+  size_t syncedTrack_{0};
   uint32_t dejitterBufferSizeMs_;
 };
 
+// Hands a track's objects to its handler on a worker thread, so decoding,
+// dejittering and writing don't hold up reading from the session.  Objects
+// wait in a BoundedQueueCallback, and while it is over its high watermark
+// the session stops reading the track's streams.  The tracks of a client
+// share one worker, which is also what keeps the synced dejitter and the
+// writer single threaded.
+class DecodeQueueCallback
+    : public ObjectReceiverCallback,
+      public std::enable_shared_from_this<DecodeQueueCallback> {
+ public:
+  DecodeQueueCallback(
+      std::shared_ptr<TrackReceiverHandler> handler,
+      uint32_t capacity,
+      folly::EventBase* sessionEvb,
+      folly::EventBase* workerEvb)
+      : handler_(std::move(handler)),
+        queue_(capacity),
+        sessionEvb_(sessionEvb),
+        workerEvb_(workerEvb) {}
+
+  FlowControlState onObject(const ObjectHeader& objHeader, Payload payload)
+      override {
+    auto state = queue_.onObject(objHeader, std::move(payload));
+    scheduleDrain();
+    return state;
+  }
+  void onObjectStatus(const ObjectHeader& objHeader) override {
+    queue_.onObjectStatus(objHeader);
+    scheduleDrain();
+  }
+  void onEndOfStream() override {}
+  void onError(ResetStreamErrorCode error) override {
+    // On the worker, after the objects before it, like everything else the
+    // handler gets there
+    workerEvb_->runInEventBaseThread([self = shared_from_this(), error] {
+      self->drain();
+      self->handler_->onError(error);
+    });
+  }
+  void onSubscribeDone(SubscribeDone subDone) override {
+    // Passed on once the objects before it are written
+    workerEvb_->runInEventBaseThread(
+        [self = shared_from_this(), subDone = std::move(subDone)]() mutable {
+          self->drain();
+          self->handler_->flushDeJitter();
+          self->sessionEvb_->runInEventBaseThread(
+              [handler = self->handler_]() { handler->baton.post(); });
+        });
+  }
+  folly::SemiFuture<folly::Unit> awaitReadyToConsume() override {
+    return queue_.awaitReadyToConsume();
+  }
+
+ private:
+  void scheduleDrain() {
+    if (!drainScheduled_.exchange(true, std::memory_order_acq_rel)) {
+      workerEvb_->runInEventBaseThread(
+          [self = shared_from_this()] { self->drain(); });
+    }
+  }
+
+  // On the worker
+  void drain() {
+    // Cleared first, items queued from here on schedule another drain
+    drainScheduled_.store(false, std::memory_order_release);
+    BoundedQueueCallback::Item item;
+    while (queue_.tryDequeue(item)) {
+      if (!item.hasValue()) {
+        continue;
+      }
+      if (item->header.status == ObjectStatus::NORMAL) {
+        handler_->onObject(item->header, std::move(item->payload));
+      } else {
+        handler_->onObjectStatus(item->header);
+      }
+    }
+  }
+
+  std::shared_ptr<TrackReceiverHandler> handler_;
+  BoundedQueueCallback queue_;
+  folly::EventBase* sessionEvb_;
+  folly::EventBase* workerEvb_;
+  std::atomic<bool> drainScheduled_{false};
+};
+
 class MoQFlvReceiverClient
     : public Subscriber,
       public std::enable_shared_from_this<MoQFlvReceiverClient> {
@@ -366,6 +662,7 @@ class MoQFlvReceiverClient
       bool useQuic,
       const std::string& flvOutPath)
       : moqClient_(makeMoQClient(evb, std::move(url), useQuic)),
+        evb_(evb),
         flvOutPath_(flvOutPath) {}
 
   folly::coro::Task<void> run() noexcept {
@@ -382,6 +679,15 @@ class MoQFlvReceiverClient
       flvw_ = std::make_shared<FlvWriterShared>(flvOutPath_);
       trackReceiverHandlerAudio_->setFlvWriterShared(flvw_);
       trackReceiverHandlerVideo_->setFlvWriterShared(flvw_);
+      if (FLAGS_dejitter_sync) {
+        SyncedMoqMiDeJitter::Config config;
+        config.minDelayMs = FLAGS_dejitter_min_buffer_size_ms;
+        config.maxDelayMs = FLAGS_dejitter_buffer_size_ms;
+        auto syncedPlayout = std::make_shared<SyncedPlayout>(
+            handlerEvb(), 2, config, flvw_);
+        trackReceiverHandlerAudio_->setSyncedPlayout(syncedPlayout, 0);
+        trackReceiverHandlerVideo_->setSyncedPlayout(syncedPlayout, 1);
+      }
 
       const auto requestIDAudio = 0;
       const auto trackAliasAudio = 1;
@@ -422,7 +728,9 @@ class MoQFlvReceiverClient
 
       // Subscribe to audio
       subRxHandlerAudio_ = std::make_shared<ObjectReceiver>(
-          ObjectReceiver::SUBSCRIBE, trackReceiverHandlerAudio_);
+          ObjectReceiver::SUBSCRIBE,
+          receiverCallback(trackReceiverHandlerAudio_));
+      subRxHandlerAudio_->setContiguousPayloads(true);
       auto trackAudio = co_await moqClient_->moqSession_->subscribe(
           subAudio, subRxHandlerAudio_);
       if (trackAudio.hasValue()) {
@@ -443,7 +751,9 @@ class MoQFlvReceiverClient
 
       // Subscribe to video
       subRxHandlerVideo_ = std::make_shared<ObjectReceiver>(
-          ObjectReceiver::SUBSCRIBE, trackReceiverHandlerVideo_);
+          ObjectReceiver::SUBSCRIBE,
+          receiverCallback(trackReceiverHandlerVideo_));
+      subRxHandlerVideo_->setContiguousPayloads(true);
       auto trackVideo = co_await moqClient_->moqSession_->subscribe(
           subVideo, subRxHandlerVideo_);
       if (trackVideo.hasValue()) {
@@ -503,7 +813,36 @@ class MoQFlvReceiverClient
   }
 
  private:
+  std::shared_ptr<ObjectReceiverCallback> receiverCallback(
+      std::shared_ptr<TrackReceiverHandler> handler) {
+    std::shared_ptr<ObjectReceiverCallback> callback = handler;
+    if (FLAGS_decode_queue_objects > 0) {
+      callback = std::make_shared<DecodeQueueCallback>(
+          std::move(handler), FLAGS_decode_queue_objects, evb_, handlerEvb());
+    }
+    if (FLAGS_fec) {
+      // Rebuilt objects arrive late, the handler's dejitter reorders them
+      callback = std::make_shared<MoQFecReceiver>(std::move(callback));
+    }
+    return callback;
+  }
+
+  // Where the track handlers run
+  folly::EventBase* handlerEvb() {
+    if (FLAGS_decode_queue_objects == 0) {
+      return evb_;
+    }
+    if (!decodeThread_) {
+      decodeThread_ =
+          std::make_unique<folly::ScopedEventBaseThread>("FlvDecode");
+    }
+    return decodeThread_->getEventBase();
+  }
+
   std::unique_ptr<MoQClient> moqClient_;
+  folly::EventBase* evb_;
+  // Decodes and writes the tracks' objects, unless decode_queue_objects is 0
+  std::unique_ptr<folly::ScopedEventBaseThread> decodeThread_;
   std::shared_ptr<Publisher::SubscriptionHandle> audioSubscribeHandle_;
   std::shared_ptr<Publisher::SubscriptionHandle> videoSubscribeHandle_;
   std::string flvOutPath_;
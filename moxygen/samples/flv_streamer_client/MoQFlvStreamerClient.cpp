@@ -4,16 +4,28 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <folly/MPMCQueue.h>
+#include <folly/String.h>
+#include <folly/coro/Baton.h>
+#include <folly/executors/IOThreadPoolExecutor.h>
+#include <folly/futures/Future.h>
 #include <folly/init/Init.h>
 #include <folly/io/async/AsyncSignalHandler.h>
 #include <folly/portability/GFlags.h>
 #include <signal.h>
+#include <atomic>
 #include <filesystem>
+#include <thread>
 #include "moxygen/MoQWebTransportClient.h"
 #include "moxygen/flv_parser/FlvSequentialReader.h"
 #include "moxygen/moq_mi/MoQMi.h"
 
-DEFINE_string(input_flv_file, "", "FLV input fifo file");
+DEFINE_string(
+    input_flv_file,
+    "",
+    "FLV input fifo files, comma separated.  Each is published in its own "
+    "session; with more than one, input N uses namespace "
+    "<track_namespace>/N");
 DEFINE_string(
     connect_url,
     "https://localhost:4433/moq",
@@ -25,6 +37,14 @@ DEFINE_string(audio_track_name, "audio0", "Audio track Name");
 DEFINE_int32(connect_timeout, 1000, "Connect timeout (ms)");
 DEFINE_int32(transaction_timeout, 120, "Transaction timeout (s)");
 DEFINE_bool(quic_transport, false, "Use raw QUIC transport");
+DEFINE_uint32(
+    publish_threads,
+    0,
+    "Threads publishing the sessions, 0 for one per core");
+DEFINE_uint32(
+    pipeline_queue_items,
+    256,
+    "Media items buffered between the read, encode and publish stages");
 
 namespace {
 using namespace moxygen;
@@ -37,10 +57,18 @@ class MoQFlvStreamerClient
       folly::EventBase* evb,
       proxygen::URL url,
       FullTrackName fvtn,
-      FullTrackName fatn)
+      FullTrackName fatn,
+      std::string inputFile)
       : moqClient_(makeMoQClient(evb, std::move(url), /*useQuic=*/false)),
         fullVideoTrackName_(std::move(fvtn)),
-        fullAudioTrackName_(std::move(fatn)) {}
+        fullAudioTrackName_(std::move(fatn)),
+        inputFile_(std::move(inputFile)),
+        readQueue_(std::make_shared<ReadQueue>(FLAGS_pipeline_queue_items)),
+        publishQueue_(FLAGS_pipeline_queue_items) {}
+
+  folly::EventBase* getEventBase() const {
+    return moqClient_->getEventBase();
+  }
 
   folly::coro::Task<void> run(Announce ann) noexcept {
     XLOG(INFO) << __func__;
@@ -57,7 +85,12 @@ class MoQFlvStreamerClient
       auto annResp = co_await moqClient_->moqSession_->announce(std::move(ann));
       if (annResp.hasValue()) {
         announceHandle_ = std::move(annResp.value());
-        folly::getGlobalIOExecutor()->add([this] { publishLoop(); });
+        startPipeline();
+        // Publish until stopped or the session closes
+        folly::CancellationCallback onClose(
+            moqClient_->moqSession_->getCancelToken(),
+            [this] { done_.post(); });
+        co_await done_;
       } else {
         XLOG(INFO) << "Announce error trackNamespace="
                    << annResp.error().trackNamespace << " code="
@@ -71,8 +104,15 @@ class MoQFlvStreamerClient
     XLOG(INFO) << __func__ << " done";
   }
 
+  // Must be called on the client's EventBase
   void stop() {
     XLOG(INFO) << __func__;
+    if (stopped_.exchange(true)) {
+      return;
+    }
+    // Wakes the encoder if it is waiting on the reader
+    readQueue_->write(nullptr);
+    done_.post();
     if (announceHandle_) {
       announceHandle_->unannounce();
     }
@@ -81,62 +121,93 @@ class MoQFlvStreamerClient
     }
   }
 
-  void publishLoop() {
+  // Waits for the encode stage to finish, after stop.  The publish EventBase
+  // must still be running.
+  void join() {
+    if (encoderThread_.joinable()) {
+      encoderThread_.join();
+    }
+  }
+
+  // Tags are read on a thread of their own, so a blocking FIFO holds up only
+  // this input, and MoQ-MI encoded on another.  Each stage hands off through
+  // a bounded queue, so a slow session backs up to its reader instead of
+  // buffering without limit.  Publishing stays on the session's EventBase.
+  void startPipeline() {
     XLOG(INFO) << __func__;
-    auto g =
-        folly::makeGuard([func = __func__] { XLOG(INFO) << "exit " << func; });
-    folly::Executor::KeepAlive keepAlive(moqClient_->getEventBase());
-    flv::FlvSequentialReader flvSeqReader(FLAGS_input_flv_file);
-    while (moqClient_->moqSession_) {
-      auto item = flvSeqReader.getNextItem();
-      if (item == nullptr) {
-        XLOG(ERR) << "Error reading FLV file";
-        break;
-      }
-      for (auto& sub : subscriptions_) {
-        XLOG(DBG1) << "Evaluating to send item: " << item->id
-                   << ", type: " << folly::to_underlying(item->type)
-                   << ", to reqID-TrackAlias: "
-                   << sub.second->subscribeOk().requestID << "-"
-                   << sub.second->trackAlias;
-
-        if (videoPub_ && sub.second->consumer == videoPub_.get()) {
-          if (item->data &&
-              (item->type == flv::FlvSequentialReader::MediaType::VIDEO ||
-               item->isEOF)) {
-            // Send audio data in a thread (stream per object). Clone it since
-            // we can have multiple subscribers
-            auto itemClone = item->clone();
-            moqClient_->getEventBase()->runInEventBaseThread(
-                [self(this), itemClone(std::move(itemClone))]() mutable {
-                  self->publishVideo(std::move(itemClone));
-                });
-          }
+    // The reader may be blocked in a FIFO read at exit, so it is detached and
+    // only holds state of its own
+    std::thread([inputFile = inputFile_, readQueue = readQueue_] {
+      flv::FlvSequentialReader flvSeqReader(inputFile);
+      while (true) {
+        auto item = flvSeqReader.getNextItem();
+        auto last = !item || item->isEOF;
+        if (!item) {
+          XLOG(ERR) << "Error reading FLV file " << inputFile;
         }
-        if (audioPub_ && sub.second->consumer == audioPub_.get()) {
-          // Audio
-          if (item->data &&
-              (item->type == flv::FlvSequentialReader::MediaType::AUDIO ||
-               item->isEOF)) {
-            // Send audio data in a thread (stream per object). Clone it since
-            // we can have multiple subscribers
-            auto itemClone = item->clone();
-            moqClient_->getEventBase()->runInEventBaseThread(
-                [self(this),
-                 trackAlias(sub.second->trackAlias),
-                 itemClone(std::move(itemClone))]() mutable {
-                  self->publishAudio(trackAlias, std::move(itemClone));
-                });
-          }
+        readQueue->blockingWrite(std::move(item));
+        if (last) {
+          break;
         }
       }
-      if (item->isEOF) {
+    }).detach();
+    encoderThread_ = std::thread([this] { encodeLoop(); });
+  }
+
+  void encodeLoop() {
+    while (true) {
+      std::unique_ptr<flv::FlvSequentialReader::MediaItem> item;
+      readQueue_->blockingRead(item);
+      if (stopped_) {
+        break;
+      }
+      EncodedItem encoded;
+      if (!item || item->isEOF) {
         XLOG(INFO) << "FLV file EOF";
+        encoded.isEOF = true;
+      } else {
+        encoded.type = item->type;
+        encoded.isIdr = item->isIdr;
+        encoded.object = MoQMi::encodeToMoQMi(std::move(item));
+        if (!encoded.object) {
+          XLOG(ERR) << "Failed to encode frame";
+          continue;
+        }
+      }
+      auto isEOF = encoded.isEOF;
+      publishQueue_.blockingWrite(std::move(encoded));
+      // The client may be gone by the time the publish thread gets to it
+      getEventBase()->runInEventBaseThread([weak = weak_from_this()] {
+        if (auto self = weak.lock()) {
+          self->drainPublishQueue();
+        }
+      });
+      if (isEOF) {
         break;
       }
     }
   }
 
+  void drainPublishQueue() {
+    EncodedItem item;
+    while (publishQueue_.read(item)) {
+      if (stopped_ || !moqClient_->moqSession_) {
+        continue;
+      }
+      if (item.isEOF) {
+        endVideoGroup();
+        continue;
+      }
+      if (item.type == flv::FlvSequentialReader::MediaType::VIDEO) {
+        if (videoPub_) {
+          publishVideo(item.isIdr, std::move(item.object));
+        }
+      } else if (audioPub_) {
+        publishAudio(std::move(item.object));
+      }
+    }
+  }
+
   folly::coro::Task<SubscribeResult> subscribe(
       SubscribeRequest subscribeReq,
       std::shared_ptr<TrackConsumer> consumer) override {
@@ -161,6 +232,7 @@ class MoQFlvStreamerClient
     } else if (subscribeReq.fullTrackName == fullAudioTrackName_) {
       latest = latestAudio_;
       audioPub_ = std::move(consumer);
+      audioTrackAlias_ = subscribeReq.trackAlias;
     } else {
       co_return folly::makeUnexpected(SubscribeError{
           subscribeReq.requestID,
@@ -185,20 +257,9 @@ class MoQFlvStreamerClient
     co_return subscription;
   }
 
-  void publishAudio(
-      TrackAlias trackAlias,
-      std::unique_ptr<flv::FlvSequentialReader::MediaItem> item) {
-    if (item->isEOF) {
-      XLOG(INFO) << "FLV audio received EOF";
-      return;
-    }
-    auto moqMiObj = MoQMi::encodeToMoQMi(std::move(item));
-    if (!moqMiObj) {
-      XLOG(ERR) << "Failed to encode audio frame";
-      return;
-    }
+  void publishAudio(std::unique_ptr<MoQMi::MoqMiObject> moqMiObj) {
     ObjectHeader objHeader = ObjectHeader{
-        trackAlias,
+        audioTrackAlias_,
         latestAudio_.group++,
         /*subgroup=*/0,
         latestAudio_.object,
@@ -211,31 +272,25 @@ class MoQFlvStreamerClient
     audioPub_->objectStream(objHeader, std::move(moqMiObj->payload));
   }
 
-  void publishVideo(std::unique_ptr<flv::FlvSequentialReader::MediaItem> item) {
-    if (item->isEOF) {
-      XLOG(INFO) << "FLV video received EOF";
-      if (videoPub_ && videoSgPub_) {
-        videoSgPub_->endOfGroup(latestVideo_.object);
-        videoSgPub_.reset();
+  void endVideoGroup() {
+    XLOG(INFO) << "FLV video received EOF";
+    if (videoPub_ && videoSgPub_) {
+      videoSgPub_->endOfGroup(latestVideo_.object);
+      videoSgPub_.reset();
 
-        latestVideo_.group++;
-        latestVideo_.object = 0;
-      }
-      return;
+      latestVideo_.group++;
+      latestVideo_.object = 0;
     }
+  }
 
-    if (!item->isIdr && !videoSgPub_) {
+  void publishVideo(
+      bool isIdr,
+      std::unique_ptr<MoQMi::MoqMiObject> moqMiObj) {
+    if (!isIdr && !videoSgPub_) {
       XLOG(INFO) << "Discarding non-IDR frame before subgroup started";
       return;
     }
 
-    auto isIdr = item->isIdr;
-    auto moqMiObj = MoQMi::encodeToMoQMi(std::move(item));
-    if (!moqMiObj) {
-      XLOG(ERR) << "Failed to encode video frame";
-      return;
-    }
-
     if (isIdr) {
       if (videoSgPub_) {
         // Close previous subgroup
@@ -271,10 +326,28 @@ class MoQFlvStreamerClient
   static const uint8_t AUDIO_STREAM_PRIORITY = 100; /* Lower is higher pri */
   static const uint8_t VIDEO_STREAM_PRIORITY = 200;
 
+  struct EncodedItem {
+    flv::FlvSequentialReader::MediaType type{
+        flv::FlvSequentialReader::MediaType::VIDEO};
+    bool isIdr{false};
+    bool isEOF{false};
+    std::unique_ptr<MoQMi::MoqMiObject> object;
+  };
+  // nullptr marks the end of the input
+  using ReadQueue =
+      folly::MPMCQueue<std::unique_ptr<flv::FlvSequentialReader::MediaItem>>;
+
   std::unique_ptr<MoQClient> moqClient_;
   std::shared_ptr<Subscriber::AnnounceHandle> announceHandle_;
   FullTrackName fullVideoTrackName_;
   FullTrackName fullAudioTrackName_;
+  std::string inputFile_;
+
+  std::shared_ptr<ReadQueue> readQueue_;
+  folly::MPMCQueue<EncodedItem> publishQueue_;
+  std::thread encoderThread_;
+  std::atomic<bool> stopped_{false};
+  folly::coro::Baton done_;
 
   AbsoluteLocation latestVideo_{0, 0};
   AbsoluteLocation latestAudio_{0, 0};
@@ -307,6 +380,7 @@ class MoQFlvStreamerClient
   };
   std::map<RequestID, std::shared_ptr<Subscription>> subscriptions_;
   std::shared_ptr<TrackConsumer> audioPub_;
+  TrackAlias audioTrackAlias_{0};
   std::shared_ptr<TrackConsumer> videoPub_;
   std::shared_ptr<SubgroupConsumer> videoSgPub_;
 };
@@ -325,23 +399,47 @@ int main(int argc, char* argv[]) {
     XLOGF(ERR, "Invalid url: {}", FLAGS_connect_url);
     return 1;
   }
-  if (!std::filesystem::exists(FLAGS_input_flv_file)) {
-    XLOGF(ERR, "The input file {} does not exists", FLAGS_input_flv_file);
+  std::vector<std::string> inputFiles;
+  folly::split(',', FLAGS_input_flv_file, inputFiles, /*ignoreEmpty=*/true);
+  if (inputFiles.empty()) {
+    XLOG(ERR) << "No input file";
     return 1;
   }
+  for (const auto& inputFile : inputFiles) {
+    if (!std::filesystem::exists(inputFile)) {
+      XLOGF(ERR, "The input file {} does not exists", inputFile);
+      return 1;
+    }
+  }
 
   XLOGF(
       INFO,
       "Starting publisher that will use: Stream(subGroup) per object for audio and Stream(subGroup) per GOP for video. Input file/pipe: {}",
       FLAGS_input_flv_file);
 
-  TrackNamespace ns =
-      TrackNamespace(FLAGS_track_namespace, FLAGS_track_namespace_delimiter);
-  auto streamerClient = std::make_shared<MoQFlvStreamerClient>(
-      &eventBase,
-      std::move(url),
-      moxygen::FullTrackName({ns, FLAGS_video_track_name}),
-      moxygen::FullTrackName({ns, FLAGS_audio_track_name}));
+  folly::IOThreadPoolExecutor publishExecutor(
+      FLAGS_publish_threads > 0 ? FLAGS_publish_threads
+                                : std::thread::hardware_concurrency());
+  std::vector<std::shared_ptr<MoQFlvStreamerClient>> streamerClients;
+  std::vector<folly::SemiFuture<folly::Unit>> runs;
+  for (size_t i = 0; i < inputFiles.size(); i++) {
+    auto trackNamespace = inputFiles.size() > 1
+        ? folly::to<std::string>(
+              FLAGS_track_namespace, FLAGS_track_namespace_delimiter, i)
+        : FLAGS_track_namespace;
+    TrackNamespace ns =
+        TrackNamespace(trackNamespace, FLAGS_track_namespace_delimiter);
+    auto streamerClient = std::make_shared<MoQFlvStreamerClient>(
+        publishExecutor.getEventBase(),
+        url,
+        moxygen::FullTrackName({ns, FLAGS_video_track_name}),
+        moxygen::FullTrackName({ns, FLAGS_audio_track_name}),
+        inputFiles[i]);
+    runs.push_back(streamerClient->run({RequestID(0), {std::move(ns)}, {}})
+                       .scheduleOn(streamerClient->getEventBase())
+                       .start());
+    streamerClients.push_back(std::move(streamerClient));
+  }
 
   class SigHandler : public folly::AsyncSignalHandler {
    public:
@@ -366,16 +464,21 @@ int main(int argc, char* argv[]) {
   };
 
   // TODO this does NOT work, we do not get the signal
-  SigHandler handler(
-      &eventBase, [&streamerClient](int) mutable { streamerClient->stop(); });
+  SigHandler handler(&eventBase, [&streamerClients](int) mutable {
+    for (auto& streamerClient : streamerClients) {
+      streamerClient->getEventBase()->runInEventBaseThread(
+          [streamerClient] { streamerClient->stop(); });
+    }
+  });
 
-  streamerClient->run({RequestID(0), {std::move(ns)}, {}})
-      .scheduleOn(&eventBase)
-      .start()
+  folly::collectAll(std::move(runs))
       .via(&eventBase)
       .thenTry([&handler](auto) { handler.unreg(); });
-  if (!eventBase.loop()) {
-    return 1;
+  auto ok = eventBase.loop();
+  for (auto& streamerClient : streamerClients) {
+    streamerClient->getEventBase()->runInEventBaseThreadAndWait(
+        [streamerClient] { streamerClient->stop(); });
+    streamerClient->join();
   }
-  return 0;
+  return ok ? 0 : 1;
 }
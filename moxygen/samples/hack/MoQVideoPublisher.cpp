@@ -1,14 +1,17 @@
 // MoQVideoPublisher.cpp
 
+#include <folly/String.h>
 #include <folly/io/Cursor.h>
 #include <folly/io/IOBuf.h>
 #include <proxygen/lib/utils/URL.h>
 #include <moxygen/moq_mi/MoQMi.h>
-#include <moxygen/relay/MoQRelayClient.h>
+#include <moxygen/relay/MoQRelayConnectionManager.h>
 #include <moxygen/samples/hack/MoQVideoPublisher.h>
 
 constexpr std::chrono::milliseconds kConnectTimeout = std::chrono::seconds(5);
 constexpr std::chrono::seconds kTransactionTimeout = std::chrono::seconds(60);
+constexpr std::chrono::milliseconds kTransportMetricsInterval =
+    std::chrono::seconds(1);
 
 namespace {
 uint64_t currentTimeMilliseconds() {
@@ -147,34 +150,126 @@ namespace moxygen {
 
 const uint8_t AUDIO_STREAM_PRIORITY = 100; /* Lower is higher pri */
 const uint8_t VIDEO_STREAM_PRIORITY = 200;
+// IDR frames remembered for aligning groups across renditions
+constexpr size_t kMaxRecentIdrs = 16;
+
+folly::Optional<size_t> MoQVideoPublisher::addRendition(
+    FullTrackName fullTrackName) {
+  const auto& announced =
+      renditions_.front()->forwarder.fullTrackName().trackNamespace;
+  if (fullTrackName.trackNamespace != announced) {
+    XLOG(ERR) << "Rendition " << fullTrackName
+              << " is not in the announced namespace "
+              << announced.describe();
+    return folly::none;
+  }
+  renditions_.push_back(
+      std::make_unique<VideoRendition>(std::move(fullTrackName)));
+  return renditions_.size() - 1;
+}
 
 // Implementation of setup function
 bool MoQVideoPublisher::setup(const std::string& connectURL) {
-  proxygen::URL url(connectURL);
-  if (!url.isValid() || !url.hasHost()) {
+  std::vector<std::string> urls;
+  folly::split(',', connectURL, urls, /*ignoreEmpty=*/true);
+  std::vector<proxygen::URL> relays;
+  for (const auto& urlString : urls) {
+    proxygen::URL url(urlString);
+    if (!url.isValid() || !url.hasHost()) {
+      XLOG(ERR) << "Invalid url: " << urlString;
+      return false;
+    }
+    relays.push_back(std::move(url));
+  }
+  if (relays.empty()) {
     XLOG(ERR) << "Invalid url: " << connectURL;
     return false;
   }
-  relayClient_ = std::make_unique<MoQRelayClient>(
-      std::make_unique<MoQClient>(evbThread_->getEventBase(), url));
-  relayClient_
-      ->run(
-          /*publisher=*/shared_from_this(),
-          /*subscriber=*/nullptr,
-          {videoForwarder_.fullTrackName().trackNamespace},
-          kConnectTimeout,
-          kTransactionTimeout)
-      .scheduleOn(evbThread_->getEventBase())
-      .start();
+  MoQRelayConnectionManager::Config config;
+  config.connectTimeout = kConnectTimeout;
+  config.transactionTimeout = kTransactionTimeout;
+  auto evb = evbThread_->getEventBase();
+  relayManager_ = std::make_shared<MoQRelayConnectionManager>(
+      evb, std::move(relays), config);
+  // One announce covers every rendition
+  evb->runInEventBaseThread([self = shared_from_this()] {
+    const auto& forwarder = self->renditions_.front()->forwarder;
+    self->relayManager_->start(
+        /*publisher=*/self,
+        /*subscriber=*/nullptr,
+        {forwarder.fullTrackName().trackNamespace});
+  });
   return true;
 }
 
+class MoQVideoPublisher::TransportMetricsObserver
+    : public MoQSession::TransportMetricsCallback {
+ public:
+  explicit TransportMetricsObserver(std::weak_ptr<MoQVideoPublisher> publisher)
+      : publisher_(std::move(publisher)) {}
+
+  void onTransportMetrics(const MoQTransportMetrics&) override {
+    if (auto publisher = publisher_.lock()) {
+      publisher->updateTargetBitrate();
+    }
+  }
+
+ private:
+  std::weak_ptr<MoQVideoPublisher> publisher_;
+};
+
+void MoQVideoPublisher::watchTransport(
+    const std::shared_ptr<MoQSession>& session) {
+  if (!targetBitrateCallback_ || watchedSession_.lock() == session) {
+    return;
+  }
+  if (!transportMetricsObserver_) {
+    transportMetricsObserver_ =
+        std::make_shared<TransportMetricsObserver>(weak_from_this());
+  }
+  if (auto previous = watchedSession_.lock()) {
+    previous->removeTransportMetricsCallback(transportMetricsObserver_.get());
+  }
+  watchedSession_ = session;
+  session->addTransportMetricsCallback(transportMetricsObserver_);
+  session->setTransportMetricsInterval(kTransportMetricsInterval);
+}
+
+void MoQVideoPublisher::updateTargetBitrate() {
+  auto metrics = renditions_.front()->forwarder.slowestTransport();
+  if (!metrics || !targetBitrateCallback_) {
+    return;
+  }
+  auto target =
+      uint64_t(double(metrics->estimatedSendRateBps()) * kBitrateHeadroom);
+  if (target == 0) {
+    return;
+  }
+  auto diff = target > targetBitrate_ ? target - targetBitrate_
+                                      : targetBitrate_ - target;
+  if (targetBitrate_ != 0 &&
+      double(diff) <= double(targetBitrate_) * kBitrateChangeFraction) {
+    return;
+  }
+  XLOG(DBG1) << "Target video bitrate " << targetBitrate_ << " -> " << target
+             << " srtt=" << metrics->srtt.count() << "us";
+  targetBitrate_ = target;
+  targetBitrateCallback_(target);
+}
+
 folly::coro::Task<Publisher::SubscribeResult> MoQVideoPublisher::subscribe(
     SubscribeRequest sub,
     std::shared_ptr<TrackConsumer> callback) {
-  if (sub.fullTrackName == videoForwarder_.fullTrackName()) {
-    co_return videoForwarder_.addSubscriber(
-        MoQSession::getRequestSession(), sub, std::move(callback));
+  for (size_t i = 0; i < renditions_.size(); i++) {
+    auto& forwarder = renditions_[i]->forwarder;
+    if (sub.fullTrackName == forwarder.fullTrackName()) {
+      auto session = MoQSession::getRequestSession();
+      if (i == 0) {
+        watchTransport(session);
+      }
+      co_return forwarder.addSubscriber(
+          std::move(session), sub, std::move(callback));
+    }
   }
 
   if (sub.fullTrackName == audioForwarder_.fullTrackName()) {
@@ -182,32 +277,7 @@ folly::coro::Task<Publisher::SubscribeResult> MoQVideoPublisher::subscribe(
         MoQSession::getRequestSession(), sub, std::move(callback));
   }
 
-  if ((sub.fullTrackName != videoForwarder_.fullTrackName()) &&
-      (sub.fullTrackName != audioForwarder_.fullTrackName())) {
-    XLOG(ERR) << "Unknown track " << sub.fullTrackName;
-    co_return folly::makeUnexpected(SubscribeError{
-        sub.requestID, SubscribeErrorCode::TRACK_NOT_EXIST, "Unknown track"});
-  }
-  if ((sub.fullTrackName == videoForwarder_.fullTrackName()) &&
-      !videoForwarder_.empty()) {
-    XLOG(ERR) << "Already subscribed to video track "
-              << videoForwarder_.fullTrackName();
-    co_return folly::makeUnexpected(SubscribeError{
-        sub.requestID,
-        SubscribeErrorCode::INTERNAL_ERROR,
-        "Already subscribed"});
-  }
-
-  if ((sub.fullTrackName == audioForwarder_.fullTrackName()) &&
-      !audioForwarder_.empty()) {
-    XLOG(ERR) << "Already subscribed to audio track "
-              << audioForwarder_.fullTrackName();
-    co_return folly::makeUnexpected(SubscribeError{
-        sub.requestID,
-        SubscribeErrorCode::INTERNAL_ERROR,
-        "Already subscribed"});
-  }
-
+  XLOG(ERR) << "Unknown track " << sub.fullTrackName;
   co_return folly::makeUnexpected(SubscribeError{
       sub.requestID, SubscribeErrorCode::TRACK_NOT_EXIST, "Unknown track"});
 }
@@ -216,36 +286,83 @@ void MoQVideoPublisher::publishVideoFrame(
     std::chrono::microseconds ptsUs,
     uint64_t flags,
     Payload payload) {
-  evbThread_->getEventBase()->runInEventBaseThread(
-      [this, ptsUs, flags, payload = std::move(payload)]() mutable {
-        publishFrameImpl(ptsUs, flags, std::move(payload));
-      });
+  enqueueFrame({false, 0, ptsUs, flags, std::move(payload)});
+}
+
+void MoQVideoPublisher::publishRenditionFrame(
+    size_t rendition,
+    std::chrono::microseconds ptsUs,
+    uint64_t flags,
+    Payload payload) {
+  enqueueFrame({false, rendition, ptsUs, flags, std::move(payload)});
+}
+
+void MoQVideoPublisher::publishVideoFrame(
+    std::chrono::microseconds ptsUs,
+    uint64_t flags,
+    void* data,
+    size_t length,
+    folly::IOBuf::FreeFunction release,
+    void* userData) {
+  publishVideoFrame(
+      ptsUs,
+      flags,
+      folly::IOBuf::takeOwnership(data, length, release, userData));
+}
+
+void MoQVideoPublisher::enqueueFrame(QueuedFrame frame) {
+  frameQueue_.enqueue(std::move(frame));
+  if (!drainScheduled_.exchange(true, std::memory_order_acq_rel)) {
+    evbThread_->getEventBase()->runInEventBaseThread([this] { drainFrames(); });
+  }
+}
+
+void MoQVideoPublisher::drainFrames() {
+  // Cleared first, a frame queued from here on schedules another drain
+  drainScheduled_.store(false, std::memory_order_release);
+  QueuedFrame frame;
+  while (frameQueue_.try_dequeue(frame)) {
+    if (frame.audio) {
+      publishAudioFrameImpl(frame.ptsUs, frame.flags, std::move(frame.payload));
+    } else if (frame.rendition < renditions_.size()) {
+      publishFrameImpl(
+          *renditions_[frame.rendition],
+          frame.ptsUs,
+          frame.flags,
+          std::move(frame.payload));
+    } else {
+      XLOG(ERR) << "Unknown rendition " << frame.rendition;
+    }
+  }
 }
 
 void MoQVideoPublisher::publishFrameImpl(
+    VideoRendition& rendition,
     std::chrono::microseconds ptsUs,
     uint64_t flags,
     Payload payload) {
-  if (!savedMetadata_ &&
+  auto& savedMetadata = rendition.savedMetadata;
+  if (!savedMetadata &&
       (flags & folly::to_underlying(BufferFlags::CODEC_CONFIG))) {
-    savedMetadata_ = convertMetadata(std::move(payload));
-    payload = savedMetadata_->clone();
-    savedMetadata_ = payload->clone();
+    savedMetadata = convertMetadata(std::move(payload));
+    payload = savedMetadata->clone();
+    savedMetadata = payload->clone();
   }
-  if (videoForwarder_.empty()) {
-    XLOG(ERR) << "No subscriber for track " << videoForwarder_.fullTrackName();
+  if (rendition.forwarder.empty()) {
+    XLOG(ERR) << "No subscriber for track "
+              << rendition.forwarder.fullTrackName();
     return;
   }
 
   auto item = std::make_unique<MediaItem>();
   item->type = MediaType::VIDEO;
-  item->id = videoSeqId_++;
+  item->id = rendition.seqId++;
   item->pts = ptsUs.count();
   // item->pts = (ptsUs.count() * timescale_) / 1000000;
   item->dts = item->pts; // wrong if B-frames are used
   item->timescale = 1000000;
-  if (lastVideoPts_) {
-    item->duration = item->pts - *lastVideoPts_;
+  if (rendition.lastPts) {
+    item->duration = item->pts - *rendition.lastPts;
   } else {
     item->duration = 1;
   }
@@ -254,71 +371,101 @@ void MoQVideoPublisher::publishFrameImpl(
   item->isEOF = flags & folly::to_underlying(BufferFlags::END_OF_STREAM);
   if (flags & folly::to_underlying(BufferFlags::CODEC_CONFIG)) {
     item->metadata = std::move(payload);
-  } else if (item->isIdr && savedMetadata_) {
+  } else if (item->isIdr && savedMetadata) {
     // New IDR frame, send saved metadata
-    item->metadata = savedMetadata_->clone();
+    item->metadata = savedMetadata->clone();
     item->data = std::move(payload);
-    lastVideoPts_ = item->pts;
+    rendition.lastPts = item->pts;
   } else {
     // video data
     item->data = std::move(payload);
-    lastVideoPts_ = item->pts;
+    rendition.lastPts = item->pts;
   }
-  publishFrameToMoQ(std::move(item));
+  publishFrameToMoQ(rendition, std::move(item));
 }
 
 void MoQVideoPublisher::endPublish() {
   evbThread_->getEventBase()->runInEventBaseThread([this] {
-    videoForwarder_.subscribeDone(
-        {0, SubscribeDoneStatusCode::TRACK_ENDED, 0, "end of track"});
+    // Frames queued before the end go out first
+    drainFrames();
+    for (auto& rendition : renditions_) {
+      rendition->forwarder.subscribeDone(
+          {0, SubscribeDoneStatusCode::TRACK_ENDED, 0, "end of track"});
+    }
   });
 }
 
-void MoQVideoPublisher::publishFrameToMoQ(std::unique_ptr<MediaItem> item) {
+uint64_t MoQVideoPublisher::alignedGroup(uint64_t pts, uint64_t minGroup) {
+  for (auto it = recentIdrGroups_.rbegin(); it != recentIdrGroups_.rend();
+       ++it) {
+    if (it->first == pts && it->second >= minGroup) {
+      return it->second;
+    }
+  }
+  // No other rendition had an IDR frame here yet, or the rendition is
+  // already past its group
+  auto group = std::max(nextAlignedGroup_, minGroup);
+  nextAlignedGroup_ = group + 1;
+  recentIdrGroups_.emplace_back(pts, group);
+  if (recentIdrGroups_.size() > kMaxRecentIdrs) {
+    recentIdrGroups_.pop_front();
+  }
+  return group;
+}
+
+void MoQVideoPublisher::publishFrameToMoQ(
+    VideoRendition& rendition,
+    std::unique_ptr<MediaItem> item) {
+  auto& latestVideo = rendition.latest;
+  auto& videoSgPub = rendition.sgPub;
   if (item->isEOF || item->isIdr) {
     XLOG(INFO) << "Ending group";
-    if (videoSgPub_) {
-      videoSgPub_->endOfGroup(latestVideo_.object);
-      videoSgPub_.reset();
+    if (videoSgPub) {
+      videoSgPub->endOfGroup(latestVideo.object);
+      videoSgPub.reset();
 
-      latestVideo_.group++;
-      latestVideo_.object = 0;
+      latestVideo.group++;
+      latestVideo.object = 0;
     }
     if (item->isEOF) {
       return;
     }
   }
 
-  if (!item->isIdr && !item->metadata && !videoSgPub_) {
+  if (!item->isIdr && !item->metadata && !videoSgPub) {
     XLOG(INFO) << "Discarding non-IDR/metadata frame before subgroup started";
     return;
   }
 
+  if (item->isIdr && !videoSgPub) {
+    latestVideo.group = alignedGroup(item->pts, latestVideo.group);
+  }
+
   auto moqMiObj = MoQMi::encodeToMoQMi(std::move(item));
   if (!moqMiObj) {
     XLOG(ERR) << "Failed to encode video frame";
     return;
   }
 
-  if (!videoSgPub_) {
+  if (!videoSgPub) {
     // Open new subgroup
-    auto res = videoForwarder_.beginSubgroup(
-        latestVideo_.group, 0, VIDEO_STREAM_PRIORITY);
+    auto res = rendition.forwarder.beginSubgroup(
+        latestVideo.group, 0, VIDEO_STREAM_PRIORITY);
     if (!res) {
       XLOG(ERR) << "Error creating subgroup";
     }
-    videoSgPub_ = std::move(res.value());
+    videoSgPub = std::move(res.value());
   }
 
   // Send video data
-  if (videoSgPub_) {
-    XLOG(DBG1) << "Sending video frame. grp-obj: " << latestVideo_.group << "-"
-               << latestVideo_.object << ". Payload size: "
+  if (videoSgPub) {
+    XLOG(DBG1) << "Sending video frame. grp-obj: " << latestVideo.group << "-"
+               << latestVideo.object << ". Payload size: "
                << (moqMiObj->payload
                        ? moqMiObj->payload->computeChainDataLength()
                        : 0);
-    videoSgPub_->object(
-        latestVideo_.object++,
+    videoSgPub->object(
+        latestVideo.object++,
         std::move(moqMiObj->payload),
         std::move(moqMiObj->extensions));
   } else {
@@ -330,10 +477,20 @@ void MoQVideoPublisher::publishAudioFrame(
     std::chrono::microseconds ptsUs,
     uint64_t flags,
     Payload payload) {
-  evbThread_->getEventBase()->runInEventBaseThread(
-      [this, ptsUs, flags, payload = std::move(payload)]() mutable {
-        publishAudioFrameImpl(ptsUs, flags, std::move(payload));
-      });
+  enqueueFrame({true, 0, ptsUs, flags, std::move(payload)});
+}
+
+void MoQVideoPublisher::publishAudioFrame(
+    std::chrono::microseconds ptsUs,
+    uint64_t flags,
+    void* data,
+    size_t length,
+    folly::IOBuf::FreeFunction release,
+    void* userData) {
+  publishAudioFrame(
+      ptsUs,
+      flags,
+      folly::IOBuf::takeOwnership(data, length, release, userData));
 }
 
 void MoQVideoPublisher::publishAudioFrameImpl(
@@ -2,15 +2,18 @@
 
 #pragma once
 
+#include <folly/concurrency/UnboundedQueue.h>
 #include <folly/io/async/ScopedEventBaseThread.h>
 #include <moxygen/MoQFramer.h>
 #include <moxygen/Publisher.h>
 #include <moxygen/relay/MoQForwarder.h>
-#include <moxygen/relay/MoQRelayClient.h>
+#include <moxygen/relay/MoQRelayConnectionManager.h>
+
+#include <deque>
 
 namespace moxygen {
 
-class MoQRelayClient;
+class MoQRelayConnectionManager;
 struct MediaItem;
 
 class MoQVideoPublisher
@@ -21,11 +24,26 @@ class MoQVideoPublisher
       FullTrackName fullVideoTrackName,
       FullTrackName fullAudioTrackName,
       uint64_t timescale = 30)
-      : videoForwarder_(std::move(fullVideoTrackName)),
-        audioForwarder_(std::move(fullAudioTrackName)) {
+      : audioForwarder_(std::move(fullAudioTrackName)) {
+    renditions_.push_back(
+        std::make_unique<VideoRendition>(std::move(fullVideoTrackName)));
     evbThread_ = std::make_unique<folly::ScopedEventBaseThread>();
   }
 
+  /**
+   * Adds a simulcast rendition of the video, e.g. a lower resolution
+   * encoding of the same source, published as its own track.  The track
+   * must be in the video track's namespace, which is announced once for
+   * all renditions, and all renditions share the audio track.  Rendition 0
+   * is the video track given to the constructor.
+   *
+   * Call before setup.  Returns the rendition's index, or folly::none if the
+   * namespace differs.
+   */
+  folly::Optional<size_t> addRendition(FullTrackName fullTrackName);
+
+  // connectURL may list several relays separated by commas, the first that
+  // connects is used and the next one is kept ready to fail over to
   bool setup(const std::string& connectURL);
 
   /**
@@ -43,6 +61,41 @@ class MoQVideoPublisher
       uint64_t flags,
       Payload payload);
 
+  /**
+   * Publishes a frame of a rendition added with addRendition.  Each
+   * rendition starts a group on its own IDR frames, and IDR frames with the
+   * same pts get the same group ID in every rendition, so a relay can switch
+   * a subscriber between renditions at a group boundary.
+   */
+  void publishRenditionFrame(
+      size_t rendition,
+      std::chrono::microseconds ptsUs,
+      uint64_t flags,
+      Payload payload);
+
+  /**
+   * Zero-copy variants for frames in the caller's own buffers, e.g. an
+   * encoder's pinned or DMA memory.  The buffer is wrapped, never copied,
+   * and must stay valid until release(data, userData) is called.  That
+   * happens on whichever thread drops the last reference, usually the
+   * publisher's once the transport has sent the frame.
+   */
+  void publishVideoFrame(
+      std::chrono::microseconds ptsUs,
+      uint64_t flags,
+      void* data,
+      size_t length,
+      folly::IOBuf::FreeFunction release,
+      void* userData = nullptr);
+
+  void publishAudioFrame(
+      std::chrono::microseconds ptsUs,
+      uint64_t flags,
+      void* data,
+      size_t length,
+      folly::IOBuf::FreeFunction release,
+      void* userData = nullptr);
+
   /**
    * Ends publishing the video stream.
    */
@@ -52,9 +105,56 @@ class MoQVideoPublisher
       SubscribeRequest sub,
       std::shared_ptr<TrackConsumer> callback) override;
 
+  // Called on the publisher's thread with a bitrate, in bits per second, the
+  // encoder should target to fit the slowest video subscriber's transport.
+  // Only called once the target moves by more than kBitrateChangeFraction.
+  using TargetBitrateCallback = std::function<void(uint64_t)>;
+  void setTargetBitrateCallback(TargetBitrateCallback callback) {
+    targetBitrateCallback_ = std::move(callback);
+  }
+
+  // Share of the estimated send rate left to the encoder
+  static constexpr double kBitrateHeadroom = 0.8;
+  static constexpr double kBitrateChangeFraction = 0.1;
+
  private:
-  void publishFrameToMoQ(std::unique_ptr<MediaItem> item);
+  class TransportMetricsObserver;
+
+  // The state of one video track
+  struct VideoRendition {
+    explicit VideoRendition(FullTrackName fullTrackName)
+        : forwarder(std::move(fullTrackName)) {}
+
+    MoQForwarder forwarder;
+    AbsoluteLocation latest{0, 0};
+    std::shared_ptr<SubgroupConsumer> sgPub;
+    uint64_t seqId{0};
+    folly::Optional<uint64_t> lastPts;
+    std::unique_ptr<folly::IOBuf> savedMetadata;
+  };
+
+  void watchTransport(const std::shared_ptr<MoQSession>& session);
+  void updateTargetBitrate();
+  // The group for an IDR frame of a rendition whose next group is at least
+  // minGroup, shared with IDR frames of the same pts in other renditions
+  uint64_t alignedGroup(uint64_t pts, uint64_t minGroup);
+  // Frames cross to the publisher's thread through frameQueue_, with a
+  // single drain scheduled however many are queued
+  struct QueuedFrame {
+    bool audio{false};
+    size_t rendition{0};
+    std::chrono::microseconds ptsUs{0};
+    uint64_t flags{0};
+    Payload payload;
+  };
+  void enqueueFrame(QueuedFrame frame);
+  void drainFrames();
+
+  void publishFrameToMoQ(
+      VideoRendition& rendition,
+      std::unique_ptr<MediaItem> item);
   void publishFrameImpl(
+      VideoRendition& rendition,
       std::chrono::microseconds ptsUs,
       uint64_t flags,
       Payload payload);
@@ -64,20 +164,25 @@ class MoQVideoPublisher
       uint64_t flags,
       Payload payload);
 
+  // Before evbThread_, which may still drain it while stopping
+  folly::UMPSCQueue<QueuedFrame, /*MayBlock=*/false> frameQueue_;
+  std::atomic<bool> drainScheduled_{false};
   std::unique_ptr<folly::ScopedEventBaseThread> evbThread_;
-  std::unique_ptr<MoQRelayClient> relayClient_;
+  std::shared_ptr<MoQRelayConnectionManager> relayManager_;
   // uint64_t timescale_{30};
-  MoQForwarder videoForwarder_;
+  std::vector<std::unique_ptr<VideoRendition>> renditions_;
   MoQForwarder audioForwarder_;
-  AbsoluteLocation latestVideo_{0, 0};
   AbsoluteLocation latestAudio_{0, 0};
-  std::shared_ptr<SubgroupConsumer> videoSgPub_;
   std::shared_ptr<SubgroupConsumer> audioSgPub_;
-  uint64_t videoSeqId_{0};
   uint64_t audioSeqId_{0};
-  folly::Optional<uint64_t> lastVideoPts_;
   folly::Optional<uint64_t> lastAudioPts_;
-  std::unique_ptr<folly::IOBuf> savedMetadata_;
+  // The groups of recent IDR frames by pts, oldest first
+  std::deque<std::pair<uint64_t, uint64_t>> recentIdrGroups_;
+  uint64_t nextAlignedGroup_{0};
+  TargetBitrateCallback targetBitrateCallback_;
+  std::shared_ptr<TransportMetricsObserver> transportMetricsObserver_;
+  std::weak_ptr<MoQSession> watchedSession_;
+  uint64_t targetBitrate_{0};
 };
 
 } // namespace moxygen
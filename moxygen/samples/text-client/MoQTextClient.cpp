@@ -6,6 +6,7 @@
 
 #include <folly/portability/GFlags.h>
 #include <moxygen/MoQClient.h>
+#include <moxygen/MoQLatencyProbe.h>
 #include <moxygen/MoQWebTransportClient.h>
 #include <moxygen/ObjectReceiver.h>
 
@@ -32,6 +33,16 @@ DEFINE_bool(fetch, false, "Use fetch rather than subscribe");
 DEFINE_bool(jrfetch, false, "Joining relative fetch");
 DEFINE_bool(jafetch, false, "Joining absolute fetch");
 DEFINE_bool(forward, true, "Forward flag for subscriptions");
+DEFINE_bool(
+    latency_probe,
+    false,
+    "Report per hop and total latency percentiles of probe objects, like "
+    "moq-date/probe, instead of printing objects.  Hops between hosts are "
+    "only as accurate as their clocks are synchronized");
+DEFINE_uint32(
+    probe_report_interval_s,
+    5,
+    "Seconds of latency probes in each report");
 
 namespace {
 using namespace moxygen;
@@ -79,6 +90,10 @@ class TextHandler : public ObjectReceiverCallback {
   ~TextHandler() override = default;
   FlowControlState onObject(const ObjectHeader& header, Payload payload)
       override {
+    if (FLAGS_latency_probe) {
+      onProbe(header);
+      return FlowControlState::UNBLOCKED;
+    }
     for (const auto& ext : header.extensions) {
       if (ext.type & 0x1) {
         ext.arrayValue->coalesce();
@@ -114,13 +129,39 @@ class TextHandler : public ObjectReceiverCallback {
   void onSubscribeDone(SubscribeDone) override {
     CHECK(!fetch_);
     std::cout << __func__ << std::endl;
+    if (probeStats_.numProbes() > 0) {
+      std::cout << probeStats_.report();
+    }
     baton.post();
   }
 
   folly::coro::Baton baton;
 
  private:
+  void onProbe(const ObjectHeader& header) {
+    auto hops = parseProbeHops(header.extensions);
+    if (hops.empty()) {
+      XLOG(DBG1) << "Not a latency probe grp=" << header.group
+                 << " id=" << header.id;
+      return;
+    }
+    probeStats_.add(hops);
+    auto now = std::chrono::steady_clock::now();
+    if (!lastReport_) {
+      lastReport_ = now;
+    } else if (
+        now - *lastReport_ >=
+        std::chrono::seconds(FLAGS_probe_report_interval_s)) {
+      std::cout << probeStats_.numProbes() << " probes" << std::endl
+                << probeStats_.report() << std::endl;
+      probeStats_.clear();
+      lastReport_ = now;
+    }
+  }
+
   bool fetch_{false};
+  LatencyProbeStats probeStats_;
+  folly::Optional<std::chrono::steady_clock::time_point> lastReport_;
 };
 
 class MoQTextClient : public Subscriber,
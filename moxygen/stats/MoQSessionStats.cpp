@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/stats/MoQSessionStats.h"
+
+namespace {
+using namespace moxygen;
+using Event = MoQSessionStats::Event;
+
+// Counts the events common to both roles into one array of the shard
+template <typename Base>
+class RoleStats : public Base {
+ public:
+  using Events = std::array<std::atomic<uint64_t>, MoQSessionStats::kNumEvents>;
+
+  RoleStats(
+      std::shared_ptr<MoQSessionStats::Shards> shards,
+      Events MoQSessionStats::Shard::*events)
+      : shards_(std::move(shards)), events_(events) {}
+
+  void onSubscribeSuccess() override {
+    count(Event::SubscribeSuccess);
+  }
+  void onSubscribeError(SubscribeErrorCode) override {
+    count(Event::SubscribeError);
+  }
+  void onFetchSuccess() override {
+    count(Event::FetchSuccess);
+  }
+  void onFetchError(FetchErrorCode) override {
+    count(Event::FetchError);
+  }
+  void onAnnounceSuccess() override {
+    count(Event::AnnounceSuccess);
+  }
+  void onAnnounceError(AnnounceErrorCode) override {
+    count(Event::AnnounceError);
+  }
+  void onUnannounce() override {
+    count(Event::Unannounce);
+  }
+  void onAnnounceCancel() override {
+    count(Event::AnnounceCancel);
+  }
+  void onSubscribeAnnouncesSuccess() override {
+    count(Event::SubscribeAnnouncesSuccess);
+  }
+  void onSubscribeAnnouncesError(SubscribeAnnouncesErrorCode) override {
+    count(Event::SubscribeAnnouncesError);
+  }
+  void onUnsubscribeAnnounces() override {
+    count(Event::UnsubscribeAnnounces);
+  }
+  void onTrackStatus() override {
+    count(Event::TrackStatus);
+  }
+  void onUnsubscribe() override {
+    count(Event::Unsubscribe);
+  }
+  void onSubscribeDone(SubscribeDoneStatusCode) override {
+    count(Event::SubscribeDone);
+  }
+  void onSubscribeUpdate() override {
+    count(Event::SubscribeUpdate);
+  }
+
+ protected:
+  MoQSessionStats::Shard& shard() {
+    return **shards_;
+  }
+
+ private:
+  void count(Event event) {
+    // Each shard has a single writer
+    auto& counter = (shard().*events_)[size_t(event)];
+    counter.store(
+        counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  std::shared_ptr<MoQSessionStats::Shards> shards_;
+  Events MoQSessionStats::Shard::*events_;
+};
+
+class PublisherStats : public RoleStats<MoQPublisherStatsCallback> {
+ public:
+  explicit PublisherStats(std::shared_ptr<MoQSessionStats::Shards> shards)
+      : RoleStats(std::move(shards), &MoQSessionStats::Shard::publisherEvents) {
+  }
+
+  void recordAnnounceLatency(uint64_t latencyMsec) override {
+    shard().announceLatencyMsec.record(latencyMsec);
+  }
+
+  void recordTransportMetrics(const MoQTransportMetrics& metrics) override {
+    shard().srttUsec.record(metrics.srtt.count());
+    shard().sendRateKbps.record(metrics.estimatedSendRateBps() / 1000);
+  }
+
+  void recordMemoryUsage(const MoQMemoryUsage& usage) override {
+    shard().sessionMemoryKB.record(usage.total() / 1024);
+  }
+};
+
+class SubscriberStats : public RoleStats<MoQSubscriberStatsCallback> {
+ public:
+  explicit SubscriberStats(std::shared_ptr<MoQSessionStats::Shards> shards)
+      : RoleStats(
+            std::move(shards),
+            &MoQSessionStats::Shard::subscriberEvents) {}
+
+  void recordSubscribeLatency(uint64_t latencyMsec) override {
+    shard().subscribeLatencyMsec.record(latencyMsec);
+  }
+
+  void recordFetchLatency(uint64_t latencyMsec) override {
+    shard().fetchLatencyMsec.record(latencyMsec);
+  }
+};
+} // namespace
+
+namespace moxygen {
+
+const char* MoQSessionStats::eventName(Event event) {
+  switch (event) {
+    case Event::SubscribeSuccess:
+      return "subscribe_success";
+    case Event::SubscribeError:
+      return "subscribe_error";
+    case Event::FetchSuccess:
+      return "fetch_success";
+    case Event::FetchError:
+      return "fetch_error";
+    case Event::AnnounceSuccess:
+      return "announce_success";
+    case Event::AnnounceError:
+      return "announce_error";
+    case Event::Unannounce:
+      return "unannounce";
+    case Event::AnnounceCancel:
+      return "announce_cancel";
+    case Event::SubscribeAnnouncesSuccess:
+      return "subscribe_announces_success";
+    case Event::SubscribeAnnouncesError:
+      return "subscribe_announces_error";
+    case Event::UnsubscribeAnnounces:
+      return "unsubscribe_announces";
+    case Event::TrackStatus:
+      return "track_status";
+    case Event::Unsubscribe:
+      return "unsubscribe";
+    case Event::SubscribeDone:
+      return "subscribe_done";
+    case Event::SubscribeUpdate:
+      return "subscribe_update";
+    case Event::NumEvents:
+      break;
+  }
+  return "unknown";
+}
+
+MoQSessionStats::MoQSessionStats()
+    : shards_(std::make_shared<Shards>()),
+      publisherStats_(std::make_shared<PublisherStats>(shards_)),
+      subscriberStats_(std::make_shared<SubscriberStats>(shards_)) {}
+
+MoQSessionStats::Snapshot MoQSessionStats::snapshot() const {
+  Snapshot snapshot;
+  for (const auto& shard : shards_->accessAllThreads()) {
+    for (size_t i = 0; i < kNumEvents; i++) {
+      snapshot.publisherEvents[i] +=
+          shard.publisherEvents[i].load(std::memory_order_relaxed);
+      snapshot.subscriberEvents[i] +=
+          shard.subscriberEvents[i].load(std::memory_order_relaxed);
+    }
+    snapshot.announceLatencyMsec.merge(shard.announceLatencyMsec);
+    snapshot.subscribeLatencyMsec.merge(shard.subscribeLatencyMsec);
+    snapshot.fetchLatencyMsec.merge(shard.fetchLatencyMsec);
+    snapshot.srttUsec.merge(shard.srttUsec);
+    snapshot.sendRateKbps.merge(shard.sendRateKbps);
+    snapshot.sessionMemoryKB.merge(shard.sessionMemoryKB);
+  }
+  return snapshot;
+}
+
+} // namespace moxygen
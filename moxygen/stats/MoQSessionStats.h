@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <moxygen/stats/MoQTrackStats.h>
+
+namespace moxygen {
+
+/*
+ * Publisher and subscriber stats callbacks that count into thread-local
+ * shards, so one instance can be shared by sessions on every worker
+ * EventBase without contention.  snapshot() merges the shards.
+ */
+class MoQSessionStats {
+ public:
+  enum class Event : uint8_t {
+    SubscribeSuccess,
+    SubscribeError,
+    FetchSuccess,
+    FetchError,
+    AnnounceSuccess,
+    AnnounceError,
+    Unannounce,
+    AnnounceCancel,
+    SubscribeAnnouncesSuccess,
+    SubscribeAnnouncesError,
+    UnsubscribeAnnounces,
+    TrackStatus,
+    Unsubscribe,
+    SubscribeDone,
+    SubscribeUpdate,
+    NumEvents
+  };
+  static constexpr size_t kNumEvents = size_t(Event::NumEvents);
+
+  // snake_case name of the event, eg: "subscribe_success"
+  static const char* eventName(Event event);
+
+  struct Snapshot {
+    std::array<uint64_t, kNumEvents> publisherEvents{};
+    std::array<uint64_t, kNumEvents> subscriberEvents{};
+    MoQHistogram announceLatencyMsec;
+    MoQHistogram subscribeLatencyMsec;
+    MoQHistogram fetchLatencyMsec;
+    // Transport samples from publishing sessions
+    MoQHistogram srttUsec;
+    MoQHistogram sendRateKbps;
+    // Buffered bytes sampled from publishing sessions
+    MoQHistogram sessionMemoryKB;
+  };
+
+  MoQSessionStats();
+
+  // Callbacks for MoQSession::setPublisherStatsCallback and
+  // setSubscriberStatsCallback.  They may outlive this object.
+  const std::shared_ptr<MoQPublisherStatsCallback>& publisherStatsCallback()
+      const {
+    return publisherStats_;
+  }
+  const std::shared_ptr<MoQSubscriberStatsCallback>& subscriberStatsCallback()
+      const {
+    return subscriberStats_;
+  }
+
+  Snapshot snapshot() const;
+
+  struct Shard {
+    std::array<std::atomic<uint64_t>, kNumEvents> publisherEvents{};
+    std::array<std::atomic<uint64_t>, kNumEvents> subscriberEvents{};
+    MoQHistogram announceLatencyMsec;
+    MoQHistogram subscribeLatencyMsec;
+    MoQHistogram fetchLatencyMsec;
+    MoQHistogram srttUsec;
+    MoQHistogram sendRateKbps;
+    MoQHistogram sessionMemoryKB;
+  };
+  struct ShardTag {};
+  using Shards = folly::ThreadLocal<Shard, ShardTag>;
+
+ private:
+  std::shared_ptr<Shards> shards_;
+  std::shared_ptr<MoQPublisherStatsCallback> publisherStats_;
+  std::shared_ptr<MoQSubscriberStatsCallback> subscriberStats_;
+};
+
+} // namespace moxygen
@@ -10,6 +10,58 @@
 
 namespace moxygen {
 
+/*
+ * A sample of a session's transport congestion state.  Fields the transport
+ * doesn't report are 0.
+ */
+struct MoQTransportMetrics {
+  std::chrono::microseconds srtt{0};
+  std::chrono::microseconds rttVar{0};
+  std::chrono::microseconds minRtt{0};
+  uint64_t congestionWindow{0};
+  uint64_t bytesInFlight{0};
+  // What the congestion controller lets through now
+  uint64_t writableBytes{0};
+  uint64_t pacingRateBps{0};
+  uint64_t packetsSent{0};
+  uint64_t packetsLost{0};
+  // Largest datagram the path carries now, 0 if unknown
+  uint64_t maxDatagramSize{0};
+
+  // The pacing rate, or a window per RTT without pacing, less the fraction
+  // of packets lost.  0 before there is an RTT sample.
+  uint64_t estimatedSendRateBps() const {
+    uint64_t rate = pacingRateBps;
+    if (rate == 0 && srtt.count() > 0) {
+      rate = congestionWindow * 8 * 1000000 / srtt.count();
+    }
+    if (packetsSent > 0) {
+      rate -= rate * std::min(packetsLost, packetsSent) / packetsSent;
+    }
+    return rate;
+  }
+};
+
+/*
+ * Bytes a session holds in its own buffers, not counting what the transport
+ * or the relay's cache hold.
+ */
+struct MoQMemoryUsage {
+  // Control messages waiting for the control stream
+  uint64_t controlWriteBytes{0};
+  // Unparsed bytes in the control stream codec
+  uint64_t controlIngressBytes{0};
+  // Unparsed bytes in the data stream codecs
+  uint64_t dataIngressBytes{0};
+  // Bytes the session's subscriptions queued and not yet written
+  uint64_t publishBufferedBytes{0};
+
+  uint64_t total() const {
+    return controlWriteBytes + controlIngressBytes + dataIngressBytes +
+        publishBufferedBytes;
+  }
+};
+
 /*
  * The stats in the MoQStatsCallback are common to both the publisher
  * and subscriber. The comments above each function describe when they're
@@ -117,6 +169,13 @@ class MoQPublisherStatsCallback : public MoQStatsCallback {
  public:
   // Record the time it takes from request to response for an ANNOUNCE
   virtual void recordAnnounceLatency(uint64_t latencyMsec) = 0;
+
+  // Record a sample of the session's transport, taken every
+  // MoQSession::setTransportMetricsInterval
+  virtual void recordTransportMetrics(const MoQTransportMetrics& metrics) = 0;
+
+  // Record the session's buffered bytes, sampled along with the transport
+  virtual void recordMemoryUsage(const MoQMemoryUsage& usage) = 0;
 };
 
 class MoQSubscriberStatsCallback : public MoQStatsCallback {
@@ -128,6 +187,61 @@ class MoQSubscriberStatsCallback : public MoQStatsCallback {
   virtual void recordFetchLatency(uint64_t latencyMsec) = 0;
 };
 
+/*
+ * Data plane events, reported per track.  These are called for every object,
+ * so implementations need to be cheap; MoQTrackStats is one built on
+ * thread-local counters.
+ */
+class MoQTrackStatsCallback {
+ public:
+  virtual ~MoQTrackStatsCallback() = default;
+
+  /*
+   * Subscriber: Received an object of the given length, on a stream or in a
+   *   datagram
+   */
+  virtual void onObjectReceived(const FullTrackName& ftn, uint64_t bytes) = 0;
+
+  /*
+   * Publisher: Wrote an object of the given length to a stream or datagram
+   */
+  virtual void onObjectSent(const FullTrackName& ftn, uint64_t bytes) = 0;
+
+  /*
+   * Relay: Time taken to hand one object to every subscriber of the track,
+   *   including the writes to their sessions
+   */
+  virtual void recordForwardLatency(
+      const FullTrackName& ftn,
+      uint64_t latencyUsec) = 0;
+
+  /*
+   * Publisher: Time spent waiting in awaitStreamCredit for the peer to allow
+   *   another uni stream
+   */
+  virtual void recordStreamCreditStall(
+      const FullTrackName& ftn,
+      uint64_t stallUsec) = 0;
+
+  /*
+   * Publisher: Bytes buffered for the subscription and not yet delivered,
+   *   sampled after each write
+   */
+  virtual void recordBufferedBytes(const FullTrackName& ftn, uint64_t bytes) = 0;
+
+  /*
+   * Publisher: The subscription went over its buffering threshold
+   *   (TOO_FAR_BEHIND)
+   */
+  virtual void onTooFarBehind(const FullTrackName& ftn) = 0;
+
+  /*
+   * Publisher: A subgroup was reset to free buffer space, dropping the given
+   *   number of buffered bytes
+   */
+  virtual void onSubgroupDropped(const FullTrackName& ftn, uint64_t bytes) = 0;
+};
+
 #define MOQ_PUBLISHER_STATS(publisherStatsCallback, method, ...) \
   if (publisherStatsCallback) {                                  \
     folly::invoke(                                               \
@@ -146,4 +260,13 @@ class MoQSubscriberStatsCallback : public MoQStatsCallback {
   }                                                                \
   static_assert(true, "semicolon required")
 
+#define MOQ_TRACK_STATS(trackStatsCallback, method, ...) \
+  if (trackStatsCallback) {                              \
+    folly::invoke(                                       \
+        &MoQTrackStatsCallback::method,                  \
+        trackStatsCallback,                              \
+        ##__VA_ARGS__);                                  \
+  }                                                      \
+  static_assert(true, "semicolon required")
+
 } // namespace moxygen
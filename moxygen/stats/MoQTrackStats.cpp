@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/stats/MoQTrackStats.h"
+
+#include <folly/lang/Bits.h>
+
+#include <cmath>
+#include <mutex>
+#include <shared_mutex>
+
+namespace {
+// Counters have a single writer, so a load and store is enough
+void add(std::atomic<uint64_t>& counter, uint64_t amount) {
+  counter.store(
+      counter.load(std::memory_order_relaxed) + amount,
+      std::memory_order_relaxed);
+}
+
+uint64_t get(const std::atomic<uint64_t>& counter) {
+  return counter.load(std::memory_order_relaxed);
+}
+} // namespace
+
+namespace moxygen {
+
+// MoQHistogram
+
+size_t MoQHistogram::bucketIndex(uint64_t value) {
+  if (value < kSubBuckets) {
+    return value;
+  }
+  // value >> shift is in [kSubBuckets / 2, kSubBuckets)
+  uint64_t shift = folly::findLastSet(value) - kSubBucketBits;
+  uint64_t subBucket = (value >> shift) - kSubBuckets / 2;
+  return kSubBuckets + (shift - 1) * (kSubBuckets / 2) + subBucket;
+}
+
+uint64_t MoQHistogram::bucketUpperBound(size_t index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+  uint64_t shift = (index - kSubBuckets) / (kSubBuckets / 2) + 1;
+  uint64_t subBucket = (index - kSubBuckets) % (kSubBuckets / 2);
+  uint64_t lowerBound = (subBucket + kSubBuckets / 2) << shift;
+  return lowerBound + ((uint64_t(1) << shift) - 1);
+}
+
+void MoQHistogram::merge(const MoQHistogram& other) {
+  for (size_t i = 0; i < kNumBuckets; i++) {
+    auto count = other.counts_[i].load(std::memory_order_relaxed);
+    if (count > 0) {
+      counts_[i].fetch_add(count, std::memory_order_relaxed);
+    }
+  }
+  sum_.fetch_add(other.sum(), std::memory_order_relaxed);
+}
+
+uint64_t MoQHistogram::count() const {
+  uint64_t total = 0;
+  for (const auto& count : counts_) {
+    total += count.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+uint64_t MoQHistogram::percentile(double pct) const {
+  auto total = count();
+  if (total == 0) {
+    return 0;
+  }
+  auto rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(pct / 100 * double(total))));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kNumBuckets; i++) {
+    seen += counts_[i].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      return bucketUpperBound(i);
+    }
+  }
+  return bucketUpperBound(kNumBuckets - 1);
+}
+
+// MoQTrackStats
+
+MoQTrackStats::TrackCounters& MoQTrackStats::getTrackCounters(
+    Shard& shard,
+    const FullTrackName& ftn) {
+  // Only this thread modifies the map, so finding needs no lock
+  auto it = shard.tracks.find(ftn);
+  if (it != shard.tracks.end()) {
+    return it->second;
+  }
+  std::unique_lock lock(shard.mutex);
+  return shard.tracks.try_emplace(ftn).first->second;
+}
+
+MoQTrackStats::Snapshot MoQTrackStats::snapshot() const {
+  Snapshot snapshot;
+  for (const auto& shard : shards_.accessAllThreads()) {
+    std::shared_lock lock(shard.mutex);
+    for (const auto& [ftn, counters] : shard.tracks) {
+      auto& total = snapshot.tracks[ftn];
+      total.objectsIn += get(counters.objectsIn);
+      total.bytesIn += get(counters.bytesIn);
+      total.objectsOut += get(counters.objectsOut);
+      total.bytesOut += get(counters.bytesOut);
+      total.tooFarBehind += get(counters.tooFarBehind);
+      total.subgroupsDropped += get(counters.subgroupsDropped);
+      total.bytesDropped += get(counters.bytesDropped);
+    }
+    snapshot.forwardLatencyUsec.merge(shard.forwardLatencyUsec);
+    snapshot.streamCreditStallUsec.merge(shard.streamCreditStallUsec);
+    snapshot.bufferedBytes.merge(shard.bufferedBytes);
+  }
+  return snapshot;
+}
+
+void MoQTrackStats::onObjectReceived(
+    const FullTrackName& ftn,
+    uint64_t bytes) {
+  auto& counters = getTrackCounters(*shards_, ftn);
+  add(counters.objectsIn, 1);
+  add(counters.bytesIn, bytes);
+}
+
+void MoQTrackStats::onObjectSent(const FullTrackName& ftn, uint64_t bytes) {
+  auto& counters = getTrackCounters(*shards_, ftn);
+  add(counters.objectsOut, 1);
+  add(counters.bytesOut, bytes);
+}
+
+void MoQTrackStats::recordForwardLatency(
+    const FullTrackName&,
+    uint64_t latencyUsec) {
+  shards_->forwardLatencyUsec.record(latencyUsec);
+}
+
+void MoQTrackStats::recordStreamCreditStall(
+    const FullTrackName&,
+    uint64_t stallUsec) {
+  shards_->streamCreditStallUsec.record(stallUsec);
+}
+
+void MoQTrackStats::recordBufferedBytes(
+    const FullTrackName&,
+    uint64_t bytes) {
+  shards_->bufferedBytes.record(bytes);
+}
+
+void MoQTrackStats::onTooFarBehind(const FullTrackName& ftn) {
+  add(getTrackCounters(*shards_, ftn).tooFarBehind, 1);
+}
+
+void MoQTrackStats::onSubgroupDropped(
+    const FullTrackName& ftn,
+    uint64_t bytes) {
+  auto& counters = getTrackCounters(*shards_, ftn);
+  add(counters.subgroupsDropped, 1);
+  add(counters.bytesDropped, bytes);
+}
+
+} // namespace moxygen
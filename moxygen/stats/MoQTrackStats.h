@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/SharedMutex.h>
+#include <folly/ThreadLocal.h>
+#include <folly/container/F14Map.h>
+#include <moxygen/stats/MoQStats.h>
+
+#include <array>
+#include <atomic>
+
+namespace moxygen {
+
+/*
+ * Log-linear histogram in the style of HdrHistogram.  Values below
+ * kSubBuckets are counted exactly, and each power of two above that is split
+ * into kSubBuckets / 2 linear buckets, so a reported value is within ~6% of
+ * the recorded one.  Recording is a relaxed atomic add and never allocates.
+ */
+class MoQHistogram {
+ public:
+  static constexpr uint32_t kSubBucketBits = 5;
+  static constexpr uint64_t kSubBuckets = 1 << kSubBucketBits;
+  static constexpr size_t kNumBuckets =
+      kSubBuckets + (64 - kSubBucketBits) * (kSubBuckets / 2);
+
+  MoQHistogram() = default;
+  MoQHistogram(const MoQHistogram& other) {
+    merge(other);
+  }
+  MoQHistogram& operator=(const MoQHistogram&) = delete;
+
+  void record(uint64_t value) {
+    counts_[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  void merge(const MoQHistogram& other);
+
+  uint64_t count() const;
+  // Sum of the recorded values
+  uint64_t sum() const {
+    return sum_.load(std::memory_order_relaxed);
+  }
+
+  // Upper bound of the bucket holding the pct'th percentile (0-100) value,
+  // or 0 if nothing was recorded
+  uint64_t percentile(double pct) const;
+
+  static size_t bucketIndex(uint64_t value);
+  // Largest value counted in the bucket at index
+  static uint64_t bucketUpperBound(size_t index);
+
+ private:
+  std::array<std::atomic<uint64_t>, kNumBuckets> counts_{};
+  std::atomic<uint64_t> sum_{0};
+};
+
+struct MoQTrackCounters {
+  uint64_t objectsIn{0};
+  uint64_t bytesIn{0};
+  uint64_t objectsOut{0};
+  uint64_t bytesOut{0};
+  uint64_t tooFarBehind{0};
+  uint64_t subgroupsDropped{0};
+  uint64_t bytesDropped{0};
+};
+
+/*
+ * MoQTrackStatsCallback that keeps per-track counters and latency histograms
+ * in thread-local shards.  The session threads that record never contend:
+ * a shard is only written by its own thread, and its lock is only taken to
+ * add a track or to read the shard from snapshot().  Histograms aggregate
+ * all tracks.
+ *
+ * One instance can be shared by all sessions.  Counts recorded by a thread
+ * are dropped when that thread exits.
+ */
+class MoQTrackStats : public MoQTrackStatsCallback {
+ public:
+  struct Snapshot {
+    folly::F14FastMap<FullTrackName, MoQTrackCounters, FullTrackName::hash>
+        tracks;
+    MoQHistogram forwardLatencyUsec;
+    MoQHistogram streamCreditStallUsec;
+    MoQHistogram bufferedBytes;
+  };
+
+  // Sums the shards of every thread
+  Snapshot snapshot() const;
+
+  void onObjectReceived(const FullTrackName& ftn, uint64_t bytes) override;
+  void onObjectSent(const FullTrackName& ftn, uint64_t bytes) override;
+  void recordForwardLatency(const FullTrackName& ftn, uint64_t latencyUsec)
+      override;
+  void recordStreamCreditStall(const FullTrackName& ftn, uint64_t stallUsec)
+      override;
+  void recordBufferedBytes(const FullTrackName& ftn, uint64_t bytes) override;
+  void onTooFarBehind(const FullTrackName& ftn) override;
+  void onSubgroupDropped(const FullTrackName& ftn, uint64_t bytes) override;
+
+ private:
+  struct TrackCounters {
+    std::atomic<uint64_t> objectsIn{0};
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> objectsOut{0};
+    std::atomic<uint64_t> bytesOut{0};
+    std::atomic<uint64_t> tooFarBehind{0};
+    std::atomic<uint64_t> subgroupsDropped{0};
+    std::atomic<uint64_t> bytesDropped{0};
+  };
+
+  struct Shard {
+    // Exclusive to add a track, shared to read the shard from another thread
+    mutable folly::SharedMutex mutex;
+    // Node map so counters stay put while other threads read them
+    folly::F14NodeMap<FullTrackName, TrackCounters, FullTrackName::hash>
+        tracks;
+    MoQHistogram forwardLatencyUsec;
+    MoQHistogram streamCreditStallUsec;
+    MoQHistogram bufferedBytes;
+  };
+
+  struct ShardTag {};
+
+  TrackCounters& getTrackCounters(Shard& shard, const FullTrackName& ftn);
+
+  mutable folly::ThreadLocal<Shard, ShardTag> shards_;
+};
+
+} // namespace moxygen
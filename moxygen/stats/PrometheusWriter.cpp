@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/stats/PrometheusWriter.h"
+
+#include <folly/Conv.h>
+
+namespace {
+const char* typeName(moxygen::PrometheusWriter::Type type) {
+  switch (type) {
+    case moxygen::PrometheusWriter::Type::Counter:
+      return "counter";
+    case moxygen::PrometheusWriter::Type::Gauge:
+      return "gauge";
+    case moxygen::PrometheusWriter::Type::Summary:
+      return "summary";
+  }
+  return "untyped";
+}
+
+void appendLabelValue(std::string& out, folly::StringPiece value) {
+  for (auto c : value) {
+    switch (c) {
+      case '\\':
+        out.append("\\\\");
+        break;
+      case '"':
+        out.append("\\\"");
+        break;
+      case '\n':
+        out.append("\\n");
+        break;
+      default:
+        out.push_back(c);
+    }
+  }
+}
+} // namespace
+
+namespace moxygen {
+
+void PrometheusWriter::declare(
+    folly::StringPiece name,
+    Type type,
+    folly::StringPiece help) {
+  folly::toAppend("# HELP ", name, " ", help, "\n", &out_);
+  folly::toAppend("# TYPE ", name, " ", typeName(type), "\n", &out_);
+}
+
+void PrometheusWriter::writeName(folly::StringPiece name, const Labels& labels) {
+  out_.append(name.data(), name.size());
+  if (labels.empty()) {
+    return;
+  }
+  out_.push_back('{');
+  bool first = true;
+  for (const auto& [key, value] : labels) {
+    if (!first) {
+      out_.push_back(',');
+    }
+    first = false;
+    folly::toAppend(key, "=\"", &out_);
+    appendLabelValue(out_, value);
+    out_.push_back('"');
+  }
+  out_.push_back('}');
+}
+
+void PrometheusWriter::sample(
+    folly::StringPiece name,
+    uint64_t value,
+    const Labels& labels) {
+  writeName(name, labels);
+  folly::toAppend(" ", value, "\n", &out_);
+}
+
+void PrometheusWriter::sample(
+    folly::StringPiece name,
+    double value,
+    const Labels& labels) {
+  writeName(name, labels);
+  folly::toAppend(" ", value, "\n", &out_);
+}
+
+void PrometheusWriter::summary(
+    folly::StringPiece name,
+    const MoQHistogram& histogram,
+    const Labels& labels) {
+  static const std::pair<const char*, double> kQuantiles[] = {
+      {"0.5", 50}, {"0.9", 90}, {"0.99", 99}, {"0.999", 99.9}};
+  for (const auto& [quantile, pct] : kQuantiles) {
+    auto quantileLabels = labels;
+    quantileLabels.emplace_back("quantile", quantile);
+    sample(name, histogram.percentile(pct), quantileLabels);
+  }
+  sample(folly::to<std::string>(name, "_sum"), histogram.sum(), labels);
+  sample(folly::to<std::string>(name, "_count"), histogram.count(), labels);
+}
+
+} // namespace moxygen
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Range.h>
+#include <moxygen/stats/MoQTrackStats.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace moxygen {
+
+/*
+ * Builds a Prometheus text exposition (version 0.0.4) document.  Declare each
+ * metric once, then write its samples.
+ */
+class PrometheusWriter {
+ public:
+  using Labels = std::vector<std::pair<std::string, std::string>>;
+
+  enum class Type { Counter, Gauge, Summary };
+
+  // Writes the HELP and TYPE lines for name
+  void declare(folly::StringPiece name, Type type, folly::StringPiece help);
+
+  void sample(
+      folly::StringPiece name,
+      uint64_t value,
+      const Labels& labels = {});
+  void sample(folly::StringPiece name, double value, const Labels& labels = {});
+
+  // Writes the p50, p90, p99 and p999 quantiles, the _sum and the _count of
+  // a declared summary
+  void summary(
+      folly::StringPiece name,
+      const MoQHistogram& histogram,
+      const Labels& labels = {});
+
+  const std::string& str() const {
+    return out_;
+  }
+
+ private:
+  void writeName(folly::StringPiece name, const Labels& labels);
+
+  std::string out_;
+};
+
+} // namespace moxygen
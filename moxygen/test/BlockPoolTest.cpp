@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <moxygen/util/BlockPool.h>
+
+#include <list>
+
+using namespace moxygen;
+
+TEST(BlockPoolTest, ReusesFreedBlocks) {
+  BlockPool pool;
+  auto a = pool.allocate(24);
+  auto b = pool.allocate(32);
+  EXPECT_NE(a, b);
+  EXPECT_EQ(pool.allocatedBlocks(), 2);
+  EXPECT_EQ(pool.slabBytes(), BlockPool::kSlabSize);
+  pool.deallocate(a, 24);
+  // Same size class
+  EXPECT_EQ(pool.allocate(20), a);
+  pool.deallocate(a, 20);
+  pool.deallocate(b, 32);
+  EXPECT_EQ(pool.allocatedBlocks(), 0);
+}
+
+TEST(BlockPoolTest, LargeBlocksUseHeap) {
+  BlockPool pool;
+  auto large = pool.allocate(BlockPool::kMaxBlockSize + 1);
+  EXPECT_EQ(pool.allocatedBlocks(), 0);
+  EXPECT_EQ(pool.slabBytes(), 0);
+  pool.deallocate(large, BlockPool::kMaxBlockSize + 1);
+}
+
+TEST(BlockPoolTest, AllocatorKeepsPoolAlive) {
+  auto pool = std::make_shared<BlockPool>();
+  std::weak_ptr<BlockPool> weakPool = pool;
+  auto value =
+      std::allocate_shared<uint64_t>(PoolAllocator<uint64_t>(pool), 7);
+  std::list<int, PoolAllocator<int>> values{PoolAllocator<int>(pool)};
+  values.push_back(1);
+  values.push_back(2);
+  EXPECT_EQ(pool->allocatedBlocks(), 3);
+  pool.reset();
+  EXPECT_FALSE(weakPool.expired());
+  values.clear();
+  EXPECT_EQ(weakPool.lock()->allocatedBlocks(), 1);
+  value.reset();
+  // The list still holds an allocator
+  EXPECT_FALSE(weakPool.expired());
+}
+
+TEST(BlockPoolTest, AllocatorWithoutPool) {
+  std::list<int, PoolAllocator<int>> values;
+  values.push_back(1);
+  EXPECT_EQ(values.front(), 1);
+  EXPECT_TRUE(PoolAllocator<int>() == PoolAllocator<uint64_t>());
+}
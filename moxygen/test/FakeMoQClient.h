@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <proxygen/lib/http/webtransport/test/FakeSharedWebTransport.h>
+#include <moxygen/MoQClient.h>
+
+namespace moxygen::test {
+
+// A MoQClient whose server lives in the same process, over a fake
+// WebTransport.  The server session hands requests to serverPublisher and
+// serverSubscriber, so tests can stand in for an origin or relay.
+class FakeMoQClient : public MoQClient,
+                      public MoQSession::ServerSetupCallback {
+ public:
+  FakeMoQClient(
+      folly::EventBase* evb,
+      proxygen::URL url,
+      std::shared_ptr<Publisher> serverPublisher,
+      std::shared_ptr<Subscriber> serverSubscriber = nullptr,
+      uint64_t maxRequestID = 100)
+      : MoQClient(evb, std::move(url)),
+        serverPublisher_(std::move(serverPublisher)),
+        serverSubscriber_(std::move(serverSubscriber)),
+        maxRequestID_(maxRequestID) {}
+
+  // The sessions must let go of the fake transports before they are freed
+  ~FakeMoQClient() override {
+    if (moqSession_) {
+      moqSession_->close(SessionCloseErrorCode::NO_ERROR);
+    }
+    if (serverSession_) {
+      serverSession_->close(SessionCloseErrorCode::NO_ERROR);
+    }
+  }
+
+  // Makes setupMoQSession throw, as if the server could not be reached
+  void setFailConnect(bool failConnect) {
+    failConnect_ = failConnect;
+  }
+
+  std::shared_ptr<MoQSession> serverSession() const {
+    return serverSession_;
+  }
+
+  folly::coro::Task<void> setupMoQSession(
+      std::chrono::milliseconds /*connect_timeout*/,
+      std::chrono::milliseconds /*transaction_timeout*/,
+      std::shared_ptr<Publisher> publishHandler,
+      std::shared_ptr<Subscriber> subscribeHandler) noexcept override {
+    if (failConnect_) {
+      co_yield folly::coro::co_error(std::runtime_error("connect failed"));
+    }
+    std::tie(clientWt_, serverWt_) =
+        proxygen::test::FakeSharedWebTransport::makeSharedWebTransport();
+    moqSession_ = std::make_shared<MoQSession>(clientWt_.get(), evb_);
+    serverWt_->setPeerHandler(moqSession_.get());
+    serverSession_ = std::make_shared<MoQSession>(serverWt_.get(), *this, evb_);
+    clientWt_->setPeerHandler(serverSession_.get());
+
+    moqSession_->setPublishHandler(std::move(publishHandler));
+    moqSession_->setSubscribeHandler(std::move(subscribeHandler));
+    moqSession_->start();
+    serverSession_->setPublishHandler(serverPublisher_);
+    serverSession_->setSubscribeHandler(serverSubscriber_);
+    serverSession_->start();
+    co_await moqSession_->setup(getClientSetup(url_.getPath()));
+  }
+
+  folly::Try<ServerSetup> onClientSetup(ClientSetup setup) override {
+    return folly::Try<ServerSetup>(ServerSetup{
+        .selectedVersion = setup.supportedVersions.back(),
+        .params = {SetupParameter{
+            folly::to_underlying(SetupKey::MAX_REQUEST_ID),
+            "",
+            maxRequestID_,
+            {}}}});
+  }
+
+ private:
+  std::shared_ptr<Publisher> serverPublisher_;
+  std::shared_ptr<Subscriber> serverSubscriber_;
+  uint64_t maxRequestID_;
+  bool failConnect_{false};
+  std::unique_ptr<proxygen::test::FakeSharedWebTransport> clientWt_;
+  std::unique_ptr<proxygen::test::FakeSharedWebTransport> serverWt_;
+  std::shared_ptr<MoQSession> serverSession_;
+};
+
+} // namespace moxygen::test
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <moxygen/MoQFramer.h>
+#include <moxygen/util/FetchIntervalSet.h>
+
+using namespace moxygen;
+
+TEST(FetchIntervalSetTest, GetValue) {
+  FetchIntervalSet<uint64_t, int> set;
+  EXPECT_EQ(set.getValue(0), nullptr);
+  set.insert(10, 20, 1);
+  set.insert(0, 5, 2);
+  set.insert(30, 40, 3);
+
+  EXPECT_EQ(*set.getValue(0), 2);
+  EXPECT_EQ(*set.getValue(4), 2);
+  EXPECT_EQ(set.getValue(5), nullptr);
+  EXPECT_EQ(*set.getValue(10), 1);
+  EXPECT_EQ(*set.getValue(19), 1);
+  EXPECT_EQ(set.getValue(20), nullptr);
+  EXPECT_EQ(*set.getValue(39), 3);
+  EXPECT_EQ(set.getValue(40), nullptr);
+}
+
+TEST(FetchIntervalSetTest, AdvanceAndErase) {
+  FetchIntervalSet<uint64_t, int> set;
+  auto it = set.insert(10, 20, 1);
+  it->second.start = 15;
+  EXPECT_EQ(set.getValue(12), nullptr);
+  EXPECT_EQ(*set.getValue(15), 1);
+
+  // Same start as a previously inserted interval
+  auto it2 = set.insert(10, 12, 2);
+  EXPECT_EQ(set.size(), 2u);
+  set.erase(it2);
+  EXPECT_EQ(*set.getValue(15), 1);
+  set.erase(it);
+  EXPECT_TRUE(set.empty());
+}
+
+TEST(FetchIntervalSetTest, GetIntersecting) {
+  FetchIntervalSet<AbsoluteLocation, int> set;
+  set.insert({0, 5}, {1, 0}, 1);
+  set.insert({1, 2}, {1, 4}, 2);
+  set.insert({2, 0}, {3, 0}, 3);
+
+  auto res = set.getIntersecting({0, 0}, {1, 0});
+  ASSERT_EQ(res.size(), 1u);
+  EXPECT_EQ(res[0]->value, 1);
+
+  res = set.getIntersecting({0, 7}, {2, 1});
+  ASSERT_EQ(res.size(), 3u);
+  EXPECT_EQ(res[0]->value, 1);
+  EXPECT_EQ(res[1]->value, 2);
+  EXPECT_EQ(res[2]->value, 3);
+
+  res = set.getIntersecting({1, 0}, {1, 2});
+  EXPECT_TRUE(res.empty());
+  res = set.getIntersecting({1, 3}, {1, 3});
+  EXPECT_TRUE(res.empty());
+}
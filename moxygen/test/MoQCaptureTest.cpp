@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/FileUtil.h>
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+#include <moxygen/MoQCapture.h>
+#include <moxygen/test/Mocks.h>
+
+using namespace moxygen;
+using namespace testing;
+
+namespace {
+using Type = MoQCaptureRecord::Type;
+
+const FullTrackName kTrack{TrackNamespace({"ns"}), "track"};
+
+SubscribeRequest subscribeRequest() {
+  SubscribeRequest subReq;
+  subReq.requestID = 4;
+  subReq.fullTrackName = kTrack;
+  subReq.priority = 3;
+  subReq.locType = LocationType::AbsoluteRange;
+  subReq.start = AbsoluteLocation{1, 2};
+  subReq.endGroup = 9;
+  return subReq;
+}
+} // namespace
+
+TEST(MoQCaptureTest, RecordsRequestsAndObjects) {
+  folly::test::TemporaryDirectory dir;
+  auto path = (dir.path() / "capture").string();
+  int session = 0;
+  {
+    auto writer = MoQCaptureWriter::open(path);
+    ASSERT_TRUE(writer);
+    auto consumer = std::make_shared<NiceMock<MockTrackConsumer>>();
+    auto subscriber = writer->subscribe(&session, subscribeRequest(), consumer);
+
+    auto subgroup = std::make_shared<NiceMock<MockSubgroupConsumer>>();
+    ON_CALL(*consumer, beginSubgroup(_, _, _))
+        .WillByDefault(Return(
+            folly::makeExpected<MoQPublishError>(
+                std::static_pointer_cast<SubgroupConsumer>(subgroup))));
+    auto recording = writer->recordObjects(kTrack, consumer);
+    auto sg = recording->beginSubgroup(5, 1, 7).value();
+    sg->object(0, folly::IOBuf::copyBuffer("hello"), noExtensions(), false);
+    sg->endOfGroup(1);
+    ObjectHeader header(TrackAlias(1), 6, 0, 2, 9, ObjectStatus::NORMAL);
+    recording->datagram(header, folly::IOBuf::copyBuffer("abc"));
+
+    // Dropped by the subscription
+    subscriber.reset();
+    writer->sessionEnd(&session);
+  }
+
+  auto records = readCapture(path);
+  ASSERT_TRUE(records.hasValue()) << records.error().what();
+  std::vector<Type> types;
+  for (const auto& record : *records) {
+    types.push_back(record.type);
+  }
+  EXPECT_EQ(
+      types,
+      std::vector<Type>(
+          {Type::TRACK,
+           Type::SUBSCRIBE,
+           Type::OBJECT,
+           Type::OBJECT,
+           Type::SUBGROUP_END,
+           Type::OBJECT,
+           Type::SUBSCRIBE_END,
+           Type::SESSION_END}));
+  EXPECT_EQ((*records)[0].fullTrackName, kTrack);
+
+  const auto& sub = (*records)[1];
+  EXPECT_EQ(sub.requestID, 4);
+  EXPECT_EQ(sub.trackID, (*records)[0].trackID);
+  EXPECT_EQ(sub.locType, LocationType::AbsoluteRange);
+  EXPECT_EQ(sub.start.group, 1);
+  EXPECT_EQ(sub.start.object, 2);
+  EXPECT_EQ(sub.end.group, 9);
+  EXPECT_EQ(sub.priority, 3);
+
+  const auto& obj = (*records)[2];
+  EXPECT_FALSE(obj.datagram);
+  EXPECT_EQ(obj.group, 5);
+  EXPECT_EQ(obj.subgroup, 1);
+  EXPECT_EQ(obj.priority, 7);
+  EXPECT_EQ(obj.length, 5);
+  EXPECT_EQ((*records)[3].status, ObjectStatus::END_OF_GROUP);
+
+  const auto& dgram = (*records)[5];
+  EXPECT_TRUE(dgram.datagram);
+  EXPECT_EQ(dgram.group, 6);
+  EXPECT_EQ(dgram.objectID, 2);
+  EXPECT_EQ(dgram.length, 3);
+
+  // Times are since the first record and never go backwards
+  for (size_t i = 1; i < records->size(); i++) {
+    EXPECT_GE((*records)[i].time, (*records)[i - 1].time);
+  }
+}
+
+TEST(MoQCaptureTest, TruncatedRecordIsDropped) {
+  folly::test::TemporaryDirectory dir;
+  auto path = (dir.path() / "capture").string();
+  int session = 0;
+  {
+    auto writer = MoQCaptureWriter::open(path);
+    ASSERT_TRUE(writer);
+    auto subscriber = writer->subscribe(&session, subscribeRequest(), nullptr);
+    // SUBSCRIBE is the last record, its end comes after close
+    writer->close();
+  }
+  std::string contents;
+  ASSERT_TRUE(folly::readFile(path.c_str(), contents));
+  contents.pop_back();
+  auto buf = folly::IOBuf::wrapBufferAsValue(contents.data(), contents.size());
+  auto records = parseCapture(buf);
+  ASSERT_TRUE(records.hasValue());
+  ASSERT_EQ(records->size(), 1);
+  EXPECT_EQ((*records)[0].type, Type::TRACK);
+
+  auto bad = folly::IOBuf::copyBuffer("not a capture");
+  EXPECT_TRUE(parseCapture(*bad).hasError());
+}
+
+TEST(MoQCaptureTest, HugeNamespaceIsTruncated) {
+  // TRACK 0 with 2^62 - 1 namespace elements and nothing after
+  std::string contents("MOQCAP1\0", 8);
+  contents += std::string("\x00\x00\x00", 3);
+  contents += "\xff\xff\xff\xff\xff\xff\xff\xff";
+  auto buf = folly::IOBuf::wrapBufferAsValue(contents.data(), contents.size());
+  auto records = parseCapture(buf);
+  ASSERT_TRUE(records.hasValue());
+  EXPECT_TRUE(records->empty());
+}
@@ -242,6 +242,54 @@ TEST_P(MoQCodecTest, ObjectStreamPayload) {
   objectStreamCodec_.onIngress(std::unique_ptr<folly::IOBuf>(), true);
 }
 
+TEST_P(MoQCodecTest, IngressAccounting) {
+  folly::IOBufQueue writeBuf{folly::IOBufQueue::cacheChainLength()};
+  moqFrameWriter_.writeSingleObjectStream(
+      writeBuf,
+      ObjectHeader(TrackAlias(1), 2, 3, 4, 5, 11),
+      folly::IOBuf::copyBuffer("hello world"));
+  auto total = std::make_shared<uint64_t>(0);
+  objectStreamCodec_.setIngressAccounting(total);
+
+  // A partial header stays buffered
+  objectStreamCodec_.onIngress(writeBuf.split(2), false);
+  EXPECT_GT(*total, 0);
+  EXPECT_EQ(*total, objectStreamCodec_.bufferedBytes());
+  objectStreamCodec_.onIngress(writeBuf.move(), true);
+  EXPECT_EQ(*total, 0);
+}
+
+TEST_P(MoQCodecTest, ObjectStreamPayloadNotCopied) {
+  folly::IOBufQueue writeBuf{folly::IOBufQueue::cacheChainLength()};
+  moqFrameWriter_.writeSingleObjectStream(
+      writeBuf,
+      ObjectHeader(TrackAlias(1), 2, 3, 4, 5, 11),
+      folly::IOBuf::copyBuffer("hello world"));
+  auto ingress = writeBuf.move();
+  ingress->coalesce();
+  auto payloadStart = ingress->tail() - strlen("hello world");
+
+  EXPECT_CALL(objectStreamCodecCallback_, onSubgroup(TrackAlias(1), 2, 3, 5));
+  EXPECT_CALL(
+      objectStreamCodecCallback_,
+      onObjectBegin(2, 3, 4, testing::_, 11, testing::_, true, false))
+      .WillOnce(testing::Invoke(
+          [payloadStart](
+              uint64_t,
+              uint64_t,
+              uint64_t,
+              Extensions,
+              uint64_t,
+              Payload payload,
+              bool,
+              bool) {
+            ASSERT_TRUE(payload);
+            EXPECT_EQ(payload->data(), payloadStart);
+            EXPECT_EQ(payload->computeChainDataLength(), 11);
+          }));
+  objectStreamCodec_.onIngress(std::move(ingress), false);
+}
+
 TEST_P(MoQCodecTest, EmptyObjectPayload) {
   folly::IOBufQueue writeBuf{folly::IOBufQueue::cacheChainLength()};
   moqFrameWriter_.writeSingleObjectStream(
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <moxygen/MoQEgressScheduler.h>
+
+using namespace moxygen;
+
+namespace {
+uint64_t order(uint8_t subPri, uint8_t pubPri, uint64_t low = 0) {
+  return (uint64_t(subPri) << 50) | (uint64_t(pubPri) << 42) | low;
+}
+} // namespace
+
+TEST(MoQEgressSchedulerTest, PriorityOrder) {
+  MoQEgressScheduler scheduler;
+  std::vector<int> sent;
+  auto send = [&](int id) {
+    return [&sent, id]() -> uint64_t {
+      sent.push_back(id);
+      return 100;
+    };
+  };
+  scheduler.schedule(order(1, 0), 1, 1, send(3));
+  scheduler.schedule(order(0, 5), 2, 1, send(2));
+  scheduler.schedule(order(0, 1, 7), 3, 1, send(1));
+  // Same flow, lower group and subgroup bits go first
+  scheduler.schedule(order(0, 1, 3), 3, 1, send(0));
+  EXPECT_EQ(scheduler.size(), 4);
+  scheduler.run([] { return true; });
+  EXPECT_EQ(sent, (std::vector<int>{0, 1, 2, 3}));
+  EXPECT_TRUE(scheduler.empty());
+}
+
+TEST(MoQEgressSchedulerTest, WeightedShare) {
+  MoQEgressScheduler scheduler;
+  std::vector<uint64_t> sent;
+  for (int i = 0; i < 6; i++) {
+    for (uint64_t flow : {1, 2}) {
+      scheduler.schedule(
+          order(0, 0, i), flow, flow == 1 ? 1 : 3, [&sent, flow]() -> uint64_t {
+            sent.push_back(flow);
+            return MoQEgressScheduler::kQuantum;
+          });
+    }
+  }
+  scheduler.run([&] { return sent.size() < 8; });
+  EXPECT_EQ(sent, (std::vector<uint64_t>{1, 2, 2, 2, 1, 2, 2, 2}));
+  EXPECT_EQ(scheduler.size(), 4);
+}
+
+TEST(MoQEgressSchedulerTest, SendSchedulesMore) {
+  MoQEgressScheduler scheduler;
+  std::vector<int> sent;
+  scheduler.schedule(order(2, 0), 1, 1, [&]() -> uint64_t {
+    sent.push_back(1);
+    // Higher precedence, goes out next
+    scheduler.schedule(order(0, 0), 2, 1, [&]() -> uint64_t {
+      sent.push_back(2);
+      scheduler.clear();
+      return 0;
+    });
+    return 0;
+  });
+  scheduler.schedule(order(2, 0, 1), 1, 1, [&]() -> uint64_t {
+    sent.push_back(3);
+    return 0;
+  });
+  scheduler.run([] { return true; });
+  EXPECT_EQ(sent, (std::vector<int>{1, 2}));
+  EXPECT_TRUE(scheduler.empty());
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <moxygen/MoQFec.h>
+#include <moxygen/test/Mocks.h>
+
+using namespace moxygen;
+using namespace testing;
+
+namespace {
+struct Datagram {
+  ObjectHeader header;
+  Payload payload;
+};
+
+class CollectingCallback : public ObjectReceiverCallback {
+ public:
+  FlowControlState onObject(const ObjectHeader& header, Payload payload)
+      override {
+    objects.push_back({header, std::move(payload)});
+    return FlowControlState::UNBLOCKED;
+  }
+  void onObjectStatus(const ObjectHeader&) override {}
+  void onEndOfStream() override {}
+  void onError(ResetStreamErrorCode) override {}
+  void onSubscribeDone(SubscribeDone) override {}
+
+  std::vector<Datagram> objects;
+};
+
+bool hasParity(const ObjectHeader& header) {
+  for (const auto& ext : header.extensions) {
+    if (ext.type == kFecParityExtension) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Publishes objects 0-4 of group 0 through an encoder with a window of 2 and
+// returns the datagrams it sends
+std::vector<Datagram> encode() {
+  auto consumer = std::make_shared<StrictMock<MockTrackConsumer>>();
+  std::vector<Datagram> sent;
+  EXPECT_CALL(*consumer, datagram(_, _))
+      .Times(5)
+      .WillRepeatedly(Invoke([&sent](const ObjectHeader& header, Payload pl) {
+        sent.push_back({header, std::move(pl)});
+        return folly::makeExpected<MoQPublishError>(folly::unit);
+      }));
+  MoQFecEncoder encoder(consumer, 2);
+  for (uint64_t id = 0; id < 5; id++) {
+    Extensions extensions;
+    if (id == 1) {
+      extensions = Extensions{
+          Extension(2, 7), Extension(3, folly::IOBuf::copyBuffer("meta"))};
+    }
+    ObjectHeader header(
+        TrackAlias(1), 0, id, id, 128, ObjectStatus::NORMAL, extensions);
+    EXPECT_TRUE(
+        encoder
+            .datagram(
+                header, folly::IOBuf::copyBuffer(std::string(id + 1, 'a')))
+            .hasValue());
+  }
+  return sent;
+}
+} // namespace
+
+TEST(MoQFecTest, ParityOnNextDatagram) {
+  auto sent = encode();
+  ASSERT_EQ(sent.size(), 5);
+  // Windows {0, 1} and {2, 3} ride on objects 2 and 4
+  EXPECT_FALSE(hasParity(sent[0].header));
+  EXPECT_FALSE(hasParity(sent[1].header));
+  EXPECT_TRUE(hasParity(sent[2].header));
+  EXPECT_FALSE(hasParity(sent[3].header));
+  EXPECT_TRUE(hasParity(sent[4].header));
+}
+
+TEST(MoQFecTest, RebuildsLostObject) {
+  auto sent = encode();
+  auto callback = std::make_shared<CollectingCallback>();
+  MoQFecReceiver receiver(callback);
+  // Object 1 and its extensions are lost
+  for (auto i : {0, 2, 3}) {
+    receiver.onObject(sent[i].header, std::move(sent[i].payload));
+  }
+  EXPECT_EQ(receiver.recovered(), 1);
+  ASSERT_EQ(callback->objects.size(), 4);
+  EXPECT_FALSE(hasParity(callback->objects[1].header));
+  auto& rebuilt = callback->objects[2];
+  EXPECT_EQ(rebuilt.header.group, 0);
+  EXPECT_EQ(rebuilt.header.id, 1);
+  EXPECT_EQ(rebuilt.payload->moveToFbString().toStdString(), "aa");
+  ASSERT_EQ(rebuilt.header.extensions.size(), 2);
+  EXPECT_EQ(rebuilt.header.extensions[0].intValue, 7);
+  EXPECT_EQ(
+      rebuilt.header.extensions[1].arrayValue->moveToFbString().toStdString(),
+      "meta");
+
+  // The late original isn't passed on again
+  receiver.onObject(sent[1].header, std::move(sent[1].payload));
+  EXPECT_EQ(callback->objects.size(), 4);
+}
+
+TEST(MoQFecTest, TwoLostObjectsAreNotRebuilt) {
+  auto sent = encode();
+  auto callback = std::make_shared<CollectingCallback>();
+  MoQFecReceiver receiver(callback);
+  for (auto i : {2, 4}) {
+    receiver.onObject(sent[i].header, std::move(sent[i].payload));
+  }
+  // Object 3 is rebuilt from 2 and the parity on 4, 0 and 1 are gone
+  EXPECT_EQ(receiver.recovered(), 1);
+  ASSERT_EQ(callback->objects.size(), 3);
+  EXPECT_EQ(callback->objects[2].header.id, 3);
+}
+
+TEST(MoQFecTest, ParityStaysWithinMaxDatagramSize) {
+  constexpr uint64_t kMaxDatagramSize = 200;
+  auto consumer = std::make_shared<StrictMock<MockTrackConsumer>>();
+  std::vector<Datagram> sent;
+  EXPECT_CALL(*consumer, datagram(_, _))
+      .Times(5)
+      .WillRepeatedly(Invoke([&sent](const ObjectHeader& header, Payload pl) {
+        sent.push_back({header, std::move(pl)});
+        return folly::makeExpected<MoQPublishError>(folly::unit);
+      }));
+  MoQFecEncoder encoder(consumer, 2, kMaxDatagramSize);
+  // Object 2 is too large to protect or to carry the parity of {0, 1}
+  for (auto [id, length] : std::vector<std::pair<uint64_t, size_t>>{
+           {0, 10}, {1, 90}, {2, 150}, {3, 10}, {4, 10}}) {
+    ObjectHeader header(TrackAlias(1), 0, id, id, 128, ObjectStatus::NORMAL);
+    EXPECT_TRUE(
+        encoder
+            .datagram(
+                header, folly::IOBuf::copyBuffer(std::string(length, 'a')))
+            .hasValue());
+  }
+  ASSERT_EQ(sent.size(), 5);
+  // Window {0, 1} waits for object 3, {3, 4} is never carried
+  EXPECT_FALSE(hasParity(sent[1].header));
+  EXPECT_FALSE(hasParity(sent[2].header));
+  EXPECT_TRUE(hasParity(sent[3].header));
+  EXPECT_FALSE(hasParity(sent[4].header));
+  for (const auto& datagram : sent) {
+    uint64_t size = datagram.payload->computeChainDataLength();
+    for (const auto& ext : datagram.header.extensions) {
+      size += ext.arrayValue ? ext.arrayValue->computeChainDataLength() : 0;
+    }
+    EXPECT_LE(size, kMaxDatagramSize);
+  }
+
+  // Object 0 is rebuilt from the parity on 3
+  auto callback = std::make_shared<CollectingCallback>();
+  MoQFecReceiver receiver(callback);
+  for (auto i : {1, 3}) {
+    receiver.onObject(sent[i].header, std::move(sent[i].payload));
+  }
+  EXPECT_EQ(receiver.recovered(), 1);
+  ASSERT_EQ(callback->objects.size(), 3);
+  EXPECT_EQ(callback->objects[2].header.id, 0);
+  EXPECT_EQ(callback->objects[2].payload->computeChainDataLength(), 10);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <moxygen/MoQFetchLimiter.h>
+
+using namespace moxygen;
+
+TEST(MoQFetchLimiterTest, Unlimited) {
+  folly::EventBase evb;
+  MoQFetchLimiter limiter(MoQFetchLimiter::Config{});
+  int acquired = 0;
+  for (int i = 0; i < 10; i++) {
+    limiter.acquire(&evb, [&] { acquired++; });
+  }
+  EXPECT_EQ(acquired, 10);
+  EXPECT_EQ(limiter.onBytesWritten(1 << 30).count(), 0);
+}
+
+TEST(MoQFetchLimiterTest, ConcurrencyQueuesInOrder) {
+  folly::EventBase evb;
+  MoQFetchLimiter limiter({.maxConcurrent = 2});
+  std::vector<int> acquired;
+  for (int i = 0; i < 4; i++) {
+    limiter.acquire(&evb, [&acquired, i] { acquired.push_back(i); });
+  }
+  EXPECT_EQ(acquired, std::vector<int>({0, 1}));
+  EXPECT_EQ(limiter.active(), 2);
+  EXPECT_EQ(limiter.waiting(), 2);
+
+  // The slot passes to the first waiter, on its EventBase
+  limiter.release();
+  EXPECT_EQ(acquired.size(), 2);
+  evb.loopOnce();
+  EXPECT_EQ(acquired, std::vector<int>({0, 1, 2}));
+  EXPECT_EQ(limiter.active(), 2);
+
+  limiter.release();
+  evb.loopOnce();
+  EXPECT_EQ(acquired, std::vector<int>({0, 1, 2, 3}));
+  EXPECT_EQ(limiter.waiting(), 0);
+
+  limiter.release();
+  limiter.release();
+  EXPECT_EQ(limiter.active(), 0);
+  limiter.acquire(&evb, [&acquired] { acquired.push_back(4); });
+  EXPECT_EQ(acquired.back(), 4);
+}
+
+TEST(MoQFetchLimiterTest, RateWait) {
+  MoQFetchLimiter limiter(
+      {.maxBytesPerSecond = 1000 * 1000, .burstBytes = 10 * 1000});
+  // The burst is written without waiting
+  EXPECT_EQ(limiter.onBytesWritten(10 * 1000).count(), 0);
+  // 5000 bytes past the burst is 5ms at 1MB/s
+  auto wait = limiter.onBytesWritten(5000);
+  EXPECT_GT(wait.count(), 4000);
+  EXPECT_LE(wait.count(), 5001);
+  // Debt accumulates
+  EXPECT_GT(limiter.onBytesWritten(5000), wait);
+}
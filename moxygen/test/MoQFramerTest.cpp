@@ -345,6 +345,73 @@ TEST(MoQFramerTest, ParseServerSetupQuicIntegerLength) {
   parseServerSetup(cursor, sizeToGive);
 }
 
+TEST(MoQFramerTest, DecodeVarint) {
+  const std::vector<uint64_t> values = {
+      0, 63, 64, 16383, 16384, 1073741823, 1073741824, quic::kEightByteLimit};
+  folly::IOBufQueue writeBuf{folly::IOBufQueue::cacheChainLength()};
+  size_t size = 0;
+  bool error = false;
+  for (auto value : values) {
+    writeVarint(writeBuf, value, size, error);
+  }
+  EXPECT_FALSE(error);
+  auto contiguous = writeBuf.move();
+  contiguous->coalesce();
+
+  // Same buffer split into 1 byte IOBufs, every multi-byte varint crosses a
+  // buffer boundary
+  folly::IOBufQueue fragmented{folly::IOBufQueue::cacheChainLength()};
+  for (size_t i = 0; i < contiguous->length(); i++) {
+    fragmented.append(folly::IOBuf::copyBuffer(contiguous->data() + i, 1));
+  }
+  auto fragmentedBuf = fragmented.move();
+
+  for (auto buf : {contiguous.get(), fragmentedBuf.get()}) {
+    folly::io::Cursor cursor(buf);
+    folly::io::Cursor quicCursor(buf);
+    for (auto value : values) {
+      auto res = decodeVarint(cursor);
+      auto expected = quic::decodeQuicInteger(quicCursor);
+      ASSERT_TRUE(res.has_value());
+      ASSERT_TRUE(expected.has_value());
+      EXPECT_EQ(res->first, value);
+      EXPECT_EQ(res->second, expected->second);
+    }
+    EXPECT_TRUE(cursor.isAtEnd());
+    EXPECT_FALSE(decodeVarint(cursor).has_value());
+  }
+
+  // atMost limits the encoded length
+  folly::io::Cursor cursor(contiguous.get());
+  cursor.skip(1 + 1 + 2 + 2);
+  EXPECT_FALSE(decodeVarint(cursor, 2).has_value());
+  EXPECT_TRUE(decodeVarint(cursor, 4).has_value());
+}
+
+TEST(MoQFramerTest, TrackNamespaceHash) {
+  TrackNamespace::hash hasher;
+  TrackNamespace expected({"a", "b", "c"});
+
+  TrackNamespace appended;
+  appended.append("a");
+  appended.append("b");
+  appended.append("c");
+  EXPECT_EQ(appended, expected);
+  EXPECT_EQ(hasher(appended), hasher(expected));
+
+  TrackNamespace modified({"a", "x", "c", "d"});
+  EXPECT_NE(modified, expected);
+  modified.set(1, "b");
+  modified.trimEnd();
+  EXPECT_EQ(modified, expected);
+  EXPECT_EQ(hasher(modified), hasher(expected));
+
+  EXPECT_EQ(TrackNamespace("a/b/c", "/"), expected);
+  EXPECT_NE(TrackNamespace({"ab", "c"}), expected);
+  EXPECT_NE(
+      hasher(TrackNamespace({"a", "b"})), hasher(TrackNamespace({"b", "a"})));
+}
+
 TEST(MoQFramerTest, ParseServerSetupLengthParseParam) {
   // Malformed server setup, see that we don't crash
   folly::IOBufQueue writeBuf{folly::IOBufQueue::cacheChainLength()};
@@ -586,6 +653,105 @@ TEST_P(MoQFramerTest, ParseStreamHeader) {
   EXPECT_EQ(parseResult->status, ObjectStatus::OBJECT_NOT_EXIST);
 }
 
+TEST_P(MoQFramerTest, StreamObjectFanoutScope) {
+  ObjectHeader objectHeader = {
+      TrackAlias(22), // trackAlias
+      33,             // group
+      0,              // subgroup
+      44,             // id
+      55,             // priority
+      ObjectStatus::NORMAL,
+      {Extension{2, 100}},
+      4};
+  auto streamType = StreamType::SUBGROUP_HEADER;
+  folly::IOBufQueue expectedBuf{folly::IOBufQueue::cacheChainLength()};
+  auto result = writer_.writeStreamObject(
+      expectedBuf, streamType, objectHeader, folly::IOBuf::copyBuffer("EFGH"));
+  EXPECT_TRUE(result.hasValue());
+  auto expected = expectedBuf.move();
+
+  ObjectHeaderFanoutScope fanoutScope;
+  for (auto i = 0; i < 3; i++) {
+    folly::IOBufQueue writeBuf{folly::IOBufQueue::cacheChainLength()};
+    auto fanoutResult = writer_.writeStreamObject(
+        writeBuf, streamType, objectHeader, folly::IOBuf::copyBuffer("EFGH"));
+    EXPECT_TRUE(fanoutResult.hasValue());
+    EXPECT_EQ(*fanoutResult, *result);
+    EXPECT_TRUE(folly::IOBufEqualTo()(writeBuf.move(), expected));
+  }
+
+  // A different object in the same scope is encoded separately
+  objectHeader.id++;
+  folly::IOBufQueue nextBuf{folly::IOBufQueue::cacheChainLength()};
+  result = writer_.writeStreamObject(
+      nextBuf, streamType, objectHeader, folly::IOBuf::copyBuffer("EFGH"));
+  EXPECT_TRUE(result.hasValue());
+  auto serialized = nextBuf.move();
+  folly::io::Cursor cursor(serialized.get());
+  auto parseResult = parser_.parseSubgroupObjectHeader(
+      cursor, objectHeader, SubgroupIDFormat::Present, true);
+  EXPECT_TRUE(parseResult.hasValue());
+  EXPECT_EQ(parseResult->id, 45);
+  EXPECT_EQ(*parseResult->length, 4);
+}
+
+TEST_P(MoQFramerTest, ExtensionsParsedLazily) {
+  ObjectHeader objectHeader(
+      TrackAlias(22),
+      33,
+      0,
+      44,
+      55,
+      ObjectStatus::NORMAL,
+      test::getTestExtensions(),
+      4);
+  auto streamType =
+      getSubgroupStreamType(GetParam(), SubgroupIDFormat::Present, true);
+  folly::IOBufQueue writeBuf{folly::IOBufQueue::cacheChainLength()};
+  auto result = writer_.writeStreamObject(
+      writeBuf, streamType, objectHeader, folly::IOBuf::copyBuffer("EFGH"));
+  EXPECT_TRUE(result.hasValue());
+  auto expected = writeBuf.move();
+
+  folly::io::Cursor cursor(expected.get());
+  auto parseResult = parser_.parseSubgroupObjectHeader(
+      cursor, objectHeader, SubgroupIDFormat::Present, true);
+  ASSERT_TRUE(parseResult.hasValue());
+  auto& extensions = parseResult->extensions;
+  ASSERT_NE(extensions.serialized(), nullptr);
+  EXPECT_EQ(extensions.size(), 2u);
+
+  // Copies share the serialized extensions, and write them back as is
+  auto copy = extensions;
+  EXPECT_EQ(copy.serialized(), extensions.serialized());
+  ObjectHeader forwarded = *parseResult;
+  result = writer_.writeStreamObject(
+      writeBuf, streamType, forwarded, folly::IOBuf::copyBuffer("EFGH"));
+  EXPECT_TRUE(result.hasValue());
+  EXPECT_TRUE(folly::IOBufEqualTo()(writeBuf.move(), expected));
+
+  // Decoded on access
+  EXPECT_EQ(extensions, test::getTestExtensions());
+  EXPECT_EQ(extensions[0].intValue, 10u);
+  EXPECT_NE(extensions.serialized(), nullptr);
+
+  // Modifying the extensions drops the serialized form, but not the copy's
+  forwarded.extensions.emplace_back(12, 1);
+  EXPECT_EQ(forwarded.extensions.serialized(), nullptr);
+  EXPECT_EQ(forwarded.extensions.size(), 3u);
+  EXPECT_EQ(copy.size(), 2u);
+  EXPECT_NE(copy.serialized(), nullptr);
+  result = writer_.writeStreamObject(
+      writeBuf, streamType, forwarded, folly::IOBuf::copyBuffer("EFGH"));
+  EXPECT_TRUE(result.hasValue());
+  auto modified = writeBuf.move();
+  folly::io::Cursor modifiedCursor(modified.get());
+  parseResult = parser_.parseSubgroupObjectHeader(
+      modifiedCursor, objectHeader, SubgroupIDFormat::Present, true);
+  ASSERT_TRUE(parseResult.hasValue());
+  EXPECT_EQ(parseResult->extensions, forwarded.extensions);
+}
+
 TEST_P(MoQFramerTest, ParseFetchHeader) {
   ObjectHeader expectedObjectHeader = {
       RequestID(22), // reqID
@@ -743,6 +909,26 @@ TEST_P(MoQFramerTest, SingleObjectStream) {
   cursor.skip(*parseResult->length);
 }
 
+TEST_P(MoQFramerTest, DraftTraits) {
+  const auto& traits = writer_.draftTraits();
+  auto version = GetParam();
+  EXPECT_EQ(traits.majorVersion, getDraftMajorVersion(version));
+  EXPECT_EQ(traits.legacy, getDraftMajorVersion(version) < 11);
+  EXPECT_EQ(traits.requestIDMultiplier, traits.legacy ? 1 : 2);
+  EXPECT_EQ(traits.authorizationParamKey, getAuthorizationParamKey(version));
+  EXPECT_EQ(
+      traits.deliveryTimeoutParamKey, getDeliveryTimeoutParamKey(version));
+  EXPECT_EQ(
+      traits.maxCacheDurationParamKey, getMaxCacheDurationParamKey(version));
+  EXPECT_EQ(parser_.draftTraits().majorVersion, traits.majorVersion);
+  EXPECT_EQ(
+      getDatagramType(traits, true, false),
+      getDatagramType(version, true, false));
+  EXPECT_EQ(
+      getSubgroupStreamType(traits, SubgroupIDFormat::Zero, true),
+      getSubgroupStreamType(version, SubgroupIDFormat::Zero, true));
+}
+
 TEST_P(MoQFramerTest, ParseTrackStatusRequest) {
   folly::IOBufQueue writeBuf{folly::IOBufQueue::cacheChainLength()};
   TrackStatusRequest tsr;
@@ -0,0 +1,139 @@
+// (c) Meta Platforms, Inc. and affiliates. Confidential and proprietary.
+
+#include <gtest/gtest.h>
+#include "moxygen/moqtest/MoQImpairmentProxy.h"
+
+namespace {
+
+using moxygen::MoQImpairedLink;
+using moxygen::MoQImpairmentConfig;
+using std::chrono::milliseconds;
+
+const MoQImpairedLink::TimePoint kStart{std::chrono::seconds(100)};
+
+class MoQImpairedLinkTest : public testing::Test {
+ public:
+  MoQImpairedLink& makeLink() {
+    link_.emplace(config_, rng_);
+    return *link_;
+  }
+
+ protected:
+  MoQImpairmentConfig config_;
+  std::mt19937 rng_{config_.seed};
+  folly::Optional<MoQImpairedLink> link_;
+};
+
+TEST_F(MoQImpairedLinkTest, DelayIsHalfTheRtt) {
+  config_.rtt = milliseconds(40);
+  auto& link = makeLink();
+  EXPECT_EQ(link.deliveryTime(100, kStart), kStart + milliseconds(20));
+  EXPECT_EQ(link.stats().packets, 1);
+  EXPECT_EQ(link.stats().bytes, 100);
+}
+
+TEST_F(MoQImpairedLinkTest, BandwidthQueuesThenDrops) {
+  // 1000 bytes a second, up to 3 packets of 1000 bytes wait
+  config_.bandwidthBps = 8000;
+  config_.queueBytes = 3000;
+  config_.rtt = milliseconds(100);
+  auto& link = makeLink();
+  EXPECT_EQ(
+      link.deliveryTime(1000, kStart),
+      kStart + std::chrono::seconds(1) + milliseconds(50));
+  EXPECT_EQ(
+      link.deliveryTime(1000, kStart),
+      kStart + std::chrono::seconds(2) + milliseconds(50));
+  EXPECT_EQ(
+      link.deliveryTime(1000, kStart),
+      kStart + std::chrono::seconds(3) + milliseconds(50));
+  EXPECT_FALSE(link.deliveryTime(1000, kStart));
+  EXPECT_EQ(link.stats().queueDrops, 1);
+  EXPECT_EQ(link.stats().packets, 3);
+  EXPECT_EQ(link.stats().bytes, 3000);
+
+  // Once the queue drains, a packet only waits for its own bytes
+  auto later = kStart + std::chrono::seconds(10);
+  EXPECT_EQ(
+      link.deliveryTime(500, later),
+      later + milliseconds(500) + milliseconds(50));
+}
+
+TEST_F(MoQImpairedLinkTest, SubMillisecondTimesAreKept) {
+  // 1200 bytes at 100Mbps take 96us
+  config_.bandwidthBps = 100'000'000;
+  auto& link = makeLink();
+  auto micros = [](MoQImpairedLink::TimePoint delivery) {
+    return std::chrono::duration<double, std::micro>(delivery - kStart)
+        .count();
+  };
+  auto first = link.deliveryTime(1200, kStart);
+  ASSERT_TRUE(first);
+  EXPECT_NEAR(micros(*first), 96, 0.01);
+  auto second = link.deliveryTime(1200, kStart);
+  ASSERT_TRUE(second);
+  EXPECT_NEAR(micros(*second), 192, 0.01);
+}
+
+TEST_F(MoQImpairedLinkTest, LossCountsDroppedPackets) {
+  config_.lossPercent = 100;
+  auto& link = makeLink();
+  for (int i = 0; i < 10; i++) {
+    EXPECT_FALSE(link.deliveryTime(100, kStart + milliseconds(i)));
+  }
+  EXPECT_EQ(link.stats().lost, 10);
+  EXPECT_EQ(link.stats().packets, 0);
+}
+
+TEST_F(MoQImpairedLinkTest, JitterKeepsOrder) {
+  config_.rtt = milliseconds(20);
+  config_.jitter = milliseconds(30);
+  auto& link = makeLink();
+  MoQImpairedLink::TimePoint last;
+  for (int i = 0; i < 100; i++) {
+    auto now = kStart + milliseconds(i);
+    auto delivery = link.deliveryTime(100, now);
+    ASSERT_TRUE(delivery);
+    EXPECT_GE(*delivery, now + milliseconds(10));
+    EXPECT_LE(*delivery, std::max(last, now + milliseconds(40)));
+    EXPECT_GE(*delivery, last);
+    last = *delivery;
+  }
+}
+
+TEST_F(MoQImpairedLinkTest, ReorderedPacketsArePassed) {
+  config_.reorderPercent = 50;
+  config_.reorderDelay = milliseconds(10);
+  auto& link = makeLink();
+  std::vector<MoQImpairedLink::TimePoint> deliveries;
+  for (int i = 0; i < 100; i++) {
+    auto now = kStart + milliseconds(i);
+    auto delivery = link.deliveryTime(100, now);
+    ASSERT_TRUE(delivery);
+    // Either on time, or held back by exactly the reorder delay
+    EXPECT_TRUE(*delivery == now || *delivery == now + milliseconds(10));
+    deliveries.push_back(*delivery);
+  }
+  auto reordered = link.stats().reordered;
+  EXPECT_GT(reordered, 0);
+  EXPECT_LT(reordered, 100);
+  EXPECT_EQ(link.stats().packets, 100);
+  EXPECT_FALSE(std::is_sorted(deliveries.begin(), deliveries.end()));
+}
+
+TEST_F(MoQImpairedLinkTest, SameSeedSameDecisions) {
+  config_.lossPercent = 30;
+  config_.jitter = milliseconds(5);
+  auto run = [this] {
+    rng_.seed(config_.seed);
+    auto& link = makeLink();
+    std::vector<folly::Optional<MoQImpairedLink::TimePoint>> deliveries;
+    for (int i = 0; i < 50; i++) {
+      deliveries.push_back(link.deliveryTime(100, kStart + milliseconds(i)));
+    }
+    return deliveries;
+  };
+  EXPECT_EQ(run(), run());
+}
+
+} // namespace
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <moxygen/MoQLatencyProbe.h>
+#include <moxygen/test/Mocks.h>
+
+using namespace moxygen;
+using namespace testing;
+
+TEST(MoQLatencyProbeTest, AppendAndParseHops) {
+  auto extensions = makeProbeExtensions(1000);
+  extensions.push_back(Extension(2, 7));
+  EXPECT_TRUE(appendProbeHop(extensions, 1500));
+  EXPECT_TRUE(appendProbeHop(extensions, 2500));
+  EXPECT_EQ(
+      parseProbeHops(extensions), std::vector<uint64_t>({1000, 1500, 2500}));
+  // Other extensions are left alone
+  ASSERT_EQ(extensions.size(), 2);
+  EXPECT_EQ(extensions[1].intValue, 7);
+
+  Extensions notProbe{Extension(2, 7)};
+  EXPECT_FALSE(appendProbeHop(notProbe, 1500));
+  EXPECT_EQ(notProbe.size(), 1);
+  EXPECT_TRUE(parseProbeHops(notProbe).empty());
+}
+
+TEST(MoQLatencyProbeTest, StamperAppendsHop) {
+  auto consumer = std::make_shared<StrictMock<MockTrackConsumer>>();
+  std::vector<uint64_t> hops;
+  EXPECT_CALL(*consumer, datagram(_, _))
+      .WillOnce(Invoke([&hops](const ObjectHeader& header, Payload) {
+        hops = parseProbeHops(header.extensions);
+        return folly::makeExpected<MoQPublishError>(folly::unit);
+      }));
+  MoQLatencyProbeStamper stamper(consumer);
+  auto start = probeTimestampUs();
+  ObjectHeader header(
+      TrackAlias(1),
+      0,
+      0,
+      0,
+      128,
+      ObjectStatus::NORMAL,
+      makeProbeExtensions(start));
+  EXPECT_TRUE(stamper.datagram(header, nullptr).hasValue());
+  ASSERT_EQ(hops.size(), 2);
+  EXPECT_EQ(hops[0], start);
+  EXPECT_GE(hops[1], start);
+}
+
+TEST(MoQLatencyProbeTest, HopPercentiles) {
+  LatencyProbeStats stats;
+  // Publisher -> relay takes i ms, relay -> subscriber 1ms
+  for (uint64_t i = 1; i <= 100; i++) {
+    stats.add({0, i * 1000}, i * 1000 + 1000);
+  }
+  // A probe from a publisher whose clock is ahead
+  stats.add({5000, 1000}, 2000);
+  EXPECT_EQ(stats.numProbes(), 101);
+  auto hops = stats.hopPercentiles();
+  ASSERT_EQ(hops.size(), 2);
+  EXPECT_EQ(hops[0].p50Us, 50000);
+  EXPECT_EQ(hops[0].p99Us, 99000);
+  EXPECT_EQ(hops[0].maxUs, 100000);
+  EXPECT_EQ(hops[1].p90Us, 1000);
+  EXPECT_EQ(stats.totalPercentiles().maxUs, 101000);
+
+  stats.clear();
+  EXPECT_EQ(stats.numProbes(), 0);
+  EXPECT_TRUE(stats.hopPercentiles().empty());
+}
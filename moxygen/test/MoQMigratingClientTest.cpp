@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <deque>
+
+#include <folly/coro/BlockingWait.h>
+#include <folly/coro/GtestHelpers.h>
+#include <folly/coro/Sleep.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/portability/GMock.h>
+#include <folly/portability/GTest.h>
+#include <moxygen/MoQMigratingClient.h>
+#include <moxygen/test/FakeMoQClient.h>
+#include <moxygen/test/Mocks.h>
+#include <moxygen/test/TestHelpers.h>
+
+using namespace testing;
+namespace moxygen::test {
+
+namespace {
+
+const FullTrackName kTrack{TrackNamespace{{"foo"}}, "bar"};
+
+SubscribeRequest getSubscribe() {
+  return SubscribeRequest{
+      RequestID(0),
+      TrackAlias(0),
+      kTrack,
+      0,
+      GroupOrder::OldestFirst,
+      true,
+      LocationType::LatestObject,
+      folly::none,
+      0,
+      {}};
+}
+
+// Clears the test's pointer to it once the migrating client frees it
+class TrackedClient : public FakeMoQClient {
+ public:
+  TrackedClient(
+      folly::EventBase* evb,
+      proxygen::URL url,
+      std::shared_ptr<Publisher> serverPublisher,
+      FakeMoQClient*& self)
+      : FakeMoQClient(evb, std::move(url), std::move(serverPublisher)),
+        self_(self) {
+    self_ = this;
+  }
+
+  ~TrackedClient() override {
+    self_ = nullptr;
+  }
+
+ private:
+  FakeMoQClient*& self_;
+};
+
+} // namespace
+
+class MoQMigratingClientTest : public ::testing::Test {
+ public:
+  folly::DrivableExecutor* getExecutor() {
+    return &evb_;
+  }
+
+ protected:
+  // One session the client opens, and the track published on it
+  struct Server {
+    std::shared_ptr<NiceMock<MockPublisher>> origin{
+        std::make_shared<NiceMock<MockPublisher>>()};
+    // Null once freed
+    FakeMoQClient* client{nullptr};
+    folly::Optional<SubscribeRequest> subscribe;
+    std::shared_ptr<TrackConsumer> publisher;
+    bool unsubscribed{false};
+  };
+
+  void SetUp() override {
+    ON_CALL(*consumer_, beginSubgroup(_, _, _))
+        .WillByDefault(Invoke(
+            [this](uint64_t groupID, uint64_t, Priority)
+                -> folly::Expected<
+                    std::shared_ptr<SubgroupConsumer>,
+                    MoQPublishError> {
+              groups_.push_back(groupID);
+              return std::shared_ptr<SubgroupConsumer>(subgroup_);
+            }));
+    ON_CALL(*consumer_, subscribeDone(_)).WillByDefault(Return(folly::unit));
+    ON_CALL(*subgroup_, object(_, _, _, _)).WillByDefault(Return(folly::unit));
+  }
+
+  std::shared_ptr<MoQMigratingClient> makeClient() {
+    return std::make_shared<MoQMigratingClient>(
+        &evb_,
+        proxygen::URL("moqt://relay.example:4433/moq"),
+        config_,
+        [this](folly::EventBase* evb, proxygen::URL url) {
+          auto& server = servers_.emplace_back();
+          ON_CALL(*server.origin, subscribe(_, _))
+              .WillByDefault(Invoke(
+                  [&server](
+                      SubscribeRequest sub,
+                      std::shared_ptr<TrackConsumer> publisher)
+                      -> folly::coro::Task<Publisher::SubscribeResult> {
+                    server.subscribe = sub;
+                    server.publisher = std::move(publisher);
+                    auto handle =
+                        std::make_shared<NiceMock<MockSubscriptionHandle>>(
+                            SubscribeOk{
+                                sub.requestID,
+                                std::chrono::milliseconds(0),
+                                GroupOrder::OldestFirst,
+                                folly::none,
+                                {}});
+                    ON_CALL(*handle, unsubscribe())
+                        .WillByDefault(
+                            Invoke([&server] { server.unsubscribed = true; }));
+                    return folly::coro::makeTask<Publisher::SubscribeResult>(
+                        std::move(handle));
+                  }));
+          auto client = std::make_unique<TrackedClient>(
+              evb, std::move(url), server.origin, server.client);
+          client->setFailConnect(failMigration_ && servers_.size() > 1);
+          return client;
+        });
+  }
+
+  // Publishes groupID as a single object on server's track
+  static void publishGroup(Server& server, uint64_t groupID) {
+    auto subgroup = server.publisher->beginSubgroup(groupID, 0, 0);
+    ASSERT_TRUE(subgroup.hasValue());
+    EXPECT_TRUE(subgroup.value()
+                    ->object(0, folly::IOBuf::copyBuffer("x"), {}, true)
+                    .hasValue());
+  }
+
+  // Subscribes, receives groups 0 and 1, then the server sends GOAWAY
+  folly::coro::Task<void> subscribeAndGoaway(
+      std::shared_ptr<MoQMigratingClient> client) {
+    co_await client->connect();
+    auto sub = co_await client->subscribe(getSubscribe(), consumer_);
+    CO_ASSERT_TRUE(sub.hasValue());
+    CO_ASSERT_TRUE(servers_[0].publisher);
+    publishGroup(servers_[0], 0);
+    publishGroup(servers_[0], 1);
+    co_await runUntil([&] { return groups_.size() == 2; });
+    CO_ASSERT_EQ(groups_, (std::vector<uint64_t>{0, 1}));
+    servers_[0].client->serverSession()->goaway(Goaway{""});
+  }
+
+  // Runs the EventBase, including timers, until done or a second passes
+  folly::coro::Task<void> runUntil(std::function<bool()> done) {
+    for (int i = 0; i < 1000 && !done(); i++) {
+      co_await folly::coro::sleep(std::chrono::milliseconds(1));
+    }
+  }
+
+  folly::EventBase evb_;
+  MoQMigratingClient::Config config_;
+  // Connects after the first one fail
+  bool failMigration_{false};
+  std::deque<Server> servers_;
+  std::shared_ptr<NiceMock<MockTrackConsumer>> consumer_{
+      std::make_shared<NiceMock<MockTrackConsumer>>()};
+  std::shared_ptr<NiceMock<MockSubgroupConsumer>> subgroup_{
+      std::make_shared<NiceMock<MockSubgroupConsumer>>()};
+  // Groups delivered to consumer_, in order
+  std::vector<uint64_t> groups_;
+};
+
+CO_TEST_F_X(MoQMigratingClientTest, SwitchesAtGroupBoundary) {
+  auto client = makeClient();
+  co_await subscribeAndGoaway(client);
+  co_await runUntil(
+      [&] { return servers_.size() == 2 && servers_[1].publisher; });
+  CO_ASSERT_TRUE(servers_.size() == 2 && servers_[1].publisher);
+  EXPECT_EQ(client->migrations(), 1);
+  EXPECT_EQ(client->getSession(), servers_[1].client->moqSession_);
+  // The new subscription picks up after the newest group
+  EXPECT_EQ(servers_[1].subscribe->locType, LocationType::AbsoluteStart);
+  EXPECT_EQ(servers_[1].subscribe->start, (AbsoluteLocation{2, 0}));
+
+  // The old session is a group ahead, so the new one takes over at 3
+  publishGroup(servers_[0], 2);
+  co_await runUntil([&] { return groups_.size() == 3; });
+  publishGroup(servers_[1], 2);
+  publishGroup(servers_[1], 3);
+  co_await runUntil([&] { return groups_.size() == 4; });
+  EXPECT_FALSE(servers_[0].unsubscribed);
+  publishGroup(servers_[0], 3);
+  // Every track switched, the old session goes without the drain timeout
+  co_await runUntil([&] { return !servers_[0].client; });
+  EXPECT_TRUE(servers_[0].unsubscribed);
+  EXPECT_FALSE(servers_[0].client);
+  EXPECT_EQ(groups_, (std::vector<uint64_t>{0, 1, 2, 3}));
+  client->close();
+}
+
+CO_TEST_F_X(MoQMigratingClientTest, DrainTimeoutSwitchesTracks) {
+  config_.drainTimeout = std::chrono::milliseconds(20);
+  auto client = makeClient();
+  co_await subscribeAndGoaway(client);
+  // The old session never reaches the switch group
+  co_await runUntil(
+      [&] { return servers_.size() == 2 && !servers_[0].client; });
+  CO_ASSERT_EQ(servers_.size(), 2);
+  EXPECT_FALSE(servers_[0].client);
+  EXPECT_TRUE(servers_[0].unsubscribed);
+
+  CO_ASSERT_TRUE(servers_[1].publisher);
+  publishGroup(servers_[1], 2);
+  co_await runUntil([&] { return groups_.size() == 3; });
+  EXPECT_EQ(groups_, (std::vector<uint64_t>{0, 1, 2}));
+  EXPECT_EQ(client->getSession(), servers_[1].client->moqSession_);
+  client->close();
+}
+
+CO_TEST_F_X(MoQMigratingClientTest, FailedConnectStaysOnOldSession) {
+  auto client = makeClient();
+  failMigration_ = true;
+  co_await subscribeAndGoaway(client);
+  co_await runUntil(
+      [&] { return servers_.size() == 2 && !servers_[1].client; });
+  CO_ASSERT_EQ(servers_.size(), 2);
+  EXPECT_FALSE(servers_[1].client);
+  EXPECT_EQ(client->migrations(), 0);
+  EXPECT_EQ(client->getSession(), servers_[0].client->moqSession_);
+
+  // The draining server keeps publishing the track
+  publishGroup(servers_[0], 2);
+  co_await runUntil([&] { return groups_.size() == 3; });
+  EXPECT_EQ(groups_, (std::vector<uint64_t>{0, 1, 2}));
+  EXPECT_FALSE(servers_[0].unsubscribed);
+  client->close();
+}
+
+} // namespace moxygen::test
@@ -15,6 +15,8 @@
 #include <moxygen/test/TestHelpers.h>
 #include <moxygen/test/TestUtils.h>
 
+#include <thread>
+
 using namespace moxygen;
 
 namespace {
@@ -279,6 +281,17 @@ class MoQSessionTest : public testing::TestWithParam<VersionParams>,
                 {}}}};
   }
 
+  // The SERVER_SETUP a resuming client remembers from its last session
+  ServerSetup getExpectedServerSetup() {
+    return ServerSetup{
+        .selectedVersion = getServerSelectedVersion(),
+        .params = {SetupParameter{
+            folly::to_underlying(SetupKey::MAX_REQUEST_ID),
+            "",
+            initialMaxRequestID_,
+            {}}}};
+  }
+
   std::vector<uint64_t> getClientSupportedVersions() {
     return GetParam().clientVersions;
   }
@@ -416,6 +429,18 @@ CO_TEST_P_X(CurrentVersionOnly, SetupTimeout) {
   clientSession_->close(SessionCloseErrorCode::NO_ERROR);
 }
 
+CO_TEST_P_X(CurrentVersionOnly, OptimisticSetupVersionMismatch) {
+  clientSession_->start();
+  serverSession_->start();
+  auto expected = getExpectedServerSetup();
+  expected.selectedVersion = kVersionDraft09;
+  auto serverSetup = co_await co_awaitTry(clientSession_->setupOptimistic(
+      getClientSetup(initialMaxRequestID_), std::move(expected)));
+  // Fails so the caller drops the SERVER_SETUP it expected
+  EXPECT_TRUE(serverSetup.hasException());
+  EXPECT_TRUE(clientWt_->isSessionClosed());
+}
+
 CO_TEST_P_X(CurrentVersionOnly, ServerSetupFail) {
   failServerSetup_ = true;
   clientSession_->start();
@@ -698,6 +723,28 @@ CO_TEST_P_X(MoQSessionTest, FetchError) {
   clientSession_->close(SessionCloseErrorCode::NO_ERROR);
 }
 
+CO_TEST_P_X(MoQSessionTest, OptimisticSetup) {
+  clientSession_->start();
+  serverSession_->setPublishHandler(serverPublisher);
+  serverSession_->start();
+  auto setupFuture = clientSession_->setupOptimistic(
+      getClientSetup(initialMaxRequestID_), getExpectedServerSetup());
+  // The FETCH goes out before SERVER_SETUP is back
+  EXPECT_CALL(
+      *serverPublisherStatsCallback_,
+      onFetchError(FetchErrorCode::INVALID_RANGE));
+  EXPECT_CALL(
+      *clientSubscriberStatsCallback_,
+      onFetchError(FetchErrorCode::INVALID_RANGE));
+  auto res =
+      co_await clientSession_->fetch(getFetch({0, 2}, {0, 1}), fetchCallback_);
+  EXPECT_TRUE(res.hasError());
+  EXPECT_EQ(res.error().errorCode, FetchErrorCode::INVALID_RANGE);
+  auto serverSetup = co_await std::move(setupFuture);
+  EXPECT_EQ(serverSetup.selectedVersion, getServerSelectedVersion());
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
 CO_TEST_P_X(MoQSessionTest, FetchPublisherError) {
   co_await setupMoQSession();
   expectFetch(
@@ -787,6 +834,108 @@ CO_TEST_P_X(MoQSessionTest, FetchEarlyCancel) {
   clientSession_->close(SessionCloseErrorCode::NO_ERROR);
 }
 
+// Holds a slot in limiter until the FETCH stream completes
+CO_TEST_P_X(MoQSessionTest, FetchCancelReleasesLimiterSlot) {
+  auto limiter = std::make_shared<MoQFetchLimiter>(
+      MoQFetchLimiter::Config{.maxConcurrent = 1});
+  MoQSettings moqSettings;
+  moqSettings.fetchLimits.shared = limiter;
+  serverSession_->setMoqSettings(moqSettings);
+  co_await setupMoQSession();
+  expectFetch([](Fetch fetch, auto fetchPub) -> TaskFetchResult {
+    fetchPub->object(0, 0, 0, moxygen::test::makeBuf(100));
+    co_return makeFetchOkResult(fetch, AbsoluteLocation{100, 100});
+  });
+  EXPECT_CALL(*fetchCallback_, object(0, 0, 0, _, _, false))
+      .WillOnce(testing::Return(folly::unit));
+  expectFetchSuccess();
+  auto res =
+      co_await clientSession_->fetch(getFetch({0, 0}, {0, 2}), fetchCallback_);
+  CO_ASSERT_FALSE(res.hasError());
+  EXPECT_EQ(limiter->active(), 1);
+  res.value()->fetchCancel();
+  for (int i = 0; i < 10 && limiter->active() > 0; i++) {
+    co_await folly::coro::co_reschedule_on_current_executor;
+  }
+  EXPECT_EQ(limiter->active(), 0);
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
+CO_TEST_P_X(MoQSessionTest, FetchErrorReleasesLimiterSlot) {
+  auto limiter = std::make_shared<MoQFetchLimiter>(
+      MoQFetchLimiter::Config{.maxConcurrent = 1});
+  MoQSettings moqSettings;
+  moqSettings.fetchLimits.shared = limiter;
+  serverSession_->setMoqSettings(moqSettings);
+  co_await setupMoQSession();
+  // Fails before writing, so the reset finds no stream
+  expectFetch(
+      [](Fetch fetch, auto) -> TaskFetchResult {
+        co_return folly::makeUnexpected(FetchError{
+            fetch.requestID, FetchErrorCode::TRACK_NOT_EXIST, "Bad trackname"});
+      },
+      FetchErrorCode::TRACK_NOT_EXIST);
+  auto res =
+      co_await clientSession_->fetch(getFetch({0, 0}, {0, 1}), fetchCallback_);
+  EXPECT_TRUE(res.hasError());
+  EXPECT_EQ(limiter->active(), 0);
+  EXPECT_EQ(limiter->waiting(), 0);
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
+CO_TEST_P_X(MoQSessionTest, SessionCloseReleasesQueuedFetch) {
+  auto limiter = std::make_shared<MoQFetchLimiter>(
+      MoQFetchLimiter::Config{.maxConcurrent = 1});
+  MoQSettings moqSettings;
+  moqSettings.fetchLimits.shared = limiter;
+  serverSession_->setMoqSettings(moqSettings);
+  co_await setupMoQSession();
+  // The first FETCH keeps its stream, and its slot, open
+  expectFetch([](Fetch fetch, auto fetchPub) -> TaskFetchResult {
+    fetchPub->object(0, 0, 0, moxygen::test::makeBuf(100));
+    co_return makeFetchOkResult(fetch, AbsoluteLocation{100, 100});
+  });
+  EXPECT_CALL(*fetchCallback_, object(0, 0, 0, _, _, false))
+      .WillOnce(testing::Return(folly::unit));
+  EXPECT_CALL(*fetchCallback_, reset(_)).Times(testing::AnyNumber());
+  expectFetchSuccess();
+  auto res =
+      co_await clientSession_->fetch(getFetch({0, 0}, {0, 2}), fetchCallback_);
+  CO_ASSERT_FALSE(res.hasError());
+  auto queued =
+      clientSession_
+          ->fetch(
+              getFetch({1, 0}, {1, 2}),
+              std::make_shared<testing::NiceMock<MockFetchConsumer>>())
+          .scheduleOn(&eventBase_)
+          .start();
+  for (int i = 0; i < 10 && limiter->waiting() == 0; i++) {
+    co_await folly::coro::co_reschedule_on_current_executor;
+  }
+  EXPECT_EQ(limiter->active(), 1);
+  EXPECT_EQ(limiter->waiting(), 1);
+
+  serverSession_->close(SessionCloseErrorCode::NO_ERROR);
+  for (int i = 0; i < 10 && limiter->active() + limiter->waiting() > 0; i++) {
+    co_await folly::coro::co_reschedule_on_current_executor;
+  }
+  EXPECT_EQ(limiter->active(), 0);
+  EXPECT_EQ(limiter->waiting(), 0);
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+  co_await co_awaitTry(std::move(queued));
+}
+
+CO_TEST_P_X(MoQSessionTest, FetchBelowLiveUrgency) {
+  co_await setupMoQSession();
+  // Subgroup streams have urgency 1
+  EXPECT_EQ(serverSession_->fetchStreamUrgency(), 1);
+  MoQSettings moqSettings;
+  moqSettings.fetchLimits.belowLive = true;
+  serverSession_->setMoqSettings(moqSettings);
+  EXPECT_EQ(serverSession_->fetchStreamUrgency(), 2);
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
 CO_TEST_P_X(MoQSessionTest, FetchBadLength) {
   co_await setupMoQSession();
   expectFetch([](Fetch fetch, auto fetchPub) -> TaskFetchResult {
@@ -912,6 +1061,61 @@ CO_TEST_P_X(MoQSessionTest, FetchOutOfOrder) {
   clientSession_->close(SessionCloseErrorCode::NO_ERROR);
 }
 
+CO_TEST_P_X(MoQSessionTest, FetchNewestFirst) {
+  co_await setupMoQSession();
+  expectFetch([](Fetch fetch, auto fetchPub) -> TaskFetchResult {
+    EXPECT_EQ(fetch.groupOrder, GroupOrder::NewestFirst);
+    // Groups descend, objects within a group still ascend
+    EXPECT_TRUE(
+        fetchPub->object(2, 0, 0, moxygen::test::makeBuf(100)).hasValue());
+    EXPECT_TRUE(
+        fetchPub->object(1, 0, 0, moxygen::test::makeBuf(100)).hasValue());
+    EXPECT_TRUE(
+        fetchPub->object(1, 0, 1, moxygen::test::makeBuf(100)).hasValue());
+    EXPECT_EQ(
+        fetchPub->object(2, 0, 1, moxygen::test::makeBuf(100)).error().code,
+        MoQPublishError::API_ERROR);
+    EXPECT_TRUE(fetchPub
+                    ->object(
+                        0,
+                        0,
+                        0,
+                        moxygen::test::makeBuf(100),
+                        noExtensions(),
+                        /*finFetch=*/true)
+                    .hasValue());
+    co_return makeFetchOkResult(fetch, AbsoluteLocation{2, 0});
+  });
+
+  folly::coro::Baton baton;
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(
+        *fetchCallback_, object(2, 0, 0, HasChainDataLengthOf(100), _, false))
+        .WillOnce(testing::Return(folly::unit));
+    EXPECT_CALL(
+        *fetchCallback_, object(1, 0, 0, HasChainDataLengthOf(100), _, false))
+        .WillOnce(testing::Return(folly::unit));
+    EXPECT_CALL(
+        *fetchCallback_, object(1, 0, 1, HasChainDataLengthOf(100), _, false))
+        .WillOnce(testing::Return(folly::unit));
+    EXPECT_CALL(
+        *fetchCallback_, object(0, 0, 0, HasChainDataLengthOf(100), _, true))
+        .WillOnce(testing::Invoke([&] {
+          baton.post();
+          return folly::unit;
+        }));
+  }
+  expectFetchSuccess();
+  EXPECT_CALL(*clientSubscriberStatsCallback_, recordFetchLatency(_));
+  auto fetch = getFetch({0, 0}, {3, 0});
+  fetch.groupOrder = GroupOrder::NewestFirst;
+  auto res = co_await clientSession_->fetch(fetch, fetchCallback_);
+  EXPECT_FALSE(res.hasError());
+  co_await baton;
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
 folly::coro::Task<void> MoQSessionTest::publishValidationTest(
     TestLogicFn testLogic) {
   co_await setupMoQSession();
@@ -1213,6 +1417,158 @@ CO_TEST_P_X(MoQSessionTest, Datagrams) {
   clientSession_->close(SessionCloseErrorCode::NO_ERROR);
 }
 
+CO_TEST_P_X(MoQSessionTest, DatagramsSentInPriorityOrder) {
+  co_await setupMoQSession();
+  expectSubscribe([](auto sub, auto pub) -> TaskSubscribeResult {
+    // Published in one loop, so sent as one batch
+    pub->datagram(
+        ObjectHeader(sub.trackAlias, 0, 0, 1, 200, 5),
+        folly::IOBuf::copyBuffer("hello"));
+    pub->datagram(
+        ObjectHeader(sub.trackAlias, 0, 0, 2, 10, 5),
+        folly::IOBuf::copyBuffer("world"));
+    pub->subscribeDone(getTrackEndedSubscribeDone(sub.requestID));
+    co_return makeSubscribeOkResult(sub, AbsoluteLocation{0, 0});
+  });
+  {
+    testing::InSequence enforceOrder;
+    EXPECT_CALL(*subscribeCallback_, datagram(_, _))
+        .WillOnce(testing::Invoke([&](const auto& header, auto) {
+          EXPECT_EQ(header.id, 2);
+          return folly::unit;
+        }));
+    EXPECT_CALL(*subscribeCallback_, datagram(_, _))
+        .WillOnce(testing::Invoke([&](const auto& header, auto) {
+          EXPECT_EQ(header.id, 1);
+          return folly::unit;
+        }));
+  }
+  expectSubscribeDone();
+  auto res = co_await clientSession_->subscribe(
+      getSubscribe(kTestTrackName), subscribeCallback_);
+  EXPECT_FALSE(res.hasError());
+  co_await subscribeDone_;
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
+CO_TEST_P_X(MoQSessionTest, EgressSchedulerOrdersDatagrams) {
+  co_await setupMoQSession();
+  MoQSettings moqSettings;
+  moqSettings.egressScheduling.enabled = true;
+  moqSettings.egressScheduling.windowBytes = 1;
+  serverSession_->setMoqSettings(moqSettings);
+  expectSubscribe([](auto sub, auto pub) -> TaskSubscribeResult {
+    pub->datagram(
+        ObjectHeader(sub.trackAlias, 1, 0, 1, 10, 5),
+        folly::IOBuf::copyBuffer("hello"));
+    pub->datagram(
+        ObjectHeader(sub.trackAlias, 0, 0, 2, 10, 5),
+        folly::IOBuf::copyBuffer("world"));
+    pub->datagram(
+        ObjectHeader(sub.trackAlias, 0, 0, 3, 200, 5),
+        folly::IOBuf::copyBuffer("later"));
+    pub->subscribeDone(getTrackEndedSubscribeDone(sub.requestID));
+    co_return makeSubscribeOkResult(sub, AbsoluteLocation{0, 0});
+  });
+  {
+    // Publisher priority, then oldest group first
+    testing::InSequence enforceOrder;
+    for (uint64_t id : {2, 1, 3}) {
+      EXPECT_CALL(*subscribeCallback_, datagram(_, _))
+          .WillOnce(testing::Invoke([id](const auto& header, auto) {
+            EXPECT_EQ(header.id, id);
+            return folly::unit;
+          }));
+    }
+  }
+  expectSubscribeDone();
+  auto res = co_await clientSession_->subscribe(
+      getSubscribe(kTestTrackName), subscribeCallback_);
+  EXPECT_FALSE(res.hasError());
+  co_await subscribeDone_;
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
+CO_TEST_P_X(MoQSessionTest, EgressSchedulerDrainsDatagramsAlone) {
+  co_await setupMoQSession();
+  MoQSettings moqSettings;
+  moqSettings.egressScheduling.enabled = true;
+  moqSettings.egressScheduling.windowBytes = 1;
+  serverSession_->setMoqSettings(moqSettings);
+  std::shared_ptr<TrackConsumer> publisher;
+  SubscribeRequest subReq;
+  expectSubscribe([&](auto sub, auto pub) -> TaskSubscribeResult {
+    publisher = pub;
+    subReq = sub;
+    co_return makeSubscribeOkResult(sub, AbsoluteLocation{0, 0});
+  });
+  auto res = co_await clientSession_->subscribe(
+      getSubscribe(kTestTrackName), subscribeCallback_);
+  EXPECT_FALSE(res.hasError());
+
+  // One datagram fills the window, the rest go out on later loops without
+  // any other write to wake the scheduler
+  folly::coro::Baton received;
+  uint64_t numReceived = 0;
+  EXPECT_CALL(*subscribeCallback_, datagram(_, _))
+      .Times(3)
+      .WillRepeatedly(testing::Invoke([&](const auto&, auto) {
+        if (++numReceived == 3) {
+          received.post();
+        }
+        return folly::unit;
+      }));
+  for (uint64_t id = 0; id < 3; id++) {
+    publisher->datagram(
+        ObjectHeader(subReq.trackAlias, 0, 0, id, 10, 5),
+        folly::IOBuf::copyBuffer("hello"));
+  }
+  co_await received;
+
+  expectSubscribeDone();
+  publisher->subscribeDone(getTrackEndedSubscribeDone(subReq.requestID));
+  co_await subscribeDone_;
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
+CO_TEST_P_X(MoQSessionTest, EgressSchedulerWritesSubgroups) {
+  co_await setupMoQSession();
+  MoQSettings moqSettings;
+  moqSettings.egressScheduling.enabled = true;
+  serverSession_->setMoqSettings(moqSettings);
+  expectSubscribe([this](auto sub, auto pub) -> TaskSubscribeResult {
+    eventBase_.add([pub, sub] {
+      auto subgroup = pub->beginSubgroup(0, 0, 0).value();
+      EXPECT_TRUE(subgroup->object(0, moxygen::test::makeBuf(10)));
+      EXPECT_TRUE(subgroup->object(1, moxygen::test::makeBuf(10)));
+      EXPECT_TRUE(subgroup->endOfSubgroup());
+      // The end of the stream is already queued
+      EXPECT_TRUE(subgroup->object(2, moxygen::test::makeBuf(10)).hasError());
+      pub->subscribeDone(getTrackEndedSubscribeDone(sub.requestID));
+    });
+    co_return makeSubscribeOkResult(sub);
+  });
+
+  expectSubscribeDone();
+  auto mockSubgroupConsumer =
+      std::make_shared<testing::StrictMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*subscribeCallback_, beginSubgroup(0, 0, _))
+      .WillOnce(testing::Return(mockSubgroupConsumer));
+  {
+    testing::InSequence seq;
+    for (uint64_t id = 0; id < 2; id++) {
+      EXPECT_CALL(*mockSubgroupConsumer, object(id, _, _, _))
+          .WillOnce(testing::Return(folly::unit));
+    }
+    EXPECT_CALL(*mockSubgroupConsumer, endOfSubgroup())
+        .WillOnce(testing::Return(folly::unit));
+  }
+  auto res = co_await clientSession_->subscribe(
+      getSubscribe(kTestTrackName), subscribeCallback_);
+  co_await subscribeDone_;
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
 CO_TEST_P_X(MoQSessionTest, DatagramBeforeSessionSetup) {
   clientSession_->start();
   EXPECT_FALSE(clientWt_->isSessionClosed());
@@ -1399,6 +1755,39 @@ CO_TEST_P_X(MoQSessionTest, SubscribeDoneFromSubscribe) {
   clientSession_->close(SessionCloseErrorCode::NO_ERROR);
 }
 
+CO_TEST_P_X(MoQSessionTest, SubscribeBatch) {
+  co_await setupMoQSession();
+  const FullTrackName otherTrackName{kTestTrackName.trackNamespace, "bar"};
+  for (auto i = 0; i < 2; i++) {
+    expectSubscribe([](auto sub, auto pub) -> TaskSubscribeResult {
+      pub->subscribeDone(getTrackEndedSubscribeDone(sub.requestID));
+      co_return makeSubscribeOkResult(sub);
+    });
+  }
+  EXPECT_CALL(*serverPublisherStatsCallback_, onSubscribeDone(_)).Times(2);
+  EXPECT_CALL(*clientSubscriberStatsCallback_, onSubscribeDone(_)).Times(2);
+  int numDone = 0;
+  EXPECT_CALL(*subscribeCallback_, subscribeDone(_))
+      .Times(2)
+      .WillRepeatedly(testing::Invoke([&] {
+        if (++numDone == 2) {
+          subscribeDone_.post();
+        }
+        return folly::unit;
+      }));
+  std::vector<std::pair<SubscribeRequest, std::shared_ptr<TrackConsumer>>>
+      subs;
+  subs.emplace_back(getSubscribe(kTestTrackName), subscribeCallback_);
+  subs.emplace_back(getSubscribe(otherTrackName), subscribeCallback_);
+  auto res = co_await clientSession_->subscribeBatch(std::move(subs));
+  EXPECT_EQ(res.size(), 2);
+  for (const auto& subRes : res) {
+    EXPECT_FALSE(subRes.hasError());
+  }
+  co_await subscribeDone_;
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
 CO_TEST_P_X(MoQSessionTest, SubscribeDoneAPIErrors) {
   co_await setupMoQSession();
   expectSubscribe([](auto sub, auto pub) -> TaskSubscribeResult {
@@ -1711,6 +2100,328 @@ CO_TEST_P_X(MoQSessionTest, TooFarBehindMultipleSubgroups) {
   clientSession_->close(SessionCloseErrorCode::NO_ERROR);
 }
 
+CO_TEST_P_X(MoQSessionTest, TooFarBehindResetsSubgroupsOnly) {
+  co_await setupMoQSession();
+
+  MoQSettings moqSettings;
+  moqSettings.bufferingThresholds.perSubscription = 100;
+  moqSettings.bufferingThresholds.resetSubgroupsWhenTooFarBehind = true;
+  serverSession_->setMoqSettings(moqSettings);
+
+  expectSubscribe([this](auto sub, auto pub) -> TaskSubscribeResult {
+    eventBase_.add(
+        [pub, sub, serverWt = serverWt_.get(), eventBase = &eventBase_] {
+          auto sgp = pub->beginSubgroup(0, 0, 0).value();
+          EXPECT_TRUE(sgp->object(0, moxygen::test::makeBuf(10)).hasValue());
+
+          eventBase->add([pub, sub, serverWt, sgp] {
+            serverWt->writeHandles[2]->setImmediateDelivery(false);
+            EXPECT_TRUE(
+                sgp->object(1, moxygen::test::makeBuf(60)).hasValue());
+            auto objectResult = sgp->object(2, moxygen::test::makeBuf(60));
+            EXPECT_TRUE(objectResult.hasError());
+            EXPECT_EQ(
+                objectResult.error().code, MoQPublishError::TOO_FAR_BEHIND);
+
+            // The subscription is still open, publishing resumes at the next
+            // group
+            auto nextGroup = pub->beginSubgroup(1, 0, 0);
+            EXPECT_TRUE(nextGroup.hasValue());
+            EXPECT_TRUE(nextGroup.value()
+                            ->object(0, moxygen::test::makeBuf(10), {}, true)
+                            .hasValue());
+            pub->subscribeDone(getTrackEndedSubscribeDone(sub.requestID));
+          });
+        });
+    co_return makeSubscribeOkResult(sub);
+  });
+
+  expectSubscribeDone();
+  auto mockSubgroupConsumer =
+      std::make_shared<testing::StrictMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*subscribeCallback_, beginSubgroup(_, _, _))
+      .WillRepeatedly(testing::Return(mockSubgroupConsumer));
+  EXPECT_CALL(*mockSubgroupConsumer, object(_, _, _, _))
+      .WillRepeatedly(testing::Return(folly::unit));
+  EXPECT_CALL(*mockSubgroupConsumer, reset(_));
+  auto res = co_await clientSession_->subscribe(
+      getSubscribe(kTestTrackName), subscribeCallback_);
+  co_await subscribeDone_;
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
+CO_TEST_P_X(MoQSessionTest, SessionBufferDropsLowestPrioritySubgroup) {
+  co_await setupMoQSession();
+
+  MoQSettings moqSettings;
+  moqSettings.bufferingThresholds.perSession = 100;
+  serverSession_->setMoqSettings(moqSettings);
+
+  expectSubscribe([this](auto sub, auto pub) -> TaskSubscribeResult {
+    eventBase_.add(
+        [pub, sub, serverWt = serverWt_.get(), eventBase = &eventBase_] {
+          std::vector<std::shared_ptr<SubgroupConsumer>> subgroupConsumers;
+          for (uint32_t subgroupId = 0; subgroupId < 2; subgroupId++) {
+            subgroupConsumers.push_back(
+                pub->beginSubgroup(0, subgroupId, 0).value());
+            auto objectResult = subgroupConsumers[subgroupId]->object(
+                0, moxygen::test::makeBuf(10));
+            EXPECT_TRUE(objectResult.hasValue());
+          }
+
+          eventBase->add([pub, sub, serverWt, subgroupConsumers] {
+            serverWt->writeHandles[2]->setImmediateDelivery(false);
+            serverWt->writeHandles[6]->setImmediateDelivery(false);
+            auto objectResult =
+                subgroupConsumers[1]->object(1, moxygen::test::makeBuf(60));
+            EXPECT_TRUE(objectResult.hasValue());
+
+            // Over the session budget, subgroup 1 has lower precedence and
+            // is dropped to make room
+            objectResult =
+                subgroupConsumers[0]->object(1, moxygen::test::makeBuf(60));
+            EXPECT_TRUE(objectResult.hasValue());
+
+            objectResult =
+                subgroupConsumers[1]->object(2, moxygen::test::makeBuf(10));
+            EXPECT_TRUE(objectResult.hasError());
+            EXPECT_EQ(
+                objectResult.error().code, MoQPublishError::TOO_FAR_BEHIND);
+
+            serverWt->writeHandles[2]->deliverInflightData();
+            pub->subscribeDone(getTrackEndedSubscribeDone(sub.requestID));
+          });
+        });
+    co_return makeSubscribeOkResult(sub);
+  });
+
+  expectSubscribeDone();
+  auto mockSubgroupConsumer =
+      std::make_shared<testing::StrictMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*subscribeCallback_, beginSubgroup(_, _, _))
+      .WillRepeatedly(testing::Return(mockSubgroupConsumer));
+  EXPECT_CALL(*mockSubgroupConsumer, object(_, _, _, _))
+      .WillRepeatedly(testing::Return(folly::unit));
+  EXPECT_CALL(*mockSubgroupConsumer, reset(_)).Times(2);
+  auto res = co_await clientSession_->subscribe(
+      getSubscribe(kTestTrackName), subscribeCallback_);
+  co_await subscribeDone_;
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
+CO_TEST_P_X(MoQSessionTest, DeliveryTimeoutDropsLateSubgroup) {
+  co_await setupMoQSession();
+  auto now = std::make_shared<std::chrono::steady_clock::time_point>(
+      std::chrono::steady_clock::now());
+  serverSession_->setClock([now] { return *now; });
+
+  expectSubscribe([this, now](auto sub, auto pub) -> TaskSubscribeResult {
+    eventBase_.add([pub, sub, now, serverWt = serverWt_.get()] {
+      auto subgroup0 = pub->beginSubgroup(0, 0, 0).value();
+      EXPECT_TRUE(subgroup0->object(0, moxygen::test::makeBuf(10)).hasValue());
+      serverWt->writeHandles[2]->setImmediateDelivery(false);
+      EXPECT_TRUE(subgroup0->object(1, moxygen::test::makeBuf(10)).hasValue());
+
+      // Object 1 is older than the 100ms delivery timeout when the next
+      // subgroup begins, so subgroup 0 is dropped
+      *now += std::chrono::milliseconds(200);
+      auto subgroup1 = pub->beginSubgroup(0, 1, 0).value();
+      auto objectResult = subgroup0->object(2, moxygen::test::makeBuf(10));
+      EXPECT_TRUE(objectResult.hasError());
+      EXPECT_EQ(objectResult.error().code, MoQPublishError::TOO_FAR_BEHIND);
+
+      EXPECT_TRUE(subgroup1->object(0, moxygen::test::makeBuf(10)).hasValue());
+      pub->subscribeDone(getTrackEndedSubscribeDone(sub.requestID));
+    });
+    co_return makeSubscribeOkResult(sub);
+  });
+
+  expectSubscribeDone();
+  auto mockSubgroupConsumer =
+      std::make_shared<testing::NiceMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*subscribeCallback_, beginSubgroup(_, _, _))
+      .WillRepeatedly(testing::Return(mockSubgroupConsumer));
+  EXPECT_CALL(*mockSubgroupConsumer, object(_, _, _, _))
+      .WillRepeatedly(testing::Return(folly::unit));
+  EXPECT_CALL(*mockSubgroupConsumer, reset(_)).Times(testing::AtLeast(1));
+  auto subscribeRequest = getSubscribe(kTestTrackName);
+  subscribeRequest.params.push_back(
+      {getDeliveryTimeoutParamKey(getServerSelectedVersion()), "", 100, {}});
+  auto res =
+      co_await clientSession_->subscribe(subscribeRequest, subscribeCallback_);
+  co_await subscribeDone_;
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
+CO_TEST_P_X(MoQSessionTest, DeliveryTimeoutResetsStalledSubgroup) {
+  co_await setupMoQSession();
+  auto now = std::make_shared<std::chrono::steady_clock::time_point>(
+      std::chrono::steady_clock::now());
+  serverSession_->setClock([now] { return *now; });
+  std::shared_ptr<TrackConsumer> publisher;
+  RequestID requestID;
+
+  expectSubscribe(
+      [this, now, &publisher, &requestID](
+          auto sub, auto pub) -> TaskSubscribeResult {
+        publisher = pub;
+        requestID = sub.requestID;
+        eventBase_.add([pub, now, serverWt = serverWt_.get()] {
+          auto subgroup = pub->beginSubgroup(0, 0, 0).value();
+          serverWt->writeHandles[2]->setImmediateDelivery(false);
+          EXPECT_TRUE(
+              subgroup->object(0, moxygen::test::makeBuf(10)).hasValue());
+          // Nothing more is written, the delivery timer resets the stream
+          *now += std::chrono::milliseconds(200);
+        });
+        co_return makeSubscribeOkResult(sub);
+      });
+
+  expectSubscribeDone();
+  auto mockSubgroupConsumer =
+      std::make_shared<testing::NiceMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*subscribeCallback_, beginSubgroup(_, _, _))
+      .WillRepeatedly(testing::Return(mockSubgroupConsumer));
+  folly::coro::Baton reset;
+  EXPECT_CALL(*mockSubgroupConsumer, reset(_))
+      .WillOnce(testing::Invoke([&reset](auto) { reset.post(); }));
+  auto subscribeRequest = getSubscribe(kTestTrackName);
+  subscribeRequest.params.push_back(
+      {getDeliveryTimeoutParamKey(getServerSelectedVersion()), "", 100, {}});
+  auto res =
+      co_await clientSession_->subscribe(subscribeRequest, subscribeCallback_);
+  co_await reset;
+  publisher->subscribeDone(getTrackEndedSubscribeDone(requestID));
+  co_await subscribeDone_;
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
+CO_TEST_P_X(MoQSessionTest, SubscribeConsumerBackpressure) {
+  co_await setupMoQSession();
+  auto readyPromise = std::make_shared<folly::Promise<folly::Unit>>();
+  auto ready = std::make_shared<bool>(false);
+
+  expectSubscribe(
+      [this, readyPromise, ready](auto sub, auto pub) -> TaskSubscribeResult {
+        eventBase_.add([this, pub, sub, readyPromise, ready] {
+          auto subgroup = pub->beginSubgroup(0, 0, 0).value();
+          EXPECT_TRUE(subgroup->object(0, moxygen::test::makeBuf(10)));
+          eventBase_.add([this, pub, sub, subgroup, readyPromise, ready] {
+            // Buffered in the transport while the subscriber is blocked
+            EXPECT_TRUE(subgroup->object(1, moxygen::test::makeBuf(10)));
+            EXPECT_TRUE(subgroup->endOfSubgroup());
+            eventBase_.add([pub, sub, readyPromise, ready] {
+              *ready = true;
+              readyPromise->setValue();
+              pub->subscribeDone(getTrackEndedSubscribeDone(sub.requestID));
+            });
+          });
+        });
+        co_return makeSubscribeOkResult(sub);
+      });
+
+  expectSubscribeDone();
+  auto mockSubgroupConsumer =
+      std::make_shared<testing::StrictMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*subscribeCallback_, beginSubgroup(0, 0, _))
+      .WillOnce(testing::Return(mockSubgroupConsumer));
+  EXPECT_CALL(*mockSubgroupConsumer, object(0, _, _, _))
+      .WillOnce(testing::Return(folly::makeUnexpected(
+          MoQPublishError(MoQPublishError::BLOCKED))));
+  EXPECT_CALL(*mockSubgroupConsumer, awaitReadyToConsume())
+      .WillOnce([readyPromise] { return readyPromise->getSemiFuture(); });
+  EXPECT_CALL(*mockSubgroupConsumer, object(1, _, _, _))
+      .WillOnce([ready](auto, auto, auto, auto) {
+        EXPECT_TRUE(*ready);
+        return folly::unit;
+      });
+  EXPECT_CALL(*mockSubgroupConsumer, endOfSubgroup())
+      .WillOnce(testing::Return(folly::unit));
+  auto res = co_await clientSession_->subscribe(
+      getSubscribe(kTestTrackName), subscribeCallback_);
+  co_await subscribeDone_;
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
+CO_TEST_P_X(MoQSessionTest, WriteCoalescing) {
+  co_await setupMoQSession();
+  MoQSettings moqSettings;
+  moqSettings.writeCoalescing.maxDelay = std::chrono::seconds(1);
+  serverSession_->setMoqSettings(moqSettings);
+
+  expectSubscribe([this](auto sub, auto pub) -> TaskSubscribeResult {
+    eventBase_.add([this, pub, sub] {
+      // Held until the end of the loop iteration
+      auto subgroup = pub->beginSubgroup(0, 0, 0).value();
+      for (uint64_t id = 0; id < 3; id++) {
+        EXPECT_TRUE(subgroup->object(id, moxygen::test::makeBuf(10)));
+      }
+      eventBase_.add([pub, sub, subgroup] {
+        // Over maxBytes, written right away
+        EXPECT_TRUE(subgroup->object(
+            3, moxygen::test::makeBuf(MoQSettings().writeCoalescing.maxBytes)));
+        EXPECT_TRUE(subgroup->endOfSubgroup());
+        pub->subscribeDone(getTrackEndedSubscribeDone(sub.requestID));
+      });
+    });
+    co_return makeSubscribeOkResult(sub);
+  });
+
+  expectSubscribeDone();
+  auto mockSubgroupConsumer =
+      std::make_shared<testing::StrictMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*subscribeCallback_, beginSubgroup(0, 0, _))
+      .WillOnce(testing::Return(mockSubgroupConsumer));
+  {
+    testing::InSequence seq;
+    for (uint64_t id = 0; id < 4; id++) {
+      EXPECT_CALL(*mockSubgroupConsumer, object(id, _, _, _))
+          .WillOnce(testing::Return(folly::unit));
+    }
+    EXPECT_CALL(*mockSubgroupConsumer, endOfSubgroup())
+        .WillOnce(testing::Return(folly::unit));
+  }
+  auto res = co_await clientSession_->subscribe(
+      getSubscribe(kTestTrackName), subscribeCallback_);
+  co_await subscribeDone_;
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
+CO_TEST_P_X(MoQSessionTest, ObjectsBatch) {
+  co_await setupMoQSession();
+  expectSubscribe([this](auto sub, auto pub) -> TaskSubscribeResult {
+    eventBase_.add([pub, sub] {
+      auto subgroup = pub->beginSubgroup(0, 0, 0).value();
+      std::vector<SubgroupObject> batch;
+      for (uint64_t id = 0; id < 3; id++) {
+        batch.push_back({id, moxygen::test::makeBuf(10), {}});
+      }
+      EXPECT_TRUE(subgroup->objects(batch, /*finSubgroup=*/true));
+      pub->subscribeDone(getTrackEndedSubscribeDone(sub.requestID));
+    });
+    co_return makeSubscribeOkResult(sub);
+  });
+
+  expectSubscribeDone();
+  auto mockSubgroupConsumer =
+      std::make_shared<testing::StrictMock<MockSubgroupConsumer>>();
+  EXPECT_CALL(*subscribeCallback_, beginSubgroup(0, 0, _))
+      .WillOnce(testing::Return(mockSubgroupConsumer));
+  {
+    testing::InSequence seq;
+    for (uint64_t id = 0; id < 3; id++) {
+      EXPECT_CALL(*mockSubgroupConsumer, object(id, _, _, _))
+          .WillOnce(testing::Return(folly::unit));
+    }
+    EXPECT_CALL(*mockSubgroupConsumer, endOfSubgroup())
+        .WillOnce(testing::Return(folly::unit));
+  }
+  auto res = co_await clientSession_->subscribe(
+      getSubscribe(kTestTrackName), subscribeCallback_);
+  co_await subscribeDone_;
+  clientSession_->close(SessionCloseErrorCode::NO_ERROR);
+}
+
 CO_TEST_P_X(MoQSessionTest, PublisherAliveUntilAllBytesDelivered) {
   co_await setupMoQSession();
   folly::coro::Baton barricade;
@@ -1962,6 +2673,109 @@ CO_TEST_P_X(MoQSessionTest, Goaway) {
   subscribeHandler->unsubscribe();
 }
 
+CO_TEST_P_X(MoQSessionTest, ServerGoawayKeepsPublishing) {
+  co_await setupMoQSession();
+  expectSubscribe([](auto sub, auto /* pub */) -> TaskSubscribeResult {
+    co_return makeSubscribeOkResult(sub, AbsoluteLocation{0, 0});
+  });
+  auto res = co_await clientSession_->subscribe(
+      getSubscribe(kTestTrackName), subscribeCallback_);
+  EXPECT_FALSE(res.hasError());
+
+  folly::coro::Baton goawayBaton;
+  EXPECT_CALL(*clientPublisher, goaway(_))
+      .WillOnce(testing::Invoke([&goawayBaton](auto goaway) -> void {
+        EXPECT_EQ(goaway.newSessionUri, "https://other/moq-relay");
+        goawayBaton.post();
+      }));
+  serverSession_->goaway(Goaway{"https://other/moq-relay"});
+  co_await goawayBaton;
+  // The client still has a subscription to move
+  EXPECT_FALSE(serverWt_->isSessionClosed());
+
+  res.value()->unsubscribe();
+  co_await folly::coro::co_reschedule_on_current_executor;
+  EXPECT_TRUE(serverWt_->isSessionClosed());
+}
+
+CO_TEST_P_X(MoQSessionTest, ServerGoawayClosesWhenTrackEnds) {
+  co_await setupMoQSession();
+  std::shared_ptr<TrackConsumer> publisher;
+  expectSubscribe([&publisher](auto sub, auto pub) -> TaskSubscribeResult {
+    publisher = pub;
+    co_return makeSubscribeOkResult(sub, AbsoluteLocation{0, 0});
+  });
+  auto res = co_await clientSession_->subscribe(
+      getSubscribe(kTestTrackName), subscribeCallback_);
+  EXPECT_FALSE(res.hasError());
+
+  folly::coro::Baton goawayBaton;
+  EXPECT_CALL(*clientPublisher, goaway(_))
+      .WillOnce(testing::Invoke(
+          [&goawayBaton](auto /* goaway */) -> void { goawayBaton.post(); }));
+  serverSession_->goaway(Goaway{""});
+  co_await goawayBaton;
+  EXPECT_FALSE(serverWt_->isSessionClosed());
+
+  // The publisher ending its last track lets the drain finish
+  EXPECT_CALL(*serverPublisherStatsCallback_, onSubscribeDone(_));
+  EXPECT_CALL(*subscribeCallback_, subscribeDone(_))
+      .Times(testing::AtMost(1))
+      .WillRepeatedly(testing::Return(folly::unit));
+  publisher->subscribeDone(getTrackEndedSubscribeDone(RequestID(0)));
+  co_await folly::coro::co_reschedule_on_current_executor;
+  EXPECT_TRUE(serverWt_->isSessionClosed());
+}
+
+namespace {
+class TestTransportMetricsCallback
+    : public MoQSession::TransportMetricsCallback {
+ public:
+  void onTransportMetrics(const MoQTransportMetrics& metrics) override {
+    last = metrics;
+    notified.post();
+  }
+
+  folly::Optional<MoQTransportMetrics> last;
+  folly::coro::Baton notified;
+};
+} // namespace
+
+CO_TEST_P_X(MoQSessionTest, TransportMetricsCallbacks) {
+  co_await setupMoQSession();
+  EXPECT_FALSE(serverSession_->getTransportMetrics().hasValue());
+  MoQTransportMetrics metrics;
+  metrics.srtt = std::chrono::milliseconds(20);
+  metrics.congestionWindow = 25000;
+  metrics.packetsSent = 100;
+  serverSession_->setTransportMetricsProvider(
+      [&metrics]() -> folly::Optional<MoQTransportMetrics> {
+        return metrics;
+      });
+  EXPECT_EQ(serverSession_->getTransportMetrics()->congestionWindow, 25000);
+  // 25000 bytes per 20ms
+  EXPECT_EQ(metrics.estimatedSendRateBps(), 10000000);
+
+  EXPECT_CALL(*serverPublisherStatsCallback_, recordTransportMetrics(_))
+      .Times(testing::AtLeast(2));
+  auto callback = std::make_shared<TestTransportMetricsCallback>();
+  serverSession_->addTransportMetricsCallback(callback);
+  serverSession_->setTransportMetricsInterval(std::chrono::milliseconds(1));
+  co_await callback->notified;
+  EXPECT_EQ(callback->last->srtt, std::chrono::milliseconds(20));
+
+  // Loss is always reported
+  callback->notified.reset();
+  metrics.packetsLost = 10;
+  co_await callback->notified;
+  EXPECT_EQ(callback->last->packetsLost, 10);
+  EXPECT_EQ(callback->last->estimatedSendRateBps(), 9000000);
+
+  serverSession_->removeTransportMetricsCallback(callback.get());
+  serverSession_->setTransportMetricsInterval(std::chrono::milliseconds(0));
+  co_await folly::coro::co_reschedule_on_current_executor;
+}
+
 CO_TEST_P_X(MoQSessionTest, UniStreamBeforeSetup) {
   EXPECT_FALSE(clientWt_->isSessionClosed());
   serverWt_->createUniStream();
@@ -109,3 +109,33 @@ TEST_F(MoQTokenCacheTest, GetAliasForEvictionSuccess) {
   EXPECT_EQ(result, alias2);           // Evict the 2nd inserted token
   EXPECT_EQ(cache_.getTotalSize(), 0); // Verify size is reduced
 }
+
+TEST_F(MoQTokenCacheTest, GetAliasForTokenRefreshesLru) {
+  MoQTokenCache cache{64};
+  auto alias1 = cache.registerToken(tokenType_, "token1").value();
+  auto alias2 = cache.registerToken(tokenType_, "token2").value();
+  auto alias3 = cache.registerToken(tokenType_, "token3").value();
+
+  // Same value, different type
+  EXPECT_TRUE(cache.getAliasForToken(2, "token1").hasError());
+  EXPECT_EQ(cache.getAliasForToken(tokenType_, "token1").value(), alias1);
+
+  EXPECT_EQ(cache.evictOne(), alias2);
+  EXPECT_TRUE(cache.getAliasForToken(tokenType_, "token2").hasError());
+  EXPECT_EQ(cache.evictOne(), alias3);
+  EXPECT_EQ(cache.evictOne(), alias1);
+  EXPECT_TRUE(cache.getAliasForToken(tokenType_, "token1").hasError());
+  EXPECT_EQ(cache.getTotalSize(), 0);
+}
+
+TEST_F(MoQTokenCacheTest, SameTokenUnderTwoAliases) {
+  MoQTokenCache cache{36};
+  EXPECT_TRUE(cache.registerToken(5, tokenType_, makeToken()));
+  EXPECT_TRUE(cache.registerToken(7, tokenType_, makeToken()));
+  EXPECT_EQ(cache.getAliasForToken(tokenType_, makeToken()).value(), 5);
+  // Deleting the other alias leaves the indexed one
+  EXPECT_TRUE(cache.deleteToken(7));
+  EXPECT_EQ(cache.getAliasForToken(tokenType_, makeToken()).value(), 5);
+  EXPECT_TRUE(cache.deleteToken(5));
+  EXPECT_TRUE(cache.getAliasForToken(tokenType_, makeToken()).hasError());
+}
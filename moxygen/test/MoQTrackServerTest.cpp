@@ -15,7 +15,7 @@ const moxygen::TrackAlias kDefaultTrackAlias = moxygen::TrackAlias(0);
 class MoQTrackServerTest : public testing::Test {
  public:
   void CreateDefaultTrackNamespace() {
-    track_.trackNamespace = {
+    track_ = moxygen::TrackNamespace({
         "moq-test-00",
         "0",
         "0",
@@ -31,7 +31,7 @@ class MoQTrackServerTest : public testing::Test {
         "0",
         "0",
         "0",
-        "0"};
+        "0"});
   }
 
   void CreateDefaultMoQTestParameters() {
@@ -65,7 +65,7 @@ TEST_F(
     TestSubscribeFunctionReturnsSubscribeErrorWithInvalidParams) {
   moxygen::SubscribeRequest req;
   MoQTrackServerTest::CreateDefaultTrackNamespace();
-  track_.trackNamespace[0] = "invalid";
+  track_.set(0, "invalid");
   req.requestID = 0;
   req.fullTrackName.trackNamespace = track_;
   req.trackAlias = kDefaultTrackAlias;
@@ -487,7 +487,7 @@ TEST_F(
     TestFetchFunctionReturnsSubscribeErrorWithInvalidParams) {
   moxygen::Fetch req;
   MoQTrackServerTest::CreateDefaultTrackNamespace();
-  track_.trackNamespace[0] = "invalid";
+  track_.set(0, "invalid");
   req.requestID = 0;
   req.fullTrackName.trackNamespace = track_;
 
@@ -812,7 +812,7 @@ TEST_F(
     ValidateFetchWithForwardPreferenceThreeReturnsError) {
   moxygen::Fetch req;
   MoQTrackServerTest::CreateDefaultTrackNamespace();
-  track_.trackNamespace[1] = "3";
+  track_.set(1, "3");
   req.requestID = 0;
   req.fullTrackName.trackNamespace = track_;
 
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <folly/synchronization/Baton.h>
+#include <moxygen/stats/MoQSessionStats.h>
+#include <moxygen/stats/MoQTrackStats.h>
+#include <moxygen/stats/PrometheusWriter.h>
+
+#include <thread>
+
+using namespace moxygen;
+
+TEST(MoQHistogramTest, Buckets) {
+  // Small values are exact
+  for (uint64_t v = 0; v < MoQHistogram::kSubBuckets; v++) {
+    EXPECT_EQ(MoQHistogram::bucketIndex(v), v);
+    EXPECT_EQ(MoQHistogram::bucketUpperBound(v), v);
+  }
+  // Every value lands in a bucket that covers it, and buckets are ordered
+  for (uint64_t v : std::initializer_list<uint64_t>{
+           32, 33, 63, 64, 1000, 123456789, ~uint64_t(0)}) {
+    auto index = MoQHistogram::bucketIndex(v);
+    ASSERT_LT(index, MoQHistogram::kNumBuckets);
+    EXPECT_GE(MoQHistogram::bucketUpperBound(index), v);
+    EXPECT_LT(MoQHistogram::bucketUpperBound(index - 1), v);
+    EXPECT_LE(
+        MoQHistogram::bucketUpperBound(index) - v,
+        v / (MoQHistogram::kSubBuckets / 2));
+  }
+  EXPECT_EQ(
+      MoQHistogram::bucketIndex(~uint64_t(0)), MoQHistogram::kNumBuckets - 1);
+}
+
+TEST(MoQHistogramTest, Percentile) {
+  MoQHistogram histogram;
+  EXPECT_EQ(histogram.percentile(50), 0);
+  for (uint64_t v = 1; v <= 100; v++) {
+    histogram.record(v);
+  }
+  EXPECT_EQ(histogram.count(), 100);
+  EXPECT_EQ(histogram.sum(), 5050);
+  EXPECT_EQ(histogram.percentile(0), 1);
+  EXPECT_EQ(histogram.percentile(10), 10);
+  auto p50 = histogram.percentile(50);
+  EXPECT_GE(p50, 50);
+  EXPECT_LE(p50, 53);
+  auto p100 = histogram.percentile(100);
+  EXPECT_GE(p100, 100);
+  EXPECT_LE(p100, 103);
+
+  MoQHistogram merged(histogram);
+  merged.merge(histogram);
+  EXPECT_EQ(merged.count(), 200);
+  EXPECT_EQ(merged.sum(), 10100);
+  EXPECT_EQ(merged.percentile(50), p50);
+}
+
+TEST(MoQTrackStatsTest, SnapshotSumsThreads) {
+  const FullTrackName track1{TrackNamespace({"ns"}), "track1"};
+  const FullTrackName track2{TrackNamespace({"ns"}), "track2"};
+  MoQTrackStats stats;
+  auto record = [&] {
+    stats.onObjectSent(track1, 100);
+    stats.onObjectSent(track1, 50);
+    stats.onObjectReceived(track2, 10);
+    stats.onSubgroupDropped(track1, 1000);
+    stats.onTooFarBehind(track1);
+    stats.recordForwardLatency(track1, 20);
+    stats.recordStreamCreditStall(track1, 5000);
+    stats.recordBufferedBytes(track1, 1200);
+  };
+  record();
+  folly::Baton<> recorded;
+  folly::Baton<> done;
+  std::thread other([&] {
+    record();
+    recorded.post();
+    // Counts are dropped when the thread exits
+    done.wait();
+  });
+  recorded.wait();
+  auto snapshot = stats.snapshot();
+  done.post();
+  other.join();
+
+  ASSERT_EQ(snapshot.tracks.size(), 2);
+  const auto& counters1 = snapshot.tracks.at(track1);
+  EXPECT_EQ(counters1.objectsOut, 4);
+  EXPECT_EQ(counters1.bytesOut, 300);
+  EXPECT_EQ(counters1.objectsIn, 0);
+  EXPECT_EQ(counters1.tooFarBehind, 2);
+  EXPECT_EQ(counters1.subgroupsDropped, 2);
+  EXPECT_EQ(counters1.bytesDropped, 2000);
+  const auto& counters2 = snapshot.tracks.at(track2);
+  EXPECT_EQ(counters2.objectsIn, 2);
+  EXPECT_EQ(counters2.bytesIn, 20);
+  EXPECT_EQ(snapshot.forwardLatencyUsec.count(), 2);
+  EXPECT_EQ(snapshot.forwardLatencyUsec.percentile(50), 20);
+  EXPECT_EQ(snapshot.streamCreditStallUsec.count(), 2);
+  EXPECT_EQ(snapshot.bufferedBytes.count(), 2);
+}
+
+TEST(MoQSessionStatsTest, SnapshotCountsRoles) {
+  MoQSessionStats stats;
+  auto publisher = stats.publisherStatsCallback();
+  auto subscriber = stats.subscriberStatsCallback();
+  publisher->onSubscribeSuccess();
+  publisher->onSubscribeSuccess();
+  publisher->recordAnnounceLatency(7);
+  subscriber->onSubscribeError(SubscribeErrorCode::TRACK_NOT_EXIST);
+  subscriber->recordSubscribeLatency(3);
+
+  auto snapshot = stats.snapshot();
+  auto index = [](MoQSessionStats::Event event) { return size_t(event); };
+  using Event = MoQSessionStats::Event;
+  EXPECT_EQ(snapshot.publisherEvents[index(Event::SubscribeSuccess)], 2);
+  EXPECT_EQ(snapshot.subscriberEvents[index(Event::SubscribeSuccess)], 0);
+  EXPECT_EQ(snapshot.subscriberEvents[index(Event::SubscribeError)], 1);
+  EXPECT_EQ(snapshot.announceLatencyMsec.percentile(50), 7);
+  EXPECT_EQ(snapshot.subscribeLatencyMsec.count(), 1);
+  EXPECT_EQ(snapshot.fetchLatencyMsec.count(), 0);
+  EXPECT_STREQ(
+      MoQSessionStats::eventName(Event::SubscribeAnnouncesError),
+      "subscribe_announces_error");
+}
+
+TEST(PrometheusWriterTest, Format) {
+  PrometheusWriter out;
+  out.declare("moq_objects_total", PrometheusWriter::Type::Counter, "Objects");
+  out.sample("moq_objects_total", uint64_t(5), {{"dir", "in"}});
+  out.sample("moq_objects_total", uint64_t(6), {{"dir", "a\"b\\"}});
+  out.declare("moq_ratio", PrometheusWriter::Type::Gauge, "Ratio");
+  out.sample("moq_ratio", 0.5);
+  MoQHistogram histogram;
+  histogram.record(4);
+  out.declare("moq_latency", PrometheusWriter::Type::Summary, "Latency");
+  out.summary("moq_latency", histogram);
+  EXPECT_EQ(
+      out.str(),
+      "# HELP moq_objects_total Objects\n"
+      "# TYPE moq_objects_total counter\n"
+      "moq_objects_total{dir=\"in\"} 5\n"
+      "moq_objects_total{dir=\"a\\\"b\\\\\"} 6\n"
+      "# HELP moq_ratio Ratio\n"
+      "# TYPE moq_ratio gauge\n"
+      "moq_ratio 0.5\n"
+      "# HELP moq_latency Latency\n"
+      "# TYPE moq_latency summary\n"
+      "moq_latency{quantile=\"0.5\"} 4\n"
+      "moq_latency{quantile=\"0.9\"} 4\n"
+      "moq_latency{quantile=\"0.99\"} 4\n"
+      "moq_latency{quantile=\"0.999\"} 4\n"
+      "moq_latency_sum 4\n"
+      "moq_latency_count 1\n");
+}
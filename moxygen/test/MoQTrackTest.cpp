@@ -9,7 +9,7 @@ namespace {
 class MoQTrackTest : public testing::Test {
  public:
   void CreatDefaultTrackNamespace() {
-    track_.trackNamespace = {
+    track_ = moxygen::TrackNamespace({
         "moq-test-00",
         "0",
         "0",
@@ -25,7 +25,7 @@ class MoQTrackTest : public testing::Test {
         "0",
         "-1",
         "-1",
-        "0"};
+        "0"});
   }
 
   void CreateDefaultMoQTestParameters() {
@@ -128,28 +128,28 @@ TEST_F(
     MoQTrackTest,
     testConvertTrackNamespaceToMoQTestParametersWithInvalidProtocol) {
   CreatDefaultTrackNamespace();
-  track_.trackNamespace[0] = "moq-test-01";
+  track_.set(0, "moq-test-01");
   auto params = moxygen::convertTrackNamespaceToMoqTestParam(&track_);
   EXPECT_TRUE(params.hasError());
 }
 
 TEST_F(MoQTrackTest, testConversionGivenTrackNamespaceWithInvalidLength) {
   CreatDefaultTrackNamespace();
-  track_.trackNamespace.resize(15);
+  track_.trimEnd();
   auto params = moxygen::convertTrackNamespaceToMoqTestParam(&track_);
   EXPECT_TRUE(params.hasError());
 }
 
 TEST_F(MoQTrackTest, testConversionWithInvalidEndParams) {
   CreatDefaultTrackNamespace();
-  track_.trackNamespace[1] = "4";
+  track_.set(1, "4");
   auto params = moxygen::convertTrackNamespaceToMoqTestParam(&track_);
   EXPECT_TRUE(params.hasError());
 }
 
 TEST_F(MoQTrackTest, testConversionWithTrackNamespaceHavingNonDigitValues) {
   CreatDefaultTrackNamespace();
-  track_.trackNamespace[1] = "a";
+  track_.set(1, "a");
   auto params = moxygen::convertTrackNamespaceToMoqTestParam(&track_);
   EXPECT_TRUE(params.hasError());
 }
@@ -159,23 +159,23 @@ TEST_F(MoQTrackTest, testConvertMoQTestParametersToTrackNamespace) {
   CreateDefaultMoQTestParameters();
   auto track = moxygen::convertMoqTestParamToTrackNamespace(&params_);
   ASSERT_FALSE(track.hasError());
-  EXPECT_EQ(track.value().trackNamespace.size(), 16);
-  EXPECT_EQ(track.value().trackNamespace[0], "moq-test-00");
-  EXPECT_EQ(track.value().trackNamespace[1], "0");
-  EXPECT_EQ(track.value().trackNamespace[2], "0");
-  EXPECT_EQ(track.value().trackNamespace[3], "0");
-  EXPECT_EQ(track.value().trackNamespace[4], "10");
-  EXPECT_EQ(track.value().trackNamespace[5], "1");
-  EXPECT_EQ(track.value().trackNamespace[6], "1");
-  EXPECT_EQ(track.value().trackNamespace[7], "1");
-  EXPECT_EQ(track.value().trackNamespace[8], "1");
-  EXPECT_EQ(track.value().trackNamespace[9], "1");
-  EXPECT_EQ(track.value().trackNamespace[10], "1");
-  EXPECT_EQ(track.value().trackNamespace[11], "1");
-  EXPECT_EQ(track.value().trackNamespace[12], "0");
-  EXPECT_EQ(track.value().trackNamespace[13], "-1");
-  EXPECT_EQ(track.value().trackNamespace[14], "-1");
-  EXPECT_EQ(track.value().trackNamespace[15], "0");
+  EXPECT_EQ(track.value().size(), 16);
+  EXPECT_EQ(track.value()[0], "moq-test-00");
+  EXPECT_EQ(track.value()[1], "0");
+  EXPECT_EQ(track.value()[2], "0");
+  EXPECT_EQ(track.value()[3], "0");
+  EXPECT_EQ(track.value()[4], "10");
+  EXPECT_EQ(track.value()[5], "1");
+  EXPECT_EQ(track.value()[6], "1");
+  EXPECT_EQ(track.value()[7], "1");
+  EXPECT_EQ(track.value()[8], "1");
+  EXPECT_EQ(track.value()[9], "1");
+  EXPECT_EQ(track.value()[10], "1");
+  EXPECT_EQ(track.value()[11], "1");
+  EXPECT_EQ(track.value()[12], "0");
+  EXPECT_EQ(track.value()[13], "-1");
+  EXPECT_EQ(track.value()[14], "-1");
+  EXPECT_EQ(track.value()[15], "0");
 }
 
 TEST_F(
@@ -186,3 +186,25 @@ TEST_F(
   auto track = moxygen::convertMoqTestParamToTrackNamespace(&params_);
   EXPECT_TRUE(track.hasError());
 }
+
+TEST_F(MoQTrackTest, testObjectsPerPriorityClass) {
+  CreateDefaultMoQTestParameters();
+  params_.forwardingPreference =
+      moxygen::ForwardingPreference::TWO_SUBGROUPS_PER_GROUP;
+  params_.lastObjectInTrack = 4;
+  EXPECT_EQ(moxygen::getPublisherPriority(0, 1, 1), moxygen::kDefaultPriority);
+  EXPECT_EQ(
+      moxygen::getPublisherPriority(0, 1, 2), moxygen::kDefaultPriority + 1);
+  // Even objects are on subgroup 0, and classes alternate by group
+  EXPECT_EQ(
+      moxygen::getObjectsPerPriorityClass(0, &params_, 2),
+      std::vector<uint64_t>({3, 2}));
+  EXPECT_EQ(
+      moxygen::getObjectsPerPriorityClass(1, &params_, 2),
+      std::vector<uint64_t>({2, 3}));
+  // The end of group marker has no payload
+  params_.sendEndOfGroupMarkers = true;
+  EXPECT_EQ(
+      moxygen::getObjectsPerPriorityClass(0, &params_, 2),
+      std::vector<uint64_t>({2, 2}));
+}
@@ -346,6 +346,13 @@ class MockPublisherStats : public MoQPublisherStatsCallback {
   MOCK_METHOD(void, onSubscribeDone, (SubscribeDoneStatusCode), (override));
 
   MOCK_METHOD(void, recordAnnounceLatency, (uint64_t), (override));
+
+  MOCK_METHOD(
+      void,
+      recordTransportMetrics,
+      (const MoQTransportMetrics&),
+      (override));
+  MOCK_METHOD(void, recordMemoryUsage, (const MoQMemoryUsage&), (override));
 };
 
 class MockSubscriberStats : public MoQSubscriberStatsCallback {
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <moxygen/ObjectReceiver.h>
+
+using namespace moxygen;
+
+namespace {
+class CollectingCallback : public ObjectReceiverCallback {
+ public:
+  FlowControlState onObject(const ObjectHeader&, Payload payload) override {
+    payloads.push_back(std::move(payload));
+    return FlowControlState::UNBLOCKED;
+  }
+  void onObjectStatus(const ObjectHeader&) override {}
+  void onEndOfStream() override {}
+  void onError(ResetStreamErrorCode) override {}
+  void onSubscribeDone(SubscribeDone) override {}
+
+  std::vector<Payload> payloads;
+};
+
+// Begins a 6 byte object and delivers it in three parts
+void receiveInParts(ObjectReceiver& receiver) {
+  auto subgroup = receiver.beginSubgroup(0, 0, 0).value();
+  EXPECT_TRUE(
+      subgroup->beginObject(0, 6, folly::IOBuf::copyBuffer("ab"), {})
+          .hasValue());
+  EXPECT_EQ(
+      subgroup->objectPayload(folly::IOBuf::copyBuffer("cd"), false).value(),
+      ObjectPublishStatus::IN_PROGRESS);
+  EXPECT_EQ(
+      subgroup->objectPayload(folly::IOBuf::copyBuffer("ef"), false).value(),
+      ObjectPublishStatus::DONE);
+}
+} // namespace
+
+TEST(ObjectReceiverTest, ChainedPayload) {
+  auto callback = std::make_shared<CollectingCallback>();
+  ObjectReceiver receiver(ObjectReceiver::SUBSCRIBE, callback);
+  receiveInParts(receiver);
+  ASSERT_EQ(callback->payloads.size(), 1);
+  EXPECT_TRUE(callback->payloads[0]->isChained());
+  EXPECT_EQ(callback->payloads[0]->moveToFbString().toStdString(), "abcdef");
+}
+
+TEST(ObjectReceiverTest, ContiguousPayload) {
+  auto callback = std::make_shared<CollectingCallback>();
+  ObjectReceiver receiver(ObjectReceiver::SUBSCRIBE, callback);
+  receiver.setContiguousPayloads(true);
+  receiveInParts(receiver);
+  ASSERT_EQ(callback->payloads.size(), 1);
+  auto& payload = callback->payloads[0];
+  EXPECT_FALSE(payload->isChained());
+  EXPECT_EQ(payload->moveToFbString().toStdString(), "abcdef");
+}
+
+TEST(ObjectReceiverTest, ContiguousPayloadHugeLength) {
+  auto callback = std::make_shared<CollectingCallback>();
+  ObjectReceiver receiver(ObjectReceiver::SUBSCRIBE, callback);
+  receiver.setContiguousPayloads(true);
+  auto subgroup = receiver.beginSubgroup(0, 0, 0).value();
+  // Nothing is allocated for the claimed length, the object is chained
+  EXPECT_TRUE(subgroup
+                  ->beginObject(
+                      0, uint64_t(1) << 40, folly::IOBuf::copyBuffer("ab"), {})
+                  .hasValue());
+  auto res = subgroup->objectPayload(folly::IOBuf::copyBuffer("cd"), false);
+  ASSERT_TRUE(res.hasValue());
+  EXPECT_EQ(res.value(), ObjectPublishStatus::IN_PROGRESS);
+  EXPECT_TRUE(callback->payloads.empty());
+}
+
+TEST(ObjectReceiverTest, ContiguousPayloadTooLong) {
+  auto callback = std::make_shared<CollectingCallback>();
+  ObjectReceiver receiver(ObjectReceiver::SUBSCRIBE, callback);
+  receiver.setContiguousPayloads(true);
+  auto subgroup = receiver.beginSubgroup(0, 0, 0).value();
+  EXPECT_TRUE(
+      subgroup->beginObject(0, 3, folly::IOBuf::copyBuffer("ab"), {})
+          .hasValue());
+  EXPECT_TRUE(
+      subgroup->objectPayload(folly::IOBuf::copyBuffer("cd"), false)
+          .hasError());
+  EXPECT_TRUE(callback->payloads.empty());
+}
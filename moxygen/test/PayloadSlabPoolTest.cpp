@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <moxygen/util/PayloadSlabPool.h>
+
+using namespace moxygen;
+
+TEST(PayloadSlabPoolTest, PacksCopiesInOneSlab) {
+  PayloadSlabPool pool(4096);
+  auto chain = folly::IOBuf::copyBuffer("abc");
+  chain->appendChain(folly::IOBuf::copyBuffer("def"));
+  auto a = pool.copy(*chain);
+  auto b = pool.copy(*chain);
+  ASSERT_TRUE(a && b);
+  EXPECT_FALSE(a->isChained());
+  EXPECT_EQ(a->clone()->moveToFbString().toStdString(), "abcdef");
+  // Both in the first slab, b at the next cache line
+  EXPECT_EQ(pool.slabBytes(), 4096);
+  EXPECT_EQ(b->data() - a->data(), PayloadSlabPool::kAlignment);
+  EXPECT_EQ(
+      reinterpret_cast<uintptr_t>(a->data()) % PayloadSlabPool::kAlignment, 0);
+}
+
+TEST(PayloadSlabPoolTest, TooLargeOrEmptyIsNotCopied) {
+  PayloadSlabPool pool(4096);
+  auto large = folly::IOBuf::create(pool.maxPayloadSize() + 1);
+  large->append(pool.maxPayloadSize() + 1);
+  EXPECT_EQ(pool.copy(*large), nullptr);
+  EXPECT_EQ(pool.copy(*folly::IOBuf::create(0)), nullptr);
+  EXPECT_EQ(pool.slabBytes(), 0);
+}
+
+TEST(PayloadSlabPoolTest, SlabsOutliveThePool) {
+  auto buf = folly::IOBuf::copyBuffer(std::string(100, 'x'));
+  std::unique_ptr<folly::IOBuf> copy;
+  {
+    PayloadSlabPool pool(4096);
+    copy = pool.copy(*buf);
+    // Fill the slab, the next copy starts another
+    while (pool.slabBytes() == 4096) {
+      pool.copy(*buf);
+    }
+    EXPECT_EQ(pool.slabBytes(), 2 * 4096);
+  }
+  EXPECT_EQ(copy->moveToFbString().toStdString(), std::string(100, 'x'));
+  copy.reset();
+}
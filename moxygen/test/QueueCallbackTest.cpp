@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <moxygen/QueueCallback.h>
+
+#include <thread>
+
+using namespace moxygen;
+
+namespace {
+ObjectHeader header(uint64_t objectID) {
+  return ObjectHeader(TrackAlias(0), 0, 0, objectID, 0);
+}
+} // namespace
+
+TEST(BoundedQueueCallbackTest, BlocksAtHighWatermark) {
+  BoundedQueueCallback callback(8, 4, 2);
+  for (uint64_t i = 0; i < 3; i++) {
+    EXPECT_EQ(
+        callback.onObject(header(i), folly::IOBuf::copyBuffer("x")),
+        ObjectReceiverCallback::FlowControlState::UNBLOCKED);
+  }
+  EXPECT_EQ(
+      callback.onObject(header(3), folly::IOBuf::copyBuffer("x")),
+      ObjectReceiverCallback::FlowControlState::BLOCKED);
+  auto ready = callback.awaitReadyToConsume();
+  EXPECT_FALSE(ready.isReady());
+
+  BoundedQueueCallback::Item item;
+  ASSERT_TRUE(callback.tryDequeue(item));
+  EXPECT_EQ(item->header.id, 0);
+  EXPECT_FALSE(ready.isReady());
+  ASSERT_TRUE(callback.tryDequeue(item));
+  EXPECT_TRUE(ready.isReady());
+
+  // Unblocked, a new wait is ready immediately
+  EXPECT_TRUE(callback.awaitReadyToConsume().isReady());
+}
+
+TEST(BoundedQueueCallbackTest, DropsObjectsWhenFull) {
+  BoundedQueueCallback callback(2, 2, 1);
+  callback.onObject(header(0), folly::IOBuf::copyBuffer("x"));
+  callback.onObject(header(1), folly::IOBuf::copyBuffer("x"));
+  callback.onObject(header(2), folly::IOBuf::copyBuffer("x"));
+  EXPECT_EQ(callback.dropped(), 1);
+  EXPECT_EQ(callback.sizeGuess(), 2);
+}
+
+TEST(BoundedQueueCallbackTest, KeepsStatusAndEndWhenFull) {
+  BoundedQueueCallback callback(2, 2, 1);
+  callback.onObject(header(0), folly::IOBuf::copyBuffer("x"));
+  callback.onObject(header(1), folly::IOBuf::copyBuffer("x"));
+  auto status = header(2);
+  status.status = ObjectStatus::END_OF_GROUP;
+  callback.onObjectStatus(status);
+  // Queued behind the overflow, so dropped
+  callback.onObject(header(3), folly::IOBuf::copyBuffer("x"));
+  callback.onEndOfStream();
+  EXPECT_EQ(callback.dropped(), 1);
+
+  BoundedQueueCallback::Item item;
+  ASSERT_TRUE(callback.tryDequeue(item));
+  EXPECT_EQ(item->header.id, 0);
+  ASSERT_TRUE(callback.tryDequeue(item));
+  EXPECT_EQ(item->header.id, 1);
+  ASSERT_TRUE(callback.tryDequeue(item));
+  EXPECT_EQ(item->header.status, ObjectStatus::END_OF_GROUP);
+  ASSERT_TRUE(callback.tryDequeue(item));
+  EXPECT_TRUE(item.hasError());
+  EXPECT_FALSE(callback.tryDequeue(item));
+
+  // Drained, new objects go through the ring again
+  callback.onObject(header(4), folly::IOBuf::copyBuffer("x"));
+  ASSERT_TRUE(callback.tryDequeue(item));
+  EXPECT_EQ(item->header.id, 4);
+  EXPECT_EQ(callback.dropped(), 1);
+}
+
+TEST(BoundedQueueCallbackTest, ConsumerThread) {
+  constexpr uint64_t kObjects = 10000;
+  BoundedQueueCallback callback(64);
+  std::thread consumer([&callback] {
+    uint64_t expected = 0;
+    BoundedQueueCallback::Item item;
+    while (true) {
+      if (!callback.tryDequeue(item)) {
+        std::this_thread::yield();
+        continue;
+      }
+      if (item.hasError()) {
+        break;
+      }
+      EXPECT_EQ(item->header.id, expected++);
+    }
+    EXPECT_EQ(expected, kObjects);
+  });
+  for (uint64_t i = 0; i < kObjects; i++) {
+    auto state = callback.onObject(header(i), folly::IOBuf::copyBuffer("x"));
+    if (state == ObjectReceiverCallback::FlowControlState::BLOCKED) {
+      callback.awaitReadyToConsume().wait();
+    }
+  }
+  callback.onEndOfStream();
+  consumer.join();
+  EXPECT_EQ(callback.dropped(), 0);
+}
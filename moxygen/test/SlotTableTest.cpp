@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <moxygen/MoQFramer.h>
+#include <moxygen/util/SlotTable.h>
+
+#include <folly/Conv.h>
+#include <folly/portability/GTest.h>
+
+#include <set>
+
+using namespace moxygen;
+
+namespace {
+
+using Table = SlotTable<RequestID, std::string>;
+
+TEST(SlotTableTest, FindEmplaceErase) {
+  Table table;
+  EXPECT_TRUE(table.empty());
+  EXPECT_TRUE(table.emplace(RequestID(2), "two").second);
+  EXPECT_FALSE(table.emplace(RequestID(2), "again").second);
+  EXPECT_TRUE(table.try_emplace(RequestID(4), "four").second);
+  EXPECT_EQ(table.size(), 2);
+  EXPECT_EQ(table.find(RequestID(2))->second, "two");
+  EXPECT_EQ(table.find(RequestID(6)), table.end());
+  // Shares a slot with 2, but isn't it
+  EXPECT_EQ(table.find(RequestID(2 + Table::kInitialSlots)), table.end());
+
+  table.erase(table.find(RequestID(2)));
+  EXPECT_EQ(table.find(RequestID(2)), table.end());
+  EXPECT_EQ(table.erase(RequestID(4)), 1);
+  EXPECT_EQ(table.erase(RequestID(4)), 0);
+  EXPECT_TRUE(table.empty());
+}
+
+TEST(SlotTableTest, IncreasingIDsReuseSlots) {
+  Table table;
+  for (uint64_t id = 0; id < 100 * Table::kInitialSlots; id += 2) {
+    EXPECT_TRUE(table.emplace(RequestID(id), "id").second);
+    if (id >= 4) {
+      EXPECT_EQ(table.erase(RequestID(id - 4)), 1);
+    }
+  }
+  EXPECT_EQ(table.size(), 2);
+}
+
+TEST(SlotTableTest, CollisionsGrowThenOverflow) {
+  Table table;
+  // Every ID lands on slot 0 until the table is at its largest
+  std::vector<uint64_t> ids;
+  for (uint64_t i = 0; i < 4; i++) {
+    ids.push_back(i * Table::kMaxSlots);
+  }
+  for (auto id : ids) {
+    EXPECT_TRUE(
+        table.emplace(RequestID(id), folly::to<std::string>(id)).second);
+  }
+  EXPECT_EQ(table.size(), ids.size());
+  for (auto id : ids) {
+    auto it = table.find(RequestID(id));
+    ASSERT_NE(it, table.end());
+    EXPECT_EQ(it->second, folly::to<std::string>(id));
+  }
+
+  // Iteration covers direct and overflowed entries
+  std::set<uint64_t> seen;
+  for (const auto& [key, value] : table) {
+    seen.insert(key.value);
+  }
+  EXPECT_EQ(seen, std::set<uint64_t>(ids.begin(), ids.end()));
+
+  // Overflowed entries are found after the direct entry is erased
+  EXPECT_EQ(table.erase(RequestID(0)), 1);
+  EXPECT_EQ(
+      table.find(RequestID(Table::kMaxSlots))->second,
+      folly::to<std::string>(Table::kMaxSlots));
+  table.clear();
+  EXPECT_TRUE(table.empty());
+  EXPECT_EQ(table.begin(), table.end());
+}
+
+TEST(SlotTableTest, GrowMovesOverflowIntoFreeSlots) {
+  SlotTable<TrackAlias, int> table;
+  table.emplace(TrackAlias(1), 1);
+  table.emplace(TrackAlias(1 + Table::kInitialSlots), 2);
+  table.emplace(TrackAlias(3), 3);
+  EXPECT_EQ(table.size(), 3);
+  EXPECT_EQ(table.find(TrackAlias(1))->second, 1);
+  EXPECT_EQ(table.find(TrackAlias(1 + Table::kInitialSlots))->second, 2);
+  EXPECT_EQ(table.find(TrackAlias(3))->second, 3);
+  int sum = 0;
+  for (auto& entry : table) {
+    sum += entry.second;
+  }
+  EXPECT_EQ(sum, 6);
+}
+
+} // namespace
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace moxygen {
+
+// Free lists of small fixed size blocks, carved from slabs that are only
+// released with the pool.  For objects allocated and freed at a high rate on
+// one thread, so a long running process recycles their memory rather than
+// going back to malloc each time.  Larger blocks go to the heap.
+//
+// Not thread safe.
+class BlockPool {
+ public:
+  static constexpr size_t kGranularity = 16;
+  static constexpr size_t kMaxBlockSize = 512;
+  static constexpr size_t kSlabSize = 64 * 1024;
+
+  BlockPool() = default;
+  BlockPool(const BlockPool&) = delete;
+  BlockPool& operator=(const BlockPool&) = delete;
+  ~BlockPool() {
+    for (auto slab : slabs_) {
+      ::operator delete(slab);
+    }
+  }
+
+  void* allocate(size_t bytes) {
+    if (bytes > kMaxBlockSize) {
+      return ::operator new(bytes);
+    }
+    auto& head = freeLists_[sizeClass(bytes)];
+    if (!head) {
+      refill(sizeClass(bytes));
+    }
+    auto block = head;
+    head = block->next;
+    allocatedBlocks_++;
+    return block;
+  }
+
+  void deallocate(void* ptr, size_t bytes) noexcept {
+    if (bytes > kMaxBlockSize) {
+      ::operator delete(ptr);
+      return;
+    }
+    auto block = static_cast<FreeBlock*>(ptr);
+    auto& head = freeLists_[sizeClass(bytes)];
+    block->next = head;
+    head = block;
+    allocatedBlocks_--;
+  }
+
+  // Pooled blocks currently handed out
+  size_t allocatedBlocks() const {
+    return allocatedBlocks_;
+  }
+
+  size_t slabBytes() const {
+    return slabs_.size() * kSlabSize;
+  }
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  static size_t sizeClass(size_t bytes) {
+    return (std::max<size_t>(bytes, 1) + kGranularity - 1) / kGranularity - 1;
+  }
+
+  void refill(size_t sizeClass) {
+    static_assert(kGranularity <= alignof(std::max_align_t));
+    auto blockSize = (sizeClass + 1) * kGranularity;
+    auto slab = static_cast<uint8_t*>(::operator new(kSlabSize));
+    slabs_.push_back(slab);
+    auto& head = freeLists_[sizeClass];
+    for (size_t offset = 0; offset + blockSize <= kSlabSize;
+         offset += blockSize) {
+      auto block = reinterpret_cast<FreeBlock*>(slab + offset);
+      block->next = head;
+      head = block;
+    }
+  }
+
+  std::array<FreeBlock*, kMaxBlockSize / kGranularity> freeLists_{};
+  std::vector<void*> slabs_;
+  size_t allocatedBlocks_{0};
+};
+
+// Allocator drawing from a BlockPool, for std::allocate_shared and
+// containers.  Every allocation keeps the pool alive.  Without a pool it
+// allocates from the heap.
+template <typename T>
+class PoolAllocator {
+ public:
+  using value_type = T;
+
+  PoolAllocator() noexcept = default;
+  explicit PoolAllocator(std::shared_ptr<BlockPool> pool) noexcept
+      : pool_(std::move(pool)) {}
+  template <typename U>
+  /* implicit */ PoolAllocator(const PoolAllocator<U>& other) noexcept
+      : pool_(other.pool()) {}
+
+  T* allocate(size_t n) {
+    static_assert(alignof(T) <= BlockPool::kGranularity);
+    if (!pool_) {
+      return std::allocator<T>().allocate(n);
+    }
+    return static_cast<T*>(pool_->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, size_t n) noexcept {
+    if (!pool_) {
+      std::allocator<T>().deallocate(ptr, n);
+      return;
+    }
+    pool_->deallocate(ptr, n * sizeof(T));
+  }
+
+  const std::shared_ptr<BlockPool>& pool() const {
+    return pool_;
+  }
+
+  template <typename U>
+  bool operator==(const PoolAllocator<U>& other) const {
+    return pool_ == other.pool();
+  }
+  template <typename U>
+  bool operator!=(const PoolAllocator<U>& other) const {
+    return pool_ != other.pool();
+  }
+
+ private:
+  std::shared_ptr<BlockPool> pool_;
+};
+
+} // namespace moxygen
@@ -1,9 +1,18 @@
 #pragma once
 
-namespace moxygen {
+#include <folly/logging/xlog.h>
 
 #include <map>
+#include <vector>
+
+namespace moxygen {
 
+// Set of half-open intervals [start, end), keyed by their initial start.
+// Intervals are expected not to overlap.  If they do, lookups only consider
+// the interval with the greatest start at or before the index.
+//
+// An interval's start may be advanced in place (eg: as a fetch progresses),
+// but never moved before the key it was inserted with.
 template <typename T1, typename T2>
 class FetchIntervalSet {
  public:
@@ -13,30 +22,61 @@ class FetchIntervalSet {
     T2 value;
   };
 
-  using IntervalMap = std::map<T1, Interval>;
+  using IntervalMap = std::multimap<T1, Interval>;
   // Insert a new interval into the set
   typename IntervalMap::iterator insert(T1 start, T1 end, T2 value) {
-    XLOG(DBG1) << "insert " << start << " " << end;
-    return intervals_.emplace(start, Interval{start, end, value}).first;
+    XLOG(DBG4) << "insert " << start << " " << end;
+    return intervals_.emplace(start, Interval{start, end, value});
   }
 
   void erase(typename IntervalMap::iterator it) {
-    XLOG(DBG1) << "erase " << it->first;
+    XLOG(DBG4) << "erase " << it->first;
     intervals_.erase(it);
   }
 
+  bool empty() const {
+    return intervals_.empty();
+  }
+
+  size_t size() const {
+    return intervals_.size();
+  }
+
   // Get the data associated with the given index
   T2* getValue(T1 index) {
-    for (auto& entry : intervals_) {
-      XLOG(DBG1) << "Checking entry " << index << " " << entry.first << " "
-                 << entry.second.end;
-      if (index >= entry.second.start && index < entry.second.end) {
-        return &entry.second.value;
-      }
+    auto it = intervals_.upper_bound(index);
+    if (it == intervals_.begin()) {
+      return nullptr;
+    }
+    --it;
+    if (index >= it->second.start && index < it->second.end) {
+      return &it->second.value;
     }
     return nullptr;
   }
 
+  // Returns the intervals intersecting [start, end), ordered by start.
+  // Pointers are invalidated when the interval is erased.
+  std::vector<Interval*> getIntersecting(T1 start, T1 end) {
+    std::vector<Interval*> result;
+    if (!(start < end)) {
+      return result;
+    }
+    auto it = intervals_.upper_bound(start);
+    if (it != intervals_.begin()) {
+      auto prev = std::prev(it);
+      if (start < prev->second.end && prev->second.start < end) {
+        result.push_back(&prev->second);
+      }
+    }
+    for (; it != intervals_.end() && it->first < end; ++it) {
+      if (it->second.start < end && start < it->second.end) {
+        result.push_back(&it->second);
+      }
+    }
+    return result;
+  }
+
  private:
   IntervalMap intervals_;
 };
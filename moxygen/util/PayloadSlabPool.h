@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/io/Cursor.h>
+#include <folly/io/IOBuf.h>
+
+#include <sys/mman.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace moxygen {
+
+// Packs payloads into large slabs, each copy aligned to a cache line.  For
+// payloads that are kept a long time, like cached objects, which would
+// otherwise pin the oversized and fragmented buffers they arrived in.
+//
+// Copies are allocated on one thread, the one owning the pool, and may be
+// freed on any.  A slab goes back to the pool once every payload in it is
+// freed, so one long lived payload keeps its whole slab.  Slabs can outlive
+// the pool.
+class PayloadSlabPool {
+ public:
+  static constexpr size_t kAlignment = 64;
+  static constexpr size_t kDefaultSlabSize = 256 * 1024;
+  static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+  static constexpr size_t kMaxFreeSlabs = 16;
+
+  // With hugePages, slabs are hugepage sized and aligned, and advised to be
+  // backed by transparent hugepages
+  explicit PayloadSlabPool(
+      size_t slabSize = kDefaultSlabSize,
+      bool hugePages = false)
+      : shared_(std::make_shared<Shared>(
+            hugePages ? kHugePageSize : roundUp(slabSize), hugePages)) {}
+  PayloadSlabPool(const PayloadSlabPool&) = delete;
+  PayloadSlabPool& operator=(const PayloadSlabPool&) = delete;
+  ~PayloadSlabPool() {
+    retireCurrent();
+  }
+
+  // Payloads larger than this are not packed
+  size_t maxPayloadSize() const {
+    return (shared_->slabSize - kHeaderSize) / 8;
+  }
+
+  // A copy of payload in one buffer from a slab.  Returns nullptr if
+  // payload is empty or too large to pack.
+  std::unique_ptr<folly::IOBuf> copy(const folly::IOBuf& payload) {
+    auto length = payload.computeChainDataLength();
+    if (length == 0 || length > maxPayloadSize()) {
+      return nullptr;
+    }
+    auto reserved = roundUp(length);
+    if (!current_ || current_->used + reserved > shared_->slabSize) {
+      retireCurrent();
+      current_ = shared_->getSlab();
+    }
+    auto data = reinterpret_cast<uint8_t*>(current_) + current_->used;
+    current_->used += reserved;
+    current_->refs.fetch_add(1, std::memory_order_relaxed);
+    folly::io::Cursor(&payload).pull(data, length);
+    return folly::IOBuf::takeOwnership(
+        data, length, 0, length, &PayloadSlabPool::release, current_);
+  }
+
+  // Slabs allocated and not yet freed, whether in use or free
+  size_t slabBytes() const {
+    return shared_->allocatedSlabs.load(std::memory_order_relaxed) *
+        shared_->slabSize;
+  }
+
+ private:
+  struct Shared;
+
+  // At the start of each slab, the payloads follow
+  struct alignas(kAlignment) Slab {
+    // Payloads in the slab, plus one while it is the pool's current slab
+    std::atomic<size_t> refs{1};
+    size_t used{0};
+    std::shared_ptr<Shared> shared;
+  };
+  static constexpr size_t kHeaderSize = sizeof(Slab);
+
+  struct Shared : std::enable_shared_from_this<Shared> {
+    Shared(size_t size, bool huge) : slabSize(size), hugePages(huge) {}
+    ~Shared() {
+      for (auto slab : freeSlabs) {
+        freeMemory(slab);
+      }
+    }
+
+    Slab* getSlab() {
+      void* mem = nullptr;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!freeSlabs.empty()) {
+          mem = freeSlabs.back();
+          freeSlabs.pop_back();
+        }
+      }
+      if (!mem) {
+        mem = allocateMemory();
+        allocatedSlabs.fetch_add(1, std::memory_order_relaxed);
+      }
+      auto slab = new (mem) Slab();
+      slab->used = kHeaderSize;
+      slab->shared = shared_from_this();
+      return slab;
+    }
+
+    // The last reference to slab is gone
+    void putSlab(Slab* slab) {
+      // May destroy this
+      auto self = std::move(slab->shared);
+      slab->~Slab();
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (freeSlabs.size() < kMaxFreeSlabs) {
+          freeSlabs.push_back(slab);
+          return;
+        }
+      }
+      freeMemory(slab);
+    }
+
+    void* allocateMemory() {
+      auto mem = std::aligned_alloc(
+          hugePages ? kHugePageSize : kAlignment, slabSize);
+      if (!mem) {
+        throw std::bad_alloc();
+      }
+#ifdef MADV_HUGEPAGE
+      if (hugePages) {
+        madvise(mem, slabSize, MADV_HUGEPAGE);
+      }
+#endif
+      return mem;
+    }
+
+    void freeMemory(void* mem) {
+      std::free(mem);
+      allocatedSlabs.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    const size_t slabSize;
+    const bool hugePages;
+    std::atomic<size_t> allocatedSlabs{0};
+    std::mutex mutex;
+    std::vector<void*> freeSlabs;
+  };
+
+  static size_t roundUp(size_t bytes) {
+    return (bytes + kAlignment - 1) / kAlignment * kAlignment;
+  }
+
+  static void unref(Slab* slab) {
+    if (slab->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      slab->shared->putSlab(slab);
+    }
+  }
+
+  static void release(void* /*buf*/, void* userData) {
+    unref(static_cast<Slab*>(userData));
+  }
+
+  void retireCurrent() {
+    if (current_) {
+      unref(std::exchange(current_, nullptr));
+    }
+  }
+
+  std::shared_ptr<Shared> shared_;
+  Slab* current_{nullptr};
+};
+
+} // namespace moxygen
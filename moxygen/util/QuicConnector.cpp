@@ -70,25 +70,43 @@ QuicConnector::connectQuic(
     folly::SocketAddress connectAddr,
     std::chrono::milliseconds timeoutMs,
     std::shared_ptr<fizz::CertificateVerifier> verifier,
-    std::string alpn) {
+    std::string alpn,
+    std::shared_ptr<quic::QuicPskCache> pskCache,
+    std::string hostname) {
   auto qEvb = std::make_shared<quic::FollyQuicEventBase>(eventBase);
   auto sock = std::make_unique<quic::FollyQuicAsyncUDPSocket>(qEvb);
   auto fizzContext = std::make_shared<fizz::client::FizzClientContext>();
   fizzContext->setSupportedAlpns({alpn});
+  bool earlyData = pskCache != nullptr;
+  if (earlyData) {
+    fizzContext->setSendEarlyData(true);
+  }
   auto quicClient = quic::QuicClientTransport::newClient(
       std::move(qEvb),
       std::move(sock),
       quic::FizzClientQuicHandshakeContext::Builder()
           .setFizzClientContext(fizzContext)
           .setCertificateVerifier(std::move(verifier))
+          .setPskCache(std::move(pskCache))
           .build(),
       /*connectionIdSize=*/0);
+  if (earlyData) {
+    quicClient->setHostname(hostname);
+    // MoQ carries no transport-level app params, 0-RTT is only valid for
+    // the same ALPN
+    quicClient->setEarlyDataAppParamsFunctions(
+        [alpn](const auto& negotiatedAlpn, const auto&) {
+          return negotiatedAlpn && *negotiatedAlpn == alpn;
+        },
+        []() -> std::unique_ptr<folly::IOBuf> { return nullptr; });
+  }
   quic::TransportSettings ts;
   ts.copaDeltaParam = 0.05;
   ts.defaultCongestionController = quic::CongestionControlType::Copa;
   ts.pacingEnabled = true;
   ts.experimentalPacer = true;
   ts.datagramConfig.enabled = true;
+  ts.attemptEarlyData = earlyData;
   quicClient->setTransportSettings(ts);
   quicClient->addNewPeerAddress(connectAddr);
   quicClient->setSupportedVersions({quic::QuicVersion::QUIC_V1});
@@ -7,7 +7,8 @@
 
 namespace quic {
 class QuicClientTransport;
-}
+class QuicPskCache;
+} // namespace quic
 
 namespace moxygen {
 
@@ -19,7 +20,11 @@ class QuicConnector {
       folly::SocketAddress connectAddr,
       std::chrono::milliseconds timeoutMs,
       std::shared_ptr<fizz::CertificateVerifier> verifier,
-      std::string alpn = "moq-00");
+      std::string alpn = "moq-00",
+      // With a PSK cache, resumed connections attempt 0-RTT and complete
+      // without waiting for the handshake.  hostname keys the cache.
+      std::shared_ptr<quic::QuicPskCache> pskCache = nullptr,
+      std::string hostname = {});
 };
 
 } // namespace moxygen
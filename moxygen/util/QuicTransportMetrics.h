@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <moxygen/MoQSession.h>
+#include <quic/api/QuicSocket.h>
+
+namespace moxygen {
+
+inline MoQTransportMetrics getQuicTransportMetrics(
+    const quic::QuicSocket& socket) {
+  auto info = socket.getTransportInfo();
+  MoQTransportMetrics metrics;
+  metrics.srtt = info.srtt;
+  metrics.rttVar = info.rttvar;
+  metrics.minRtt = info.maybeMinRtt.value_or(std::chrono::microseconds(0));
+  metrics.congestionWindow = info.congestionWindow;
+  metrics.bytesInFlight = info.bytesInFlight;
+  metrics.writableBytes = info.writableBytes;
+  if (info.pacingInterval.count() > 0) {
+    // pacingBurstSize packets go out every pacingInterval
+    metrics.pacingRateBps = info.pacingBurstSize * info.mss * 8 * 1000000 /
+        info.pacingInterval.count();
+  }
+  metrics.packetsSent = info.totalPacketsSent;
+  metrics.packetsLost = info.totalPacketsMarkedLost;
+  metrics.maxDatagramSize = socket.getDatagramSizeLimit();
+  return metrics;
+}
+
+// For MoQSession::setTransportMetricsProvider.  The session doesn't keep
+// the socket alive.
+inline MoQSession::TransportMetricsProvider quicTransportMetricsProvider(
+    std::weak_ptr<quic::QuicSocket> socket) {
+  return [socket =
+              std::move(socket)]() -> folly::Optional<MoQTransportMetrics> {
+    auto locked = socket.lock();
+    if (!locked || !locked->good()) {
+      return folly::none;
+    }
+    return getQuicTransportMetrics(*locked);
+  };
+}
+
+} // namespace moxygen
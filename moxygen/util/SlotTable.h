@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/container/F14Map.h>
+
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace moxygen {
+
+// Map from a densely allocated ID (RequestID, TrackAlias) to a value,
+// indexed directly by the low bits of the ID.  Each slot keeps its full key,
+// checked on lookup, so a later ID landing on the slot of an earlier one is
+// never mistaken for it.  When two live IDs share a slot the table doubles,
+// up to kMaxSlots, after which the newer ID goes to a hash map.  IDs that
+// only grow, as request IDs do, keep reusing the same slots.
+//
+// Iterators follow F14 semantics: inserting invalidates them, erasing only
+// invalidates the erased entry.
+template <typename Key, typename Value, typename Hash = typename Key::hash>
+class SlotTable {
+  using Overflow = folly::F14FastMap<Key, Value, Hash>;
+
+ public:
+  using value_type = std::pair<const Key, Value>;
+  static constexpr size_t kInitialSlots = 16;
+  static constexpr size_t kMaxSlots = 4096;
+
+  template <bool IsConst>
+  class Iterator {
+    using Table = std::conditional_t<IsConst, const SlotTable, SlotTable>;
+    using OverflowIt = std::conditional_t<
+        IsConst,
+        typename Overflow::const_iterator,
+        typename Overflow::iterator>;
+
+   public:
+    using value_type = SlotTable::value_type;
+    using reference =
+        std::conditional_t<IsConst, const value_type&, value_type&>;
+    using pointer = std::conditional_t<IsConst, const value_type*, value_type*>;
+
+    Iterator(Table* table, size_t slot, OverflowIt overflowIt)
+        : table_(table), slot_(slot), overflowIt_(overflowIt) {
+      skipEmpty();
+    }
+    /* implicit */ Iterator(const Iterator<false>& other)
+      requires IsConst
+        : table_(other.table_),
+          slot_(other.slot_),
+          overflowIt_(other.overflowIt_) {}
+
+    reference operator*() const {
+      return inSlots() ? *table_->slots_[slot_] : *overflowIt_;
+    }
+    pointer operator->() const {
+      return &**this;
+    }
+    Iterator& operator++() {
+      if (inSlots()) {
+        slot_++;
+        skipEmpty();
+      } else {
+        ++overflowIt_;
+      }
+      return *this;
+    }
+    bool operator==(const Iterator& other) const {
+      return slot_ == other.slot_ &&
+          (inSlots() || overflowIt_ == other.overflowIt_);
+    }
+
+   private:
+    friend class SlotTable;
+    template <bool>
+    friend class Iterator;
+
+    bool inSlots() const {
+      return slot_ < table_->slots_.size();
+    }
+    void skipEmpty() {
+      while (inSlots() && !table_->slots_[slot_]) {
+        slot_++;
+      }
+    }
+
+    Table* table_;
+    size_t slot_;
+    OverflowIt overflowIt_;
+  };
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  SlotTable() : slots_(kInitialSlots) {}
+
+  iterator begin() {
+    return iterator(this, 0, overflow_.begin());
+  }
+  iterator end() {
+    return iterator(this, slots_.size(), overflow_.end());
+  }
+  const_iterator begin() const {
+    return const_iterator(this, 0, overflow_.begin());
+  }
+  const_iterator end() const {
+    return const_iterator(this, slots_.size(), overflow_.end());
+  }
+
+  iterator find(const Key& key) {
+    auto slot = slotFor(key);
+    if (slots_[slot] && slots_[slot]->first == key) {
+      return iterator(this, slot, overflow_.end());
+    }
+    if (overflow_.empty()) {
+      return end();
+    }
+    return iterator(this, slots_.size(), overflow_.find(key));
+  }
+  const_iterator find(const Key& key) const {
+    return const_cast<SlotTable*>(this)->find(key);
+  }
+
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args) {
+    auto it = find(key);
+    if (it != end()) {
+      return {it, false};
+    }
+    size_++;
+    while (true) {
+      auto slot = slotFor(key);
+      if (!slots_[slot]) {
+        slots_[slot].emplace(
+            std::piecewise_construct,
+            std::forward_as_tuple(key),
+            std::forward_as_tuple(std::forward<Args>(args)...));
+        return {iterator(this, slot, overflow_.end()), true};
+      }
+      if (slots_.size() >= kMaxSlots) {
+        auto overflowIt =
+            overflow_.try_emplace(key, std::forward<Args>(args)...).first;
+        return {iterator(this, slots_.size(), overflowIt), true};
+      }
+      grow();
+    }
+  }
+  template <typename V>
+  std::pair<iterator, bool> emplace(const Key& key, V&& value) {
+    return try_emplace(key, std::forward<V>(value));
+  }
+
+  void erase(iterator it) {
+    if (it.inSlots()) {
+      slots_[it.slot_].reset();
+    } else {
+      overflow_.erase(it.overflowIt_);
+    }
+    size_--;
+  }
+  size_t erase(const Key& key) {
+    auto it = find(key);
+    if (it == end()) {
+      return 0;
+    }
+    erase(it);
+    return 1;
+  }
+
+  void clear() {
+    for (auto& slot : slots_) {
+      slot.reset();
+    }
+    overflow_.clear();
+    size_ = 0;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+  bool empty() const {
+    return size_ == 0;
+  }
+
+ private:
+  size_t slotFor(const Key& key) const {
+    return key.value & (slots_.size() - 1);
+  }
+
+  // Entries distinct under the old mask stay distinct under the new one, and
+  // overflowed entries move in where their slot is now free
+  void grow() {
+    std::vector<std::optional<value_type>> slots(slots_.size() * 2);
+    std::swap(slots, slots_);
+    for (auto& entry : slots) {
+      if (entry) {
+        slots_[slotFor(entry->first)].emplace(std::move(*entry));
+      }
+    }
+    for (auto it = overflow_.begin(); it != overflow_.end();) {
+      auto& slot = slots_[slotFor(it->first)];
+      if (slot) {
+        ++it;
+        continue;
+      }
+      slot.emplace(it->first, std::move(it->second));
+      it = overflow_.erase(it);
+    }
+  }
+
+  std::vector<std::optional<value_type>> slots_;
+  Overflow overflow_;
+  size_t size_{0};
+};
+
+} // namespace moxygen
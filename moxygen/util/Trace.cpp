@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "moxygen/util/Trace.h"
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace moxygen {
+
+namespace {
+struct Event {
+  const char* name;
+  int64_t startNs;
+  int64_t durationNs;
+  uint64_t track;
+  uint64_t group;
+  uint64_t object;
+};
+
+// Only the owning thread appends, the lock is uncontended except while stop
+// reads the buffer
+struct ThreadBuffer {
+  std::mutex mutex;
+  std::vector<Event> events;
+  int64_t tid{0};
+};
+
+struct Buffers {
+  std::mutex mutex;
+  // Buffers outlive their threads so stop can read them
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  // steady_clock time of start, spans are written relative to it
+  std::atomic<int64_t> epochNs{0};
+};
+
+Buffers& buffers() {
+  static auto* buffers = new Buffers();
+  return *buffers;
+}
+
+ThreadBuffer& threadBuffer() {
+  thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+    auto threadBuffer = std::make_shared<ThreadBuffer>();
+    threadBuffer->tid = syscall(SYS_gettid);
+    auto& all = buffers();
+    std::lock_guard<std::mutex> lock(all.mutex);
+    all.buffers.push_back(threadBuffer);
+    return threadBuffer;
+  }();
+  return *buffer;
+}
+
+int64_t toNs(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+
+// Chrome trace timestamps are microseconds, fractions allowed
+void writeMicros(std::ostream& out, int64_t ns) {
+  out << ns / 1000 << '.' << char('0' + ns / 100 % 10)
+      << char('0' + ns / 10 % 10) << char('0' + ns % 10);
+}
+} // namespace
+
+std::atomic<bool> Tracer::enabled_{false};
+
+void Tracer::start() {
+  buffers().epochNs.store(
+      toNs(std::chrono::steady_clock::now().time_since_epoch()),
+      std::memory_order_relaxed);
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+bool Tracer::stop(const std::string& path) {
+  enabled_.store(false, std::memory_order_relaxed);
+  std::ofstream out(path, std::ios::trunc);
+  auto& all = buffers();
+  std::lock_guard<std::mutex> lock(all.mutex);
+  out << "{\"traceEvents\":[";
+  bool first = true;
+  for (auto& buffer : all.buffers) {
+    std::vector<Event> events;
+    {
+      std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+      events.swap(buffer->events);
+    }
+    for (const auto& event : events) {
+      out << (first ? "\n" : ",\n") << "{\"name\":\"" << event.name
+          << "\",\"ph\":\"X\",\"pid\":" << getpid()
+          << ",\"tid\":" << buffer->tid << ",\"ts\":";
+      writeMicros(out, event.startNs);
+      out << ",\"dur\":";
+      writeMicros(out, event.durationNs);
+      out << ",\"args\":{\"track\":" << event.track
+          << ",\"group\":" << event.group << ",\"object\":" << event.object
+          << "}}";
+      first = false;
+    }
+  }
+  out << "\n]}\n";
+  out.close();
+  return bool(out);
+}
+
+void Tracer::record(
+    const char* name,
+    std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end,
+    uint64_t track,
+    uint64_t group,
+    uint64_t object) {
+  auto& buffer = threadBuffer();
+  auto startNs = toNs(start.time_since_epoch()) -
+      buffers().epochNs.load(std::memory_order_relaxed);
+  if (startNs < 0) {
+    // Began before start
+    return;
+  }
+  std::lock_guard<std::mutex> lock(buffer.mutex);
+  if (buffer.events.size() >= kMaxEventsPerThread) {
+    return;
+  }
+  buffer.events.push_back(
+      {name, startNs, toNs(end - start), track, group, object});
+}
+
+} // namespace moxygen
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Per-object trace spans, compiled in with the MOXYGEN_TRACE build option
+// and recorded between Tracer::start and Tracer::stop.  stop writes a Chrome
+// trace event file, which Perfetto and chrome://tracing open.
+//
+//   MOXYGEN_TRACE_SPAN("MoQForwarder::object", track, group, object);
+//
+// Spans last until the end of the enclosing scope.  track is the track alias
+// where the code has one, and the FullTrackName hash where it doesn't.  The
+// tag arguments are only evaluated while recording.
+
+namespace moxygen {
+
+class Tracer {
+ public:
+  // Spans recorded per thread before further spans on it are dropped
+  static constexpr size_t kMaxEventsPerThread = 1 << 20;
+
+  static void start();
+  // Writes the spans recorded since start to path and clears them.  Returns
+  // false if the file can't be written.
+  static bool stop(const std::string& path);
+
+  static bool enabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  static void record(
+      const char* name,
+      std::chrono::steady_clock::time_point start,
+      std::chrono::steady_clock::time_point end,
+      uint64_t track,
+      uint64_t group,
+      uint64_t object);
+
+ private:
+  static std::atomic<bool> enabled_;
+};
+
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char* name) : name_(name) {
+    if (Tracer::enabled()) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+  ~TraceSpan() {
+    if (active()) {
+      Tracer::record(
+          name_,
+          start_,
+          std::chrono::steady_clock::now(),
+          track_,
+          group_,
+          object_);
+    }
+  }
+
+  bool active() const {
+    return start_ != std::chrono::steady_clock::time_point();
+  }
+
+  void tag(uint64_t track, uint64_t group, uint64_t object) {
+    track_ = track;
+    group_ = group;
+    object_ = object;
+  }
+
+ private:
+  const char* name_;
+  std::chrono::steady_clock::time_point start_;
+  uint64_t track_{0};
+  uint64_t group_{0};
+  uint64_t object_{0};
+};
+
+} // namespace moxygen
+
+#define MOXYGEN_TRACE_CONCAT_IMPL(a, b) a##b
+#define MOXYGEN_TRACE_CONCAT(a, b) MOXYGEN_TRACE_CONCAT_IMPL(a, b)
+
+#if MOXYGEN_TRACE
+#define MOXYGEN_TRACE_SPAN_VAR MOXYGEN_TRACE_CONCAT(moxygenTraceSpan, __LINE__)
+#define MOXYGEN_TRACE_SPAN(name, track, group, object) \
+  ::moxygen::TraceSpan MOXYGEN_TRACE_SPAN_VAR(name);    \
+  if (MOXYGEN_TRACE_SPAN_VAR.active()) {                \
+    MOXYGEN_TRACE_SPAN_VAR.tag(track, group, object);   \
+  }
+#else
+#define MOXYGEN_TRACE_SPAN(name, track, group, object) \
+  do {                                                 \
+  } while (false)
+#endif